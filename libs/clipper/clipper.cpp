@@ -51,9 +51,12 @@
 namespace ClipperLib {
 
 #ifdef use_int32
-  static cInt const loRange = 46340;
-  static cInt const hiRange = 46340;
+  //the products of coordinates are taken in 64 bits, so all but the top bit of 32 bits can be used
+  static cInt const loRange = 0x3FFFFFFF;
+  static cInt const hiRange = 0x3FFFFFFF;
+  typedef signed long long cWide;
 #else
+  typedef cInt cWide;
   static cInt const loRange = 0x3FFFFFFF;
   static cInt const hiRange = 0x3FFFFFFFFFFFFFFFLL;
   typedef unsigned long long ulong64;
@@ -600,7 +603,7 @@ bool SlopesEqual(const TEdge &e1, const TEdge &e2, bool UseFullInt64Range)
     return Int128Mul(e1.Delta.Y, e2.Delta.X) == Int128Mul(e1.Delta.X, e2.Delta.Y);
   else 
 #endif
-    return e1.Delta.Y * e2.Delta.X == e1.Delta.X * e2.Delta.Y;
+    return (cWide)e1.Delta.Y * e2.Delta.X == (cWide)e1.Delta.X * e2.Delta.Y;
 }
 //------------------------------------------------------------------------------
 
@@ -612,7 +615,7 @@ bool SlopesEqual(const IntPoint pt1, const IntPoint pt2,
     return Int128Mul(pt1.Y-pt2.Y, pt2.X-pt3.X) == Int128Mul(pt1.X-pt2.X, pt2.Y-pt3.Y);
   else 
 #endif
-    return (pt1.Y-pt2.Y)*(pt2.X-pt3.X) == (pt1.X-pt2.X)*(pt2.Y-pt3.Y);
+    return (cWide)(pt1.Y-pt2.Y)*(pt2.X-pt3.X) == (cWide)(pt1.X-pt2.X)*(pt2.Y-pt3.Y);
 }
 //------------------------------------------------------------------------------
 
@@ -624,7 +627,7 @@ bool SlopesEqual(const IntPoint pt1, const IntPoint pt2,
     return Int128Mul(pt1.Y-pt2.Y, pt3.X-pt4.X) == Int128Mul(pt1.X-pt2.X, pt3.Y-pt4.Y);
   else 
 #endif
-    return (pt1.Y-pt2.Y)*(pt3.X-pt4.X) == (pt1.X-pt2.X)*(pt3.Y-pt4.Y);
+    return (cWide)(pt1.Y-pt2.Y)*(pt3.X-pt4.X) == (cWide)(pt1.X-pt2.X)*(pt3.Y-pt4.Y);
 }
 //------------------------------------------------------------------------------
 
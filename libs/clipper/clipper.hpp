@@ -37,7 +37,8 @@
 #define CLIPPER_VERSION "6.1.3"
 
 //use_int32: When enabled 32bit ints are used instead of 64bit ints. This
-//improve performance but coordinate values are limited to the range +/- 46340
+//improve performance but coordinate values are limited to the range +/- 2^30
+//(products are taken in 64 bits). Set by the build rather than here.
 //#define use_int32
 
 //use_xyz: adds a Z member to IntPoint. Adds a minor cost to perfomance.
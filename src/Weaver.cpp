@@ -5,12 +5,14 @@
 #include <unistd.h>
 
 #include "weaveDataStorage.h"
+#include "utils/parallel.h"
 
 namespace cura 
 {
 
-void Weaver::weave(PrintObject* object, CommandSocket* commandSocket)
+void Weaver::weave(PrintObject* object, CommandSocket* commandSocket, const LayerHandler& handle_layer)
 {
+    unsigned int thread_count = getThreadCount(getSettingAsCount("machine_thread_count"));
     int maxz = object->max().z;
 
     int layer_count = (maxz - initial_layer_thickness) / connectionHeight + 1;
@@ -30,11 +32,7 @@ void Weaver::weave(PrintObject* object, CommandSocket* commandSocket)
     { // find first non-empty layer
         for (starting_layer_idx = 0; starting_layer_idx < layer_count; starting_layer_idx++)
         {
-            Polygons parts;
-            for (cura::Slicer* slicer : slicerList)
-                parts.add(slicer->layers[starting_layer_idx].polygonList);  
-            
-            if (parts.size() > 0)
+            if (SlicerLayerView(slicerList, starting_layer_idx).size() > 0)
                 break;
         }
         if (starting_layer_idx > 0)
@@ -43,32 +41,43 @@ void Weaver::weave(PrintObject* object, CommandSocket* commandSocket)
         }
     }
     
-    
-    std::cerr<< "chainifying layers..." << std::endl;
+    wireFrame.layers.clear();
+    wireFrame.bottom_outline.clear();
+    wireFrame.bottom_infill = WeaveRoof();
+    wireFrame.max_layer_count = std::max(0, layer_count - starting_layer_idx - 1);
+    
+    int starting_z = -1;
+    SlicerLayerView(slicerList, starting_layer_idx).addTo(wireFrame.bottom_outline); // kept, since the bottom is filled after the first layer is connected
+    
+    if (commandSocket)
+        commandSocket->sendPolygons(Inset0Type, 0, wireFrame.bottom_outline, 1);
+    
+    wireFrame.z_bottom = slicerList[0]->layers[starting_layer_idx].z;
+    
+    Point starting_point_in_layer;
+    if (wireFrame.bottom_outline.size() > 0)
+        starting_point_in_layer = (wireFrame.bottom_outline.max() + wireFrame.bottom_outline.min()) / 2;
+    else 
+        starting_point_in_layer = (Point(0,0) + object->max() + object->min()) / 2;
+    
+    // The layers are completed a block at a time and handed to handle_layer, after which they are freed, so only the
+    // layers of one block are kept, together with the layer below it and the layer above it.
+    // Chainifying a layer starts close to where the chain of the layer below ended, so the layers are chainified in order.
+    // Then the horizontal parts and the connections of each layer only depend on the chainified outlines of the layer itself
+    // and the layers next to it, and they are generated in parallel.
+    // wireFrame.layers holds the layer below the block (once the first block is done), the block and the layer above it.
+    const unsigned int block_size = thread_count;
+    int layer_idx = starting_layer_idx + 1;
+    unsigned int layer_nr = 0; // the number of the next layer to be handed to handle_layer
+    bool has_layer_below = false;
+    while (true)
     {
-        int starting_z = -1;
-        for (cura::Slicer* slicer : slicerList)
-            wireFrame.bottom_outline.add(slicer->layers[starting_layer_idx].polygonList);
-        
-        if (commandSocket)
-            commandSocket->sendPolygons(Inset0Type, 0, wireFrame.bottom_outline, 1);
-        
-        wireFrame.z_bottom = slicerList[0]->layers[starting_layer_idx].z;
-        
-        Point starting_point_in_layer;
-        if (wireFrame.bottom_outline.size() > 0)
-            starting_point_in_layer = (wireFrame.bottom_outline.max() + wireFrame.bottom_outline.min()) / 2;
-        else 
-            starting_point_in_layer = (Point(0,0) + object->max() + object->min()) / 2;
-        
-        for (int layer_idx = starting_layer_idx + 1; layer_idx < layer_count; layer_idx++)
+        const unsigned int block_start = has_layer_below? 1 : 0;
+        for (; layer_idx < layer_count && wireFrame.layers.size() < block_start + block_size + 1; layer_idx++)
         {
             logProgress("inset", layer_idx+1, layer_count); // abuse the progress system of the normal mode of CuraEngine
             
-            Polygons parts1;
-            for (cura::Slicer* slicer : slicerList)
-                parts1.add(slicer->layers[layer_idx].polygonList);
-
+            SlicerLayerView parts1(slicerList, layer_idx); // the outlines of all meshes, without copying them
             
             Polygons chainified;
 
@@ -91,58 +100,87 @@ void Weaver::weave(PrintObject* object, CommandSocket* commandSocket)
                 starting_point_in_layer = layer.supported.back().back();
             }
         }
-    }
-    
-    std::cerr<< "finding horizontal parts..." << std::endl;
-    {
-        Polygons* lower_top_parts = &wireFrame.bottom_outline;
+        const bool top_block = layer_idx >= layer_count;
+        const unsigned int block_end = (top_block)? wireFrame.layers.size() : wireFrame.layers.size() - 1; // the layer above isn't complete yet
+        if (block_end <= block_start)
+        {
+            break;
+        }
         
-        for (unsigned int layer_idx = 0; layer_idx < wireFrame.layers.size(); layer_idx++)
+        parallelFor(block_end - block_start, thread_count, [&](unsigned int block_idx)
         {
-            logProgress("skin", layer_idx+1, wireFrame.layers.size()); // abuse the progress system of the normal mode of CuraEngine
-            
-            WeaveLayer& layer = wireFrame.layers[layer_idx];
+            unsigned int idx = block_start + block_idx;
+            WeaveLayer& layer = wireFrame.layers[idx];
             
+            Polygons& lower_top_parts = (idx > 0)? wireFrame.layers[idx-1].supported : wireFrame.bottom_outline;
             Polygons empty;
-            Polygons& layer_above = (layer_idx+1 < wireFrame.layers.size())? wireFrame.layers[layer_idx+1].supported : empty;
+            Polygons& layer_above = (idx+1 < wireFrame.layers.size())? wireFrame.layers[idx+1].supported : empty;
             
-            createHorizontalFill(*lower_top_parts, layer, layer_above, layer.z1);
-            lower_top_parts = &layer.supported;
+            createHorizontalFill(lower_top_parts, layer, layer_above, layer.z1);
+        });
+        logProgress("skin", layer_nr + block_end - block_start, wireFrame.max_layer_count); // abuse the progress system of the normal mode of CuraEngine
+        // at this point layer.supported still only contains the polygons to be connected
+        // when connecting layers, we further add the supporting polygons created by the roofs
+        
+        // each layer is supported by the layer below together with its roofs, which have already been added to the layer below the block
+        std::vector<int> layer_z1; // connect_polygons sets the heights of the layers, so they are read beforehand
+        for (WeaveLayer& layer : wireFrame.layers)
+        {
+            layer_z1.push_back(layer.z1);
         }
-    }
-    // at this point layer.supported still only contains the polygons to be connected
-    // when connecting layers, we further add the supporting polygons created by the roofs
-    
-    std::cerr<< "connecting layers..." << std::endl;
-    {
-        Polygons* lower_top_parts = &wireFrame.bottom_outline;
-        int last_z = wireFrame.z_bottom;
-        for (unsigned int layer_idx = 0; layer_idx < wireFrame.layers.size(); layer_idx++) // use top of every layer but the last
+        parallelFor(block_end - block_start, thread_count, [&](unsigned int block_idx)
         {
-            WeaveLayer& layer = wireFrame.layers[layer_idx];
+            unsigned int idx = block_start + block_idx;
+            WeaveLayer& layer = wireFrame.layers[idx];
             
-            connect_polygons(*lower_top_parts, last_z, layer.supported, layer.z1, layer);
-            layer.supported.add(layer.roofs.roof_outlines);
-            lower_top_parts = &layer.supported;
-            
-            last_z = layer.z1;
+            if (idx == 0)
+            {
+                connect_polygons(wireFrame.bottom_outline, wireFrame.z_bottom, layer.supported, layer_z1[idx], layer);
+                return;
+            }
+            WeaveLayer& layer_below = wireFrame.layers[idx-1];
+            Polygons lower_top_parts = layer_below.supported;
+            if (idx > block_start)
+                lower_top_parts.add(layer_below.roofs.roof_outlines);
+            connect_polygons(lower_top_parts, layer_z1[idx-1], layer.supported, layer_z1[idx], layer);
+        });
+        for (unsigned int idx = block_start; idx < block_end; idx++)
+        {
+            wireFrame.layers[idx].supported.add(wireFrame.layers[idx].roofs.roof_outlines);
         }
-    }
-
 
-    { // roofs:
+        if (top_block)
+        { // roofs:
+            WeaveLayer& top_layer = wireFrame.layers[block_end - 1];
+            Polygons to_be_supported; // empty for the top layer
+            fillRoofs(top_layer.supported, to_be_supported, -1, top_layer.z1, top_layer.roofs);
+        }
+        if (layer_nr == 0)
+        { // bottom:
+            Polygons to_be_supported; // is empty for the bottom layer, cause the order of insets doesn't really matter (in a sense everything is to be supported)
+            fillRoofs(wireFrame.bottom_outline, to_be_supported, -1, wireFrame.layers.front().z0, wireFrame.bottom_infill);
+        }
         
-        WeaveLayer& top_layer = wireFrame.layers.back();
-        Polygons to_be_supported; // empty for the top layer
-        fillRoofs(top_layer.supported, to_be_supported, -1, top_layer.z1, top_layer.roofs);
-    }
-    
-    
-    { // bottom:
-        Polygons to_be_supported; // is empty for the bottom layer, cause the order of insets doesn't really matter (in a sense everything is to be supported)
-        fillRoofs(wireFrame.bottom_outline, to_be_supported, -1, wireFrame.layers.front().z0, wireFrame.bottom_infill);
+        for (unsigned int idx = block_start; idx < block_end; idx++)
+        {
+            handle_layer(wireFrame.layers[idx], layer_nr);
+            layer_nr++;
+        }
+        if (top_block)
+        {
+            break;
+        }
+        // keep the top layer of the block, which supports the next block, and the layer above
+        while (wireFrame.layers.size() > 2)
+        {
+            wireFrame.layers.pop_front();
+        }
+        has_layer_below = true;
     }
+    wireFrame.layers.clear();
     
+    for (cura::Slicer* slicer : slicerList)
+        delete slicer;
 }
 
 
@@ -370,40 +408,46 @@ void Weaver::connect(Polygons& parts0, int z0, Polygons& parts1, int z1, WeaveCo
 
 void Weaver::chainify_polygons(Polygons& parts1, Point start_close_to, Polygons& result, bool include_last)
 {
-    
-        
     for (unsigned int prt = 0 ; prt < parts1.size(); prt++)
     {
-        const PolygonRef upperPart = parts1[prt];
-        
-        ClosestPolygonPoint closestInPoly = findClosest(start_close_to, upperPart);
+        chainify_polygon(parts1[prt], start_close_to, result);
+    }
+}
+
+void Weaver::chainify_polygons(const SlicerLayerView& parts1, Point start_close_to, Polygons& result, bool include_last)
+{
+    parts1.forEachPolygon([&](PolygonRef upperPart) { chainify_polygon(upperPart, start_close_to, result); });
+}
+
+void Weaver::chainify_polygon(const PolygonRef upperPart, Point& start_close_to, Polygons& result)
+{
+    ClosestPolygonPoint closestInPoly = findClosest(start_close_to, upperPart);
+
+    
+    PolygonRef part_top = result.newPoly();
+    
+    GivenDistPoint next_upper;
+    bool found = true;
+    int idx = 0;
+    
+    for (Point upper_point = upperPart[closestInPoly.pos]; found; upper_point = next_upper.location)
+    {
+        found = getNextPointWithDistance(upper_point, nozzle_top_diameter, upperPart, idx, closestInPoly.pos, next_upper);
 
         
-        PolygonRef part_top = result.newPoly();
-        
-        GivenDistPoint next_upper;
-        bool found = true;
-        int idx = 0;
-        
-        for (Point upper_point = upperPart[closestInPoly.pos]; found; upper_point = next_upper.location)
+        if (!found) 
         {
-            found = getNextPointWithDistance(upper_point, nozzle_top_diameter, upperPart, idx, closestInPoly.pos, next_upper);
-
-            
-            if (!found) 
-            {
-                break;
-            }
-            
-            part_top.add(upper_point);
-            
-            idx = next_upper.pos;
+            break;
         }
-        if (part_top.size() > 0)
-            start_close_to = part_top.back();
-        else
-            result.remove(result.size()-1);
+        
+        part_top.add(upper_point);
+        
+        idx = next_upper.pos;
     }
+    if (part_top.size() > 0)
+        start_close_to = part_top.back();
+    else
+        result.remove(result.size()-1);
 }
 
 
@@ -420,6 +464,8 @@ void Weaver::connect_polygons(Polygons& supporting, int z0, Polygons& supported,
     result.z1 = z1;
     
     std::vector<WeaveConnectionPart>& parts = result.connections;
+    
+    SegmentGrid supporting_grid(supporting); // each point of supported is connected to the closest point of supporting
         
     for (unsigned int prt = 0 ; prt < supported.size(); prt++)
     {
@@ -437,7 +483,7 @@ void Weaver::connect_polygons(Polygons& supporting, int z0, Polygons& supported,
         for (const Point& upper_point : upperPart)
         {
             
-            ClosestPolygonPoint lowerPolyPoint = findClosest(upper_point, supporting);
+            ClosestPolygonPoint lowerPolyPoint = supporting_grid.findClosest(upper_point);
             Point& lower = lowerPolyPoint.location;
             
             Point3 lower3 = Point3(lower.X, lower.Y, z0);
@@ -1,6 +1,8 @@
 #ifndef WEAVER_H
 #define WEAVER_H
 
+#include <functional>
+
 #include "weaveDataStorage.h"
 #include "commandSocket.h"
 #include "settings.h"
@@ -40,6 +42,12 @@ private:
    
     
 public:
+    /*!
+     * Receives the layers of the wireframe in order, each as soon as it is complete, with its number from zero.
+     * Weaver::wireFrame has the bottom of the wireframe once the first layer is received.
+     * The layer is freed afterwards.
+     */
+    typedef std::function<void (WeaveLayer& layer, unsigned int layer_nr)> LayerHandler;
     
     Weaver(SettingsBase* settings_base) : SettingsBase(settings_base) 
     {
@@ -60,10 +68,14 @@ public:
      * This is the main function for Neith / Weaving / WirePrinting / Webbed printing.
      * Creates a wireframe for the model consisting of horizontal 'flat' parts and connections between consecutive flat parts consisting of UP moves and diagonally DOWN moves.
      * 
+     * The layers are streamed to \p handle_layer rather than kept, so only a few layers at a time are in memory:
+     * one per thread, together with the layer below them and the layer above them.
+     * 
      * \param object The object for which to create a wireframe print
      * \param commandSocket the commandSocket
+     * \param handle_layer Called with each layer once it is complete
      */
-    void weave(PrintObject* object, CommandSocket* commandSocket);
+    void weave(PrintObject* object, CommandSocket* commandSocket, const LayerHandler& handle_layer);
     
 
 private:
@@ -90,6 +102,24 @@ private:
  * If true, the last segment may be smaller.
  */
     void chainify_polygons(Polygons& parts1, Point start_close_to, Polygons& result, bool include_last);
+
+/*!
+ * Chainify the polygons of a layer of several slicers, without first copying them together.
+ * 
+ * \param parts1 The polygons to be chainified
+ * \param start_close_to The point from which to start the first link
+ * \param include_last governs whether the last segment is smaller or grater than the \p nozzle_top_diameter.
+ */
+    void chainify_polygons(const SlicerLayerView& parts1, Point start_close_to, Polygons& result, bool include_last);
+
+/*!
+ * Chainify a single polygon, adding the chain to \p result.
+ * 
+ * \param upperPart The polygon to be chainified
+ * \param start_close_to The point from which to start the first link; set to the end of the chain
+ * \param result Where to add the chain
+ */
+    void chainify_polygon(const PolygonRef upperPart, Point& start_close_to, Polygons& result);
     
 /*!
  * The main weaving function.
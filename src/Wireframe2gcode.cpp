@@ -10,13 +10,12 @@ namespace cura
 {
 
 
-void Wireframe2gcode::writeGCode(CommandSocket* commandSocket, int& maxObjectHeight)
+void Wireframe2gcode::writeGCode(PrintObject* object, CommandSocket* commandSocket, int& maxObjectHeight)
 {
 
     if (commandSocket)
         commandSocket->beginGCode();
     
-    maxObjectHeight = wireFrame.layers.back().z1;
     
     { // starting Gcode
         if (hasSetting("material_bed_temperature") && getSettingInDegreeCelsius("material_bed_temperature") > 0)
@@ -36,13 +35,46 @@ void Wireframe2gcode::writeGCode(CommandSocket* commandSocket, int& maxObjectHei
     
     
             
-    unsigned int totalLayers = wireFrame.layers.size();
+    // each layer is written as soon as the weaver has completed it, after which the weaver frees it
+    maxObjectHeight = 0;
+    weaver.weave(object, commandSocket, [&](WeaveLayer& layer, unsigned int layer_nr)
+        {
+            if (layer_nr == 0)
+                writeBottom();
+            writeLayer(layer, layer_nr, commandSocket);
+            maxObjectHeight = layer.z1;
+        });
+    
+    gcode.setZ(maxObjectHeight);
+    
+    gcode.writeRetraction(&standard_retraction_config);
+    
+    
+    gcode.updateTotalPrintTime();
+    
+    gcode.writeDelay(0.3);
+    
+    gcode.writeFanCommand(0);
+
+    if (commandSocket)
+    {
+        gcode.finalize(maxObjectHeight, getSettingInMillimetersPerSecond("speed_travel"), getSettingString("machine_end_gcode").c_str());
+        for(int e=0; e<MAX_EXTRUDERS; e++)
+            gcode.writeTemperatureCommand(e, 0, false);
+
+        commandSocket->sendGCodeLayer();
+        commandSocket->endSendSlicedObject();
+    }
+}
+
+void Wireframe2gcode::writeBottom()
+{
     gcode.writeLayerComment(0);
     gcode.writeTypeComment("SKIRT");
 
     gcode.setZ(initial_layer_thickness);
     
-    for (PolygonRef bottom_part : wireFrame.bottom_infill.roof_outlines)
+    for (PolygonRef bottom_part : weaver.wireFrame.bottom_infill.roof_outlines)
     {
         if (bottom_part.size() == 0) continue;
         writeMoveWithRetract(bottom_part[bottom_part.size()-1]);
@@ -56,7 +88,7 @@ void Wireframe2gcode::writeGCode(CommandSocket* commandSocket, int& maxObjectHei
     
     // bottom:
     Polygons empty_outlines;
-    writeFill(wireFrame.bottom_infill.roof_insets, empty_outlines, 
+    writeFill(weaver.wireFrame.bottom_infill.roof_insets, empty_outlines, 
               [this](Wireframe2gcode& thiss, WeaveRoofPart& inset, WeaveConnectionPart& part, unsigned int segment_idx) { 
                     WeaveConnectionSegment& segment = part.connection.segments[segment_idx]; 
                     if (segment.segmentType == WeaveSegmentType::MOVE || segment.segmentType == WeaveSegmentType::DOWN_AND_FLAT) // this is the case when an inset overlaps with a hole 
@@ -77,106 +109,80 @@ void Wireframe2gcode::writeGCode(CommandSocket* commandSocket, int& maxObjectHei
                         gcode.writeMove(segment.to, speedBottom, extrusion_per_mm_flat); 
                 }
             );
+}
+
+void Wireframe2gcode::writeLayer(WeaveLayer& layer, unsigned int layer_nr, CommandSocket* commandSocket)
+{
+    unsigned int totalLayers = weaver.wireFrame.max_layer_count;
+    logProgress("export", layer_nr+1, totalLayers); // abuse the progress system of the normal mode of CuraEngine
+    if (commandSocket) commandSocket->sendProgress(2.0/3.0 + 1.0/3.0 * float(layer_nr) / float(totalLayers));
     
-    for (unsigned int layer_nr = 0; layer_nr < wireFrame.layers.size(); layer_nr++)
+    gcode.writeLayerComment(layer_nr+1);
+    
+    int fanSpeed = getSettingInPercentage("cool_fan_speed_max");
+    if (layer_nr == 0)
+        fanSpeed = getSettingInPercentage("cool_fan_speed_min");
+    gcode.writeFanCommand(fanSpeed);
+    
+    for (unsigned int part_nr = 0; part_nr < layer.connections.size(); part_nr++)
     {
+        WeaveConnectionPart& part = layer.connections[part_nr];
+
+        if (part.connection.segments.size() == 0) continue;
         
-        logProgress("export", layer_nr+1, totalLayers); // abuse the progress system of the normal mode of CuraEngine
-        if (commandSocket) commandSocket->sendProgress(2.0/3.0 + 1.0/3.0 * float(layer_nr) / float(totalLayers));
-        
-        WeaveLayer& layer = wireFrame.layers[layer_nr];
+        gcode.writeTypeComment("SUPPORT"); // connection
+        {
+            if (vSize2(gcode.getPositionXY() - part.connection.from) > connectionHeight)
+            {
+                Point3 point_same_height(part.connection.from.x, part.connection.from.y, layer.z1+100);
+                writeMoveWithRetract(point_same_height);
+            }
+            writeMoveWithRetract(part.connection.from);
+            for (unsigned int segment_idx = 0; segment_idx < part.connection.segments.size(); segment_idx++)
+            {
+                handle_segment(layer, part, segment_idx);
+            }
+        }
         
-        gcode.writeLayerComment(layer_nr+1);
         
-        int fanSpeed = getSettingInPercentage("cool_fan_speed_max");
-        if (layer_nr == 0)
-            fanSpeed = getSettingInPercentage("cool_fan_speed_min");
-        gcode.writeFanCommand(fanSpeed);
         
-        for (unsigned int part_nr = 0; part_nr < layer.connections.size(); part_nr++)
+        gcode.writeTypeComment("WALL-OUTER"); // top
         {
-            WeaveConnectionPart& part = layer.connections[part_nr];
-       
-            if (part.connection.segments.size() == 0) continue;
-            
-            gcode.writeTypeComment("SUPPORT"); // connection
+            for (unsigned int segment_idx = 0; segment_idx < part.connection.segments.size(); segment_idx++)
             {
-                if (vSize2(gcode.getPositionXY() - part.connection.from) > connectionHeight)
-                {
-                    Point3 point_same_height(part.connection.from.x, part.connection.from.y, layer.z1+100);
-                    writeMoveWithRetract(point_same_height);
-                }
-                writeMoveWithRetract(part.connection.from);
-                for (unsigned int segment_idx = 0; segment_idx < part.connection.segments.size(); segment_idx++)
+                WeaveConnectionSegment& segment = part.connection.segments[segment_idx];
+                if (segment.segmentType == WeaveSegmentType::DOWN) continue;
+                if (segment.segmentType == WeaveSegmentType::MOVE) 
                 {
-                    handle_segment(layer, part, segment_idx);
-                }
-            }
-            
-            
-            
-            gcode.writeTypeComment("WALL-OUTER"); // top
-            {
-                for (unsigned int segment_idx = 0; segment_idx < part.connection.segments.size(); segment_idx++)
+                    writeMoveWithRetract(segment.to);
+                } else 
                 {
-                    WeaveConnectionSegment& segment = part.connection.segments[segment_idx];
-                    if (segment.segmentType == WeaveSegmentType::DOWN) continue;
-                    if (segment.segmentType == WeaveSegmentType::MOVE) 
-                    {
-                        writeMoveWithRetract(segment.to);
-                    } else 
-                    {
-                        gcode.writeMove(segment.to, speedFlat, extrusion_per_mm_flat);
-                        gcode.writeDelay(flat_delay);
-                    }
+                    gcode.writeMove(segment.to, speedFlat, extrusion_per_mm_flat);
+                    gcode.writeDelay(flat_delay);
                 }
             }
         }
-        
-        // roofs:
-        gcode.setZ(layer.z1);
-        std::function<void (Wireframe2gcode& thiss, WeaveRoofPart& inset, WeaveConnectionPart& part, unsigned int segment_idx)>
-            handle_roof = &Wireframe2gcode::handle_roof_segment;
-        writeFill(layer.roofs.roof_insets, layer.roofs.roof_outlines,
-                  handle_roof,
-                [this](Wireframe2gcode& thiss, WeaveConnectionSegment& segment) { // handle flat segments
-                    if (segment.segmentType == WeaveSegmentType::MOVE)
-                    {
-                        writeMoveWithRetract(segment.to);
-                    } else if (segment.segmentType == WeaveSegmentType::DOWN_AND_FLAT)
-                    {
-                        // do nothing
-                    } else 
-                    {   
-                        gcode.writeMove(segment.to, speedFlat, extrusion_per_mm_flat);
-                        gcode.writeDelay(flat_delay);
-                    }
-                });
-        
-     
-        
     }
     
-    gcode.setZ(maxObjectHeight);
-    
-    gcode.writeRetraction(&standard_retraction_config);
-    
-    
-    gcode.updateTotalPrintTime();
-    
-    gcode.writeDelay(0.3);
-    
-    gcode.writeFanCommand(0);
-
-    if (commandSocket)
-    {
-        gcode.finalize(maxObjectHeight, getSettingInMillimetersPerSecond("speed_travel"), getSettingString("machine_end_gcode").c_str());
-        for(int e=0; e<MAX_EXTRUDERS; e++)
-            gcode.writeTemperatureCommand(e, 0, false);
-
-        commandSocket->sendGCodeLayer();
-        commandSocket->endSendSlicedObject();
-    }
+    // roofs:
+    gcode.setZ(layer.z1);
+    std::function<void (Wireframe2gcode& thiss, WeaveRoofPart& inset, WeaveConnectionPart& part, unsigned int segment_idx)>
+        handle_roof = &Wireframe2gcode::handle_roof_segment;
+    writeFill(layer.roofs.roof_insets, layer.roofs.roof_outlines,
+              handle_roof,
+            [this](Wireframe2gcode& thiss, WeaveConnectionSegment& segment) { // handle flat segments
+                if (segment.segmentType == WeaveSegmentType::MOVE)
+                {
+                    writeMoveWithRetract(segment.to);
+                } else if (segment.segmentType == WeaveSegmentType::DOWN_AND_FLAT)
+                {
+                    // do nothing
+                } else 
+                {   
+                    gcode.writeMove(segment.to, speedFlat, extrusion_per_mm_flat);
+                    gcode.writeDelay(flat_delay);
+                }
+            });
 }
 
     
@@ -486,8 +492,8 @@ void Wireframe2gcode::writeMoveWithRetract(Point to)
 Wireframe2gcode::Wireframe2gcode(Weaver& weaver, GCodeExport& gcode, SettingsBase* settings_base) 
 : SettingsBase(settings_base) 
 , gcode(gcode)
+, weaver(weaver)
 {
-    wireFrame = weaver.wireFrame;
     initial_layer_thickness = getSettingInMicrons("layer_height_0");
     connectionHeight = getSettingInMicrons("wireframe_height"); 
     roof_inset = getSettingInMicrons("wireframe_roof_inset"); 
@@ -69,11 +69,32 @@ public:
     
     Wireframe2gcode(Weaver& weaver, GCodeExport& gcode, SettingsBase* settings_base);
     
-    void writeGCode(CommandSocket* commandSocket, int& maxObjectHeight);
+    /*!
+     * Weave the \p object and write the gcode for it, layer by layer as the weaver completes the layers.
+     * 
+     * \param object The object to weave
+     * \param commandSocket Where to send the progress and gcode, if not null
+     * \param[out] maxObjectHeight The height of the top of the object
+     */
+    void writeGCode(PrintObject* object, CommandSocket* commandSocket, int& maxObjectHeight);
 
 
 private:
-    WireFrame wireFrame;
+    Weaver& weaver; //!< The weaver producing the layers to write
+    
+    /*!
+     * Write the skirt and the bottom infill, which are printed before the first layer of connections.
+     */
+    void writeBottom();
+    
+    /*!
+     * Write the connections and roofs of a single layer.
+     * 
+     * \param layer The layer to write
+     * \param layer_nr The index of the layer
+     * \param commandSocket Where to send the progress, if not null
+     */
+    void writeLayer(WeaveLayer& layer, unsigned int layer_nr, CommandSocket* commandSocket);
     
     void writeFill(std::vector<WeaveRoofPart>& fill_insets, Polygons& outlines
         , std::function<void (Wireframe2gcode& thiss, WeaveRoofPart& inset, WeaveConnectionPart& part, unsigned int segment_idx)> connectionHandler
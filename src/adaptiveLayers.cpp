@@ -0,0 +1,89 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#include "adaptiveLayers.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace cura {
+
+std::vector<int> getAdaptiveLayerTops(const std::vector<Mesh>& meshes, int model_max_z, int initial_layer_thickness, int min_thickness, int max_thickness, int thickness_step, int max_cusp)
+{
+    thickness_step = std::max(1, thickness_step);
+    min_thickness = std::max(1, min_thickness);
+    max_thickness = std::max(min_thickness, max_thickness);
+
+    // The thickest a layer may be, per height bucket: the least of what the faces through that bucket allow.
+    int bucket_size = std::max(10, min_thickness / 4);
+    int bucket_count = std::max(0, model_max_z) / bucket_size + 1;
+    std::vector<int> bucket_max_thickness(bucket_count, max_thickness);
+    for (const Mesh& mesh : meshes)
+    {
+        for (const MeshFace& face : mesh.faces)
+        {
+            const Point3& p0 = mesh.vertices.positions[face.vertex_index[0]];
+            const Point3& p1 = mesh.vertices.positions[face.vertex_index[1]];
+            const Point3& p2 = mesh.vertices.positions[face.vertex_index[2]];
+            double ax = p1.x - p0.x, ay = p1.y - p0.y, az = p1.z - p0.z;
+            double bx = p2.x - p0.x, by = p2.y - p0.y, bz = p2.z - p0.z;
+            double nx = ay * bz - az * by;
+            double ny = az * bx - ax * bz;
+            double nz = ax * by - ay * bx;
+            double normal_length = std::sqrt(nx * nx + ny * ny + nz * nz);
+            if (normal_length <= 0)
+            {
+                continue; // degenerate
+            }
+            double steepness = std::abs(nz) / normal_length;
+            if (steepness * max_thickness <= max_cusp)
+            {
+                continue; // steep enough for the thickest layers
+            }
+            int allowed = std::max(min_thickness, int(max_cusp / steepness));
+            int face_min_z = std::max(0, std::min(p0.z, std::min(p1.z, p2.z)));
+            int face_max_z = std::min(model_max_z, std::max(p0.z, std::max(p1.z, p2.z)));
+            for (int bucket = face_min_z / bucket_size; bucket <= face_max_z / bucket_size && bucket < bucket_count; bucket++)
+            {
+                bucket_max_thickness[bucket] = std::min(bucket_max_thickness[bucket], allowed);
+            }
+        }
+    }
+
+    std::vector<int> tops;
+    int top = initial_layer_thickness;
+    tops.push_back(top);
+    int last_thickness = initial_layer_thickness;
+    while (true)
+    {
+        // the thickest layer on top of the last one which isn't thicker than any bucket it spans allows
+        int step_count = (std::min(max_thickness, last_thickness + thickness_step) - min_thickness) / thickness_step;
+        int thickness = min_thickness;
+        for (; step_count > 0; step_count--)
+        {
+            int candidate = min_thickness + step_count * thickness_step;
+            bool fits = true;
+            for (int bucket = std::max(0, top / bucket_size); bucket <= (top + candidate) / bucket_size && bucket < bucket_count; bucket++)
+            {
+                if (bucket_max_thickness[bucket] < candidate)
+                {
+                    fits = false;
+                    break;
+                }
+            }
+            if (fits)
+            {
+                thickness = candidate;
+                break;
+            }
+        }
+        if (top + thickness - thickness / 2 > model_max_z)
+        {
+            break; // the layer would be sliced above the model
+        }
+        top += thickness;
+        tops.push_back(top);
+        last_thickness = thickness;
+    }
+    return tops;
+}
+
+}//namespace cura
@@ -0,0 +1,42 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#ifndef ADAPTIVE_LAYERS_H
+#define ADAPTIVE_LAYERS_H
+
+#include <vector>
+
+#include "mesh.h"
+
+/*
+This file contains code to choose the thickness of each layer from the slope of the surface of the model, so that the
+layers are as thick as they can be without the steps they leave on that surface getting too high. Where the walls of
+the model are vertical the layers get as thick as allowed, which means fewer layers and so fewer arc starts.
+
+The thicknesses are chosen once, from the faces of the meshes, before slicing; everything after that works from the
+heights of the layers, so it doesn't cost anything per layer.
+*/
+namespace cura {
+
+/*!
+ * Choose the tops of the layers of adaptive layer heights.
+ *
+ * The step a layer leaves on a surface, measured perpendicular to it, is the thickness of the layer times the
+ * steepness of the surface (the z component of its unit normal): nothing on a vertical wall, the whole thickness on a
+ * horizontal one. Each layer is made as thick as it can be without that step getting higher than \p max_cusp on any of
+ * the faces it cuts, in steps of \p thickness_step from \p min_thickness up to \p max_thickness. A layer is at most
+ * \p thickness_step thicker than the one below, so the thickness changes gradually, but it can get thinner right away.
+ *
+ * \param meshes The meshes, after they have been placed on the build plate
+ * \param model_max_z The height of the top of the model
+ * \param initial_layer_thickness The thickness of the first layer, which isn't chosen
+ * \param min_thickness The thinnest a layer may be
+ * \param max_thickness The thickest a layer may be
+ * \param thickness_step The step in which the thickness of the layers is chosen
+ * \param max_cusp The highest step a layer may leave on the surface
+ * \return The height of the top of each layer, from the bottom up, for all layers of which the middle, where they are
+ * sliced, isn't above the top of the model
+ */
+std::vector<int> getAdaptiveLayerTops(const std::vector<Mesh>& meshes, int model_max_z, int initial_layer_thickness, int min_thickness, int max_thickness, int thickness_step, int max_cusp);
+
+}//namespace cura
+
+#endif//ADAPTIVE_LAYERS_H
@@ -0,0 +1,98 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#include "allocationCounter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace cura {
+
+namespace
+{
+
+std::atomic<uint64_t> allocation_count(0);
+std::atomic<uint64_t> allocated_bytes(0);
+
+void* allocate(std::size_t size)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    void* memory = std::malloc(size? size : 1);
+    if (!memory)
+    {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+}//anonymous namespace
+
+uint64_t getAllocationCount()
+{
+    return allocation_count.load(std::memory_order_relaxed);
+}
+
+uint64_t getAllocatedBytes()
+{
+    return allocated_bytes.load(std::memory_order_relaxed);
+}
+
+}//namespace cura
+
+void* operator new(std::size_t size)
+{
+    return cura::allocate(size);
+}
+
+void* operator new[](std::size_t size)
+{
+    return cura::allocate(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    try {
+        return cura::allocate(size);
+    }catch(...){
+        return nullptr;
+    }
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    try {
+        return cura::allocate(size);
+    }catch(...){
+        return nullptr;
+    }
+}
+
+void operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void* memory, const std::nothrow_t&) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete[](void* memory, const std::nothrow_t&) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete[](void* memory, std::size_t) noexcept
+{
+    std::free(memory);
+}
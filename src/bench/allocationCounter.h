@@ -0,0 +1,27 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#ifndef BENCH_ALLOCATION_COUNTER_H
+#define BENCH_ALLOCATION_COUNTER_H
+
+#include <cstdint>
+
+/*
+Linking allocationCounter.cpp into an executable replaces the global operator new and delete by ones which count the
+allocations, so that the benchmarks can report how many allocations a stage makes besides how long it takes: most of
+the time lost to the allocator is in the many small polygons made and thrown away per layer, which a profiler shows
+spread over the whole engine. It is only linked into the benchmarks; the engine itself uses the default allocator.
+*/
+namespace cura {
+
+/*!
+ * The number of allocations made with operator new since the program started.
+ */
+uint64_t getAllocationCount();
+
+/*!
+ * The number of bytes allocated with operator new since the program started.
+ */
+uint64_t getAllocatedBytes();
+
+}//namespace cura
+
+#endif//BENCH_ALLOCATION_COUNTER_H
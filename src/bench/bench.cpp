@@ -0,0 +1,353 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+#include "../utils/logoutput.h"
+#include "../utils/parallel.h"
+#include "../utils/string.h"
+#include "../utils/trace.h"
+#include "../settingRegistry.h"
+#include "../fffProcessor.h"
+#include "allocationCounter.h"
+#include "benchModels.h"
+
+/*
+The benchmark slices each generated model a few times and reports, per stage, the shortest time of the repetitions in
+a JSON file, so that the results of two builds or two machines can be compared line by line. The stage times are taken
+from the trace zones of the engine, so the benchmark measures exactly the code which is run when slicing normally.
+
+The G-code of every repetition is hashed: when the hashes of a model differ the slicing isn't deterministic, which is
+reported and makes the benchmark fail, as it would make the timings of different builds incomparable too.
+
+The allocations made from loading to exporting are counted too, by allocationCounter, since the time taken by the
+allocator is hard to see in the stage times.
+*/
+
+using namespace cura;
+
+namespace
+{
+
+void print_usage()
+{
+    logError("usage: bench [-j <settings.json>] [-s <settingkey>=<value>] [--repeat <count>] [--work <directory>] [-o <results.json>]\n");
+}
+
+/*!
+ * A stage of the benchmark, with the trace zones which make it up.
+ */
+struct BenchStage
+{
+    const char* name;
+    std::vector<const char*> zones;
+    bool per_face; //!< Whether the throughput is in faces of the model per second, rather than layers per second
+};
+
+const std::vector<BenchStage> bench_stages = {
+    {"load", {"load"}, true},
+    {"slice", {"slice"}, true},
+    {"layer_parts", {"layer_parts"}, false},
+    {"insets", {"insets"}, false},
+    {"skins", {"skins_infill"}, false},
+    {"support", {"support"}, false},
+    {"ordering", {"PathOrderOptimizer::optimize", "LineOrderOptimizer::optimize"}, false},
+    {"export", {"export"}, false},
+};
+
+struct ModelResult
+{
+    std::string name;
+    std::string description;
+    unsigned int face_count = 0;
+    unsigned int layer_count = 0;
+    size_t gcode_size = 0;
+    uint64_t gcode_hash = 0;
+    bool deterministic = true;
+    bool failed = false;
+    std::vector<double> stage_seconds; //!< The shortest time of the repetitions, per stage of bench_stages
+    double total_seconds = 0; //!< The shortest time of the repetitions from loading to exporting
+    uint64_t allocations = 0; //!< The fewest allocations of the repetitions from loading to exporting
+    uint64_t allocated_bytes = 0; //!< The bytes allocated by the repetition with the fewest allocations
+};
+
+/*!
+ * The 64 bit FNV-1a hash of a file, its size and the number of layers in it.
+ *
+ * \return Whether the file could be read
+ */
+bool hashGCode(const std::string& filename, uint64_t& hash, size_t& size, unsigned int& layer_count)
+{
+    std::ifstream in(filename, std::ios::binary);
+    if (!in.is_open())
+    {
+        return false;
+    }
+    hash = 14695981039346656037ull;
+    size = 0;
+    layer_count = 0;
+    std::string line;
+    while (std::getline(in, line))
+    {
+        for (char c : line)
+        {
+            hash = (hash ^ uint8_t(c)) * 1099511628211ull;
+        }
+        hash = (hash ^ uint8_t('\n')) * 1099511628211ull;
+        size += line.size() + 1;
+        if (line.compare(0, 7, ";LAYER:") == 0)
+        {
+            layer_count++;
+        }
+    }
+    return true;
+}
+
+/*!
+ * Slice a model once and add the stage times to \p result.
+ *
+ * \return The hash of the G-code, valid when \p result isn't failed
+ */
+uint64_t runBench(const std::string& model_file, const std::string& gcode_file, const std::vector<std::pair<std::string, std::string>>& settings, bool first_run, ModelResult& result)
+{
+    clearTrace();
+    {
+        std::unique_ptr<fffProcessor> processor(new fffProcessor());
+        for (const std::pair<std::string, std::string>& setting : settings)
+        {
+            processor->setSetting(setting.first, setting.second);
+        }
+        if (!processor->setTargetFile(gcode_file.c_str()))
+        {
+            logError("Failed to open %s for output.\n", gcode_file.c_str());
+            result.failed = true;
+            return 0;
+        }
+        try {
+            uint64_t allocations_before = getAllocationCount();
+            uint64_t bytes_before = getAllocatedBytes();
+            if (!processor->processFiles({model_file}))
+            {
+                result.failed = true;
+                return 0;
+            }
+            processor->finalize();
+            uint64_t allocations = getAllocationCount() - allocations_before;
+            if (first_run || allocations < result.allocations)
+            {
+                result.allocations = allocations;
+                result.allocated_bytes = getAllocatedBytes() - bytes_before;
+            }
+        }catch(...){
+            logError("Unknown exception while slicing %s\n", model_file.c_str());
+            result.failed = true;
+            return 0;
+        }
+    } // destroying the processor closes the output file
+    std::map<std::string, double> totals = getTraceTotals();
+
+    uint64_t hash = 0;
+    if (!hashGCode(gcode_file, hash, result.gcode_size, result.layer_count))
+    {
+        logError("Failed to read %s\n", gcode_file.c_str());
+        result.failed = true;
+        return 0;
+    }
+    for (unsigned int stage_idx = 0; stage_idx < bench_stages.size(); stage_idx++)
+    {
+        double seconds = 0;
+        for (const char* zone : bench_stages[stage_idx].zones)
+        {
+            seconds += totals[zone];
+        }
+        if (first_run || seconds < result.stage_seconds[stage_idx])
+        {
+            result.stage_seconds[stage_idx] = seconds;
+        }
+    }
+    double total_seconds = totals["load"] + totals["processModel"];
+    if (first_run || total_seconds < result.total_seconds)
+    {
+        result.total_seconds = total_seconds;
+    }
+    return hash;
+}
+
+void writeResults(std::ostream& out, const std::vector<ModelResult>& results, unsigned int thread_count, int repeat_count)
+{
+    out << std::fixed;
+    out << "{\n";
+    out << "    \"version\": \"" << VERSION << "\",\n";
+    out << "    \"threads\": " << thread_count << ",\n";
+    out << "    \"repeat\": " << repeat_count << ",\n";
+    out << "    \"models\": [";
+    for (unsigned int result_idx = 0; result_idx < results.size(); result_idx++)
+    {
+        const ModelResult& result = results[result_idx];
+        out << ((result_idx > 0)? ",\n" : "\n");
+        out << "        {\n";
+        out << "            \"name\": \"" << result.name << "\",\n";
+        out << "            \"description\": \"" << result.description << "\",\n";
+        out << "            \"faces\": " << result.face_count << ",\n";
+        out << "            \"failed\": " << (result.failed? "true" : "false") << ",\n";
+        out << "            \"layers\": " << result.layer_count << ",\n";
+        out << "            \"gcode_bytes\": " << result.gcode_size << ",\n";
+        out << "            \"gcode_hash\": \"" << std::hex << std::setw(16) << std::setfill('0') << result.gcode_hash << std::dec << std::setfill(' ') << "\",\n";
+        out << "            \"deterministic\": " << (result.deterministic? "true" : "false") << ",\n";
+        out << "            \"total_seconds\": " << std::setprecision(6) << result.total_seconds << ",\n";
+        out << "            \"allocations\": " << result.allocations << ",\n";
+        out << "            \"allocations_per_layer\": " << std::setprecision(1) << ((result.layer_count > 0)? double(result.allocations) / result.layer_count : 0.0) << ",\n";
+        out << "            \"allocated_bytes\": " << result.allocated_bytes << ",\n";
+        out << "            \"stages\": {";
+        for (unsigned int stage_idx = 0; stage_idx < bench_stages.size(); stage_idx++)
+        {
+            const BenchStage& stage = bench_stages[stage_idx];
+            double seconds = result.stage_seconds[stage_idx];
+            double amount = stage.per_face? result.face_count : result.layer_count;
+            out << ((stage_idx > 0)? ",\n" : "\n");
+            out << "                \"" << stage.name << "\": {\"seconds\": " << std::setprecision(6) << seconds;
+            out << ", \"" << (stage.per_face? "faces" : "layers") << "_per_second\": " << std::setprecision(1) << ((seconds > 0)? amount / seconds : 0.0) << "}";
+        }
+        out << "\n            }\n";
+        out << "        }";
+    }
+    out << "\n    ]\n";
+    out << "}\n";
+}
+
+}//anonymous namespace
+
+int main(int argc, char **argv)
+{
+    std::vector<std::pair<std::string, std::string>> settings;
+    std::string results_file;
+    std::string work_dir = ".";
+    int repeat_count = 3;
+
+    for(int argn = 1; argn < argc; argn++)
+    {
+        char* str = argv[argn];
+        if (stringcasecompare(str, "--repeat") == 0 && argn + 1 < argc)
+        {
+            argn++;
+            repeat_count = std::max(1, atoi(argv[argn]));
+        }
+        else if (stringcasecompare(str, "--work") == 0 && argn + 1 < argc)
+        {
+            argn++;
+            work_dir = argv[argn];
+        }
+        else if (stringcasecompare(str, "-j") == 0 && argn + 1 < argc)
+        {
+            argn++;
+            if (!SettingRegistry::getInstance()->loadJSON(argv[argn]))
+            {
+                logError("ERROR: Failed to load json file: %s\n", argv[argn]);
+                exit(1);
+            }
+        }
+        else if (stringcasecompare(str, "-s") == 0 && argn + 1 < argc)
+        {
+            argn++;
+            char* valuePtr = strchr(argv[argn], '=');
+            if (valuePtr)
+            {
+                *valuePtr++ = '\0';
+                settings.emplace_back(argv[argn], valuePtr);
+            }
+        }
+        else if (stringcasecompare(str, "-o") == 0 && argn + 1 < argc)
+        {
+            argn++;
+            results_file = argv[argn];
+        }
+        else if (stringcasecompare(str, "-v") == 0)
+        {
+            increaseVerboseLevel();
+        }
+        else
+        {
+            print_usage();
+            exit(1);
+        }
+    }
+
+    if (!SettingRegistry::getInstance()->settingsLoaded())
+    {
+        //If no json file has been loaded, try to load the default.
+        if (!SettingRegistry::getInstance()->loadJSON("fdmprinter.json"))
+        {
+            logError("ERROR: Failed to load json file: fdmprinter.json\n");
+            exit(1);
+        }
+    }
+    startTrace();
+
+    unsigned int thread_count;
+    {
+        fffProcessor processor;
+        for (const std::pair<std::string, std::string>& setting : settings)
+        {
+            processor.setSetting(setting.first, setting.second);
+        }
+        thread_count = getThreadCount(processor.getSettingAsCount("machine_thread_count"));
+    }
+
+    std::vector<ModelResult> results;
+    bool success = true;
+    for (const bench::BenchModel& model : bench::generateBenchModels())
+    {
+        ModelResult result;
+        result.name = model.name;
+        result.description = model.description;
+        result.face_count = model.getFaceCount();
+        result.stage_seconds.resize(bench_stages.size(), 0);
+        std::string model_file = work_dir + "/" + model.name + ".stl";
+        std::string gcode_file = work_dir + "/" + model.name + ".gcode";
+        if (!model.writeSTL(model_file))
+        {
+            logError("Failed to write %s\n", model_file.c_str());
+            result.failed = true;
+        }
+        for (int repeat = 0; repeat < repeat_count && !result.failed; repeat++)
+        {
+            uint64_t hash = runBench(model_file, gcode_file, settings, repeat == 0, result);
+            if (!result.failed)
+            {
+                if (repeat > 0 && hash != result.gcode_hash)
+                {
+                    result.deterministic = false;
+                }
+                result.gcode_hash = hash;
+            }
+        }
+        logError("%s: %d faces, %d layers in %.3fs, %llu allocations%s%s\n", result.name.c_str(), result.face_count, result.layer_count, result.total_seconds, (unsigned long long)result.allocations, result.deterministic? "" : ", NOT deterministic", result.failed? ", FAILED" : "");
+        success = success && result.deterministic && !result.failed;
+        results.push_back(result);
+    }
+
+    if (results_file.size() > 0)
+    {
+        std::ofstream out(results_file);
+        writeResults(out, results, thread_count, repeat_count);
+        if (!out.good())
+        {
+            logError("Failed to write %s\n", results_file.c_str());
+            return 1;
+        }
+    }
+    else
+    {
+        writeResults(std::cout, results, thread_count, repeat_count);
+    }
+    return success? 0 : 1;
+}
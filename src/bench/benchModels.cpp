@@ -0,0 +1,286 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#include "benchModels.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+
+namespace cura {
+namespace bench {
+
+namespace
+{
+
+struct Vec3
+{
+    float x, y, z;
+    Vec3(float x, float y, float z) : x(x), y(y), z(z) {}
+    Vec3 operator-(const Vec3& other) const { return Vec3(x - other.x, y - other.y, z - other.z); }
+    Vec3 operator+(const Vec3& other) const { return Vec3(x + other.x, y + other.y, z + other.z); }
+    Vec3 cross(const Vec3& other) const { return Vec3(y * other.z - z * other.y, z * other.x - x * other.z, x * other.y - y * other.x); }
+    float dot(const Vec3& other) const { return x * other.x + y * other.y + z * other.z; }
+};
+
+/*!
+ * A pseudo random sequence which is the same on every platform, unlike std::rand.
+ */
+class Random
+{
+    uint32_t state;
+public:
+    Random(uint32_t seed) : state(seed) {}
+
+    //! The next number in [0, 1)
+    float next()
+    {
+        state = state * 1664525u + 1013904223u;
+        return (state >> 8) / 16777216.0f;
+    }
+};
+
+class ModelBuilder
+{
+public:
+    BenchModel& model;
+
+    ModelBuilder(BenchModel& model) : model(model) {}
+
+    void addTriangle(const Vec3& a, const Vec3& b, const Vec3& c)
+    {
+        for (const Vec3* v : {&a, &b, &c})
+        {
+            model.corners.push_back(v->x);
+            model.corners.push_back(v->y);
+            model.corners.push_back(v->z);
+        }
+    }
+
+    /*!
+     * Add a planar quad as two triangles, ordered so that they face along \p outward.
+     */
+    void addQuad(const Vec3& a, const Vec3& b, const Vec3& c, const Vec3& d, const Vec3& outward)
+    {
+        if ((b - a).cross(c - a).dot(outward) >= 0)
+        {
+            addTriangle(a, b, c);
+            addTriangle(a, c, d);
+        }
+        else
+        {
+            addTriangle(a, c, b);
+            addTriangle(a, d, c);
+        }
+    }
+
+    void addBox(const Vec3& min, const Vec3& max)
+    {
+        Vec3 p000(min.x, min.y, min.z), p100(max.x, min.y, min.z), p110(max.x, max.y, min.z), p010(min.x, max.y, min.z);
+        Vec3 p001(min.x, min.y, max.z), p101(max.x, min.y, max.z), p111(max.x, max.y, max.z), p011(min.x, max.y, max.z);
+        addQuad(p000, p010, p110, p100, Vec3(0, 0, -1));
+        addQuad(p001, p101, p111, p011, Vec3(0, 0, 1));
+        addQuad(p000, p100, p101, p001, Vec3(0, -1, 0));
+        addQuad(p010, p011, p111, p110, Vec3(0, 1, 0));
+        addQuad(p000, p001, p011, p010, Vec3(-1, 0, 0));
+        addQuad(p100, p110, p111, p101, Vec3(1, 0, 0));
+    }
+
+    /*!
+     * Add a closed ring around \p center: a tube when \p inner_radius is positive, a solid cylinder when it is zero.
+     */
+    void addCylinder(const Vec3& center, float outer_radius, float inner_radius, float height, unsigned int segment_count)
+    {
+        Vec3 up(0, 0, 1);
+        Vec3 top_center = center + Vec3(0, 0, height);
+        for (unsigned int segment = 0; segment < segment_count; segment++)
+        {
+            float angle0 = 2 * M_PI * segment / segment_count;
+            float angle1 = 2 * M_PI * (segment + 1) / segment_count;
+            Vec3 dir0(std::cos(angle0), std::sin(angle0), 0);
+            Vec3 dir1(std::cos(angle1), std::sin(angle1), 0);
+            auto at = [&](const Vec3& dir, float radius, float z) { return Vec3(center.x + dir.x * radius, center.y + dir.y * radius, center.z + z); };
+            Vec3 outward = Vec3(std::cos((angle0 + angle1) / 2), std::sin((angle0 + angle1) / 2), 0);
+            addQuad(at(dir0, outer_radius, 0), at(dir1, outer_radius, 0), at(dir1, outer_radius, height), at(dir0, outer_radius, height), outward);
+            if (inner_radius > 0)
+            {
+                Vec3 inward(-outward.x, -outward.y, 0);
+                addQuad(at(dir0, inner_radius, 0), at(dir1, inner_radius, 0), at(dir1, inner_radius, height), at(dir0, inner_radius, height), inward);
+                addQuad(at(dir0, outer_radius, height), at(dir1, outer_radius, height), at(dir1, inner_radius, height), at(dir0, inner_radius, height), up);
+                addQuad(at(dir0, outer_radius, 0), at(dir1, outer_radius, 0), at(dir1, inner_radius, 0), at(dir0, inner_radius, 0), Vec3(0, 0, -1));
+            }
+            else
+            {
+                addTriangle(top_center, at(dir0, outer_radius, height), at(dir1, outer_radius, height));
+                addTriangle(center, at(dir1, outer_radius, 0), at(dir0, outer_radius, 0));
+            }
+        }
+    }
+
+    /*!
+     * Add the outside of the filled cells of a grid of cubes.
+     *
+     * \param size The number of cells along each axis
+     * \param cell_size The size of a cell in mm
+     * \param filled Whether the cell at the given indices is filled
+     */
+    void addVoxels(int size, float cell_size, std::function<bool (int, int, int)> filled)
+    {
+        auto isFilled = [&](int x, int y, int z)
+        {
+            return x >= 0 && y >= 0 && z >= 0 && x < size && y < size && z < size && filled(x, y, z);
+        };
+        auto corner = [cell_size](int x, int y, int z) { return Vec3(x * cell_size, y * cell_size, z * cell_size); };
+        for (int z = 0; z < size; z++)
+        {
+            for (int y = 0; y < size; y++)
+            {
+                for (int x = 0; x < size; x++)
+                {
+                    if (!isFilled(x, y, z))
+                    {
+                        continue;
+                    }
+                    if (!isFilled(x - 1, y, z)) addQuad(corner(x, y, z), corner(x, y + 1, z), corner(x, y + 1, z + 1), corner(x, y, z + 1), Vec3(-1, 0, 0));
+                    if (!isFilled(x + 1, y, z)) addQuad(corner(x + 1, y, z), corner(x + 1, y + 1, z), corner(x + 1, y + 1, z + 1), corner(x + 1, y, z + 1), Vec3(1, 0, 0));
+                    if (!isFilled(x, y - 1, z)) addQuad(corner(x, y, z), corner(x + 1, y, z), corner(x + 1, y, z + 1), corner(x, y, z + 1), Vec3(0, -1, 0));
+                    if (!isFilled(x, y + 1, z)) addQuad(corner(x, y + 1, z), corner(x + 1, y + 1, z), corner(x + 1, y + 1, z + 1), corner(x, y + 1, z + 1), Vec3(0, 1, 0));
+                    if (!isFilled(x, y, z - 1)) addQuad(corner(x, y, z), corner(x + 1, y, z), corner(x + 1, y + 1, z), corner(x, y + 1, z), Vec3(0, 0, -1));
+                    if (!isFilled(x, y, z + 1)) addQuad(corner(x, y, z + 1), corner(x + 1, y, z + 1), corner(x + 1, y + 1, z + 1), corner(x, y + 1, z + 1), Vec3(0, 0, 1));
+                }
+            }
+        }
+    }
+};
+
+BenchModel generateTube()
+{
+    BenchModel model{"tube", "thin-walled cylinder, 40 mm across and 60 mm high with a 2 mm wall", {}};
+    ModelBuilder(model).addCylinder(Vec3(0, 0, 0), 20, 18, 60, 512);
+    return model;
+}
+
+BenchModel generatePlate()
+{
+    BenchModel model{"plate", "solid block of 150 x 150 x 20 mm", {}};
+    ModelBuilder(model).addBox(Vec3(0, 0, 0), Vec3(150, 150, 20));
+    return model;
+}
+
+BenchModel generateLattice()
+{
+    BenchModel model{"lattice", "48 mm cube of 2 mm struts with 8 mm cells", {}};
+    ModelBuilder(model).addVoxels(48, 1.0, [](int x, int y, int z)
+    {
+        return (x % 8 < 2) + (y % 8 < 2) + (z % 8 < 2) >= 2; // on at least two of the strut planes: on a strut
+    });
+    return model;
+}
+
+BenchModel generateScan()
+{
+    BenchModel model{"scan", "bumpy sphere of 50 mm across with holes and loose faces", {}};
+    ModelBuilder builder(model);
+    Random random(12345);
+    const unsigned int longitude_count = 240;
+    const unsigned int latitude_count = 120;
+    std::vector<Vec3> points;
+    for (unsigned int latitude = 0; latitude <= latitude_count; latitude++)
+    {
+        float polar = M_PI * latitude / latitude_count;
+        for (unsigned int longitude = 0; longitude < longitude_count; longitude++)
+        {
+            float azimuth = 2 * M_PI * longitude / longitude_count;
+            float radius = 25 * (1 + 0.03 * std::sin(5 * azimuth) * std::cos(7 * polar) + 0.004 * random.next());
+            points.emplace_back(radius * std::sin(polar) * std::cos(azimuth), radius * std::sin(polar) * std::sin(azimuth), 25 - radius * std::cos(polar));
+        }
+    }
+    auto point = [&](unsigned int latitude, unsigned int longitude) { return points[latitude * longitude_count + longitude % longitude_count]; };
+    for (unsigned int latitude = 0; latitude < latitude_count; latitude++)
+    {
+        for (unsigned int longitude = 0; longitude < longitude_count; longitude++)
+        {
+            Vec3 a = point(latitude, longitude), b = point(latitude, longitude + 1), c = point(latitude + 1, longitude + 1), d = point(latitude + 1, longitude);
+            for (int triangle = 0; triangle < 2; triangle++)
+            {
+                float chance = random.next();
+                if (chance < 0.002)
+                {
+                    continue; // a hole
+                }
+                if (triangle == 0)
+                {
+                    builder.addTriangle(a, b, c);
+                }
+                else
+                {
+                    builder.addTriangle(a, c, d);
+                }
+                if (chance > 0.998)
+                {
+                    builder.addTriangle(a + Vec3(0.3, 0.2, 0.1), b, c + Vec3(0.3, 0.2, 0.1)); // a loose face sticking out
+                }
+            }
+        }
+    }
+    return model;
+}
+
+BenchModel generateMultiPartPlate()
+{
+    BenchModel model{"multi_part_plate", "4 x 4 separate cylinders, tubes and blocks of 10 to 20 mm high, 30 mm apart", {}};
+    ModelBuilder builder(model);
+    for (int row = 0; row < 4; row++)
+    {
+        for (int column = 0; column < 4; column++)
+        {
+            Vec3 center(column * 30, row * 30, 0);
+            float height = 10 + (row + column) * 10 / 6.0;
+            switch ((row + column) % 3)
+            {
+            case 0:
+                builder.addCylinder(center, 10, 0, height, 96);
+                break;
+            case 1:
+                builder.addCylinder(center, 10, 8, height, 96);
+                break;
+            default:
+                builder.addBox(center - Vec3(8, 8, 0), center + Vec3(8, 8, height));
+                break;
+            }
+        }
+    }
+    return model;
+}
+
+}//anonymous namespace
+
+bool BenchModel::writeSTL(const std::string& filename) const
+{
+    FILE* file = fopen(filename.c_str(), "wb");
+    if (!file)
+    {
+        return false;
+    }
+    char header[80] = {};
+    snprintf(header, sizeof(header), "benchmark model %s", name.c_str());
+    uint32_t face_count = getFaceCount();
+    fwrite(header, sizeof(header), 1, file);
+    fwrite(&face_count, sizeof(face_count), 1, file);
+    for (unsigned int face_idx = 0; face_idx < face_count; face_idx++)
+    {
+        float normal[3] = {0, 0, 0}; // the loader computes the orientation from the corners
+        uint16_t attributes = 0;
+        fwrite(normal, sizeof(normal), 1, file);
+        fwrite(&corners[face_idx * 9], sizeof(float), 9, file);
+        fwrite(&attributes, sizeof(attributes), 1, file);
+    }
+    return fclose(file) == 0;
+}
+
+std::vector<BenchModel> generateBenchModels()
+{
+    return {generateTube(), generatePlate(), generateLattice(), generateScan(), generateMultiPartPlate()};
+}
+
+}//namespace bench
+}//namespace cura
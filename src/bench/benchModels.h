@@ -0,0 +1,47 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#ifndef BENCH_MODELS_H
+#define BENCH_MODELS_H
+
+#include <string>
+#include <vector>
+
+/*
+The models of the benchmark are generated rather than stored, so that every build benchmarks exactly the same geometry
+without adding large binary files to the repository. Each one stands for a kind of model which stresses other stages.
+*/
+namespace cura {
+namespace bench {
+
+/*!
+ * A triangle soup, in millimeters, as it is stored in an STL file.
+ */
+struct BenchModel
+{
+    std::string name;
+    std::string description;
+    std::vector<float> corners; //!< three coordinates per corner, three corners per face
+
+    unsigned int getFaceCount() const { return corners.size() / 9; }
+
+    /*!
+     * Write the model as a binary STL file.
+     *
+     * \return Whether the file could be written
+     */
+    bool writeSTL(const std::string& filename) const;
+};
+
+/*!
+ * Generate the models of the benchmark:
+ *  - tube: a thin-walled cylinder, of which nearly every layer repeats the one below
+ *  - plate: a large, low, solid block, which is mostly skin and infill
+ *  - lattice: a cube of thin struts, with many small parts and holes on each layer
+ *  - scan: a bumpy sphere with holes and loose faces, like a 3D scan which wasn't repaired
+ *  - multi_part_plate: many separate parts of different shapes side by side, with long travels between them
+ */
+std::vector<BenchModel> generateBenchModels();
+
+}//namespace bench
+}//namespace cura
+
+#endif//BENCH_MODELS_H
@@ -0,0 +1,488 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "../utils/logoutput.h"
+#include "../utils/polygon.h"
+#include "../utils/polygonUtils.h"
+#include "../utils/string.h"
+#include "../comb.h"
+#include "../infill.h"
+#include "../pathOrderOptimizer.h"
+#include "../timeEstimate.h"
+#include "allocationCounter.h"
+
+/*
+Microbenchmarks of the geometry helpers which the stages spend most of their time in, in the style of Google Benchmark:
+each benchmark runs for every size of its input, and the number of iterations grows until a run takes long enough to
+time reliably. The inputs are generated from a fixed seed, so the numbers of two builds are measured on the same input.
+
+The allocations made per iteration are counted by allocationCounter, as a benchmark which allocates less is usually
+faster in the engine by more than it shows here, where the allocator has no other threads to contend with.
+
+The results are written as a table, and with -o also as JSON in the format of Google Benchmark, so that its compare.py
+can compare two runs.
+*/
+
+using namespace cura;
+
+namespace
+{
+
+/*!
+ * The state of one run of a benchmark: the size of the input and the number of times to run the measured code.
+ */
+class MicroBenchState
+{
+public:
+    const int size; //!< The size of the input, in the unit of the benchmark
+    int64_t items; //!< The number of items processed per iteration, for the throughput; the size unless set otherwise
+
+    MicroBenchState(int size, int64_t iterations)
+    : size(size)
+    , items(size)
+    , remaining(iterations)
+    , started(false)
+    {
+    }
+
+    /*!
+     * Whether to run the measured code once more. The time from the first call to the last is measured, so the input
+     * should be made before the first call.
+     */
+    bool keepRunning()
+    {
+        if (!started)
+        {
+            started = true;
+            start_allocations = getAllocationCount();
+            start = std::chrono::steady_clock::now();
+        }
+        if (remaining == 0)
+        {
+            end = std::chrono::steady_clock::now();
+            end_allocations = getAllocationCount();
+            return false;
+        }
+        remaining--;
+        return true;
+    }
+
+    double getSeconds() const
+    {
+        return std::chrono::duration<double>(end - start).count();
+    }
+
+    uint64_t getAllocations() const
+    {
+        return end_allocations - start_allocations;
+    }
+private:
+    int64_t remaining;
+    bool started;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point end;
+    uint64_t start_allocations = 0;
+    uint64_t end_allocations = 0;
+};
+
+struct MicroBench
+{
+    const char* name;
+    std::vector<int> sizes;
+    std::function<void (MicroBenchState&)> run;
+};
+
+volatile int64_t sink; //!< The results are added to this, so that the compiler can't leave out the measured code
+
+/*!
+ * A pseudo random sequence which is the same on every platform, unlike std::rand.
+ */
+class Random
+{
+    uint32_t state;
+public:
+    Random(uint32_t seed) : state(seed) {}
+
+    //! The next number in [min, max)
+    int64_t next(int64_t min, int64_t max)
+    {
+        state = state * 1664525u + 1013904223u;
+        return min + int64_t(state >> 8) * (max - min) / 16777216;
+    }
+};
+
+Polygon makeCircle(Point center, int64_t radius, unsigned int point_count)
+{
+    Polygon circle;
+    for (unsigned int point_idx = 0; point_idx < point_count; point_idx++)
+    {
+        double angle = 2 * M_PI * point_idx / point_count;
+        circle.add(center + Point(std::cos(angle) * radius, std::sin(angle) * radius));
+    }
+    return circle;
+}
+
+/*!
+ * A star of \p point_count points between 7 and 10 mm from the origin.
+ */
+Polygon makeStar(unsigned int point_count)
+{
+    Polygon star;
+    for (unsigned int point_idx = 0; point_idx < point_count; point_idx++)
+    {
+        double angle = 2 * M_PI * point_idx / point_count;
+        int64_t radius = (point_idx % 2)? MM2INT(7) : MM2INT(10);
+        star.add(Point(std::cos(angle) * radius, std::sin(angle) * radius));
+    }
+    return star;
+}
+
+/*!
+ * \p count circles of 32 points and 4 mm across on a square grid 5 mm apart, moved by \p offset.
+ */
+Polygons makeCircleGrid(int count, Point offset)
+{
+    Polygons circles;
+    int columns = std::ceil(std::sqrt(count));
+    for (int circle_idx = 0; circle_idx < count; circle_idx++)
+    {
+        Point center(MM2INT(5) * (circle_idx % columns), MM2INT(5) * (circle_idx / columns));
+        circles.add(makeCircle(center + offset, MM2INT(2), 32));
+    }
+    return circles;
+}
+
+/*!
+ * \p count squares of 2 mm at random places on a 200 mm bed.
+ */
+Polygons makeRandomSquares(int count, Random& random)
+{
+    Polygons squares;
+    for (int square_idx = 0; square_idx < count; square_idx++)
+    {
+        Point corner(random.next(0, MM2INT(198)), random.next(0, MM2INT(198)));
+        PolygonRef square = squares.newPoly();
+        square.add(corner);
+        square.add(corner + Point(MM2INT(2), 0));
+        square.add(corner + Point(MM2INT(2), MM2INT(2)));
+        square.add(corner + Point(0, MM2INT(2)));
+    }
+    return squares;
+}
+
+std::vector<Point> makeRandomPoints(unsigned int count, int64_t min, int64_t max, Random& random)
+{
+    std::vector<Point> points;
+    for (unsigned int point_idx = 0; point_idx < count; point_idx++)
+    {
+        points.emplace_back(random.next(min, max), random.next(min, max));
+    }
+    return points;
+}
+
+const std::vector<int> polygon_counts = {16, 256, 4096};
+const std::vector<int> point_counts = {16, 256, 4096};
+
+const std::vector<MicroBench> micro_benches = {
+    {"Polygons::offset", polygon_counts, [](MicroBenchState& state)
+    {
+        Polygons circles = makeCircleGrid(state.size, Point(0, 0));
+        while (state.keepRunning())
+        {
+            sink += circles.offset(-MM2INT(0.5)).size();
+        }
+    }},
+    {"Polygons::difference", polygon_counts, [](MicroBenchState& state)
+    {
+        Polygons circles = makeCircleGrid(state.size, Point(0, 0));
+        Polygons moved = makeCircleGrid(state.size, Point(MM2INT(1), MM2INT(1)));
+        while (state.keepRunning())
+        {
+            sink += circles.difference(moved).size();
+        }
+    }},
+    {"Polygons::unionPolygons", polygon_counts, [](MicroBenchState& state)
+    {
+        Polygons circles = makeCircleGrid(state.size, Point(0, 0));
+        Polygons moved = makeCircleGrid(state.size, Point(MM2INT(1), MM2INT(1)));
+        while (state.keepRunning())
+        {
+            sink += circles.unionPolygons(moved).size();
+        }
+    }},
+    {"Polygons::intersection", polygon_counts, [](MicroBenchState& state)
+    {
+        Polygons circles = makeCircleGrid(state.size, Point(0, 0));
+        Polygons moved = makeCircleGrid(state.size, Point(MM2INT(1), MM2INT(1)));
+        while (state.keepRunning())
+        {
+            sink += circles.intersection(moved).size();
+        }
+    }},
+    {"PolygonRef::inside", point_counts, [](MicroBenchState& state)
+    {
+        Polygon star = makeStar(state.size);
+        Random random(1);
+        std::vector<Point> points = makeRandomPoints(256, -MM2INT(11), MM2INT(11), random);
+        unsigned int point_idx = 0;
+        while (state.keepRunning())
+        {
+            sink += star.inside(points[point_idx++ % points.size()]);
+        }
+    }},
+    {"findClosest", point_counts, [](MicroBenchState& state)
+    {
+        Polygons stars;
+        stars.add(makeStar(state.size));
+        Random random(2);
+        std::vector<Point> points = makeRandomPoints(256, -MM2INT(11), MM2INT(11), random);
+        unsigned int point_idx = 0;
+        while (state.keepRunning())
+        {
+            sink += findClosest(points[point_idx++ % points.size()], stars).pos;
+        }
+    }},
+    {"generateLineInfill", {16, 128, 1024}, [](MicroBenchState& state)
+    {
+        // a disc with as many lines across as the size, with a hole in the middle
+        int line_spacing = MM2INT(1);
+        Polygons outline;
+        outline.add(makeCircle(Point(0, 0), state.size * line_spacing / 2, 256));
+        Polygon hole = makeCircle(Point(0, 0), state.size * line_spacing / 8, 64);
+        hole.reverse();
+        outline.add(hole);
+        while (state.keepRunning())
+        {
+            Polygons result;
+            generateLineInfill(outline, 0, result, MM2INT(0.5), line_spacing, 0, 45);
+            sink += result.size();
+        }
+    }},
+    {"PathOrderOptimizer::optimize", polygon_counts, [](MicroBenchState& state)
+    {
+        Random random(3);
+        Polygons squares = makeRandomSquares(state.size, random);
+        while (state.keepRunning())
+        {
+            PathOrderOptimizer optimizer(Point(0, 0));
+            optimizer.addPolygons(squares);
+            optimizer.optimize();
+            sink += optimizer.polyOrder.back();
+        }
+    }},
+    {"LineOrderOptimizer::optimize", polygon_counts, [](MicroBenchState& state)
+    {
+        Random random(4);
+        Polygons lines;
+        for (int line_idx = 0; line_idx < state.size; line_idx++)
+        {
+            Point start(random.next(0, MM2INT(190)), random.next(0, MM2INT(200)));
+            PolygonRef line = lines.newPoly();
+            line.add(start);
+            line.add(start + Point(MM2INT(10), 0));
+        }
+        while (state.keepRunning())
+        {
+            LineOrderOptimizer optimizer(Point(0, 0));
+            optimizer.addPolygons(lines);
+            optimizer.optimize();
+            sink += optimizer.polyOrder.back();
+        }
+    }},
+    {"Comb::calc", polygon_counts, [](MicroBenchState& state)
+    {
+        // a square with as many square holes as the size, and travels between the corners of the cells around the holes
+        int columns = std::ceil(std::sqrt(state.size));
+        int64_t cell_size = MM2INT(200) / columns;
+        Polygons boundary;
+        PolygonRef outside = boundary.newPoly();
+        outside.add(Point(0, 0));
+        outside.add(Point(MM2INT(200), 0));
+        outside.add(Point(MM2INT(200), MM2INT(200)));
+        outside.add(Point(0, MM2INT(200)));
+        for (int hole_idx = 0; hole_idx < state.size; hole_idx++)
+        {
+            Point corner(cell_size * (hole_idx % columns) + cell_size / 4, cell_size * (hole_idx / columns) + cell_size / 4);
+            PolygonRef hole = boundary.newPoly();
+            hole.add(corner);
+            hole.add(corner + Point(0, cell_size / 2));
+            hole.add(corner + Point(cell_size / 2, cell_size / 2));
+            hole.add(corner + Point(cell_size / 2, 0));
+        }
+        Random random(5);
+        std::vector<Point> points;
+        for (unsigned int point_idx = 0; point_idx < 256; point_idx++)
+        {
+            points.emplace_back(cell_size * random.next(1, columns), cell_size * random.next(1, columns));
+        }
+        Comb comb(boundary);
+        comb.prepare();
+        std::vector<Point> comb_points;
+        unsigned int point_idx = 0;
+        while (state.keepRunning())
+        {
+            comb_points.clear();
+            sink += comb.calc(points[point_idx % points.size()], points[(point_idx + 1) % points.size()], comb_points);
+            sink += comb_points.size();
+            point_idx++;
+        }
+    }},
+    {"TimeEstimateCalculator::plan", {256, 4096, 65536}, [](MicroBenchState& state)
+    {
+        // a zigzag of short and long moves at different speeds, as in the infill of a layer
+        Random random(6);
+        std::vector<TimeEstimateCalculator::Position> positions;
+        std::vector<double> speeds;
+        double e = 0;
+        for (int move_idx = 0; move_idx < state.size; move_idx++)
+        {
+            double length = random.next(1, 200);
+            e += length * 0.05;
+            positions.emplace_back((move_idx % 2)? length : 0, move_idx * 0.5, 0.2, e);
+            speeds.push_back(random.next(20, 100));
+        }
+        TimeEstimateCalculator calculator;
+        while (state.keepRunning())
+        {
+            calculator.reset();
+            calculator.setPosition(TimeEstimateCalculator::Position(0, 0, 0.2, 0));
+            for (unsigned int move_idx = 0; move_idx < positions.size(); move_idx++)
+            {
+                calculator.plan(positions[move_idx], speeds[move_idx]);
+            }
+            sink += calculator.calculate();
+        }
+    }},
+};
+
+struct MicroBenchResult
+{
+    std::string name;
+    int64_t iterations;
+    double nanoseconds; //!< per iteration
+    double items_per_second;
+    double allocations; //!< per iteration
+};
+
+/*!
+ * Run a benchmark with more and more iterations, until a run takes at least \p min_time seconds.
+ */
+MicroBenchResult runMicroBench(const MicroBench& bench, int size, double min_time)
+{
+    int64_t iterations = 1;
+    while (true)
+    {
+        MicroBenchState state(size, iterations);
+        bench.run(state);
+        double seconds = state.getSeconds();
+        if (seconds >= min_time || iterations >= 1000000000)
+        {
+            MicroBenchResult result;
+            result.name = std::string(bench.name) + "/" + std::to_string(size);
+            result.iterations = iterations;
+            result.nanoseconds = seconds * 1e9 / iterations;
+            result.items_per_second = (seconds > 0)? state.items * iterations / seconds : 0;
+            result.allocations = double(state.getAllocations()) / iterations;
+            return result;
+        }
+        // aim a little over the minimum time, like Google Benchmark, but grow at least tenfold while too fast to time
+        double factor = (seconds > min_time / 10)? min_time * 1.4 / seconds : 10;
+        iterations = std::max(iterations + 1, int64_t(iterations * factor));
+    }
+}
+
+void writeResults(std::ostream& out, const std::vector<MicroBenchResult>& results)
+{
+    out << std::fixed;
+    out << "{\n";
+    out << "  \"context\": {\"executable\": \"microbench\"},\n";
+    out << "  \"benchmarks\": [";
+    for (unsigned int result_idx = 0; result_idx < results.size(); result_idx++)
+    {
+        const MicroBenchResult& result = results[result_idx];
+        out << ((result_idx > 0)? ",\n" : "\n");
+        out << "    {\"name\": \"" << result.name << "\", \"run_type\": \"iteration\", \"iterations\": " << result.iterations;
+        out << ", \"real_time\": " << std::setprecision(1) << result.nanoseconds << ", \"cpu_time\": " << result.nanoseconds;
+        out << ", \"time_unit\": \"ns\", \"items_per_second\": " << result.items_per_second << ", \"allocations\": " << result.allocations << "}";
+    }
+    out << "\n  ]\n";
+    out << "}\n";
+}
+
+void print_usage()
+{
+    logError("usage: microbench [--filter <name part>] [--min-time <seconds>] [-o <results.json>]\n");
+}
+
+}//anonymous namespace
+
+int main(int argc, char **argv)
+{
+    std::string filter;
+    std::string results_file;
+    double min_time = 0.5;
+
+    for(int argn = 1; argn < argc; argn++)
+    {
+        char* str = argv[argn];
+        if (stringcasecompare(str, "--filter") == 0 && argn + 1 < argc)
+        {
+            argn++;
+            filter = argv[argn];
+        }
+        else if (stringcasecompare(str, "--min-time") == 0 && argn + 1 < argc)
+        {
+            argn++;
+            min_time = atof(argv[argn]);
+        }
+        else if (stringcasecompare(str, "-o") == 0 && argn + 1 < argc)
+        {
+            argn++;
+            results_file = argv[argn];
+        }
+        else
+        {
+            print_usage();
+            exit(1);
+        }
+    }
+
+    std::vector<MicroBenchResult> results;
+    std::cout << std::left << std::setw(40) << "Benchmark" << std::right << std::setw(16) << "Time (ns)" << std::setw(14) << "Iterations" << std::setw(16) << "Items/s" << std::setw(14) << "Allocs/iter" << "\n";
+    for (const MicroBench& bench : micro_benches)
+    {
+        if (std::string(bench.name).find(filter) == std::string::npos)
+        {
+            continue;
+        }
+        for (int size : bench.sizes)
+        {
+            MicroBenchResult result = runMicroBench(bench, size, min_time);
+            std::cout << std::left << std::setw(40) << result.name << std::right << std::fixed << std::setprecision(0);
+            std::cout << std::setw(16) << result.nanoseconds << std::setw(14) << result.iterations << std::setw(16) << result.items_per_second << std::setprecision(1) << std::setw(14) << result.allocations << std::endl;
+            results.push_back(result);
+        }
+    }
+
+    if (results_file.size() > 0)
+    {
+        std::ofstream out(results_file);
+        writeResults(out, results);
+        if (!out.good())
+        {
+            logError("Failed to write %s\n", results_file.c_str());
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -6,7 +6,7 @@
 
 namespace cura {
 
-int bridgeAngle(Polygons outline, SliceLayer* prevLayer);
+int bridgeAngle(const Polygons& outline, SliceLayer* prevLayer);
 
 }//namespace cura
 
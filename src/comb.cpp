@@ -1,8 +1,113 @@
 /** Copyright (C) 2013 David Braam - Released under terms of the AGPLv3 License */
 #include "comb.h"
 
+#include <algorithm>
+#include <cmath>
+
 namespace cura {
 
+/*!
+ * How far a crossing found in the rotated frame of a travel can lie from the travel and the edge in the original frame,
+ * through rounding the rotated points and the crossing.
+ */
+#define COMB_ROUNDING_MARGIN 20
+
+void Comb::buildGrid()
+{
+    gridBuilt = true;
+    Point max(POINT_MIN, POINT_MIN);
+    gridMin = Point(POINT_MAX, POINT_MAX);
+    for(unsigned int n=0; n<boundery.size(); n++)
+    {
+        for(unsigned int i=0; i<boundery[n].size(); i++)
+        {
+            Point p = boundery[n][i];
+            gridMin = Point(std::min(gridMin.X, p.X), std::min(gridMin.Y, p.Y));
+            max = Point(std::max(max.X, p.X), std::max(max.Y, p.Y));
+            edgePolygon.push_back(n);
+            edgeIdx.push_back(i);
+        }
+    }
+    if (edgeIdx.size() == 0)
+    {
+        gridMin = max = Point(0, 0);
+    }
+    double width = std::max(int64_t(1), int64_t(max.X - gridMin.X));
+    double height = std::max(int64_t(1), int64_t(max.Y - gridMin.Y));
+    double cell = std::sqrt(width * height / std::max(size_t(1), edgeIdx.size())) * 2; // a few edges per cell
+    cell = std::max(cell, std::max(width, height) / 1024);
+    gridCellSize = std::max(int64_t(MM2INT(0.5)), int64_t(std::ceil(cell)));
+    gridWidth = (max.X - gridMin.X) / gridCellSize + 1;
+    gridHeight = (max.Y - gridMin.Y) / gridCellSize + 1;
+    gridCells.resize(gridWidth * gridHeight);
+    for(unsigned int e=0; e<edgeIdx.size(); e++)
+    {
+        PolygonRef poly = boundery[edgePolygon[e]];
+        Point p0 = poly[(edgeIdx[e] > 0)? edgeIdx[e] - 1 : poly.size() - 1];
+        Point p1 = poly[edgeIdx[e]];
+        forCellsAlong(p0, p1, 1, [&](unsigned int cell_idx) { gridCells[cell_idx].push_back(e); });
+    }
+    edgeStamp.resize(edgeIdx.size(), 0);
+    nearbyEdges.reserve(edgeIdx.size());
+    insideCrossings.resize(boundery.size());
+}
+
+template<typename Process>
+void Comb::forCellsAlong(Point a, Point b, int64_t margin, Process process)
+{
+    if (a.Y > b.Y)
+    {
+        std::swap(a, b);
+    }
+    int64_t row_min = std::max(int64_t(0), int64_t(a.Y - margin - gridMin.Y) / gridCellSize - 1);
+    int64_t row_max = std::min(gridHeight - 1, int64_t(b.Y + margin - gridMin.Y) / gridCellSize + 1);
+    for(int64_t row = row_min; row <= row_max; row++)
+    {
+        // the part of the line in this row, widened by the margin
+        double y0 = std::max(double(a.Y), double(gridMin.Y + row * gridCellSize - margin));
+        double y1 = std::min(double(b.Y), double(gridMin.Y + (row + 1) * gridCellSize + margin));
+        if (y0 > y1)
+        {
+            continue;
+        }
+        double x0 = a.X;
+        double x1 = b.X;
+        if (b.Y != a.Y)
+        {
+            x0 = a.X + (b.X - a.X) * (y0 - a.Y) / (b.Y - a.Y);
+            x1 = a.X + (b.X - a.X) * (y1 - a.Y) / (b.Y - a.Y);
+        }
+        int64_t col_min = std::max(int64_t(0), int64_t(std::floor((std::min(x0, x1) - margin - gridMin.X) / gridCellSize)) - 1);
+        int64_t col_max = std::min(gridWidth - 1, int64_t(std::floor((std::max(x0, x1) + margin - gridMin.X) / gridCellSize)) + 1);
+        for(int64_t col = col_min; col <= col_max; col++)
+        {
+            process(row * gridWidth + col);
+        }
+    }
+}
+
+void Comb::collectEdgesAlong(Point a, Point b, int64_t margin)
+{
+    if (!gridBuilt)
+    {
+        buildGrid();
+    }
+    nearbyEdges.clear();
+    queryStamp++;
+    forCellsAlong(a, b, margin, [&](unsigned int cell_idx)
+    {
+        for(unsigned int e : gridCells[cell_idx])
+        {
+            if (edgeStamp[e] != queryStamp)
+            {
+                edgeStamp[e] = queryStamp;
+                nearbyEdges.push_back(e);
+            }
+        }
+    });
+    std::sort(nearbyEdges.begin(), nearbyEdges.end());
+}
+
 bool Comb::preTest(Point startPoint, Point endPoint)
 {
     return collisionTest(startPoint, endPoint);
@@ -10,28 +115,26 @@ bool Comb::preTest(Point startPoint, Point endPoint)
 
 bool Comb::collisionTest(Point startPoint, Point endPoint)
 {
+    countStat(Stat_CombCollisionTests);
     Point diff = endPoint - startPoint;
 
     matrix = PointMatrix(diff);
     sp = matrix.apply(startPoint);
     ep = matrix.apply(endPoint);
     
-    for(unsigned int n=0; n<boundery.size(); n++)
+    collectEdgesAlong(startPoint, endPoint, COMB_ROUNDING_MARGIN);
+    for(unsigned int e : nearbyEdges)
     {
-        if (boundery[n].size() < 1)
-            continue;
-        Point p0 = matrix.apply(boundery[n][boundery[n].size()-1]);
-        for(unsigned int i=0; i<boundery[n].size(); i++)
+        PolygonRef poly = boundery[edgePolygon[e]];
+        unsigned int i = edgeIdx[e];
+        Point p0 = matrix.apply(poly[(i > 0)? i - 1 : poly.size() - 1]);
+        Point p1 = matrix.apply(poly[i]);
+        if ((p0.Y > sp.Y && p1.Y < sp.Y) || (p1.Y > sp.Y && p0.Y < sp.Y))
         {
-            Point p1 = matrix.apply(boundery[n][i]);
-            if ((p0.Y > sp.Y && p1.Y < sp.Y) || (p1.Y > sp.Y && p0.Y < sp.Y))
-            {
-                int64_t x = p0.X + (p1.X - p0.X) * (sp.Y - p0.Y) / (p1.Y - p0.Y);
-                
-                if (x > sp.X && x < ep.X)
-                    return true;
-            }
-            p0 = p1;
+            int64_t x = p0.X + int64_t(p1.X - p0.X) * (sp.Y - p0.Y) / (p1.Y - p0.Y);
+            
+            if (x > sp.X && x < ep.X)
+                return true;
         }
     }
     return false;
@@ -43,21 +146,23 @@ void Comb::calcMinMax()
     {
         minX[n] = INT64_MAX;
         maxX[n] = INT64_MIN;
-        Point p0 = matrix.apply(boundery[n][boundery[n].size()-1]);
-        for(unsigned int i=0; i<boundery[n].size(); i++)
+    }
+    collectEdgesAlong(matrix.unapply(sp), matrix.unapply(ep), COMB_ROUNDING_MARGIN);
+    for(unsigned int e : nearbyEdges)
+    {
+        unsigned int n = edgePolygon[e];
+        unsigned int i = edgeIdx[e];
+        Point p0 = matrix.apply(boundery[n][(i > 0)? i - 1 : boundery[n].size() - 1]);
+        Point p1 = matrix.apply(boundery[n][i]);
+        if ((p0.Y > sp.Y && p1.Y < sp.Y) || (p1.Y > sp.Y && p0.Y < sp.Y))
         {
-            Point p1 = matrix.apply(boundery[n][i]);
-            if ((p0.Y > sp.Y && p1.Y < sp.Y) || (p1.Y > sp.Y && p0.Y < sp.Y))
+            int64_t x = p0.X + int64_t(p1.X - p0.X) * (sp.Y - p0.Y) / (p1.Y - p0.Y);
+            
+            if (x >= sp.X && x <= ep.X)
             {
-                int64_t x = p0.X + (p1.X - p0.X) * (sp.Y - p0.Y) / (p1.Y - p0.Y);
-                
-                if (x >= sp.X && x <= ep.X)
-                {
-                    if (x < minX[n]) { minX[n] = x; minIdx[n] = i; }
-                    if (x > maxX[n]) { maxX[n] = x; maxIdx[n] = i; }
-                }
+                if (x < minX[n]) { minX[n] = x; minIdx[n] = i; }
+                if (x > maxX[n]) { maxX[n] = x; maxIdx[n] = i; }
             }
-            p0 = p1;
         }
     }
 }
@@ -92,52 +197,63 @@ Point Comb::getBounderyPointWithOffset(unsigned int polygonNr, unsigned int idx)
 
 Comb::Comb(Polygons& _boundery)
 : boundery(_boundery)
+, minX(boundery.size())
+, maxX(boundery.size())
+, minIdx(boundery.size())
+, maxIdx(boundery.size())
+, gridBuilt(false)
+, queryStamp(0)
 {
-    minX = new int64_t[boundery.size()];
-    maxX = new int64_t[boundery.size()];
-    minIdx = new unsigned int[boundery.size()];
-    maxIdx = new unsigned int[boundery.size()];
 }
 
-Comb::~Comb()
+size_t Comb::getMemoryUsage() const
 {
-    delete[] minX;
-    delete[] maxX;
-    delete[] minIdx;
-    delete[] maxIdx;
+    size_t memory = (minX.capacity() + maxX.capacity()) * sizeof(int64_t) + (minIdx.capacity() + maxIdx.capacity()) * sizeof(unsigned int);
+    memory += gridCells.capacity() * sizeof(std::vector<unsigned int>);
+    for (const std::vector<unsigned int>& cell : gridCells)
+    {
+        memory += cell.capacity() * sizeof(unsigned int);
+    }
+    memory += (edgePolygon.capacity() + edgeIdx.capacity() + edgeStamp.capacity() + nearbyEdges.capacity()) * sizeof(unsigned int);
+    memory += insideCrossings.capacity() * sizeof(int);
+    return memory;
+}
+
+void Comb::prepare()
+{
+    if (!gridBuilt)
+    {
+        buildGrid();
+    }
 }
 
 bool Comb::moveInside(Point* p, int distance)
 {
     Point ret = *p;
     int64_t bestDist = MM2INT(2.0) * MM2INT(2.0);
-    for(unsigned int n=0; n<boundery.size(); n++)
+    collectEdgesAlong(*p, *p, MM2INT(2.0) + 20); // the closest point on an edge can lie 10 beyond its end
+    for(unsigned int e : nearbyEdges)
     {
-        if (boundery[n].size() < 1)
-            continue;
-        Point p0 = boundery[n][boundery[n].size()-1];
-        for(unsigned int i=0; i<boundery[n].size(); i++)
+        PolygonRef poly = boundery[edgePolygon[e]];
+        unsigned int i = edgeIdx[e];
+        Point p0 = poly[(i > 0)? i - 1 : poly.size() - 1];
+        Point p1 = poly[i];
+        
+        //Q = A + Normal( B - A ) * ((( B - A ) dot ( P - A )) / VSize( A - B ));
+        Point pDiff = p1 - p0;
+        int64_t lineLength = vSize(pDiff);
+        int64_t distOnLine = dot(pDiff, *p - p0) / lineLength;
+        if (distOnLine < 10)
+            distOnLine = 10;
+        if (distOnLine > lineLength - 10)
+            distOnLine = lineLength - 10;
+        Point q = p0 + pDiff * distOnLine / lineLength;
+        
+        int64_t dist = vSize2(q - *p);
+        if (dist < bestDist)
         {
-            Point p1 = boundery[n][i];
-            
-            //Q = A + Normal( B - A ) * ((( B - A ) dot ( P - A )) / VSize( A - B ));
-            Point pDiff = p1 - p0;
-            int64_t lineLength = vSize(pDiff);
-            int64_t distOnLine = dot(pDiff, *p - p0) / lineLength;
-            if (distOnLine < 10)
-                distOnLine = 10;
-            if (distOnLine > lineLength - 10)
-                distOnLine = lineLength - 10;
-            Point q = p0 + pDiff * distOnLine / lineLength;
-            
-            int64_t dist = vSize2(q - *p);
-            if (dist < bestDist)
-            {
-                bestDist = dist;
-                ret = q + crossZ(normal(p1 - p0, distance));
-            }
-            
-            p0 = p1;
+            bestDist = dist;
+            ret = q + crossZ(normal(p1 - p0, distance));
         }
     }
     if (bestDist < MM2INT(2.0) * MM2INT(2.0))
@@ -148,20 +264,50 @@ bool Comb::moveInside(Point* p, int distance)
     return false;
 }
 
+bool Comb::inside(const Point p)
+{
+    if (boundery.size() < 1)
+        return false;
+    if (!gridBuilt)
+        buildGrid();
+    collectEdgesAlong(p, Point(gridMin.X + gridWidth * gridCellSize, p.Y), 1); // the edges which can cross the ray from p to the right
+    std::fill(insideCrossings.begin(), insideCrossings.end(), 0);
+    for(unsigned int e : nearbyEdges)
+    {
+        unsigned int n = edgePolygon[e];
+        if (insideCrossings[n] < 0)
+            continue;
+        PolygonRef poly = boundery[n];
+        unsigned int i = edgeIdx[e];
+        int crossing = PolygonRef::rayCrossing(poly[(i > 0)? i - 1 : poly.size() - 1], poly[i], p);
+        insideCrossings[n] = (crossing < 0)? -1 : insideCrossings[n] + crossing;
+    }
+    if (insideCrossings[0] < 0 || insideCrossings[0] % 2 == 0) // outside the outline, or on its border
+        return false;
+    for(unsigned int n=1; n<boundery.size(); n++)
+    {
+        if (insideCrossings[n] > 0 && insideCrossings[n] % 2 == 1) // inside a hole
+            return false;
+    }
+    return true;
+}
+
 bool Comb::calc(Point startPoint, Point endPoint, std::vector<Point>& combPoints)
 {
+    TRACE_ZONE("Comb::calc");
+    countStat(Stat_CombQueries);
     if (shorterThen(endPoint - startPoint, MM2INT(1.5)))
         return true;
     
     bool addEndpoint = false;
     //Check if we are inside the comb boundaries
-    if (!boundery.inside(startPoint))
+    if (!inside(startPoint))
     {
         if (!moveInside(&startPoint))    //If we fail to move the point inside the comb boundary we need to retract.
             return false;
         combPoints.push_back(startPoint);
     }
-    if (!boundery.inside(endPoint))
+    if (!inside(endPoint))
     {
         if (!moveInside(&endPoint))    //If we fail to move the point inside the comb boundary we need to retract.
             return false;
@@ -2,6 +2,8 @@
 #ifndef COMB_H
 #define COMB_H
 
+#include <vector>
+
 #include "utils/polygon.h"
 
 namespace cura {
@@ -11,15 +13,48 @@ class Comb
 private:
     Polygons& boundery;
 
-    int64_t* minX;
-    int64_t* maxX;
-    unsigned int* minIdx;
-    unsigned int* maxIdx;
+    std::vector<int64_t> minX;
+    std::vector<int64_t> maxX;
+    std::vector<unsigned int> minIdx;
+    std::vector<unsigned int> maxIdx;
 
     PointMatrix matrix;
     Point sp;
     Point ep;
 
+    /*
+    The edges of the boundary are kept in a uniform grid, so that the tests below only look at the edges near the travel
+    or the point being tested. The edges near a travel are still tested in the rotated frame of the travel, exactly like
+    a test over all edges would, so the grid never changes the result. The grid is built by prepare(), or else on the first test.
+    Edge e is the edge of polygon edgePolygon[e] ending at vertex edgeIdx[e], starting at the vertex before it.
+    */
+    bool gridBuilt;
+    Point gridMin; //!< The lower left corner of the grid
+    int64_t gridCellSize; //!< The width and height of a cell
+    int64_t gridWidth; //!< The number of cells in the x direction
+    int64_t gridHeight; //!< The number of cells in the y direction
+    std::vector<std::vector<unsigned int>> gridCells; //!< The edges passing through each cell, row by row
+    std::vector<unsigned int> edgePolygon;
+    std::vector<unsigned int> edgeIdx;
+    std::vector<unsigned int> edgeStamp; //!< The query in which each edge was last collected, so it is collected once
+    unsigned int queryStamp;
+    std::vector<unsigned int> nearbyEdges; //!< The edges collected by the last call to collectEdgesAlong, in order
+    std::vector<int> insideCrossings; //!< Used by inside(): for each polygon the number of crossings with the ray, or -1 when on the border
+
+    void buildGrid();
+
+    /*!
+     * Call \p process with the index in #gridCells of every cell within \p margin of the line from \p a to \p b.
+     */
+    template<typename Process>
+    void forCellsAlong(Point a, Point b, int64_t margin, Process process);
+
+    /*!
+     * Collect in #nearbyEdges, in order, all edges which pass within \p margin of the line from \p a to \p b, and possibly
+     * some edges further away.
+     */
+    void collectEdgesAlong(Point a, Point b, int64_t margin);
+
     bool preTest(Point startPoint, Point endPoint);    
     bool collisionTest(Point startPoint, Point endPoint);
 
@@ -31,12 +66,19 @@ private:
     
 public:
     Comb(Polygons& _boundery);
-    ~Comb();
     
-    bool inside(const Point p) { return boundery.inside(p); }
+    /*!
+     * Build the grid of boundary edges up front, so that the tests don't allocate anything but their results.
+     * Combs of different boundaries can be prepared in parallel.
+     */
+    void prepare();
+    
+    bool inside(const Point p); //!< Same as Polygons::inside on the boundary
     bool moveInside(Point* p, int distance = 100);
     
     bool calc(Point startPoint, Point endPoint, std::vector<Point>& combPoints);
+
+    size_t getMemoryUsage() const; //!< The heap memory held by the grid and the per polygon bounds, in bytes
 };
 
 }//namespace cura
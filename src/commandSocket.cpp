@@ -1,11 +1,22 @@
 #include "utils/logoutput.h"
 #include "commandSocket.h"
 #include "fffProcessor.h"
-
+#include "sessionRecording.h"
+#include "utils/asyncOutput.h"
+#include "utils/gettime.h"
+#include "utils/stats.h"
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
 #include <thread>
 #include <cinttypes>
+#include <cmath> // llround
+#include <cstring> // memcpy
 
 #include <Arcus/Socket.h>
+#include <google/protobuf/arena.h>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -16,35 +27,385 @@ namespace cura {
 #define BYTES_PER_FLOAT 4
 #define FLOATS_PER_VECTOR 3
 #define VECTORS_PER_FACE 3
+#define BYTES_PER_INDEX 4
+#define GCODE_CHUNK_SIZE (256 * 1024) //!< The maximum amount of GCode in a GCodeLayer message
+
+namespace
+{
+
+/*!
+ * Append a coordinate difference to \p result as a zigzag varint: small differences of either sign take a single byte.
+ */
+void appendZigzagVarint(int64_t value, std::string& result)
+{
+    uint64_t zigzag = (uint64_t(value) << 1) ^ uint64_t(value >> 63);
+    while (zigzag >= 0x80)
+    {
+        result.push_back(char(zigzag | 0x80));
+        zigzag >>= 7;
+    }
+    result.push_back(char(zigzag));
+}
+
+/*!
+ * Encode the points of a polygon as Cura::Polygon::DeltaVarintPoints.
+ * 
+ * \param polygon The polygon
+ * \param quantum The unit of the encoded coordinates, in micron
+ * \param result Where to store the encoded points
+ */
+void encodePreviewPoints(PolygonRef polygon, int quantum, std::string& result)
+{
+    result.clear();
+    result.reserve(polygon.size() * 4);
+    int64_t last_x = 0;
+    int64_t last_y = 0;
+    for(unsigned int i = 0; i < polygon.size(); ++i)
+    {
+        int64_t x = std::llround(double(polygon[i].X) / quantum);
+        int64_t y = std::llround(double(polygon[i].Y) / quantum);
+        appendZigzagVarint(x - last_x, result);
+        appendZigzagVarint(y - last_y, result);
+        last_x = x;
+        last_y = y;
+    }
+}
+
+const uint32_t message_type_count = 10; //!< The Arcus type ids of the messages are 1 up to and including this
+
+/*!
+ * The message with an Arcus type id, to create messages of that type from; nullptr if there is no such type.
+ */
+const google::protobuf::Message* getMessagePrototype(uint32_t type_id)
+{
+    switch(type_id)
+    {
+    case 1: return &Cura::ObjectList::default_instance();
+    case 2: return &Cura::SlicedObjectList::default_instance();
+    case 3: return &Cura::Progress::default_instance();
+    case 4: return &Cura::GCodeLayer::default_instance();
+    case 5: return &Cura::ObjectPrintTime::default_instance();
+    case 6: return &Cura::SettingList::default_instance();
+    case 7: return &Cura::GCodePrefix::default_instance();
+    case 8: return &Cura::PrintStatistics::default_instance();
+    case 9: return &Cura::GCodeCredit::default_instance();
+    case 10: return &Cura::SlicingStatistics::default_instance();
+    default: return nullptr;
+    }
+}
+
+/*!
+ * The Arcus type id of a message; zero if its type isn't one of them.
+ */
+uint32_t getMessageTypeId(const google::protobuf::Message& message)
+{
+    for(uint32_t type_id = 1; type_id <= message_type_count; type_id++)
+    {
+        if(getMessagePrototype(type_id)->GetDescriptor() == message.GetDescriptor())
+        {
+            return type_id;
+        }
+    }
+    return 0;
+}
+
+/*!
+ * Where the messages of a session come from and go to.
+ */
+class MessageChannel
+{
+public:
+    virtual ~MessageChannel() {}
+
+    /*!
+     * Whether more messages may come.
+     */
+    virtual bool isOpen() = 0;
+
+    /*!
+     * The next message which has arrived, if any.
+     */
+    virtual Arcus::MessagePtr takeNextMessage() = 0;
+
+    /*!
+     * Send a message; safe to call from several threads.
+     */
+    virtual void sendMessage(Arcus::MessagePtr message) = 0;
+
+    /*!
+     * Log the errors which occurred since the last call.
+     */
+    virtual void logErrors() {}
+};
+
+/*!
+ * The socket to the front-end, of which the incoming messages can be recorded.
+ */
+class SocketChannel : public MessageChannel
+{
+public:
+    SocketChannel(const std::string& ip, int port, const std::string& record_file)
+    {
+        for(uint32_t type_id = 1; type_id <= message_type_count; type_id++)
+        {
+            socket.registerMessageType(type_id, getMessagePrototype(type_id));
+        }
+        if(!record_file.empty() && !recorder.open(record_file))
+        {
+            logError("Failed to open %s for recording the session\n", record_file.c_str());
+        }
+        socket.connect(ip, port);
+    }
+
+    bool isOpen() override
+    {
+        return socket.state() != Arcus::SocketState::Closed && socket.state() != Arcus::SocketState::Error;
+    }
+
+    Arcus::MessagePtr takeNextMessage() override
+    {
+        Arcus::MessagePtr message = socket.takeNextMessage();
+        if(message)
+        {
+            recorder.record(getMessageTypeId(*message), message->SerializeAsString());
+        }
+        return message;
+    }
+
+    void sendMessage(Arcus::MessagePtr message) override
+    {
+        socket.sendMessage(message);
+    }
+
+    void logErrors() override
+    {
+        if(!socket.errorString().empty()) {
+            logError("%s\n", socket.errorString().data());
+            socket.clearError();
+        }
+    }
+
+private:
+    Arcus::Socket socket;
+    SessionRecorder recorder;
+};
+
+/*!
+ * A recorded session, of which the messages arrive as long after the first one as they did when it was recorded. The
+ * messages sent back are dropped, but for when the preview and the GCode of each job started coming and when the job
+ * was done.
+ *
+ * The GCode credit isn't replayed, since the GCode is chunked differently from one run to the next: the GCode is taken
+ * as soon as it is sent. The session ends when all messages have arrived and all jobs are done.
+ */
+class ReplayChannel : public MessageChannel
+{
+public:
+    ReplayChannel(std::vector<RecordedMessage>&& messages)
+    : messages(std::move(messages))
+    , next_message(0)
+    , start_time(getTime())
+    , closed(false)
+    , current_job(0)
+    { }
+
+    bool isOpen() override
+    {
+        return !closed;
+    }
+
+    Arcus::MessagePtr takeNextMessage() override
+    {
+        if(next_message >= messages.size())
+        {
+            std::lock_guard<std::mutex> lock(jobs_mutex);
+            closed = current_job >= jobs.size(); // a job may still be waiting in the messages the socket thread deferred
+            return Arcus::MessagePtr();
+        }
+        const RecordedMessage& recorded = messages[next_message];
+        double due_time = (recorded.time - messages[0].time) * 1e-6;
+        if(getTime() - start_time < due_time)
+        {
+            return Arcus::MessagePtr();
+        }
+        next_message++;
+        if(recorded.type_id == getMessageTypeId(Cura::GCodeCredit::default_instance()))
+        {
+            return Arcus::MessagePtr();
+        }
+        const google::protobuf::Message* prototype = getMessagePrototype(recorded.type_id);
+        Arcus::MessagePtr message(prototype? prototype->New() : nullptr);
+        if(!message || !message->ParseFromString(recorded.data))
+        {
+            logError("Skipped a recorded message of type %u which couldn't be read\n", recorded.type_id);
+            return Arcus::MessagePtr();
+        }
+        if(dynamic_cast<Cura::ObjectList*>(message.get()))
+        {
+            std::lock_guard<std::mutex> lock(jobs_mutex);
+            jobs.emplace_back(due_time);
+        }
+        return message;
+    }
+
+    void sendMessage(Arcus::MessagePtr message) override
+    {
+        double time = getTime() - start_time;
+        std::lock_guard<std::mutex> lock(jobs_mutex);
+        if(current_job >= jobs.size())
+        {
+            return;
+        }
+        Job& job = jobs[current_job];
+        if(dynamic_cast<Cura::SlicedObjectList*>(message.get()) && job.first_layers < 0)
+        {
+            job.first_layers = time - job.start;
+        }
+        Cura::GCodeLayer* gcode = dynamic_cast<Cura::GCodeLayer*>(message.get());
+        if(gcode)
+        {
+            if(job.first_gcode < 0)
+            {
+                job.first_gcode = time - job.start;
+            }
+            job.gcode_size += gcode->data().size();
+        }
+        if(dynamic_cast<Cura::ObjectPrintTime*>(message.get()))
+        { // sent at the end of each job, also when it was abandoned for a newer one
+            job.done = time - job.start;
+            current_job++;
+        }
+    }
+
+    /*!
+     * Log how long the front-end waited for each job.
+     */
+    void logResults()
+    {
+        std::lock_guard<std::mutex> lock(jobs_mutex);
+        for(unsigned int job_idx = 0; job_idx < jobs.size(); job_idx++)
+        {
+            const Job& job = jobs[job_idx];
+            bool abandoned = job_idx + 1 < jobs.size() && jobs[job_idx + 1].start < job.start + job.done;
+            logError("Job %u: first layers after %.3fs, first GCode after %.3fs, done after %.3fs, %zu bytes of GCode%s\n", job_idx, job.first_layers, job.first_gcode, job.done, job.gcode_size, abandoned? " (abandoned)" : "");
+        }
+        logError("Replayed %zu messages and %zu jobs in %.3fs\n", messages.size(), jobs.size(), getTime() - start_time);
+    }
+
+private:
+    /*!
+     * The timings of a job, from the time its object list was due, in seconds; negative if it hasn't happened.
+     */
+    struct Job
+    {
+        Job(double start)
+        : start(start)
+        , first_layers(-1)
+        , first_gcode(-1)
+        , done(-1)
+        , gcode_size(0)
+        { }
+
+        double start; //!< When the object list was due, since the replay started
+        double first_layers; //!< When the first layers for the preview were sent
+        double first_gcode; //!< When the first GCode was sent
+        double done; //!< When the print time was sent, at the end of the job
+        size_t gcode_size; //!< The bytes of GCode sent
+    };
+
+    std::vector<RecordedMessage> messages;
+    unsigned int next_message; //!< The index of the next message to arrive
+    double start_time; //!< When the replay started
+    bool closed; //!< Whether all messages have arrived and all jobs were done when the socket thread asked for more
+
+    std::mutex jobs_mutex; //!< Guards the below, as GCode is sent from another thread
+    std::vector<Job> jobs; //!< The jobs, in the order their object lists arrived
+    unsigned int current_job; //!< The first job which isn't done
+};
+
+}//anonymous namespace
 
 class CommandSocket::Private
 {
 public:
     Private()
         : processor(nullptr)
-        , socket(nullptr)
         , object_count(0)
         , current_object_number(0)
-        , currentSlicedObject(nullptr)
+        , sendingSlicedObject(false)
+        , previewTolerance(0)
         , slicedObjects(0)
+        , gcodeFlowControl(false)
+        , gcodeCredit(0)
     { }
 
+    /*!
+     * Get the layer with the given id among the layers which haven't been sent yet, creating it on layerArena if need be.
+     */
     Cura::Layer* getLayerById(int id);
 
+    /*!
+     * Get the arena to allocate the pending layers and the message they are sent in on, starting a new one if need be.
+     */
+    google::protobuf::Arena* getLayerArena();
+
+    /*!
+     * Start collecting the layers of the next sliced object.
+     */
+    void beginSlicedObject();
+
+    /*!
+     * Send the layers of the current sliced object from the start of pendingLayers up to \p end, as one message.
+     */
+    void sendLayers(std::map<int, Cura::Layer*>::iterator end);
+
+    /*!
+     * Move the layers of the current sliced object from the start of pendingLayers up to \p end into one message, which
+     * is added to sentLayerMessages without sending it.
+     */
+    std::shared_ptr<Cura::SlicedObjectList> collectLayers(std::map<int, Cura::Layer*>::iterator end);
+
+    /*!
+     * Take the next message for the socket thread to handle, if any.
+     */
+    Arcus::MessagePtr takeNextMessage();
+
+    /*!
+     * Wait until the front-end is ready to receive another GCodeLayer message, when it uses flow control.
+     * 
+     * Called from the thread sending the GCode, which receives the messages when the socket thread is busy slicing.
+     */
+    void waitForGCodeCredit();
+
     fffProcessor* processor;
 
-    Arcus::Socket* socket;
+    std::unique_ptr<MessageChannel> channel; //!< The socket to the front-end, or the recorded session being replayed
 
     int object_count;
     int current_object_number;
 
-    std::shared_ptr<Cura::SlicedObjectList> slicedObjectList;
-    Cura::SlicedObject* currentSlicedObject;
+    bool sendingSlicedObject; //!< Whether the layers of a sliced object are being collected
+    int previewTolerance; //!< How far the polygons sent for the current sliced object may deviate from the real ones; zero to send them exactly
+    std::map<int, Cura::Layer*> pendingLayers; //!< The layers of the current sliced object which haven't been sent yet, by id; owned by layerArena
+    std::shared_ptr<google::protobuf::Arena> layerArena; //!< The arena of the pending layers, which the messages sent with them keep alive
+    std::vector<std::vector<std::shared_ptr<Cura::SlicedObjectList>>> sentLayerMessages; //!< For each sliced object of this job the messages sent with its layers
+    std::vector<std::vector<std::shared_ptr<Cura::SlicedObjectList>>> previousLayerMessages; //!< The sentLayerMessages of the previous job, for the objects which haven't been sent again yet
     int slicedObjects;
     std::vector<int64_t> objectIds;
 
     std::string tempGCodeFile;
-    std::ostringstream gcode_output_stream;
+    std::unique_ptr<AsyncOutputStream> gcode_output_stream; //!< Sends the GCode as GCodeLayer messages from a background thread
+
+    std::mutex messageMutex; //!< Guards receiving messages and the members below, which are used by both the socket thread and the thread sending the GCode
+    std::condition_variable creditGranted; //!< Notified when the socket thread receives GCode credit
+    bool gcodeFlowControl; //!< Whether the front-end has granted GCode credit, after which no more GCode is sent than it has granted
+    int gcodeCredit; //!< The number of GCodeLayer messages which may still be sent
+    std::deque<Arcus::MessagePtr> deferredMessages; //!< Messages received by the thread sending the GCode, for the socket thread to handle
+
+    /*!
+     * Receive a message from the channel, handling it here if it grants GCode credit. Requires messageMutex to be locked.
+     */
+    Arcus::MessagePtr receiveMessage();
 
     std::shared_ptr<PrintObject> objectToSlice;
 };
@@ -56,20 +417,33 @@ CommandSocket::CommandSocket(fffProcessor* processor)
     d->processor->setCommandSocket(this);
 }
 
-void CommandSocket::connect(const std::string& ip, int port)
+CommandSocket::~CommandSocket()
 {
-    d->socket = new Arcus::Socket();
-    d->socket->registerMessageType(1, &Cura::ObjectList::default_instance());
-    d->socket->registerMessageType(2, &Cura::SlicedObjectList::default_instance());
-    d->socket->registerMessageType(3, &Cura::Progress::default_instance());
-    d->socket->registerMessageType(4, &Cura::GCodeLayer::default_instance());
-    d->socket->registerMessageType(5, &Cura::ObjectPrintTime::default_instance());
-    d->socket->registerMessageType(6, &Cura::SettingList::default_instance());
-    d->socket->registerMessageType(7, &Cura::GCodePrefix::default_instance());
+}
+
+void CommandSocket::connect(const std::string& ip, int port, const std::string& record_file)
+{
+    d->channel.reset(new SocketChannel(ip, port, record_file));
+    run();
+}
 
-    d->socket->connect(ip, port);
+bool CommandSocket::replay(const std::string& record_file)
+{
+    std::vector<RecordedMessage> messages;
+    if(!readSessionRecording(record_file, messages))
+    {
+        return false;
+    }
+    ReplayChannel* channel = new ReplayChannel(std::move(messages));
+    d->channel.reset(channel);
+    run();
+    channel->logResults();
+    return true;
+}
 
-    while(d->socket->state() != Arcus::SocketState::Closed && d->socket->state() != Arcus::SocketState::Error)
+void CommandSocket::run()
+{
+    while(d->channel->isOpen())
     {
         if(d->objectToSlice)
         {
@@ -79,9 +453,19 @@ void CommandSocket::connect(const std::string& ip, int port)
             d->processor->resetFileNumber();
 
             sendPrintTime();
+            sendPrintStatistics();
+            if (isStatsEnabled())
+            {
+                sendSlicingStatistics();
+                clearStats();
+            }
         }
 
-        Arcus::MessagePtr message = d->socket->takeNextMessage();
+        Arcus::MessagePtr message = d->takeNextMessage();
+        if(!message)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(250));
+        }
 
         Cura::SettingList* settingList = dynamic_cast<Cura::SettingList*>(message.get());
         if(settingList)
@@ -95,12 +479,7 @@ void CommandSocket::connect(const std::string& ip, int port)
             handleObjectList(objectList);
         }
 
-        std::this_thread::sleep_for(std::chrono::milliseconds(250));
-
-        if(!d->socket->errorString().empty()) {
-            logError("%s\n", d->socket->errorString().data());
-            d->socket->clearError();
-        }
+        d->channel->logErrors();
     }
 }
 
@@ -111,29 +490,41 @@ void CommandSocket::handleObjectList(Cura::ObjectList* list)
     d->objectIds.clear();
 
     d->objectToSlice = std::make_shared<PrintObject>(d->processor);
-    for(auto object : list->objects())
+    for(const Cura::Object& object : list->objects())
     {
         d->objectToSlice->meshes.emplace_back(d->objectToSlice.get()); //Construct a new mesh and put it into printObject's mesh list.
         Mesh& mesh = d->objectToSlice->meshes.back();
 
-        int bytesPerFace = BYTES_PER_FLOAT * FLOATS_PER_VECTOR * VECTORS_PER_FACE;
-        int faceCount = object.vertices().size() / bytesPerFace;
-        for(int i = 0; i < faceCount; ++i)
+        for(const Cura::Setting& setting : object.settings())
         {
-            //TODO: Apply matrix
-            std::string data = object.vertices().substr(i * bytesPerFace, bytesPerFace);
-            const FPoint3* floatVerts = reinterpret_cast<const FPoint3*>(data.data());
-
-            Point3 verts[3];
-            verts[0] = matrix.apply(floatVerts[0]);
-            verts[1] = matrix.apply(floatVerts[1]);
-            verts[2] = matrix.apply(floatVerts[2]);
-            mesh.addFace(verts[0], verts[1], verts[2]);
+            mesh.setSetting(setting.name(), setting.value());
         }
 
-        for(auto setting : object.settings())
+        // Read the vertices straight from the message. The bytes aren't necessarily aligned for floats, hence the memcpy.
+        const std::string& vertex_data = object.vertices();
+        int bytesPerVertex = BYTES_PER_FLOAT * FLOATS_PER_VECTOR;
+        unsigned int vertexCount = vertex_data.size() / bytesPerVertex;
+        std::vector<Point3> positions(vertexCount);
+        for(unsigned int i = 0; i < vertexCount; ++i)
         {
-            mesh.setSetting(setting.name(), setting.value());
+            //TODO: Apply matrix
+            float coords[FLOATS_PER_VECTOR];
+            memcpy(coords, vertex_data.data() + i * bytesPerVertex, sizeof(coords));
+            positions[i] = matrix.apply(FPoint3(coords[0], coords[1], coords[2]));
+        }
+
+        if (object.indices().size() > 0)
+        { // an indexed mesh: the vertices are already shared between the faces, so they don't need to be welded
+            int bytesPerFace = BYTES_PER_INDEX * VECTORS_PER_FACE;
+            unsigned int faceCount = object.indices().size() / bytesPerFace;
+            std::vector<uint32_t> indices(faceCount * VECTORS_PER_FACE);
+            memcpy(indices.data(), object.indices().data(), faceCount * bytesPerFace);
+            mesh.addIndexedFaces(positions, indices.data(), faceCount);
+        }
+        else
+        { // three vertices per face
+            mesh.reserve(vertexCount / VECTORS_PER_FACE);
+            mesh.addFaces(positions);
         }
 
         d->objectIds.push_back(object.id());
@@ -145,7 +536,7 @@ void CommandSocket::handleObjectList(Cura::ObjectList* list)
 
 void CommandSocket::handleSettingList(Cura::SettingList* list)
 {
-    for(auto setting : list->settings())
+    for(const Cura::Setting& setting : list->settings())
     {
         d->processor->setSetting(setting.name(), setting.value());
     }
@@ -153,7 +544,7 @@ void CommandSocket::handleSettingList(Cura::SettingList* list)
 
 void CommandSocket::sendLayerInfo(int layer_nr, int32_t z, int32_t height)
 {
-    if(!d->currentSlicedObject)
+    if(!d->sendingSlicedObject)
     {
         return;
     }
@@ -165,7 +556,7 @@ void CommandSocket::sendLayerInfo(int layer_nr, int32_t z, int32_t height)
 
 void CommandSocket::sendPolygons(PolygonType type, int layer_nr, Polygons& polygons, int line_width)
 {
-    if(!d->currentSlicedObject)
+    if(!d->sendingSlicedObject)
         return;
     
     if (polygons.size() == 0)
@@ -173,13 +564,45 @@ void CommandSocket::sendPolygons(PolygonType type, int layer_nr, Polygons& polyg
 
     Cura::Layer* layer = d->getLayerById(layer_nr);
 
+    if(d->previewTolerance > 0)
+    {
+        // the preview doesn't need the full resolution; simplify the polygons and send their points compactly
+        int quantum = std::max(1, d->previewTolerance / 2);
+        Polygons simplified = polygons.simplify(d->previewTolerance);
+        for(unsigned int i = 0; i < simplified.size(); ++i)
+        {
+            if(simplified[i].size() < 2)
+            {
+                continue;
+            }
+            Cura::Polygon* p = layer->add_polygons();
+            p->set_type(static_cast<Cura::Polygon_Type>(type));
+            p->set_encoding(Cura::Polygon::DeltaVarintPoints);
+            p->set_quantum(quantum);
+            encodePreviewPoints(simplified[i], quantum, *p->mutable_points());
+            p->set_line_width(line_width);
+        }
+        return;
+    }
+
     for(unsigned int i = 0; i < polygons.size(); ++i)
     {
         Cura::Polygon* p = layer->add_polygons();
         p->set_type(static_cast<Cura::Polygon_Type>(type));
-        std::string polydata;
-        polydata.append(reinterpret_cast<const char*>(polygons[i].data()), polygons[i].size() * sizeof(Point));
-        p->set_points(polydata);
+#ifdef use_int32
+        // the front end reads the raw points as 64 bit coordinates, which are widened straight into the message
+        std::string& points = *p->mutable_points();
+        points.resize(polygons[i].size() * 2 * sizeof(int64_t));
+        char* out = &points[0];
+        for (const Point& point : polygons[i])
+        {
+            const int64_t coordinates[2] = { point.X, point.Y };
+            memcpy(out, coordinates, sizeof(coordinates));
+            out += sizeof(coordinates);
+        }
+#else
+        p->set_points(reinterpret_cast<const char*>(polygons[i].data()), polygons[i].size() * sizeof(Point));
+#endif
         p->set_line_width(line_width);
     }
 }
@@ -188,7 +611,7 @@ void CommandSocket::sendProgress(float amount)
 {
     auto message = std::make_shared<Cura::Progress>();
     message->set_amount(amount);
-    d->socket->sendMessage(message);
+    d->channel->sendMessage(message);
 }
 
 void CommandSocket::sendPrintTime()
@@ -196,7 +619,52 @@ void CommandSocket::sendPrintTime()
     auto message = std::make_shared<Cura::ObjectPrintTime>();
     message->set_time(d->processor->getTotalPrintTime());
     message->set_material_amount(d->processor->getTotalFilamentUsed(0));
-    d->socket->sendMessage(message);
+    d->channel->sendMessage(message);
+}
+
+void CommandSocket::sendPrintStatistics()
+{
+    auto message = std::make_shared<Cura::PrintStatistics>();
+    for (const PrintStatistics::Entry& entry : d->processor->getPrintStatistics().getEntries())
+    {
+        Cura::FeatureStatistics* features = message->add_features();
+        features->set_layer(entry.layer);
+        features->set_feature(entry.feature);
+        features->set_time(entry.time);
+        features->set_travel_distance(entry.travel_distance);
+        features->set_extrusion_volume(entry.extrusion_volume);
+        features->set_welding_time(entry.welding_time);
+    }
+    d->channel->sendMessage(message);
+}
+
+void CommandSocket::sendSlicingStatistics()
+{
+    StatsReport report = getStats();
+    auto message = std::make_shared<Cura::SlicingStatistics>();
+    for (unsigned int counter = 0; counter < Stat_Count; counter++)
+    {
+        message->add_counters(getStatName(static_cast<StatCounter>(counter)));
+    }
+    for (const std::pair<std::string, StatCounts>& stage : report.stages)
+    {
+        Cura::SlicingStatisticsEntry* entry = message->add_stages();
+        entry->set_stage(stage.first);
+        for (uint64_t value : stage.second)
+        {
+            entry->add_values(value);
+        }
+    }
+    for (unsigned int layer_nr = 0; layer_nr < report.layers.size(); layer_nr++)
+    {
+        Cura::SlicingStatisticsEntry* entry = message->add_layers();
+        entry->set_layer(layer_nr);
+        for (uint64_t value : report.layers[layer_nr])
+        {
+            entry->add_values(value);
+        }
+    }
+    d->channel->sendMessage(message);
 }
 
 void CommandSocket::sendPrintMaterialForObject(int index, int extruder_nr, float print_time)
@@ -210,65 +678,244 @@ void CommandSocket::sendPrintMaterialForObject(int index, int extruder_nr, float
 
 void CommandSocket::beginSendSlicedObject()
 {
-    if(!d->slicedObjectList)
+    d->beginSlicedObject();
+    if(d->slicedObjects < int(d->previousLayerMessages.size()))
+    {
+        d->previousLayerMessages[d->slicedObjects].clear();
+    }
+}
+
+void CommandSocket::beginResendSlicedObject()
+{
+    d->beginSlicedObject();
+    if(d->slicedObjects < int(d->previousLayerMessages.size()))
     {
-        d->slicedObjectList = std::make_shared<Cura::SlicedObjectList>();
+        int64_t id = d->objectIds[d->slicedObjects];
+        for(std::shared_ptr<Cura::SlicedObjectList>& previous : d->previousLayerMessages[d->slicedObjects])
+        {
+            std::shared_ptr<Cura::SlicedObjectList> message = previous;
+            if(message->objects(0).id() != id)
+            { // a message which has been sent isn't changed, since the socket may still be writing it
+                message = std::make_shared<Cura::SlicedObjectList>(*previous);
+                message->mutable_objects(0)->set_id(id);
+            }
+            d->channel->sendMessage(message);
+            d->sentLayerMessages[d->slicedObjects].push_back(message);
+        }
+        d->previousLayerMessages[d->slicedObjects].clear();
     }
+}
 
-    d->currentSlicedObject = d->slicedObjectList->add_objects();
-    d->currentSlicedObject->set_id(d->objectIds[d->slicedObjects]);
+void CommandSocket::sendLayersUpTo(int layer_nr)
+{
+    if(!d->sendingSlicedObject)
+    {
+        return;
+    }
+    auto end = d->pendingLayers.upper_bound(layer_nr);
+    if(end != d->pendingLayers.begin())
+    {
+        d->sendLayers(end);
+    }
 }
 
 void CommandSocket::endSendSlicedObject()
 {
+    if(d->sendingSlicedObject)
+    {
+        d->sendLayers(d->pendingLayers.end()); // also when there are no layers left, so that the front-end knows the object is complete
+        d->sendingSlicedObject = false;
+    }
     d->slicedObjects++;
     if(d->slicedObjects >= d->object_count)
     {
-        d->socket->sendMessage(d->slicedObjectList);
+        d->previousLayerMessages.swap(d->sentLayerMessages);
+        d->sentLayerMessages.clear();
         d->slicedObjects = 0;
-        d->slicedObjectList.reset();
-        d->currentSlicedObject = nullptr;
     }
 }
 
 void CommandSocket::beginGCode()
 {
-    d->processor->setTargetStream(&d->gcode_output_stream);
+    if (!d->gcode_output_stream)
+    {
+        // the GCode of a job is flushed at its end, so the messages of a job are all sent before the next one changes objectIds
+        Private* data = d.get();
+        d->gcode_output_stream.reset(new AsyncOutputStream([data](std::string& buffer, size_t size)
+        {
+            data->waitForGCodeCredit();
+            auto message = std::make_shared<Cura::GCodeLayer>();
+            message->set_id(data->objectIds[0]);
+            if (size < buffer.size() / 4)
+            { // copied, so that a small layer doesn't keep a whole buffer in the send queue
+                message->set_data(buffer.data(), size);
+            }
+            else
+            {
+                buffer.resize(size);
+                message->mutable_data()->swap(buffer);
+            }
+            data->channel->sendMessage(message);
+        }, GCODE_CHUNK_SIZE));
+    }
+    d->processor->setTargetStream(d->gcode_output_stream.get());
 }
 
 void CommandSocket::sendGCodeLayer()
 {
-    auto message = std::make_shared<Cura::GCodeLayer>();
-    message->set_id(d->objectIds[0]);
-    message->set_data(d->gcode_output_stream.str());
-    d->socket->sendMessage(message);
-    
-    d->gcode_output_stream.str("");
+    d->gcode_output_stream->handOver();
 }
 
 void CommandSocket::sendGCodePrefix(std::string prefix)
 {
     auto message = std::make_shared<Cura::GCodePrefix>();
     message->set_data(prefix);
-    d->socket->sendMessage(message);
+    d->channel->sendMessage(message);
 }
 
-Cura::Layer* CommandSocket::Private::getLayerById(int id)
+bool CommandSocket::hasNewJob()
 {
-    auto itr = std::find_if(currentSlicedObject->mutable_layers()->begin(), currentSlicedObject->mutable_layers()->end(), [id](Cura::Layer& l) { return l.id() == id; });
+    std::lock_guard<std::mutex> lock(d->messageMutex);
+    for(Arcus::MessagePtr message = d->receiveMessage(); message; message = d->receiveMessage())
+    {
+        d->deferredMessages.push_back(message);
+    }
+    for(Arcus::MessagePtr& message : d->deferredMessages)
+    {
+        if(dynamic_cast<Cura::ObjectList*>(message.get()))
+        {
+            return true;
+        }
+    }
+    return false;
+}
 
-    Cura::Layer* layer = nullptr;
-    if(itr != currentSlicedObject->mutable_layers()->end())
+void CommandSocket::abandonJob()
+{
+    if(d->gcode_output_stream)
     {
-        layer = &(*itr);
+        d->gcode_output_stream->discard();
     }
-    else
+    if(d->sendingSlicedObject)
     {
-        layer = currentSlicedObject->add_layers();
-        layer->set_id(id);
+        d->collectLayers(d->pendingLayers.end());
+        d->sendingSlicedObject = false;
     }
+    // Only the layers of a job which got as far as writing the GCode are complete, and only a job reusing all of its slice data resends them.
+    d->previousLayerMessages.swap(d->sentLayerMessages);
+    d->sentLayerMessages.clear();
+    d->slicedObjects = 0;
+}
 
+Cura::Layer* CommandSocket::Private::getLayerById(int id)
+{
+    Cura::Layer*& layer = pendingLayers[id];
+    if(!layer)
+    {
+        layer = google::protobuf::Arena::CreateMessage<Cura::Layer>(getLayerArena());
+        layer->set_id(id);
+    }
     return layer;
 }
 
+google::protobuf::Arena* CommandSocket::Private::getLayerArena()
+{
+    if(!layerArena)
+    {
+        // A batch of layers holds a lot of small polygons, so the blocks may grow large.
+        google::protobuf::ArenaOptions options;
+        options.start_block_size = 64 * 1024;
+        options.max_block_size = 1024 * 1024;
+        layerArena = std::make_shared<google::protobuf::Arena>(options);
+    }
+    return layerArena.get();
+}
+
+Arcus::MessagePtr CommandSocket::Private::receiveMessage()
+{
+    Arcus::MessagePtr message = channel->takeNextMessage();
+    Cura::GCodeCredit* credit = dynamic_cast<Cura::GCodeCredit*>(message.get());
+    if(credit)
+    {
+        gcodeFlowControl = true;
+        gcodeCredit += credit->chunks();
+        creditGranted.notify_all();
+        return Arcus::MessagePtr();
+    }
+    return message;
+}
+
+Arcus::MessagePtr CommandSocket::Private::takeNextMessage()
+{
+    std::lock_guard<std::mutex> lock(messageMutex);
+    if(!deferredMessages.empty())
+    {
+        Arcus::MessagePtr message = deferredMessages.front();
+        deferredMessages.pop_front();
+        return message;
+    }
+    return receiveMessage();
+}
+
+void CommandSocket::Private::waitForGCodeCredit()
+{
+    std::unique_lock<std::mutex> lock(messageMutex);
+    while(gcodeFlowControl && gcodeCredit <= 0)
+    {
+        if(!channel->isOpen())
+        {
+            return; // no more credit will come
+        }
+        Arcus::MessagePtr message = receiveMessage();
+        if(message)
+        {
+            deferredMessages.push_back(message);
+        }
+        else if(gcodeCredit <= 0)
+        {
+            creditGranted.wait_for(lock, std::chrono::milliseconds(10));
+        }
+    }
+    if(gcodeFlowControl)
+    {
+        gcodeCredit--;
+    }
+}
+
+void CommandSocket::Private::beginSlicedObject()
+{
+    sendingSlicedObject = true;
+    previewTolerance = processor->getSettingInMicrons("machine_preview_tolerance");
+    pendingLayers.clear();
+    layerArena.reset();
+    sentLayerMessages.resize(slicedObjects + 1);
+    sentLayerMessages[slicedObjects].clear();
+}
+
+void CommandSocket::Private::sendLayers(std::map<int, Cura::Layer*>::iterator end)
+{
+    channel->sendMessage(collectLayers(end));
+}
+
+std::shared_ptr<Cura::SlicedObjectList> CommandSocket::Private::collectLayers(std::map<int, Cura::Layer*>::iterator end)
+{
+    // The message is allocated on the arena of its layers, which it keeps alive. The pending layers after end stay on
+    // that arena too, so the next message shares it; once no layers are pending the next ones start a new arena.
+    Cura::SlicedObjectList* list = google::protobuf::Arena::CreateMessage<Cura::SlicedObjectList>(getLayerArena());
+    std::shared_ptr<Cura::SlicedObjectList> message(layerArena, list);
+    Cura::SlicedObject* object = message->add_objects();
+    object->set_id(objectIds[slicedObjects]);
+    for(auto itr = pendingLayers.begin(); itr != end; ++itr)
+    {
+        object->mutable_layers()->UnsafeArenaAddAllocated(itr->second);
+    }
+    pendingLayers.erase(pendingLayers.begin(), end);
+    if(pendingLayers.empty())
+    {
+        layerArena.reset();
+    }
+    sentLayerMessages[slicedObjects].push_back(message);
+    return message;
+}
+
 }//namespace cura
@@ -17,7 +17,23 @@ class CommandSocket
 public:
     CommandSocket(fffProcessor* processor);
 
-    void connect(const std::string& ip, int port);
+    ~CommandSocket();
+
+    /*!
+     * Process the jobs the front-end sends until it disconnects.
+     *
+     * \param record_file Where to record the messages of the session for replay, if not empty
+     */
+    void connect(const std::string& ip, int port, const std::string& record_file = "");
+
+    /*!
+     * Process a session recorded by connect without the front-end, the messages arriving as long after each other as
+     * they did then, and log for each job how long it took until its first layers for the preview, its first GCode and
+     * its end.
+     *
+     * \return Whether the recording could be read
+     */
+    bool replay(const std::string& record_file);
 
     void handleObjectList(Cura::ObjectList* list);
     void handleSettingList(Cura::SettingList* list);
@@ -26,16 +42,48 @@ public:
     void sendPolygons(cura::PolygonType type, int layer_nr, cura::Polygons& polygons, int line_width);
     void sendProgress(float amount);
     void sendPrintTime();
+    void sendPrintStatistics(); //!< Send the print time and material of each feature on each layer
+    void sendSlicingStatistics(); //!< Send the work counted for --stats per stage and per layer
     void sendPrintMaterialForObject(int index, int extruder_nr, float material_amount);
 
     void beginSendSlicedObject();
     void endSendSlicedObject();
 
+    /*!
+     * Send the layers of the current sliced object up to and including \p layer_nr which haven't been sent yet, for when no more polygons will be sent for them.
+     * 
+     * The remaining layers are sent by endSendSlicedObject, so the front-end receives each object in a number of messages.
+     */
+    void sendLayersUpTo(int layer_nr);
+
+    /*!
+     * Begin sending the next sliced object with the layer data sent for it in the previous job, for when the slice data is reused from that job.
+     */
+    void beginResendSlicedObject();
+
     void beginGCode();
     void sendGCodeLayer();
     void sendGCodePrefix(std::string prefix);
 
+    /*!
+     * Whether the front-end has sent a new object list, which makes the job being processed obsolete.
+     * 
+     * Receives the messages which have arrived meanwhile, to be handled once the current job has stopped.
+     */
+    bool hasNewJob();
+
+    /*!
+     * Drop what is left of a job which was abandoned for a newer one: the GCode which hasn't been sent is discarded, and
+     * the layers collected for the preview are kept without sending them, to be resent if the next job reuses the slice data.
+     */
+    void abandonJob();
+
 private:
+    /*!
+     * Handle the messages of the session and process its jobs until it ends.
+     */
+    void run();
+
     class Private;
     const std::unique_ptr<Private> d;
 };
@@ -0,0 +1,136 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#include "distributedSlicing.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "utils/logoutput.h"
+
+namespace cura {
+
+namespace
+{
+/*!
+ * The settings the worker gets from getWorkerCommand rather than from the coordinator.
+ */
+bool isWorkerSetting(const std::string& key)
+{
+    return key.find("machine_distributed_") == 0
+        || key == "machine_checkpoint_file"
+        || key == "machine_layer_range_start"
+        || key == "machine_layer_range_end";
+}
+
+/*!
+ * Quote an argument for the shell.
+ */
+std::string quote(const std::string& argument)
+{
+#ifdef _WIN32
+    std::string quoted = "\"";
+    for (char c : argument)
+    {
+        if (c == '"')
+        {
+            quoted += '\\';
+        }
+        quoted += c;
+    }
+    return quoted + "\"";
+#else
+    std::string quoted = "'";
+    for (char c : argument)
+    {
+        if (c == '\'')
+        {
+            quoted += "'\\''";
+        }
+        else
+        {
+            quoted += c;
+        }
+    }
+    return quoted + "'";
+#endif
+}
+}//namespace
+
+std::string getWorkerCommand(const std::string& command_template, unsigned int node, const std::map<std::string, std::string>& settings, const std::string& checkpoint_file, unsigned int layer_start, unsigned int layer_end, const std::vector<std::string>& model_files)
+{
+    std::string command = command_template;
+    std::string node_string = std::to_string(node);
+    for (size_t pos = command.find("{node}"); pos != std::string::npos; pos = command.find("{node}", pos + node_string.size()))
+    {
+        command.replace(pos, 6, node_string);
+    }
+    for (const std::pair<const std::string, std::string>& setting : settings)
+    {
+        if (!isWorkerSetting(setting.first))
+        {
+            command += " -s " + quote(setting.first + "=" + setting.second);
+        }
+    }
+    command += " --checkpoint " + quote(checkpoint_file);
+    command += " -s machine_layer_range_start=" + std::to_string(layer_start);
+    command += " -s machine_layer_range_end=" + std::to_string(layer_end);
+#ifdef _WIN32
+    command += " -o NUL";
+#else
+    command += " -o /dev/null";
+#endif
+    for (const std::string& model_file : model_files)
+    {
+        command += " " + quote(model_file);
+    }
+    return command;
+}
+
+std::string getWorkerCheckpointFile(const std::string& directory, unsigned int node)
+{
+#ifdef _WIN32
+    int pid = _getpid();
+#else
+    int pid = getpid();
+#endif
+    char name[64];
+    snprintf(name, sizeof(name), "cura_part_%d_%u.ckp", pid, node);
+    if (directory.empty() || directory[directory.size() - 1] == '/' || directory[directory.size() - 1] == '\\')
+    {
+        return directory + name;
+    }
+    return directory + "/" + name;
+}
+
+bool runWorkers(const std::vector<std::string>& commands)
+{
+    std::vector<int> results(commands.size(), 0);
+    std::vector<std::thread> threads;
+    flushLog(); // before the workers write to the same terminal
+    for (unsigned int node = 0; node < commands.size(); node++)
+    {
+        log("Starting worker %u: %s\n", node, commands[node].c_str());
+        threads.emplace_back([&commands, &results, node]()
+        {
+            results[node] = system(commands[node].c_str());
+        });
+    }
+    bool succeeded = true;
+    for (unsigned int node = 0; node < threads.size(); node++)
+    {
+        threads[node].join();
+        if (results[node] != 0)
+        {
+            logError("Worker %u failed with status %d\n", node, results[node]);
+            succeeded = false;
+        }
+    }
+    return succeeded;
+}
+
+}//namespace cura
@@ -0,0 +1,50 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#ifndef DISTRIBUTED_SLICING_H
+#define DISTRIBUTED_SLICING_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+Distributed slicing processes the layers of a large model on several nodes, each taking a range of layers, and joins
+the results on the node which writes the GCode.
+
+The nodes share a directory. The coordinator starts a worker per node with a command given by the user, like an ssh or
+a job submission command, and each worker writes a checkpoint of the model of which only the layers of its range hold
+anything. The coordinator then reads each range of layers from the checkpoint of its worker, see
+SliceCheckpoint::takeLayers, and writes the GCode from those.
+*/
+
+namespace cura {
+
+/*!
+ * The command to start the worker of one node.
+ *
+ * \param command_template The command to start CuraEngine on a node, in which each {node} is replaced by the index of
+ * the node
+ * \param node The index of the node
+ * \param settings The settings of the coordinator, which the worker gets as well, but for those of distributed slicing
+ * \param checkpoint_file The checkpoint the worker is to write
+ * \param layer_start The first layer the worker is to process
+ * \param layer_end The end of the layers the worker is to process, or 0 for up to the top of the model
+ * \param model_files The model files, at the same path on all nodes
+ * \return The command, for the shell
+ */
+std::string getWorkerCommand(const std::string& command_template, unsigned int node, const std::map<std::string, std::string>& settings, const std::string& checkpoint_file, unsigned int layer_start, unsigned int layer_end, const std::vector<std::string>& model_files);
+
+/*!
+ * The checkpoint file of the worker of a node, in the shared directory.
+ */
+std::string getWorkerCheckpointFile(const std::string& directory, unsigned int node);
+
+/*!
+ * Run the commands of the workers, all at once, and wait for them to finish.
+ *
+ * \return Whether all of them succeeded
+ */
+bool runWorkers(const std::vector<std::string>& commands);
+
+}//namespace cura
+
+#endif//DISTRIBUTED_SLICING_H
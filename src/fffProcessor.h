@@ -4,21 +4,38 @@
 //#define M_PI 3.14159265358979323846  /* pi */
 
 #include <algorithm>
+#include <atomic>
+#include <functional>
 #include <sstream>
 #include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
 #include "utils/gettime.h"
 #include "utils/logoutput.h"
+#include "settingRegistry.h"
 #include "sliceDataStorage.h"
 #include "modelFile/modelFile.h"
 #include "slicer.h"
+#include "adaptiveLayers.h"
+#include "sliceCache.h"
+#include "sliceCheckpoint.h"
+#include "distributedSlicing.h"
 #include "support.h"
 #include "multiVolumes.h"
+#include "oozeShield.h"
 #include "layerPart.h"
+#include "layerSpill.h"
+#include "layerCodec.h"
 #include "inset.h"
+#include "repeatedLayers.h"
+#include "meshInstances.h"
+#include "memoryUsage.h"
 #include "skirt.h"
 #include "raft.h"
 #include "skin.h"
 #include "infill.h"
+#include "infillCache.h"
 #include "bridge.h"
 #include "pathOrderOptimizer.h"
 #include "gcodePlanner.h"
@@ -27,6 +44,13 @@
 #include "Weaver.h"
 #include "Wireframe2gcode.h"
 #include "utils/polygonUtils.h"
+#include "utils/parallel.h"
+#include "utils/layerPipeline.h"
+#include "utils/numa.h"
+#include "utils/asyncOutput.h"
+#include "utils/stats.h"
+#include "utils/trace.h"
+#include "utils/compressedOutput.h"
 //@ std::setprecision
 #include <iomanip>
 
@@ -42,6 +66,33 @@ private:
     TimeKeeper timeKeeper;
     CommandSocket* commandSocket;
     std::ofstream output_file;
+    std::unique_ptr<OutputCompressor> output_compressor; //!< Compresses the GCode into output_file, when writing a .gz or .zst file
+    std::unique_ptr<AsyncOutputStream> output_file_stream; //!< Writes (or compresses) into output_file from a background thread, so slicing doesn't wait for the disk
+    std::unique_ptr<StatsOutputStream> stats_output_stream; //!< Counts the GCode on its way to the target for the stats, when they're counted
+    InfillCache infill_cache; //!< The infill generated for the areas of earlier layers, and of earlier jobs of a --connect session
+    std::vector<std::vector<Point>> planner_point_pools; //!< The buffers in which the GCodePlanners of the layers being planned keep their points, so their memory is reused from layer to layer
+    std::vector<GCodeBuffer> gcode_buffers; //!< The GCode of the layers being planned in parallel, formatted alongside planning them
+    std::mutex send_polygons_mutex; //!< Serialises sendPolygons, which is called while layers are planned in parallel
+    PrintStatistics print_statistics; //!< The print time and material of each feature on each layer of the last GCode written
+    std::string statistics_filename; //!< The file to which finalize writes print_statistics, if any
+    std::vector<std::string> model_files; //!< The files of the model being processed, for the workers of distributed slicing
+    std::function<void (float)> progress_handler; //!< Called with the progress of the model being processed, besides sending it over the commandSocket
+    std::atomic<bool> cancelled; //!< Set from another thread to stop processing the model at the next block of layers
+    MemoryUsage memory_usage; //!< The memory used by the data of the model being processed
+    size_t max_memory; //!< The memory which the data of a model may use, from machine_max_memory, in bytes; zero for no limit
+    std::atomic<bool> memory_limit_exceeded; //!< Set when the data of the model being processed uses more than max_memory, which stops processing it
+
+    /*!
+     * A layer of an object which is kept to be written interleaved with the layers of the other objects, see
+     * writeInterleavedObjects.
+     */
+    struct InterleavedLayer
+    {
+        GCodeBuffer gcode; //!< The GCode of the layer
+        int z; //!< The height of the layer
+        double area; //!< The area of the outlines of the layer, in mm^2
+    };
+    std::vector<std::vector<InterleavedLayer>> interleaved_objects; //!< The layers of each object written since the last finalize, when interleaving the objects
 
 public:
     fffProcessor()
@@ -49,6 +100,9 @@ public:
         fileNr = 1;
         maxObjectHeight = 0;
         commandSocket = NULL;
+        cancelled = false;
+        max_memory = 0;
+        memory_limit_exceeded = false;
     }
 
     void resetFileNumber()
@@ -61,18 +115,87 @@ public:
         commandSocket = socket;
     }
 
+    /*!
+     * Write the print time, travel distance, extrusion volume and arc-on time of each feature on each layer to a file
+     * when finalizing, as JSON when its name ends in .json and as CSV otherwise.
+     */
+    void setStatisticsFile(const char* filename)
+    {
+        statistics_filename = filename;
+    }
+
+    const PrintStatistics& getPrintStatistics()
+    {
+        return print_statistics;
+    }
+
+    /*!
+     * Report the progress of processing a model, from 0 to 1, to \p handler as well as over the command socket.
+     * The handler is called from the thread processing the model.
+     */
+    void setProgressHandler(std::function<void (float)> handler)
+    {
+        progress_handler = handler;
+    }
+
+    /*!
+     * Stop processing the current model at the next block of layers, after which processFiles and processModel return
+     * false. The G-code written so far is incomplete. May be called from any thread.
+     */
+    void cancel()
+    {
+        cancelled = true;
+    }
+
+    /*!
+     * Whether processing the current model should stop: after cancel(), once its data uses more memory than
+     * machine_max_memory allows, or once the command socket has received a newer job.
+     */
+    bool isCancelled()
+    {
+        return cancelled || memory_limit_exceeded || (commandSocket && commandSocket->hasNewJob());
+    }
+
+    /*!
+     * Whether processing the last model was stopped because its data used more memory than machine_max_memory allows.
+     */
+    bool isMemoryLimitExceeded()
+    {
+        return memory_limit_exceeded;
+    }
+
     void sendPolygons(PolygonType type, int layer_nr, Polygons& polygons, int line_width)
     {
         if (commandSocket)
+        {
+            std::lock_guard<std::mutex> lock(send_polygons_mutex);
             commandSocket->sendPolygons(type, layer_nr, polygons, line_width);
+        }
     }
 
     bool setTargetFile(const char* filename)
     {
-        output_file.open(filename);
+        OutputCompression compression = getOutputCompression(filename);
+        if (!isOutputCompressionAvailable(compression))
+        {
+            logError("This build can't compress the output into %s.\n", filename);
+            return false;
+        }
+        output_file.open(filename, (compression == Compression_None)? std::ios::out : std::ios::out | std::ios::binary);
         if (output_file.is_open())
         {
-            gcode.setOutputStream(&output_file);
+            output_compressor = OutputCompressor::create(compression, output_file);
+            output_file_stream.reset(new AsyncOutputStream([this](std::string& buffer, size_t size)
+            {
+                if (output_compressor)
+                {
+                    output_compressor->write(buffer.data(), size); // on the background thread, so compressing overlaps with slicing
+                    return;
+                }
+                output_file.write(buffer.data(), size);
+                output_file.flush();
+            }));
+            gcode.setOutputStream(output_file_stream.get());
             return true;
         }
         return false;
@@ -86,64 +209,123 @@ public:
     bool processFiles(const std::vector<std::string> &files)
     {
         timeKeeper.restart();
-        PrintObject* model = nullptr;
-
-        model = new PrintObject(this);
+        setNumaPlacement(getSettingBoolean("machine_numa_placement"));
+        TraceZone load_zone("load");
+        StatsScope load_stats_scope("load");
+        std::unique_ptr<PrintObject> model(new PrintObject(this));
         for(std::string filename : files)
         {
             log("Loading %s from disk...\n", filename.c_str());
 
             FMatrix3x3 matrix;
-            if (!loadMeshFromFile(model, filename.c_str(), matrix))
+            if (!loadMeshFromFile(model.get(), filename.c_str(), matrix))
             {
                 logError("Failed to load model: %s\n", filename.c_str());
                 return false;
             }
         }
         model->finalize();
+        load_zone.end();
 
         log("Loaded from disk in %5.3fs\n", timeKeeper.restart());
-        return processModel(model);
+        model_files = files;
+        bool processed = processModel(model.get());
+        model_files.clear();
+        return processed;
     }
 
     bool processModel(PrintObject* model)
     {
+        TRACE_ZONE("processModel");
+        StatsScope stats_scope(nullptr); // the work in between the stages counts for no stage
         timeKeeper.restart();
         if (!model)
             return false;
 
         TimeKeeper timeKeeperTotal;
 
-        if (model->getSettingBoolean("wireframe_enabled"))
+        // No settings change while the model is processed; resolve them up front so they can be read from any thread.
+        freezeSettings();
+        setNumaPlacement(getSettingBoolean("machine_numa_placement"));
+        if (isStatsEnabled() && gcode.getOutputStream() != stats_output_stream.get())
+        {
+            stats_output_stream.reset(new StatsOutputStream(*gcode.getOutputStream()));
+            gcode.setOutputStream(stats_output_stream.get());
+        }
+        bool completed = true;
+
+        max_memory = std::max(0, getSettingAsCount("machine_max_memory")) * size_t(1024 * 1024);
+        memory_limit_exceeded = false;
+        memory_usage.clear();
+        size_t mesh_memory = 0;
+        for(Mesh& mesh : model->meshes)
+            mesh_memory += getMemoryUsage(mesh);
+        memory_usage.set(Memory_Meshes, mesh_memory);
+        memory_usage.set(Memory_InfillCache, infill_cache.getMemoryUsed());
+        if (!checkMemory("load"))
         {
-            log("starting Neith Weaver...\n");
+            thawSettings();
+            return false;
+        }
 
-            Weaver w(this);
-            w.weave(model, commandSocket);
+        if (model->getSettingBoolean("wireframe_enabled"))
+        {
+            log("starting Neith Weaver and Gcode generation...\n");
+            TRACE_ZONE("wireframe");
+            StatsScope stats_scope("wireframe");
 
-            log("starting Neith Gcode generation...\n");
             preSetup();
+            gcode.setStatistics(&print_statistics);
+            Weaver w(this);
             Wireframe2gcode gcoder(w, gcode, this);
-            gcoder.writeGCode(commandSocket, maxObjectHeight);
+            gcoder.writeGCode(model, commandSocket, maxObjectHeight); // the weaver hands over each layer as soon as it's done
             log("finished Neith Gcode generation...\n");
 
         } else
         {
-            SliceDataStorage storage;
             preSetup();
 
-            if (!prepareModel(storage, model))
-                return false;
-
+            if (commandSocket)
+            {
+                completed = processModelReusingPreviousJob(model);
+                if (!completed)
+                {
+                    commandSocket->abandonJob();
+                }
+            }
+            else if (getSettingAsCount("machine_distributed_nodes") > 1 && getSettingString("machine_distributed_worker_command").size() > 0 && model_files.size() > 0)
+            {
+                completed = processModelDistributed(model, getSettingAsCount("machine_distributed_nodes"));
+            }
+            else if (getSettingString("machine_checkpoint_file").size() > 0)
+            {
+                completed = processModelWithCheckpoint(model, getSettingString("machine_checkpoint_file"));
+            }
+            else
+            {
+                SliceDataStorage storage;
+                if (!prepareModel(storage, model))
+                {
+                    thawSettings();
+                    return false;
+                }
 
-            processSliceData(storage);
-            writeGCode(storage);
+                completed = !isCancelled() && processSliceDataAndWriteGCode(storage);
+            }
 
     std::cerr << "machine_gcode_flavor = " << model->getSettingString("machine_gcode_flavor") << std::endl;
     std::cerr << "machine_gcode_flavor = " << model->getSettingAsGCodeFlavor("machine_gcode_flavor") << std::endl;
         }
 
+        thawSettings();
+
+        if (!completed)
+        {
+            log("Cancelled after %5.2fs.\n", timeKeeperTotal.restart());
+            return false;
+        }
         logProgress("process", 1, 1);//Report the GUI that a file has been fully processed.
+        log("Peak memory: %.1fMB accounted, %.1fMB resident\n", memory_usage.getPeakTotal() / (1024.0 * 1024.0), getPeakResidentMemory() / (1024.0 * 1024.0));
         log("Total time elapsed %5.2fs.\n", timeKeeperTotal.restart());
 
         return true;
@@ -151,9 +333,15 @@ public:
 
     void finalize()
     {
+        writeInterleavedObjects();
         gcode.finalize(maxObjectHeight, getSettingInMillimetersPerSecond("speed_travel"), getSettingString("machine_end_gcode").c_str());
         for(int e=0; e<MAX_EXTRUDERS; e++)
             gcode.writeTemperatureCommand(e, 0, false);
+        gcode.flush();
+        if (statistics_filename.size() > 0 && !print_statistics.writeFile(statistics_filename.c_str()))
+        {
+            logError("Failed to write the statistics to %s.\n", statistics_filename.c_str());
+        }
     }
 
     double getTotalFilamentUsed(int e)
@@ -166,7 +354,374 @@ public:
         return gcode.getTotalPrintTime();
     }
 
+    /*!
+     * The volume deposited by all extruders so far, in mm^3.
+     */
+    double getTotalDepositedVolume()
+    {
+        double volume = 0;
+        for(int e=0; e<MAX_EXTRUDERS; e++)
+            volume += gcode.getTotalFilamentUsed(e);
+        return volume;
+    }
+
+    /*!
+     * Estimate the print time of an existing G-code file with the machine limits given by the settings, to compare the
+     * estimate with the time a print really took.
+     *
+     * \param filename The G-code file
+     * \return Whether the file could be read
+     */
+    bool estimatePrintTime(const char* filename)
+    {
+        std::ifstream file(filename);
+        if (!file.is_open())
+        {
+            return false;
+        }
+        TimeKeeper estimate_time;
+        TimeEstimateCalculator estimator;
+        estimator.setMachineLimits(getMachineLimits());
+        double print_time = estimator.estimate(file);
+        log("Estimated the print time of %s in %5.3fs\n", filename, estimate_time.restart());
+        log("Print time: %d\n", int(print_time));
+        return true;
+    }
+
 private:
+    void sendProgress(float amount)
+    {
+        if (commandSocket) commandSocket->sendProgress(amount);
+        if (progress_handler) progress_handler(amount);
+    }
+
+    /*!
+     * The result of slicing all meshes of a PrintObject.
+     */
+    struct SlicedModel
+    {
+        Point3 model_min, model_max;
+        std::vector<int> layer_tops; //!< The height of the top of each layer, before the raft is added
+        std::vector<Slicer*> slicers; //!< One slicer per mesh
+        std::vector<MeshInstance> instances; //!< For each mesh whether it is a moved copy of an earlier mesh, of which the slices were copied
+
+        SlicedModel() {}
+        SlicedModel(const SlicedModel&) = delete;
+        SlicedModel& operator=(const SlicedModel&) = delete;
+        ~SlicedModel() { clear(); }
+
+        void clear()
+        {
+            for(Slicer* slicer : slicers)
+                delete slicer;
+            slicers.clear();
+            instances.clear();
+        }
+    };
+
+    /*!
+     * What is kept of the previous job in a --connect session.
+     * A job for the same meshes only reruns the pipeline stages which depend on a setting that was changed since.
+     */
+    struct PreviousJob
+    {
+        std::vector<uint64_t> mesh_hashes; //!< The geometry of the meshes; see meshHash
+        std::map<std::string, std::string> processor_settings; //!< All settings of the processor at the end of the job
+        std::map<std::string, std::string> object_settings; //!< All settings of the PrintObject at the end of the job
+        std::vector<std::map<std::string, std::string>> mesh_settings; //!< All settings of each mesh at the end of the job
+        SlicedModel sliced; //!< The result of Stage_Slice
+        std::unique_ptr<SliceDataStorage> layer_parts; //!< The result of Stage_LayerParts
+        std::unique_ptr<SliceDataStorage> storage; //!< The result of all stages up to Stage_Planning
+        int completed_stage; //!< The first stage of which the result isn't kept, as the job was abandoned before; those before it are valid for the settings above
+
+        PreviousJob() : completed_stage(Stage_Slice) {}
+
+        void clear()
+        {
+            completed_stage = Stage_Slice;
+            mesh_hashes.clear();
+            sliced.clear();
+            layer_parts.reset();
+            storage.reset();
+        }
+    } previous_job;
+
+    /*!
+     * Get the pipeline stages affected by the differences between two sets of settings.
+     * 
+     * \param before The settings of the previous job
+     * \param after The settings of the current job
+     * \return Bit mask of EPipelineStage values
+     */
+    static unsigned int getChangedStages(const std::map<std::string, std::string>& before, const std::map<std::string, std::string>& after)
+    {
+        unsigned int stages = 0;
+        for(auto& setting : after)
+        {
+            auto it = before.find(setting.first);
+            if (it == before.end() || it->second != setting.second)
+                stages |= SettingRegistry::getInstance()->getSettingStages(setting.first);
+        }
+        for(auto& setting : before)
+        {
+            if (after.find(setting.first) == after.end())
+                stages |= SettingRegistry::getInstance()->getSettingStages(setting.first);
+        }
+        return stages;
+    }
+
+    /*!
+     * Process a model in a --connect session, reusing the results of the previous job for the stages which don't depend on any change since.
+     * 
+     * When the meshes differ from the previous job, everything is processed again.
+     * The GCode is always written again.
+     * 
+     * \return Whether the job was completed; false when it was abandoned for a newer one, of which the stages completed so far can be reused
+     */
+    bool processModelReusingPreviousJob(PrintObject* model)
+    {
+        std::vector<uint64_t> mesh_hashes;
+        for(Mesh& mesh : model->meshes)
+            mesh_hashes.push_back(meshHash(&mesh));
+
+        int first_stage = Stage_Slice;
+        if (previous_job.completed_stage > Stage_Slice && mesh_hashes == previous_job.mesh_hashes)
+        {
+            unsigned int changed_stages = getChangedStages(previous_job.processor_settings, getAllSettings())
+                | getChangedStages(previous_job.object_settings, model->getAllSettings());
+            for(unsigned int mesh_idx = 0; mesh_idx < model->meshes.size(); mesh_idx++)
+                changed_stages |= getChangedStages(previous_job.mesh_settings[mesh_idx], model->meshes[mesh_idx].getAllSettings());
+            first_stage = previous_job.completed_stage;
+            for(int stage = Stage_Slice; stage < previous_job.completed_stage; stage++)
+            {
+                if (changed_stages & (1u << stage))
+                {
+                    first_stage = stage;
+                    break;
+                }
+            }
+        }
+
+        if (first_stage == Stage_Slice)
+        {
+            previous_job.clear();
+            previous_job.mesh_hashes = mesh_hashes;
+        }
+        else
+        {
+            static const char* stage_names[Stage_Count] = { "slicing", "layer parts", "insets", "skins and infill", "support", "planning", "export" };
+            log("Reusing the results of the previous job up to %s\n", stage_names[first_stage]);
+            model->clear();
+            // The kept storage still refers to the meshes of the previous job for their settings.
+            for(SliceDataStorage* storage : { previous_job.layer_parts.get(), previous_job.storage.get() })
+            {
+                if (!storage)
+                    continue;
+                for(unsigned int mesh_idx = 0; mesh_idx < storage->meshes.size(); mesh_idx++)
+                    storage->meshes[mesh_idx].settings = &model->meshes[mesh_idx];
+            }
+        }
+
+        // From here on the kept results are those of this job. Each stage only counts as completed once it is, so when
+        // this job is abandoned for a newer one, that one can start where this one got to.
+        previous_job.completed_stage = first_stage;
+        previous_job.processor_settings = getAllSettings();
+        previous_job.object_settings = model->getAllSettings();
+        previous_job.mesh_settings.clear();
+        for(Mesh& mesh : model->meshes)
+            previous_job.mesh_settings.push_back(mesh.getAllSettings());
+
+        if (first_stage == Stage_Slice)
+        {
+            sliceModel(model, previous_job.sliced);
+            if (isCancelled())
+                return false;
+            previous_job.completed_stage = Stage_LayerParts;
+        }
+        if (first_stage <= Stage_LayerParts)
+        {
+            previous_job.layer_parts.reset(new SliceDataStorage());
+            generateLayerParts(*previous_job.layer_parts, model, previous_job.sliced);
+            previous_job.completed_stage = Stage_Insets;
+        }
+        if (first_stage <= Stage_Support)
+        {
+            if (isCancelled())
+                return false;
+            previous_job.storage.reset(new SliceDataStorage(*previous_job.layer_parts));
+            processSliceData(*previous_job.storage);
+            if (isCancelled())
+                return false;
+            previous_job.completed_stage = Stage_Planning;
+        }
+        else
+        {
+            commandSocket->beginResendSlicedObject();
+        }
+
+        // Writing the GCode changes the storage (e.g. it adds perimeter gaps), so write it from a copy.
+        SliceDataStorage storage(*previous_job.storage);
+        return writeGCode(storage);
+    }
+
+    /*!
+     * Process a model and write its GCode, taking the processed model from a checkpoint when it was written for the same
+     * meshes and the same settings of the stages before planning, see checkpointKey. Otherwise the model is processed and
+     * the checkpoint is written before the GCode, so that the next run can start from there.
+     *
+     * \param filename The checkpoint file
+     * \return Whether the GCode was written; false when cancelled
+     */
+    bool processModelWithCheckpoint(PrintObject* model, const std::string& filename)
+    {
+        std::vector<uint64_t> mesh_hashes;
+        std::vector<std::map<std::string, std::string>> settings = { getAllSettings(), model->getAllSettings() };
+        for(Mesh& mesh : model->meshes)
+        {
+            mesh_hashes.push_back(meshHash(&mesh));
+            settings.push_back(mesh.getAllSettings());
+        }
+        uint64_t key = checkpointKey(mesh_hashes, settings);
+
+        int layer_start = getSettingAsCount("machine_layer_range_start");
+        int layer_end = getSettingAsCount("machine_layer_range_end");
+        if (layer_start > 0 || layer_end > 0)
+        {
+            // a worker of distributed slicing, which only processes and keeps its own range of layers
+            SliceDataStorage storage;
+            if (!prepareModel(storage, model))
+                return false;
+            processSliceData(storage);
+            if (isCancelled())
+                return false;
+            bool saved = saveCheckpoint(filename, key, storage, std::max(0, layer_start), (layer_end > 0)? layer_end : std::numeric_limits<unsigned int>::max());
+            log("Wrote the layers %i to %i to the checkpoint %s in %5.3fs\n", layer_start, layer_end, filename.c_str(), timeKeeper.restart());
+            return saved;
+        }
+
+        std::shared_ptr<SliceCheckpoint> checkpoint = std::make_shared<SliceCheckpoint>(filename);
+        std::unique_ptr<SliceDataStorage> loaded(new SliceDataStorage());
+        if (checkpoint->isOpen() && checkpoint->load(key, model->meshes, *loaded))
+        {
+            log("Loaded the processed model from the checkpoint %s in %5.3fs\n", filename.c_str(), timeKeeper.restart());
+            model->clear();
+            memory_usage.set(Memory_Meshes, 0);
+            loaded->checkpoint = checkpoint;
+            setMemoryUsage(*loaded, memory_usage);
+            return writeGCode(*loaded);
+        }
+        loaded.reset();
+        checkpoint.reset(); // unmapped before the file is replaced
+
+        SliceDataStorage storage;
+        if (!prepareModel(storage, model))
+            return false;
+        processSliceData(storage);
+        if (isCancelled())
+            return false;
+        if (saveCheckpoint(filename, key, storage))
+        {
+            log("Wrote the checkpoint %s in %5.3fs\n", filename.c_str(), timeKeeper.restart());
+        }
+        return writeGCode(storage);
+    }
+
+    /*!
+     * Process a model on machine_distributed_nodes nodes, each taking an equal range of layers, and write its GCode
+     * from the layers they processed; see distributedSlicing.h.
+     *
+     * Each worker still slices the whole model and generates its support, which needs all the layers above, so only
+     * the work per layer is split up. The layers are split by the layer count from before the empty first layers are
+     * removed, and the last range goes up to the top of the model whatever its count.
+     */
+    bool processModelDistributed(PrintObject* model, unsigned int node_count)
+    {
+        std::vector<uint64_t> mesh_hashes;
+        std::vector<std::map<std::string, std::string>> settings = { getAllSettings(), model->getAllSettings() };
+        for(Mesh& mesh : model->meshes)
+        {
+            mesh_hashes.push_back(meshHash(&mesh));
+            settings.push_back(mesh.getAllSettings());
+        }
+        uint64_t key = checkpointKey(mesh_hashes, settings);
+
+        int initial_slice_z = 0;
+        unsigned int layer_count = getLayerTops(model, model->max().z, initial_slice_z).size();
+        std::string directory = getSettingString("machine_distributed_directory");
+        std::vector<std::string> checkpoint_files;
+        std::vector<unsigned int> range_starts;
+        std::vector<std::string> commands;
+        for(unsigned int node = 0; node < node_count; node++)
+        {
+            unsigned int layer_start = layer_count * node / node_count;
+            unsigned int layer_end = (node + 1 < node_count)? layer_count * (node + 1) / node_count : 0;
+            checkpoint_files.push_back(getWorkerCheckpointFile(directory, node));
+            range_starts.push_back(layer_start);
+            commands.push_back(getWorkerCommand(getSettingString("machine_distributed_worker_command"), node, getAllSettings(), checkpoint_files.back(), layer_start, layer_end, model_files));
+        }
+        log("Processing %u layers on %u nodes\n", layer_count, node_count);
+        bool succeeded = runWorkers(commands);
+        log("Workers finished in %5.3fs\n", timeKeeper.restart());
+
+        std::shared_ptr<SliceCheckpoint> checkpoint;
+        std::unique_ptr<SliceDataStorage> storage(new SliceDataStorage());
+        for(unsigned int node = 0; node < node_count && succeeded; node++)
+        {
+            std::shared_ptr<SliceCheckpoint> part = std::make_shared<SliceCheckpoint>(checkpoint_files[node]);
+            if (node == 0)
+            {
+                succeeded = part->isOpen() && part->load(key, model->meshes, *storage);
+                checkpoint = part;
+            }
+            else
+            {
+                SliceDataStorage part_storage;
+                unsigned int layer_end = (node + 1 < node_count)? range_starts[node + 1] : std::numeric_limits<unsigned int>::max();
+                succeeded = part->isOpen() && part->load(key, model->meshes, part_storage) && checkpoint->takeLayers(part, range_starts[node], layer_end);
+            }
+            if (!succeeded)
+            {
+                logError("Cannot read the layers of worker %u from %s\n", node, checkpoint_files[node].c_str());
+            }
+        }
+        for(const std::string& checkpoint_file : checkpoint_files)
+        {
+            remove(checkpoint_file.c_str()); // the mappings stay
+        }
+        if (!succeeded)
+        {
+            return false;
+        }
+        model->clear();
+        memory_usage.set(Memory_Meshes, 0);
+        storage->checkpoint = checkpoint;
+        setMemoryUsage(*storage, memory_usage);
+        return writeGCode(*storage);
+    }
+
+    /*!
+     * The limits of the motion planner of the firmware, from the machine settings.
+     */
+    TimeEstimateCalculator::MachineLimits getMachineLimits()
+    {
+        TimeEstimateCalculator::MachineLimits limits;
+        const char* axis_names[TimeEstimateCalculator::NUM_AXIS] = {"x", "y", "z", "e"};
+        for(unsigned int n=0; n<TimeEstimateCalculator::NUM_AXIS; n++)
+        {
+            limits.max_feedrate[n] = getSettingInMillimetersPerSecond(std::string("machine_max_feedrate_") + axis_names[n]);
+            limits.max_acceleration[n] = getSettingInMillimetersPerSecond(std::string("machine_max_acceleration_") + axis_names[n]);
+        }
+        limits.acceleration = getSettingInMillimetersPerSecond("machine_acceleration");
+        // these may well be below 1mm/s, which getSettingInMillimetersPerSecond doesn't allow
+        limits.minimum_feedrate = INT2MM(getSettingInMicrons("machine_minimum_feedrate"));
+        limits.max_xy_jerk = INT2MM(getSettingInMicrons("machine_max_jerk_xy"));
+        limits.max_z_jerk = INT2MM(getSettingInMicrons("machine_max_jerk_z"));
+        limits.max_e_jerk = INT2MM(getSettingInMicrons("machine_max_jerk_e"));
+        limits.firmware_retraction_amount = INT2MM(getSettingInMicrons("machine_firmware_retraction_amount"));
+        limits.firmware_retraction_speed = getSettingInMillimetersPerSecond("machine_firmware_retraction_speed");
+        return limits;
+    }
+
     void preSetup()
     {
         for(unsigned int n=1; n<MAX_EXTRUDERS;n++)
@@ -187,28 +742,140 @@ private:
         }
 
         gcode.setFlavor(getSettingAsGCodeFlavor("machine_gcode_flavor"));
+        gcode.setMachineLimits(getMachineLimits());
         gcode.setRetractionSettings(getSettingInMicrons("machine_switch_extruder_retraction_amount"), getSettingInMillimetersPerSecond("material_switch_extruder_retraction_speed"), getSettingInMillimetersPerSecond("material_switch_extruder_prime_speed"), getSettingInMicrons("retraction_extrusion_window"), getSettingAsCount("retraction_count_max"));
     }
 
+    /*!
+     * Check the memory used after or within a stage against machine_max_memory, and stop processing the model when it's
+     * over, see isCancelled. The memory used is also recorded in the trace.
+     * 
+     * \param stage The stage which was processed, for the log
+     * \param log_usage Whether to log the memory used; false for the checks within a stage
+     * \return Whether the memory used is within the limit
+     */
+    bool checkMemory(const char* stage, bool log_usage = true)
+    {
+        memory_usage.trace();
+        if (log_usage)
+            log("Memory after %s: %s\n", stage, memory_usage.toString().c_str());
+        if (max_memory > 0 && memory_usage.getTotal() > max_memory)
+        {
+            if (!memory_limit_exceeded)
+            {
+                logError("Stopped in the %s stage, as the model needs more memory than the limit of %dMB set by --max-memory: %s\n",
+                    stage, int(max_memory / (1024 * 1024)), memory_usage.toString().c_str());
+            }
+            memory_limit_exceeded = true;
+            return false;
+        }
+        return true;
+    }
+
     bool prepareModel(SliceDataStorage& storage, PrintObject* object) /// slices the model
     {
-        storage.model_min = object->min();
-        storage.model_max = object->max();
-        storage.model_size = storage.model_max - storage.model_min;
+        SlicedModel sliced;
+        sliceModel(object, sliced);
+        if (isCancelled())
+            return false;
+        generateLayerParts(storage, object, sliced);
+        memory_usage.set(Memory_Slices, 0); // the slices are freed on returning
 
-        log("Slicing model...\n");
+        log("Finished prepareModel.\n");
+        return true;
+    }
+
+    /*!
+     * The height of the top of each layer of a model, a fixed distance apart or chosen by getAdaptiveLayerTops.
+     *
+     * \param model_max_z The height of the top of the model
+     * \param initial_slice_z Set to the height at which the first layer is sliced
+     */
+    std::vector<int> getLayerTops(PrintObject* object, int model_max_z, int& initial_slice_z)
+    {
         int initial_layer_thickness = object->getSettingInMicrons("layer_height_0");
         int layer_thickness = object->getSettingInMicrons("layer_height");
         if (object->getSettingAsPlatformAdhesion("adhesion_type") == Adhesion_Raft)
         {
             initial_layer_thickness = layer_thickness;
         }
-        int initial_slice_z = (initial_layer_thickness - layer_thickness / 2);
-        int layer_count = (storage.model_max.z - initial_slice_z) / layer_thickness + 1;
-        std::vector<Slicer*> slicerList;
-        for(Mesh& mesh : object->meshes)
+        initial_slice_z = (initial_layer_thickness - layer_thickness / 2);
+        int layer_count = (model_max_z - initial_slice_z) / layer_thickness + 1;
+        if (object->getSettingBoolean("adaptive_layer_height_enabled"))
+        {
+            int variation = object->getSettingInMicrons("adaptive_layer_height_variation");
+            int variation_step = object->getSettingInMicrons("adaptive_layer_height_variation_step");
+            int min_thickness = std::max(variation_step, layer_thickness - variation);
+            std::vector<int> layer_tops = getAdaptiveLayerTops(object->meshes, model_max_z, initial_layer_thickness, min_thickness, layer_thickness + variation, variation_step, object->getSettingInMicrons("adaptive_layer_height_threshold"));
+            log("Adaptive layers: %i instead of %i\n", int(layer_tops.size()), layer_count);
+            return layer_tops;
+        }
+        return Slicer::getUniformLayerZ(initial_layer_thickness, layer_thickness, layer_count);
+    }
+
+    void sliceModel(PrintObject* object, SlicedModel& sliced)
+    {
+        TRACE_ZONE("slice");
+        StatsScope stats_scope("slice");
+        sliced.model_min = object->min();
+        sliced.model_max = object->max();
+
+        log("Slicing model...\n");
+        int initial_slice_z = 0;
+        std::vector<int>& layer_tops = sliced.layer_tops;
+        layer_tops = getLayerTops(object, sliced.model_max.z, initial_slice_z);
+        // each layer is sliced through its middle, except the first, which is sliced half a layer height below its top
+        std::vector<int> layer_z(layer_tops.size());
+        layer_z[0] = initial_slice_z;
+        for (unsigned int layer_nr = 1; layer_nr < layer_tops.size(); layer_nr++)
+        {
+            layer_z[layer_nr] = layer_tops[layer_nr] - (layer_tops[layer_nr] - layer_tops[layer_nr - 1]) / 2;
+        }
+        int layer_count = layer_z.size();
+        std::string slice_cache_directory = object->getSettingString("machine_slice_cache_directory");
+        std::vector<Slicer*>& slicerList = sliced.slicers;
+        if (object->getSettingBoolean("machine_mesh_instancing"))
         {
-            Slicer* slicer = new Slicer(&mesh, initial_slice_z, layer_thickness, layer_count, mesh.getSettingBoolean("meshfix_keep_open_polygons"), mesh.getSettingBoolean("meshfix_extensive_stitching"));
+            sliced.instances = findMeshInstances(object);
+        }
+        else
+        {
+            sliced.instances.assign(object->meshes.size(), MeshInstance());
+        }
+        for(unsigned int mesh_idx = 0; mesh_idx < object->meshes.size(); mesh_idx++)
+        {
+            if (isCancelled())
+                return;
+            Mesh& mesh = object->meshes[mesh_idx];
+            bool keep_none_closed = mesh.getSettingBoolean("meshfix_keep_open_polygons");
+            bool extensive_stitching = mesh.getSettingBoolean("meshfix_extensive_stitching");
+            Slicer* slicer = nullptr;
+            const MeshInstance& instance = sliced.instances[mesh_idx];
+            if (instance.master >= 0)
+            {
+                slicer = new Slicer(layer_z);
+                copyMovedSlices(*slicerList[instance.master], instance.offset, *slicer);
+                log("Copied the slices of mesh %i to mesh %i\n", instance.master, mesh_idx);
+            }
+            else if (slice_cache_directory.size() > 0)
+            {
+                uint64_t cache_key = sliceCacheKey(&mesh, layer_z, keep_none_closed, extensive_stitching, mesh.getSettingInMicrons("xy_offset"));
+                slicer = new Slicer(layer_z);
+                if (loadSliceCache(slice_cache_directory, cache_key, *slicer))
+                {
+                    log("Loaded slices from cache\n");
+                }
+                else
+                {
+                    delete slicer;
+                    slicer = new Slicer(&mesh, layer_z, keep_none_closed, extensive_stitching);
+                    saveSliceCache(slice_cache_directory, cache_key, *slicer);
+                }
+            }
+            else
+            {
+                slicer = new Slicer(&mesh, layer_z, keep_none_closed, extensive_stitching);
+            }
             slicerList.push_back(slicer);
             /*
             for(SlicerLayer& layer : slicer->layers)
@@ -245,15 +912,21 @@ private:
 
             if (n_empty_first_layers > 0)
             {
+                int removed_thickness = (n_empty_first_layers < layer_count)? layer_tops[n_empty_first_layers] - layer_tops[0] : 0;
                 for (Slicer* slicer : slicerList)
                 {
                     std::vector<SlicerLayer>& layers = slicer->layers;
                     layers.erase(layers.begin(), layers.begin() + n_empty_first_layers);
                     for (SlicerLayer& layer : layers)
                     {
-                        layer.z -= n_empty_first_layers * layer_thickness;
+                        layer.z -= removed_thickness;
                     }
                 }
+                layer_tops.erase(layer_tops.begin(), layer_tops.begin() + n_empty_first_layers);
+                for (int& top : layer_tops)
+                {
+                    top -= removed_thickness;
+                }
                 layer_count -= n_empty_first_layers;
             }
         }
@@ -261,115 +934,325 @@ private:
         log("Layer count: %i\n", layer_count);
         log("Sliced model in %5.3fs\n", timeKeeper.restart());
 
+        size_t slice_memory = 0;
+        for(Slicer* slicer : sliced.slicers)
+            slice_memory += getMemoryUsage(*slicer);
+        memory_usage.set(Memory_Slices, slice_memory);
+        checkMemory("slice");
+
         object->clear();///Clear the mesh data, it is no longer needed after this point, and it saves a lot of memory.
+        memory_usage.set(Memory_Meshes, 0);
+    }
+
+    void generateLayerParts(SliceDataStorage& storage, PrintObject* object, SlicedModel& sliced)
+    {
+        TRACE_ZONE("layer_parts");
+        StatsScope stats_scope("layer_parts");
+        storage.model_min = sliced.model_min;
+        storage.model_max = sliced.model_max;
+        storage.model_size = storage.model_max - storage.model_min;
+        std::vector<Slicer*>& slicerList = sliced.slicers;
+        const std::vector<int>& layer_tops = sliced.layer_tops;
 
         log("Generating layer parts...\n");
+        unsigned int thread_count = getThreadCount(getSettingAsCount("machine_thread_count"));
         storage.meshes.reserve(slicerList.size());
         for(unsigned int meshIdx=0; meshIdx < slicerList.size(); meshIdx++)
         {
             storage.meshes.emplace_back(&object->meshes[meshIdx]);
             SliceMeshStorage& meshStorage = storage.meshes[meshIdx];
-            createLayerParts(meshStorage, slicerList[meshIdx], meshStorage.settings->getSettingBoolean("meshfix_union_all"), meshStorage.settings->getSettingBoolean("meshfix_union_all_remove_holes"));
+            if (meshIdx < sliced.instances.size())
+            {
+                meshStorage.instance = sliced.instances[meshIdx];
+            }
+            createLayerParts(meshStorage, slicerList[meshIdx], meshStorage.settings->getSettingBoolean("meshfix_union_all"), meshStorage.settings->getSettingBoolean("meshfix_union_all_remove_holes"), thread_count);
             //@createLayerParts(meshStorage, slicerList[meshIdx], true, meshStorage.settings->getSettingBoolean("meshfix_union_all_remove_holes"));
-            delete slicerList[meshIdx];
+
+            // Scanned models slice into far more points than can be printed; a deviation of more than a quarter of the
+            // outer wall would show in the walls.
+            int64_t max_deviation = std::min(meshStorage.settings->getSettingInMicrons("meshfix_maximum_deviation"), meshStorage.settings->getSettingInMicrons("wall_line_width_0") / 4);
+            if (max_deviation > 0)
+            {
+                unsigned int removed = simplifyLayerParts(meshStorage, max_deviation, thread_count);
+                log("Simplified the outlines of mesh %i by removing %u points\n", meshIdx, removed);
+            }
 
             bool has_raft = meshStorage.settings->getSettingAsPlatformAdhesion("adhesion_type") == Adhesion_Raft;
             for(unsigned int layer_nr=0; layer_nr<meshStorage.layers.size(); layer_nr++)
             {
-                //Add the raft offset to each layer.
+                //Print each layer at its top, on top of the raft if there is one.
                 if (has_raft)
                 {
-                    meshStorage.layers[layer_nr].printZ +=
+                    meshStorage.layers[layer_nr].printZ =
                         meshStorage.settings->getSettingInMicrons("raft_base_thickness")
                         + meshStorage.settings->getSettingInMicrons("raft_interface_thickness")
                         + meshStorage.settings->getSettingAsCount("raft_surface_layers") * getSettingInMicrons("layer_height") //raft_surface_thickness")
                         + meshStorage.settings->getSettingInMicrons("raft_airgap")
-                        - initial_slice_z;
+                        + layer_tops[layer_nr] - layer_tops[0];
                 }
                 else
                 {
-                    meshStorage.layers[layer_nr].printZ +=
-                        meshStorage.settings->getSettingInMicrons("layer_height_0")
-                        - initial_slice_z;
+                    meshStorage.layers[layer_nr].printZ = layer_tops[layer_nr];
                 }
             }
         }
         log("Generated layer parts in %5.3fs\n", timeKeeper.restart());
-
-        log("Finished prepareModel.\n");
-        return true;
+        setMemoryUsage(storage, memory_usage);
+        checkMemory("layer_parts");
     }
 
-    void processSliceData(SliceDataStorage& storage)
+    /*!
+     * Resolve the settings snapshot of each mesh from its current settings.
+     * This is done again for every job, since the settings of a mesh may change between jobs while its sliced data is reused.
+     */
+    void resolveMeshSettings(SliceDataStorage& storage)
     {
-        if (commandSocket)
-           commandSocket->beginSendSlicedObject();
-
-        // const
-        unsigned int totalLayers = storage.meshes[0].layers.size();
+        for(SliceMeshStorage& mesh : storage.meshes)
+        {
+            mesh.settings_snapshot = std::make_shared<const SettingsSnapshot>(mesh.settings);
+        }
+    }
 
-        //carveMultipleVolumes(storage.meshes);
-        generateMultipleVolumesOverlap(storage.meshes, getSettingInMicrons("multiple_mesh_overlap"));
-        //dumpLayerparts(storage, "c:/models/output.html");
-        if (getSettingBoolean("magic_polygon_mode"))
+    /*!
+     * Make the layers which are to be copied from the same layer of the master of their mesh generate nothing themselves,
+     * and make those which are to copy the results of another layer of their own mesh which is copied from the master generate them instead,
+     * so that no layer copies from a layer which gets its copy from the master.
+     *
+     * \param moved_layers Per mesh, for each layer whether it gets a copy of its master
+     * \param sources Per mesh, for each layer the layer of the same mesh to copy from; updated
+     */
+    void excludeMovedLayers(const std::vector<std::vector<bool>>& moved_layers, std::vector<std::vector<unsigned int>>& sources)
+    {
+        for(unsigned int mesh_idx = 0; mesh_idx < sources.size(); mesh_idx++)
         {
-            for(unsigned int layer_nr=0; layer_nr<totalLayers; layer_nr++)
+            for(unsigned int layer_nr = 0; layer_nr < sources[mesh_idx].size(); layer_nr++)
             {
-                for(SliceMeshStorage& mesh : storage.meshes)
+                if (moved_layers[mesh_idx][layer_nr] || moved_layers[mesh_idx][sources[mesh_idx][layer_nr]])
                 {
-                    SliceLayer* layer = &mesh.layers[layer_nr];
-                    for(SliceLayerPart& part : layer->parts)
-                    {
-                        sendPolygons(Inset0Type, layer_nr, part.outline, mesh.settings->getSettingInMicrons("wall_line_width_x"));
-                    }
+                    sources[mesh_idx][layer_nr] = layer_nr;
                 }
             }
-            return;
         }
+    }
 
-        for(unsigned int layer_nr=0; layer_nr<totalLayers; layer_nr++)
+    /*!
+     * What the stages of the layers added by addSliceDataStages share while the pipeline runs.
+     */
+    struct SliceDataJob
+    {
+        const SettingsSnapshot global_settings;
+        unsigned int layer_count;
+        std::vector<std::vector<int>> inset_counts; //!< Per mesh, for each layer the number of insets to generate
+        std::vector<std::vector<bool>> moved_layers; //!< Per mesh, for each layer whether its parts are copied from the same layer of the master of the mesh
+        std::vector<std::vector<unsigned int>> inset_sources; //!< Per mesh, for each layer the layer to copy the insets from; the layer itself when they are to be generated
+        std::vector<std::vector<bool>> moved_skin_layers; //!< Per mesh, for each layer whether its skins are copied from the same layer of the master of the mesh
+        std::vector<std::vector<unsigned int>> skin_sources; //!< Per mesh, for each layer the layer to copy the skins from; the layer itself when they are to be generated
+        std::vector<size_t> unpacked_memory; //!< For each layer the bytes of frozen layers the insets stage freed by unpacking them
+        std::unique_ptr<RepeatedLayerResults> repeated_insets;
+        std::unique_ptr<RepeatedLayerResults> repeated_skins;
+        std::atomic<unsigned int> n_repeated_inset_layers;
+        std::atomic<unsigned int> n_field_inset_layers;
+        std::atomic<unsigned int> n_moved_inset_layers;
+        std::atomic<unsigned int> n_repeated_skin_layers;
+        std::atomic<unsigned int> n_moved_skin_layers;
+        int skins_stage; //!< The stage generating the skins; -1 when the layers aren't processed
+        unsigned int skin_layers_below; //!< The most layers below a layer of which the skins read the insets
+        unsigned int skin_layers_above; //!< The most layers above a layer of which the skins read the insets
+        int done_stage; //!< The stage after which a layer is done; -1 when the layers aren't processed
+        unsigned int spiral_start; //!< The first layer written by writeSpiralLayer, see getSpiralStart
+        // The layers processed by a worker of distributed slicing, see setProcessedLayers; all layers otherwise.
+        unsigned int range_start; //!< The first layer of the range the worker is to process
+        unsigned int range_end; //!< The end of that range
+        unsigned int skins_start; //!< The first layer of which the skins and sparse infill are generated
+        unsigned int skins_end;
+        unsigned int combine_start; //!< The first layer of which the sparse infill is combined with the layers below
+        unsigned int insets_start; //!< The first layer of which the insets are generated
+        unsigned int insets_end;
+
+        SliceDataJob(SettingsBase* settings)
+        : global_settings(settings)
+        , layer_count(0)
+        , n_repeated_inset_layers(0)
+        , n_field_inset_layers(0)
+        , n_moved_inset_layers(0)
+        , n_repeated_skin_layers(0)
+        , n_moved_skin_layers(0)
+        , skins_stage(-1)
+        , skin_layers_below(0)
+        , skin_layers_above(0)
+        , done_stage(-1)
+        , spiral_start(0)
+        , range_start(0)
+        , range_end(0)
+        , skins_start(0)
+        , skins_end(0)
+        , combine_start(0)
+        , insets_start(0)
+        , insets_end(0)
         {
-            for(SliceMeshStorage& mesh : storage.meshes)
-            {
-                if(commandSocket)
+        }
+    };
+
+    /*!
+     * Process the sliced layer parts of a model into everything which is planned for each layer.
+     * The GCode is written afterwards by writeGCode, from a copy of the result.
+     */
+    void processSliceData(SliceDataStorage& storage)
+    {
+        SliceDataJob job(this);
+        LayerPipeline pipeline;
+        addSliceDataStages(storage, job, pipeline, true);
+        if (job.done_stage < 0 || isCancelled())
+        {
+            return;
+        }
+        unsigned int thread_count = getThreadCount(getSettingAsCount("machine_thread_count"));
+        if (storage.spill || storage.compact_layers)
+        {
+            // Each layer is packed away again once it's done and no other layer reads it anymore.
+            unsigned int pack_stage = pipeline.addStage("pack layer", [this, &storage](unsigned int layer_nr)
+            {
+                packLayers(storage, layer_nr);
+            }, true);
+            pipeline.addDependency(pack_stage, job.done_stage, 0, 0);
+            pipeline.addDependency(pack_stage, job.skins_stage, job.skin_layers_above, job.skin_layers_below);
+            pipeline.setWindow(thread_count * 8);
+        }
+        pipeline.run(job.layer_count, thread_count, [this]() { return isCancelled(); });
+        log("Processed the layers in %5.3fs\n", timeKeeper.restart());
+        finishSliceData(storage, job);
+    }
+
+    /*!
+     * Process the sliced layer parts of a model and write the GCode, in one pipeline: each layer is written as soon as
+     * it and the layers it depends on are processed, after which its data is freed.
+     *
+     * \return Whether all layers were written; false when cancelled
+     */
+    bool processSliceDataAndWriteGCode(SliceDataStorage& storage)
+    {
+        SliceDataJob slice_job(this);
+        LayerPipeline pipeline;
+        addSliceDataStages(storage, slice_job, pipeline, false);
+        if (isCancelled())
+        {
+            return false;
+        }
+        GCodeJob gcode_job(this);
+        beginGCode(storage, gcode_job, 0.0);
+        addGCodeStages(storage, gcode_job, pipeline, &slice_job);
+        pipeline.setWindow(gcode_job.thread_count * 8 + gcode_job.lookahead); // as many layers as were processed at a time stage by stage
+        bool completed = pipeline.run(gcode_job.layer_count, gcode_job.thread_count, [this]() { return isCancelled(); });
+        if (slice_job.done_stage >= 0)
+        {
+            finishSliceData(storage, slice_job);
+        }
+        return endGCode(storage, gcode_job, completed);
+    }
+
+    /*!
+     * Set the layers to process from machine_layer_range_start and machine_layer_range_end, which a worker of distributed
+     * slicing gets, see processModelDistributed. Besides its own range, the worker generates the skins of the layers
+     * with which the sparse infill of the range is combined, and the insets of the layers the skins of those read.
+     * Only the layers of the range are kept by the coordinator, so the layers around it only need to be right where
+     * the range reads them. A layer which would repeat the results of a layer before those it processes generates them
+     * itself.
+     */
+    void setProcessedLayers(SliceDataStorage& storage, SliceDataJob& job)
+    {
+        unsigned int layer_count = job.layer_count;
+        int range_end = getSettingAsCount("machine_layer_range_end");
+        job.range_start = std::min(layer_count, static_cast<unsigned int>(std::max(0, getSettingAsCount("machine_layer_range_start"))));
+        job.range_end = (range_end > 0)? std::min(layer_count, static_cast<unsigned int>(range_end)) : layer_count;
+        unsigned int combine_layers = 0; // the most layers below a layer with which its sparse infill is combined
+        for(SliceMeshStorage& mesh : storage.meshes)
+        {
+            combine_layers = std::max(combine_layers, static_cast<unsigned int>(std::max(1, mesh.settings_snapshot->fill_sparse_combine) - 1));
+        }
+        job.skins_start = job.range_start - std::min(job.range_start, combine_layers);
+        job.skins_end = std::min(layer_count, job.range_end + combine_layers);
+        job.combine_start = (job.skins_start > 0)? job.skins_start + combine_layers : 0; // combining reads the skins below
+        job.insets_start = job.skins_start - std::min(job.skins_start, job.skin_layers_below);
+        job.insets_end = std::min(layer_count, job.skins_end + job.skin_layers_above);
+        if (job.insets_start == 0 && job.insets_end == layer_count)
+        {
+            return;
+        }
+        log("Processing layers %u to %u of %u, reading layers %u to %u\n", job.range_start, job.range_end, layer_count, job.insets_start, job.insets_end);
+        for(std::vector<unsigned int>& mesh_inset_sources : job.inset_sources)
+        {
+            for(unsigned int layer_nr = job.insets_start; layer_nr < job.insets_end; layer_nr++)
+            {
+                if (mesh_inset_sources[layer_nr] < job.insets_start)
                 {
-                    int initial_layer_thickness = mesh.settings->getSettingInMicrons("layer_height_0");
-                    int layer_thickness = mesh.settings->getSettingInMicrons("layer_height");
-                    if (mesh.settings->getSettingAsPlatformAdhesion("adhesion_type") == Adhesion_Raft)
-                    {
-                        initial_layer_thickness = layer_thickness;
-                    }
-                    commandSocket->sendLayerInfo(layer_nr, mesh.layers[layer_nr].printZ, layer_nr == 0 ? initial_layer_thickness : layer_thickness);
+                    mesh_inset_sources[layer_nr] = layer_nr;
+                }
+            }
+        }
+        for(std::vector<unsigned int>& mesh_skin_sources : job.skin_sources)
+        {
+            for(unsigned int layer_nr = job.skins_start; layer_nr < job.skins_end; layer_nr++)
+            {
+                if (mesh_skin_sources[layer_nr] < job.skins_start)
+                {
+                    mesh_skin_sources[layer_nr] = layer_nr;
                 }
+            }
+        }
+    }
 
-                int insetCount = mesh.settings->getSettingAsCount("wall_line_count");
-                if (mesh.settings->getSettingBoolean("magic_spiralize") && static_cast<int>(layer_nr) < mesh.settings->getSettingAsCount("bottom_layers") && layer_nr % 2 == 1)//Add extra insets every 2 layers when spiralizing, this makes bottoms of cups watertight.
-                    insetCount += 5;
-                SliceLayer* layer = &mesh.layers[layer_nr];
-                int wall_line_width_0 = mesh.settings->getSettingInMicrons("wall_line_width_0");
-                int wall_line_width_x = mesh.settings->getSettingInMicrons("wall_line_width_x");
-                int inset_count = insetCount;
-                if (mesh.settings->getSettingBoolean("alternate_extra_perimeter"))
-                    inset_count += layer_nr % 2;
-                generateInsets(layer, wall_line_width_0, wall_line_width_x, inset_count, mesh.settings->getSettingBoolean("wall_overlap_avoid_enabled"));
+    /*!
+     * Do what concerns the model as a whole after slicing it, and add the stages which process each layer to \p pipeline:
+     * the insets, the skins and sparse infill, combining the sparse infill of layers, the combs, and reporting a layer
+     * in layer order from the calling thread, so the command socket is never used from the workers.
+     *
+     * Where the parts of a layer repeat an earlier layer, or a layer of the master of a mesh, the layer gets a copy of the
+     * results of that layer instead. The copies are taken when the results are generated, since the layer copied from
+     * may be processed further by the time a later layer repeats it.
+     *
+     * \param job What the stages share; to be kept until the pipeline has run
+     * \param send_progress Whether the layers count as the first two thirds of the progress
+     */
+    void addSliceDataStages(SliceDataStorage& storage, SliceDataJob& job, LayerPipeline& pipeline, bool send_progress)
+    {
+        if (commandSocket)
+           commandSocket->beginSendSlicedObject();
+
+        const SettingsSnapshot& global_settings = job.global_settings;
+        resolveMeshSettings(storage);
+
+        // const
+        unsigned int totalLayers = storage.meshes[0].layers.size();
+        unsigned int thread_count = getThreadCount(getSettingAsCount("machine_thread_count"));
 
-                for(unsigned int partNr=0; partNr<layer->parts.size(); partNr++)
+        // A layer of a mesh which is a moved copy of an earlier mesh gets a moved copy of the same layer of that mesh, where their outlines are the same.
+        // This is found before the outlines of the meshes are made to overlap, as that joins the meshes less than 40 micron apart and grows each by half the overlap.
+        int multiple_mesh_overlap = getSettingInMicrons("multiple_mesh_overlap");
+        std::vector<std::vector<bool>>& moved_layers = job.moved_layers; // per mesh, for each layer whether it is copied from the master of the mesh
+        moved_layers = findMovedLayers(storage.meshes, std::max(0, multiple_mesh_overlap / 2) + 40);
+
+        //carveMultipleVolumes(storage.meshes, thread_count);
+        generateMultipleVolumesOverlap(storage.meshes, multiple_mesh_overlap, thread_count);
+        //dumpLayerparts(storage, "c:/models/output.html");
+        if (global_settings.magic_polygon_mode)
+        {
+            for(unsigned int layer_nr=0; layer_nr<totalLayers; layer_nr++)
+            {
+                for(SliceMeshStorage& mesh : storage.meshes)
                 {
-                    if (layer->parts[partNr].insets.size() > 0)
+                    SliceLayer* layer = &mesh.layers[layer_nr];
+                    for(SliceLayerPart& part : layer->parts)
                     {
-                        sendPolygons(Inset0Type, layer_nr, layer->parts[partNr].insets[0], wall_line_width_x);
-                        for(unsigned int inset=1; inset<layer->parts[partNr].insets.size(); inset++)
-                            sendPolygons(InsetXType, layer_nr, layer->parts[partNr].insets[inset], wall_line_width_x);
+                        sendPolygons(Inset0Type, layer_nr, part.outline, mesh.settings_snapshot->wall_line_width_x);
                     }
                 }
             }
-            logProgress("inset",layer_nr+1,totalLayers);
-            if (commandSocket) commandSocket->sendProgress(1.0/3.0 * float(layer_nr) / float(totalLayers));
+            return;
         }
 
-
+        // The empty first layers only depend on the outlines, so they are removed before anything is generated for the layers.
+        int n_empty_first_layers = 0;
         { // remove empty first layers
-            int n_empty_first_layers = 0;
             for (unsigned int layer_idx = 0; layer_idx < totalLayers; layer_idx++)
             {
                 bool layer_is_empty = true;
@@ -397,12 +1280,17 @@ private:
                 for (SliceMeshStorage& mesh : storage.meshes)
                 {
                     std::vector<SliceLayer>& layers = mesh.layers;
+                    int removed_thickness = (n_empty_first_layers < int(layers.size()))? layers[n_empty_first_layers].printZ - layers[0].printZ : 0;
                     layers.erase(layers.begin(), layers.begin() + n_empty_first_layers);
                     for (SliceLayer& layer : layers)
                     {
-                        layer.printZ -= n_empty_first_layers * getSettingInMicrons("layer_height");
+                        layer.printZ -= removed_thickness;
                     }
                 }
+                for (std::vector<bool>& mesh_moved_layers : moved_layers)
+                {
+                    mesh_moved_layers.erase(mesh_moved_layers.begin(), mesh_moved_layers.begin() + n_empty_first_layers);
+                }
                 totalLayers -= n_empty_first_layers;
             }
         }
@@ -411,86 +1299,30 @@ private:
             log("Stopping process because there are no layers.\n");
             return;
         }
+        job.layer_count = totalLayers;
 
+        // The ooze shield, the support, the skirt and the raft only depend on the outlines as well, so they are done
+        // for the whole model before the layers are processed.
         if (getSettingBoolean("ooze_shield_enabled"))
         {
-            for(unsigned int layer_nr=0; layer_nr<totalLayers; layer_nr++)
-            {
-                Polygons oozeShield;
-                for(SliceMeshStorage& mesh : storage.meshes)
-                {
-                    for(SliceLayerPart& part : mesh.layers[layer_nr].parts)
-                    {
-                        oozeShield = oozeShield.unionPolygons(part.outline.offset(MM2INT(2.0))); // TODO: put hard coded value in a variable with an explanatory name (and make var a parameter, and perhaps even a setting?)
-                    }
-                }
-                storage.oozeShield.push_back(oozeShield);
-            }
-
-            for(unsigned int layer_nr=0; layer_nr<totalLayers; layer_nr++)
-                storage.oozeShield[layer_nr] = storage.oozeShield[layer_nr].offset(-MM2INT(1.0)).offset(MM2INT(1.0)); // TODO: put hard coded value in a variable with an explanatory name (and make var a parameter, and perhaps even a setting?)
+            TRACE_ZONE("ooze_shield");
             int offsetAngle = tan(getSettingInAngleRadians("ooze_shield_angle")) * getSettingInMicrons("layer_height");//Allow for a 60deg angle in the oozeShield.
-            for(unsigned int layer_nr=1; layer_nr<totalLayers; layer_nr++)
-                storage.oozeShield[layer_nr] = storage.oozeShield[layer_nr].unionPolygons(storage.oozeShield[layer_nr-1].offset(-offsetAngle));
-            for(unsigned int layer_nr=totalLayers-1; layer_nr>0; layer_nr--)
-                storage.oozeShield[layer_nr-1] = storage.oozeShield[layer_nr-1].unionPolygons(storage.oozeShield[layer_nr].offset(-offsetAngle));
+            generateOozeShield(storage, totalLayers, MM2INT(2.0), offsetAngle, thread_count); // TODO: put hard coded value in a variable with an explanatory name (and make var a parameter, and perhaps even a setting?)
         }
-        log("Generated inset in %5.3fs\n", timeKeeper.restart());
 
+        TraceZone support_zone("support");
         log("Generating support areas...\n");
-        for(SliceMeshStorage& mesh : storage.meshes)
-        {
-            generateSupportAreas(storage, &mesh, totalLayers);
-        }
-        log("Generated support areas in %5.3fs\n", timeKeeper.restart());
-
-
-
-        for(unsigned int layer_nr=0; layer_nr<totalLayers; layer_nr++)
         {
-            if (!getSettingBoolean("magic_spiralize") || static_cast<int>(layer_nr) < getSettingAsCount("bottom_layers"))    //Only generate up/downskin and infill for the first X layers when spiralize is choosen.
+            StatsScope stats_scope("support");
+            for(SliceMeshStorage& mesh : storage.meshes)
             {
-                for(SliceMeshStorage& mesh : storage.meshes)
-                {
-                    int extrusionWidth = mesh.settings->getSettingInMicrons("wall_line_width_x");
-                    generateSkins(layer_nr, mesh, extrusionWidth, mesh.settings->getSettingAsCount("bottom_layers"), mesh.settings->getSettingAsCount("top_layers"), mesh.settings->getSettingAsCount("skin_outline_count"), mesh.settings->getSettingBoolean("wall_overlap_avoid_enabled"));
-                    if (mesh.settings->getSettingInMicrons("infill_line_distance") > 0)
-                    {
-                        int infill_skin_overlap = 0;
-                        if (mesh.settings->getSettingInMicrons("infill_line_distance") > mesh.settings->getSettingInMicrons("infill_line_width") + 10)
-                        {
-                            infill_skin_overlap = extrusionWidth / 2;
-                        }
-                        generateSparse(layer_nr, mesh, extrusionWidth, infill_skin_overlap);
-                        if (mesh.settings->getSettingString("fill_perimeter_gaps") == "Skin")
-                        {
-                            generatePerimeterGaps(layer_nr, mesh, extrusionWidth, mesh.settings->getSettingAsCount("bottom_layers"), mesh.settings->getSettingAsCount("top_layers"));
-                        }
-                        else if (mesh.settings->getSettingString("fill_perimeter_gaps") == "Everywhere")
-                        {
-                            generatePerimeterGaps(layer_nr, mesh, extrusionWidth, 0, 0);
-                        }
-                    }
-
-                    SliceLayer& layer = mesh.layers[layer_nr];
-                    for(SliceLayerPart& part : layer.parts)
-                    {
-                        for (SkinPart& skin_part : part.skin_parts)
-                        {
-                            sendPolygons(SkinType, layer_nr, skin_part.outline, extrusionWidth);
-                        }
-                    }
-                }
+                if (isCancelled())
+                    return;
+                generateSupportAreas(storage, &mesh, totalLayers);
             }
-            logProgress("skin", layer_nr+1, totalLayers);
-            if (commandSocket) commandSocket->sendProgress(1.0/3.0 + 1.0/3.0 * float(layer_nr) / float(totalLayers));
-        }
-        for(unsigned int layer_nr=totalLayers-1; layer_nr>0; layer_nr--)
-        {
-            for(SliceMeshStorage& mesh : storage.meshes)
-                combineSparseLayers(layer_nr, mesh, mesh.settings->getSettingAsCount("fill_sparse_combine"));
         }
-        log("Generated up/down skin in %5.3fs\n", timeKeeper.restart());
+        support_zone.end();
+        log("Generated support areas in %5.3fs\n", timeKeeper.restart());
 
         if (getSettingInMicrons("wipe_tower_distance") > 0 && getSettingInMicrons("wipe_tower_size") > 0)
         {
@@ -522,391 +1354,1794 @@ private:
         }
 
         sendPolygons(SkirtType, 0, storage.skirt, adhesion_line_width);
-    }
-
-    void writeGCode(SliceDataStorage& storage)
-    {
-        gcode.resetTotalPrintTimeAndFilament();
-
-        if (commandSocket)
-            commandSocket->beginGCode();
+        setMemoryUsage(storage, memory_usage);
+        checkMemory("support");
 
-        //Setup the retraction parameters.
-        storage.retraction_config.amount = INT2MM(getSettingInMicrons("retraction_amount"));
-        storage.retraction_config.primeAmount = INT2MM(getSettingInMicrons("retraction_extra_prime_amount"));
-        storage.retraction_config.speed = getSettingInMillimetersPerSecond("retraction_retract_speed");
-        storage.retraction_config.primeSpeed = getSettingInMillimetersPerSecond("retraction_prime_speed");
-        storage.retraction_config.zHop = getSettingInMicrons("retraction_hop");
+        // A layer with the same outlines and number of insets as an earlier layer, as is common in prismatic parts, gets a copy of the insets of that layer.
+        // The number of insets goes by the layer number from before the empty first layers were removed.
+        job.spiral_start = getSpiralStart(storage, global_settings, totalLayers);
         for(SliceMeshStorage& mesh : storage.meshes)
         {
-            mesh.retraction_config.amount = INT2MM(mesh.settings->getSettingInMicrons("retraction_amount"));
-            mesh.retraction_config.primeAmount = INT2MM(mesh.settings->getSettingInMicrons("retraction_extra_prime_amount"));
-            mesh.retraction_config.speed = mesh.settings->getSettingInMillimetersPerSecond("retraction_retract_speed");
-            mesh.retraction_config.primeSpeed = mesh.settings->getSettingInMillimetersPerSecond("retraction_prime_speed");
-            mesh.retraction_config.zHop = mesh.settings->getSettingInMicrons("retraction_hop");
+            const SettingsSnapshot& mesh_settings = *mesh.settings_snapshot;
+            job.inset_counts.emplace_back();
+            for(unsigned int layer_nr=0; layer_nr<totalLayers; layer_nr++)
+            {
+                unsigned int sliced_layer_nr = layer_nr + n_empty_first_layers;
+                int insetCount = mesh_settings.wall_line_count;
+                if (mesh_settings.magic_spiralize && static_cast<int>(sliced_layer_nr) < mesh_settings.bottom_layers && sliced_layer_nr % 2 == 1)//Add extra insets every 2 layers when spiralizing, this makes bottoms of cups watertight.
+                    insetCount += 5;
+                if (mesh_settings.alternate_extra_perimeter)
+                    insetCount += sliced_layer_nr % 2;
+                job.inset_counts.back().push_back(insetCount);
+            }
+            job.inset_sources.push_back(findRepeatedInsetLayers(mesh, job.inset_counts.back()));
         }
+        excludeMovedLayers(moved_layers, job.inset_sources);
 
-        if (fileNr == 1)
+        // Likewise a layer of which the parts and those of the layers it takes its skin from repeat an earlier layer gets a copy of the skins of that layer,
+        // and a layer of a moved copy gets a moved copy of the skins of its master where all the layers it takes its skin from are moved copies.
+        for(unsigned int mesh_idx = 0; mesh_idx < storage.meshes.size(); mesh_idx++)
         {
-            if (gcode.getFlavor() != GCODE_FLAVOR_ULTIGCODE)
-            {//@ RepRap
-                if (hasSetting("material_bed_temperature") && getSettingInDegreeCelsius("material_bed_temperature") > 0)
-                    gcode.writeBedTemperatureCommand(getSettingInDegreeCelsius("material_bed_temperature"), true);
-
-                for(SliceMeshStorage& mesh : storage.meshes)
-                    if (mesh.settings->hasSetting("material_print_temperature") && mesh.settings->getSettingInDegreeCelsius("material_print_temperature") > 0)
-                        gcode.writeTemperatureCommand(mesh.settings->getSettingAsIndex("extruder_nr"), mesh.settings->getSettingInDegreeCelsius("material_print_temperature"));
-                for(SliceMeshStorage& mesh : storage.meshes)
-                    if (mesh.settings->hasSetting("material_print_temperature") && mesh.settings->getSettingInDegreeCelsius("material_print_temperature") > 0)
-                        gcode.writeTemperatureCommand(mesh.settings->getSettingAsIndex("extruder_nr"), mesh.settings->getSettingInDegreeCelsius("material_print_temperature"), true);
-                gcode.writeCode(getSettingString("machine_start_gcode").c_str());
-                //@ set welder_on and welder_off gcode string if metal printing
-                if (getSettingBoolean("machine_metal_printing")){
-                    gcode.setIsMetalPrinting(getSettingBoolean("machine_metal_printing"));
-                    gcode.setWelderOn(getSettingString("machine_welder_on_gcode"));
-                    gcode.setWelderOff(getSettingString("machine_welder_off_gcode"));
-                    gcode.setMinDistWelderOff(getSettingInMillimetersPerSecond("machine_min_dist_welder_off"));
-                    gcode.setIsWelding(false); //@ initial that welding is on or not
-                }
-            }
-            gcode.writeComment("Generated with Cura_SteamEngine " VERSION);
-            //@ add line_width and layer_height to the gcode output
-            gcode.writeComment("////////////////////////////////////////");
-            std::string tempString;
-            tempString = getSettingString("skin_line_width");
-            gcode.writeComment("Line width: " + tempString + " mm.");
-            tempString = getSettingString("layer_height");
-            gcode.writeComment("Layer height: " + tempString + " mm.");
-            tempString = getSettingString("speed_print");
-            gcode.writeComment("Printing speed: " + tempString + " mm/s");
-            tempString = getSettingString("material_diameter");
-            gcode.writeComment("Material diameter: " + tempString + " mm.");
-
-            double lineWidth = INT2MM(getSettingInMicrons("infill_line_width"));
-            double layerHeight = INT2MM(getSettingInMicrons("layer_height"));
-            double speedPrint = INT2MM(getSettingInMicrons("speed_print"));
-            double expectedMM3PerSec = lineWidth * layerHeight * speedPrint;
-            double materialDiameter = INT2MM(getSettingInMicrons("material_diameter"));
-            double crossSectionalArea = M_PI*(materialDiameter/2.0)*(materialDiameter/2.0);
-            double wireSpeed;
-            double wireMMPerSec;
-            for(int i=1;i<=100;i++){
-                //@ this equation only for Millermatic 190
-                //@ wireMMPerSec = 0.0254 * (0.45*i/100.0+20.5) * i/100.0;
-                wireMMPerSec = (2.216*i)-19;
-                if ((crossSectionalArea*wireMMPerSec) < expectedMM3PerSec){
-                    wireSpeed = i;
-                }
-                else {
-                    break;
+            SliceMeshStorage& mesh = storage.meshes[mesh_idx];
+            const SettingsSnapshot& mesh_settings = *mesh.settings_snapshot;
+            job.skin_sources.push_back(findRepeatedSkinLayers(mesh, job.inset_counts[mesh_idx], mesh_settings.bottom_layers, mesh_settings.top_layers));
+            job.moved_skin_layers.push_back(findMovedSkinLayers(moved_layers[mesh_idx], mesh_settings.bottom_layers, mesh_settings.top_layers));
+            job.skin_layers_below = std::max(job.skin_layers_below, static_cast<unsigned int>(std::max(0, mesh_settings.bottom_layers)));
+            job.skin_layers_above = std::max(job.skin_layers_above, static_cast<unsigned int>(std::max(0, mesh_settings.top_layers)));
+        }
+        excludeMovedLayers(job.moved_skin_layers, job.skin_sources);
+        if (global_settings.magic_spiralize)
+        {
+            for(std::vector<unsigned int>& mesh_skin_sources : job.skin_sources)
+            {
+                for(unsigned int layer_nr = std::max(0, global_settings.bottom_layers); layer_nr < totalLayers; layer_nr++)
+                {
+                    mesh_skin_sources[layer_nr] = layer_nr; // no skins are generated here, so nothing is copied either
                 }
             }
-            //@ expected material in volume
-            std::ostringstream expVolume;
-            expVolume << expectedMM3PerSec;
-            gcode.writeComment("Expected Material: " + expVolume.str() + " mm3/s.");
-            gcode.writeComment("////////////////////////////////////////");
-            gcode.writeComment("Recommended welder (Millermatic 190) settings");
-            gcode.writeComment("Voltage: 5 volts");
-            if (wireSpeed >=10)
+        }
+        setProcessedLayers(storage, job);
+        job.repeated_insets.reset(new RepeatedLayerResults(job.inset_sources));
+        job.repeated_skins.reset(new RepeatedLayerResults(job.skin_sources));
+
+        // From here on each layer only needs the layers around it, so the outlines of all layers are packed away, into the
+        // scratch file or their compact encoding, to be unpacked when their insets are generated.
+        std::string spill_directory = getSettingString("machine_spill_directory");
+        if (spill_directory.size() > 0)
+        {
+            storage.spill = std::make_shared<LayerSpill>(spill_directory, storage.meshes.size(), totalLayers);
+            if (!storage.spill->isOpen())
             {
-                std::ostringstream tempStr;
-                tempStr << (wireSpeed - 2.0) << " - " << (wireSpeed + 2.0);
-                gcode.writeComment("Wire speed: " + tempStr.str());
+                storage.spill.reset();
             }
-            else
+        }
+        storage.compact_layers = !storage.spill && getSettingBoolean("machine_compact_layers");
+        if (storage.spill || storage.compact_layers)
+        {
+            TRACE_ZONE("pack layers");
+            parallelFor(totalLayers, thread_count, [&](unsigned int layer_nr)
             {
-                gcode.writeComment("Wire speed: <10 (Cannot be set!)");
+                for(unsigned int mesh_idx = 0; mesh_idx < storage.meshes.size(); mesh_idx++)
+                {
+                    packLayer(storage, mesh_idx, layer_nr);
+                }
+            });
+            setMemoryUsage(storage, memory_usage);
+        }
+        job.unpacked_memory.assign(totalLayers, 0);
+        memory_usage.set(Memory_Insets, 0);
+        memory_usage.set(Memory_Skins, 0);
+        memory_usage.set(Memory_Infill, 0);
+        memory_usage.set(Memory_Combs, 0);
+
+        // The insets of each layer only depend on the outlines of that layer.
+        // The master of a mesh comes before its copies, so the same layer of the master is done by the time a copy gets it.
+        unsigned int insets_stage = pipeline.addStage("insets", [this, &storage, &job](unsigned int layer_nr)
+        {
+            if (layer_nr < job.insets_start || layer_nr >= job.insets_end)
+            {
+                return;
             }
-            gcode.writeComment("////////////////////////////////////////\n");
-
-
-            if (gcode.getFlavor() == GCODE_FLAVOR_BFB)
+            for(unsigned int mesh_idx = 0; mesh_idx < storage.meshes.size(); mesh_idx++)
             {
-                gcode.writeComment("enable auto-retraction");
-                std::ostringstream tmp;
-                tmp << "M227 S" << (getSettingInMicrons("retraction_amount") * 2560 / 1000) << " P" << (getSettingInMicrons("retraction_amount") * 2560 / 1000);
-                gcode.writeLine(tmp.str().c_str());
+                SliceMeshStorage& mesh = storage.meshes[mesh_idx];
+                SliceLayer& layer = mesh.layers[layer_nr];
+                job.unpacked_memory[layer_nr] += layer.compact.capacity();
+                unpackLayer(storage, mesh_idx, layer_nr);
+                std::shared_ptr<const std::vector<SliceLayerPart>> repeated_parts = job.repeated_insets->take(mesh_idx, layer_nr);
+                if (job.moved_layers[mesh_idx][layer_nr])
+                {
+                    copyMovedLayer(storage.meshes[mesh.instance.master].layers[layer_nr], mesh.instance.offset, layer);
+                    job.n_moved_inset_layers++;
+                }
+                else if (repeated_parts)
+                {
+                    layer.parts = *repeated_parts;
+                    job.n_repeated_inset_layers++;
+                }
+                else
+                {
+                    const SettingsSnapshot& mesh_settings = *mesh.settings_snapshot;
+                    if (generateInsets(&layer, mesh_settings.wall_line_width_0, mesh_settings.wall_line_width_x, job.inset_counts[mesh_idx][layer_nr], mesh_settings.wall_overlap_avoid_enabled, mesh_settings.wall_field_point_count))
+                    {
+                        job.n_field_inset_layers++;
+                    }
+                }
+                job.repeated_insets->keep(mesh_idx, layer_nr, layer.parts);
             }
-        }
-        else
+        });
+        pipeline.addDependency(insets_stage, insets_stage, [&job](unsigned int layer_nr, std::vector<unsigned int>& required_layers)
         {
-            gcode.writeFanCommand(0);
-            gcode.resetExtrusionValue();
-            gcode.setZ(maxObjectHeight + 5000);
-            gcode.writeMove(gcode.getPositionXY(), getSettingInMillimetersPerSecond("speed_travel"), 0);
-            gcode.writeMove(Point(storage.model_min.x, storage.model_min.y), getSettingInMillimetersPerSecond("speed_travel"), 0);
-        }
-        fileNr++;
-
-        unsigned int totalLayers = storage.meshes[0].layers.size();
-        //gcode.writeComment("Layer count: %d", totalLayers);
+            for(const std::vector<unsigned int>& mesh_inset_sources : job.inset_sources)
+            {
+                required_layers.push_back(mesh_inset_sources[layer_nr]);
+            }
+        });
 
-        bool has_raft = getSettingAsPlatformAdhesion("adhesion_type") == Adhesion_Raft;
-        if (has_raft)
+        // Skins, sparse infill and perimeter gaps of a layer only read the insets and outlines of the layers around it.
+        // A copy only replaces these, since the layers around it may be reading the rest of its parts meanwhile.
+        unsigned int skins_stage = pipeline.addStage("skins_infill", [this, &storage, &job](unsigned int layer_nr)
         {
-            //printf("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!enter has_raft"); //@ for test.
-            GCodePathConfig raft_base_config(&storage.retraction_config, "SUPPORT");
-            raft_base_config.setSpeed(getSettingInMillimetersPerSecond("raft_base_speed"));
-            raft_base_config.setLineWidth(getSettingInMicrons("raft_base_linewidth"));
-            raft_base_config.setLayerHeight(getSettingInMicrons("raft_base_thickness"));
-            raft_base_config.setFlow(getSettingInPercentage("material_flow"));
-            GCodePathConfig raft_interface_config(&storage.retraction_config, "SUPPORT");
-            raft_interface_config.setSpeed(getSettingInMillimetersPerSecond("raft_base_speed"));
-            raft_interface_config.setLineWidth(getSettingInMicrons("raft_base_linewidth"));
-            raft_interface_config.setLayerHeight(getSettingInMicrons("raft_base_thickness"));
-            raft_interface_config.setFlow(getSettingInPercentage("material_flow"));
-            GCodePathConfig raft_surface_config(&storage.retraction_config, "SUPPORT");
-            raft_surface_config.setSpeed(getSettingInMillimetersPerSecond("raft_base_speed"));
-            raft_surface_config.setLineWidth(getSettingInMicrons("raft_base_linewidth"));
-            raft_surface_config.setLayerHeight(getSettingInMicrons("raft_base_thickness"));
-            raft_surface_config.setFlow(getSettingInPercentage("material_flow"));
-
+            const SettingsSnapshot& global_settings = job.global_settings;
+            if (global_settings.magic_spiralize && static_cast<int>(layer_nr) >= global_settings.bottom_layers)    //Only generate up/downskin and infill for the first X layers when spiralize is choosen.
             {
-                gcode.writeLayerComment(-3);
-                gcode.writeComment("RAFT");
-                GCodePlanner gcodeLayer(gcode, &storage.retraction_config, getSettingInMillimetersPerSecond("speed_travel"), getSettingInMicrons("retraction_min_travel"));
-                if (getSettingAsIndex("support_extruder_nr") > 0)
+                return;
+            }
+            if (layer_nr < job.skins_start || layer_nr >= job.skins_end)
+            {
+                return;
+            }
+            for(unsigned int mesh_idx = 0; mesh_idx < storage.meshes.size(); mesh_idx++)
+            {
+                SliceMeshStorage& mesh = storage.meshes[mesh_idx];
+                SliceLayer& layer = mesh.layers[layer_nr];
+                std::shared_ptr<const std::vector<SliceLayerPart>> repeated_parts = job.repeated_skins->take(mesh_idx, layer_nr);
+                if (job.moved_skin_layers[mesh_idx][layer_nr])
+                {
+                    copyMovedSkins(storage.meshes[mesh.instance.master].layers[layer_nr], mesh.instance.offset, layer);
+                    job.n_moved_skin_layers++;
+                }
+                else if (repeated_parts)
+                {
+                    copySkins(*repeated_parts, layer.parts);
+                    job.n_repeated_skin_layers++;
+                }
+                else
+                {
+                    const SettingsSnapshot& mesh_settings = *mesh.settings_snapshot;
+                    int extrusionWidth = mesh_settings.wall_line_width_x;
+                    generateSkins(layer_nr, mesh, extrusionWidth, mesh_settings.bottom_layers, mesh_settings.top_layers, mesh_settings.skin_outline_count, mesh_settings.wall_overlap_avoid_enabled);
+                    if (mesh_settings.infill_line_distance > 0)
+                    {
+                        int infill_skin_overlap = 0;
+                        if (mesh_settings.infill_line_distance > mesh_settings.infill_line_width + 10)
+                        {
+                            infill_skin_overlap = extrusionWidth / 2;
+                        }
+                        generateSparse(layer_nr, mesh, extrusionWidth, infill_skin_overlap);
+                        if (mesh_settings.fill_perimeter_gaps == FillPerimeterGaps_Skin)
+                        {
+                            generatePerimeterGaps(layer_nr, mesh, extrusionWidth, mesh_settings.bottom_layers, mesh_settings.top_layers);
+                        }
+                        else if (mesh_settings.fill_perimeter_gaps == FillPerimeterGaps_Everywhere)
+                        {
+                            generatePerimeterGaps(layer_nr, mesh, extrusionWidth, 0, 0);
+                        }
+                    }
+                    for(SliceLayerPart& part : layer.parts)
+                    {
+                        part.inner_offsets.clear();
+                    }
+                }
+                job.repeated_skins->keep(mesh_idx, layer_nr, layer.parts);
+            }
+        });
+        pipeline.addDependency(skins_stage, insets_stage, job.skin_layers_below, job.skin_layers_above);
+        pipeline.addDependency(skins_stage, skins_stage, [&job](unsigned int layer_nr, std::vector<unsigned int>& required_layers)
+        {
+            for(const std::vector<unsigned int>& mesh_skin_sources : job.skin_sources)
+            {
+                required_layers.push_back(mesh_skin_sources[layer_nr]);
+            }
+        });
+        job.skins_stage = skins_stage;
+        std::vector<unsigned int> layer_done_stages = { skins_stage }; // the stages after which a layer is done, apart from reporting it
+
+        // Combining a layer changes the sparse areas of the layers below it, so this goes from the top down.
+        int max_sparse_combine = 1;
+        for(SliceMeshStorage& mesh : storage.meshes)
+        {
+            max_sparse_combine = std::max(max_sparse_combine, mesh.settings_snapshot->fill_sparse_combine);
+        }
+        if (max_sparse_combine > 1)
+        {
+            unsigned int combine_stage = pipeline.addStage("combineSparseLayers", [&storage, &job](unsigned int layer_nr)
+            {
+                if (layer_nr == 0 || layer_nr < job.combine_start || layer_nr >= job.skins_end)
+                {
+                    return;
+                }
+                for(SliceMeshStorage& mesh : storage.meshes)
+                {
+                    combineSparseLayers(layer_nr, mesh, mesh.settings_snapshot->fill_sparse_combine);
+                }
+            });
+            pipeline.addDependency(combine_stage, skins_stage, max_sparse_combine - 1, 0);
+            pipeline.addDependency(combine_stage, combine_stage, 0, 1);
+            layer_done_stages.push_back(combine_stage);
+        }
+
+        if (global_settings.retraction_combing)
+        {
+            // The combs are only built once the copies of the layer are taken, which would otherwise share them.
+            unsigned int combs_stage = pipeline.addStage("combs", [&storage, &job](unsigned int layer_nr)
+            {
+                if (layer_nr >= job.spiral_start)
+                {
+                    return; // the walls of a spiralized layer are written without travels in between
+                }
+                if (layer_nr < job.range_start || layer_nr >= job.range_end)
+                {
+                    return;
+                }
+                for(SliceMeshStorage& mesh : storage.meshes)
+                {
+                    for(SliceLayerPart& part : mesh.layers[layer_nr].parts)
+                    {
+                        part.comb = std::make_shared<Comb>(part.combBoundery);
+                        part.comb->prepare();
+                    }
+                }
+            });
+            pipeline.addDependency(combs_stage, skins_stage, 0, 0);
+            layer_done_stages.push_back(combs_stage);
+        }
+
+        unsigned int report_stage = pipeline.addStage("report layer", [this, &storage, &job, send_progress](unsigned int layer_nr)
+        {
+            const SettingsSnapshot& global_settings = job.global_settings;
+            for(SliceMeshStorage& mesh : storage.meshes)
+            {
+                const SettingsSnapshot& mesh_settings = *mesh.settings_snapshot;
+                if(commandSocket)
+                {
+                    commandSocket->sendLayerInfo(layer_nr, mesh.layers[layer_nr].printZ, getLayerThickness(storage, mesh_settings, layer_nr));
+                }
+
+                SliceLayer& layer = mesh.layers[layer_nr];
+                MemoryUsage layer_memory;
+                addMemoryUsage(layer, layer_memory);
+                for (MemoryCategory category : { Memory_Insets, Memory_Skins, Memory_Infill, Memory_Combs })
+                {
+                    memory_usage.add(category, layer_memory.get(category));
+                }
+                if (storage.spill || storage.compact_layers)
+                {
+                    memory_usage.add(Memory_Outlines, layer_memory.get(Memory_Outlines)); // unpacked by the insets stage
+                }
+                int wall_line_width_x = mesh_settings.wall_line_width_x;
+                for(SliceLayerPart& part : layer.parts)
+                {
+                    if (part.insets.size() > 0)
+                    {
+                        sendPolygons(Inset0Type, layer_nr, part.insets[0], wall_line_width_x);
+                        for(unsigned int inset=1; inset<part.insets.size(); inset++)
+                            sendPolygons(InsetXType, layer_nr, part.insets[inset], wall_line_width_x);
+                    }
+                    if (!global_settings.magic_spiralize || static_cast<int>(layer_nr) < global_settings.bottom_layers)
+                    {
+                        for (SkinPart& skin_part : part.skin_parts)
+                        {
+                            sendPolygons(SkinType, layer_nr, skin_part.outline, wall_line_width_x);
+                        }
+                    }
+                }
+            }
+            MemoryUsage thawed;
+            thawed.set(Memory_Frozen, job.unpacked_memory[layer_nr]);
+            releaseMemoryUsage(thawed);
+            logProgress("inset", layer_nr+1, job.layer_count);
+            logProgress("skin", layer_nr+1, job.layer_count);
+            if (send_progress)
+            {
+                sendProgress(2.0/3.0 * float(layer_nr) / float(job.layer_count));
+            }
+            checkMemory("layers", false); // stops the pipeline when over the limit
+        }, true);
+        for(unsigned int stage : layer_done_stages)
+        {
+            pipeline.addDependency(report_stage, stage, 0, 0);
+        }
+        job.done_stage = report_stage;
+    }
+
+    /*!
+     * Log what the stages of the layers of a SliceDataJob have done, once the pipeline has run.
+     */
+    void finishSliceData(SliceDataStorage& storage, SliceDataJob& job)
+    {
+        if (job.n_repeated_inset_layers > 0)
+        {
+            log("Copied the insets of %d repeated layers\n", int(job.n_repeated_inset_layers));
+        }
+        if (job.n_moved_inset_layers > 0)
+        {
+            log("Copied the insets of %d layers of moved copies of a mesh\n", int(job.n_moved_inset_layers));
+        }
+        if (job.n_field_inset_layers > 0)
+        {
+            log("Generated the insets of %d layers from distance fields\n", int(job.n_field_inset_layers));
+        }
+        if (job.n_repeated_skin_layers > 0)
+        {
+            log("Copied the skins of %d repeated layers\n", int(job.n_repeated_skin_layers));
+        }
+        if (job.n_moved_skin_layers > 0)
+        {
+            log("Copied the skins of %d layers of moved copies of a mesh\n", int(job.n_moved_skin_layers));
+        }
+        if (storage.spill)
+        {
+            log("Spilled %.1fMB of layers to the scratch file\n", storage.spill->getFileSize() / (1024.0 * 1024.0));
+        }
+        setMemoryUsage(storage, memory_usage);
+        if (storage.compact_layers)
+        {
+            log("Froze the layers into %.1fMB\n", memory_usage.get(Memory_Frozen) / (1024.0 * 1024.0));
+        }
+        checkMemory("layers");
+    }
+
+    /*!
+     * What the stages of writing the layers added by addGCodeStages share while the pipeline runs.
+     */
+    struct GCodeJob
+    {
+        const SettingsSnapshot global_settings;
+        unsigned int layer_count;
+        unsigned int thread_count;
+        unsigned int lookahead; //!< The most layers planned at once
+        unsigned int first_batch_layer; //!< The first layer planned in a batch with the layers after it
+        unsigned int spiral_start; //!< The first layer written by writeSpiralLayer instead of being planned
+        unsigned int batch_end; //!< The first layer which isn't written yet
+        float progress_start; //!< The progress when the first layer is written; the layers take up the rest
+        unsigned int infill_cache_hits;
+        unsigned int infill_cache_misses;
+        int64_t travel_refinement_saved; //!< The travel saved on all layers by refining the path order
+        uint64_t moves_merged; //!< The moves left out on all layers by merging them, see GCodePlanner::setMergeTolerance
+        uint64_t moves_planned; //!< The moves of the paths which were merged
+        bool layer_templates; //!< Whether layers repeating the layer before them are written from its GCode, see writeGCodeBatch
+        std::vector<uint64_t> layer_fingerprints; //!< For each layer the hashLayerToolpaths of it; 0 for the layers which can't repeat another
+        GCodeBuffer layer_template; //!< The GCode of the last layer which the layer after it repeats
+        uint64_t template_fingerprint; //!< The fingerprint of the layer of layer_template; 0 if none
+        int template_z; //!< The Z of the layer of layer_template
+        int template_fan_speed; //!< The fan speed of the layer of layer_template
+        Point template_start; //!< Where the layer of layer_template started
+        unsigned int n_template_layers; //!< The layers written from layer_template
+        std::vector<unsigned int> support_sources; //!< For each layer the layer of which it shares the support paths, see findRepeatedSupportLayers
+        std::vector<unsigned int> next_support_repeat; //!< For each layer the next layer sharing its support paths; 0 if none
+        unsigned int n_repeated_support_layers;
+        int welder_starts;
+        std::vector<std::unique_ptr<GCodePlanner>> planners;
+        std::vector<int> fan_speeds;
+        std::vector<Point> batch_end_positions; //!< For each layer of the last batch, where the head was after it
+        std::vector<LayerPathConfigs> path_configs; //!< The path configs of each kind of layer, see setPathConfigs
+        std::vector<unsigned int> layer_path_configs; //!< For each layer the index of its path configs in path_configs
+        //@ add vairables for pause time between layers
+        double pauseTime;
+        double pauseIncrease;
+        std::string pauseGcode;
+        //@ add variable for move the printer head up at the end of each layer
+        double upLayerEnd;
+        //@ welder off gcode
+        std::string welderOffGCode;
+        //@ boolean layer pause
+        bool layerPause;
+        bool pauseAdaptive; //!< Whether the pause only lasts as long as the layer needs to cool, see getInterlayerDwell
+        double interpassTime; //!< The time from the start of a layer to the start of the next which a reference layer needs to cool, in ms
+        double interpassThickness; //!< The volume per area of the outlines a reference layer deposits, in mm
+        double pauseTotal; //!< The time paused between the layers written so far, in ms
+        double pauseSaved; //!< The time saved on those pauses compared to the fixed pauses, in ms
+        bool interleave; //!< Whether the layers are kept in interleaved_objects rather than written, see writeInterleavedObjects
+
+        GCodeJob(SettingsBase* settings)
+        : global_settings(settings)
+        , layer_count(0)
+        , thread_count(1)
+        , lookahead(1)
+        , first_batch_layer(1)
+        , spiral_start(0)
+        , batch_end(0)
+        , progress_start(0)
+        , infill_cache_hits(0)
+        , infill_cache_misses(0)
+        , travel_refinement_saved(0)
+        , moves_merged(0)
+        , moves_planned(0)
+        , layer_templates(false)
+        , template_fingerprint(0)
+        , template_z(0)
+        , template_fan_speed(0)
+        , n_template_layers(0)
+        , n_repeated_support_layers(0)
+        , welder_starts(0)
+        , pauseTime(0)
+        , pauseIncrease(0)
+        , upLayerEnd(0)
+        , layerPause(false)
+        , pauseAdaptive(false)
+        , interpassTime(0)
+        , interpassThickness(0)
+        , pauseTotal(0)
+        , pauseSaved(0)
+        , interleave(false)
+        {
+        }
+    };
+
+    /*!
+     * Write the GCode of a processed model.
+     *
+     * \return Whether all layers were written; false when cancelled
+     */
+    bool writeGCode(SliceDataStorage& storage)
+    {
+        GCodeJob job(this);
+        beginGCode(storage, job, 2.0/3.0);
+        LayerPipeline pipeline;
+        addGCodeStages(storage, job, pipeline, nullptr);
+        if (storage.spill || storage.compact_layers || storage.checkpoint)
+        {
+            pipeline.setWindow(job.thread_count * 8 + job.lookahead); // only unpack the layers about to be written
+        }
+        bool completed = pipeline.run(job.layer_count, job.thread_count, [this]() { return isCancelled(); });
+        return endGCode(storage, job, completed);
+    }
+
+    /*!
+     * Write everything before the first layer: the start code, the header and the raft.
+     *
+     * \param progress_start The progress when the first layer is written
+     */
+    void beginGCode(SliceDataStorage& storage, GCodeJob& job, float progress_start)
+    {
+        TRACE_ZONE("export");
+        StatsScope stats_scope("export");
+        gcode.resetTotalPrintTimeAndFilament();
+        gcode.setStatistics(&print_statistics);
+
+        if (commandSocket)
+            commandSocket->beginGCode();
+
+        const SettingsSnapshot& global_settings = job.global_settings;
+        resolveMeshSettings(storage);
+        infill_cache.setMemoryBudget(std::max(0, getSettingAsCount("machine_infill_cache_size")) * size_t(1024 * 1024));
+        job.infill_cache_hits = infill_cache.getHitCount();
+        job.infill_cache_misses = infill_cache.getMissCount();
+        job.welder_starts = gcode.getWelderStartCount();
+        job.progress_start = progress_start;
+        job.interleave = getSettingBoolean("machine_interleave_objects");
+
+        //Setup the retraction parameters.
+        storage.retraction_config.amount = INT2MM(getSettingInMicrons("retraction_amount"));
+        storage.retraction_config.primeAmount = INT2MM(getSettingInMicrons("retraction_extra_prime_amount"));
+        storage.retraction_config.speed = getSettingInMillimetersPerSecond("retraction_retract_speed");
+        storage.retraction_config.primeSpeed = getSettingInMillimetersPerSecond("retraction_prime_speed");
+        storage.retraction_config.zHop = getSettingInMicrons("retraction_hop");
+        for(SliceMeshStorage& mesh : storage.meshes)
+        {
+            mesh.retraction_config.amount = INT2MM(mesh.settings->getSettingInMicrons("retraction_amount"));
+            mesh.retraction_config.primeAmount = INT2MM(mesh.settings->getSettingInMicrons("retraction_extra_prime_amount"));
+            mesh.retraction_config.speed = mesh.settings->getSettingInMillimetersPerSecond("retraction_retract_speed");
+            mesh.retraction_config.primeSpeed = mesh.settings->getSettingInMillimetersPerSecond("retraction_prime_speed");
+            mesh.retraction_config.zHop = mesh.settings->getSettingInMicrons("retraction_hop");
+        }
+
+        if (fileNr == 1)
+        {
+            if (gcode.getFlavor() != GCODE_FLAVOR_ULTIGCODE)
+            {//@ RepRap
+                if (hasSetting("material_bed_temperature") && getSettingInDegreeCelsius("material_bed_temperature") > 0)
+                    gcode.writeBedTemperatureCommand(getSettingInDegreeCelsius("material_bed_temperature"), true);
+
+                for(SliceMeshStorage& mesh : storage.meshes)
+                    if (mesh.settings->hasSetting("material_print_temperature") && mesh.settings->getSettingInDegreeCelsius("material_print_temperature") > 0)
+                        gcode.writeTemperatureCommand(mesh.settings->getSettingAsIndex("extruder_nr"), mesh.settings->getSettingInDegreeCelsius("material_print_temperature"));
+                for(SliceMeshStorage& mesh : storage.meshes)
+                    if (mesh.settings->hasSetting("material_print_temperature") && mesh.settings->getSettingInDegreeCelsius("material_print_temperature") > 0)
+                        gcode.writeTemperatureCommand(mesh.settings->getSettingAsIndex("extruder_nr"), mesh.settings->getSettingInDegreeCelsius("material_print_temperature"), true);
+                gcode.writeCode(getSettingString("machine_start_gcode").c_str());
+                //@ set welder_on and welder_off gcode string if metal printing
+                if (getSettingBoolean("machine_metal_printing")){
+                    gcode.setIsMetalPrinting(getSettingBoolean("machine_metal_printing"));
+                    gcode.setWelderOn(getSettingString("machine_welder_on_gcode"));
+                    gcode.setWelderOff(getSettingString("machine_welder_off_gcode"));
+                    gcode.setMinDistWelderOff(getSettingInMillimetersPerSecond("machine_min_dist_welder_off"));
+                    gcode.setIsWelding(false); //@ initial that welding is on or not
+                }
+            }
+            gcode.writeComment("Generated with Cura_SteamEngine " VERSION);
+            //@ add line_width and layer_height to the gcode output
+            gcode.writeComment("////////////////////////////////////////");
+            std::string tempString;
+            tempString = getSettingString("skin_line_width");
+            gcode.writeComment("Line width: " + tempString + " mm.");
+            tempString = getSettingString("layer_height");
+            gcode.writeComment("Layer height: " + tempString + " mm.");
+            tempString = getSettingString("speed_print");
+            gcode.writeComment("Printing speed: " + tempString + " mm/s");
+            tempString = getSettingString("material_diameter");
+            gcode.writeComment("Material diameter: " + tempString + " mm.");
+
+            double lineWidth = INT2MM(getSettingInMicrons("infill_line_width"));
+            double layerHeight = INT2MM(getSettingInMicrons("layer_height"));
+            double speedPrint = INT2MM(getSettingInMicrons("speed_print"));
+            double expectedMM3PerSec = lineWidth * layerHeight * speedPrint;
+            double materialDiameter = INT2MM(getSettingInMicrons("material_diameter"));
+            double crossSectionalArea = M_PI*(materialDiameter/2.0)*(materialDiameter/2.0);
+            double wireSpeed;
+            double wireMMPerSec;
+            for(int i=1;i<=100;i++){
+                //@ this equation only for Millermatic 190
+                //@ wireMMPerSec = 0.0254 * (0.45*i/100.0+20.5) * i/100.0;
+                wireMMPerSec = (2.216*i)-19;
+                if ((crossSectionalArea*wireMMPerSec) < expectedMM3PerSec){
+                    wireSpeed = i;
+                }
+                else {
+                    break;
+                }
+            }
+            //@ expected material in volume
+            std::ostringstream expVolume;
+            expVolume << expectedMM3PerSec;
+            gcode.writeComment("Expected Material: " + expVolume.str() + " mm3/s.");
+            gcode.writeComment("////////////////////////////////////////");
+            gcode.writeComment("Recommended welder (Millermatic 190) settings");
+            gcode.writeComment("Voltage: 5 volts");
+            if (wireSpeed >=10)
+            {
+                std::ostringstream tempStr;
+                tempStr << (wireSpeed - 2.0) << " - " << (wireSpeed + 2.0);
+                gcode.writeComment("Wire speed: " + tempStr.str());
+            }
+            else
+            {
+                gcode.writeComment("Wire speed: <10 (Cannot be set!)");
+            }
+            gcode.writeComment("////////////////////////////////////////\n");
+
+
+            if (gcode.getFlavor() == GCODE_FLAVOR_BFB)
+            {
+                gcode.writeComment("enable auto-retraction");
+                std::ostringstream tmp;
+                tmp << "M227 S" << (getSettingInMicrons("retraction_amount") * 2560 / 1000) << " P" << (getSettingInMicrons("retraction_amount") * 2560 / 1000);
+                gcode.writeLine(tmp.str().c_str());
+            }
+        }
+        else
+        {
+            gcode.writeFanCommand(0);
+            gcode.resetExtrusionValue();
+            if (!job.interleave) // otherwise writeInterleavedObjects travels between the objects
+            {
+                gcode.setZ(maxObjectHeight + 5000);
+                gcode.writeMove(gcode.getPositionXY(), getSettingInMillimetersPerSecond("speed_travel"), 0);
+                gcode.writeMove(Point(storage.model_min.x, storage.model_min.y), getSettingInMillimetersPerSecond("speed_travel"), 0);
+            }
+        }
+        fileNr++;
+        if (job.interleave)
+        {
+            interleaved_objects.emplace_back();
+        }
+
+        job.layer_count = storage.meshes[0].layers.size();
+        job.spiral_start = getSpiralStart(storage, global_settings, job.layer_count);
+        setPathConfigs(storage, job);
+        if (storage.support.generated)
+        {
+            storage.support.toolpathsPerLayer.assign(storage.support.supportAreasPerLayer.size(), nullptr);
+            // Under a flat overhang the support is the same for many layers, which then share their paths.
+            std::vector<int> support_variants;
+            for(unsigned int layer_nr = 0; layer_nr < storage.support.supportAreasPerLayer.size(); layer_nr++)
+            {
+                support_variants.push_back((layer_nr == 0)? 2 : (layer_nr & 1)); // see generateSupportToolpaths
+            }
+            job.support_sources = findRepeatedSupportLayers(storage.support.supportAreasPerLayer, support_variants);
+            job.next_support_repeat.assign(job.support_sources.size(), 0);
+            std::vector<unsigned int> last_repeat(job.support_sources.size());
+            for(unsigned int layer_nr = 0; layer_nr < job.support_sources.size(); layer_nr++)
+            {
+                unsigned int source = job.support_sources[layer_nr];
+                if (source != layer_nr)
+                {
+                    job.next_support_repeat[last_repeat[source]] = layer_nr;
+                    job.n_repeated_support_layers++;
+                }
+                last_repeat[source] = layer_nr;
+            }
+        }
+        //gcode.writeComment("Layer count: %d", job.layer_count);
+
+        bool has_raft = getSettingAsPlatformAdhesion("adhesion_type") == Adhesion_Raft;
+        if (has_raft)
+        {
+            //printf("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!enter has_raft"); //@ for test.
+            GCodePathConfig raft_base_config(&storage.retraction_config, "SUPPORT");
+            raft_base_config.setSpeed(getSettingInMillimetersPerSecond("raft_base_speed"));
+            raft_base_config.setLineWidth(getSettingInMicrons("raft_base_linewidth"));
+            raft_base_config.setLayerHeight(getSettingInMicrons("raft_base_thickness"));
+            raft_base_config.setFlow(getSettingInPercentage("material_flow"));
+            GCodePathConfig raft_interface_config(&storage.retraction_config, "SUPPORT");
+            raft_interface_config.setSpeed(getSettingInMillimetersPerSecond("raft_base_speed"));
+            raft_interface_config.setLineWidth(getSettingInMicrons("raft_base_linewidth"));
+            raft_interface_config.setLayerHeight(getSettingInMicrons("raft_base_thickness"));
+            raft_interface_config.setFlow(getSettingInPercentage("material_flow"));
+            GCodePathConfig raft_surface_config(&storage.retraction_config, "SUPPORT");
+            raft_surface_config.setSpeed(getSettingInMillimetersPerSecond("raft_base_speed"));
+            raft_surface_config.setLineWidth(getSettingInMicrons("raft_base_linewidth"));
+            raft_surface_config.setLayerHeight(getSettingInMicrons("raft_base_thickness"));
+            raft_surface_config.setFlow(getSettingInPercentage("material_flow"));
+
+            {
+                gcode.writeLayerComment(-3);
+                gcode.writeComment("RAFT");
+                GCodePlanner gcodeLayer(gcode, &storage.retraction_config, getSettingInMillimetersPerSecond("speed_travel"), getSettingInMicrons("retraction_min_travel"));
+                if (getSettingAsIndex("support_extruder_nr") > 0)
                     gcodeLayer.setExtruder(getSettingAsIndex("support_extruder_nr"));
                 gcode.setZ(getSettingInMicrons("raft_base_thickness"));
                 gcodeLayer.addPolygonsByOptimizer(storage.raftOutline, &raft_base_config);
 
-                Polygons raftLines;
-                int offset_from_poly_outline = 0;
-                generateLineInfill(storage.raftOutline, offset_from_poly_outline, raftLines, getSettingInMicrons("raft_base_linewidth"), getSettingInMicrons("raft_line_spacing"), getSettingInPercentage("fill_overlap"), 0);
-                gcodeLayer.addLinesByOptimizer(raftLines, &raft_base_config);
+                Polygons raftLines;
+                int offset_from_poly_outline = 0;
+                generateCachedInfill(Fill_Lines, storage.raftOutline, offset_from_poly_outline, raftLines, getSettingInMicrons("raft_base_linewidth"), getSettingInMicrons("raft_line_spacing"), getSettingInPercentage("fill_overlap"), 0);
+                gcodeLayer.addLinesByOptimizer(raftLines, &raft_base_config);
+
+                gcode.writeFanCommand(getSettingInPercentage("cool_fan_speed_max"));
+                gcodeLayer.writeGCode(false, getSettingInMicrons("raft_base_thickness"));
+            }
+
+            {
+                gcode.writeLayerComment(-2);
+                gcode.writeComment("RAFT");
+                GCodePlanner gcodeLayer(gcode, &storage.retraction_config, getSettingInMillimetersPerSecond("speed_travel"), getSettingInMicrons("retraction_min_travel"));
+                gcode.setZ(getSettingInMicrons("raft_base_thickness") + getSettingInMicrons("raft_interface_thickness"));
+
+                Polygons raftLines;
+                int offset_from_poly_outline = 0;
+                int raft_interface_line_width = getSettingInMicrons("wall_line_width_x"); // getSettingInMicrons("raft_interface_line_width")
+                int raft_interface_line_spacing = getSettingInMicrons("raft_line_spacing"); // getSettingInMicrons("raft_interface_line_spacing")
+                generateCachedInfill(Fill_Lines, storage.raftOutline, offset_from_poly_outline, raftLines, raft_interface_line_width, raft_interface_line_spacing, getSettingInPercentage("fill_overlap"), getSettingAsCount("raft_surface_layers") > 0 ? 45 : 90);
+                gcodeLayer.addLinesByOptimizer(raftLines, &raft_interface_config);
+
+                gcodeLayer.writeGCode(false, getSettingInMicrons("raft_interface_thickness"));
+            }
+
+            for (int raftSurfaceLayer=1; raftSurfaceLayer<=getSettingAsCount("raft_surface_layers"); raftSurfaceLayer++)
+            {
+                gcode.writeLayerComment(-1);
+                gcode.writeComment("RAFT");
+                int raft_surface_thickness = getSettingInMicrons("layer_height"); // getSettingInMicrons("raft_surface_thickness")
+                GCodePlanner gcodeLayer(gcode, &storage.retraction_config, getSettingInMillimetersPerSecond("speed_travel"), getSettingInMicrons("retraction_min_travel"));
+                gcode.setZ(getSettingInMicrons("raft_base_thickness") + getSettingInMicrons("raft_interface_thickness") + raft_surface_thickness*raftSurfaceLayer);
+
+                Polygons raftLines;
+                int offset_from_poly_outline = 0;
+                int raft_surface_line_width = getSettingInMicrons("wall_line_width_0"); // getSettingInMicrons("raft_surface_line_width")
+                int raft_surface_line_spacing = raft_surface_line_width; // getSettingInMicrons("raft_surface_line_spacing")
+                // the surface layers alternate between two directions, so the cache fills all but the first two
+                generateCachedInfill(Fill_Lines, storage.raftOutline, offset_from_poly_outline, raftLines, raft_surface_line_width, raft_surface_line_spacing, getSettingInPercentage("fill_overlap"), (raftSurfaceLayer % 2 == 0)? 0 : 90);
+                gcodeLayer.addLinesByOptimizer(raftLines, &raft_surface_config);
+
+                gcodeLayer.writeGCode(false, getSettingInMicrons("raft_interface_thickness"));
+            }
+        }
+        //@ add vairables for pause time between layers
+        job.pauseTime = INT2MM(getSettingInMicrons("machine_layer_pause_time"));
+        job.pauseIncrease = INT2MM(getSettingInMicrons("machine_layer_pause_increase"));
+        job.pauseGcode = getSettingString("machine_layer_pause_gcode");
+        //@ add variable for move the printer head up at the end of each layer
+        job.upLayerEnd = INT2MM(getSettingInMicrons("machine_up_layer_end"));
+        //@ welder off gcode
+        job.welderOffGCode = getSettingString("machine_welder_off_gcode");
+        //@ boolean layer pause
+        job.layerPause = getSettingBoolean("machine_layer_pause");
+        job.pauseAdaptive = getSettingBoolean("machine_layer_pause_adaptive");
+        job.interpassTime = getSettingInSeconds("machine_interpass_time") * 1000;
+        job.interpassThickness = INT2MM(getSettingInMicrons("machine_interpass_reference_thickness"));
+
+        job.thread_count = getThreadCount(getSettingAsCount("machine_thread_count"));
+        job.lookahead = std::max(1, global_settings.machine_planning_lookahead);
+        if (global_settings.magic_spiralize || global_settings.magic_polygon_mode)
+        {
+            job.lookahead = 1; // planning these changes the path config of the outer wall
+        }
+        // The GUI is sent the polygons of each layer as it is planned, and interleaving records the layers already.
+        job.layer_templates = global_settings.machine_layer_templates && !commandSocket && !job.interleave && !global_settings.magic_polygon_mode;
+        if (job.layer_templates)
+        {
+            job.layer_fingerprints.assign(job.layer_count, 0);
+        }
+        if (planner_point_pools.size() < job.lookahead)
+        {
+            planner_point_pools.resize(job.lookahead);
+        }
+    }
+
+    /*!
+     * Add the stages which write the layers to \p pipeline: generating the infill, skin and support paths of each layer,
+     * writing each layer in order from the calling thread, and freeing the data of a layer once nothing reads it anymore.
+     *
+     * \param slice_job The stages processing the layers, which writing a layer waits for; nullptr when they are processed already
+     */
+    void addGCodeStages(SliceDataStorage& storage, GCodeJob& job, LayerPipeline& pipeline, const SliceDataJob* slice_job)
+    {
+        // The layers are planned a batch at a time, so a batch is written once its first layer is reached.
+        unsigned int export_stage = pipeline.addStage("export", [this, &storage, &job](unsigned int layer_nr)
+        {
+            if (layer_nr == job.batch_end)
+            {
+                writeGCodeBatch(storage, job, layer_nr);
+            }
+        }, true);
+        // Generating the paths of a layer reads the outlines of the layer below it, for the bridges.
+        unsigned int toolpaths_stage = pipeline.addStage("toolpaths", [this, &storage, &job](unsigned int layer_nr)
+        {
+            if (layer_nr >= job.spiral_start || job.global_settings.magic_polygon_mode)
+            {
+                return; // nothing filled
+            }
+            for(SliceMeshStorage& mesh : storage.meshes)
+            {
+                generateLayerToolpaths(job.global_settings, mesh, layer_nr);
+            }
+            if (storage.support.generated && layer_nr < storage.support.toolpathsPerLayer.size() && !storage.support.toolpathsPerLayer[layer_nr])
+            {
+                generateSupportToolpaths(storage, job.global_settings, layer_nr);
+                for(unsigned int repeat = job.next_support_repeat[layer_nr]; repeat != 0; repeat = job.next_support_repeat[repeat])
+                {
+                    storage.support.toolpathsPerLayer[repeat] = storage.support.toolpathsPerLayer[layer_nr];
+                }
+            }
+            if (job.layer_templates && isTemplateLayer(job.global_settings, layer_nr))
+            {
+                // the path configs go by the layer thickness, and the wipe tower alternates between the layers
+                int64_t variant = getLayerThickness(storage, job.global_settings, layer_nr) * int64_t(2) + ((job.global_settings.wipe_tower_size >= 1)? layer_nr % 2 : 0);
+                job.layer_fingerprints[layer_nr] = std::max(uint64_t(1), hashLayerToolpaths(storage, layer_nr, variant));
+            }
+        });
+        if (job.support_sources.size() > 0)
+        {
+            // A layer repeating the support of an earlier layer gets its paths from there.
+            pipeline.addDependency(toolpaths_stage, toolpaths_stage, [&job](unsigned int layer_nr, std::vector<unsigned int>& required_layers)
+            {
+                if (layer_nr < job.support_sources.size())
+                {
+                    required_layers.push_back(job.support_sources[layer_nr]);
+                }
+            });
+        }
+        unsigned int toolpaths_account_stage = pipeline.addStage("account toolpaths", [this, &storage, &job](unsigned int layer_nr)
+        {
+            MemoryUsage generated;
+            for(SliceMeshStorage& mesh : storage.meshes)
+            {
+                addMemoryUsage(mesh.layers[layer_nr], generated);
+            }
+            size_t toolpaths_memory = generated.get(Memory_Toolpaths);
+            bool shared_support = layer_nr < job.support_sources.size() && job.support_sources[layer_nr] != layer_nr; // counted once
+            if (layer_nr < storage.support.toolpathsPerLayer.size() && storage.support.toolpathsPerLayer[layer_nr] && !shared_support)
+            {
+                toolpaths_memory += getMemoryUsage(*storage.support.toolpathsPerLayer[layer_nr]);
+            }
+            memory_usage.add(Memory_Toolpaths, toolpaths_memory);
+        }, true);
+        pipeline.addDependency(toolpaths_account_stage, toolpaths_stage, 0, 0);
+        // with layer templates, writing a layer looks at whether the next layer repeats it
+        pipeline.addDependency(export_stage, toolpaths_account_stage, 0, job.lookahead - (job.layer_templates? 0 : 1));
+
+        bool slice_stages = slice_job && slice_job->done_stage >= 0;
+        if (slice_stages)
+        {
+            pipeline.addDependency(toolpaths_stage, slice_job->done_stage, 1, 0);
+            pipeline.addDependency(export_stage, slice_job->done_stage, 0, job.lookahead - 1);
+        }
+        else if (storage.spill || storage.compact_layers || storage.checkpoint)
+        {
+            // The processed layers are packed away, or still in the checkpoint; planning a batch reads its layers and the layer below it.
+            unsigned int load_stage = pipeline.addStage("unpack layer", [this, &storage, &job](unsigned int layer_nr)
+            {
+                for(unsigned int mesh_idx = 0; mesh_idx < storage.meshes.size(); mesh_idx++)
+                {
+                    SliceLayer& layer = storage.meshes[mesh_idx].layers[layer_nr];
+                    if (unpackLayer(storage, mesh_idx, layer_nr) && job.global_settings.retraction_combing && layer_nr < job.spiral_start)
+                    {
+                        for(SliceLayerPart& part : layer.parts)
+                        {
+                            part.comb = std::make_shared<Comb>(part.combBoundery);
+                            part.comb->prepare();
+                        }
+                    }
+                }
+            });
+            unsigned int account_stage = pipeline.addStage("account layer", [this, &storage](unsigned int layer_nr)
+            {
+                MemoryUsage loaded;
+                for(SliceMeshStorage& mesh : storage.meshes)
+                {
+                    addMemoryUsage(mesh.layers[layer_nr], loaded);
+                }
+                for (MemoryCategory category : { Memory_Outlines, Memory_Insets, Memory_Skins, Memory_Infill, Memory_Combs })
+                {
+                    memory_usage.add(category, loaded.get(category));
+                }
+            }, true);
+            pipeline.addDependency(account_stage, load_stage, 0, 0);
+            pipeline.addDependency(toolpaths_stage, account_stage, 1, 0);
+            pipeline.addDependency(export_stage, account_stage, 1, job.lookahead - 1);
+        }
+
+        // Planning a layer reads the layer below it, and generating the skins reads the outlines and insets of the layers around it.
+        unsigned int retire_stage = pipeline.addStage("retire layer", [this, &storage](unsigned int layer_nr)
+        {
+            retireLayer(storage, layer_nr);
+        }, true);
+        pipeline.addDependency(retire_stage, export_stage, 0, 1);
+        if (slice_stages)
+        {
+            pipeline.addDependency(retire_stage, slice_job->skins_stage, slice_job->skin_layers_above, slice_job->skin_layers_below);
+        }
+    }
 
-                gcode.writeFanCommand(getSettingInPercentage("cool_fan_speed_max"));
-                gcodeLayer.writeGCode(false, getSettingInMicrons("raft_base_thickness"));
+    /*!
+     * Plan the layers of the batch starting at \p batch_start and write them.
+     *
+     * Planning a layer only depends on the layers before it through the position and extruder it starts with. With a
+     * lookahead, the layers are planned a batch at a time in parallel and then written in order. The first layer of a
+     * batch starts where the previous batch ended, so it is planned exactly as when planning serially; each other layer is
+     * planned from where the layer at the same place in the previous batch ended, as layers close together tend to end
+     * close together. Each layer is planned with the path configs of its kind of layer, which are only read meanwhile.
+     * The layers of a batch are also formatted in parallel into GCodeBuffers, which are then replayed onto the export in order.
+     */
+    void writeGCodeBatch(SliceDataStorage& storage, GCodeJob& job, unsigned int batch_start)
+    {
+        const SettingsSnapshot& global_settings = job.global_settings;
+        unsigned int totalLayers = job.layer_count;
+        std::vector<std::unique_ptr<GCodePlanner>>& planners = job.planners;
+        std::vector<int>& fan_speeds = job.fan_speeds;
+        std::vector<Point>& batch_end_positions = job.batch_end_positions;
+        unsigned int batch_end = std::min(totalLayers, batch_start + ((batch_start >= job.first_batch_layer)? job.lookahead : 1));
+        job.batch_end = batch_end;
+        bool spiral = batch_start >= job.spiral_start; // the lookahead is 1 when spiralizing, so this is the whole batch
+        unsigned int planned_end = spiral? batch_start : batch_end;
+        gcode.resetStartPosition(); // as it is at the start of each layer while planning serially
+
+        planners.clear();
+        for(unsigned int layer_nr = batch_start; layer_nr < planned_end; layer_nr++)
+        {
+            planners.emplace_back(new GCodePlanner(gcode, &storage.retraction_config, global_settings.speed_travel, global_settings.retraction_min_travel, &planner_point_pools[layer_nr - batch_start]));
+            GCodePlanner& gcodeLayer = *planners.back();
+            gcodeLayer.setTravelRefinementTime(global_settings.machine_travel_refinement_time / 1000.0);
+            gcodeLayer.setArcTolerance(global_settings.machine_arc_tolerance);
+            gcodeLayer.setMergeTolerance(global_settings.machine_merge_tolerance);
+            if (global_settings.machine_metal_printing)
+            {
+                gcodeLayer.setWelderCycleCost(global_settings.machine_min_dist_welder_off, global_settings.machine_welder_cycle_cost);
+            }
+            if (layer_nr > batch_start)
+            {
+                if (layer_nr - batch_start < batch_end_positions.size())
+                {
+                    gcodeLayer.setStartPosition(batch_end_positions[layer_nr - batch_start]);
+                }
+                gcodeLayer.forceRetract(); // the head won't start exactly where this layer is planned from, so don't comb the first travel
+            }
+        }
+        fan_speeds.resize(batch_end - batch_start);
+        batch_end_positions.resize(batch_end - batch_start);
+        if (gcode_buffers.size() < batch_end - batch_start)
+        {
+            gcode_buffers.resize(batch_end - batch_start);
+        }
+        // A layer repeating the layer before it is written from the GCode of that layer, so it isn't planned unless that fails.
+        std::vector<char> repeats(planned_end - batch_start, false);
+        for(unsigned int layer_nr = batch_start; layer_nr < planned_end && job.layer_templates; layer_nr++)
+        {
+            uint64_t fingerprint = job.layer_fingerprints[layer_nr];
+            repeats[layer_nr - batch_start] = fingerprint != 0 && ((layer_nr == batch_start)? canWriteLayerTemplate(storage, job, layer_nr) : fingerprint == job.layer_fingerprints[layer_nr - 1]);
+        }
+        parallelFor(planned_end - batch_start, job.thread_count, [&](unsigned int batch_idx)
+        {
+            if (repeats[batch_idx])
+            {
+                return;
+            }
+            unsigned int layer_nr = batch_start + batch_idx;
+            GCodePlanner& gcodeLayer = *planners[batch_idx];
+            fan_speeds[batch_idx] = planLayer(storage, global_settings, job.path_configs[job.layer_path_configs[layer_nr]], gcodeLayer, layer_nr);
+            if (batch_end - batch_start > 1)
+            {
+                // format the layer here too, on a copy of the export in the state in which this layer is planned
+                GCodeExport recorder(gcode);
+                recorder.setZ(storage.meshes[0].layers[layer_nr].printZ);
+                recorder.startRecording(&gcode_buffers[batch_idx], Point3(gcodeLayer.getStartPosition().X, gcodeLayer.getStartPosition().Y, gcode.getPositionZ()));
+                gcodeLayer.writeGCode(recorder, global_settings.cool_lift_head, getLayerGCodeThickness(storage, global_settings, layer_nr));
+                recorder.stopRecording();
             }
+        });
+        size_t paths_memory = 0;
+        for(std::unique_ptr<GCodePlanner>& planner : planners)
+            paths_memory += planner->getMemoryUsage();
+        for(GCodeBuffer& buffer : gcode_buffers)
+            paths_memory += buffer.getMemoryUsage();
+        paths_memory += job.layer_template.getMemoryUsage();
+        memory_usage.set(Memory_Paths, paths_memory);
+        memory_usage.set(Memory_TimeEstimate, gcode.getEstimateMemoryUsage());
+        memory_usage.set(Memory_InfillCache, infill_cache.getMemoryUsed());
+        checkMemory("export", false); // stops the pipeline when over the limit
+
+        for(unsigned int layer_nr = batch_start; layer_nr < batch_end; layer_nr++)
+        {
+            TRACE_ZONE("write layer", layer_nr);
+            StatsScope stats_scope(getStatsContext().stage, layer_nr);
+            logProgress("export", layer_nr+1, totalLayers);
+            sendProgress(job.progress_start + (1.0 - job.progress_start) * float(layer_nr) / float(totalLayers));
 
+            InterleavedLayer* interleaved_layer = nullptr;
+            if (job.interleave)
             {
-                gcode.writeLayerComment(-2);
-                gcode.writeComment("RAFT");
-                GCodePlanner gcodeLayer(gcode, &storage.retraction_config, getSettingInMillimetersPerSecond("speed_travel"), getSettingInMicrons("retraction_min_travel"));
-                gcode.setZ(getSettingInMicrons("raft_base_thickness") + getSettingInMicrons("raft_interface_thickness"));
+                interleaved_objects.back().emplace_back();
+                interleaved_layer = &interleaved_objects.back().back();
+                interleaved_layer->z = storage.meshes[0].layers[layer_nr].printZ;
+                interleaved_layer->area = getLayerOutlineArea(storage, layer_nr);
+                gcode.startRecording(&interleaved_layer->gcode, gcode.getPosition());
+            }
+            //@ start layer
+            gcode.writeLayerComment(layer_nr);
+            int layer_welder_starts = gcode.getWelderStartCount();
+            double layer_start_time = gcode.getTotalPrintTime();
+            double layer_start_volume = getTotalDepositedVolume();
 
-                Polygons raftLines;
-                int offset_from_poly_outline = 0;
-                int raft_interface_line_width = getSettingInMicrons("wall_line_width_x"); // getSettingInMicrons("raft_interface_line_width")
-                int raft_interface_line_spacing = getSettingInMicrons("raft_line_spacing"); // getSettingInMicrons("raft_interface_line_spacing")
-                generateLineInfill(storage.raftOutline, offset_from_poly_outline, raftLines, raft_interface_line_width, raft_interface_line_spacing, getSettingInPercentage("fill_overlap"), getSettingAsCount("raft_surface_layers") > 0 ? 45 : 90);
-                gcodeLayer.addLinesByOptimizer(raftLines, &raft_interface_config);
+            int z = storage.meshes[0].layers[layer_nr].printZ;
 
-                gcodeLayer.writeGCode(false, getSettingInMicrons("raft_interface_thickness"));
+            gcode.setZ(z);
+            gcode.resetStartPosition();
+
+            if (spiral)
+            {
+                writeSpiralLayer(storage, global_settings, job.path_configs[job.layer_path_configs[layer_nr]], layer_nr);
+            }
+            else if (canWriteLayerTemplate(storage, job, layer_nr))
+            {
+                gcode.writeFanCommand(job.template_fan_speed);
+                gcode.replay(job.layer_template, z - job.template_z);
+                job.n_template_layers++;
+            }
+            else
+            {
+                GCodePlanner& gcodeLayer = *planners[layer_nr - batch_start];
+                bool buffered = batch_end - batch_start > 1;
+                if (repeats[layer_nr - batch_start])
+                {
+                    // the layer it repeats ended elsewhere than where the layer before that did
+                    gcodeLayer.setStartPosition(gcode.getPositionXY());
+                    fan_speeds[layer_nr - batch_start] = planLayer(storage, global_settings, job.path_configs[job.layer_path_configs[layer_nr]], gcodeLayer, layer_nr);
+                    buffered = false;
+                }
+                gcode.writeFanCommand(fan_speeds[layer_nr - batch_start]);
+                job.travel_refinement_saved += gcodeLayer.getTravelRefinementSaved();
+                uint64_t fingerprint = job.layer_templates? job.layer_fingerprints[layer_nr] : 0;
+                bool record_template = fingerprint != 0 && layer_nr + 1 < totalLayers && job.layer_fingerprints[layer_nr + 1] == fingerprint;
+                if (record_template)
+                {
+                    // keep the GCode of the layer for the layers repeating it, recorded on a copy of the export as for a batch
+                    GCodeExport recorder(gcode);
+                    recorder.startRecording(&job.layer_template, gcode.getPosition());
+                    gcodeLayer.writeGCode(recorder, global_settings.cool_lift_head, getLayerGCodeThickness(storage, global_settings, layer_nr));
+                    recorder.stopRecording();
+                    job.template_fingerprint = fingerprint;
+                    job.template_z = z;
+                    job.template_fan_speed = fan_speeds[layer_nr - batch_start];
+                    job.template_start = gcode.getPositionXY();
+                    gcode.replay(job.layer_template);
+                }
+                //@ start write GCode for each layer
+                else if (!buffered || !gcode.replay(gcode_buffers[layer_nr - batch_start]))
+                {
+                    gcodeLayer.writeGCode(global_settings.cool_lift_head, getLayerGCodeThickness(storage, global_settings, layer_nr));
+                }
+                job.moves_merged += gcodeLayer.getMovesMerged();
+                job.moves_planned += gcodeLayer.getMovesPlanned();
+            }
+            batch_end_positions[layer_nr - batch_start] = gcode.getPositionXY();
+            if (interleaved_layer)
+            {
+                gcode.stopRecording();
+                interleaved_layer->gcode.keepRetractionConfigs(); // the configs of the storage are gone when it is written
             }
+            else if (global_settings.machine_metal_printing)
+            {
+                log("Layer %d: %d arc cycles\n", layer_nr, gcode.getWelderStartCount() - layer_welder_starts);
+            }
+            if (commandSocket)
+                commandSocket->sendGCodeLayer();
+            //@ add pause to each layer
+            if (job.layerPause && !interleaved_layer){ // writeInterleavedObjects pauses between interleaved layers
+                gcode.setFeature("PAUSE");
+                writeWelderOffAndLift(job.welderOffGCode, INT2MM(gcode.getPositionZ()) + job.upLayerEnd);
+                //@ pause the pringting
+                std::string tempGcode;
+                double tempPauseTime;
+                std::ostringstream temp;
+                tempPauseTime = job.pauseTime + (job.pauseTime*(job.pauseIncrease/100)*layer_nr);
+                if (job.pauseAdaptive)
+                {
+                    gcode.updateTotalPrintTime();
+                    double dwell = getInterlayerDwell(storage, job, layer_nr, (gcode.getTotalPrintTime() - layer_start_time) * 1000, getTotalDepositedVolume() - layer_start_volume);
+                    job.pauseSaved += tempPauseTime - dwell;
+                    tempPauseTime = dwell;
+                }
+                job.pauseTotal += tempPauseTime;
+                if (!job.pauseAdaptive || (int)tempPauseTime > 0)
+                {
+                    temp << (int)tempPauseTime << "\n";
+                    tempGcode = job.pauseGcode + temp.str();
 
-            for (int raftSurfaceLayer=1; raftSurfaceLayer<=getSettingAsCount("raft_surface_layers"); raftSurfaceLayer++)
+                    gcode.writeCode(tempGcode.c_str());
+                }
+            }
+        }
+        planners.clear(); // the paths of the batch are written
+        if (commandSocket)
+            commandSocket->sendLayersUpTo(batch_end - 1); // all polygons of the layers of this batch have been sent, so they can be shown
+    }
+
+    /*!
+     * Free the data of a layer which is written, keeping only its height.
+     */
+    void retireLayer(SliceDataStorage& storage, unsigned int layer_nr)
+    {
+        MemoryUsage freed;
+        for(SliceMeshStorage& mesh : storage.meshes)
+        {
+            SliceLayer& layer = mesh.layers[layer_nr];
+            addMemoryUsage(layer, freed);
+            std::vector<SliceLayerPart>().swap(layer.parts);
+            layer.openLines = Polygons();
+            std::vector<unsigned char>().swap(layer.compact);
+        }
+        if (layer_nr < storage.support.supportAreasPerLayer.size())
+        {
+            freed.add(Memory_Support, storage.support.supportAreasPerLayer[layer_nr].getMemoryUsage());
+            storage.support.supportAreasPerLayer[layer_nr] = Polygons();
+        }
+        if (layer_nr < storage.support.toolpathsPerLayer.size() && storage.support.toolpathsPerLayer[layer_nr])
+        {
+            if (storage.support.toolpathsPerLayer[layer_nr].use_count() == 1)
             {
-                gcode.writeLayerComment(-1);
-                gcode.writeComment("RAFT");
-                int raft_surface_thickness = getSettingInMicrons("layer_height"); // getSettingInMicrons("raft_surface_thickness")
-                GCodePlanner gcodeLayer(gcode, &storage.retraction_config, getSettingInMillimetersPerSecond("speed_travel"), getSettingInMicrons("retraction_min_travel"));
-                gcode.setZ(getSettingInMicrons("raft_base_thickness") + getSettingInMicrons("raft_interface_thickness") + raft_surface_thickness*raftSurfaceLayer);
+                freed.add(Memory_Toolpaths, getMemoryUsage(*storage.support.toolpathsPerLayer[layer_nr])); // no other layer shares them anymore
+            }
+            storage.support.toolpathsPerLayer[layer_nr] = nullptr;
+        }
+        if (layer_nr < storage.oozeShield.size())
+        {
+            freed.add(Memory_Support, storage.oozeShield[layer_nr].getMemoryUsage());
+            storage.oozeShield[layer_nr] = Polygons();
+        }
+        releaseMemoryUsage(freed);
+    }
 
-                Polygons raftLines;
-                int offset_from_poly_outline = 0;
-                int raft_surface_line_width = getSettingInMicrons("wall_line_width_0"); // getSettingInMicrons("raft_surface_line_width")
-                int raft_surface_line_spacing = raft_surface_line_width; // getSettingInMicrons("raft_surface_line_spacing")
-                generateLineInfill(storage.raftOutline, offset_from_poly_outline, raftLines, raft_surface_line_width, raft_surface_line_spacing, getSettingInPercentage("fill_overlap"), (raftSurfaceLayer % 2 == 0)? 0 : 90);
-                gcodeLayer.addLinesByOptimizer(raftLines, &raft_surface_config);
+    /*!
+     * Put a layer of a mesh out of the way while it isn't worked on: into the scratch file when spilling, or else into its
+     * compact encoding when compacting the layers.
+     */
+    void packLayer(SliceDataStorage& storage, unsigned int mesh_idx, unsigned int layer_nr)
+    {
+        SliceLayer& layer = storage.meshes[mesh_idx].layers[layer_nr];
+        if (storage.spill)
+        {
+            storage.spill->spill(mesh_idx, layer_nr, layer);
+        }
+        else if (storage.compact_layers)
+        {
+            freezeLayer(layer);
+        }
+    }
 
-                gcodeLayer.writeGCode(false, getSettingInMicrons("raft_interface_thickness"));
+    /*!
+     * Get a layer of a mesh back which packLayer put out of the way, or read it from the checkpoint the storage was loaded from.
+     *
+     * \return Whether the layer was packed
+     */
+    bool unpackLayer(SliceDataStorage& storage, unsigned int mesh_idx, unsigned int layer_nr)
+    {
+        SliceLayer& layer = storage.meshes[mesh_idx].layers[layer_nr];
+        if (thawLayer(layer))
+        {
+            return true;
+        }
+        if (storage.checkpoint)
+        {
+            return storage.checkpoint->loadLayer(mesh_idx, layer_nr, layer);
+        }
+        return storage.spill && storage.spill->load(mesh_idx, layer_nr, layer);
+    }
+
+    /*!
+     * Pack the layers of all meshes at \p layer_nr once they are processed.
+     */
+    void packLayers(SliceDataStorage& storage, unsigned int layer_nr)
+    {
+        MemoryUsage unpacked;
+        MemoryUsage packed;
+        for(unsigned int mesh_idx = 0; mesh_idx < storage.meshes.size(); mesh_idx++)
+        {
+            addMemoryUsage(storage.meshes[mesh_idx].layers[layer_nr], unpacked);
+            packLayer(storage, mesh_idx, layer_nr);
+            addMemoryUsage(storage.meshes[mesh_idx].layers[layer_nr], packed);
+        }
+        releaseMemoryUsage(unpacked);
+        memory_usage.add(Memory_Outlines, packed.get(Memory_Outlines)); // the layers which couldn't be spilled
+        memory_usage.add(Memory_Frozen, packed.get(Memory_Frozen));
+    }
+
+    /*!
+     * Take the memory of data which is freed off the memory used by the model.
+     */
+    void releaseMemoryUsage(const MemoryUsage& freed)
+    {
+        for (MemoryCategory category : { Memory_Outlines, Memory_Insets, Memory_Skins, Memory_Infill, Memory_Combs, Memory_Frozen, Memory_Support, Memory_Toolpaths })
+        {
+            memory_usage.set(category, memory_usage.get(category) - std::min(memory_usage.get(category), freed.get(category)));
+        }
+    }
+
+    /*!
+     * Write everything after the last layer, or discard the job when it was cancelled.
+     *
+     * \param completed Whether all layers were written
+     * \return Whether the job is completed
+     */
+    bool endGCode(SliceDataStorage& storage, GCodeJob& job, bool completed)
+    {
+        TRACE_ZONE("export");
+        StatsScope stats_scope("export");
+        const SettingsSnapshot& global_settings = job.global_settings;
+        if (!completed)
+        {
+            if (commandSocket)
+            {
+                // End the job as a completed one would, but into nowhere, so the next job starts from the same state of the export.
+                std::ostringstream discarded;
+                gcode.setOutputStream(&discarded);
+                gcode.writeRetraction(&storage.retraction_config, true);
+                gcode.writeFanCommand(0);
+                maxObjectHeight = std::max(maxObjectHeight, storage.model_max.z);
+                finalize();
+                commandSocket->beginGCode();
+            }
+            return false;
+        }
+        gcode.writeRetraction(&storage.retraction_config, true);
+
+        log("Wrote layers in %5.2fs.\n", timeKeeper.restart());
+        if (!checkMemory("export"))
+            return false;
+        log("Took the infill of %d of %d areas from the infill cache\n", infill_cache.getHitCount() - job.infill_cache_hits, infill_cache.getHitCount() - job.infill_cache_hits + infill_cache.getMissCount() - job.infill_cache_misses);
+        if (job.n_repeated_support_layers > 0)
+        {
+            log("Shared the support paths of %d layers with an earlier layer\n", job.n_repeated_support_layers);
+        }
+        if (global_settings.machine_travel_refinement_time > 0)
+        {
+            log("Saved %.1fmm of travel by refining the path order\n", INT2MM(job.travel_refinement_saved));
+        }
+        if (job.n_template_layers > 0)
+        {
+            log("Wrote %u layers from the GCode of the identical layer before them\n", job.n_template_layers);
+        }
+        if (global_settings.machine_merge_tolerance > 0 && job.moves_planned > 0)
+        {
+            log("Merged away %llu of %llu moves (%.1f%%)\n", (unsigned long long)job.moves_merged, (unsigned long long)job.moves_planned, 100.0 * job.moves_merged / job.moves_planned);
+        }
+        if (global_settings.machine_metal_printing)
+        {
+            log("%d arc cycles in total\n", gcode.getWelderStartCount() - job.welder_starts);
+        }
+        if (job.layerPause && !job.interleave)
+        {
+            log("Paused %.0fs between layers\n", job.pauseTotal / 1000);
+            if (job.pauseAdaptive)
+            {
+                log("Saved %.0fs of pauses by dwelling only as long as the layers need to cool\n", job.pauseSaved / 1000);
+            }
+        }
+        gcode.writeFanCommand(0);
+
+        //Store the object height for when we are printing multiple objects, as we need to clear every one of them when moving to the next position.
+        maxObjectHeight = std::max(maxObjectHeight, storage.model_max.z);
+
+        if (commandSocket)
+        {
+            finalize();
+            commandSocket->sendGCodeLayer();
+            commandSocket->endSendSlicedObject();
+            if (gcode.getFlavor() == GCODE_FLAVOR_ULTIGCODE)
+            {
+                std::ostringstream prefix;
+                prefix << ";FLAVOR:UltiGCode\n";
+                prefix << ";TIME:" << int(gcode.getTotalPrintTime()) << "\n";
+                prefix << ";MATERIAL:" << int(gcode.getTotalFilamentUsed(0)) << "\n";
+                prefix << ";MATERIAL2:" << int(gcode.getTotalFilamentUsed(1)) << "\n";
+                commandSocket->sendGCodePrefix(prefix.str());
+            }
+        }
+        return true;
+    }
+
+    /*!
+     * Set the path configs of each kind of layer of a job and which of them each layer is planned with.
+     */
+    void setPathConfigs(SliceDataStorage& storage, GCodeJob& job)
+    {
+        const SettingsSnapshot& global_settings = job.global_settings;
+        std::map<std::pair<int, int>, unsigned int> kinds; // by the number of a slowed down layer, or -1, and the layer thickness
+        job.path_configs.clear();
+        job.layer_path_configs.resize(job.layer_count);
+        for(unsigned int layer_nr = 0; layer_nr < job.layer_count; layer_nr++)
+        {
+            int slowdown_layer_nr = (static_cast<int>(layer_nr) < global_settings.speed_slowdown_layers)? layer_nr : -1;
+            std::pair<int, int> kind(slowdown_layer_nr, getLayerThickness(storage, global_settings, layer_nr));
+            std::map<std::pair<int, int>, unsigned int>::iterator found = kinds.find(kind);
+            if (found == kinds.end())
+            {
+                found = kinds.emplace(kind, job.path_configs.size()).first;
+                job.path_configs.emplace_back(storage);
+                setLayerPathConfigs(job.path_configs.back(), storage, global_settings, layer_nr);
+            }
+            job.layer_path_configs[layer_nr] = found->second;
+        }
+    }
+
+    /*!
+     * Set the line widths, speeds, flows and layer heights of the path configs of all meshes, the skirt and the support
+     * for a layer.
+     */
+    void setLayerPathConfigs(LayerPathConfigs& configs, SliceDataStorage& storage, const SettingsSnapshot& global_settings, unsigned int layer_nr)
+    {
+        int layer_thickness = getLayerThickness(storage, global_settings, layer_nr);
+
+        configs.skirt_config.setSpeed(global_settings.skirt_speed);
+        configs.skirt_config.setLineWidth(global_settings.skirt_line_width);
+        configs.skirt_config.setFlow(global_settings.material_flow);
+        configs.skirt_config.setLayerHeight(layer_thickness);
+
+        configs.support_config.setLineWidth(global_settings.support_line_width);
+        configs.support_config.setSpeed(global_settings.speed_support);
+        configs.support_config.setFlow(global_settings.material_flow);
+        configs.support_config.setLayerHeight(layer_thickness);
+        for(unsigned int mesh_idx = 0; mesh_idx < storage.meshes.size(); mesh_idx++)
+        {
+            const SettingsSnapshot& mesh_settings = *storage.meshes[mesh_idx].settings_snapshot;
+            MeshPathConfigs& mesh_configs = configs.meshes[mesh_idx];
+            mesh_configs.inset0_config.setLineWidth(mesh_settings.wall_line_width_0);
+            mesh_configs.inset0_config.setSpeed(mesh_settings.speed_wall_0);
+            mesh_configs.inset0_config.setFlow(mesh_settings.material_flow);
+            mesh_configs.inset0_config.setLayerHeight(layer_thickness);
+
+            mesh_configs.insetX_config.setLineWidth(mesh_settings.wall_line_width_x);
+            mesh_configs.insetX_config.setSpeed(mesh_settings.speed_wall_x);
+            mesh_configs.insetX_config.setFlow(mesh_settings.material_flow);
+            mesh_configs.insetX_config.setLayerHeight(layer_thickness);
+
+            mesh_configs.skin_config.setLineWidth(mesh_settings.skin_line_width);
+            mesh_configs.skin_config.setSpeed(mesh_settings.speed_topbottom);
+            mesh_configs.skin_config.setFlow(mesh_settings.material_flow);
+            mesh_configs.skin_config.setLayerHeight(layer_thickness);
+
+            for(unsigned int idx=0; idx<MAX_SPARSE_COMBINE; idx++)
+            {
+                mesh_configs.infill_config[idx].setLineWidth(mesh_settings.infill_line_width * (idx + 1));
+                mesh_configs.infill_config[idx].setSpeed(mesh_settings.speed_infill);
+                mesh_configs.infill_config[idx].setFlow(mesh_settings.material_flow);
+                mesh_configs.infill_config[idx].setLayerHeight(layer_thickness);
+            }
+        }
+
+        int initial_speedup_layers = global_settings.speed_slowdown_layers;
+        if (static_cast<int>(layer_nr) < initial_speedup_layers)
+        {
+            int initial_layer_speed = global_settings.speed_layer_0;
+            configs.support_config.smoothSpeed(initial_layer_speed, layer_nr, initial_speedup_layers);
+            for(MeshPathConfigs& mesh_configs : configs.meshes)
+            {
+                mesh_configs.inset0_config.smoothSpeed(initial_layer_speed, layer_nr, initial_speedup_layers);
+                mesh_configs.insetX_config.smoothSpeed(initial_layer_speed, layer_nr, initial_speedup_layers);
+                mesh_configs.skin_config.smoothSpeed(initial_layer_speed, layer_nr, initial_speedup_layers);
+                for(unsigned int idx=0; idx<MAX_SPARSE_COMBINE; idx++)
+                {
+                    mesh_configs.infill_config[idx].smoothSpeed(initial_layer_speed, layer_nr, initial_speedup_layers);
+                }
+            }
+        }
+        for(MeshPathConfigs& mesh_configs : configs.meshes)
+        {
+            mesh_configs.inset0_spiralize_config = mesh_configs.inset0_config;
+            mesh_configs.inset0_spiralize_config.spiralize = true;
+        }
+    }
+
+    /*!
+     * The time to pause after a layer, so that the next layer starts once this one has cooled to the interpass
+     * temperature.
+     *
+     * The heat a layer puts in goes with the volume it deposits, and it cools through the area of its outlines, so by a
+     * lumped model the time the layer needs to cool goes with the volume per area. A layer depositing
+     * GCodeJob::interpassThickness of volume per area needs GCodeJob::interpassTime from its start to the start of the
+     * next layer. Welding the layer itself takes part of that time, so long layers need little or no pause.
+     *
+     * \param layer_time The time the layer took to weld, in ms, by the print time estimate
+     * \param layer_volume The volume the layer deposited, in mm^3
+     * \return The pause, in ms
+     */
+    double getInterlayerDwell(SliceDataStorage& storage, const GCodeJob& job, unsigned int layer_nr, double layer_time, double layer_volume)
+    {
+        double interpass_time = getInterpassTime(getLayerOutlineArea(storage, layer_nr), layer_volume, job.interpassTime, job.interpassThickness);
+        return std::max(0.0, interpass_time - layer_time);
+    }
+
+    /*!
+     * The time from the start of a layer to the start of the next which the layer needs to cool, see getInterlayerDwell.
+     *
+     * \param area The area of the outlines of the layer, in mm^2
+     * \param volume The volume the layer deposited, in mm^3
+     * \param interpass_time The time a reference layer needs, in ms
+     * \param interpass_thickness The volume per area of the outlines the reference layer deposits, in mm
+     * \return The time, in ms
+     */
+    static double getInterpassTime(double area, double volume, double interpass_time, double interpass_thickness)
+    {
+        if (area <= 0 || interpass_thickness <= 0)
+        {
+            return 0;
+        }
+        return interpass_time * (volume / area) / interpass_thickness;
+    }
+
+    /*!
+     * The area of the outlines of a layer of all meshes, in mm^2.
+     */
+    double getLayerOutlineArea(SliceDataStorage& storage, unsigned int layer_nr)
+    {
+        double area = 0;
+        for(SliceMeshStorage& mesh : storage.meshes)
+        {
+            for(SliceLayerPart& part : mesh.layers[layer_nr].parts)
+            {
+                for(unsigned int poly_idx = 0; poly_idx < part.outline.size(); poly_idx++)
+                {
+                    area += part.outline[poly_idx].area() / 1e6;
+                }
+            }
+        }
+        return area;
+    }
+
+    /*!
+     * Turn the welder off and move the head straight up.
+     *
+     * \param up_z The height to move the head to, in mm
+     */
+    void writeWelderOffAndLift(const std::string& welder_off_gcode, double up_z)
+    {
+        //@ turn off the welder
+        gcode.writeCode(welder_off_gcode.c_str());
+        //@ set that the welder is off
+        gcode.setIsWelding(false);
+        //@ move printer head up in mm unit
+        std::ostringstream tempUp;
+        tempUp << std::fixed << std::setprecision(3) << ";Move print head up\nG0 Z" << up_z << "\n";
+        gcode.writeCode(tempUp.str().c_str());
+    }
+
+    /*!
+     * Write the layers of the objects kept in interleaved_objects, welding the layers of one object while the others
+     * cool.
+     *
+     * When printing objects one after the other, each layer has to cool to the interpass temperature before the next
+     * one, which on small objects means pausing for most of the print. Here the head instead stays on an object for
+     * machine_interleave_band_layers layers and then moves on to the lowest of the other objects of which the last
+     * layer has cooled, by the same model as getInterlayerDwell. It only pauses when none of the objects has cooled,
+     * until the first one has. Between the objects the head goes up to machine_interleave_clearance above the highest
+     * layer welded so far.
+     */
+    void writeInterleavedObjects()
+    {
+        if (interleaved_objects.empty())
+        {
+            return;
+        }
+        unsigned int object_count = interleaved_objects.size();
+        unsigned int band_layers = std::max(1, getSettingAsCount("machine_interleave_band_layers"));
+        int clearance = getSettingInMicrons("machine_interleave_clearance");
+        int speed_travel = getSettingInMillimetersPerSecond("speed_travel");
+        double interpass_time = getSettingInSeconds("machine_interpass_time") * 1000;
+        double interpass_thickness = INT2MM(getSettingInMicrons("machine_interpass_reference_thickness"));
+        bool layer_pause = getSettingBoolean("machine_layer_pause");
+        std::string pause_gcode = getSettingString("machine_layer_pause_gcode");
+        std::string welder_off_gcode = getSettingString("machine_welder_off_gcode");
+        double up_layer_end = INT2MM(getSettingInMicrons("machine_up_layer_end"));
+
+        std::vector<unsigned int> next_layer(object_count, 0);
+        std::vector<double> ready_time(object_count, 0); // when the last layer written of each object has cooled, in ms
+        auto isReady = [&](unsigned int object_idx, double clock)
+        {
+            return next_layer[object_idx] < interleaved_objects[object_idx].size() && ready_time[object_idx] <= clock;
+        };
+        double clock = 0; // the time since the first interleaved layer started, in ms
+        double pause_total = 0;
+        int top = 0; // the highest layer welded so far
+        unsigned int switch_count = 0;
+        int welder_starts = gcode.getWelderStartCount();
+        unsigned int current = object_count; // the object being welded
+        unsigned int band = 0; // the layers welded on it since the head moved there
+        gcode.updateTotalPrintTime();
+        while (true)
+        {
+            unsigned int next = object_count;
+            if (current < object_count && band < band_layers && isReady(current, clock))
+            {
+                next = current;
+            }
+            else
+            {
+                for (unsigned int object_idx = 0; object_idx < object_count; object_idx++)
+                {
+                    if (object_idx != current && isReady(object_idx, clock)
+                        && (next == object_count || interleaved_objects[object_idx][next_layer[object_idx]].z < interleaved_objects[next][next_layer[next]].z))
+                    {
+                        next = object_idx;
+                    }
+                }
+                if (next == object_count && current < object_count && isReady(current, clock))
+                {
+                    next = current;
+                }
+            }
+            if (next == object_count)
+            {
+                // none has cooled: pause until the first one has
+                unsigned int first = object_count;
+                for (unsigned int object_idx = 0; object_idx < object_count; object_idx++)
+                {
+                    if (next_layer[object_idx] < interleaved_objects[object_idx].size() && (first == object_count || ready_time[object_idx] < ready_time[first]))
+                    {
+                        first = object_idx;
+                    }
+                }
+                if (first == object_count)
+                {
+                    break; // all layers are written
+                }
+                double pause = ready_time[first] - clock;
+                gcode.setFeature("PAUSE");
+                if (!layer_pause) // otherwise it is off already
+                {
+                    writeWelderOffAndLift(welder_off_gcode, INT2MM(gcode.getPositionZ()) + up_layer_end);
+                }
+                std::ostringstream pause_code;
+                pause_code << pause_gcode << int(pause) << "\n";
+                gcode.writeCode(pause_code.str().c_str());
+                pause_total += pause;
+                clock = ready_time[first];
+                continue;
+            }
+
+            InterleavedLayer& layer = interleaved_objects[next][next_layer[next]];
+            if (next != current)
+            {
+                // over the objects to the first move of the layer
+                gcode.writeCode(welder_off_gcode.c_str());
+                gcode.setIsWelding(false);
+                gcode.setZ(std::max(top, gcode.getPositionZ()) + clearance);
+                gcode.writeMove(gcode.getPositionXY(), speed_travel, 0);
+                Point3 destination = layer.gcode.getStartPosition();
+                layer.gcode.getFirstMove(destination);
+                gcode.writeMove(Point(destination.x, destination.y), speed_travel, 0);
+                if (current < object_count)
+                {
+                    switch_count++;
+                }
+                current = next;
+                band = 0;
+            }
+            if (gcode.getExtruderNr() != layer.gcode.getStartExtruder())
+            {
+                gcode.switchExtruder(layer.gcode.getStartExtruder());
+            }
+            double time_before = gcode.getTotalPrintTime();
+            gcode.updateTotalPrintTime();
+            clock += (gcode.getTotalPrintTime() - time_before) * 1000;
+            double layer_start = clock;
+            double layer_start_time = gcode.getTotalPrintTime();
+            double layer_start_volume = getTotalDepositedVolume();
+            if (!gcode.replay(layer.gcode))
+            {
+                // the layer continues from where the head was when it was planned
+                Point3 start = layer.gcode.getStartPosition();
+                gcode.writeMove(Point(start.x, start.y), speed_travel, 0);
+                gcode.setZ(start.z);
+                gcode.writeMove(start, speed_travel, 0);
+                if (!gcode.replay(layer.gcode))
+                {
+                    logError("Failed to write layer %d of object %d.\n", next_layer[next], next + 1);
+                }
+            }
+            gcode.updateTotalPrintTime();
+            clock += (gcode.getTotalPrintTime() - layer_start_time) * 1000;
+            ready_time[next] = layer_start + getInterpassTime(layer.area, getTotalDepositedVolume() - layer_start_volume, interpass_time, interpass_thickness);
+            top = std::max(top, layer.z);
+            if (layer_pause)
+            {
+                gcode.setFeature("PAUSE");
+                writeWelderOffAndLift(welder_off_gcode, INT2MM(gcode.getPositionZ()) + up_layer_end);
             }
+            layer = InterleavedLayer(); // free the GCode written
+            next_layer[next]++;
+            band++;
         }
-        //@ add vairables for pause time between layers
-        double pauseTime = INT2MM(getSettingInMicrons("machine_layer_pause_time"));
-        double pauseIncrease = INT2MM(getSettingInMicrons("machine_layer_pause_increase"));
-        std::string pauseGcode = getSettingString("machine_layer_pause_gcode");
-        //@ add variable for move the printer head up at the end of each layer
-        double upLayerEnd = INT2MM(getSettingInMicrons("machine_up_layer_end"));
-        //@ welder off gcode
-        std::string welderOffGCode = getSettingString("machine_welder_off_gcode");
-        //@ boolean layer pause
-        bool layerPause = getSettingBoolean("machine_layer_pause");
+        log("Interleaved %d objects, moving between them %d times\n", object_count, switch_count);
+        log("Paused %.0fs between layers\n", pause_total / 1000);
+        if (getSettingBoolean("machine_metal_printing"))
+        {
+            log("%d arc cycles in total\n", gcode.getWelderStartCount() - welder_starts);
+        }
+        interleaved_objects.clear();
+    }
 
-        for(unsigned int layer_nr=0; layer_nr<totalLayers; layer_nr++)
+    /*!
+     * The thickness of a layer: the distance from the layer below, which with adaptive layer heights differs per layer.
+     */
+    int getLayerThickness(SliceDataStorage& storage, const SettingsSnapshot& global_settings, unsigned int layer_nr)
+    {
+        if (layer_nr == 0)
         {
-            logProgress("export", layer_nr+1, totalLayers);
-            if (commandSocket) commandSocket->sendProgress(2.0/3.0 + 1.0/3.0 * float(layer_nr) / float(totalLayers));
+            return global_settings.adhesion_type == Adhesion_Raft? global_settings.layer_height : global_settings.layer_height_0;
+        }
+        if (storage.meshes.size() > 0 && layer_nr < storage.meshes[0].layers.size())
+        {
+            return storage.meshes[0].layers[layer_nr].printZ - storage.meshes[0].layers[layer_nr - 1].printZ;
+        }
+        return global_settings.layer_height;
+    }
 
-            int layer_thickness = getSettingInMicrons("layer_height");
-            if (layer_nr == 0 && !has_raft)
-            {
-                layer_thickness = getSettingInMicrons("layer_height_0");
-            }
+    /*!
+     * The thickness by which spiralized walls rise over a layer.
+     */
+    int getLayerGCodeThickness(SliceDataStorage& storage, const SettingsSnapshot& global_settings, unsigned int layer_nr)
+    {
+        return getLayerThickness(storage, global_settings, layer_nr);
+    }
 
-            storage.skirt_config.setSpeed(getSettingInMillimetersPerSecond("skirt_speed"));
-            storage.skirt_config.setLineWidth(getSettingInMicrons("skirt_line_width"));
-            storage.skirt_config.setFlow(getSettingInPercentage("material_flow"));
-            storage.skirt_config.setLayerHeight(layer_thickness);
+    /*!
+     * Plan all moves of a layer, without writing anything. Only reads the state of #gcode, so the layers of a batch
+     * can be planned in parallel as long as nothing is written meanwhile.
+     *
+     * \param gcodeLayer The planner of the layer, starting at the position from which the layer is planned
+     * \return The fan speed for the layer
+     */
+    int planLayer(SliceDataStorage& storage, const SettingsSnapshot& global_settings, LayerPathConfigs& configs, GCodePlanner& gcodeLayer, unsigned int layer_nr)
+    {
+        TRACE_ZONE("planLayer", layer_nr);
+        StatsScope stats_scope(getStatsContext().stage, layer_nr);
+        if (layer_nr == 0)
+        {
+            if (storage.skirt.size() > 0)
+                gcodeLayer.addTravel(storage.skirt[storage.skirt.size()-1].closestPointTo(gcodeLayer.getStartPosition()));
+            gcodeLayer.addPolygonsByOptimizer(storage.skirt, &configs.skirt_config);
+        }
 
-            storage.support_config.setLineWidth(getSettingInMicrons("support_line_width"));
-            storage.support_config.setSpeed(getSettingInMillimetersPerSecond("speed_support"));
-            storage.support_config.setFlow(getSettingInPercentage("material_flow"));
-            storage.support_config.setLayerHeight(layer_thickness);
-            for(SliceMeshStorage& mesh : storage.meshes)
-            {
-                mesh.inset0_config.setLineWidth(mesh.settings->getSettingInMicrons("wall_line_width_0"));
-                mesh.inset0_config.setSpeed(mesh.settings->getSettingInMillimetersPerSecond("speed_wall_0"));
-                mesh.inset0_config.setFlow(mesh.settings->getSettingInPercentage("material_flow"));
-                mesh.inset0_config.setLayerHeight(layer_thickness);
+        bool printSupportFirst = (storage.support.generated && global_settings.support_extruder_nr > 0 && global_settings.support_extruder_nr == gcodeLayer.getExtruder());
+        if (printSupportFirst)
+            addSupportToGCode(storage, global_settings, configs, gcodeLayer, layer_nr);
 
-                mesh.insetX_config.setLineWidth(mesh.settings->getSettingInMicrons("wall_line_width_x"));
-                mesh.insetX_config.setSpeed(mesh.settings->getSettingInMillimetersPerSecond("speed_wall_x"));
-                mesh.insetX_config.setFlow(mesh.settings->getSettingInPercentage("material_flow"));
-                mesh.insetX_config.setLayerHeight(layer_thickness);
+        if (storage.oozeShield.size() > 0)
+        {
+            //printf("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!enter storage oozeShield size > 0"); //@ for test.
+            gcodeLayer.setAlwaysRetract(true);
+            gcodeLayer.addPolygonsByOptimizer(storage.oozeShield[layer_nr], &configs.skirt_config);
+            gcodeLayer.setAlwaysRetract(!global_settings.retraction_combing);
+        }
 
-                mesh.skin_config.setLineWidth(mesh.settings->getSettingInMicrons("skin_line_width"));
-                mesh.skin_config.setSpeed(mesh.settings->getSettingInMillimetersPerSecond("speed_topbottom"));
-                mesh.skin_config.setFlow(mesh.settings->getSettingInPercentage("material_flow"));
-                mesh.skin_config.setLayerHeight(layer_thickness);
+        //Figure out in which order to print the meshes, do this by looking at the current extruder and preferer the meshes that use that extruder.
+        std::vector<SliceMeshStorage*> mesh_order = calculateMeshOrder(storage, gcodeLayer.getExtruder());
+        for(SliceMeshStorage* mesh : mesh_order)
+        {
+            addMeshLayerToGCode(storage, global_settings, configs, mesh, gcodeLayer, layer_nr);
+        }
+        if (!printSupportFirst)
+            addSupportToGCode(storage, global_settings, configs, gcodeLayer, layer_nr);
 
-                for(unsigned int idx=0; idx<MAX_SPARSE_COMBINE; idx++)
-                {
-                    mesh.infill_config[idx].setLineWidth(mesh.settings->getSettingInMicrons("infill_line_width") * (idx + 1));
-                    mesh.infill_config[idx].setSpeed(mesh.settings->getSettingInMillimetersPerSecond("speed_infill"));
-                    mesh.infill_config[idx].setFlow(mesh.settings->getSettingInPercentage("material_flow"));
-                    mesh.infill_config[idx].setLayerHeight(layer_thickness);
-                }
-            }
+        { //Finish the layer by applying speed corrections for minimal layer times and determine the fanSpeed
+            double travelTime;
+            double extrudeTime;
+            gcodeLayer.getTimes(travelTime, extrudeTime);
+            gcodeLayer.forceMinimalLayerTime(global_settings.cool_min_layer_time, global_settings.cool_min_speed, travelTime, extrudeTime);
 
-            int initial_speedup_layers = getSettingAsCount("speed_slowdown_layers");
-            if (static_cast<int>(layer_nr) < initial_speedup_layers)
-            {
-                int initial_layer_speed = getSettingInMillimetersPerSecond("speed_layer_0");
-                storage.support_config.smoothSpeed(initial_layer_speed, layer_nr, initial_speedup_layers);
-                for(SliceMeshStorage& mesh : storage.meshes)
-                {
-                    mesh.inset0_config.smoothSpeed(initial_layer_speed, layer_nr, initial_speedup_layers);
-                    mesh.insetX_config.smoothSpeed(initial_layer_speed, layer_nr, initial_speedup_layers);
-                    mesh.skin_config.smoothSpeed(initial_layer_speed, layer_nr, initial_speedup_layers);
-                    for(unsigned int idx=0; idx<MAX_SPARSE_COMBINE; idx++)
-                    {
-                        mesh.infill_config[idx].smoothSpeed(initial_layer_speed, layer_nr, initial_speedup_layers);
-                    }
-                }
-            }
-            //@ start layer
-            gcode.writeLayerComment(layer_nr);
+            return getLayerFanSpeed(global_settings, travelTime + extrudeTime, layer_nr);
+        }
+    }
 
-            GCodePlanner gcodeLayer(gcode, &storage.retraction_config, getSettingInMillimetersPerSecond("speed_travel"), getSettingInMicrons("retraction_min_travel"));
+    /*!
+     * Whether a layer could repeat another layer, as far as the layer number goes: the first layers, which are slowed
+     * down, have their fan slowed down and have the skirt, are each different, and so are spiralized layers.
+     */
+    bool isTemplateLayer(const SettingsSnapshot& global_settings, unsigned int layer_nr)
+    {
+        return layer_nr > 0 && static_cast<int>(layer_nr) >= global_settings.speed_slowdown_layers
+            && static_cast<int>(layer_nr) >= global_settings.cool_fan_full_layer && !global_settings.magic_spiralize;
+    }
 
-            int z = storage.meshes[0].layers[layer_nr].printZ;
+    /*!
+     * Whether a layer can be written from the GCode of the layer before it, in GCodeJob::layer_template: the layer
+     * repeats that layer, so its moves are the same but for their Z, as long as it starts where that layer started.
+     * Only the Z of the recording changes when it is written; the E values and the retractions are worked out as it is
+     * written, like for any recording.
+     */
+    bool canWriteLayerTemplate(SliceDataStorage& storage, GCodeJob& job, unsigned int layer_nr)
+    {
+        if (!job.layer_templates || job.layer_fingerprints[layer_nr] == 0 || job.layer_fingerprints[layer_nr] != job.template_fingerprint)
+        {
+            return false;
+        }
+        int z_offset = storage.meshes[0].layers[layer_nr].printZ - job.template_z;
+        return gcode.getPositionXY() == job.template_start && gcode.canReplay(job.layer_template, z_offset);
+    }
 
-            gcode.setZ(z);
-            gcode.resetStartPosition();
+    /*!
+     * The fan speed for a layer which takes \p totalLayerTime seconds to print.
+     */
+    int getLayerFanSpeed(const SettingsSnapshot& global_settings, double totalLayerTime, unsigned int layer_nr)
+    {
+        // interpolate fan speed (for cool_fan_full_layer and for cool_min_layer_time_fan_speed_max)
+        int fanSpeed = global_settings.cool_fan_speed_min;
+        if (totalLayerTime < global_settings.cool_min_layer_time)
+        {
+            fanSpeed = global_settings.cool_fan_speed_max;
+        }
+        else if (totalLayerTime < global_settings.cool_min_layer_time_fan_speed_max)
+        {
+            // when forceMinimalLayerTime didn't change the extrusionSpeedFactor, we adjust the fan speed
+            double minTime = (global_settings.cool_min_layer_time);
+            double maxTime = (global_settings.cool_min_layer_time_fan_speed_max);
+            int fanSpeedMin = global_settings.cool_fan_speed_min;
+            int fanSpeedMax = global_settings.cool_fan_speed_max;
+            fanSpeed = fanSpeedMax - (fanSpeedMax-fanSpeedMin) * (totalLayerTime - minTime) / (maxTime - minTime);
+        }
+        if (static_cast<int>(layer_nr) < global_settings.cool_fan_full_layer)
+        {
+            //Slow down the fan on the layers below the [cool_fan_full_layer], where layer 0 is speed 0.
+            fanSpeed = fanSpeed * layer_nr / global_settings.cool_fan_full_layer;
+        }
+        return fanSpeed;
+    }
 
-            if (layer_nr == 0)
+    /*!
+     * The first layer which is written by writeSpiralLayer: with spiralize, the layers above the first layer with a
+     * spiralized wall, as long as nothing but the walls of the meshes is printed, all with the same extruder, and each
+     * mesh has a single wall, which is all writeSpiralLayer writes.
+     * The layer count when no layer is.
+     */
+    unsigned int getSpiralStart(SliceDataStorage& storage, const SettingsSnapshot& global_settings, unsigned int layer_count)
+    {
+        if (!global_settings.magic_spiralize || global_settings.magic_polygon_mode || global_settings.wall_line_count != 1
+            || storage.support.generated || storage.oozeShield.size() > 0)
+        {
+            return layer_count;
+        }
+        for(SliceMeshStorage& mesh : storage.meshes)
+        {
+            if (mesh.settings_snapshot->extruder_nr != storage.meshes[0].settings_snapshot->extruder_nr
+                || mesh.settings_snapshot->wall_line_count != 1 || mesh.settings_snapshot->alternate_extra_perimeter)
             {
-                if (storage.skirt.size() > 0)
-                    gcodeLayer.addTravel(storage.skirt[storage.skirt.size()-1].closestPointTo(gcode.getPositionXY()));
-                gcodeLayer.addPolygonsByOptimizer(storage.skirt, &storage.skirt_config);
+                return layer_count;
             }
+        }
+        return std::min(layer_count, static_cast<unsigned int>(std::max(0, global_settings.bottom_layers)) + 1);
+    }
 
-            bool printSupportFirst = (storage.support.generated && getSettingAsIndex("support_extruder_nr") > 0 && getSettingAsIndex("support_extruder_nr") == gcodeLayer.getExtruder());
-            if (printSupportFirst)
-                addSupportToGCode(storage, gcodeLayer, layer_nr);
-
-            if (storage.oozeShield.size() > 0)
+    /*!
+     * Write a spiralized layer straight to the export without planning it: the outer wall of each part, each starting at
+     * its point closest to the head, where the last wall rises by a layer over its length, so that it continues into the
+     * wall of the next layer as one helix.
+     */
+    void writeSpiralLayer(SliceDataStorage& storage, const SettingsSnapshot& global_settings, LayerPathConfigs& configs, unsigned int layer_nr)
+    {
+        TRACE_ZONE("writeSpiralLayer", layer_nr);
+        unsigned int wall_count = 0;
+        double extrude_time = 0.0;
+        for(unsigned int mesh_idx = 0; mesh_idx < storage.meshes.size(); mesh_idx++)
+        {
+            for(SliceLayerPart& part : storage.meshes[mesh_idx].layers[layer_nr].parts)
             {
-                //printf("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!enter storage oozeShield size > 0"); //@ for test.
-                gcodeLayer.setAlwaysRetract(true);
-                gcodeLayer.addPolygonsByOptimizer(storage.oozeShield[layer_nr], &storage.skirt_config);
-                gcodeLayer.setAlwaysRetract(!getSettingBoolean("retraction_combing"));
+                if (part.insets.size() > 0)
+                {
+                    wall_count += part.insets[0].size();
+                    extrude_time += INT2MM(part.insets[0].polygonLength()) / configs.meshes[mesh_idx].inset0_config.getSpeed();
+                }
             }
+        }
+        // slow down to the minimal layer time as forceMinimalLayerTime does, leaving out the travels and corners
+        double speed_factor = 1.0;
+        if (extrude_time > 0.0 && extrude_time < global_settings.cool_min_layer_time)
+        {
+            speed_factor = extrude_time / global_settings.cool_min_layer_time;
+        }
+        gcode.writeFanCommand(getLayerFanSpeed(global_settings, extrude_time / speed_factor, layer_nr));
 
-            //Figure out in which order to print the meshes, do this by looking at the current extruder and preferer the meshes that use that extruder.
-            std::vector<SliceMeshStorage*> mesh_order = calculateMeshOrder(storage, gcodeLayer.getExtruder());
-            for(SliceMeshStorage* mesh : mesh_order)
+        int z = gcode.getPositionZ();
+        int layer_thickness = getLayerGCodeThickness(storage, global_settings, layer_nr);
+        unsigned int wall_nr = 0;
+        for(unsigned int mesh_idx = 0; mesh_idx < storage.meshes.size(); mesh_idx++)
+        {
+            SliceMeshStorage& mesh = storage.meshes[mesh_idx];
+            if (gcode.getExtruderNr() != mesh.settings_snapshot->extruder_nr)
             {
-                addMeshLayerToGCode(storage, mesh, gcodeLayer, layer_nr);
+                gcode.switchExtruder(mesh.settings_snapshot->extruder_nr);
             }
-            if (!printSupportFirst)
-                addSupportToGCode(storage, gcodeLayer, layer_nr);
-
-            { //Finish the layer by applying speed corrections for minimal layer times and determine the fanSpeed
-                double travelTime;
-                double extrudeTime;
-                gcodeLayer.getTimes(travelTime, extrudeTime);
-                gcodeLayer.forceMinimalLayerTime(getSettingInSeconds("cool_min_layer_time"), getSettingInMillimetersPerSecond("cool_min_speed"), travelTime, extrudeTime);
-
-                // interpolate fan speed (for cool_fan_full_layer and for cool_min_layer_time_fan_speed_max)
-                int fanSpeed = getSettingInPercentage("cool_fan_speed_min");
-                double totalLayerTime = travelTime + extrudeTime;
-                if (totalLayerTime < getSettingInSeconds("cool_min_layer_time"))
-                {
-                    fanSpeed = getSettingInPercentage("cool_fan_speed_max");
-                }
-                else if (totalLayerTime < getSettingInSeconds("cool_min_layer_time_fan_speed_max"))
+            GCodePathConfig& config = configs.meshes[mesh_idx].inset0_config;
+            int speed = std::max(global_settings.cool_min_speed, config.getSpeed() * speed_factor);
+            for(SliceLayerPart& part : mesh.layers[layer_nr].parts)
+            {
+                if (part.insets.size() == 0)
                 {
-                    // when forceMinimalLayerTime didn't change the extrusionSpeedFactor, we adjust the fan speed
-                    double minTime = (getSettingInSeconds("cool_min_layer_time"));
-                    double maxTime = (getSettingInSeconds("cool_min_layer_time_fan_speed_max"));
-                    int fanSpeedMin = getSettingInPercentage("cool_fan_speed_min");
-                    int fanSpeedMax = getSettingInPercentage("cool_fan_speed_max");
-                    fanSpeed = fanSpeedMax - (fanSpeedMax-fanSpeedMin) * (totalLayerTime - minTime) / (maxTime - minTime);
+                    continue;
                 }
-                if (static_cast<int>(layer_nr) < getSettingAsCount("cool_fan_full_layer"))
+                for(unsigned int poly_idx = 0; poly_idx < part.insets[0].size(); poly_idx++)
                 {
-                    //Slow down the fan on the layers below the [cool_fan_full_layer], where layer 0 is speed 0.
-                    fanSpeed = fanSpeed * layer_nr / getSettingAsCount("cool_fan_full_layer");
+                    PolygonRef wall = part.insets[0][poly_idx];
+                    wall_nr++;
+                    if (wall.size() < 2)
+                    {
+                        continue;
+                    }
+                    unsigned int start_idx = 0;
+                    Point position = gcode.getPositionXY();
+                    for(unsigned int point_idx = 1; point_idx < wall.size(); point_idx++)
+                    {
+                        if (vSize2(wall[point_idx] - position) < vSize2(wall[start_idx] - position))
+                        {
+                            start_idx = point_idx;
+                        }
+                    }
+                    if (!shorterThen(wall[start_idx] - position, global_settings.retraction_min_travel))
+                    {
+                        gcode.writeRetraction(config.retraction_config);
+                    }
+                    gcode.writeMove(wall[start_idx], global_settings.speed_travel, 0);
+                    gcode.writeTypeComment(config.name);
+
+                    bool rises = wall_nr == wall_count;
+                    double total_length = INT2MM(wall.polygonLength());
+                    double length = 0.0;
+                    Point p0 = wall[start_idx];
+                    for(unsigned int point_nr = 1; point_nr <= wall.size(); point_nr++)
+                    {
+                        Point p1 = wall[(start_idx + point_nr) % wall.size()];
+                        length += vSizeMM(p1 - p0);
+                        p0 = p1;
+                        if (rises && total_length > 0.0)
+                        {
+                            gcode.setZ(z + layer_thickness * length / total_length);
+                        }
+                        gcode.writeMove(p1, speed, config.getExtrusionMM3perMM());
+                    }
                 }
-                gcode.writeFanCommand(fanSpeed);
-            }
-            //@ start write GCode for each layer
-            gcodeLayer.writeGCode(getSettingBoolean("cool_lift_head"), layer_nr > 0 || getSettingAsPlatformAdhesion("adhesion_type") == Adhesion_Raft? getSettingInMicrons("layer_height") : getSettingInMicrons("layer_height_0"));
-            if (commandSocket)
-                commandSocket->sendGCodeLayer();
-            //@ add pause to each layer
-            if (layerPause){
-                //@ turn off the welder
-                //gcode.writeCode(getSettingString("machine_welder_off_gcode").c_str());
-                gcode.writeCode(welderOffGCode.c_str());
-                //@ move printer head up in mm unit
-                std::string tempUpLayerEnd;
-                std::ostringstream tempUp;
-                double upZ = INT2MM(gcode.getPositionZ()) + upLayerEnd;
-                //tempUp.precision(3);
-                tempUp << std::fixed << std::setprecision(3) << ";Move print head up\nG0 Z" << upZ << "\n";
-                tempUpLayerEnd = tempUp.str();
-                gcode.writeCode(tempUpLayerEnd.c_str());
-                //@ pause the pringting
-                std::string tempGcode;
-                double tempPauseTime;
-                std::ostringstream temp;
-                tempPauseTime = pauseTime + (pauseTime*(pauseIncrease/100)*layer_nr);
-                temp << (int)tempPauseTime << "\n";
-                tempGcode = pauseGcode + temp.str();
-
-                gcode.writeCode(tempGcode.c_str());
-                //@ set that the welder is off
-                gcode.setIsWelding(false);
-            }
-        }//@ end for each layer
-        gcode.writeRetraction(&storage.retraction_config, true);
-
-        log("Wrote layers in %5.2fs.\n", timeKeeper.restart());
-        gcode.writeFanCommand(0);
-
-        //Store the object height for when we are printing multiple objects, as we need to clear every one of them when moving to the next position.
-        maxObjectHeight = std::max(maxObjectHeight, storage.model_max.z);
-
-        if (commandSocket)
-        {
-            finalize();
-            commandSocket->sendGCodeLayer();
-            commandSocket->endSendSlicedObject();
-            if (gcode.getFlavor() == GCODE_FLAVOR_ULTIGCODE)
-            {
-                std::ostringstream prefix;
-                prefix << ";FLAVOR:UltiGCode\n";
-                prefix << ";TIME:" << int(gcode.getTotalPrintTime()) << "\n";
-                prefix << ";MATERIAL:" << int(gcode.getTotalFilamentUsed(0)) << "\n";
-                prefix << ";MATERIAL2:" << int(gcode.getTotalFilamentUsed(1)) << "\n";
-                commandSocket->sendGCodePrefix(prefix.str());
             }
         }
+        gcode.updateTotalPrintTime();
     }
 
     std::vector<SliceMeshStorage*> calculateMeshOrder(SliceDataStorage& storage, int current_extruder)
@@ -921,7 +3156,7 @@ private:
         {
             for(unsigned int idx=0; idx<add_list.size(); idx++)
             {
-                if (add_list[idx]->settings->getSettingAsIndex("extruder_nr") == add_extruder_nr)
+                if (add_list[idx]->settings_snapshot->extruder_nr == add_extruder_nr)
                 {
                     ret.push_back(add_list[idx]);
                     add_list.erase(add_list.begin() + idx);
@@ -929,24 +3164,109 @@ private:
                 }
             }
             if (add_list.size() > 0)
-                add_extruder_nr = add_list[0]->settings->getSettingAsIndex("extruder_nr");
+                add_extruder_nr = add_list[0]->settings_snapshot->extruder_nr;
         }
         return ret;
     }
 
+    /*!
+     * Generate the infill of an area, or take it from the infill cache when the area was filled the same way before.
+     * Apart from \p pattern the parameters are those of the infill generators.
+     *
+     * \param pattern The infill generator to use; Fill_ZigZag generates zigzags without end pieces
+     * \param lineSpacing The distance between the lines, or between the rings of Fill_Concentric
+     */
+    void generateCachedInfill(EFillMethod pattern, const Polygons& outline, int outlineOffset, Polygons& result, int extrusionWidth, int lineSpacing, int infillOverlap, double rotation)
+    {
+        const InfillParameters parameters{pattern, outlineOffset, extrusionWidth, lineSpacing, infillOverlap, rotation};
+        infill_cache.generate(outline, parameters, result, [&](Polygons& infill)
+        {
+            switch(pattern)
+            {
+            case Fill_Grid:
+                generateGridInfill(outline, outlineOffset, infill, extrusionWidth, lineSpacing, infillOverlap, rotation);
+                break;
+            case Fill_Lines:
+                generateLineInfill(outline, outlineOffset, infill, extrusionWidth, lineSpacing, infillOverlap, rotation);
+                break;
+            case Fill_Triangles:
+                generateTriangleInfill(outline, outlineOffset, infill, extrusionWidth, lineSpacing, infillOverlap, rotation);
+                break;
+            case Fill_Concentric:
+                generateConcentricInfill(outline, infill, lineSpacing);
+                break;
+            case Fill_ZigZag:
+                generateZigZagInfill(outline, infill, extrusionWidth, lineSpacing, infillOverlap, rotation, false, false);
+                break;
+            default:
+                break;
+            }
+        });
+    }
+
+    /*!
+     * Generate the grid, line or triangle infill of all parts of a layer with one scanline pass per infill thickness,
+     * rather than a pass per part. Gives each part the same infill as generating it part by part.
+     *
+     * \param settings The settings of the mesh
+     * \param layer The layer of which the sparse areas are filled
+     * \param fillAngle The direction of the infill lines on this layer
+     * \return For each infill thickness (see SliceLayerPart::sparse_outline) the infill of each part,
+     * or nothing when the fill pattern is not a scanline pattern
+     */
+    std::vector<std::vector<Polygons>> generateLayerInfill(const SettingsSnapshot& settings, SliceLayer& layer, int fillAngle)
+    {
+        std::vector<std::vector<Polygons>> layer_infill;
+        if (settings.fill_pattern != Fill_Grid && settings.fill_pattern != Fill_Lines && settings.fill_pattern != Fill_Triangles)
+        {
+            return layer_infill;
+        }
+        unsigned int thickness_count = 0;
+        for(SliceLayerPart& part : layer.parts)
+        {
+            thickness_count = std::max(thickness_count, static_cast<unsigned int>(part.sparse_outline.size()));
+        }
+        const Polygons no_infill;
+        for(unsigned int n = 0; n < thickness_count; n++)
+        {
+            std::vector<const Polygons*> outlines;
+            for(SliceLayerPart& part : layer.parts)
+            {
+                outlines.push_back((n < part.sparse_outline.size())? &part.sparse_outline[n] : &no_infill);
+            }
+            layer_infill.emplace_back(layer.parts.size());
+            switch(settings.fill_pattern)
+            {
+            case Fill_Grid:
+                generateGridInfill(outlines, 0, layer_infill.back(), settings.infill_line_width, settings.infill_line_distance * 2, settings.fill_overlap, fillAngle);
+                break;
+            case Fill_Lines:
+                generateLineInfill(outlines, 0, layer_infill.back(), settings.infill_line_width, settings.infill_line_distance, settings.fill_overlap, fillAngle);
+                break;
+            case Fill_Triangles:
+                generateTriangleInfill(outlines, 0, layer_infill.back(), settings.infill_line_width, settings.infill_line_distance * 3, settings.fill_overlap, 0);
+                break;
+            default:
+                break;
+            }
+        }
+        return layer_infill;
+    }
+
     //Add a single layer from a single mesh-volume to the GCode
-    void addMeshLayerToGCode(SliceDataStorage& storage, SliceMeshStorage* mesh, GCodePlanner& gcodeLayer, int layer_nr)
+    void addMeshLayerToGCode(SliceDataStorage& storage, const SettingsSnapshot& global_settings, LayerPathConfigs& configs, SliceMeshStorage* mesh, GCodePlanner& gcodeLayer, int layer_nr)
     {
         //printf("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!enter addMeshLayerToGCode function"); //@ for test.
         int prevExtruder = gcodeLayer.getExtruder();
-        bool extruder_changed = gcodeLayer.setExtruder(mesh->settings->getSettingAsIndex("extruder_nr"));
+        bool extruder_changed = gcodeLayer.setExtruder(mesh->settings_snapshot->extruder_nr);
 
         if (extruder_changed)
-            addWipeTower(storage, gcodeLayer, layer_nr, prevExtruder);
+            addWipeTower(storage, global_settings, configs, gcodeLayer, layer_nr, prevExtruder);
 
         SliceLayer* layer = &mesh->layers[layer_nr];
+        MeshPathConfigs& mesh_configs = configs.meshes[mesh - &storage.meshes[0]];
 
-        if (getSettingBoolean("magic_polygon_mode"))
+        if (global_settings.magic_polygon_mode)
         {
             //printf("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!enter magic_polygon_mode"); //@ for test.
             Polygons polygons;
@@ -980,14 +3300,16 @@ private:
                     polygons.add(p);
                 }
             }
-            if (mesh->settings->getSettingBoolean("magic_spiralize"))
-                mesh->inset0_config.spiralize = true;
-
-            gcodeLayer.addPolygonsByOptimizer(polygons, &mesh->inset0_config);
+            gcodeLayer.addPolygonsByOptimizer(polygons, mesh->settings_snapshot->magic_spiralize? &mesh_configs.inset0_spiralize_config : &mesh_configs.inset0_config);
             return;
         }
 
 
+        if (layer->parts.size() > 0 && !layer->parts[0].toolpaths)
+        {
+            generateLayerToolpaths(global_settings, *mesh, layer_nr); // not generated ahead of the export
+        }
+
         PathOrderOptimizer partOrderOptimizer(gcode.getStartPositionXY());
         for(unsigned int partNr=0; partNr<layer->parts.size(); partNr++)
         {
@@ -997,149 +3319,177 @@ private:
 
         for(unsigned int partCounter=0; partCounter<partOrderOptimizer.polyOrder.size(); partCounter++)
         {
-            SliceLayerPart* part = &layer->parts[partOrderOptimizer.polyOrder[partCounter]];
+            unsigned int part_idx = partOrderOptimizer.polyOrder[partCounter];
+            SliceLayerPart* part = &layer->parts[part_idx];
+            PartToolpaths& toolpaths = *part->toolpaths;
 
-            if (getSettingBoolean("retraction_combing"))
-                gcodeLayer.setCombBoundary(&part->combBoundery);
+            if (global_settings.retraction_combing)
+            {
+                if (part->comb)
+                    gcodeLayer.setComb(part->comb.get());
+                else
+                    gcodeLayer.setCombBoundary(&part->combBoundery);
+            }
             else
                 gcodeLayer.setAlwaysRetract(true);
 
-            int fillAngle = 45;
-            if (layer_nr & 1)
-                fillAngle += 90;
-            int extrusionWidth = getSettingInMicrons("infill_line_width");
+            int extrusionWidth = global_settings.infill_line_width;
 
-            //Add thicker (multiple layers) sparse infill.
-            int sparse_infill_line_distance = getSettingInMicrons("infill_line_distance");
-            double infill_overlap = getSettingInPercentage("fill_overlap");
-            if (sparse_infill_line_distance > 0)
+            //Print the thicker sparse lines first. (double or more layer thickness, infill combined with previous layers)
+            for(unsigned int n=1; n<toolpaths.infill_lines.size(); n++)
+            {
+                gcodeLayer.addPolygonsByOptimizer(toolpaths.infill_polygons[n], &mesh_configs.infill_config[n]);
+                gcodeLayer.addLinesByOptimizer(toolpaths.infill_lines[n], &mesh_configs.infill_config[n]);
+                sendPolygons(InfillType, layer_nr, (toolpaths.infill_polygons[n].size() > 0)? toolpaths.infill_polygons[n] : toolpaths.infill_lines[n], extrusionWidth);
+            }
+
+            //Combine the 1 layer thick infill with the top/bottom skin and print that as one thing.
+            if (toolpaths.infill_lines.size() > 0)
+            {
+                gcodeLayer.addPolygonsByOptimizer(toolpaths.infill_polygons[0], &mesh_configs.infill_config[0]);
+                gcodeLayer.addLinesByOptimizer(toolpaths.infill_lines[0], &mesh_configs.infill_config[0]);
+
+                sendPolygons(InfillType, layer_nr, toolpaths.infill_lines[0], extrusionWidth);
+            }
+
+            if (global_settings.wall_line_count > 0)
             {
-                //printf("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!enter spare_infill_line_distance greater than zero"); //@ for test.
-                //Print the thicker sparse lines first. (double or more layer thickness, infill combined with previous layers)
-                for(unsigned int n=1; n<part->sparse_outline.size(); n++)
+                GCodePathConfig* inset0_config = &mesh_configs.inset0_config;
+                if (global_settings.magic_spiralize)
                 {
-                    Polygons fillPolygons;
-                    switch(getSettingAsFillMethod("fill_pattern"))
-                    {
-                    case Fill_Grid:
-                        generateGridInfill(part->sparse_outline[n], 0, fillPolygons, extrusionWidth, sparse_infill_line_distance * 2, infill_overlap, fillAngle);
-                        gcodeLayer.addLinesByOptimizer(fillPolygons, &mesh->infill_config[n]);
-                        break;
-                    case Fill_Lines:
-                        generateLineInfill(part->sparse_outline[n], 0, fillPolygons, extrusionWidth, sparse_infill_line_distance, infill_overlap, fillAngle);
-                        gcodeLayer.addLinesByOptimizer(fillPolygons, &mesh->infill_config[n]);
-                        break;
-                    case Fill_Triangles:
-                        generateTriangleInfill(part->sparse_outline[n], 0, fillPolygons, extrusionWidth, sparse_infill_line_distance * 3, infill_overlap, 0);
-                        gcodeLayer.addLinesByOptimizer(fillPolygons, &mesh->infill_config[n]);
-                        break;
-                    case Fill_Concentric:
-                        generateConcentricInfill(part->sparse_outline[n], fillPolygons, sparse_infill_line_distance);
-                        gcodeLayer.addPolygonsByOptimizer(fillPolygons, &mesh->infill_config[n]);
-                        break;
-                    case Fill_ZigZag:
-                        generateZigZagInfill(part->sparse_outline[n], fillPolygons, extrusionWidth, sparse_infill_line_distance, infill_overlap, fillAngle, false, false);
-                        gcodeLayer.addPolygonsByOptimizer(fillPolygons, &mesh->infill_config[n]);
-                        break;
-                    default:
-                        logError("fill_pattern has unknown value.\n");
-                        break;
-                    }
-                    sendPolygons(InfillType, layer_nr, fillPolygons, extrusionWidth);
+                    //printf("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!enter magic_spiralize"); //@ for test.
+                    if (static_cast<int>(layer_nr) >= global_settings.bottom_layers)
+                        inset0_config = &mesh_configs.inset0_spiralize_config;
+                    if (static_cast<int>(layer_nr) == global_settings.bottom_layers && part->insets.size() > 0)
+                        gcodeLayer.addPolygonsByOptimizer(part->insets[0], &mesh_configs.insetX_config);
+                }
+                for(int insetNr=part->insets.size()-1; insetNr>-1; insetNr--)
+                {
+                    if (insetNr == 0)
+                        gcodeLayer.addPolygonsByOptimizer(part->insets[insetNr], inset0_config);
+                    else
+                        gcodeLayer.addPolygonsByOptimizer(part->insets[insetNr], &mesh_configs.insetX_config);
                 }
             }
 
-            //Combine the 1 layer thick infill with the top/bottom skin and print that as one thing.
-            Polygons infillPolygons;
-            Polygons infillLines;
-            if (sparse_infill_line_distance > 0 && part->sparse_outline.size() > 0)
+            for (Polygons& skin_perimeter : toolpaths.skin_perimeters)
+            {
+                gcodeLayer.addPolygonsByOptimizer(skin_perimeter, &mesh_configs.skin_config); // add polygons to gcode in inward order
+            }
+            gcodeLayer.addPolygonsByOptimizer(toolpaths.skin_polygons, &mesh_configs.skin_config);
+            gcodeLayer.addLinesByOptimizer(toolpaths.skin_lines, &mesh_configs.skin_config);
+
+            sendPolygons(SkinType, layer_nr, toolpaths.skin_lines, extrusionWidth);
+
+            //After a layer part, make sure the nozzle is inside the comb boundary, so we do not retract on the perimeter.
+            if (!global_settings.magic_spiralize || static_cast<int>(layer_nr) < global_settings.bottom_layers)
+                gcodeLayer.moveInsideCombBoundary(extrusionWidth * 2);
+        }
+        gcodeLayer.setCombBoundary(nullptr);
+    }
+
+    /*!
+     * Generate the infill, skin, bridge and perimeter gap paths of each part of a layer of a mesh, which planning the
+     * layer only orders. Reads the outlines of the layer below, for the bridges.
+     */
+    void generateLayerToolpaths(const SettingsSnapshot& global_settings, SliceMeshStorage& mesh, unsigned int layer_nr)
+    {
+        TRACE_ZONE("toolpaths", layer_nr);
+        SliceLayer* layer = &mesh.layers[layer_nr];
+        int fillAngle = 45;
+        if (layer_nr & 1)
+            fillAngle += 90;
+        int extrusionWidth = global_settings.infill_line_width;
+        int sparse_infill_line_distance = global_settings.infill_line_distance;
+        double infill_overlap = global_settings.fill_overlap;
+
+        std::vector<std::vector<Polygons>> layer_infill; // the sparse infill of all parts at once, when fill_per_layer
+        if (global_settings.fill_per_layer && sparse_infill_line_distance > 0)
+        {
+            layer_infill = generateLayerInfill(global_settings, *layer, fillAngle);
+        }
+
+        for(unsigned int part_idx = 0; part_idx < layer->parts.size(); part_idx++)
+        {
+            SliceLayerPart* part = &layer->parts[part_idx];
+            std::shared_ptr<PartToolpaths> toolpaths = std::make_shared<PartToolpaths>();
+
+            //The sparse infill of each thickness; the 1 layer thick infill is combined with the skin.
+            if (sparse_infill_line_distance > 0)
             {
-                //printf("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!enter infillPolygons"); //@ for test.
-                switch(getSettingAsFillMethod("fill_pattern"))
+                toolpaths->infill_lines.resize(part->sparse_outline.size());
+                toolpaths->infill_polygons.resize(part->sparse_outline.size());
+            }
+            for(unsigned int n=0; n<toolpaths->infill_lines.size(); n++)
+            {
+                if (layer_infill.size() > 0)
+                {
+                    toolpaths->infill_lines[n] = std::move(layer_infill[n][part_idx]);
+                    continue;
+                }
+                Polygons& fillLines = toolpaths->infill_lines[n];
+                Polygons& fillPolygons = toolpaths->infill_polygons[n];
+                switch(global_settings.fill_pattern)
                 {
                 case Fill_Grid:
-                    generateGridInfill(part->sparse_outline[0], 0, infillLines, extrusionWidth, sparse_infill_line_distance * 2, infill_overlap, fillAngle);
+                    generateCachedInfill(Fill_Grid, part->sparse_outline[n], 0, fillLines, extrusionWidth, sparse_infill_line_distance * 2, infill_overlap, fillAngle);
                     break;
                 case Fill_Lines:
-                    generateLineInfill(part->sparse_outline[0], 0, infillLines, extrusionWidth, sparse_infill_line_distance, infill_overlap, fillAngle);
+                    generateCachedInfill(Fill_Lines, part->sparse_outline[n], 0, fillLines, extrusionWidth, sparse_infill_line_distance, infill_overlap, fillAngle);
                     break;
                 case Fill_Triangles:
-                    generateTriangleInfill(part->sparse_outline[0], 0, infillLines, extrusionWidth, sparse_infill_line_distance * 3, infill_overlap, 0);
+                    generateCachedInfill(Fill_Triangles, part->sparse_outline[n], 0, fillLines, extrusionWidth, sparse_infill_line_distance * 3, infill_overlap, 0);
                     break;
                 case Fill_Concentric:
-                    generateConcentricInfill(part->sparse_outline[0], infillPolygons, sparse_infill_line_distance);
+                    generateCachedInfill(Fill_Concentric, part->sparse_outline[n], 0, fillPolygons, extrusionWidth, sparse_infill_line_distance, infill_overlap, 0);
                     break;
                 case Fill_ZigZag:
-                    generateZigZagInfill(part->sparse_outline[0], infillLines, extrusionWidth, sparse_infill_line_distance, infill_overlap, fillAngle, false, false);
+                    // the thicker zigzags are printed as polygons, the 1 layer thick ones as lines
+                    generateCachedInfill(Fill_ZigZag, part->sparse_outline[n], 0, (n > 0)? fillPolygons : fillLines, extrusionWidth, sparse_infill_line_distance, infill_overlap, fillAngle);
                     break;
                 default:
                     logError("fill_pattern has unknown value.\n");
                     break;
                 }
             }
-            gcodeLayer.addPolygonsByOptimizer(infillPolygons, &mesh->infill_config[0]);
-            gcodeLayer.addLinesByOptimizer(infillLines, &mesh->infill_config[0]);
-
-            sendPolygons(InfillType, layer_nr, infillLines, extrusionWidth);
-
-            if (getSettingAsCount("wall_line_count") > 0)
-            {
-                if (getSettingBoolean("magic_spiralize"))
-                {
-                    //printf("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!enter magic_spiralize"); //@ for test.
-                    if (static_cast<int>(layer_nr) >= getSettingAsCount("bottom_layers"))
-                        mesh->inset0_config.spiralize = true;
-                    if (static_cast<int>(layer_nr) == getSettingAsCount("bottom_layers") && part->insets.size() > 0)
-                        gcodeLayer.addPolygonsByOptimizer(part->insets[0], &mesh->insetX_config);
-                }
-                for(int insetNr=part->insets.size()-1; insetNr>-1; insetNr--)
-                {
-                    if (insetNr == 0)
-                        gcodeLayer.addPolygonsByOptimizer(part->insets[insetNr], &mesh->inset0_config);
-                    else
-                        gcodeLayer.addPolygonsByOptimizer(part->insets[insetNr], &mesh->insetX_config);
-                }
-            }
 
-            Polygons skinPolygons;
-            Polygons skinLines;
+            Polygons& skinLines = toolpaths->skin_lines;
             for(SkinPart& skin_part : part->skin_parts)
             {
                 int bridge = -1;
                 if (layer_nr > 0)
-                    bridge = bridgeAngle(skin_part.outline, &mesh->layers[layer_nr-1]);
+                    bridge = bridgeAngle(skin_part.outline, &mesh.layers[layer_nr-1]);
                 if (bridge > -1)
                 {
-                    generateLineInfill(skin_part.outline, 0, skinLines, extrusionWidth, extrusionWidth, infill_overlap, bridge);
+                    generateCachedInfill(Fill_Lines, skin_part.outline, 0, skinLines, extrusionWidth, extrusionWidth, infill_overlap, bridge);
                 }else{
-                    switch(getSettingAsFillMethod("top_bottom_pattern"))
+                    switch(global_settings.top_bottom_pattern)
                     {
                     case Fill_Lines:
                         for (Polygons& skin_perimeter : skin_part.insets)
                         {
-                            gcodeLayer.addPolygonsByOptimizer(skin_perimeter, &mesh->skin_config); // add polygons to gcode in inward order
+                            toolpaths->skin_perimeters.push_back(skin_perimeter);
                         }
                         if (skin_part.insets.size() > 0)
                         {
-                            generateLineInfill(skin_part.insets.back(), -extrusionWidth/2, skinLines, extrusionWidth, extrusionWidth, infill_overlap, fillAngle);
-                            if (getSettingString("fill_perimeter_gaps") != "Nowhere")
+                            generateCachedInfill(Fill_Lines, skin_part.insets.back(), -extrusionWidth/2, skinLines, extrusionWidth, extrusionWidth, infill_overlap, fillAngle);
+                            if (global_settings.fill_perimeter_gaps != FillPerimeterGaps_Nowhere)
                             {
-                                generateLineInfill(skin_part.perimeterGaps, 0, skinLines, extrusionWidth, extrusionWidth, 0, fillAngle);
+                                generateCachedInfill(Fill_Lines, skin_part.perimeterGaps, 0, skinLines, extrusionWidth, extrusionWidth, 0, fillAngle);
                             }
                         }
                         else
                         {
-                            generateLineInfill(skin_part.outline, 0, skinLines, extrusionWidth, extrusionWidth, infill_overlap, fillAngle);
+                            generateCachedInfill(Fill_Lines, skin_part.outline, 0, skinLines, extrusionWidth, extrusionWidth, infill_overlap, fillAngle);
                         }
                         break;
                     case Fill_Concentric:
                         {
-                            //printf("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!enter skinPolygons Fill_Concentric"); //@ for test.
                             Polygons in_outline;
-                            offsetSafe(skin_part.outline, -extrusionWidth/2, extrusionWidth, in_outline, getSettingBoolean("wall_overlap_avoid_enabled"));
-                            if (getSettingString("fill_perimeter_gaps") != "Nowhere")
+                            offsetSafe(skin_part.outline, -extrusionWidth/2, extrusionWidth, in_outline, global_settings.wall_overlap_avoid_enabled);
+                            if (global_settings.fill_perimeter_gaps != FillPerimeterGaps_Nowhere)
                             {
-                                generateConcentricInfillDense(in_outline, skinPolygons, &part->perimeterGaps, extrusionWidth, getSettingBoolean("wall_overlap_avoid_enabled"));
+                                generateConcentricInfillDense(in_outline, toolpaths->skin_polygons, &part->perimeterGaps, extrusionWidth, global_settings.wall_overlap_avoid_enabled);
                             }
                         }
                         break;
@@ -1151,45 +3501,36 @@ private:
             }
 
             // handle gaps between perimeters etc.
-            if (getSettingString("fill_perimeter_gaps") != "Nowhere")
+            if (global_settings.fill_perimeter_gaps != FillPerimeterGaps_Nowhere)
             {
-                generateLineInfill(part->perimeterGaps, 0, skinLines, extrusionWidth, extrusionWidth, 0, fillAngle);
+                generateCachedInfill(Fill_Lines, part->perimeterGaps, 0, skinLines, extrusionWidth, extrusionWidth, 0, fillAngle);
             }
-
-
-            gcodeLayer.addPolygonsByOptimizer(skinPolygons, &mesh->skin_config);
-            gcodeLayer.addLinesByOptimizer(skinLines, &mesh->skin_config);
-
-            sendPolygons(SkinType, layer_nr, skinLines, extrusionWidth);
-
-            //After a layer part, make sure the nozzle is inside the comb boundary, so we do not retract on the perimeter.
-            if (!getSettingBoolean("magic_spiralize") || static_cast<int>(layer_nr) < getSettingAsCount("bottom_layers"))
-                gcodeLayer.moveInsideCombBoundary(extrusionWidth * 2);
+            part->toolpaths = toolpaths;
         }
-        gcodeLayer.setCombBoundary(nullptr);
     }
 
-    void addSupportToGCode(SliceDataStorage& storage, GCodePlanner& gcodeLayer, int layer_nr)
+    void addSupportToGCode(SliceDataStorage& storage, const SettingsSnapshot& global_settings, LayerPathConfigs& configs, GCodePlanner& gcodeLayer, int layer_nr)
     {
         if (!storage.support.generated)
             return;
 
 
-        if (getSettingAsIndex("support_extruder_nr") > -1)
+        if (global_settings.support_extruder_nr > -1)
         {
             int prevExtruder = gcodeLayer.getExtruder();
-            if (gcodeLayer.setExtruder(getSettingAsIndex("support_extruder_nr")))
-                addWipeTower(storage, gcodeLayer, layer_nr, prevExtruder);
+            if (gcodeLayer.setExtruder(global_settings.support_extruder_nr))
+                addWipeTower(storage, global_settings, configs, gcodeLayer, layer_nr, prevExtruder);
         }
-        Polygons support;
-        if (storage.support.generated)
-            support = storage.support.supportAreasPerLayer[layer_nr];
+        sendPolygons(SupportType, layer_nr, storage.support.supportAreasPerLayer[layer_nr], global_settings.wall_line_width_x);
 
-        sendPolygons(SupportType, layer_nr, support, getSettingInMicrons("wall_line_width_x"));
-
-        std::vector<Polygons> supportIslands = support.splitIntoParts();
+        if (static_cast<unsigned int>(layer_nr) >= storage.support.toolpathsPerLayer.size() || !storage.support.toolpathsPerLayer[layer_nr])
+        {
+            generateSupportToolpaths(storage, global_settings, layer_nr); // not generated ahead of the export
+        }
+        SupportToolpaths& toolpaths = *storage.support.toolpathsPerLayer[layer_nr];
+        std::vector<Polygons>& supportIslands = toolpaths.islands;
 
-        PathOrderOptimizer islandOrderOptimizer(gcode.getPositionXY());
+        PathOrderOptimizer islandOrderOptimizer(gcodeLayer.getStartPosition());
         for(unsigned int n=0; n<supportIslands.size(); n++)
         {
             islandOrderOptimizer.addPolygon(supportIslands[n][0]);
@@ -1199,14 +3540,44 @@ private:
         for(unsigned int n=0; n<supportIslands.size(); n++)
         {
             Polygons& island = supportIslands[islandOrderOptimizer.polyOrder[n]];
+            Polygons& supportLines = toolpaths.lines[islandOrderOptimizer.polyOrder[n]];
+
+            gcodeLayer.forceRetract();
+            if (global_settings.retraction_combing)
+                gcodeLayer.setCombBoundary(&island);
+            if (global_settings.support_pattern == Fill_Grid || ( global_settings.support_pattern == Fill_ZigZag && layer_nr == 0 ) )
+                gcodeLayer.addPolygonsByOptimizer(island, &configs.support_config);
+            gcodeLayer.addLinesByOptimizer(supportLines, &configs.support_config);
+            gcodeLayer.setCombBoundary(nullptr);
+
+            sendPolygons(SupportInfillType, layer_nr, supportLines, global_settings.wall_line_width_x);
+        }
+    }
+
+    /*!
+     * Split the support of a layer into islands and generate the lines filling each, which planning the layer only orders.
+     */
+    void generateSupportToolpaths(SliceDataStorage& storage, const SettingsSnapshot& global_settings, unsigned int layer_nr)
+    {
+        TRACE_ZONE("support toolpaths", layer_nr);
+        if (storage.support.toolpathsPerLayer.size() <= layer_nr)
+        {
+            storage.support.toolpathsPerLayer.resize(layer_nr + 1); // only when not generated ahead, so from the calling thread
+        }
+        std::shared_ptr<SupportToolpaths> toolpaths = std::make_shared<SupportToolpaths>();
+        toolpaths->islands = storage.support.supportAreasPerLayer[layer_nr].splitIntoParts();
+        toolpaths->lines.resize(toolpaths->islands.size());
 
-            Polygons supportLines;
-            int support_line_distance = getSettingInMicrons("support_line_distance");
-            double infill_overlap = getSettingInPercentage("fill_overlap");
+        for(unsigned int n=0; n<toolpaths->islands.size(); n++)
+        {
+            Polygons& island = toolpaths->islands[n];
+            Polygons& supportLines = toolpaths->lines[n];
+            int support_line_distance = global_settings.support_line_distance;
+            double infill_overlap = global_settings.fill_overlap;
             if (support_line_distance > 0)
             {
-                int extrusionWidth = getSettingInMicrons("wall_line_width_x");
-                switch(getSettingAsFillMethod("support_pattern"))
+                int extrusionWidth = global_settings.wall_line_width_x;
+                switch(global_settings.support_pattern)
                 {
                 case Fill_Grid:
                     {
@@ -1237,7 +3608,7 @@ private:
                         {
                             generateGridInfill(island, offset_from_outline, supportLines, extrusionWidth, support_line_distance, infill_overlap + 150, 0);
                         }else{
-                            generateZigZagInfill(island, supportLines, extrusionWidth, support_line_distance, infill_overlap, 0, getSettingBoolean("support_connect_zigzags"), true);
+                            generateZigZagInfill(island, supportLines, extrusionWidth, support_line_distance, infill_overlap, 0, global_settings.support_connect_zigzags, true);
                         }
                     }
                     break;
@@ -1246,25 +3617,16 @@ private:
                     break;
                 }
             }
-
-            gcodeLayer.forceRetract();
-            if (getSettingBoolean("retraction_combing"))
-                gcodeLayer.setCombBoundary(&island);
-            if (getSettingAsFillMethod("support_pattern") == Fill_Grid || ( getSettingAsFillMethod("support_pattern") == Fill_ZigZag && layer_nr == 0 ) )
-                gcodeLayer.addPolygonsByOptimizer(island, &storage.support_config);
-            gcodeLayer.addLinesByOptimizer(supportLines, &storage.support_config);
-            gcodeLayer.setCombBoundary(nullptr);
-
-            sendPolygons(SupportInfillType, layer_nr, supportLines, getSettingInMicrons("wall_line_width_x"));
         }
+        storage.support.toolpathsPerLayer[layer_nr] = toolpaths;
     }
 
-    void addWipeTower(SliceDataStorage& storage, GCodePlanner& gcodeLayer, int layer_nr, int prevExtruder)
+    void addWipeTower(SliceDataStorage& storage, const SettingsSnapshot& global_settings, LayerPathConfigs& configs, GCodePlanner& gcodeLayer, int layer_nr, int prevExtruder)
     {
-        if (getSettingInMicrons("wipe_tower_size") < 1)
+        if (global_settings.wipe_tower_size < 1)
             return;
 
-        int64_t offset = -getSettingInMicrons("wall_line_width_x");
+        int64_t offset = -global_settings.wall_line_width_x;
         if (layer_nr > 0)
             offset *= 2;
 
@@ -1283,7 +3645,7 @@ private:
         }
         for(unsigned int n=0; n<insets.size(); n++)
         {
-            gcodeLayer.addPolygonsByOptimizer(insets[insets.size() - 1 - n], &storage.meshes[0].insetX_config);
+            gcodeLayer.addPolygonsByOptimizer(insets[insets.size() - 1 - n], &configs.meshes[0].insetX_config);
         }
 
         //Make sure we wipe the old extruder on the wipe tower.
@@ -2,13 +2,96 @@
 /** based on */
 /** Copyright (C) 2013 David Braam - Released under terms of the AGPLv3 License */
 #include <stdarg.h>
+#include <stdio.h>
+#include <cmath>
 #include <iomanip>
 
 #include "gcodeExport.h"
 #include "utils/logoutput.h"
+#include "utils/stats.h"
 
 namespace cura {
 
+namespace
+{
+
+/*!
+ * Write \p microns in millimeters with three decimals, the same text as streaming INT2MM(microns) with std::fixed and
+ * std::setprecision(3) gives, but without going through a double and the locale of the stream.
+ *
+ * \param buffer Where to write the text, with room for at least 24 characters
+ * \return The end of the written text
+ */
+char* formatMicrons(char* buffer, int64_t microns)
+{
+    uint64_t value = microns;
+    if (microns < 0)
+    {
+        *buffer++ = '-';
+        value = -value;
+    }
+    char digits[24]; // in reverse order
+    int count = 0;
+    do
+    {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0 || count < 4);
+    while (count > 3)
+    {
+        *buffer++ = digits[--count];
+    }
+    *buffer++ = '.';
+    while (count > 0)
+    {
+        *buffer++ = digits[--count];
+    }
+    return buffer;
+}
+
+/*!
+ * Write \p amount with five decimals, the same text as streaming it with std::fixed and std::setprecision(5) gives.
+ *
+ * The amount is scaled to an integer number of units of the last decimal. When the scaled amount is too close to halfway
+ * between two integers for the rounding of the scaling to be sure, it is printed the slow way instead.
+ *
+ * \param buffer Where to write the text, with room for at least 32 characters
+ * \return The end of the written text
+ */
+char* formatExtrusion(char* buffer, double amount)
+{
+    const double scaled = std::abs(amount) * 100000.0;
+    const double rounded = std::floor(scaled + 0.5);
+    if (!(scaled < 1e12) || std::abs(scaled - rounded) > 0.499)
+    {
+        return buffer + snprintf(buffer, 32, "%.5f", amount);
+    }
+    if (std::signbit(amount))
+    {
+        *buffer++ = '-'; // also for amounts which round to zero, like printf
+    }
+    uint64_t value = rounded;
+    char digits[24]; // in reverse order
+    int count = 0;
+    do
+    {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0 || count < 6);
+    while (count > 5)
+    {
+        *buffer++ = digits[--count];
+    }
+    *buffer++ = '.';
+    while (count > 0)
+    {
+        *buffer++ = digits[--count];
+    }
+    return buffer;
+}
+
+}//anonymous namespace
+
 GCodeExport::GCodeExport()
 : output_stream(&std::cout), currentPosition(0,0,0), startPosition(INT32_MIN,INT32_MIN,0)
 {
@@ -30,6 +113,22 @@ GCodeExport::GCodeExport()
     retractionPrimeSpeed = 1;
     isRetracted = false;
     isZHopped = false;
+    isMetalPrinting = false;
+    isWelding = false;
+    welderStartCount = 0;
+    min_dist_welder_off = 0.0;
+    welderOnDwells = false;
+    welderOnDwellTime = 0.0;
+    welderOffDwells = false;
+    welderOffDwellTime = 0.0;
+    statistics = nullptr;
+    statisticsLayer = PrintStatistics::no_layer;
+    statisticsFeature = "START";
+    statisticsEntry = 0;
+    recording = nullptr;
+    recordingOutputStream = nullptr;
+    formattedXY = nullptr;
+    formattedXYLength = 0;
     setFlavor(GCODE_FLAVOR_REPRAP);
     memset(extruderOffset, 0, sizeof(extruderOffset));
 }
@@ -77,6 +176,7 @@ void GCodeExport::setFlavor(EGCodeFlavor flavor)
     {
         is_volumatric = false;
     }
+    selectEmitters();
 }
 
 EGCodeFlavor GCodeExport::getFlavor()
@@ -95,20 +195,27 @@ void GCodeExport::setRetractionSettings(int extruderSwitchRetraction, int extrud
 
 void GCodeExport::setZ(int z)
 {
+    record(GCodeBuffer::SetZ, z);
     this->zPos = z;
 }
 
 Point3 GCodeExport::getPosition()
 {
+    if (recording && !recording->moved)
+        recording->start_position_used = true;
     return currentPosition;
 }
 Point GCodeExport::getPositionXY()
 {
+    if (recording && !recording->moved)
+        recording->start_position_used = true;
     return Point(currentPosition.x, currentPosition.y);
 }
 
 int GCodeExport::getPositionZ()
 {
+    if (recording && !recording->moved)
+        recording->start_position_used = true;
     return currentPosition.z;
 }
 
@@ -179,6 +286,8 @@ void GCodeExport::resetTotalPrintTimeAndFilament()
 
 void GCodeExport::updateTotalPrintTime()
 {
+    if (record(GCodeBuffer::UpdatePrintTime))
+        return;
     totalPrintTime += estimateCalculator.calculate();
     estimateCalculator.reset();
 }
@@ -188,13 +297,64 @@ void GCodeExport::writeComment(std::string comment)
     *output_stream << ";" << comment << "\n";
 }
 
+void GCodeExport::setStatistics(PrintStatistics* statistics)
+{
+    this->statistics = statistics;
+    estimateCalculator.clearTagTimes();
+    if (statistics)
+    {
+        statistics->clear();
+        selectStatisticsEntry();
+    }
+}
+
+void GCodeExport::setFeature(const char* feature)
+{
+    if (record(GCodeBuffer::Feature))
+    {
+        recording->operations.back().feature = feature;
+        return;
+    }
+    statisticsFeature = feature;
+    selectStatisticsEntry();
+}
+
+void GCodeExport::selectStatisticsEntry()
+{
+    if (!statistics)
+        return;
+    statisticsEntry = statistics->getEntryIdx(statisticsLayer, statisticsFeature);
+    updateEstimateTag();
+}
+
+void GCodeExport::updateEstimateTag()
+{
+    if (statistics)
+        estimateCalculator.setTag(statisticsEntry * 2 + (isWelding? 1 : 0));
+}
+
+void GCodeExport::addMoveStatistics(double length, double extrusion_mm3_per_mm)
+{
+    if (!statistics)
+        return;
+    PrintStatistics::Entry& entry = (*statistics)[statisticsEntry];
+    if (extrusion_mm3_per_mm > 0.000001)
+        entry.extrusion_volume += extrusion_mm3_per_mm * length;
+    else
+        entry.travel_distance += length;
+}
+
 void GCodeExport::writeTypeComment(const char* type)
 {
     *output_stream << ";TYPE:" << type << "\n";
+    setFeature(type);
 }
 void GCodeExport::writeLayerComment(int layer_nr)
 {
     *output_stream << ";LAYER:" << layer_nr << "\n";
+    statisticsLayer = layer_nr;
+    statisticsFeature = "TRAVEL"; // until the first type comment of the layer
+    selectStatisticsEntry();
 }
 
 void GCodeExport::writeLine(const char* line)
@@ -204,6 +364,8 @@ void GCodeExport::writeLine(const char* line)
 
 void GCodeExport::resetExtrusionValue()
 {
+    if (record(GCodeBuffer::ResetExtrusionValue))
+        return;
     if (extrusion_amount != 0.0 && flavor != GCODE_FLAVOR_MAKERBOT && flavor != GCODE_FLAVOR_BFB)
     {
         *output_stream << "G92 " << extruderCharacter[current_extruder] << "0\n";
@@ -211,13 +373,18 @@ void GCodeExport::resetExtrusionValue()
         for (unsigned int i = 0; i < extrusion_amount_at_previous_n_retractions.size(); i++)
             extrusion_amount_at_previous_n_retractions[i] -= extrusion_amount;
         extrusion_amount = 0.0;
+        TimeEstimateCalculator::Position position = estimateCalculator.getPosition();
+        position[TimeEstimateCalculator::E_AXIS] = 0; // like the firmware, or the next move would seem to move the E axis all the way back
+        estimateCalculator.setPosition(position);
     }
 }
 
 void GCodeExport::writeDelay(double timeAmount)
 {
+    if (record(GCodeBuffer::Delay, 0, timeAmount))
+        return;
     *output_stream << "G4 P" << int(timeAmount * 1000) << "\n";
-    totalPrintTime += timeAmount;
+    estimateCalculator.dwell(timeAmount);
 }
 
 void GCodeExport::writeMove(Point p, int speed, double extrusion_mm3_per_mm)
@@ -231,137 +398,269 @@ void GCodeExport::writeMove(Point3 p, int speed, double extrusion_mm3_per_mm)
 }
 void GCodeExport::writeMove(int x, int y, int z, int speed, double extrusion_mm3_per_mm)
 {
+    if (recording)
+    {
+        // whether and how the move is written depends on the state when replaying; only the coordinates are formatted now
+        record(GCodeBuffer::Move, speed, extrusion_mm3_per_mm);
+        GCodeBuffer::Operation& move = recording->operations.back();
+        move.p = Point3(x, y, z);
+        move.extruder = current_extruder;
+        writeXY(x, y);
+        move.text_end = output_stream->tellp();
+        recording->moved = true;
+        currentPosition = Point3(x, y, z);
+        return;
+    }
     if (currentPosition.x == x && currentPosition.y == y && currentPosition.z == z)
         return;
 
-    double extrusion_per_mm = extrusion_mm3_per_mm;
-    if (!is_volumatric)
+    (this->*moveEmitter)(x, y, z, speed, extrusion_mm3_per_mm);
+    addMoveStatistics((Point3(x, y, z) - currentPosition).vSizeMM(), extrusion_mm3_per_mm);
+
+    currentPosition = Point3(x, y, z);
+    startPosition = currentPosition;
+    estimateCalculator.plan(getEstimatePosition(), speed);
+}
+
+TimeEstimateCalculator::Position GCodeExport::getEstimatePosition()
+{
+    double e = isMetalPrinting? estimateCalculator.getPosition()[TimeEstimateCalculator::E_AXIS] : extrusion_amount;
+    return TimeEstimateCalculator::Position(INT2MM(currentPosition.x), INT2MM(currentPosition.y), INT2MM(currentPosition.z), e);
+}
+
+void GCodeExport::selectEmitters()
+{
+    const bool volumetric = flavor == GCODE_FLAVOR_ULTIGCODE || flavor == GCODE_FLAVOR_REPRAP_VOLUMATRIC; // also: the firmware retracts
+    if (flavor == GCODE_FLAVOR_BFB)
     {
-        extrusion_per_mm = extrusion_mm3_per_mm / getFilamentArea(current_extruder);
+        moveEmitter = &GCodeExport::emitBFBMove;
+        arcEmitter = &GCodeExport::emitArcAsMove;
     }
+    else if (isMetalPrinting)
+    {
+        moveEmitter = volumetric? &GCodeExport::emitMove<true, true> : &GCodeExport::emitMove<false, true>;
+        arcEmitter = volumetric? &GCodeExport::emitArc<true, true> : &GCodeExport::emitArc<false, true>;
+    }
+    else
+    {
+        moveEmitter = volumetric? &GCodeExport::emitMove<true, false> : &GCodeExport::emitMove<false, false>;
+        arcEmitter = volumetric? &GCodeExport::emitArc<true, false> : &GCodeExport::emitArc<false, false>;
+    }
+}
 
-    if (flavor == GCODE_FLAVOR_BFB)
+void GCodeExport::emitBFBMove(int x, int y, int z, int speed, double extrusion_mm3_per_mm)
+{
+    double extrusion_per_mm = extrusion_mm3_per_mm / getFilamentArea(current_extruder);
+
+    //For Bits From Bytes machines, we need to handle this completely differently. As they do not use E values but RPM values.
+    float fspeed = speed * 60;
+    float rpm = extrusion_per_mm * speed * 60;
+    const float mm_per_rpm = 4.0; //All BFB machines have 4mm per RPM extrusion.
+    rpm /= mm_per_rpm;
+    if (rpm > 0)
     {
-        //For Bits From Bytes machines, we need to handle this completely differently. As they do not use E values but RPM values.
-        float fspeed = speed * 60;
-        float rpm = extrusion_per_mm * speed * 60;
-        const float mm_per_rpm = 4.0; //All BFB machines have 4mm per RPM extrusion.
-        rpm /= mm_per_rpm;
-        if (rpm > 0)
+        if (isRetracted)
         {
-            if (isRetracted)
+            if (currentSpeed != int(rpm * 10))
             {
-                if (currentSpeed != int(rpm * 10))
-                {
-                    //fprintf(f, "; %f e-per-mm %d mm-width %d mm/s\n", extrusion_per_mm, lineWidth, speed);
-                    //fprintf(f, "M108 S%0.1f\r\n", rpm); //M108 set extruder speed
-                    *output_stream << "M108 S" << std::setprecision(1) << rpm << "\r\n";
-                    currentSpeed = int(rpm * 10);
-                }
-                //Add M101 or M201 to enable the proper extruder.
-                *output_stream << "M" << int((current_extruder + 1) * 100 + 1) << "\r\n";
-                isRetracted = false;
+                //fprintf(f, "; %f e-per-mm %d mm-width %d mm/s\n", extrusion_per_mm, lineWidth, speed);
+                //fprintf(f, "M108 S%0.1f\r\n", rpm); //M108 set extruder speed
+                *output_stream << "M108 S" << std::setprecision(1) << rpm << "\r\n";
+                currentSpeed = int(rpm * 10);
             }
-            //Fix the speed by the actual RPM we are asking, because of rounding errors we cannot get all RPM values, but we have a lot more resolution in the feedrate value.
-            // (Trick copied from KISSlicer, thanks Jonathan)
-            fspeed *= (rpm / (roundf(rpm * 100) / 100));
+            //Add M101 or M201 to enable the proper extruder.
+            *output_stream << "M" << int((current_extruder + 1) * 100 + 1) << "\r\n";
+            isRetracted = false;
+        }
+        //Fix the speed by the actual RPM we are asking, because of rounding errors we cannot get all RPM values, but we have a lot more resolution in the feedrate value.
+        // (Trick copied from KISSlicer, thanks Jonathan)
+        fspeed *= (rpm / (roundf(rpm * 100) / 100));
 
-            //Increase the extrusion amount to calculate the amount of filament used.
-            Point3 diff = Point3(x,y,z) - getPosition();
+        //Increase the extrusion amount to calculate the amount of filament used.
+        Point3 diff = Point3(x,y,z) - getPosition();
 
-            extrusion_amount += extrusion_per_mm * diff.vSizeMM();
-        }else{
-            //If we are not extruding, check if we still need to disable the extruder. This causes a retraction due to auto-retraction.
-            if (!isRetracted)
-            {
-                *output_stream << "M103\r\n";
-                isRetracted = true;
-            }
-        }
-        *output_stream << std::setprecision(3) << "G1 X" << INT2MM(x - extruderOffset[current_extruder].X) << " Y" << INT2MM(y - extruderOffset[current_extruder].Y) << " Z" << INT2MM(z) << std::setprecision(1) << " F" << fspeed << "\r\n";
+        extrusion_amount += extrusion_per_mm * diff.vSizeMM();
     }else{
-        //Normal E handling. //@ RepRap
-        //@ move this diff outside so able to use it in else for G0
-        Point3 diff = Point3(x,y,z) - getPosition();
-        //@ t_tmp for temporary calculation time
-        //@ double t_tmp;
-        if (extrusion_mm3_per_mm > 0.000001)
+        //If we are not extruding, check if we still need to disable the extruder. This causes a retraction due to auto-retraction.
+        if (!isRetracted)
         {
-            //@ Point3 diff = Point3(x,y,z) - getPosition();
-            if (isZHopped > 0)
-            {
-                *output_stream << std::setprecision(3) << "G1 Z" << INT2MM(currentPosition.z) << "\n";
-                isZHopped = false;
-            }
-            if (isRetracted)
-            {
-                if (flavor == GCODE_FLAVOR_ULTIGCODE || flavor == GCODE_FLAVOR_REPRAP_VOLUMATRIC)
-                {
-                    *output_stream << "G11\n";
-                    //Assume default UM2 retraction settings.
-                    estimateCalculator.plan(TimeEstimateCalculator::Position(INT2MM(currentPosition.x), INT2MM(currentPosition.y), INT2MM(currentPosition.z), extrusion_amount), 25.0);
-                }else{
-                    *output_stream << "G1 F" << (retractionPrimeSpeed * 60) << " " << extruderCharacter[current_extruder] << std::setprecision(5) << extrusion_amount << "\n";
-                    currentSpeed = retractionPrimeSpeed;
-                    estimateCalculator.plan(TimeEstimateCalculator::Position(INT2MM(currentPosition.x), INT2MM(currentPosition.y), INT2MM(currentPosition.z), extrusion_amount), currentSpeed);
-                }
-                if (getExtrusionAmountMM3(current_extruder) > 10000.0) //According to https://github.com/Ultimaker/CuraEngine/issues/14 having more then 21m of extrusion causes inaccuracies. So reset it every 10m, just to be sure.
-                    resetExtrusionValue(); //
-                isRetracted = false;
-            }
-            //@ if isMetalPrinting then cal time and new speed
-            if (isMetalPrinting)
-            {
-                //@t_tmp = (extrusion_per_mm * diff.vSizeMM())/(double)speed;
-                //@speed = (int)(diff.vSizeMM()/t_tmp); //@ cal new speed
-                if (!isWelding)
-                {
-                    isWelding = true;
-                    *output_stream << welder_on;
-                }
-            }
-            extrusion_amount += extrusion_per_mm * diff.vSizeMM();
-            *output_stream << "G1"; //@ to print
-
-        }else{//@ only moving
-            //@ if it is metal printing
-            if (isMetalPrinting)
-            {
-                //@ check with min_dist_welder_off
-                if (isWelding && diff.vSizeMM() > min_dist_welder_off){
-                    isWelding = false;
-                    *output_stream << welder_off;
-                }
-            }
-
-            *output_stream << "G0"; //@ to move
+            *output_stream << "M103\r\n";
+            isRetracted = true;
         }
+    }
+    *output_stream << "G1";
+    writeXY(x, y);
+    *output_stream << " Z";
+    writeMillimeters(z);
+    *output_stream << std::setprecision(1) << " F" << fspeed << "\r\n";
+}
 
-        if (currentSpeed != speed)
+template<bool volumetric, bool welding>
+void GCodeExport::emitMove(int x, int y, int z, int speed, double extrusion_mm3_per_mm)
+{
+    //Normal E handling. //@ RepRap
+    //@ move this diff outside so able to use it in else for G0
+    Point3 diff = Point3(x,y,z) - getPosition();
+    if (extrusion_mm3_per_mm > 0.000001)
+    {
+        startExtrusion<volumetric, welding>();
+        double extrusion_per_mm = volumetric? extrusion_mm3_per_mm : extrusion_mm3_per_mm / getFilamentArea(current_extruder);
+        extrusion_amount += extrusion_per_mm * diff.vSizeMM();
+        *output_stream << "G1"; //@ to print
+
+    }else{//@ only moving
+        //@ if it is metal printing, check with min_dist_welder_off
+        if (welding && isWelding && diff.vSizeMM() > min_dist_welder_off)
         {
-            *output_stream << " F" << (speed * 60); //@feedrate per minute
-            currentSpeed = speed;
+            isWelding = false;
+            updateEstimateTag();
+            *output_stream << welder_off;
+            if (welderOffDwells)
+                estimateCalculator.dwell(welderOffDwellTime);
         }
 
-        *output_stream << std::setprecision(3) << " X" << INT2MM(x - extruderOffset[current_extruder].X) << " Y" << INT2MM(y - extruderOffset[current_extruder].Y);
-        if (z != currentPosition.z)
-            *output_stream << " Z" << INT2MM(z);
-        if (!isMetalPrinting)
+        *output_stream << "G0"; //@ to move
+    }
+
+    if (currentSpeed != speed)
+    {
+        *output_stream << " F" << (speed * 60); //@feedrate per minute
+        currentSpeed = speed;
+    }
+
+    writeXY(x, y);
+    if (z != currentPosition.z)
+    {
+        *output_stream << " Z";
+        writeMillimeters(z);
+    }
+    //@ the welder takes the place of the E axis
+    if (!welding && extrusion_mm3_per_mm > 0.000001)
+    {
+        *output_stream << " " << extruderCharacter[current_extruder];
+        writeExtrusionAmount(extrusion_amount);
+    }
+
+    *output_stream << "\n";
+}
+
+template<bool firmware_retraction, bool welding>
+void GCodeExport::startExtrusion()
+{
+    if (isZHopped > 0)
+    {
+        *output_stream << "G1 Z";
+        writeMillimeters(currentPosition.z);
+        *output_stream << "\n";
+        isZHopped = false;
+    }
+    if (isRetracted)
+    {
+        if (firmware_retraction)
         {
-            if (extrusion_mm3_per_mm > 0.000001)
-                *output_stream << " " << extruderCharacter[current_extruder] << std::setprecision(5) << extrusion_amount;
+            *output_stream << "G11\n";
+            estimateCalculator.plan(TimeEstimateCalculator::Position(INT2MM(currentPosition.x), INT2MM(currentPosition.y), INT2MM(currentPosition.z), extrusion_amount), estimateCalculator.getMachineLimits().firmware_retraction_speed);
+        }else{
+            *output_stream << "G1 F" << (retractionPrimeSpeed * 60) << " " << extruderCharacter[current_extruder];
+            writeExtrusionAmount(extrusion_amount);
+            *output_stream << "\n";
+            currentSpeed = retractionPrimeSpeed;
+            estimateCalculator.plan(TimeEstimateCalculator::Position(INT2MM(currentPosition.x), INT2MM(currentPosition.y), INT2MM(currentPosition.z), extrusion_amount), currentSpeed);
         }
+        if (getExtrusionAmountMM3(current_extruder) > 10000.0) //According to https://github.com/Ultimaker/CuraEngine/issues/14 having more then 21m of extrusion causes inaccuracies. So reset it every 10m, just to be sure.
+            resetExtrusionValue(); //
+        isRetracted = false;
+    }
+    //@ if isMetalPrinting then switch the welder on
+    if (welding && !isWelding)
+    {
+        isWelding = true;
+        updateEstimateTag();
+        welderStartCount++;
+        countStat(Stat_WelderCycles);
+        *output_stream << welder_on;
+        if (welderOnDwells)
+            estimateCalculator.dwell(welderOnDwellTime);
+    }
+}
 
-        *output_stream << "\n";
+void GCodeExport::writeArc(Point p, Point center, bool clockwise, int speed, double extrusion_mm3_per_mm)
+{
+    if (recording)
+    {
+        record(GCodeBuffer::Arc, speed, extrusion_mm3_per_mm);
+        GCodeBuffer::Operation& arc = recording->operations.back();
+        arc.p = Point3(p.X, p.Y, zPos);
+        arc.center = center;
+        arc.clockwise = clockwise;
+        recording->moved = true;
+        currentPosition = arc.p;
+        return;
     }
+    (this->*arcEmitter)(p, center, clockwise, speed, extrusion_mm3_per_mm);
+}
 
-    currentPosition = Point3(x, y, z);
+void GCodeExport::emitArcAsMove(Point p, Point center, bool clockwise, int speed, double extrusion_mm3_per_mm)
+{
+    (void)center;
+    (void)clockwise;
+    writeMove(p, speed, extrusion_mm3_per_mm);
+}
+
+template<bool volumetric, bool welding>
+void GCodeExport::emitArc(Point p, Point center, bool clockwise, int speed, double extrusion_mm3_per_mm)
+{
+    if (extrusion_mm3_per_mm <= 0.000001)
+    {
+        writeMove(p, speed, extrusion_mm3_per_mm);
+        return;
+    }
+    const int z = zPos;
+    double extrusion_per_mm = volumetric? extrusion_mm3_per_mm : extrusion_mm3_per_mm / getFilamentArea(current_extruder);
+    double radius = vSizeMM(Point(currentPosition.x, currentPosition.y) - center);
+    double sweep = atan2(p.Y - center.Y, p.X - center.X) - atan2(currentPosition.y - center.Y, currentPosition.x - center.X);
+    if (clockwise)
+        sweep = -sweep;
+    if (sweep <= 0)
+        sweep += 2 * M_PI;
+    double length = sqrt(radius * sweep * radius * sweep + INT2MM(z - currentPosition.z) * INT2MM(z - currentPosition.z));
+
+    startExtrusion<volumetric, welding>();
+    extrusion_amount += extrusion_per_mm * length;
+    addMoveStatistics(length, extrusion_mm3_per_mm);
+    *output_stream << (clockwise? "G2" : "G3");
+    if (currentSpeed != speed)
+    {
+        *output_stream << " F" << (speed * 60);
+        currentSpeed = speed;
+    }
+    writeXY(p.X, p.Y);
+    if (z != currentPosition.z)
+    {
+        *output_stream << " Z";
+        writeMillimeters(z);
+    }
+    // the center relative to the start, which the extruder offset doesn't change
+    *output_stream << " I";
+    writeMillimeters(center.X - currentPosition.x);
+    *output_stream << " J";
+    writeMillimeters(center.Y - currentPosition.y);
+    if (!welding)
+    {
+        *output_stream << " " << extruderCharacter[current_extruder];
+        writeExtrusionAmount(extrusion_amount);
+    }
+    *output_stream << "\n";
+
+    currentPosition = Point3(p.X, p.Y, z);
     startPosition = currentPosition;
-    estimateCalculator.plan(TimeEstimateCalculator::Position(INT2MM(currentPosition.x), INT2MM(currentPosition.y), INT2MM(currentPosition.z), extrusion_amount), speed);
+    estimateCalculator.planArc(getEstimatePosition(), INT2MM(center.X), INT2MM(center.Y), clockwise, speed);
 }
 
 void GCodeExport::writeRetraction(RetractionConfig* config, bool force)
 {
+    if (record(GCodeBuffer::Retraction, force, 0.0, config))
+        return;
     if (flavor == GCODE_FLAVOR_BFB)//BitsFromBytes does automatic retraction.
         return;
     if (isRetracted)
@@ -380,17 +679,21 @@ void GCodeExport::writeRetraction(RetractionConfig* config, bool force)
     if (flavor == GCODE_FLAVOR_ULTIGCODE || flavor == GCODE_FLAVOR_REPRAP_VOLUMATRIC)
     {
         *output_stream << "G10\n";
-        //Assume default UM2 retraction settings.
-        double retraction_distance = 4.5;
-        estimateCalculator.plan(TimeEstimateCalculator::Position(INT2MM(currentPosition.x), INT2MM(currentPosition.y), INT2MM(currentPosition.z), extrusion_amount - retraction_distance), 25); // TODO: hardcoded values!
+        // the firmware retracts with its own settings
+        const TimeEstimateCalculator::MachineLimits& limits = estimateCalculator.getMachineLimits();
+        estimateCalculator.plan(TimeEstimateCalculator::Position(INT2MM(currentPosition.x), INT2MM(currentPosition.y), INT2MM(currentPosition.z), extrusion_amount - limits.firmware_retraction_amount), limits.firmware_retraction_speed);
     }else{
-        *output_stream << "G1 F" << (config->speed * 60) << " " << extruderCharacter[current_extruder] << std::setprecision(5) << extrusion_amount - config->amount << "\n";
+        *output_stream << "G1 F" << (config->speed * 60) << " " << extruderCharacter[current_extruder];
+        writeExtrusionAmount(extrusion_amount - config->amount);
+        *output_stream << "\n";
         currentSpeed = config->speed;
         estimateCalculator.plan(TimeEstimateCalculator::Position(INT2MM(currentPosition.x), INT2MM(currentPosition.y), INT2MM(currentPosition.z), extrusion_amount - config->amount), currentSpeed);
     }
     if (config->zHop > 0)
     {
-        *output_stream << std::setprecision(3) << "G1 Z" << INT2MM(currentPosition.z + config->zHop) << "\n";
+        *output_stream << "G1 Z";
+        writeMillimeters(currentPosition.z + config->zHop);
+        *output_stream << "\n";
         isZHopped = true;
     }
     extrusion_amount_at_previous_n_retractions.push_front(extrusion_amount);
@@ -405,6 +708,16 @@ void GCodeExport::switchExtruder(int newExtruder)
 {
     if (current_extruder == newExtruder)
         return;
+    if (record(GCodeBuffer::SwitchExtruder, newExtruder))
+    {
+        // keep track of the extruder and position the way writing would, for the offsets and for the planner asking
+        if (flavor != GCODE_FLAVOR_BFB)
+        {
+            current_extruder = newExtruder;
+            currentPosition.z += 1;
+        }
+        return;
+    }
 
     if (flavor == GCODE_FLAVOR_BFB)
     {
@@ -420,7 +733,9 @@ void GCodeExport::switchExtruder(int newExtruder)
     {
         *output_stream << "G10 S1\n";
     }else{
-        *output_stream << "G1 F" << (extruderSwitchRetractionSpeed * 60) << " " << extruderCharacter[current_extruder] << std::setprecision(5) << (extrusion_amount - extruderSwitchRetraction) << "\n";
+        *output_stream << "G1 F" << (extruderSwitchRetractionSpeed * 60) << " " << extruderCharacter[current_extruder];
+        writeExtrusionAmount(extrusion_amount - extruderSwitchRetraction);
+        *output_stream << "\n";
         currentSpeed = extruderSwitchRetractionSpeed;
     }
 
@@ -446,10 +761,15 @@ void GCodeExport::writeCode(const char* str)
         *output_stream << "\r\n";
     else
         *output_stream << "\n";
+    double dwell_time;
+    if (TimeEstimateCalculator::findDwell(str, dwell_time)) // e.g. the pause between layers
+        estimateCalculator.dwell(dwell_time);
 }
 
 void GCodeExport::writeFanCommand(int speed)
 {
+    if (record(GCodeBuffer::Fan, speed))
+        return;
     if (currentFanSpeed == speed)
         return;
     if (speed > 0)
@@ -501,27 +821,58 @@ void GCodeExport::writeBedTemperatureCommand(int temperature, bool wait)
 void GCodeExport::finalize(int maxObjectHeight, int moveSpeed, const char* endCode)
 {
     std::cerr << "maxObjectHeight : " << maxObjectHeight << std::endl;
+    setFeature("END");
     writeFanCommand(0);
     setZ(maxObjectHeight + 5000);
     writeMove(Point3(0,0,maxObjectHeight + 5000) + getPositionXY(), moveSpeed, 0);
     writeCode(endCode);
+    updateTotalPrintTime();
+    if (statistics)
+    {
+        // entry n has the time of the moves with tag 2n with the welder off and with tag 2n + 1 with the welder on
+        const std::vector<double>& tag_times = estimateCalculator.getTagTimes();
+        for (unsigned int n = 0; n < statistics->getEntries().size(); n++)
+        {
+            PrintStatistics::Entry& entry = (*statistics)[n];
+            entry.time = (n * 2 < tag_times.size())? tag_times[n * 2] : 0.0;
+            entry.welding_time = (n * 2 + 1 < tag_times.size())? tag_times[n * 2 + 1] : 0.0;
+            entry.time += entry.welding_time;
+        }
+    }
     log("Print time: %d\n", int(getTotalPrintTime()));
     log("Filament: %d\n", int(getTotalFilamentUsed(0)));
     for(int n=1; n<MAX_EXTRUDERS; n++)
         if (getTotalFilamentUsed(n) > 0)
             log("Filament%d: %d\n", n + 1, int(getTotalFilamentUsed(n)));
+    flush();
+}
+
+void GCodeExport::flush()
+{
     output_stream->flush();
 }
+void GCodeExport::setMachineLimits(const TimeEstimateCalculator::MachineLimits& limits)
+{
+    estimateCalculator.setMachineLimits(limits);
+}
+
+const TimeEstimateCalculator::MachineLimits& GCodeExport::getMachineLimits()
+{
+    return estimateCalculator.getMachineLimits();
+}
+
 //@ set welder_on GCode
 void GCodeExport::setWelderOn(std::string welder_on_gcode)
 {
     welder_on = welder_on_gcode;
+    welderOnDwells = TimeEstimateCalculator::findDwell(welder_on, welderOnDwellTime);
 }
 
 //@ set welder_off GCode
 void GCodeExport::setWelderOff(std::string welder_off_gcode)
 {
     welder_off = welder_off_gcode;
+    welderOffDwells = TimeEstimateCalculator::findDwell(welder_off, welderOffDwellTime);
 }
 
 //@ set Minimum Distance to move with welder off
@@ -533,11 +884,184 @@ void GCodeExport::setMinDistWelderOff(double machine_min_dist_welder_off)
 //@ set metal printing boolean
 void GCodeExport::setIsMetalPrinting(bool machine_metal_printing){
     isMetalPrinting = machine_metal_printing;
+    selectEmitters();
 }
 
 //@ set is welding
 void GCodeExport::setIsWelding(bool is_welding){
     isWelding = is_welding;
+    updateEstimateTag();
+}
+
+//@ get the number of times the welder was turned on
+int GCodeExport::getWelderStartCount(){
+    return welderStartCount;
+}
+
+bool GCodeExport::record(GCodeBuffer::OperationType type, int value, double amount, RetractionConfig* retraction_config)
+{
+    if (!recording)
+        return false;
+    GCodeBuffer::Operation operation;
+    operation.type = type;
+    operation.value = value;
+    operation.amount = amount;
+    operation.retraction_config = retraction_config;
+    operation.text_start = output_stream->tellp();
+    operation.text_end = operation.text_start;
+    operation.extruder = current_extruder;
+    operation.feature = nullptr;
+    recording->operations.push_back(operation);
+    return true;
+}
+
+void GCodeExport::writeXY(int x, int y)
+{
+    if (formattedXY)
+    {
+        output_stream->write(formattedXY, formattedXYLength);
+        return;
+    }
+    char buffer[64];
+    char* end = buffer;
+    *end++ = ' ';
+    *end++ = 'X';
+    end = formatMicrons(end, x - extruderOffset[current_extruder].X);
+    *end++ = ' ';
+    *end++ = 'Y';
+    end = formatMicrons(end, y - extruderOffset[current_extruder].Y);
+    output_stream->write(buffer, end - buffer);
+}
+
+void GCodeExport::writeMillimeters(int64_t microns)
+{
+    char buffer[24];
+    output_stream->write(buffer, formatMicrons(buffer, microns) - buffer);
+}
+
+void GCodeExport::writeExtrusionAmount(double amount)
+{
+    char buffer[32];
+    output_stream->write(buffer, formatExtrusion(buffer, amount) - buffer);
+}
+
+void GCodeExport::startRecording(GCodeBuffer* buffer, Point3 start_position)
+{
+    buffer->clear();
+    buffer->text << std::fixed;
+    buffer->start_position = start_position;
+    buffer->start_extruder = current_extruder;
+    buffer->start_position_used = false;
+    buffer->moved = false;
+    currentPosition = start_position;
+    recordingOutputStream = output_stream;
+    output_stream = &buffer->text;
+    recording = buffer;
+}
+
+void GCodeExport::stopRecording()
+{
+    output_stream = recordingOutputStream;
+    recording = nullptr;
+}
+
+bool GCodeBuffer::getFirstMove(Point3& destination) const
+{
+    for (const Operation& operation : operations)
+    {
+        if (operation.type == Move || operation.type == Arc)
+        {
+            destination = operation.p;
+            return true;
+        }
+    }
+    return false;
+}
+
+void GCodeBuffer::keepRetractionConfigs()
+{
+    std::vector<std::pair<RetractionConfig*, RetractionConfig*>> kept; // each original and its copy
+    for (Operation& operation : operations)
+    {
+        if (!operation.retraction_config)
+        {
+            continue;
+        }
+        RetractionConfig* copy = nullptr;
+        for (const std::pair<RetractionConfig*, RetractionConfig*>& original_and_copy : kept)
+        {
+            if (original_and_copy.first == operation.retraction_config)
+            {
+                copy = original_and_copy.second;
+            }
+        }
+        if (!copy)
+        {
+            retraction_configs.push_back(*operation.retraction_config);
+            copy = &retraction_configs.back();
+            kept.emplace_back(operation.retraction_config, copy);
+        }
+        operation.retraction_config = copy;
+    }
+}
+
+bool GCodeExport::canReplay(const GCodeBuffer& buffer, int z_offset)
+{
+    return current_extruder == buffer.start_extruder && (!buffer.start_position_used || currentPosition == buffer.start_position + Point3(0, 0, z_offset));
+}
+
+bool GCodeExport::replay(const GCodeBuffer& buffer, int z_offset)
+{
+    if (!canReplay(buffer, z_offset))
+        return false;
+    const std::string text = buffer.text.str();
+    unsigned int text_pos = 0;
+    for (const GCodeBuffer::Operation& operation : buffer.operations)
+    {
+        output_stream->write(text.data() + text_pos, operation.text_start - text_pos);
+        text_pos = operation.text_end;
+        switch (operation.type)
+        {
+        case GCodeBuffer::Move:
+            if (operation.extruder == current_extruder)
+            {
+                formattedXY = text.data() + operation.text_start;
+                formattedXYLength = operation.text_end - operation.text_start;
+            }
+            writeMove(operation.p.x, operation.p.y, operation.p.z + z_offset, operation.value, operation.amount);
+            formattedXY = nullptr;
+            break;
+        case GCodeBuffer::Arc:
+            writeArc(Point(operation.p.x, operation.p.y), operation.center, operation.clockwise, operation.value, operation.amount);
+            break;
+        case GCodeBuffer::Retraction:
+            writeRetraction(operation.retraction_config, operation.value);
+            break;
+        case GCodeBuffer::SwitchExtruder:
+            switchExtruder(operation.value);
+            break;
+        case GCodeBuffer::SetZ:
+            setZ(operation.value + z_offset);
+            break;
+        case GCodeBuffer::Fan:
+            writeFanCommand(operation.value);
+            break;
+        case GCodeBuffer::Delay:
+            writeDelay(operation.amount);
+            break;
+        case GCodeBuffer::UpdatePrintTime:
+            updateTotalPrintTime();
+            break;
+        case GCodeBuffer::ResetExtrusionValue:
+            resetExtrusionValue();
+            break;
+        case GCodeBuffer::Feature:
+            setFeature(operation.feature);
+            break;
+        }
+    }
+    output_stream->write(text.data() + text_pos, text.size() - text_pos);
+    return true;
 }
 
 }//namespace cura
@@ -6,9 +6,12 @@
 
 #include <stdio.h>
 #include <deque> // for extrusionAmountAtPreviousRetractions
+#include <sstream>
+#include <vector>
 
 #include "settings.h"
 #include "utils/intpoint.h"
+#include "printStatistics.h"
 #include "timeEstimate.h"
 
 namespace cura {
@@ -90,6 +93,105 @@ private:
     }
 };
 
+/*!
+ * The GCode of a layer as recorded by a GCodeExport, so that it can be formatted on another thread than the one writing
+ * the GCode, see GCodeExport::startRecording.
+ *
+ * Everything which doesn't depend on the state of the export, like the comments and the coordinates of the moves, is
+ * formatted when recording. The rest, like the extrusion values, the feedrates, the retractions and switching the welder
+ * on and off, is kept as operations which GCodeExport::replay performs on the export writing the GCode, exactly as if
+ * the layer was written to it directly.
+ */
+class GCodeBuffer
+{
+    friend class GCodeExport;
+private:
+    enum OperationType
+    {
+        Move,
+        Arc,
+        Retraction,
+        SwitchExtruder,
+        SetZ,
+        Fan,
+        Delay,
+        UpdatePrintTime,
+        ResetExtrusionValue,
+        Feature
+    };
+    struct Operation
+    {
+        OperationType type;
+        Point3 p; //!< The destination of a Move or an Arc
+        Point center; //!< The center of an Arc
+        bool clockwise; //!< Whether an Arc goes clockwise
+        int value; //!< The speed of a Move or an Arc, the extruder, the Z, the fan speed, or whether a Retraction is forced
+        double amount; //!< The extrusion of a Move or an Arc, or the time of a Delay
+        RetractionConfig* retraction_config; //!< The config of a Retraction
+        unsigned int text_start; //!< The start in the text of the formatted coordinates of a Move; the text before is written before the operation
+        unsigned int text_end; //!< The end in the text of the formatted coordinates of a Move
+        int extruder; //!< The extruder for which the coordinates of a Move were formatted
+        const char* feature; //!< The name of a Feature
+    };
+    std::vector<Operation> operations;
+    std::deque<RetractionConfig> retraction_configs; //!< Copies of the configs of the retractions, see keepRetractionConfigs
+    std::ostringstream text; //!< The formatted text, with all text written between operations
+    Point3 start_position; //!< The position the recording assumed to start from
+    int start_extruder; //!< The extruder the recording assumed to start with
+    bool start_position_used; //!< Whether the recorded GCode depends on the start position, other than through the moves
+    bool moved; //!< Whether a move was recorded, after which the position no longer depends on the start position
+public:
+    /*!
+     * The heap memory held by the recording, in bytes.
+     */
+    size_t getMemoryUsage()
+    {
+        std::streamoff text_size = text.tellp();
+        return operations.capacity() * sizeof(Operation) + ((text_size > 0)? text_size : 0);
+    }
+
+    /*!
+     * Remove everything recorded, keeping the memory for the next recording.
+     */
+    void clear()
+    {
+        operations.clear();
+        retraction_configs.clear();
+        text.str(std::string());
+        text.clear();
+    }
+
+    /*!
+     * The position the recording assumed to start from.
+     */
+    Point3 getStartPosition() const
+    {
+        return start_position;
+    }
+
+    /*!
+     * The extruder the recording assumed to start with.
+     */
+    int getStartExtruder() const
+    {
+        return start_extruder;
+    }
+
+    /*!
+     * The destination of the first move recorded.
+     *
+     * \param destination Set to the destination, if there is a move
+     * \return Whether any move was recorded
+     */
+    bool getFirstMove(Point3& destination) const;
+
+    /*!
+     * Make the retractions refer to copies of their configs kept in the buffer, so that the recording can still be
+     * replayed once the configs it was recorded with are gone.
+     */
+    void keepRetractionConfigs();
+};
+
 //The GCodeExport class writes the actual GCode. This is the only class that knows how GCode looks and feels.
 //  Any customizations on GCodes flavors are done in this class.
 class GCodeExport
@@ -129,15 +231,92 @@ private:
     //std::string welder_off = "G4 P0\nM42 P0 S0\n";//@ Gcode to turn welder off
     std::string welder_on;//@ GCode to turn welder on
     std::string welder_off;//@ GCode to turn welder off
+    bool welderOnDwells; //@ whether welder_on has a G4, which waits for the moves to finish
+    double welderOnDwellTime; //@ the time the G4s of welder_on wait, unit s
+    bool welderOffDwells; //@ whether welder_off has a G4
+    double welderOffDwellTime; //@ the time the G4s of welder_off wait, unit s
     double min_dist_welder_off; //@ minimum distance to move with welder off, unit mm
     bool isWelding; //@ true = welder is on, false = welder is off
+    int welderStartCount; //@ number of times the welder was turned on, i.e. the number of arc cycles
     bool isMetalPrinting; //@ true = metal printing, false = not metal printing
+
+    PrintStatistics* statistics; //!< Where the statistics of the GCode are added up, if anywhere, see setStatistics
+    int statisticsLayer; //!< The layer of the last layer comment
+    std::string statisticsFeature; //!< The feature of the last type comment
+    unsigned int statisticsEntry; //!< The index in statistics of the current layer and feature
+
+    GCodeBuffer* recording; //!< The buffer into which the GCode is recorded rather than written, see startRecording
+    std::ostream* recordingOutputStream; //!< The output stream to return to after recording
+    const char* formattedXY; //!< When replaying a move, its coordinates as formatted when recording
+    unsigned int formattedXYLength;
+
+    /*!
+     * Record an operation, when recording.
+     * \return Whether the operation was recorded, so it shouldn't be performed
+     */
+    bool record(GCodeBuffer::OperationType type, int value = 0, double amount = 0.0, RetractionConfig* retraction_config = nullptr);
+    void writeXY(int x, int y);
+    void writeMillimeters(int64_t microns); //!< Write a length in microns as millimeters with three decimals
+    void writeExtrusionAmount(double amount); //!< Write an E value with five decimals
+
+    /*!
+     * Select the entry of the statistics for the current layer and feature.
+     */
+    void selectStatisticsEntry();
+
+    /*!
+     * Tag the time of the moves from now on with the current statistics entry and with whether the welder is on.
+     */
+    void updateEstimateTag();
+
+    /*!
+     * Add a move to the current statistics entry.
+     *
+     * \param length The length of the move in mm
+     * \param extrusion_mm3_per_mm The extrusion of the move, zero for a travel move
+     */
+    void addMoveStatistics(double length, double extrusion_mm3_per_mm);
+
+    /*!
+     * The writers of moves and arcs for the flavor and for metal printing, selected by selectEmitters whenever either
+     * changes, so writing a move doesn't check them over and over.
+     */
+    void (GCodeExport::*moveEmitter)(int x, int y, int z, int speed, double extrusion_mm3_per_mm);
+    void (GCodeExport::*arcEmitter)(Point p, Point center, bool clockwise, int speed, double extrusion_mm3_per_mm);
+    void selectEmitters();
+
+    /*!
+     * The current position as planned in the print time estimate. When metal printing the moves don't move the E axis,
+     * so the E axis stays where the last retraction or prime left it.
+     */
+    TimeEstimateCalculator::Position getEstimatePosition();
+
+    void emitBFBMove(int x, int y, int z, int speed, double extrusion_mm3_per_mm); //!< Bits From Bytes: RPM rather than E values
+    void emitArcAsMove(Point p, Point center, bool clockwise, int speed, double extrusion_mm3_per_mm); //!< For flavors without arcs
+
+    /*!
+     * Write a move with E values, or with the welder switched on and off in their place.
+     *
+     * \tparam volumetric Whether E is in mm^3 and the firmware retracts, as for UltiGCode and RepRap (Volumetric)
+     * \tparam welding Whether this is metal printing
+     */
+    template<bool volumetric, bool welding>
+    void emitMove(int x, int y, int z, int speed, double extrusion_mm3_per_mm);
+    template<bool volumetric, bool welding>
+    void emitArc(Point p, Point center, bool clockwise, int speed, double extrusion_mm3_per_mm);
+
+    /*!
+     * Undo the Z hop and the retraction and switch the welder on as needed before an extrusion move.
+     */
+    template<bool firmware_retraction, bool welding>
+    void startExtrusion();
 public:
 
     GCodeExport();
     ~GCodeExport();
 
     void setOutputStream(std::ostream* stream);
+    std::ostream* getOutputStream() { return output_stream; }
 
     void setExtruderOffset(int id, Point p);
     Point getExtruderOffset(int id);
@@ -173,9 +352,22 @@ public:
     void updateTotalPrintTime();
     void resetTotalPrintTimeAndFilament();
 
+    /*!
+     * Add up the print time, travel distance, extrusion volume and arc-on time of each feature on each layer from now on,
+     * until the next call. The statistics are cleared, and the times are filled in by finalize.
+     *
+     * \param statistics Where to add up the statistics, or nullptr not to
+     */
+    void setStatistics(PrintStatistics* statistics);
+
+    /*!
+     * Set the feature to which the statistics of what is written from now on are added, without writing a type comment.
+     */
+    void setFeature(const char* feature);
+
     void writeComment(std::string comment);
-    void writeTypeComment(const char* type);
-    void writeLayerComment(int layer_nr);
+    void writeTypeComment(const char* type); //!< Also sets the feature of the statistics, see setFeature
+    void writeLayerComment(int layer_nr); //!< Also sets the layer of the statistics
 
     void writeLine(const char* line);
 
@@ -189,6 +381,16 @@ public:
 private:
     void writeMove(int x, int y, int z, int speed, double extrusion_per_mm);
 public:
+    /*!
+     * Write an extrusion move along an arc in the XY plane, as G2 or G3, from the current position to \p p at the
+     * current Z. Flavors without arcs and non-extruding moves get a straight move instead.
+     *
+     * \param p The end of the arc, which lies at the same distance from \p center as the current position
+     * \param center The center of the arc
+     * \param clockwise Whether the arc goes clockwise (G2) rather than counterclockwise (G3)
+     */
+    void writeArc(Point p, Point center, bool clockwise, int speed, double extrusion_mm3_per_mm);
+
     void writeRetraction(RetractionConfig* config, bool force=false);
 
     void switchExtruder(int newExtruder);
@@ -201,11 +403,60 @@ public:
     void writeBedTemperatureCommand(int temperature, bool wait = false);
 
     void finalize(int maxObjectHeight, int moveSpeed, const char* endCode);
+
+    /*!
+     * Flush the output stream, so everything written so far reaches the file or socket behind it.
+     */
+    void flush();
+
+    /*!
+     * Set the limits with which the firmware plans the moves, for the print time estimate.
+     */
+    void setMachineLimits(const TimeEstimateCalculator::MachineLimits& limits);
+    const TimeEstimateCalculator::MachineLimits& getMachineLimits();
+
+    /*!
+     * The memory held by the print time estimate, in bytes.
+     */
+    size_t getEstimateMemoryUsage() const
+    {
+        return estimateCalculator.getMemoryUsage();
+    }
+
     void setWelderOn(std::string welder_on_gcode);
     void setWelderOff(std::string welder_off_gcode);
     void setMinDistWelderOff(double machine_min_dist_welder_off);
     void setIsMetalPrinting(bool machine_metal_printing);
     void setIsWelding(bool is_welding);
+    int getWelderStartCount();
+
+    /*!
+     * Record everything written to this export into \p buffer, instead of writing it, until stopRecording.
+     * This is used on a copy of the export which will write the GCode, so that the GCode of a layer can be formatted
+     * while the layers before it are still being written. The moves, retractions, extruder switches, fan commands, delays
+     * and comments are recorded; temperature commands and finalize are not supported while recording.
+     *
+     * \param buffer The buffer to record into, which is cleared first
+     * \param start_position The position at which the export will be when the recording is replayed, as far as known
+     */
+    void startRecording(GCodeBuffer* buffer, Point3 start_position);
+    void stopRecording();
+
+    /*!
+     * Write the GCode recorded into \p buffer, with the same result as writing it to this export directly.
+     * Nothing is written when the recording assumed another extruder, or another start position where the GCode
+     * depends on it; then the layer has to be written directly.
+     *
+     * \param z_offset Added to the Z of everything recorded, to write the recording of one layer for another layer
+     * which would be written the same but for its Z
+     * \return Whether the recording was written
+     */
+    bool replay(const GCodeBuffer& buffer, int z_offset = 0);
+
+    /*!
+     * Whether replay would write \p buffer.
+     */
+    bool canReplay(const GCodeBuffer& buffer, int z_offset = 0);
 };
 
 }
@@ -1,8 +1,105 @@
 #include "gcodePlanner.h"
 #include "pathOrderOptimizer.h"
+#include "utils/gettime.h"
 
 namespace cura {
 
+namespace
+{
+
+/*!
+ * Check whether points[start] to points[end] lie on a circular arc, and find that arc.
+ *
+ * The circle goes through the first, the middle and the last point, with its center rounded to whole microns as it is
+ * written. All points have to lie within \p tolerance of the circle, all lines between them within \p tolerance of the
+ * arc, and the points have to turn one way only, less than a full turn in total.
+ *
+ * \param center Set to the center of the arc
+ * \param clockwise Set to whether the arc goes clockwise
+ * \return Whether the points lie on an arc
+ */
+bool fitArc(const std::vector<Point>& points, unsigned int start, unsigned int end, int tolerance, Point& center, bool& clockwise)
+{
+    const Point a = points[start];
+    const Point b = points[(start + end) / 2];
+    const Point c = points[end];
+    const double abX = b.X - a.X, abY = b.Y - a.Y;
+    const double acX = c.X - a.X, acY = c.Y - a.Y;
+    const double d = 2.0 * (abX * acY - abY * acX);
+    if (std::abs(d) < 1.0)
+    {
+        return false; // (nearly) on a line
+    }
+    const double ab2 = abX * abX + abY * abY;
+    const double ac2 = acX * acX + acY * acY;
+    const double centerX = a.X + (acY * ab2 - abY * ac2) / d;
+    const double centerY = a.Y + (abX * ac2 - acX * ab2) / d;
+    const double max_radius = MM2INT(1000.0);
+    if (std::abs(centerX - a.X) > max_radius || std::abs(centerY - a.Y) > max_radius)
+    {
+        return false; // a circle this large is a straight line for the printer
+    }
+    center = Point(std::llround(centerX), std::llround(centerY));
+    clockwise = d < 0;
+    const double radius = std::sqrt(double(a.X - center.X) * (a.X - center.X) + double(a.Y - center.Y) * (a.Y - center.Y));
+    double sweep = 0.0;
+    for (unsigned int idx = start; idx < end; idx++)
+    {
+        const Point p0 = points[idx];
+        const Point p1 = points[idx + 1];
+        if (std::abs(std::sqrt(double(p1.X - center.X) * (p1.X - center.X) + double(p1.Y - center.Y) * (p1.Y - center.Y)) - radius) > tolerance)
+        {
+            return false;
+        }
+        const double cross = double(p0.X - center.X) * (p1.Y - center.Y) - double(p0.Y - center.Y) * (p1.X - center.X);
+        if ((cross < 0) != clockwise || cross == 0)
+        {
+            return false; // turning the other way, or not moving
+        }
+        // the line comes closest to the center between its ends, where the arc bulges out furthest from it
+        const double lineX = p1.X - p0.X, lineY = p1.Y - p0.Y;
+        const double along = std::max(0.0, std::min(1.0, -(double(p0.X - center.X) * lineX + double(p0.Y - center.Y) * lineY) / (lineX * lineX + lineY * lineY)));
+        const double closestX = p0.X - center.X + lineX * along, closestY = p0.Y - center.Y + lineY * along;
+        const double closest = std::sqrt(closestX * closestX + closestY * closestY);
+        if (radius - closest > tolerance)
+        {
+            return false; // the arc bulges too far from the line
+        }
+        const double half_chord = std::sqrt(lineX * lineX + lineY * lineY) / 2;
+        sweep += 2 * std::asin(std::min(1.0, half_chord / radius));
+    }
+    return sweep < 2 * M_PI - 0.1;
+}
+
+/*!
+ * The time of a straight move which starts and ends at given speeds and, when it is long enough, goes at \p speed in between.
+ *
+ * \param length The length of the move in mm
+ * \param speed The speed of the move in mm/s
+ * \param entry_speed The speed at the start, at most \p speed
+ * \param exit_speed The speed at the end, at most \p speed
+ * \param acceleration The acceleration in mm/s^2
+ */
+double getMoveTime(double length, double speed, double entry_speed, double exit_speed, double acceleration)
+{
+    const double accelerate_distance = (speed * speed - entry_speed * entry_speed) / (2 * acceleration);
+    const double decelerate_distance = (speed * speed - exit_speed * exit_speed) / (2 * acceleration);
+    if (accelerate_distance + decelerate_distance <= length)
+    {
+        return (2 * speed - entry_speed - exit_speed) / acceleration + (length - accelerate_distance - decelerate_distance) / speed;
+    }
+    const double low = std::min(entry_speed, exit_speed);
+    const double high = std::max(entry_speed, exit_speed);
+    const double peak2 = acceleration * length + (low * low + high * high) / 2; // the square of the speed where speeding up turns into slowing down
+    if (peak2 < high * high)
+    {
+        return (std::sqrt(low * low + 2 * acceleration * length) - low) / acceleration; // too short to even get from one speed to the other
+    }
+    return (2 * std::sqrt(peak2) - low - high) / acceleration;
+}
+
+}//anonymous namespace
+
 GCodePath* GCodePlanner::getLatestPathWithConfig(GCodePathConfig* config)
 {
     if (paths.size() > 0 && paths[paths.size()-1].config == config && !paths[paths.size()-1].done)
@@ -13,6 +110,10 @@ GCodePath* GCodePlanner::getLatestPathWithConfig(GCodePathConfig* config)
     ret->config = config;
     ret->extruder = currentExtruder;
     ret->done = false;
+    ret->pointIdx = points.size();
+    ret->pointCount = 0;
+    ret->length = 0.0;
+    ret->cornerFactor = 0.0;
     return ret;
 }
 
@@ -22,16 +123,30 @@ void GCodePlanner::forceNewPathStart()
         paths[paths.size()-1].done = true;
 }
 
-GCodePlanner::GCodePlanner(GCodeExport& gcode, RetractionConfig* retraction_config, int travelSpeed, int retractionMinimalDistance)
-: gcode(gcode), travelConfig(retraction_config, "MOVE")
+GCodePlanner::GCodePlanner(GCodeExport& gcode, RetractionConfig* retraction_config, int travelSpeed, int retractionMinimalDistance, std::vector<Point>* pointPool)
+: gcode(gcode), points(pointPool ? *pointPool : ownPoints), travelConfig(retraction_config, "MOVE")
 {
-    lastPosition = gcode.getPositionXY();
+    points.clear();
+    startPosition = gcode.getPositionXY();
+    lastPosition = startPosition;
     travelConfig.setSpeed(travelSpeed);
     comb = nullptr;
+    combOwned = true;
     extrudeSpeedFactor = 100;
     travelSpeedFactor = 100;
     extraTime = 0.0;
     totalPrintTime = 0.0;
+    travelRefinementTime = 0.0;
+    travelRefinementSaved = 0;
+    welderOffDistance = 0;
+    welderCycleCost = 0;
+    arcTolerance = 0;
+    mergeTolerance = 0;
+    movesMerged = 0;
+    movesPlanned = 0;
+    const TimeEstimateCalculator::MachineLimits& limits = gcode.getMachineLimits();
+    acceleration = std::min(limits.acceleration, std::min(limits.max_acceleration[TimeEstimateCalculator::X_AXIS], limits.max_acceleration[TimeEstimateCalculator::Y_AXIS]));
+    jerk = limits.max_xy_jerk;
     forceRetraction = false;
     alwaysRetract = false;
     currentExtruder = gcode.getExtruderNr();
@@ -39,7 +154,7 @@ GCodePlanner::GCodePlanner(GCodeExport& gcode, RetractionConfig* retraction_conf
 }
 GCodePlanner::~GCodePlanner()
 {
-    if (comb)
+    if (comb && combOwned)
         delete comb;
 }
 
@@ -60,7 +175,7 @@ void GCodePlanner::addTravel(Point p)
         {
             for(unsigned int n=0; n<pointList.size(); n++)
             {
-                path->points.push_back(pointList[n]);
+                addPoint(path, pointList[n]);
             }
         }else{
             if (!shorterThen(lastPosition - p, retractionMinimalDistance))
@@ -71,13 +186,13 @@ void GCodePlanner::addTravel(Point p)
         if (!shorterThen(lastPosition - p, retractionMinimalDistance))
             path->retract = true;
     }
-    path->points.push_back(p);
+    addPoint(path, p);
     lastPosition = p;
 }
 
 void GCodePlanner::addExtrusionMove(Point p, GCodePathConfig* config)
 {
-    getLatestPathWithConfig(config)->points.push_back(p);
+    addPoint(getLatestPathWithConfig(config), p);
     lastPosition = p;
 }
 
@@ -116,9 +231,17 @@ void GCodePlanner::addPolygonsByOptimizer(Polygons& polygons, GCodePathConfig* c
 {
     //log("addPolygonsByOptimizer");
     PathOrderOptimizer orderOptimizer(lastPosition);
+    orderOptimizer.welderOffDistance = welderOffDistance;
+    orderOptimizer.welderCycleCost = welderCycleCost;
     for(unsigned int i=0;i<polygons.size();i++)
         orderOptimizer.addPolygon(polygons[i]);
     orderOptimizer.optimize();
+    if (travelRefinementTime > 0)
+    {
+        TimeKeeper timer;
+        travelRefinementSaved += orderOptimizer.refine(travelRefinementTime);
+        travelRefinementTime -= timer.restart();
+    }
     for(unsigned int i=0;i<orderOptimizer.polyOrder.size();i++)
     {
         int nr = orderOptimizer.polyOrder[i];
@@ -128,9 +251,17 @@ void GCodePlanner::addPolygonsByOptimizer(Polygons& polygons, GCodePathConfig* c
 void GCodePlanner::addLinesByOptimizer(Polygons& polygons, GCodePathConfig* config)
 {
     LineOrderOptimizer orderOptimizer(lastPosition);
+    orderOptimizer.welderOffDistance = welderOffDistance;
+    orderOptimizer.welderCycleCost = welderCycleCost;
     for(unsigned int i=0;i<polygons.size();i++)
         orderOptimizer.addPolygon(polygons[i]);
     orderOptimizer.optimize();
+    if (travelRefinementTime > 0)
+    {
+        TimeKeeper timer;
+        travelRefinementSaved += orderOptimizer.refine(travelRefinementTime);
+        travelRefinementTime -= timer.restart();
+    }
     for(unsigned int i=0;i<orderOptimizer.polyOrder.size();i++)
     {
         int nr = orderOptimizer.polyOrder[i];
@@ -146,7 +277,21 @@ void GCodePlanner::forceMinimalLayerTime(double minTime, int minimalSpeed, doubl
         double minExtrudeTime = minTime - travelTime;
         if (minExtrudeTime < 1)
             minExtrudeTime = 1;
-        double factor = extrudeTime / minExtrudeTime;
+        // slowing the extrusion down by a factor makes it take movingTime / factor + cornerTime * factor
+        double movingTime = 0.0;
+        double cornerTime = 0.0;
+        for(unsigned int n=0; n<paths.size(); n++)
+        {
+            GCodePath* path = &paths[n];
+            if (path->config->getExtrusionMM3perMM() == 0)
+                continue;
+            double speed = path->config->getSpeed();
+            movingTime += path->length / speed;
+            cornerTime += path->cornerFactor * speed / acceleration;
+        }
+        double factor = movingTime / minExtrudeTime;
+        if (cornerTime > 0.0)
+            factor = (minExtrudeTime - sqrt(std::max(0.0, minExtrudeTime * minExtrudeTime - 4 * cornerTime * movingTime))) / (2 * cornerTime);
         for(unsigned int n=0; n<paths.size(); n++)
         {
             GCodePath* path = &paths[n];
@@ -163,11 +308,12 @@ void GCodePlanner::forceMinimalLayerTime(double minTime, int minimalSpeed, doubl
         else
             factor = getExtrudeSpeedFactor() / 100.0;
 
-        if (minTime - (extrudeTime / factor) - travelTime > 0.1)
+        double slowExtrudeTime = movingTime / factor + cornerTime * factor;
+        if (minTime - slowExtrudeTime - travelTime > 0.1)
         {
-            this->extraTime = minTime - (extrudeTime / factor) - travelTime;
+            this->extraTime = minTime - slowExtrudeTime - travelTime;
         }
-        this->totalPrintTime = (extrudeTime / factor) + travelTime;
+        this->totalPrintTime = slowExtrudeTime + travelTime;
     }else{
         this->totalPrintTime = totalTime;
     }
@@ -175,43 +321,110 @@ void GCodePlanner::forceMinimalLayerTime(double minTime, int minimalSpeed, doubl
 
 void GCodePlanner::getTimes(double& travelTime, double& extrudeTime)
 {
-    travelTime = 0.0;
-    extrudeTime = 0.0;
-    Point p0 = gcode.getPositionXY();
+    // Walk the moves of all paths one move behind, as the speed at the end of a move depends on the move after it. The
+    // time of the moves of a path at its speed is added up in its cornerFactor, which becomes a factor at the end.
+    for(unsigned int n=0; n<paths.size(); n++)
+    {
+        paths[n].length = 0.0;
+        paths[n].cornerFactor = 0.0;
+    }
+    const double stopSpeed = jerk / 2; // the speed from which the printer stops, and to which it starts, instantly
+    GCodePath* pending = nullptr; // the path of the move of which the speed at the end isn't known yet
+    double pendingLength = 0.0;
+    double pendingEntrySpeed = 0.0;
+    double pendingDirX = 0.0;
+    double pendingDirY = 0.0;
+    bool pendingStops = false; // whether the printer stops after the pending move
+    auto finishPending = [&](double exitSpeed)
+    {
+        double speed = pending->config->getSpeed();
+        pending->length += pendingLength;
+        pending->cornerFactor += getMoveTime(pendingLength, speed, pendingEntrySpeed, std::min(exitSpeed, speed), acceleration);
+    };
+    Point p0 = startPosition;
     for(unsigned int n=0; n<paths.size(); n++)
     {
         GCodePath* path = &paths[n];
-        for(unsigned int i=0; i<path->points.size(); i++)
+        double speed = path->config->getSpeed();
+        bool stopsBefore = path->retract || (n > 0 && path->extruder != paths[n-1].extruder);
+        for(unsigned int i=0; i<path->pointCount; i++)
         {
-            double thisTime = vSizeMM(p0 - path->points[i]) / double(path->config->getSpeed());
-            if (path->config->getExtrusionMM3perMM() != 0)
-                extrudeTime += thisTime;
-            else
-                travelTime += thisTime;
-            p0 = path->points[i];
+            Point p1 = points[path->pointIdx + i];
+            double length = vSizeMM(p1 - p0);
+            if (length <= 0.0)
+                continue;
+            double dirX = INT2MM(p1.X - p0.X) / length;
+            double dirY = INT2MM(p1.Y - p0.Y) / length;
+            p0 = p1;
+            // in metal printing the welder is switched off for a long travel and on again after it, waiting for the moves to finish
+            bool welderCycle = welderOffDistance > 0 && path->config == &travelConfig && length > INT2MM(welderOffDistance);
+            double junctionSpeed = stopSpeed;
+            if (pending)
+            {
+                if (!pendingStops && !stopsBefore && !welderCycle)
+                {
+                    // the printer takes the corner at the speed at which the change of velocity is the jerk
+                    double change = sqrt((dirX - pendingDirX) * (dirX - pendingDirX) + (dirY - pendingDirY) * (dirY - pendingDirY));
+                    junctionSpeed = (change > 0.0)? jerk / change : speed;
+                }
+                junctionSpeed = std::min(junctionSpeed, std::min(speed, double(pending->config->getSpeed())));
+                finishPending(junctionSpeed);
+            }
+            pending = path;
+            pendingLength = length;
+            pendingEntrySpeed = std::min(junctionSpeed, speed);
+            pendingDirX = dirX;
+            pendingDirY = dirY;
+            pendingStops = welderCycle;
+            stopsBefore = false;
         }
     }
+    if (pending)
+        finishPending(stopSpeed);
+
+    travelTime = 0.0;
+    extrudeTime = 0.0;
+    for(unsigned int n=0; n<paths.size(); n++)
+    {
+        GCodePath* path = &paths[n];
+        double speed = path->config->getSpeed();
+        double time = path->cornerFactor;
+        path->cornerFactor = (path->length > 0.0)? (time - path->length / speed) * acceleration / speed : 0.0;
+        if (path->config->getExtrusionMM3perMM() != 0)
+            extrudeTime += time;
+        else
+            travelTime += time;
+    }
 }
 
 void GCodePlanner::writeGCode(bool liftHeadIfNeeded, int layerThickness)
 {
+    writeGCode(gcode, liftHeadIfNeeded, layerThickness);
+}
+
+void GCodePlanner::writeGCode(GCodeExport& output, bool liftHeadIfNeeded, int layerThickness)
+{
+    TRACE_ZONE("GCodePlanner::writeGCode");
     GCodePathConfig* lastConfig = nullptr;
-    int extruder = gcode.getExtruderNr();
+    int extruder = output.getExtruderNr();
+    movesMerged = 0;
+    movesPlanned = 0;
 
     for(unsigned int n=0; n<paths.size(); n++)
     {
         GCodePath* path = &paths[n];
+        countStat(Stat_PlannedMoves, path->pointCount);
         if (extruder != path->extruder)
         {
             extruder = path->extruder;
-            gcode.switchExtruder(extruder);
+            output.switchExtruder(extruder);
         }else if (path->retract)
         {
-            gcode.writeRetraction(path->config->retraction_config);
+            output.writeRetraction(path->config->retraction_config);
         }
         if (path->config != &travelConfig && lastConfig != path->config)
         {
-            gcode.writeTypeComment(path->config->name);
+            output.writeTypeComment(path->config->name);
             lastConfig = path->config;
         }
         int speed = path->config->getSpeed();
@@ -221,36 +434,36 @@ void GCodePlanner::writeGCode(bool liftHeadIfNeeded, int layerThickness)
         else
             speed = speed * travelSpeedFactor / 100;
 
-        if (path->points.size() == 1 && path->config != &travelConfig && shorterThen(gcode.getPositionXY() - path->points[0], path->config->getLineWidth() * 2))
+        if (path->pointCount == 1 && path->config != &travelConfig && shorterThen(output.getPositionXY() - points[path->pointIdx], path->config->getLineWidth() * 2))
         {
             //Check for lots of small moves and combine them into one large line
-            Point p0 = path->points[0];
+            Point p0 = points[path->pointIdx];
             unsigned int i = n + 1;
-            while(i < paths.size() && paths[i].points.size() == 1 && shorterThen(p0 - paths[i].points[0], path->config->getLineWidth() * 2))
+            while(i < paths.size() && paths[i].pointCount == 1 && shorterThen(p0 - points[paths[i].pointIdx], path->config->getLineWidth() * 2))
             {
-                p0 = paths[i].points[0];
+                p0 = points[paths[i].pointIdx];
                 i ++;
             }
             if (paths[i-1].config == &travelConfig)
                 i --;
             if (i > n + 2)
             {
-                p0 = gcode.getPositionXY();
+                p0 = output.getPositionXY();
                 for(unsigned int x=n; x<i-1; x+=2)
                 {
-                    int64_t new_width = vSize(p0 - paths[x].points[0]); // = old_length
-                    Point newPoint = (paths[x].points[0] + paths[x+1].points[0]) / 2;
+                    int64_t new_width = vSize(p0 - points[paths[x].pointIdx]); // = old_length
+                    Point newPoint = (points[paths[x].pointIdx] + points[paths[x+1].pointIdx]) / 2;
                     int64_t old_width = path->config->getLineWidth();
                     if (old_width > 0)
                     {
                         if (new_width > 0)
-                            gcode.writeMove(newPoint, speed * old_width / new_width, path->config->getExtrusionMM3perMM() * new_width / old_width);
+                            output.writeMove(newPoint, speed * old_width / new_width, path->config->getExtrusionMM3perMM() * new_width / old_width);
                         else 
-                            gcode.writeMove(newPoint, speed, path->config->getExtrusionMM3perMM());
+                            output.writeMove(newPoint, speed, path->config->getExtrusionMM3perMM());
                     }
-                    p0 = paths[x+1].points[0];
+                    p0 = points[paths[x+1].pointIdx];
                 }
-                gcode.writeMove(paths[i-1].points[0], speed, path->config->getExtrusionMM3perMM());
+                output.writeMove(points[paths[i-1].pointIdx], speed, path->config->getExtrusionMM3perMM());
                 n = i - 1;
                 continue;
             }
@@ -270,43 +483,157 @@ void GCodePlanner::writeGCode(bool liftHeadIfNeeded, int layerThickness)
         {
             //If we need to spiralize then raise the head slowly by 1 layer as this path progresses.
             float totalLength = 0.0;
-            int z = gcode.getPositionZ();
-            Point p0 = gcode.getPositionXY();
-            for(unsigned int i=0; i<path->points.size(); i++)
+            int z = output.getPositionZ();
+            Point p0 = output.getPositionXY();
+            for(unsigned int i=0; i<path->pointCount; i++)
             {
-                Point p1 = path->points[i];
+                Point p1 = points[path->pointIdx + i];
                 totalLength += vSizeMM(p0 - p1);
                 p0 = p1;
             }
 
             float length = 0.0;
-            p0 = gcode.getPositionXY();
-            for(unsigned int i=0; i<path->points.size(); i++)
+            p0 = output.getPositionXY();
+            for(unsigned int i=0; i<path->pointCount; i++)
             {
-                Point p1 = path->points[i];
+                Point p1 = points[path->pointIdx + i];
                 length += vSizeMM(p0 - p1);
                 p0 = p1;
-                gcode.setZ(z + layerThickness * length / totalLength);
-                gcode.writeMove(path->points[i], speed, path->config->getExtrusionMM3perMM());
+                output.setZ(z + layerThickness * length / totalLength);
+                output.writeMove(points[path->pointIdx + i], speed, path->config->getExtrusionMM3perMM());
             }
+        }else if (arcTolerance > 0 && path->config != &travelConfig && path->config->getExtrusionMM3perMM() > 0 && path->pointCount >= 3)
+        {
+            writePathWithArcs(output, path, speed);
+        }else if (mergeTolerance > 0 && path->config != &travelConfig && path->pointCount >= 2)
+        {
+            writePathMerged(output, path, speed);
         }else{
-            for(unsigned int i=0; i<path->points.size(); i++)
+            for(unsigned int i=0; i<path->pointCount; i++)
             {
-                gcode.writeMove(path->points[i], speed, path->config->getExtrusionMM3perMM());
+                output.writeMove(points[path->pointIdx + i], speed, path->config->getExtrusionMM3perMM());
             }
         }
     }
 
-    gcode.updateTotalPrintTime();
+    output.updateTotalPrintTime();
     if (liftHeadIfNeeded && extraTime > 0.0)
     {
-        gcode.writeComment("Small layer, adding delay");
+        output.writeComment("Small layer, adding delay");
         if (lastConfig)
-            gcode.writeRetraction(lastConfig->retraction_config, true);
-        gcode.setZ(gcode.getPositionZ() + MM2INT(3.0));
-        gcode.writeMove(gcode.getPositionXY(), travelConfig.getSpeed(), 0);
-        gcode.writeMove(gcode.getPositionXY() - Point(-MM2INT(20.0), 0), travelConfig.getSpeed(), 0);
-        gcode.writeDelay(extraTime);
+            output.writeRetraction(lastConfig->retraction_config, true);
+        output.setZ(output.getPositionZ() + MM2INT(3.0));
+        output.writeMove(output.getPositionXY(), travelConfig.getSpeed(), 0);
+        output.writeMove(output.getPositionXY() - Point(-MM2INT(20.0), 0), travelConfig.getSpeed(), 0);
+        output.writeDelay(extraTime);
+    }
+}
+
+void GCodePlanner::writePathWithArcs(GCodeExport& output, GCodePath* path, int speed)
+{
+    // the path starts at the current position
+    std::vector<Point> path_points;
+    path_points.reserve(path->pointCount + 1);
+    path_points.push_back(output.getPositionXY());
+    path_points.insert(path_points.end(), points.begin() + path->pointIdx, points.begin() + path->pointIdx + path->pointCount);
+
+    const unsigned int min_arc_lines = 3; // fewer lines gain little, and are most likely not meant to be an arc
+    const unsigned int last = path_points.size() - 1;
+    Point center;
+    bool clockwise;
+    unsigned int idx = 0;
+    while (idx < last)
+    {
+        // find the longest arc from idx, by doubling its length until it no longer fits and then bisecting
+        unsigned int fits = idx;
+        Point fit_center;
+        bool fit_clockwise = false;
+        unsigned int fails = last + 1;
+        for (unsigned int end = idx + min_arc_lines; end <= last; end = idx + (end - idx) * 2)
+        {
+            if (!fitArc(path_points, idx, end, arcTolerance, center, clockwise))
+            {
+                fails = end;
+                break;
+            }
+            fits = end;
+            fit_center = center;
+            fit_clockwise = clockwise;
+        }
+        if (fits > idx)
+        {
+            while (fails - fits > 1)
+            {
+                unsigned int end = (fits + fails) / 2;
+                if (fitArc(path_points, idx, end, arcTolerance, center, clockwise))
+                {
+                    fits = end;
+                    fit_center = center;
+                    fit_clockwise = clockwise;
+                }
+                else
+                {
+                    fails = end;
+                }
+            }
+            output.writeArc(path_points[fits], fit_center, fit_clockwise, speed, path->config->getExtrusionMM3perMM());
+            idx = fits;
+        }
+        else
+        {
+            idx++;
+            output.writeMove(path_points[idx], speed, path->config->getExtrusionMM3perMM());
+        }
+    }
+}
+
+void GCodePlanner::writePathMerged(GCodeExport& output, GCodePath* path, int speed)
+{
+    const unsigned int max_merged = 32; // the points checked for each extension of a move; longer runs are split
+    const double tolerance = mergeTolerance;
+    const unsigned int end = path->pointIdx + path->pointCount;
+    Point last = output.getPositionXY(); // the end of the last move written
+    unsigned int run_start = end; // the first of the points the pending move replaces, or end if there's no pending move
+    unsigned int pending = end; // the end of the pending move
+    movesPlanned += path->pointCount;
+    for (unsigned int idx = path->pointIdx; idx < end; idx++)
+    {
+        const Point p = points[idx];
+        if (p == ((pending < end)? points[pending] : last))
+        {
+            movesMerged++; // doesn't move
+            continue;
+        }
+        if (pending < end)
+        {
+            // the move from last to p replaces the pending move if the points it passes stay within the tolerance of it, in order
+            bool merges = idx - run_start <= max_merged;
+            const double dX = p.X - last.X, dY = p.Y - last.Y;
+            const double length2 = dX * dX + dY * dY;
+            double along_before = 0.0;
+            for (unsigned int run_idx = run_start; run_idx < idx && merges; run_idx++)
+            {
+                const double vX = points[run_idx].X - last.X, vY = points[run_idx].Y - last.Y;
+                const double along = dX * vX + dY * vY;
+                const double across = dX * vY - dY * vX;
+                merges = along >= along_before && along <= length2 && across * across <= tolerance * tolerance * length2;
+                along_before = along;
+            }
+            if (merges)
+            {
+                movesMerged++;
+                pending = idx;
+                continue;
+            }
+            output.writeMove(points[pending], speed, path->config->getExtrusionMM3perMM());
+            last = points[pending];
+        }
+        run_start = idx;
+        pending = idx;
+    }
+    if (pending < end)
+    {
+        output.writeMove(points[pending], speed, path->config->getExtrusionMM3perMM());
     }
 }
 
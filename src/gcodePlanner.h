@@ -17,8 +17,23 @@ public:
     GCodePathConfig* config;
     bool retract;
     int extruder;
-    std::vector<Point> points;
+    unsigned int pointIdx; //!< The index of the first point of this path in GCodePlanner::points
+    unsigned int pointCount; //!< The number of points of this path
     bool done;//Path is finished, no more moves should be added, and a new path should be started instead of any appending done to this one.
+    double length; //!< The length of this path in mm, from where the path before it ends; set by GCodePlanner::getTimes
+    double cornerFactor; //!< The time lost to slowing down and speeding up at the corners and stops, in full stops at the speed of the path; set by GCodePlanner::getTimes
+
+    /*!
+     * The time this path takes at a speed: moving its length at that speed, plus a full stop at that speed
+     * costing speed / acceleration for each of cornerFactor.
+     *
+     * \param speed The speed in mm/s
+     * \param acceleration The acceleration in mm/s^2
+     */
+    double getTime(double speed, double acceleration) const
+    {
+        return length / speed + cornerFactor * speed / acceleration;
+    }
 };
 
 //The GCodePlanner class stores multiple moves that are planned.
@@ -29,9 +44,13 @@ class GCodePlanner
 private:
     GCodeExport& gcode;
 
+    Point startPosition; //!< The position from which this layer is planned
     Point lastPosition;
     std::vector<GCodePath> paths;
+    std::vector<Point> ownPoints; //!< The storage of #points when no pool is given to the constructor
+    std::vector<Point>& points; //!< The points of all paths, path after path; only the last path gets points added
     Comb* comb;
+    bool combOwned; //!< Whether #comb was created by setCombBoundary, rather than borrowed through setComb
 
     GCodePathConfig travelConfig;
     int extrudeSpeedFactor;
@@ -42,12 +61,40 @@ private:
     bool alwaysRetract;
     double extraTime;
     double totalPrintTime;
+    double travelRefinementTime; //!< The time in seconds left for refining the order of the paths on this layer
+    int64_t travelRefinementSaved; //!< The travel distance saved by refining the order of the paths on this layer
+    int welderOffDistance; //!< In metal printing: the travel distance above which the welder is turned off, or zero
+    int welderCycleCost; //!< The travel distance which refining the order of the paths may add to save one welder off/on cycle
+    int arcTolerance; //!< The distance from the planned points within which extrusion moves may be written as arcs, or zero
+    int mergeTolerance; //!< The distance from the planned points within which the straight moves of a path are merged, or zero
+    unsigned int movesMerged; //!< The moves left out by the last writeGCode, see setMergeTolerance
+    unsigned int movesPlanned; //!< The moves of the paths the last writeGCode merged
+    double acceleration; //!< The acceleration of the printer in the XY plane, in mm/s^2, for the times of the paths
+    double jerk; //!< The change of speed in the XY plane which the printer makes instantly, in mm/s, for the times of the paths
     
 private:
     GCodePath* getLatestPathWithConfig(GCodePathConfig* config);
     void forceNewPathStart();
+    /*!
+     * Write the points of an extrusion path, replacing runs of them which lie on a circle within arcTolerance by arcs.
+     */
+    void writePathWithArcs(GCodeExport& output, GCodePath* path, int speed);
+    /*!
+     * Write the points of a path, leaving out those which lie within mergeTolerance of a line from the last point
+     * written to a later point, and those which don't move.
+     */
+    void writePathMerged(GCodeExport& output, GCodePath* path, int speed);
+    void addPoint(GCodePath* path, Point p)
+    {
+        points.push_back(p); // path is the last path, so its points end at the end of the pool
+        path->pointCount++;
+    }
 public:
-    GCodePlanner(GCodeExport& gcode, RetractionConfig* retraction_config, int travelSpeed, int retractionMinimalDistance);
+    /*!
+     * \param pointPool The buffer to keep the planned points in, which is cleared first; keeping one buffer over all
+     * layers reuses its memory. When null, the planner uses a buffer of its own.
+     */
+    GCodePlanner(GCodeExport& gcode, RetractionConfig* retraction_config, int travelSpeed, int retractionMinimalDistance, std::vector<Point>* pointPool = nullptr);
     ~GCodePlanner();
 
     bool setExtruder(int extruder)
@@ -63,14 +110,42 @@ public:
         return currentExtruder;
     }
 
+    /*!
+     * Plan the layer from another position than where the head is now, e.g. when the layer is planned before the previous
+     * layer is written. Must be called before anything is added.
+     */
+    void setStartPosition(Point p)
+    {
+        startPosition = p;
+        lastPosition = p;
+    }
+
+    Point getStartPosition()
+    {
+        return startPosition;
+    }
+
     void setCombBoundary(Polygons* polygons)
     {
-        if (comb)
+        if (comb && combOwned)
             delete comb;
         if (polygons)
             comb = new Comb(*polygons);
         else
             comb = nullptr;
+        combOwned = true;
+    }
+
+    /*!
+     * Comb the travel moves with a comb which was built beforehand, like that of SliceLayerPart::comb.
+     * The planner doesn't take ownership; \p comb is used until the next call to setComb or setCombBoundary.
+     */
+    void setComb(Comb* comb)
+    {
+        if (this->comb && combOwned)
+            delete this->comb;
+        this->comb = comb;
+        combOwned = false;
     }
 
     void setAlwaysRetract(bool alwaysRetract)
@@ -102,6 +177,77 @@ public:
         return this->travelSpeedFactor;
     }
 
+    /*!
+     * Set the time which may be spent on this layer on shortening the travel between the paths ordered by
+     * addPolygonsByOptimizer and addLinesByOptimizer, see PathOrderOptimizer::refine.
+     * 
+     * \param time The time in seconds; zero leaves the paths in the order of the optimizers
+     */
+    void setTravelRefinementTime(double time)
+    {
+        this->travelRefinementTime = time;
+    }
+    /*!
+     * Make refining the order of the paths count the welder off/on cycles of metal printing, see PathOrderOptimizer::refine.
+     * 
+     * \param welderOffDistance The travel distance above which the welder is turned off
+     * \param welderCycleCost The travel distance worth saving one welder off/on cycle
+     */
+    void setWelderCycleCost(int welderOffDistance, int welderCycleCost)
+    {
+        this->welderOffDistance = welderOffDistance;
+        this->welderCycleCost = welderCycleCost;
+    }
+    /*!
+     * Write runs of the points of extrusion paths which lie on a circular arc as G2/G3 arcs, see GCodeExport::writeArc.
+     * Only the XY plane is fitted, so spiralized paths keep their straight moves.
+     *
+     * \param tolerance The maximum distance of the arcs from the planned points and lines; zero writes straight moves only
+     */
+    void setArcTolerance(int tolerance)
+    {
+        this->arcTolerance = tolerance;
+    }
+    /*!
+     * Merge runs of straight extrusion moves of the same path which deviate from a straight line by at most
+     * \p tolerance into one move, and leave out moves which don't go anywhere. The slicer leaves many nearly collinear
+     * points on straight walls and tiny segments on curves, each of which costs the controller a line to read and plan.
+     * Travels aren't merged, since whether the welder is switched off goes by the length of each travel move, and
+     * neither are paths which are written as arcs or spiralized.
+     *
+     * \param tolerance The maximum distance of the merged moves from the planned points; zero merges nothing
+     */
+    void setMergeTolerance(int tolerance)
+    {
+        this->mergeTolerance = tolerance;
+    }
+    /*!
+     * The number of moves left out by merging in the last writeGCode, and the number of moves of the paths it merged.
+     */
+    unsigned int getMovesMerged()
+    {
+        return this->movesMerged;
+    }
+    unsigned int getMovesPlanned()
+    {
+        return this->movesPlanned;
+    }
+    /*!
+     * The travel distance saved by refining the order of the paths on this layer.
+     */
+    int64_t getTravelRefinementSaved()
+    {
+        return this->travelRefinementSaved;
+    }
+
+    /*!
+     * The heap memory held by the planned paths and their points, in bytes.
+     */
+    size_t getMemoryUsage() const
+    {
+        return paths.capacity() * sizeof(GCodePath) + points.capacity() * sizeof(Point);
+    }
+
     void addTravel(Point p);
 
     void addExtrusionMove(Point p, GCodePathConfig* config);
@@ -114,11 +260,25 @@ public:
 
     void addLinesByOptimizer(Polygons& polygons, GCodePathConfig* config);
 
+    /*!
+     * Slow down the extrusion moves so that the layer takes at least \p minTime, and plan a delay for the rest.
+     * Uses the lengths and corner factors of the paths computed by getTimes.
+     */
     void forceMinimalLayerTime(double minTime, int minimalSpeed, double travelTime, double extrusionTime);
-    
+
+    /*!
+     * Estimate the time of the travel and of the extrusion moves of this layer, slowing down at the corners and stops
+     * with the acceleration and jerk of the printer. This computes GCodePath::length and GCodePath::cornerFactor of all paths.
+     */
     void getTimes(double& travelTime, double& extrudeTime);
 
     void writeGCode(bool liftHeadIfNeeded, int layerThickness);
+
+    /*!
+     * Write the planned layer to another export than the one the planner was made for, like one recording the GCode
+     * of the layer into a GCodeBuffer.
+     */
+    void writeGCode(GCodeExport& output, bool liftHeadIfNeeded, int layerThickness);
 };
 
 }//namespace cura
@@ -0,0 +1,453 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#include "gpuSlicer.h"
+
+#ifdef HAVE_OPENCL
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#define CL_TARGET_OPENCL_VERSION 120
+#define CL_USE_DEPRECATED_OPENCL_1_2_APIS
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "utils/logoutput.h"
+#include "utils/parallel.h"
+#include "utils/trace.h"
+#endif
+
+namespace cura {
+
+#ifdef HAVE_OPENCL
+namespace
+{
+
+// The kernels read the corners of the faces from the vertices and faces of the mesh as they are stored.
+static_assert(sizeof(Point3) == 3 * sizeof(cl_int), "a vertex is read as three ints");
+static_assert(sizeof(MeshFace) == 6 * sizeof(cl_int), "a face is read as its three vertex indices and three connected faces");
+
+/*
+Each work item cuts one face. The layers a face gives a segment at are consecutive: the first layer above its lowest
+corner, up to the last one below its highest corner, so countSegments finds the first of them and how many there are,
+and writeSegments cuts the face at each, at the offset of the face in the segments of all faces. Which edges are cut, and
+which way around, is decided as in ActiveFace::slice, and the cuts are the integer divisions of Slicer::project2D, which
+round towards zero in OpenCL C as in C++.
+*/
+const char* kernel_source = R"CL(
+#define FACE_STRIDE 6
+
+typedef struct
+{
+    long x, y, z;
+} Vertex;
+
+typedef struct
+{
+    Vertex p[3];
+    int lowest; // the index of the lowest corner; only used when it's the only one that low
+    int highest; // the index of the highest corner; only used when it's the only one that high
+    long z_mid; // the height of the middle corner
+} Face;
+
+Face loadFace(__global const int* vertices, __global const int* faces, unsigned int face_idx)
+{
+    Face f;
+    for (int i = 0; i < 3; i++)
+    {
+        int vertex_idx = faces[face_idx * FACE_STRIDE + i];
+        f.p[i].x = vertices[vertex_idx * 3];
+        f.p[i].y = vertices[vertex_idx * 3 + 1];
+        f.p[i].z = vertices[vertex_idx * 3 + 2];
+    }
+    f.lowest = (f.p[0].z <= f.p[1].z)? ((f.p[0].z <= f.p[2].z)? 0 : 2) : ((f.p[1].z <= f.p[2].z)? 1 : 2);
+    f.highest = (f.p[0].z >= f.p[1].z)? ((f.p[0].z >= f.p[2].z)? 0 : 2) : ((f.p[1].z >= f.p[2].z)? 1 : 2);
+    f.z_mid = max(min(f.p[0].z, f.p[1].z), min(max(f.p[0].z, f.p[1].z), f.p[2].z));
+    return f;
+}
+
+// 1 when the plane at z cuts the edges from the lowest corner, 2 when it cuts those to the highest one, 0 when it gives no segment
+int getCrossing(const Face* f, long z)
+{
+    if (f->p[f->lowest].z < z && z <= f->z_mid)
+    {
+        return 1;
+    }
+    if (f->z_mid < z && z < f->p[f->highest].z)
+    {
+        return 2;
+    }
+    return 0;
+}
+
+__kernel void countSegments(__global const int* vertices, __global const int* faces, unsigned int face_count, __global const int* layer_z, unsigned int layer_count, __global unsigned int* first_layers, __global unsigned int* segment_counts)
+{
+    unsigned int face_idx = get_global_id(0);
+    if (face_idx >= face_count)
+    {
+        return;
+    }
+    Face f = loadFace(vertices, faces, face_idx);
+    unsigned int first = 0;
+    unsigned int end = layer_count;
+    while (first < end)
+    {
+        unsigned int middle = (first + end) / 2;
+        if (layer_z[middle] <= f.p[f.lowest].z)
+        {
+            first = middle + 1;
+        }
+        else
+        {
+            end = middle;
+        }
+    }
+    unsigned int layer_nr = first;
+    while (layer_nr < layer_count && getCrossing(&f, layer_z[layer_nr]) != 0)
+    {
+        layer_nr++;
+    }
+    first_layers[face_idx] = first;
+    segment_counts[face_idx] = layer_nr - first;
+}
+
+__kernel void writeSegments(__global const int* vertices, __global const int* faces, unsigned int face_count, __global const int* layer_z, __global const unsigned int* first_layers, __global const ulong* segment_offsets, __global long* segments)
+{
+    unsigned int face_idx = get_global_id(0);
+    if (face_idx >= face_count)
+    {
+        return;
+    }
+    Face f = loadFace(vertices, faces, face_idx);
+    unsigned int layer_nr = first_layers[face_idx];
+    for (ulong segment_idx = segment_offsets[face_idx]; segment_idx < segment_offsets[face_idx + 1]; segment_idx++, layer_nr++)
+    {
+        long z = layer_z[layer_nr];
+        int from_lowest = getCrossing(&f, z) == 1;
+        int apex = from_lowest? f.lowest : f.highest;
+        Vertex p0 = f.p[apex];
+        Vertex p_start = f.p[from_lowest? (apex + 2) % 3 : (apex + 1) % 3];
+        Vertex p_end = f.p[from_lowest? (apex + 1) % 3 : (apex + 2) % 3];
+        __global long* segment = segments + segment_idx * 4;
+        segment[0] = p0.x + (p_start.x - p0.x) * (z - p0.z) / (p_start.z - p0.z);
+        segment[1] = p0.y + (p_start.y - p0.y) * (z - p0.z) / (p_start.z - p0.z);
+        segment[2] = p0.x + (p_end.x - p0.x) * (z - p0.z) / (p_end.z - p0.z);
+        segment[3] = p0.y + (p_end.y - p0.y) * (z - p0.z) / (p_end.z - p0.z);
+    }
+}
+)CL";
+
+/*!
+ * Whether an OpenCL call succeeded; if not, warns that the layers are sliced on the CPU instead.
+ */
+bool check(cl_int error, const char* what)
+{
+    if (error != CL_SUCCESS)
+    {
+        logWarningOnce((std::string("opencl ") + what).c_str(), "OpenCL failed to %s (error %d); slicing on the CPU\n", what, error);
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * A buffer on the device, released when it goes out of scope.
+ */
+class DeviceBuffer
+{
+public:
+    cl_mem mem;
+
+    DeviceBuffer()
+    : mem(nullptr)
+    {
+    }
+
+    ~DeviceBuffer()
+    {
+        if (mem)
+        {
+            clReleaseMemObject(mem);
+        }
+    }
+
+    bool create(cl_context context, cl_mem_flags flags, size_t size, void* host_data, const char* what)
+    {
+        cl_int error;
+        mem = clCreateBuffer(context, flags, size, host_data, &error);
+        return check(error, what);
+    }
+};
+
+/*!
+ * The OpenCL device the faces are cut on, with the kernels built for it. Found once per process, on the first mesh
+ * sliced with the OpenCL backend.
+ */
+class GPUDevice
+{
+public:
+    cl_context context;
+    cl_command_queue queue;
+    cl_program program;
+    cl_kernel count_kernel;
+    cl_kernel write_kernel;
+    cl_ulong max_alloc_size; //!< The largest buffer the device can allocate
+    std::mutex mutex; //!< The kernels and the queue are used for one mesh at a time
+
+    /*!
+     * The device, or null if there is none or the kernels couldn't be built for it.
+     */
+    static GPUDevice* get()
+    {
+        static std::unique_ptr<GPUDevice> device(create());
+        return device.get();
+    }
+
+    ~GPUDevice()
+    {
+        if (write_kernel) clReleaseKernel(write_kernel);
+        if (count_kernel) clReleaseKernel(count_kernel);
+        if (program) clReleaseProgram(program);
+        if (queue) clReleaseCommandQueue(queue);
+        if (context) clReleaseContext(context);
+    }
+
+private:
+    GPUDevice()
+    : context(nullptr), queue(nullptr), program(nullptr), count_kernel(nullptr), write_kernel(nullptr), max_alloc_size(0)
+    {
+    }
+
+    static GPUDevice* create()
+    {
+        cl_uint platform_count = 0;
+        if (clGetPlatformIDs(0, nullptr, &platform_count) != CL_SUCCESS || platform_count == 0)
+        {
+            logWarningOnce("opencl platform", "No OpenCL platform is installed; slicing on the CPU\n");
+            return nullptr;
+        }
+        std::vector<cl_platform_id> platforms(platform_count);
+        clGetPlatformIDs(platform_count, platforms.data(), nullptr);
+        // a GPU if there is one, or else any device, such as an OpenCL implementation on the CPU
+        const cl_device_type device_types[] = { CL_DEVICE_TYPE_GPU, CL_DEVICE_TYPE_ALL };
+        cl_device_id device_id = nullptr;
+        for (cl_device_type device_type : device_types)
+        {
+            for (unsigned int platform_idx = 0; platform_idx < platforms.size() && !device_id; platform_idx++)
+            {
+                if (clGetDeviceIDs(platforms[platform_idx], device_type, 1, &device_id, nullptr) != CL_SUCCESS)
+                {
+                    device_id = nullptr;
+                }
+            }
+        }
+        if (!device_id)
+        {
+            logWarningOnce("opencl device", "No OpenCL device was found; slicing on the CPU\n");
+            return nullptr;
+        }
+
+        std::unique_ptr<GPUDevice> device(new GPUDevice());
+        cl_int error;
+        device->context = clCreateContext(nullptr, 1, &device_id, nullptr, nullptr, &error);
+        if (!check(error, "create a context"))
+            return nullptr;
+        device->queue = clCreateCommandQueue(device->context, device_id, 0, &error);
+        if (!check(error, "create a command queue"))
+            return nullptr;
+        device->program = clCreateProgramWithSource(device->context, 1, &kernel_source, nullptr, &error);
+        if (!check(error, "create the program"))
+            return nullptr;
+        error = clBuildProgram(device->program, 1, &device_id, "", nullptr, nullptr);
+        if (error != CL_SUCCESS)
+        {
+            size_t log_size = 0;
+            clGetProgramBuildInfo(device->program, device_id, CL_PROGRAM_BUILD_LOG, 0, nullptr, &log_size);
+            std::string build_log(log_size, '\0');
+            clGetProgramBuildInfo(device->program, device_id, CL_PROGRAM_BUILD_LOG, log_size, &build_log[0], nullptr);
+            logWarningOnce("opencl build", "OpenCL failed to build the kernels (error %d); slicing on the CPU\n%s\n", error, build_log.c_str());
+            return nullptr;
+        }
+        device->count_kernel = clCreateKernel(device->program, "countSegments", &error);
+        if (!check(error, "create the kernel countSegments"))
+            return nullptr;
+        device->write_kernel = clCreateKernel(device->program, "writeSegments", &error);
+        if (!check(error, "create the kernel writeSegments"))
+            return nullptr;
+        clGetDeviceInfo(device_id, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), &device->max_alloc_size, nullptr);
+
+        char name[256] = "";
+        clGetDeviceInfo(device_id, CL_DEVICE_NAME, sizeof(name) - 1, name, nullptr);
+        log("Slicing on the OpenCL device %s\n", name);
+        return device.release();
+    }
+};
+
+/*!
+ * Set the arguments of a kernel, in order.
+ */
+bool setKernelArgs(cl_kernel kernel, const std::vector<std::pair<size_t, const void*>>& args, const char* what)
+{
+    for (unsigned int arg_idx = 0; arg_idx < args.size(); arg_idx++)
+    {
+        if (!check(clSetKernelArg(kernel, arg_idx, args[arg_idx].first, args[arg_idx].second), what))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+}//anonymous namespace
+
+bool haveGPUSlicing()
+{
+    return true;
+}
+
+bool sliceSegmentsOnGPU(Mesh& mesh, std::vector<SlicerLayer>& layers, unsigned int thread_count)
+{
+    TRACE_ZONE("slice faces on GPU");
+    GPUDevice* device = GPUDevice::get();
+    if (!device)
+    {
+        return false;
+    }
+    cl_uint face_count = mesh.faces.size();
+    cl_uint layer_count = layers.size();
+    if (face_count == 0)
+    {
+        return true;
+    }
+    size_t vertices_size = mesh.vertices.positions.size() * sizeof(Point3);
+    size_t faces_size = mesh.faces.size() * sizeof(MeshFace);
+    if (vertices_size > device->max_alloc_size || faces_size > device->max_alloc_size)
+    {
+        logWarningOnce("opencl mesh size", "The mesh is too large for a buffer of the OpenCL device; slicing on the CPU\n");
+        return false;
+    }
+    std::vector<cl_int> layer_z(layer_count);
+    for (unsigned int layer_nr = 0; layer_nr < layer_count; layer_nr++)
+    {
+        layer_z[layer_nr] = layers[layer_nr].z;
+    }
+
+    std::lock_guard<std::mutex> lock(device->mutex);
+    DeviceBuffer vertices;
+    DeviceBuffer faces;
+    DeviceBuffer layer_z_buffer;
+    DeviceBuffer first_layers_buffer;
+    DeviceBuffer segment_counts_buffer;
+    if (!vertices.create(device->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, vertices_size, mesh.vertices.positions.data(), "upload the vertices")
+        || !faces.create(device->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, faces_size, mesh.faces.data(), "upload the faces")
+        || !layer_z_buffer.create(device->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, layer_z.size() * sizeof(cl_int), layer_z.data(), "upload the layer heights")
+        || !first_layers_buffer.create(device->context, CL_MEM_WRITE_ONLY, face_count * sizeof(cl_uint), nullptr, "allocate the first layers")
+        || !segment_counts_buffer.create(device->context, CL_MEM_WRITE_ONLY, face_count * sizeof(cl_uint), nullptr, "allocate the segment counts"))
+    {
+        return false;
+    }
+
+    size_t global_size = face_count;
+    if (!setKernelArgs(device->count_kernel, {
+            { sizeof(cl_mem), &vertices.mem }, { sizeof(cl_mem), &faces.mem }, { sizeof(cl_uint), &face_count },
+            { sizeof(cl_mem), &layer_z_buffer.mem }, { sizeof(cl_uint), &layer_count },
+            { sizeof(cl_mem), &first_layers_buffer.mem }, { sizeof(cl_mem), &segment_counts_buffer.mem } }, "set the arguments of countSegments")
+        || !check(clEnqueueNDRangeKernel(device->queue, device->count_kernel, 1, nullptr, &global_size, nullptr, 0, nullptr, nullptr), "count the segments"))
+    {
+        return false;
+    }
+    std::vector<cl_uint> first_layers(face_count);
+    std::vector<cl_uint> segment_counts(face_count);
+    if (!check(clEnqueueReadBuffer(device->queue, first_layers_buffer.mem, CL_FALSE, 0, face_count * sizeof(cl_uint), first_layers.data(), 0, nullptr, nullptr), "read the first layers")
+        || !check(clEnqueueReadBuffer(device->queue, segment_counts_buffer.mem, CL_TRUE, 0, face_count * sizeof(cl_uint), segment_counts.data(), 0, nullptr, nullptr), "read the segment counts"))
+    {
+        return false;
+    }
+
+    // the segments of each face start where those of the faces before it end
+    std::vector<cl_ulong> segment_offsets(face_count + 1);
+    std::vector<int64_t> layer_count_changes(layer_count + 1, 0); // the segments each layer has more than the layer below it
+    segment_offsets[0] = 0;
+    for (unsigned int face_idx = 0; face_idx < face_count; face_idx++)
+    {
+        segment_offsets[face_idx + 1] = segment_offsets[face_idx] + segment_counts[face_idx];
+        layer_count_changes[first_layers[face_idx]] += segment_counts[face_idx];
+        layer_count_changes[first_layers[face_idx] + segment_counts[face_idx]] -= segment_counts[face_idx];
+    }
+    cl_ulong segment_count = segment_offsets[face_count];
+    if (segment_count == 0)
+    {
+        return true;
+    }
+    if (segment_count * 4 * sizeof(cl_long) > device->max_alloc_size)
+    {
+        logWarningOnce("opencl segments size", "The segments of the mesh are too many for a buffer of the OpenCL device; slicing on the CPU\n");
+        return false;
+    }
+    DeviceBuffer segment_offsets_buffer;
+    DeviceBuffer segments_buffer;
+    if (!segment_offsets_buffer.create(device->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, segment_offsets.size() * sizeof(cl_ulong), segment_offsets.data(), "upload the segment offsets")
+        || !segments_buffer.create(device->context, CL_MEM_WRITE_ONLY, segment_count * 4 * sizeof(cl_long), nullptr, "allocate the segments"))
+    {
+        return false;
+    }
+    if (!setKernelArgs(device->write_kernel, {
+            { sizeof(cl_mem), &vertices.mem }, { sizeof(cl_mem), &faces.mem }, { sizeof(cl_uint), &face_count },
+            { sizeof(cl_mem), &layer_z_buffer.mem }, { sizeof(cl_mem), &first_layers_buffer.mem },
+            { sizeof(cl_mem), &segment_offsets_buffer.mem }, { sizeof(cl_mem), &segments_buffer.mem } }, "set the arguments of writeSegments")
+        || !check(clEnqueueNDRangeKernel(device->queue, device->write_kernel, 1, nullptr, &global_size, nullptr, 0, nullptr, nullptr), "cut the faces"))
+    {
+        return false;
+    }
+    std::vector<cl_long> segments(segment_count * 4);
+    if (!check(clEnqueueReadBuffer(device->queue, segments_buffer.mem, CL_TRUE, 0, segments.size() * sizeof(cl_long), segments.data(), 0, nullptr, nullptr), "read the segments"))
+    {
+        return false;
+    }
+
+    int64_t layer_segment_count = 0;
+    for (unsigned int layer_nr = 0; layer_nr < layer_count; layer_nr++)
+    {
+        layer_segment_count += layer_count_changes[layer_nr];
+        layers[layer_nr].segmentList.reserve(layer_segment_count);
+    }
+    // Each thread hands out the segments of a consecutive range of layers, going over the faces in order.
+    unsigned int chunk_count = std::min(thread_count, layer_count);
+    parallelFor(chunk_count, thread_count, [&](unsigned int chunk_idx)
+    {
+        unsigned int layer_start = uint64_t(layer_count) * chunk_idx / chunk_count;
+        unsigned int layer_end = uint64_t(layer_count) * (chunk_idx + 1) / chunk_count;
+        for (unsigned int face_idx = 0; face_idx < face_count; face_idx++)
+        {
+            unsigned int first = std::max(layer_start, first_layers[face_idx]);
+            unsigned int end = std::min(layer_end, first_layers[face_idx] + segment_counts[face_idx]);
+            for (unsigned int layer_nr = first; layer_nr < end; layer_nr++)
+            {
+                const cl_long* cut = &segments[(segment_offsets[face_idx] + layer_nr - first_layers[face_idx]) * 4];
+                SlicerSegment segment;
+                segment.start = Point(cut[0], cut[1]);
+                segment.end = Point(cut[2], cut[3]);
+                segment.faceIndex = face_idx;
+                segment.addedToPolygon = false;
+                layers[layer_nr].segmentList.push_back(segment);
+            }
+        }
+    });
+    return true;
+}
+#else
+bool haveGPUSlicing()
+{
+    return false;
+}
+
+bool sliceSegmentsOnGPU(Mesh&, std::vector<SlicerLayer>&, unsigned int)
+{
+    return false;
+}
+#endif
+
+}//namespace cura
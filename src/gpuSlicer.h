@@ -0,0 +1,43 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#ifndef GPU_SLICER_H
+#define GPU_SLICER_H
+
+#include <vector>
+
+#include "slicer.h"
+
+/*
+Cutting the faces of a mesh at the heights of the layers on a GPU, through OpenCL, for the largest scanned meshes, where
+the sweep of the Slicer over millions of faces is bound by the bandwidth of the memory of the host.
+
+The mesh is uploaded once and all faces are cut at all layers in one dispatch: each work item cuts one face at each
+layer it crosses, by the same integer divisions as the sweep, so the segments are exactly those of the sweep. They are
+then handed out to the layers in the order of the faces, as SlicerLayer::makePolygons takes them from the sweep.
+
+The backend is built with "cmake -DENABLE_OPENCL=ON", which defines HAVE_OPENCL, and used when machine_slice_backend
+is "opencl". The sweep on the CPU stays the reference: with machine_slice_backend_check the layers are also swept on the
+CPU and compared, and the segments of the CPU are used for any layer which differs.
+*/
+
+namespace cura {
+
+/*!
+ * Whether the engine was built with the OpenCL backend.
+ */
+bool haveGPUSlicing();
+
+/*!
+ * Cut all faces of a mesh at the heights of all layers on the GPU and fill the SlicerLayer::segmentList of each layer
+ * with the segments the sweep of the Slicer finds, in the order of their faces.
+ *
+ * \param mesh The mesh
+ * \param layers The layers, with their heights set and no segments yet, from the bottom up
+ * \param thread_count The threads with which to hand out the segments to the layers
+ * \return Whether the segments were found; false when built without OpenCL, without an OpenCL device, or when the
+ * device fails or runs out of memory, in which case the layers are left without segments
+ */
+bool sliceSegmentsOnGPU(Mesh& mesh, std::vector<SlicerLayer>& layers, unsigned int thread_count);
+
+}//namespace cura
+
+#endif//GPU_SLICER_H
@@ -1,37 +1,37 @@
 /** Copyright (C) 2013 David Braam - Released under terms of the AGPLv3 License */
 #include "infill.h"
 #include "functional"
+#include <algorithm> // std::sort
 #include "utils/polygonUtils.h"
 namespace cura {
 
 
 
-void generateConcentricInfillDense(Polygons outline, Polygons& result, Polygons* in_between, int extrusionWidth, bool avoidOverlappingPerimeters)
+void generateConcentricInfillDense(const Polygons& outline, Polygons& result, Polygons* in_between, int extrusionWidth, bool avoidOverlappingPerimeters)
 {
-    while(outline.size() > 0)
+    if (outline.size() == 0) return;
+    result.add(outline);
+    Polygons ring;
+    offsetExtrusionWidth(outline, true, extrusionWidth, ring, in_between, avoidOverlappingPerimeters);
+    while(ring.size() > 0)
     {
-        for (unsigned int polyNr = 0; polyNr < outline.size(); polyNr++)
-        {
-            PolygonRef r = outline[polyNr];
-            result.add(r);
-        }
-        Polygons next_outline;
-        offsetExtrusionWidth(outline, true, extrusionWidth, next_outline, in_between, avoidOverlappingPerimeters);
-        outline = next_outline;
+        result.add(ring);
+        Polygons next_ring;
+        offsetExtrusionWidth(ring, true, extrusionWidth, next_ring, in_between, avoidOverlappingPerimeters);
+        ring = std::move(next_ring);
     }
 
 }
 
-void generateConcentricInfill(Polygons outline, Polygons& result, int inset_value)
+void generateConcentricInfill(const Polygons& outline, Polygons& result, int inset_value)
 {
-    while(outline.size() > 0)
+    if (outline.size() == 0) return;
+    result.add(outline);
+    Polygons ring = outline.offset(-inset_value);
+    while(ring.size() > 0)
     {
-        for (unsigned int polyNr = 0; polyNr < outline.size(); polyNr++)
-        {
-            PolygonRef r = outline[polyNr];
-            result.add(r);
-        }
-        outline = outline.offset(-inset_value);
+        result.add(ring);
+        ring = ring.offset(-inset_value);
     }
 }
 
@@ -58,7 +58,166 @@ void generateTriangleInfill(const Polygons& in_outline, int outlineOffset, Polyg
                        infillOverlap, rotation + 120);
 }
 
-void addLineInfill(Polygons& result, PointMatrix matrix, int scanline_min_idx, int lineSpacing, AABB boundary, std::vector<std::vector<int64_t> > cutList, int extrusionWidth)
+namespace
+{
+
+/*!
+ * The crossings of the outline of an infill area with its scanlines.
+ *
+ * The crossings are collected in the order in which they are found while walking along the outline,
+ * and then grouped per scanline into one flat buffer, rather than into a vector per scanline.
+ * Each thread reuses its buffers for the next infill area, see getScanlineCrossings.
+ *
+ * When several areas are filled in one pass, each crossing also records the area whose outline it belongs to.
+ */
+class ScanlineCrossings
+{
+public:
+    /*!
+     * Remove all crossings and prepare for \p scanline_count scanlines.
+     */
+    void clear(int scanline_count)
+    {
+        found.clear();
+        line_start.assign(std::max(0, scanline_count) + 1, 0);
+    }
+
+    /*!
+     * Add a crossing of the outline with a scanline.
+     * 
+     * \param scanline The index of the scanline, counted from the first scanline of the area
+     * \param y The coordinate at which the outline crosses the scanline
+     * \param area The index of the area to which the outline belongs, when filling several areas at once
+     */
+    void add(int scanline, int64_t y, unsigned int area = 0)
+    {
+        found.emplace_back(scanline, Crossing{y, area});
+        line_start[scanline + 1]++;
+    }
+
+    /*!
+     * Group the crossings per scanline and sort them along each scanline.
+     * Has to be called after the last crossing is added and before the crossings are read.
+     */
+    void sortPerScanline()
+    {
+        for (unsigned int scanline = 1; scanline < line_start.size(); scanline++)
+        {
+            line_start[scanline] += line_start[scanline - 1];
+        }
+        sorted.resize(found.size());
+        insert_idx.assign(line_start.begin(), line_start.end() - 1);
+        for (const std::pair<int, Crossing>& crossing : found)
+        {
+            sorted[insert_idx[crossing.first]++] = crossing.second;
+        }
+        for (unsigned int scanline = 0; scanline + 1 < line_start.size(); scanline++)
+        {
+            std::sort(sorted.begin() + line_start[scanline], sorted.begin() + line_start[scanline + 1]);
+        }
+    }
+
+    /*!
+     * The number of scanlines.
+     */
+    unsigned int scanlineCount() const
+    {
+        return line_start.size() - 1;
+    }
+
+    /*!
+     * The number of crossings with a scanline, after sortPerScanline.
+     */
+    unsigned int crossingCount(unsigned int scanline) const
+    {
+        return line_start[scanline + 1] - line_start[scanline];
+    }
+
+    /*!
+     * The \p idx-th crossing along a scanline, after sortPerScanline.
+     */
+    int64_t crossing(unsigned int scanline, unsigned int idx) const
+    {
+        return sorted[line_start[scanline] + idx].y;
+    }
+
+    /*!
+     * The area to which the \p idx-th crossing along a scanline belongs, after sortPerScanline.
+     */
+    unsigned int crossingArea(unsigned int scanline, unsigned int idx) const
+    {
+        return sorted[line_start[scanline] + idx].area;
+    }
+
+private:
+    struct Crossing
+    {
+        int64_t y;
+        unsigned int area;
+
+        bool operator<(const Crossing& other) const
+        {
+            return y < other.y || (y == other.y && area < other.area);
+        }
+    };
+
+    std::vector<std::pair<int, Crossing>> found; //!< The crossings with the index of their scanline, in the order in which they were added
+    std::vector<unsigned int> line_start; //!< For each scanline the index of its first crossing in sorted; one extra entry marks the end
+    std::vector<unsigned int> insert_idx; //!< Where the next crossing of each scanline goes in sorted, while grouping
+    std::vector<Crossing> sorted; //!< The crossings grouped by scanline and sorted along each scanline
+};
+
+/*!
+ * The scanline crossings buffer of the current thread, cleared for \p scanline_count scanlines.
+ * 
+ * The infill generators never nest, so one buffer per thread suffices.
+ */
+ScanlineCrossings& getScanlineCrossings(int scanline_count)
+{
+    static thread_local ScanlineCrossings crossings;
+    crossings.clear(scanline_count);
+    return crossings;
+}
+
+/*!
+ * The scanlines crossed by an edge of an outline, in the order in which the edge crosses them.
+ *
+ * The edge must not be parallel to the scanlines.
+ */
+struct EdgeScanlines
+{
+    int first; //!< The first scanline crossed
+    int end; //!< One step beyond the last scanline crossed
+    int direction; //!< The step from one scanline to the next: 1 or -1
+
+    EdgeScanlines(Point p0, Point p1, int lineSpacing)
+    {
+        int scanline_idx0 = (p0.X + ((p0.X > 0)? -1 : -lineSpacing)) / lineSpacing; // -1 cause a linesegment on scanline x counts as belonging to scansegment x-1   ...
+        int scanline_idx1 = (p1.X + ((p1.X > 0)? -1 : -lineSpacing)) / lineSpacing; // -linespacing because a line between scanline -n and -n-1 belongs to scansegment -n-1 (for n=positive natural number)
+        direction = 1;
+        if (p0.X > p1.X)
+        {
+            direction = -1;
+            scanline_idx1 += 1; // only consider the scanlines in between the scansegments
+        } else scanline_idx0 += 1; // only consider the scanlines in between the scansegments
+        first = scanline_idx0;
+        end = scanline_idx1 + direction;
+    }
+};
+
+/*!
+ * The point where the edge from \p p0 to \p p1 crosses scanline \p scanline_idx.
+ */
+Point scanlineCrossing(Point p0, Point p1, int scanline_idx, int lineSpacing)
+{
+    int x = scanline_idx * lineSpacing;
+    int y = p1.Y + int64_t(p0.Y - p1.Y) * (x - p1.X) / (p0.X - p1.X);
+    return Point(x, y);
+}
+
+}//anonymous namespace
+
+void addLineInfill(Polygons& result, PointMatrix matrix, int scanline_min_idx, int lineSpacing, AABB boundary, const ScanlineCrossings& cutList, int extrusionWidth)
 {
     //auto, Specifies that the type of the variable that is being declared will be automatically deduced from its initializer.
     //functions, specifies that the return type is a trailing return type or will be deduced from its return statements
@@ -69,23 +228,14 @@ void addLineInfill(Polygons& result, PointMatrix matrix, int scanline_min_idx, i
         p.add(matrix.unapply(to));
     };
 
-    auto compare_int64_t = [](const void* a, const void* b)
-    {
-        int64_t n = (*(int64_t*)a) - (*(int64_t*)b);
-        if (n < 0) return -1;
-        if (n > 0) return 1;
-        return 0;
-    };
-
     int scanline_idx = 0;
     for(int64_t x = scanline_min_idx * lineSpacing; x < boundary.max.X; x += lineSpacing)
     {
-        qsort(cutList[scanline_idx].data(), cutList[scanline_idx].size(), sizeof(int64_t), compare_int64_t);
-        for(unsigned int i = 0; i + 1 < cutList[scanline_idx].size(); i+=2)
+        for(unsigned int i = 0; i + 1 < cutList.crossingCount(scanline_idx); i+=2)
         {
-            if (cutList[scanline_idx][i+1] - cutList[scanline_idx][i] < extrusionWidth / 5)
+            if (cutList.crossing(scanline_idx, i+1) - cutList.crossing(scanline_idx, i) < extrusionWidth / 5)
                 continue;
-            addLine(Point(x, cutList[scanline_idx][i]), Point(x, cutList[scanline_idx][i+1]));
+            addLine(Point(x, cutList.crossing(scanline_idx, i)), Point(x, cutList.crossing(scanline_idx, i+1)));
         }
         scanline_idx += 1;
     }
@@ -111,6 +261,7 @@ void addLineInfill(Polygons& result, PointMatrix matrix, int scanline_min_idx, i
  */
 void generateLineInfill(const Polygons& in_outline, int outlineOffset, Polygons& result, int extrusionWidth, int lineSpacing, int infillOverlap, double rotation)
 {
+    TRACE_ZONE("generateLineInfill");
     if (in_outline.size() == 0) return;
     Polygons outline = in_outline.offset(extrusionWidth * infillOverlap / 100 + outlineOffset);
     if (outline.size() == 0) return;
@@ -125,10 +276,7 @@ void generateLineInfill(const Polygons& in_outline, int outlineOffset, Polygons&
     int scanline_min_idx = boundary.min.X / lineSpacing;
     int lineCount = (boundary.max.X + (lineSpacing - 1)) / lineSpacing - scanline_min_idx;
 
-    std::vector<std::vector<int64_t> > cutList; // mapping from scanline to all intersections with polygon segments
-
-    for(int n=0; n<lineCount; n++)
-        cutList.push_back(std::vector<int64_t>());
+    ScanlineCrossings& cutList = getScanlineCrossings(lineCount); // mapping from scanline to all intersections with polygon segments
 
     for(unsigned int poly_idx=0; poly_idx < outline.size(); poly_idx++)
     {
@@ -136,35 +284,127 @@ void generateLineInfill(const Polygons& in_outline, int outlineOffset, Polygons&
         for(unsigned int i=0; i < outline[poly_idx].size(); i++)
         {
             Point p1 = outline[poly_idx][i];
-            int64_t xMin = p1.X, xMax = p0.X;
-            if (xMin == xMax) {
+            if (p0.X == p1.X) {
                 p0 = p1;
                 continue;
             }
-            if (xMin > xMax) { xMin = p0.X; xMax = p1.X; }
-
-            int scanline_idx0 = (p0.X + ((p0.X > 0)? -1 : -lineSpacing)) / lineSpacing; // -1 cause a linesegment on scanline x counts as belonging to scansegment x-1   ...
-            int scanline_idx1 = (p1.X + ((p1.X > 0)? -1 : -lineSpacing)) / lineSpacing; // -linespacing because a line between scanline -n and -n-1 belongs to scansegment -n-1 (for n=positive natural number)
-            int direction = 1;
-            if (p0.X > p1.X)
-            {
-                direction = -1;
-                scanline_idx1 += 1; // only consider the scanlines in between the scansegments
-            } else scanline_idx0 += 1; // only consider the scanlines in between the scansegments
 
-            for(int scanline_idx = scanline_idx0; scanline_idx != scanline_idx1+direction; scanline_idx+=direction)
+            EdgeScanlines scanlines(p0, p1, lineSpacing);
+            for(int scanline_idx = scanlines.first; scanline_idx != scanlines.end; scanline_idx += scanlines.direction)
             {
-                int x = scanline_idx * lineSpacing;
-                int y = p1.Y + (p0.Y - p1.Y) * (x - p1.X) / (p0.X - p1.X);
-                cutList[scanline_idx - scanline_min_idx].push_back(y);
+                cutList.add(scanline_idx - scanline_min_idx, scanlineCrossing(p0, p1, scanline_idx, lineSpacing).Y);
             }
             p0 = p1;
         }
     }
 
+    cutList.sortPerScanline();
     addLineInfill(result, matrix, scanline_min_idx, lineSpacing, boundary, cutList, extrusionWidth);
 }
 
+/*!
+ * Add the lines of several areas, which were filled in one scanline pass.
+ *
+ * Along each scanline the crossings of each area are connected using the even-odd rule, as in addLineInfill,
+ * regardless of the crossings of the other areas in between.
+ */
+void addLineInfillPerArea(std::vector<Polygons>& results, PointMatrix matrix, int scanline_min_idx, int lineSpacing, const ScanlineCrossings& cutList, int extrusionWidth)
+{
+    std::vector<bool> is_open(results.size(), false); // whether a line of the area has started and not yet ended on the current scanline
+    std::vector<int64_t> open_y(results.size());
+    for(unsigned int scanline_idx = 0; scanline_idx < cutList.scanlineCount(); scanline_idx++)
+    {
+        int64_t x = (scanline_min_idx + static_cast<int64_t>(scanline_idx)) * lineSpacing;
+        unsigned int crossing_count = cutList.crossingCount(scanline_idx);
+        for(unsigned int i = 0; i < crossing_count; i++)
+        {
+            unsigned int area = cutList.crossingArea(scanline_idx, i);
+            int64_t y = cutList.crossing(scanline_idx, i);
+            if (!is_open[area])
+            {
+                is_open[area] = true;
+                open_y[area] = y;
+                continue;
+            }
+            is_open[area] = false;
+            if (y - open_y[area] < extrusionWidth / 5)
+                continue;
+            PolygonRef p = results[area].newPoly();
+            p.add(matrix.unapply(Point(x, open_y[area])));
+            p.add(matrix.unapply(Point(x, y)));
+        }
+        for(unsigned int i = 0; i < crossing_count; i++)
+        {
+            is_open[cutList.crossingArea(scanline_idx, i)] = false; // an unmatched last crossing doesn't start a line on the next scanline
+        }
+    }
+}
+
+void generateLineInfill(const std::vector<const Polygons*>& in_outlines, int outlineOffset, std::vector<Polygons>& results, int extrusionWidth, int lineSpacing, int infillOverlap, double rotation)
+{
+    TRACE_ZONE("generateLineInfill");
+    PointMatrix matrix(rotation);
+
+    std::vector<Polygons> outlines(in_outlines.size());
+    AABB boundary;
+    boundary.min = Point(POINT_MAX, POINT_MAX);
+    for(unsigned int area = 0; area < in_outlines.size(); area++)
+    {
+        if (in_outlines[area]->size() == 0) continue;
+        outlines[area] = in_outlines[area]->offset(extrusionWidth * infillOverlap / 100 + outlineOffset);
+        outlines[area].applyMatrix(matrix);
+        AABB area_boundary(outlines[area]);
+        boundary.min.X = std::min(boundary.min.X, area_boundary.min.X);
+        boundary.max.X = std::max(boundary.max.X, area_boundary.max.X);
+    }
+    if (boundary.min.X > boundary.max.X) return; // all areas are empty
+
+    int scanline_min_idx = boundary.min.X / lineSpacing;
+    int lineCount = (boundary.max.X + (lineSpacing - 1)) / lineSpacing - scanline_min_idx;
+
+    ScanlineCrossings& cutList = getScanlineCrossings(lineCount);
+
+    for(unsigned int area = 0; area < outlines.size(); area++)
+    {
+        Polygons& outline = outlines[area];
+        for(unsigned int poly_idx=0; poly_idx < outline.size(); poly_idx++)
+        {
+            Point p0 = outline[poly_idx][outline[poly_idx].size()-1];
+            for(unsigned int i=0; i < outline[poly_idx].size(); i++)
+            {
+                Point p1 = outline[poly_idx][i];
+                if (p0.X == p1.X) {
+                    p0 = p1;
+                    continue;
+                }
+
+                EdgeScanlines scanlines(p0, p1, lineSpacing);
+                for(int scanline_idx = scanlines.first; scanline_idx != scanlines.end; scanline_idx += scanlines.direction)
+                {
+                    cutList.add(scanline_idx - scanline_min_idx, scanlineCrossing(p0, p1, scanline_idx, lineSpacing).Y, area);
+                }
+                p0 = p1;
+            }
+        }
+    }
+
+    cutList.sortPerScanline();
+    addLineInfillPerArea(results, matrix, scanline_min_idx, lineSpacing, cutList, extrusionWidth);
+}
+
+void generateGridInfill(const std::vector<const Polygons*>& in_outlines, int outlineOffset, std::vector<Polygons>& results, int extrusionWidth, int lineSpacing, int infillOverlap, double rotation)
+{
+    generateLineInfill(in_outlines, outlineOffset, results, extrusionWidth, lineSpacing, infillOverlap, rotation);
+    generateLineInfill(in_outlines, outlineOffset, results, extrusionWidth, lineSpacing, infillOverlap, rotation + 90);
+}
+
+void generateTriangleInfill(const std::vector<const Polygons*>& in_outlines, int outlineOffset, std::vector<Polygons>& results, int extrusionWidth, int lineSpacing, int infillOverlap, double rotation)
+{
+    generateLineInfill(in_outlines, outlineOffset, results, extrusionWidth, lineSpacing, infillOverlap, rotation);
+    generateLineInfill(in_outlines, outlineOffset, results, extrusionWidth, lineSpacing, infillOverlap, rotation + 60);
+    generateLineInfill(in_outlines, outlineOffset, results, extrusionWidth, lineSpacing, infillOverlap, rotation + 120);
+}
+
 
 void generateZigZagInfill(const Polygons& in_outline, Polygons& result, int extrusionWidth, int lineSpacing, int infillOverlap, double rotation, bool connect_zigzags, bool use_endPieces)
 {
@@ -223,11 +463,9 @@ void generateZigZagInfill(const Polygons& in_outline, Polygons& result, int extr
  */
 void generateZigZagInfill_endPieces(const Polygons& in_outline, Polygons& result, int extrusionWidth, int lineSpacing, int infillOverlap, double rotation, bool connect_zigzags)
 {
-//     if (in_outline.size() == 0) return;
 //     Polygons outline = in_outline.offset(extrusionWidth * infillOverlap / 100 - extrusionWidth / 2);
-    Polygons empty;
-    Polygons outline = in_outline.difference(empty); // copy
-    if (outline.size() == 0) return;
+    if (in_outline.size() == 0) return;
+    Polygons outline = in_outline; // copy; the outline is the result of earlier polygon operations, so it needs no cleaning up by Clipper
 
     PointMatrix matrix(rotation);
 
@@ -245,17 +483,14 @@ void generateZigZagInfill_endPieces(const Polygons& in_outline, Polygons& result
     int scanline_min_idx = boundary.min.X / lineSpacing;
     int lineCount = (boundary.max.X + (lineSpacing - 1)) / lineSpacing - scanline_min_idx;
 
-    std::vector<std::vector<int64_t> > cutList; // mapping from scanline to all intersections with polygon segments
-
-    for(int n=0; n<lineCount; n++)
-        cutList.push_back(std::vector<int64_t>());
+    ScanlineCrossings& cutList = getScanlineCrossings(lineCount); // mapping from scanline to all intersections with polygon segments
     for(unsigned int polyNr=0; polyNr < outline.size(); polyNr++)
     {
         std::vector<Point> firstBoundarySegment;
         std::vector<Point> unevenBoundarySegment; // stored cause for connected_zigzags a boundary segment which ends in an uneven scanline needs to be included
 
         bool isFirstBoundarySegment = true;
-        bool firstBoundarySegmentEndsInEven;
+        bool firstBoundarySegmentEndsInEven = false;
 
         bool isEvenScanSegment = false;
 
@@ -265,30 +500,21 @@ void generateZigZagInfill_endPieces(const Polygons& in_outline, Polygons& result
         for(unsigned int i=0; i < outline[polyNr].size(); i++)
         {
             Point p1 = outline[polyNr][i];
-            int64_t xMin = p1.X, xMax = p0.X;
-            if (xMin == xMax) {
+            if (p0.X == p1.X) {
                 lastPoint = p1;
                 p0 = p1;
                 continue;
             }
-            if (xMin > xMax) { xMin = p0.X; xMax = p1.X; }
-
-            int scanline_idx0 = (p0.X + ((p0.X > 0)? -1 : -lineSpacing)) / lineSpacing; // -1 cause a linesegment on scanline x counts as belonging to scansegment x-1   ...
-            int scanline_idx1 = (p1.X + ((p1.X > 0)? -1 : -lineSpacing)) / lineSpacing; // -linespacing because a line between scanline -n and -n-1 belongs to scansegment -n-1 (for n=positive natural number)
-            int direction = 1;
-            if (p0.X > p1.X)
-            {
-                direction = -1;
-                scanline_idx1 += 1; // only consider the scanlines in between the scansegments
-            } else scanline_idx0 += 1; // only consider the scanlines in between the scansegments
 
+            EdgeScanlines scanlines(p0, p1, lineSpacing);
 
             if (isFirstBoundarySegment) firstBoundarySegment.push_back(p0);
-            for(int scanline_idx = scanline_idx0; scanline_idx != scanline_idx1+direction; scanline_idx+=direction)
+            for(int scanline_idx = scanlines.first; scanline_idx != scanlines.end; scanline_idx += scanlines.direction)
             {
-                int x = scanline_idx * lineSpacing;
-                int y = p1.Y + (p0.Y - p1.Y) * (x - p1.X) / (p0.X - p1.X);
-                cutList[scanline_idx - scanline_min_idx].push_back(y);
+                Point crossing = scanlineCrossing(p0, p1, scanline_idx, lineSpacing);
+                int x = crossing.X;
+                int y = crossing.Y;
+                cutList.add(scanline_idx - scanline_min_idx, y);
 
 
                 bool last_isEvenScanSegment = isEvenScanSegment;
@@ -348,8 +574,9 @@ void generateZigZagInfill_endPieces(const Polygons& in_outline, Polygons& result
             addLine(firstBoundarySegment[firstBoundarySegment.size()-2], firstBoundarySegment[firstBoundarySegment.size()-1]);
     }
 
-    if (cutList.size() == 0) return;
-    if (connect_zigzags && cutList.size() == 1 && cutList[0].size() <= 2) return;  // don't add connection if boundary already contains whole outline!
+    cutList.sortPerScanline();
+    if (cutList.scanlineCount() == 0) return;
+    if (connect_zigzags && cutList.scanlineCount() == 1 && cutList.crossingCount(0) <= 2) return;  // don't add connection if boundary already contains whole outline!
 
     addLineInfill(result, matrix, scanline_min_idx, lineSpacing, boundary, cutList, extrusionWidth);
 }
@@ -377,17 +604,14 @@ void generateZigZagInfill_noEndPieces(const Polygons& in_outline, Polygons& resu
     int scanline_min_idx = boundary.min.X / lineSpacing;
     int lineCount = (boundary.max.X + (lineSpacing - 1)) / lineSpacing - scanline_min_idx;
 
-    std::vector<std::vector<int64_t> > cutList; // mapping from scanline to all intersections with polygon segments
-
-    for(int n=0; n<lineCount; n++)
-        cutList.push_back(std::vector<int64_t>());
+    ScanlineCrossings& cutList = getScanlineCrossings(lineCount); // mapping from scanline to all intersections with polygon segments
     for(unsigned int polyNr=0; polyNr < outline.size(); polyNr++)
     {
         std::vector<Point> firstBoundarySegment;
         std::vector<Point> boundarySegment;
 
         bool isFirstBoundarySegment = true;
-        bool firstBoundarySegmentEndsInEven;
+        bool firstBoundarySegmentEndsInEven = false;
 
         bool isEvenScanSegment = false;
 
@@ -396,30 +620,21 @@ void generateZigZagInfill_noEndPieces(const Polygons& in_outline, Polygons& resu
         for(unsigned int i=0; i < outline[polyNr].size(); i++)
         {
             Point p1 = outline[polyNr][i];
-            int64_t xMin = p1.X, xMax = p0.X;
-            if (xMin == xMax) {
+            if (p0.X == p1.X) {
                 p0 = p1;
                 continue;
             }
-            if (xMin > xMax) { xMin = p0.X; xMax = p1.X; }
-
-            int scanline_idx0 = (p0.X + ((p0.X > 0)? -1 : -lineSpacing)) / lineSpacing; // -1 cause a linesegment on scanline x counts as belonging to scansegment x-1   ...
-            int scanline_idx1 = (p1.X + ((p1.X > 0)? -1 : -lineSpacing)) / lineSpacing; // -linespacing because a line between scanline -n and -n-1 belongs to scansegment -n-1 (for n=positive natural number)
-            int direction = 1;
-            if (p0.X > p1.X)
-            {
-                direction = -1;
-                scanline_idx1 += 1; // only consider the scanlines in between the scansegments
-            } else scanline_idx0 += 1; // only consider the scanlines in between the scansegments
 
+            EdgeScanlines scanlines(p0, p1, lineSpacing);
 
             if (isFirstBoundarySegment) firstBoundarySegment.push_back(p0);
             else boundarySegment.push_back(p0);
-            for(int scanline_idx = scanline_idx0; scanline_idx != scanline_idx1+direction; scanline_idx+=direction)
+            for(int scanline_idx = scanlines.first; scanline_idx != scanlines.end; scanline_idx += scanlines.direction)
             {
-                int x = scanline_idx * lineSpacing;
-                int y = p1.Y + (p0.Y - p1.Y) * (x - p1.X) / (p0.X - p1.X);
-                cutList[scanline_idx - scanline_min_idx].push_back(y);
+                Point crossing = scanlineCrossing(p0, p1, scanline_idx, lineSpacing);
+                int x = crossing.X;
+                int y = crossing.Y;
+                cutList.add(scanline_idx - scanline_min_idx, y);
 
 
                 bool last_isEvenScanSegment = isEvenScanSegment;
@@ -470,6 +685,7 @@ void generateZigZagInfill_noEndPieces(const Polygons& in_outline, Polygons& resu
     }
 
 
+    cutList.sortPerScanline();
     addLineInfill(result, matrix, scanline_min_idx, lineSpacing, boundary, cutList, extrusionWidth);
 
 }
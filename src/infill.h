@@ -2,15 +2,34 @@
 #ifndef INFILL_H
 #define INFILL_H
 
+#include <vector>
+
 #include "utils/polygon.h"
 
 namespace cura {
 
-void generateConcentricInfill(Polygons outline, Polygons& result, int inset_value);
-void generateConcentricInfillDense(Polygons outline, Polygons& result, Polygons* in_between, int extrusionWidth, bool avoidOverlappingPerimeters);
+void generateConcentricInfill(const Polygons& outline, Polygons& result, int inset_value);
+void generateConcentricInfillDense(const Polygons& outline, Polygons& result, Polygons* in_between, int extrusionWidth, bool avoidOverlappingPerimeters);
 void generateGridInfill(const Polygons& in_outline, int outlineOffset, Polygons& result, int extrusionWidth, int lineSpacing, int infillOverlap, double rotation);
 void generateTriangleInfill(const Polygons& in_outline, int outlineOffset, Polygons& result, int extrusionWidth, int lineSpacing, int infillOverlap, double rotation);
 void generateLineInfill(const Polygons& in_outline, int outlineOffset, Polygons& result, int extrusionWidth, int lineSpacing, int infillOverlap, double rotation);
+
+/*!
+ * Generate line infill for several areas with a single scanline pass over all of them.
+ *
+ * Each area gets the same lines as generateLineInfill would give it, since the scanlines lie on the same lattice for all areas
+ * and the crossings of each area are connected separately.
+ *
+ * \param in_outlines The areas to fill
+ * \param results For each area the polygons to which its lines are added
+ * The other parameters are those of generateLineInfill.
+ */
+void generateLineInfill(const std::vector<const Polygons*>& in_outlines, int outlineOffset, std::vector<Polygons>& results, int extrusionWidth, int lineSpacing, int infillOverlap, double rotation);
+//! Grid infill of several areas at once; see generateLineInfill(const std::vector<const Polygons*>&, ...)
+void generateGridInfill(const std::vector<const Polygons*>& in_outlines, int outlineOffset, std::vector<Polygons>& results, int extrusionWidth, int lineSpacing, int infillOverlap, double rotation);
+//! Triangle infill of several areas at once; see generateLineInfill(const std::vector<const Polygons*>&, ...)
+void generateTriangleInfill(const std::vector<const Polygons*>& in_outlines, int outlineOffset, std::vector<Polygons>& results, int extrusionWidth, int lineSpacing, int infillOverlap, double rotation);
+
 void generateZigZagInfill(const Polygons& in_outline, Polygons& result, int extrusionWidth, int lineSpacing, int infillOverlap, double rotation, bool connect_zigzags, bool use_endPieces);
 void generateZigZagInfill_endPieces(const Polygons& in_outline, Polygons& result, int extrusionWidth, int lineSpacing, int infillOverlap, double rotation, bool connect_zigzags);
 void generateZigZagInfill_noEndPieces(const Polygons& in_outline, Polygons& result, int extrusionWidth, int lineSpacing, int infillOverlap, double rotation);
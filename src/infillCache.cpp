@@ -0,0 +1,116 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#include "infillCache.h"
+
+namespace cura {
+
+namespace
+{
+
+/*!
+ * Hash of an outline together with the parameters of its infill.
+ */
+uint64_t hashInfillArea(const Polygons& outline, const InfillParameters& parameters)
+{
+    uint64_t hash = 14695981039346656037ull; // FNV-1a
+    auto mix = [&hash](int64_t value)
+    {
+        hash ^= static_cast<uint64_t>(value);
+        hash *= 1099511628211ull;
+    };
+    mix(parameters.pattern);
+    mix(parameters.outline_offset);
+    mix(parameters.extrusion_width);
+    mix(parameters.line_spacing);
+    mix(parameters.infill_overlap);
+    mix(static_cast<int64_t>(parameters.rotation * 1000));
+    mix(outline.size());
+    for (const ClipperLib::Path& poly : outline)
+    {
+        mix(poly.size());
+        for (const Point& p : poly)
+        {
+            mix(p.X);
+            mix(p.Y);
+        }
+    }
+    return hash;
+}
+
+}//anonymous namespace
+
+InfillCache::InfillCache()
+: memory_budget(0)
+, memory_used(0)
+, hit_count(0)
+, miss_count(0)
+{
+}
+
+void InfillCache::setMemoryBudget(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    memory_budget = bytes;
+    evict();
+}
+
+void InfillCache::generate(const Polygons& outline, const InfillParameters& parameters, Polygons& result, const std::function<void (Polygons&)>& generate)
+{
+    if (memory_budget == 0)
+    {
+        generate(result);
+        return;
+    }
+    uint64_t hash = hashInfillArea(outline, parameters);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto range = entries_by_hash.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            Entry& entry = *it->second;
+            if (entry.parameters == parameters && entry.outline == outline)
+            {
+                entries.splice(entries.begin(), entries, it->second);
+                result.add(entry.infill);
+                hit_count++;
+                return;
+            }
+        }
+        miss_count++;
+    }
+
+    Polygons infill;
+    generate(infill); // without the lock, so other threads can use the cache meanwhile
+    size_t memory = sizeof(Entry) + outline.getMemoryUsage() + infill.getMemoryUsage();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (memory <= memory_budget)
+        {
+            entries.push_front(Entry{hash, outline, parameters, infill, memory});
+            entries_by_hash.emplace(hash, entries.begin());
+            memory_used += memory;
+            evict();
+        }
+    }
+    result.add(infill);
+}
+
+void InfillCache::evict()
+{
+    while (memory_used > memory_budget)
+    {
+        std::list<Entry>::iterator oldest = std::prev(entries.end());
+        auto range = entries_by_hash.equal_range(oldest->hash);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (it->second == oldest)
+            {
+                entries_by_hash.erase(it);
+                break;
+            }
+        }
+        memory_used -= oldest->memory;
+        entries.erase(oldest);
+    }
+}
+
+}//namespace cura
@@ -0,0 +1,124 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#ifndef INFILL_CACHE_H
+#define INFILL_CACHE_H
+
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+#include "settings.h"
+#include "utils/polygon.h"
+
+/*
+The infill cache keeps the lines generated for an infill area, so that an area which comes back on a later layer with the
+same pattern, spacing, rotation and overlap doesn't go through the infill generator again. Line and grid infill only
+alternate between a couple of rotations, so prismatic parts hit the cache on nearly every layer.
+
+Entries are compared on the whole outline, not just on its hash, so a hit always gives exactly the lines the generator
+would have produced. The least recently used entries are evicted once the cache exceeds its memory budget.
+*/
+
+namespace cura {
+
+/*!
+ * Everything besides the outline which determines the infill generated for an area.
+ */
+struct InfillParameters
+{
+    EFillMethod pattern; //!< The infill generator to use
+    int outline_offset; //!< The offset applied to the outline before generating the infill
+    int extrusion_width; //!< The width of the infill lines
+    int line_spacing; //!< The distance between the infill lines, as passed to the generator
+    int infill_overlap; //!< The overlap of the infill with the outline, as a percentage of the extrusion width
+    double rotation; //!< The direction of the infill lines
+
+    bool operator==(const InfillParameters& other) const
+    {
+        return pattern == other.pattern && outline_offset == other.outline_offset && extrusion_width == other.extrusion_width
+            && line_spacing == other.line_spacing && infill_overlap == other.infill_overlap && rotation == other.rotation;
+    }
+};
+
+/*!
+ * A least recently used cache of generated infill, bounded by a memory budget.
+ *
+ * Thread safe, since the layers may be planned in parallel. Two threads filling the same new area at once both generate
+ * its infill, and the area may then be in the cache twice.
+ */
+class InfillCache
+{
+public:
+    InfillCache();
+
+    /*!
+     * Set the maximum amount of memory used by the cached outlines and infill, evicting entries to fit.
+     *
+     * \param bytes The budget in bytes; zero disables the cache
+     */
+    void setMemoryBudget(size_t bytes);
+
+    /*!
+     * Add the infill of an area to \p result, taking it from the cache when the same area was filled before.
+     *
+     * \param outline The area to fill
+     * \param parameters The parameters with which \p generate fills the area
+     * \param result The polygons to which the infill is added
+     * \param generate Generates the infill of \p outline into the polygons passed to it, which are empty
+     */
+    void generate(const Polygons& outline, const InfillParameters& parameters, Polygons& result, const std::function<void (Polygons&)>& generate);
+
+    /*!
+     * The number of areas for which the infill was taken from the cache, since the cache was created.
+     */
+    unsigned int getHitCount() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return hit_count;
+    }
+
+    /*!
+     * The number of areas for which the infill had to be generated, since the cache was created.
+     */
+    unsigned int getMissCount() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return miss_count;
+    }
+
+    /*!
+     * The memory used by the cached outlines and infill, in bytes.
+     */
+    size_t getMemoryUsed() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return memory_used;
+    }
+
+private:
+    struct Entry
+    {
+        uint64_t hash; //!< Hash of the outline and parameters
+        Polygons outline;
+        InfillParameters parameters;
+        Polygons infill; //!< The infill generated for the outline
+        size_t memory; //!< The estimated memory used by this entry
+    };
+
+    std::list<Entry> entries; //!< The cached entries, most recently used first
+    std::unordered_multimap<uint64_t, std::list<Entry>::iterator> entries_by_hash; //!< The entries, by Entry::hash
+    size_t memory_budget; //!< The maximum of memory_used
+    size_t memory_used; //!< The sum of Entry::memory over all entries
+    unsigned int hit_count;
+    unsigned int miss_count;
+    mutable std::mutex mutex; //!< Guards all of the above
+
+    /*!
+     * Evict the least recently used entries until the used memory fits in the budget.
+     */
+    void evict();
+};
+
+}//namespace cura
+
+#endif//INFILL_CACHE_H
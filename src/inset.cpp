@@ -2,8 +2,31 @@
 #include "inset.h"
 #include "polygonOptimizer.h"
 #include "utils/polygonUtils.h"
+#include "utils/distanceField.h"
 namespace cura {
 
+namespace
+{
+const uint64_t max_field_cell_count = 1 << 21; //!< The most grid points of the distance fields of a part, which take about 50MB while they are in use
+
+/*!
+ * Simplify a contour of a distance field, which has a point on each grid line it crosses, and append it as the next inset.
+ *
+ * \return Whether the inset has any polygons left
+ */
+bool addFieldInset(SliceLayerPart* part, Polygons inset, int64_t cell_size)
+{
+    simplifyPolygons(inset, cell_size / 4);
+    optimizePolygons(inset);
+    if (inset.size() < 1)
+    {
+        return false;
+    }
+    part->insets.push_back(std::move(inset));
+    return true;
+}
+}//namespace
+
 void generateInsets(SliceLayerPart* part, int line_width_0, int line_width_x, int insetCount, bool avoidOverlappingPerimeters)
 {
     int combBoundaryInset = line_width_x/2; // hard coded value
@@ -38,11 +61,77 @@ void generateInsets(SliceLayerPart* part, int line_width_0, int line_width_x, in
 }
 
 
-void generateInsets(SliceLayer* layer, int line_width_0, int line_width_x, int insetCount, bool avoidOverlappingPerimeters)
+bool generateFieldInsets(SliceLayerPart* part, int line_width_0, int line_width_x, int insetCount, bool avoidOverlappingPerimeters)
+{
+    int64_t cell_size = DistanceField::getCellSize(part->outline, line_width_x / 10, line_width_x / 4, max_field_cell_count);
+    if (cell_size == 0 || insetCount == 0)
+    {
+        return false;
+    }
+    DistanceField outline_field(part->outline, cell_size);
+    part->combBoundery = outline_field.getArea(line_width_x / 2);
+    if (!avoidOverlappingPerimeters)
+    {
+        // Each inset is the outline offset by the sum of the offsets of the insets before it.
+        int distance = line_width_x / 2;
+        for(int i=0; i<insetCount; i++)
+        {
+            if (i > 0)
+            {
+                distance += (i == 1)? line_width_0 : line_width_x;
+            }
+            if (!addFieldInset(part, outline_field.getArea(distance), cell_size))
+            {
+                break;
+            }
+        }
+        return true;
+    }
+
+    // Like offsetSafe and offsetExtrusionWidth: each inset is the area of the one before it shrunk by one and a half
+    // line width and grown by half a line width again, which drops the parts where the inset would overlap itself.
+    DistanceField shrunk = outline_field.getFieldOfArea(line_width_x);
+    int grown = line_width_x / 2;
+    if (!addFieldInset(part, shrunk.getArea(-grown), cell_size))
+    {
+        return true;
+    }
+    for(int i=1; i<insetCount; i++)
+    {
+        int line_width = (i == 1)? line_width_0 : line_width_x;
+        DistanceField previous = shrunk.getFieldOfArea(-grown);
+        shrunk = previous.getFieldOfArea(line_width * 3 / 2);
+        grown = line_width / 2;
+        part->perimeterGaps.add(DistanceField::getAreaDifference(previous, line_width / 2, shrunk, -line_width));
+        if (!addFieldInset(part, shrunk.getArea(-grown), cell_size))
+        {
+            break;
+        }
+    }
+    return true;
+}
+
+bool generateInsets(SliceLayer* layer, int line_width_0, int line_width_x, int insetCount, bool avoidOverlappingPerimeters, unsigned int field_point_count)
 {
+    bool use_field = false;
+    if (field_point_count > 0)
+    {
+        unsigned int point_count = 0;
+        for(SliceLayerPart& part : layer->parts)
+        {
+            for(const ClipperLib::Path& poly : part.outline)
+            {
+                point_count += poly.size();
+            }
+        }
+        use_field = point_count >= field_point_count;
+    }
     for(unsigned int partNr = 0; partNr < layer->parts.size(); partNr++)
     {
-        generateInsets(&layer->parts[partNr], line_width_0, line_width_x, insetCount, avoidOverlappingPerimeters);
+        if (!use_field || !generateFieldInsets(&layer->parts[partNr], line_width_0, line_width_x, insetCount, avoidOverlappingPerimeters))
+        {
+            generateInsets(&layer->parts[partNr], line_width_0, line_width_x, insetCount, avoidOverlappingPerimeters);
+        }
     }
     
     //Remove the parts which did not generate an inset. As these parts are too small to print,
@@ -55,6 +144,7 @@ void generateInsets(SliceLayer* layer, int line_width_0, int line_width_x, int i
             partNr -= 1;
         }
     }
+    return use_field;
 }
 
 }//namespace cura
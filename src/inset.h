@@ -18,6 +18,20 @@ namespace cura
  */
 void generateInsets(SliceLayerPart* part, int line_width_0, int line_width_x, int insetCount, bool avoidOverlappingPerimeters);
 
+/*!
+ * Generates the insets / perimeters for a single layer part from the distance field of its outline (see DistanceField)
+ * instead of by offsetting the outline, which is much faster for outlines of very many points. The insets are only
+ * accurate to a twentieth of the line width.
+ * 
+ * \param part The part for which to generate the insets.
+ * \param line_width_0 Line width of the outer wall
+ * \param line_width_x Line width of other walls
+ * \param insetCount The number of insets to to generate
+ * \param avoidOverlappingPerimeters Whether to remove the parts of two consecutive perimeters where they have overlap (and store the gaps thus created in the \p part)
+ * \return Whether the insets were generated; not when the part is too large for a distance field or has no insets
+ */
+bool generateFieldInsets(SliceLayerPart* part, int line_width_0, int line_width_x, int insetCount, bool avoidOverlappingPerimeters);
+
 /*!
  * Generates the insets / perimeters for all parts in a layer.
  * 
@@ -26,8 +40,10 @@ void generateInsets(SliceLayerPart* part, int line_width_0, int line_width_x, in
  * \param line_width_x Line width of other walls
  * \param insetCount The number of insets to to generate
  * \param avoidOverlappingPerimeters Whether to remove the parts of two consecutive perimeters where they have overlap (and store the gaps thus created in the \p part)
+ * \param field_point_count The number of points of the outlines of the layer from which on the insets of its parts are generated with generateFieldInsets; 0 to never do so
+ * \return Whether the insets of the layer were generated with generateFieldInsets, apart from the parts which are too large for it
  */ 
-void generateInsets(SliceLayer* layer, int line_width_0, int line_width_x, int insetCount, bool avoidOverlappingPerimeters);
+bool generateInsets(SliceLayer* layer, int line_width_0, int line_width_x, int insetCount, bool avoidOverlappingPerimeters, unsigned int field_point_count);
 
 }//namespace cura
 
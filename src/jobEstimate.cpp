@@ -0,0 +1,608 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#include "jobEstimate.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <limits>
+
+#include "modelFile/fileParsing.h"
+#include "modelFile/modelFile.h"
+#include "utils/floatpoint.h"
+#include "utils/parallel.h"
+#include "utils/string.h"
+
+namespace cura {
+
+namespace
+{
+
+const unsigned int max_sample_count = 16; //!< The most layers sampled for their area, perimeter and open ends
+const int64_t overhang_grid_size = 128; //!< The most cells of the grid along which the overhangs are measured, along x or y
+
+/*!
+ * The faces of a binary STL file, read from its mapping.
+ */
+class StlFaces
+{
+public:
+    StlFaces(const MappedFile& file, uint32_t face_count) : data(file.data() + 84), face_count(face_count) {}
+
+    size_t size() const { return face_count; }
+
+    void get(size_t face_idx, Point3* corners) const
+    {
+        float v[9];
+        memcpy(v, data + face_idx * bytes_per_face + sizeof(float) * 3, sizeof(v));
+        for (unsigned int corner = 0; corner < 3; corner++)
+        {
+            // the engine loads models with the identity matrix
+            corners[corner] = Point3(MM2INT(v[corner * 3]), MM2INT(v[corner * 3 + 1]), MM2INT(v[corner * 3 + 2]));
+        }
+    }
+
+    static const size_t bytes_per_face = sizeof(float) * 12 + sizeof(uint16_t);
+private:
+    const char* data;
+    uint32_t face_count;
+};
+
+/*!
+ * The faces of a loaded mesh.
+ */
+class MeshFaces
+{
+public:
+    MeshFaces(const Mesh& mesh) : mesh(mesh) {}
+
+    size_t size() const { return mesh.faces.size(); }
+
+    void get(size_t face_idx, Point3* corners) const
+    {
+        for (unsigned int corner = 0; corner < 3; corner++)
+        {
+            corners[corner] = mesh.vertices.positions[mesh.faces[face_idx].vertex_index[corner]];
+        }
+    }
+private:
+    const Mesh& mesh;
+};
+
+/*!
+ * A key for an edge which is the same whichever of its faces it is taken from.
+ */
+uint64_t getEdgeKey(const Point3& a, const Point3& b)
+{
+    const Point3& first = (a.x < b.x || (a.x == b.x && (a.y < b.y || (a.y == b.y && a.z < b.z))))? a : b;
+    const Point3& second = (&first == &a)? b : a;
+    uint64_t key = 14695981039346656037ull;
+    const int64_t coordinates[6] = { first.x, first.y, first.z, second.x, second.y, second.z };
+    for (int64_t coordinate : coordinates)
+    {
+        key = (key ^ uint64_t(coordinate)) * 1099511628211ull;
+        key ^= key >> 29;
+    }
+    return key;
+}
+
+/*!
+ * Where an edge crosses the plane at height \p z, in mm. The end points are put in a fixed order first, so that both
+ * faces of the edge give exactly the same point.
+ */
+FPoint3 getCrossing(const Point3& a, const Point3& b, int z)
+{
+    const Point3& low = (a.z < b.z)? a : b;
+    const Point3& high = (a.z < b.z)? b : a;
+    double t = double(z - low.z) / double(high.z - low.z);
+    return FPoint3(INT2MM(low.x + (high.x - low.x) * t), INT2MM(low.y + (high.y - low.y) * t), INT2MM(z));
+}
+
+/*!
+ * The area, perimeter and segments of a sampled layer.
+ */
+struct SampleLayer
+{
+    int z;
+    double signed_area = 0; // mm^2
+    double perimeter = 0; // mm
+    uint64_t segment_count = 0;
+    std::vector<std::pair<uint64_t, int>> ends; // the edge of each end of each segment, +1 for where it starts and -1 for where it ends
+};
+
+/*!
+ * Where a face crosses the vertical line through the centre of a cell of the grid over the build plate.
+ */
+struct ColumnCrossing
+{
+    unsigned int cell;
+    double z;
+    bool enters; //!< Whether the face points down, so that the line enters the model through it
+    bool overhang; //!< Whether the face needs support
+
+    bool operator<(const ColumnCrossing& other) const
+    {
+        // where one part sits on another, the line leaves the lower one before it enters the upper one
+        return cell < other.cell || (cell == other.cell && (z < other.z || (z == other.z && !enters && other.enters)));
+    }
+};
+
+/*!
+ * The settings which the statistics depend on.
+ */
+struct MeasureSettings
+{
+    int initial_slice_z; //!< The height at which the first layer is sliced
+    int layer_thickness;
+    double overhang_normal_z; //!< How far down the normal of a face has to point for the face to need support, as a fraction of its length
+    bool support_on_buildplate_only; //!< Whether only the support which stands on the build plate is kept
+
+    MeasureSettings(SettingsBase& settings)
+    {
+        int initial_layer_thickness = settings.getSettingInMicrons("layer_height_0");
+        layer_thickness = std::max(1, settings.getSettingInMicrons("layer_height"));
+        if (settings.getSettingAsPlatformAdhesion("adhesion_type") == Adhesion_Raft)
+        {
+            initial_layer_thickness = layer_thickness;
+        }
+        initial_slice_z = initial_layer_thickness - layer_thickness / 2;
+        // as generateSupportAreas, which supports what sticks out more than tan(support_angle) per layer
+        overhang_normal_z = std::sin(settings.getSettingInAngleRadians("support_angle"));
+        support_on_buildplate_only = settings.getSettingAsSupportType("support_type") == Support_PlatformOnly;
+    }
+
+    unsigned int getLayerCount(int model_max_z) const
+    {
+        return std::max(0, model_max_z - initial_slice_z) / layer_thickness + 1;
+    }
+};
+
+/*!
+ * Measure the faces of a model, or of one of its meshes.
+ *
+ * \param z_shift How much higher PrintObject::finalize puts the faces
+ */
+template<typename Faces>
+void measureFaces(const Faces& faces, const MeasureSettings& measure_settings, int z_shift, ModelStatistics& statistics)
+{
+    statistics.face_count = faces.size();
+    statistics.min = Point3(std::numeric_limits<int32_t>::max(), std::numeric_limits<int32_t>::max(), std::numeric_limits<int32_t>::max());
+    statistics.max = Point3(std::numeric_limits<int32_t>::min(), std::numeric_limits<int32_t>::min(), std::numeric_limits<int32_t>::min());
+    Point3 corners[3];
+    double signed_volume = 0;
+    for (size_t face_idx = 0; face_idx < faces.size(); face_idx++)
+    {
+        faces.get(face_idx, corners);
+        FPoint3 a(INT2MM(corners[0].x), INT2MM(corners[0].y), INT2MM(corners[0].z));
+        FPoint3 b(INT2MM(corners[1].x), INT2MM(corners[1].y), INT2MM(corners[1].z));
+        FPoint3 c(INT2MM(corners[2].x), INT2MM(corners[2].y), INT2MM(corners[2].z));
+        signed_volume += a.x * (b.y * c.z - b.z * c.y) + a.y * (b.z * c.x - b.x * c.z) + a.z * (b.x * c.y - b.y * c.x);
+        for (const Point3& corner : corners)
+        {
+            statistics.min.x = std::min(statistics.min.x, corner.x);
+            statistics.min.y = std::min(statistics.min.y, corner.y);
+            statistics.min.z = std::min(statistics.min.z, corner.z);
+            statistics.max.x = std::max(statistics.max.x, corner.x);
+            statistics.max.y = std::max(statistics.max.y, corner.y);
+            statistics.max.z = std::max(statistics.max.z, corner.z);
+        }
+    }
+    if (faces.size() == 0)
+    {
+        statistics.min = statistics.max = Point3(0, 0, 0);
+    }
+    statistics.min.z += z_shift;
+    statistics.max.z += z_shift;
+    statistics.layer_count = measure_settings.getLayerCount(statistics.max.z);
+
+    // The faces which need support and how far down the support under them goes, found along the vertical lines through
+    // the centres of a grid over the build plate. Going up such a line, a face pointing down enters the model and one
+    // pointing up leaves it; the support under a face which needs it reaches down to where the line last left the model,
+    // or to the build plate, unless the face is inside another part of the model. With support only on the build plate,
+    // only the first face along the line counts. The slicer doesn't care which way the faces are wound, so a mesh which
+    // is inside out is turned the right way first.
+    double down = (signed_volume < 0)? -1 : 1;
+    int64_t cell_size = std::max(int64_t(1), std::max(int64_t(statistics.max.x) - statistics.min.x, int64_t(statistics.max.y) - statistics.min.y) / overhang_grid_size + 1);
+    unsigned int cells_x = (int64_t(statistics.max.x) - statistics.min.x) / cell_size + 1;
+    std::vector<ColumnCrossing> crossings;
+    for (size_t face_idx = 0; face_idx < faces.size(); face_idx++)
+    {
+        faces.get(face_idx, corners);
+        Point3 u = corners[1] - corners[0];
+        Point3 v = corners[2] - corners[0];
+        double normal_x = double(u.y) * v.z - double(u.z) * v.y;
+        double normal_y = double(u.z) * v.x - double(u.x) * v.z;
+        double normal_z = double(u.x) * v.y - double(u.y) * v.x;
+        if (normal_z == 0)
+        {
+            continue;
+        }
+        double normal_length = std::sqrt(normal_x * normal_x + normal_y * normal_y + normal_z * normal_z);
+        ColumnCrossing crossing;
+        crossing.enters = down * normal_z < 0;
+        crossing.overhang = crossing.enters && -down * normal_z > measure_settings.overhang_normal_z * normal_length;
+        int64_t min_y = std::min(corners[0].y, std::min(corners[1].y, corners[2].y)) - statistics.min.y;
+        int64_t max_y = std::max(corners[0].y, std::max(corners[1].y, corners[2].y)) - statistics.min.y;
+        for (int64_t cell_y = std::max(int64_t(0), (min_y - cell_size / 2 + cell_size - 1) / cell_size); cell_y * cell_size + cell_size / 2 < max_y; cell_y++)
+        {
+            // the stretch of the row which the face covers, between where the row crosses two of its edges
+            double y = statistics.min.y + cell_y * cell_size + cell_size / 2;
+            double min_x = std::numeric_limits<double>::max();
+            double max_x = std::numeric_limits<double>::lowest();
+            for (unsigned int corner = 0; corner < 3; corner++)
+            {
+                const Point3& from = corners[corner];
+                const Point3& to = corners[(corner + 1) % 3];
+                if ((from.y <= y) != (to.y <= y))
+                {
+                    double x = from.x + (y - from.y) * (to.x - from.x) / (to.y - from.y);
+                    min_x = std::min(min_x, x);
+                    max_x = std::max(max_x, x);
+                }
+            }
+            for (int64_t cell_x = std::max(0.0, std::ceil((min_x - statistics.min.x) / cell_size - 0.5)); statistics.min.x + cell_x * cell_size + cell_size / 2 < max_x; cell_x++)
+            {
+                double x = statistics.min.x + cell_x * cell_size + cell_size / 2;
+                crossing.cell = cell_y * cells_x + cell_x;
+                crossing.z = corners[0].z - (normal_x * (x - corners[0].x) + normal_y * (y - corners[0].y)) / normal_z;
+                crossings.push_back(crossing);
+            }
+        }
+    }
+    std::sort(crossings.begin(), crossings.end());
+    statistics.overhang_volume = 0;
+    double cell_area = INT2MM(cell_size) * INT2MM(cell_size);
+    for (size_t crossing_idx = 0; crossing_idx < crossings.size(); )
+    {
+        unsigned int cell = crossings[crossing_idx].cell;
+        int depth = 0;
+        bool on_buildplate = true;
+        double floor_z = statistics.min.z - z_shift;
+        for ( ; crossing_idx < crossings.size() && crossings[crossing_idx].cell == cell; crossing_idx++)
+        {
+            const ColumnCrossing& crossing = crossings[crossing_idx];
+            if (!crossing.enters)
+            {
+                depth = std::max(0, depth - 1);
+                if (depth == 0)
+                {
+                    floor_z = crossing.z;
+                }
+                continue;
+            }
+            if (depth == 0 && crossing.overhang && (on_buildplate || !measure_settings.support_on_buildplate_only))
+            {
+                statistics.overhang_volume += cell_area * INT2MM(std::max(0.0, crossing.z - floor_z));
+            }
+            on_buildplate = false;
+            depth++;
+        }
+    }
+
+    // Sample layers spread evenly over the height, sliced where the engine slices them.
+    std::vector<SampleLayer> samples(std::min(max_sample_count, statistics.layer_count));
+    for (unsigned int sample_idx = 0; sample_idx < samples.size(); sample_idx++)
+    {
+        unsigned int layer_nr = (sample_idx * 2 + 1) * statistics.layer_count / (samples.size() * 2);
+        samples[sample_idx].z = measure_settings.initial_slice_z + layer_nr * measure_settings.layer_thickness - z_shift;
+    }
+    for (size_t face_idx = 0; face_idx < faces.size(); face_idx++)
+    {
+        faces.get(face_idx, corners);
+        int face_min_z = std::min(corners[0].z, std::min(corners[1].z, corners[2].z));
+        int face_max_z = std::max(corners[0].z, std::max(corners[1].z, corners[2].z));
+        for (SampleLayer& sample : samples)
+        {
+            if (sample.z <= face_min_z || sample.z > face_max_z)
+            {
+                continue; // all corners are on the same side: a corner is below the layer when it's lower than it
+            }
+            FPoint3 crossings[2];
+            uint64_t keys[2];
+            unsigned int crossing_count = 0;
+            for (unsigned int edge = 0; edge < 3 && crossing_count < 2; edge++)
+            {
+                const Point3& a = corners[edge];
+                const Point3& b = corners[(edge + 1) % 3];
+                if ((a.z < sample.z) != (b.z < sample.z))
+                {
+                    crossings[crossing_count] = getCrossing(a, b, sample.z);
+                    keys[crossing_count] = getEdgeKey(a, b);
+                    crossing_count++;
+                }
+            }
+            if (crossing_count < 2)
+            {
+                continue;
+            }
+            // Orient the segment so that the outside of the face is on its right, as on a counter-clockwise outline.
+            Point3 u = corners[1] - corners[0];
+            Point3 v = corners[2] - corners[0];
+            double normal_x = double(u.y) * v.z - double(u.z) * v.y;
+            double normal_y = double(u.z) * v.x - double(u.x) * v.z;
+            double dx = crossings[1].x - crossings[0].x;
+            double dy = crossings[1].y - crossings[0].y;
+            if (dy * normal_x - dx * normal_y < 0)
+            {
+                std::swap(crossings[0], crossings[1]);
+                std::swap(keys[0], keys[1]);
+            }
+            sample.signed_area += (crossings[0].x * crossings[1].y - crossings[1].x * crossings[0].y) / 2;
+            sample.perimeter += std::sqrt(dx * dx + dy * dy);
+            sample.segment_count++;
+            sample.ends.emplace_back(keys[0], 1);
+            sample.ends.emplace_back(keys[1], -1);
+        }
+    }
+
+    statistics.sample_count = samples.size();
+    statistics.slice_area = statistics.slice_perimeter = statistics.slice_segments = 0;
+    statistics.open_ends = 0;
+    for (SampleLayer& sample : samples)
+    {
+        statistics.slice_area += std::abs(sample.signed_area);
+        statistics.slice_perimeter += sample.perimeter;
+        statistics.slice_segments += sample.segment_count;
+        // On a closed mesh each edge a layer crosses starts one segment and ends another.
+        std::sort(sample.ends.begin(), sample.ends.end());
+        for (size_t end_idx = 0; end_idx < sample.ends.size();)
+        {
+            int balance = 0;
+            size_t next_idx = end_idx;
+            for (; next_idx < sample.ends.size() && sample.ends[next_idx].first == sample.ends[end_idx].first; next_idx++)
+            {
+                balance += sample.ends[next_idx].second;
+            }
+            statistics.open_ends += std::abs(balance);
+            end_idx = next_idx;
+        }
+    }
+    if (samples.size() > 0)
+    {
+        statistics.slice_area /= samples.size();
+        statistics.slice_perimeter /= samples.size();
+        statistics.slice_segments /= samples.size();
+    }
+}
+
+/*!
+ * A linear function of the amounts of geometry of a job.
+ */
+struct CostTerms
+{
+    double base;
+    double per_face;
+    double per_layer;
+    double per_segment; //!< per face crossed by a layer, over all layers
+    double per_wall_vertex; //!< per vertex of the walls, over all layers
+    double per_support_wall_vertex; //!< per vertex of the walls over all layers, when support is enabled
+    double per_overhang_mm2; //!< per mm^2 of the layers under the overhangs, when support is enabled
+    double per_support_box_mm2; //!< per mm^2 of the layers under the bounding box of the model, when support is enabled
+    double per_layer_path_mm; //!< per mm of walls, skin and infill lines of a layer
+    bool per_layer_stage; //!< Whether the stage processes the layers in parallel
+};
+
+/*!
+ * The amounts of geometry of a job, the variables of CostTerms.
+ */
+struct JobAmounts
+{
+    double faces;
+    double layers;
+    double segments;
+    double wall_vertices;
+    double support_wall_vertices;
+    double overhang_mm2;
+    double support_box_mm2;
+    double layer_path_mm;
+
+    double apply(const CostTerms& terms) const
+    {
+        return terms.base + terms.per_face * faces + terms.per_layer * layers + terms.per_segment * segments
+            + terms.per_wall_vertex * wall_vertices + terms.per_support_wall_vertex * support_wall_vertices
+            + terms.per_overhang_mm2 * overhang_mm2 + terms.per_support_box_mm2 * support_box_mm2 + terms.per_layer_path_mm * layer_path_mm;
+    }
+};
+
+// The seconds per amount of each stage the engine logs the time of, on a single thread. Fitted to the benchmark models
+// and a few spheres, a torus and a cylinder, with layers of 0.1 to 2 mm, 3 or 100 walls, sparse infill and support;
+// the median error is 10% but for the layers, whose time depends on how many layers turn out to be alike, where it is 16%.
+const std::vector<std::pair<const char*, CostTerms>> stage_time_terms = {
+    {"load",        {0,         7.205e-7,  0,         0,         0,        0,        0,         0,         0, false}},
+    {"slice",       {6.32e-5,   5.468e-8,  0,         1.468e-7,  0,        0,        0,         0,         0, false}},
+    {"layer_parts", {1.497e-4,  0,         1.76e-5,   4.244e-8,  0,        0,        0,         0,         0, true}},
+    {"support",     {1.971e-4,  0,         3.335e-7,  0,         0,        0,        6.835e-6,  1.105e-9,  0, false}},
+    {"layers",      {0.05709,   0,         3.611e-5,  0,         3.516e-8, 2.791e-7, 1.344e-4,  0,         0, true}},
+};
+const double indexed_load_factor = 0.45; //!< The time of loading an indexed format relative to a binary STL file with as many faces
+
+// The bytes per amount accounted after each stage the engine logs the memory of.
+const std::vector<std::pair<const char*, CostTerms>> stage_memory_terms = {
+    {"load",        {1009,      44.74,     0,         0,         0,        0,        0,         0,         0, false}},
+    {"slice",       {1.035e4,   47.99,     0,         4.024,     0,        0,        0,         0,         0, false}},
+    {"layer_parts", {0,         0,         1734,      7.831,     0,        0,        0,         0,         0, false}},
+    {"support",     {0,         0,         932.4,     3.901,     0,        0,        0,         0,         0, false}},
+};
+// The bytes resident at the peak: the accounted memory and besides it the code, the allocator and the paths of the layers
+// in flight. Within 10% of the measured peak for half of the jobs and within 20% for nine out of ten.
+const CostTerms resident_terms = {9.101e6, 155.8, 0, 53.24, 0, 0, 0, 0, 174.2, false};
+
+}//namespace
+
+bool measureModel(const std::string& filename, SettingsBase& settings, ModelStatistics& statistics)
+{
+    MeasureSettings measure_settings(settings);
+
+    const char* ext = strrchr(filename.c_str(), '.');
+    if (ext && stringcasecompare(ext, ".stl") == 0)
+    {
+        MappedFile file(filename.c_str());
+        if (!file.isValid())
+        {
+            return false;
+        }
+        uint32_t face_count = 0;
+        if (file.size() >= 84)
+        {
+            memcpy(&face_count, file.data() + 80, sizeof(face_count));
+        }
+        bool binary = file.size() >= 84 && (file.size() - 84) / StlFaces::bytes_per_face >= face_count
+            && (strncmp(file.data(), "solid", 5) != 0 || file.size() == 84 + face_count * StlFaces::bytes_per_face);
+        if (binary)
+        {
+            StlFaces faces(file, face_count);
+            int z_shift = 0;
+            if (settings.hasSetting("mesh_position_x") || settings.hasSetting("mesh_position_y") || settings.hasSetting("mesh_position_z"))
+            { // as PrintObject::finalize
+                measureFaces(faces, measure_settings, 0, statistics);
+                z_shift = -statistics.min.z + (settings.hasSetting("mesh_position_z")? settings.getSettingInMicrons("mesh_position_z") : 0);
+            }
+            statistics.indexed = false;
+            measureFaces(faces, measure_settings, z_shift, statistics);
+            return true;
+        }
+    }
+
+    // The other formats are loaded as usual; only ASCII STL files are welded then.
+    PrintObject object(&settings);
+    FMatrix3x3 matrix;
+    if (!loadMeshFromFile(&object, filename.c_str(), matrix))
+    {
+        return false;
+    }
+    object.finalize();
+    statistics.indexed = !(ext && stringcasecompare(ext, ".stl") == 0);
+    ModelStatistics total;
+    total.face_count = 0;
+    total.open_ends = 0;
+    total.slice_area = total.slice_perimeter = total.slice_segments = 0;
+    total.overhang_volume = 0;
+    for (unsigned int mesh_idx = 0; mesh_idx < object.meshes.size(); mesh_idx++)
+    {
+        ModelStatistics mesh_statistics;
+        measureFaces(MeshFaces(object.meshes[mesh_idx]), measure_settings, 0, mesh_statistics);
+        if (mesh_idx == 0)
+        {
+            total.min = mesh_statistics.min;
+            total.max = mesh_statistics.max;
+        }
+        total.min = Point3(std::min(total.min.x, mesh_statistics.min.x), std::min(total.min.y, mesh_statistics.min.y), std::min(total.min.z, mesh_statistics.min.z));
+        total.max = Point3(std::max(total.max.x, mesh_statistics.max.x), std::max(total.max.y, mesh_statistics.max.y), std::max(total.max.z, mesh_statistics.max.z));
+        // each mesh is sliced over the layers of the whole model, so its means are scaled to those layers below
+        total.face_count += mesh_statistics.face_count;
+        total.open_ends += mesh_statistics.open_ends;
+        total.overhang_volume += mesh_statistics.overhang_volume;
+        total.slice_area += mesh_statistics.slice_area * mesh_statistics.layer_count;
+        total.slice_perimeter += mesh_statistics.slice_perimeter * mesh_statistics.layer_count;
+        total.slice_segments += mesh_statistics.slice_segments * mesh_statistics.layer_count;
+    }
+    if (object.meshes.empty())
+    {
+        total.min = total.max = Point3(0, 0, 0);
+    }
+    total.layer_count = measure_settings.getLayerCount(total.max.z);
+    total.sample_count = std::min(max_sample_count, total.layer_count);
+    total.slice_area /= total.layer_count;
+    total.slice_perimeter /= total.layer_count;
+    total.slice_segments /= total.layer_count;
+    total.indexed = statistics.indexed;
+    statistics = total;
+    return true;
+}
+
+JobEstimate estimateJob(const ModelStatistics& statistics, SettingsBase& settings)
+{
+    // The walls go round the outlines until they fill the layer; the skin and infill lines fill what is left.
+    double wall_width = std::max(0.01, INT2MM(settings.getSettingInMicrons("wall_line_width_x")));
+    double infill_width = std::max(0.01, INT2MM(settings.getSettingInMicrons("infill_line_width")));
+    double infill_distance = INT2MM(settings.getSettingInMicrons("infill_line_distance"));
+    double layer_count = statistics.layer_count;
+    double wall_mm = std::min(std::max(0, settings.getSettingAsCount("wall_line_count")) * statistics.slice_perimeter, statistics.slice_area / wall_width);
+    double inner_area = std::max(0.0, statistics.slice_area - wall_mm * wall_width);
+    double skin_share = std::min(1.0, std::max(0, settings.getSettingAsCount("top_layers") + settings.getSettingAsCount("bottom_layers")) / std::max(1.0, layer_count));
+    double infill_share = (infill_distance > 0)? std::min(1.0, infill_width / infill_distance) : 0.0;
+    double fill_mm = inner_area / infill_width * (skin_share + (1 - skin_share) * infill_share);
+
+    // The walls of a layer have about as many vertices as its outlines, as many times as walls fit in.
+    double wall_count = (statistics.slice_perimeter > 0)? wall_mm / statistics.slice_perimeter : 0;
+    bool support = settings.getSettingBoolean("support_enable") && settings.getSettingAsSupportType("support_type") != Support_None;
+
+    JobAmounts amounts;
+    amounts.faces = statistics.face_count;
+    amounts.layers = layer_count;
+    amounts.segments = statistics.slice_segments * layer_count;
+    amounts.wall_vertices = wall_count * statistics.slice_segments * layer_count;
+    amounts.support_wall_vertices = support? amounts.wall_vertices : 0;
+    amounts.overhang_mm2 = support? statistics.overhang_volume / std::max(0.001, INT2MM(settings.getSettingInMicrons("layer_height"))) : 0;
+    amounts.support_box_mm2 = support? INT2MM(statistics.max.x - statistics.min.x) * INT2MM(statistics.max.y - statistics.min.y) * layer_count : 0;
+    amounts.layer_path_mm = wall_mm + fill_mm;
+
+    JobEstimate estimate;
+    estimate.thread_count = getThreadCount(settings.getSettingAsCount("machine_thread_count"));
+    unsigned int layer_threads = std::max(1u, std::min(estimate.thread_count, statistics.layer_count));
+    estimate.cpu_seconds = 0;
+    estimate.wall_seconds = 0;
+    for (const std::pair<const char*, CostTerms>& stage : stage_time_terms)
+    {
+        double seconds = std::max(0.0, amounts.apply(stage.second));
+        if (stage.first == std::string("load") && statistics.indexed)
+        {
+            seconds *= indexed_load_factor;
+        }
+        estimate.stage_seconds.emplace_back(stage.first, seconds);
+        estimate.cpu_seconds += seconds;
+        estimate.wall_seconds += stage.second.per_layer_stage? seconds / layer_threads : seconds;
+    }
+    for (const std::pair<const char*, CostTerms>& stage : stage_memory_terms)
+    {
+        estimate.stage_memory.emplace_back(stage.first, std::max(0.0, amounts.apply(stage.second)));
+    }
+    estimate.peak_memory = std::max(0.0, amounts.apply(resident_terms));
+    return estimate;
+}
+
+void writeJobEstimate(std::ostream& out, const std::string& filename, const ModelStatistics& statistics, const JobEstimate& estimate, double measure_seconds)
+{
+    std::string escaped;
+    for (char c : filename)
+    {
+        if (c == '"' || c == '\\')
+        {
+            escaped += '\\';
+        }
+        escaped += c;
+    }
+    out << std::fixed << std::setprecision(3);
+    out << "{\"model\": \"" << escaped << "\"";
+    out << ", \"faces\": " << statistics.face_count;
+    out << ", \"min\": [" << INT2MM(statistics.min.x) << ", " << INT2MM(statistics.min.y) << ", " << INT2MM(statistics.min.z) << "]";
+    out << ", \"max\": [" << INT2MM(statistics.max.x) << ", " << INT2MM(statistics.max.y) << ", " << INT2MM(statistics.max.z) << "]";
+    out << ", \"layers\": " << statistics.layer_count;
+    out << ", \"sampled_layers\": " << statistics.sample_count;
+    out << ", \"layer_area_mm2\": " << statistics.slice_area;
+    out << ", \"layer_perimeter_mm\": " << statistics.slice_perimeter;
+    out << ", \"layer_faces\": " << statistics.slice_segments;
+    out << ", \"open_ends\": " << statistics.open_ends;
+    out << ", \"closed\": " << ((statistics.open_ends == 0)? "true" : "false");
+    out << ", \"overhang_volume_mm3\": " << statistics.overhang_volume;
+    out << ", \"seconds\": {";
+    for (unsigned int stage_idx = 0; stage_idx < estimate.stage_seconds.size(); stage_idx++)
+    {
+        out << ((stage_idx > 0)? ", " : "") << "\"" << estimate.stage_seconds[stage_idx].first << "\": " << estimate.stage_seconds[stage_idx].second;
+    }
+    out << "}";
+    out << ", \"cpu_seconds\": " << estimate.cpu_seconds;
+    out << ", \"threads\": " << estimate.thread_count;
+    out << ", \"wall_seconds\": " << estimate.wall_seconds;
+    out << ", \"memory_mb\": {";
+    for (unsigned int stage_idx = 0; stage_idx < estimate.stage_memory.size(); stage_idx++)
+    {
+        out << ((stage_idx > 0)? ", " : "") << "\"" << estimate.stage_memory[stage_idx].first << "\": " << estimate.stage_memory[stage_idx].second / (1024.0 * 1024.0);
+    }
+    out << "}";
+    out << ", \"peak_memory_mb\": " << estimate.peak_memory / (1024.0 * 1024.0);
+    out << ", \"measure_seconds\": " << measure_seconds;
+    out << "}" << std::endl;
+}
+
+}//namespace cura
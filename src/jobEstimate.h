@@ -0,0 +1,80 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#ifndef JOB_ESTIMATE_H
+#define JOB_ESTIMATE_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "settings.h"
+#include "utils/intpoint.h"
+
+/*
+Predicting what a job will cost before slicing it, so that a farm can send it to a node with the time and memory to
+spare. The model is measured rather than loaded: a binary STL file is read straight from its mapping without welding its
+vertices, and instead of slicing every layer a few layers are sampled for the area, the perimeter and the faces crossed
+per layer. That takes a small fraction of the time of slicing the model, and the other formats cost what their loaders
+cost, which don't weld either.
+
+The time of each stage is predicted as a linear function of the amount of geometry it goes through, and the memory
+after each stage in the same way, with coefficients fitted to the models of the benchmark (see src/bench/) sliced with a
+range of layer heights, walls, infill and support. The time is that of a single thread; the layers are processed in
+parallel, so the wall clock time is predicted as the time of the stages which go through the layers divided by the
+threads which will work on them.
+*/
+namespace cura {
+
+/*!
+ * What measureModel finds out about a model.
+ */
+struct ModelStatistics
+{
+    uint64_t face_count;
+    Point3 min; //!< The corner of the bounding box of the model with the lowest coordinates
+    Point3 max; //!< The corner of the bounding box of the model with the highest coordinates
+    unsigned int layer_count; //!< The number of layers with the uniform layer height
+    unsigned int sample_count; //!< The number of layers sampled
+    double slice_area; //!< The mean area of the sampled layers, in mm^2
+    double slice_perimeter; //!< The mean length of the outlines of the sampled layers, in mm
+    double slice_segments; //!< The mean number of faces crossed by a sampled layer
+    uint64_t open_ends; //!< The ends of the outline segments of the sampled layers which don't meet another one; zero when the mesh is closed
+    double overhang_volume; //!< The volume between the faces which need support at support_angle and what is under them, in mm^3
+    bool indexed; //!< Whether the file lists its vertices once, so that loading it needn't weld them
+};
+
+/*!
+ * Measure a model file of any format loadMeshFromFile loads.
+ *
+ * \param filename The model file
+ * \param settings The settings for the layer heights and the position of the model
+ * \param statistics Output parameter: the statistics of the model
+ * \return Whether the file could be read
+ */
+bool measureModel(const std::string& filename, SettingsBase& settings, ModelStatistics& statistics);
+
+/*!
+ * The predicted cost of slicing a model.
+ */
+struct JobEstimate
+{
+    std::vector<std::pair<std::string, double>> stage_seconds; //!< Per stage the engine logs the time of, the time on a single thread
+    std::vector<std::pair<std::string, size_t>> stage_memory; //!< Per stage which the engine logs the memory of, the memory accounted after it
+    double cpu_seconds; //!< The time of all stages on a single thread
+    double wall_seconds; //!< The time of all stages with the threads of machine_thread_count
+    unsigned int thread_count;
+    size_t peak_memory; //!< The most memory the process will take, accounted or not
+};
+
+/*!
+ * Predict the cost of slicing a model with the given settings.
+ */
+JobEstimate estimateJob(const ModelStatistics& statistics, SettingsBase& settings);
+
+/*!
+ * Write the statistics and the estimate of a model as a JSON object on one line, for a scheduler to read.
+ */
+void writeJobEstimate(std::ostream& out, const std::string& filename, const ModelStatistics& statistics, const JobEstimate& estimate, double measure_seconds);
+
+}//namespace cura
+
+#endif//JOB_ESTIMATE_H
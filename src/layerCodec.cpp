@@ -0,0 +1,169 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#include "layerCodec.h"
+
+#include "utils/logoutput.h"
+#include "utils/varint.h"
+
+namespace cura {
+
+/*
+Layout of an encoded layer, all integers are varints:
+    the number of parts
+    for each part: the corners of its bounding box, its outline, comb boundary, insets, skin parts, sparse outlines and perimeter gaps
+        for each skin part: its outline, insets and perimeter gaps
+    the open lines
+where a list of Polygons is a count followed by the Polygons, and Polygons are the number of polygons followed by, for each
+polygon, the number of points and the points as zigzag encoded differences to the previous point; the first point of a
+polygon follows the origin of the part.
+*/
+
+void encodePolygons(const Polygons& polygons, Point origin, std::vector<unsigned char>& out)
+{
+    writeVarInt(out, polygons.size());
+    for (const ClipperLib::Path& path : polygons)
+    {
+        writeVarInt(out, path.size());
+        Point previous = origin;
+        for (const Point& p : path)
+        {
+            writeSignedVarInt(out, p.X - previous.X);
+            writeSignedVarInt(out, p.Y - previous.Y);
+            previous = p;
+        }
+    }
+}
+
+void decodePolygons(VarIntReader& reader, Point origin, Polygons& polygons)
+{
+    uint64_t polygon_count = reader.readCount();
+    for (uint64_t polygon_idx = 0; polygon_idx < polygon_count && !reader.failed; polygon_idx++)
+    {
+        PolygonRef polygon = polygons.newPoly();
+        uint64_t point_count = reader.readCount();
+        Point p = origin;
+        for (uint64_t point_idx = 0; point_idx < point_count && !reader.failed; point_idx++)
+        {
+            p.X += reader.readSignedVarInt();
+            p.Y += reader.readSignedVarInt();
+            polygon.add(p);
+        }
+    }
+}
+
+namespace
+{
+void encodePolygonsList(const std::vector<Polygons>& list, Point origin, std::vector<unsigned char>& out)
+{
+    writeVarInt(out, list.size());
+    for (const Polygons& polygons : list)
+    {
+        encodePolygons(polygons, origin, out);
+    }
+}
+
+void decodePolygonsList(VarIntReader& reader, Point origin, std::vector<Polygons>& list)
+{
+    list.resize(reader.readCount());
+    for (Polygons& polygons : list)
+    {
+        decodePolygons(reader, origin, polygons);
+    }
+}
+}//namespace
+
+void encodeLayer(const SliceLayer& layer, std::vector<unsigned char>& out)
+{
+    writeVarInt(out, layer.parts.size());
+    for (const SliceLayerPart& part : layer.parts)
+    {
+        Point origin = part.boundaryBox.min;
+        writeSignedVarInt(out, origin.X);
+        writeSignedVarInt(out, origin.Y);
+        writeSignedVarInt(out, part.boundaryBox.max.X - origin.X);
+        writeSignedVarInt(out, part.boundaryBox.max.Y - origin.Y);
+        encodePolygons(part.outline, origin, out);
+        encodePolygons(part.combBoundery, origin, out);
+        encodePolygonsList(part.insets, origin, out);
+        writeVarInt(out, part.skin_parts.size());
+        for (const SkinPart& skin_part : part.skin_parts)
+        {
+            encodePolygons(skin_part.outline, origin, out);
+            encodePolygonsList(skin_part.insets, origin, out);
+            encodePolygons(skin_part.perimeterGaps, origin, out);
+        }
+        encodePolygonsList(part.sparse_outline, origin, out);
+        encodePolygons(part.perimeterGaps, origin, out);
+    }
+    encodePolygons(layer.openLines, Point(0, 0), out);
+}
+
+bool decodeLayer(const std::vector<unsigned char>& data, SliceLayer& layer)
+{
+    return decodeLayer(data.data(), data.size(), layer);
+}
+
+bool decodeLayer(const unsigned char* data, size_t size, SliceLayer& layer)
+{
+    VarIntReader reader(data, size, 0);
+    layer.parts.clear();
+    layer.parts.resize(reader.readCount());
+    for (SliceLayerPart& part : layer.parts)
+    {
+        Point origin;
+        origin.X = reader.readSignedVarInt();
+        origin.Y = reader.readSignedVarInt();
+        part.boundaryBox.min = origin;
+        part.boundaryBox.max.X = origin.X + reader.readSignedVarInt();
+        part.boundaryBox.max.Y = origin.Y + reader.readSignedVarInt();
+        decodePolygons(reader, origin, part.outline);
+        decodePolygons(reader, origin, part.combBoundery);
+        decodePolygonsList(reader, origin, part.insets);
+        part.skin_parts.resize(reader.readCount());
+        for (SkinPart& skin_part : part.skin_parts)
+        {
+            decodePolygons(reader, origin, skin_part.outline);
+            decodePolygonsList(reader, origin, skin_part.insets);
+            decodePolygons(reader, origin, skin_part.perimeterGaps);
+        }
+        decodePolygonsList(reader, origin, part.sparse_outline);
+        decodePolygons(reader, origin, part.perimeterGaps);
+        if (reader.failed)
+        {
+            break;
+        }
+    }
+    layer.openLines = Polygons();
+    decodePolygons(reader, Point(0, 0), layer.openLines);
+    if (reader.failed || reader.pos != size)
+    {
+        layer.parts.clear();
+        return false;
+    }
+    return true;
+}
+
+void freezeLayer(SliceLayer& layer)
+{
+    std::vector<unsigned char> compact;
+    encodeLayer(layer, compact);
+    compact.shrink_to_fit();
+    layer.compact.swap(compact);
+    std::vector<SliceLayerPart>().swap(layer.parts);
+    layer.openLines = Polygons();
+}
+
+bool thawLayer(SliceLayer& layer)
+{
+    if (layer.compact.empty())
+    {
+        return false;
+    }
+    if (!decodeLayer(layer.compact, layer))
+    {
+        logError("A frozen layer is corrupt\n");
+    }
+    std::vector<unsigned char>().swap(layer.compact);
+    return true;
+}
+
+}//namespace cura
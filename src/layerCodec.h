@@ -0,0 +1,68 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#ifndef LAYER_CODEC_H
+#define LAYER_CODEC_H
+
+#include <vector>
+
+#include "sliceDataStorage.h"
+#include "utils/varint.h"
+
+/*
+The compact encoding of the parts of a layer, for the layers which are done with one stage and only read again in a later
+one. Each point is stored as the difference to the point before it, and the first point of each polygon of a part as the
+difference to the corner of the bounding box of the part, all as varints; so most coordinates take one or two bytes
+instead of eight, and the whole layer is one buffer without the slack of the vectors of each polygon.
+
+The comb of each part isn't encoded, so it has to be prepared again after decoding.
+*/
+
+namespace cura {
+
+/*!
+ * Encode the parts and open lines of a layer.
+ *
+ * \param layer The layer
+ * \param out The encoding is appended to this
+ */
+void encodeLayer(const SliceLayer& layer, std::vector<unsigned char>& out);
+
+/*!
+ * Decode the parts and open lines of a layer, replacing those it has.
+ *
+ * \param data The encoding made by encodeLayer
+ * \param layer The layer
+ * \return Whether \p data could be decoded; if not, the layer is left without parts
+ */
+bool decodeLayer(const std::vector<unsigned char>& data, SliceLayer& layer);
+
+/*!
+ * Decode the parts and open lines of a layer from \p size bytes at \p data, such as in a memory mapped file.
+ */
+bool decodeLayer(const unsigned char* data, size_t size, SliceLayer& layer);
+
+/*!
+ * Encode polygons the way the polygons of the parts are encoded: each point as the difference to the point before it,
+ * and the first point of each polygon as the difference to \p origin.
+ */
+void encodePolygons(const Polygons& polygons, Point origin, std::vector<unsigned char>& out);
+
+/*!
+ * Decode polygons encoded by encodePolygons, adding them to \p polygons.
+ */
+void decodePolygons(VarIntReader& reader, Point origin, Polygons& polygons);
+
+/*!
+ * Replace the parts and open lines of a layer by their encoding in SliceLayer::compact, and free them.
+ */
+void freezeLayer(SliceLayer& layer);
+
+/*!
+ * Decode the parts and open lines of a frozen layer and free its encoding.
+ *
+ * \return Whether the layer was frozen
+ */
+bool thawLayer(SliceLayer& layer);
+
+}//namespace cura
+
+#endif//LAYER_CODEC_H
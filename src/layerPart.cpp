@@ -2,7 +2,10 @@
 #include <stdio.h>
 
 #include "layerPart.h"
+#include "polygonOptimizer.h"
 #include "settings.h"
+#include "utils/parallel.h"
+#include "utils/trace.h"
 
 /*
 The layer-part creation step is the first step in creating actual useful data for 3D printing.
@@ -41,17 +44,45 @@ void createLayerWithParts(SliceLayer& storageLayer, SlicerLayer* layer, bool uni
     }
 }
 
-void createLayerParts(SliceMeshStorage& storage, Slicer* slicer, bool union_layers, bool union_all_remove_holes)
+void createLayerParts(SliceMeshStorage& storage, Slicer* slicer, bool union_layers, bool union_all_remove_holes, unsigned int thread_count)
 {
-    for(unsigned int layer_nr = 0; layer_nr < slicer->layers.size(); layer_nr++)
+    // The parts of a layer only depend on the slice of that layer, so the layers are split into parts in parallel.
+    unsigned int first_layer_nr = storage.layers.size();
+    storage.layers.resize(first_layer_nr + slicer->layers.size());
+    parallelFor(slicer->layers.size(), thread_count, [&](unsigned int layer_nr)
     {
-        storage.layers.push_back(SliceLayer());
-        storage.layers[layer_nr].sliceZ = slicer->layers[layer_nr].z;
-        storage.layers[layer_nr].printZ = slicer->layers[layer_nr].z;
-        createLayerWithParts(storage.layers[layer_nr], &slicer->layers[layer_nr], union_layers, union_all_remove_holes);
-        
-        logProgress("layerparts", layer_nr + 1, slicer->layers.size());
-    }
+        TRACE_ZONE("layer parts", layer_nr);
+        StatsScope stats_scope(getStatsContext().stage, layer_nr);
+        SliceLayer& layer = storage.layers[first_layer_nr + layer_nr];
+        layer.sliceZ = slicer->layers[layer_nr].z;
+        layer.printZ = slicer->layers[layer_nr].z;
+        createLayerWithParts(layer, &slicer->layers[layer_nr], union_layers, union_all_remove_holes);
+    });
+    logProgress("layerparts", slicer->layers.size(), slicer->layers.size());
+}
+
+unsigned int simplifyLayerParts(SliceMeshStorage& storage, int64_t max_deviation, unsigned int thread_count)
+{
+    return parallelReduce(storage.layers.size(), thread_count, 0u, [&](unsigned int layer_nr)
+    {
+        TRACE_ZONE("simplify", layer_nr);
+        StatsScope stats_scope(getStatsContext().stage, layer_nr);
+        SliceLayer& layer = storage.layers[layer_nr];
+        unsigned int removed = 0;
+        for(unsigned int part_idx = 0; part_idx < layer.parts.size(); part_idx++)
+        {
+            SliceLayerPart& part = layer.parts[part_idx];
+            removed += simplifyPolygons(part.outline, max_deviation);
+            if (part.outline.size() == 0)
+            {
+                layer.parts.erase(layer.parts.begin() + part_idx);
+                part_idx--;
+                continue;
+            }
+            part.boundaryBox.calculate(part.outline);
+        }
+        return removed;
+    }, [](unsigned int a, unsigned int b) { return a + b; });
 }
 
 void dumpLayerparts(SliceDataStorage& storage, const char* filename)
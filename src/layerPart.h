@@ -21,7 +21,21 @@ namespace cura {
 
 void createLayerWithParts(SliceLayer& storageLayer, SlicerLayer* layer, bool union_layers, bool union_all_remove_holes);
 
-void createLayerParts(SliceMeshStorage& storage, Slicer* slicer, bool union_layers, bool union_all_remove_holes);
+/*!
+ * Split each layer of a slicer into parts and add them as the layers of \p storage.
+ * \param thread_count The number of threads with which to split the layers
+ */
+void createLayerParts(SliceMeshStorage& storage, Slicer* slicer, bool union_layers, bool union_all_remove_holes, unsigned int thread_count);
+
+/*!
+ * Simplify the outlines of the parts of all layers of \p storage with simplifyPolygons, and drop the parts left without
+ * an outline.
+ *
+ * \param max_deviation How far the simplified outlines may be from the original ones
+ * \param thread_count The number of threads with which to simplify the layers
+ * \return The number of points removed
+ */
+unsigned int simplifyLayerParts(SliceMeshStorage& storage, int64_t max_deviation, unsigned int thread_count);
 
 void dumpLayerparts(SliceDataStorage& storage, const char* filename);
 
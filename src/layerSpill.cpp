@@ -0,0 +1,119 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#include "layerSpill.h"
+
+#include <atomic>
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "layerCodec.h"
+#include "utils/logoutput.h"
+
+namespace cura {
+
+namespace
+{
+std::atomic<unsigned int> spill_file_count(0); //!< To give each scratch file of this process its own name
+}//namespace
+
+LayerSpill::LayerSpill(const std::string& directory, unsigned int mesh_count, unsigned int layer_count)
+: file(nullptr)
+, file_size(0)
+, entries(mesh_count, std::vector<Entry>(layer_count, Entry{0, 0}))
+{
+#ifdef _WIN32
+    int pid = _getpid();
+#else
+    int pid = getpid();
+#endif
+    char name[64];
+    snprintf(name, sizeof(name), "cura_spill_%d_%u.tmp", pid, spill_file_count++);
+    if (directory.empty() || directory[directory.size() - 1] == '/' || directory[directory.size() - 1] == '\\')
+    {
+        filename = directory + name;
+    }
+    else
+    {
+        filename = directory + "/" + name;
+    }
+    file = fopen(filename.c_str(), "w+b");
+    if (!file)
+    {
+        logError("Cannot create the scratch file %s, so the layers are kept in memory\n", filename.c_str());
+    }
+}
+
+LayerSpill::~LayerSpill()
+{
+    if (file)
+    {
+        fclose(file);
+        remove(filename.c_str());
+    }
+}
+
+size_t LayerSpill::spill(unsigned int mesh_idx, unsigned int layer_nr, SliceLayer& layer)
+{
+    if (!file)
+    {
+        return 0;
+    }
+    std::vector<unsigned char> data;
+    encodeLayer(layer, data);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (fseek(file, file_size, SEEK_SET) != 0 || fwrite(data.data(), 1, data.size(), file) != data.size() || fflush(file) != 0)
+        {
+            logError("Cannot write the scratch file %s, so the layers are kept in memory\n", filename.c_str());
+            return 0;
+        }
+        entries[mesh_idx][layer_nr] = Entry{file_size, data.size()};
+        file_size += data.size();
+    }
+    std::vector<SliceLayerPart>().swap(layer.parts);
+    layer.openLines = Polygons();
+    return data.size();
+}
+
+bool LayerSpill::isSpilled(unsigned int mesh_idx, unsigned int layer_nr) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries[mesh_idx][layer_nr].size > 0;
+}
+
+bool LayerSpill::load(unsigned int mesh_idx, unsigned int layer_nr, SliceLayer& layer)
+{
+    std::vector<unsigned char> data;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        const Entry& entry = entries[mesh_idx][layer_nr];
+        if (entry.size == 0)
+        {
+            return false;
+        }
+        data.resize(entry.size);
+        if (fseek(file, entry.offset, SEEK_SET) != 0 || fread(data.data(), 1, data.size(), file) != data.size())
+        {
+            logError("Cannot read layer %d back from the scratch file %s\n", layer_nr, filename.c_str());
+            return false;
+        }
+    }
+
+    if (!decodeLayer(data, layer))
+    {
+        logError("Layer %d in the scratch file %s is corrupt\n", layer_nr, filename.c_str());
+        return false;
+    }
+    return true;
+}
+
+size_t LayerSpill::getFileSize() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return file_size;
+}
+
+}//namespace cura
@@ -0,0 +1,83 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#ifndef LAYER_SPILL_H
+#define LAYER_SPILL_H
+
+#include <stdio.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "sliceDataStorage.h"
+
+/*
+The layer spill keeps the layer parts of the layers which aren't being worked on in a scratch file instead of in memory,
+so that the memory for a tall model depends on the number of layers processed at a time rather than on its height.
+
+A layer is spilled by writing its parts in the encoding of layerCodec to the end of the file and freeing them, and loaded
+by reading them back; it stays in the file, so copies of the storage can each load it. A layer can be spilled again after it has been loaded and
+processed further, after which its last copy is read. The file is removed when the spill is destroyed.
+*/
+
+namespace cura {
+
+class LayerSpill
+{
+public:
+    /*!
+     * Create the scratch file.
+     *
+     * \param directory Where to create the scratch file
+     * \param mesh_count The number of meshes of the storage
+     * \param layer_count The number of layers of each mesh
+     */
+    LayerSpill(const std::string& directory, unsigned int mesh_count, unsigned int layer_count);
+
+    ~LayerSpill();
+
+    /*!
+     * Whether the scratch file could be created; if not, nothing is spilled.
+     */
+    bool isOpen() const { return file != nullptr; }
+
+    /*!
+     * Write the parts and open lines of a layer to the scratch file and free them. Safe to call for different layers at once.
+     *
+     * \return The number of bytes written; zero when the layer couldn't be written, in which case it's kept in memory
+     */
+    size_t spill(unsigned int mesh_idx, unsigned int layer_nr, SliceLayer& layer);
+
+    /*!
+     * Whether a layer is in the scratch file.
+     */
+    bool isSpilled(unsigned int mesh_idx, unsigned int layer_nr) const;
+
+    /*!
+     * Read the parts and open lines of a spilled layer back into \p layer. The comb of each part isn't kept, so it has
+     * to be prepared again. Safe to call for different layers at once, and while other layers are being spilled.
+     *
+     * \return Whether the layer was spilled and could be read
+     */
+    bool load(unsigned int mesh_idx, unsigned int layer_nr, SliceLayer& layer);
+
+    /*!
+     * The size of the scratch file, in bytes.
+     */
+    size_t getFileSize() const;
+
+private:
+    struct Entry
+    {
+        size_t offset;
+        size_t size; //!< Zero when the layer isn't spilled
+    };
+
+    std::string filename;
+    FILE* file;
+    size_t file_size;
+    std::vector<std::vector<Entry>> entries; //!< Per mesh, for each layer where it is in the file
+    mutable std::mutex mutex; //!< Guards the file and the entries
+};
+
+}//namespace cura
+
+#endif//LAYER_SPILL_H
@@ -11,11 +11,14 @@
 #include <sys/resource.h>
 #endif
 #include <stddef.h>
+#include <iostream>
 #include <vector>
 
 #include "utils/gettime.h"
 #include "utils/logoutput.h"
 #include "utils/string.h"
+#include "utils/stats.h"
+#include "utils/trace.h"
 #include "sliceDataStorage.h"
 
 #include "modelFile/modelFile.h"
@@ -36,10 +39,18 @@
 #include "comb.h"
 #include "gcodeExport.h"
 #include "fffProcessor.h"
+#include "sliceDaemon.h"
+#include "jobEstimate.h"
 
 void print_usage()
 {
-    cura::logError("usage: CuraEngine [-h] [-v] [-m 3x3matrix] [-c <config file>] [-s <settingkey>=<value>] -o <output.gcode> <model.stl>\n");
+    cura::logError("usage: CuraEngine [-h] [-v] [-m 3x3matrix] [-c <config file>] [-s <settingkey>=<value>] [-t <threads>] -o <output.gcode> [--statistics <statistics.json|.csv>] [--trace <trace.json>] [--stats] [--max-memory <MB>] [--spill <scratch dir>] [--checkpoint <checkpoint file>] <model.stl>\n");
+    cura::logError("       CuraEngine -v [-j <settings.json>] [-s <settingkey>=<value>] --estimate <input.gcode>\n");
+    cura::logError("       CuraEngine [-j <settings.json>] [-s <settingkey>=<value>] --estimate <model file>\n");
+    cura::logError("       CuraEngine [-v] [-j <settings.json>] [-s <settingkey>=<value>] --connect <ip>:<port> [--record <session file>]\n");
+    cura::logError("       CuraEngine [-v] [-j <settings.json>] [-s <settingkey>=<value>] --replay <session file>\n");
+    cura::logError("       CuraEngine [-v] [-j <settings.json>] [-s <settingkey>=<value>] --daemon <workers>\n");
+    cura::logError("       CuraEngine [-v] [-j <settings.json>] [-s <settingkey>=<value>] --batch <workers> <model dir> <output dir>\n");
 }
 
 //Signal handler for a "floating point exception", which can also be integer division by zero errors.
@@ -52,6 +63,19 @@ void signal_FPE(int n)
 
 using namespace cura;
 
+//Write the zones recorded since --trace, if it was given, and report the counts of --stats.
+void finishTrace(const std::string& trace_file)
+{
+    if (trace_file.size() > 0 && !writeTrace(trace_file))
+    {
+        cura::logError("Failed to write the trace to %s\n", trace_file.c_str());
+    }
+    if (isStatsEnabled())
+    {
+        logStats();
+    }
+}
+
 int main(int argc, char **argv)
 {
 #if defined(__linux__) || (defined(__APPLE__) && defined(__MACH__))
@@ -66,6 +90,12 @@ int main(int argc, char **argv)
 
     fffProcessor processor;
     std::vector<std::string> files;
+    std::vector<std::string> estimate_files; // G-code files of which to estimate the print time, or models of which to predict the cost of slicing, instead of slicing
+    int daemon_workers = -1; // the number of jobs read from stdin to slice at once, or -1 to slice the files given
+    int batch_workers = -1; // the number of models of batch_model_dir to slice at once, or -1 to slice the files given
+    std::string batch_model_dir;
+    std::string batch_output_dir;
+    std::string trace_file; // where to write the trace of the stages, layers and kernels, if anywhere
 
     logCopyright("Cura_SteamEngine version %s\n", VERSION);
     logCopyright("Copyright (C) 2017 Yuenyong Nilsiam\n");
@@ -88,6 +118,8 @@ int main(int argc, char **argv)
     CommandSocket* commandSocket = NULL;
     std::string ip;
     int port = 49674;
+    std::string record_file;
+    std::string replay_file;
 
     for(int argn = 1; argn < argc; argn++)
     {
@@ -109,6 +141,63 @@ int main(int argc, char **argv)
 
                     argn += 1;
                 }
+                else if (stringcasecompare(str, "--record") == 0 && argn + 1 < argc)
+                {
+                    argn++;
+                    record_file = argv[argn];
+                }
+                else if (stringcasecompare(str, "--replay") == 0 && argn + 1 < argc)
+                {
+                    argn++;
+                    replay_file = argv[argn];
+                }
+                else if (stringcasecompare(str, "--statistics") == 0 && argn + 1 < argc)
+                {
+                    argn++;
+                    processor.setStatisticsFile(argv[argn]);
+                }
+                else if (stringcasecompare(str, "--trace") == 0 && argn + 1 < argc)
+                {
+                    argn++;
+                    trace_file = argv[argn];
+                    startTrace();
+                }
+                else if (stringcasecompare(str, "--stats") == 0)
+                {
+                    startStats();
+                }
+                else if (stringcasecompare(str, "--max-memory") == 0 && argn + 1 < argc)
+                {
+                    argn++;
+                    processor.setSetting("machine_max_memory", argv[argn]);
+                }
+                else if (stringcasecompare(str, "--spill") == 0 && argn + 1 < argc)
+                {
+                    argn++;
+                    processor.setSetting("machine_spill_directory", argv[argn]);
+                }
+                else if (stringcasecompare(str, "--checkpoint") == 0 && argn + 1 < argc)
+                {
+                    argn++;
+                    processor.setSetting("machine_checkpoint_file", argv[argn]);
+                }
+                else if (stringcasecompare(str, "--estimate") == 0 && argn + 1 < argc)
+                {
+                    argn++;
+                    estimate_files.push_back(argv[argn]);
+                }
+                else if (stringcasecompare(str, "--daemon") == 0 && argn + 1 < argc)
+                {
+                    argn++;
+                    daemon_workers = getThreadCount(atoi(argv[argn]));
+                }
+                else if (stringcasecompare(str, "--batch") == 0 && argn + 3 < argc)
+                {
+                    batch_workers = getThreadCount(atoi(argv[argn + 1]));
+                    batch_model_dir = argv[argn + 2];
+                    batch_output_dir = argv[argn + 3];
+                    argn += 3;
+                }
                 else if (stringcasecompare(str, "--") == 0)
                 {
                     try {
@@ -154,6 +243,10 @@ int main(int argc, char **argv)
                             exit(1);
                         }
                         break;
+                    case 't':
+                        argn++;
+                        processor.setSetting("machine_thread_count", argv[argn]);
+                        break;
                     case 's':
                         {
                             //Parse the given setting and store it.
@@ -187,9 +280,68 @@ int main(int argc, char **argv)
         }
     }
 
+    if (estimate_files.size() > 0)
+    {
+        for(std::string& filename : estimate_files)
+        {
+            if (isModelFile(filename.c_str()))
+            {
+                TimeKeeper measure_time;
+                ModelStatistics statistics;
+                if (!measureModel(filename, processor, statistics))
+                {
+                    logError("Failed to load model: %s\n", filename.c_str());
+                    exit(1);
+                }
+                double measure_seconds = measure_time.restart();
+                writeJobEstimate(std::cout, filename, statistics, estimateJob(statistics, processor), measure_seconds);
+                continue;
+            }
+            if (!processor.estimatePrintTime(filename.c_str()))
+            {
+                logError("Failed to open %s for reading.\n", filename.c_str());
+                exit(1);
+            }
+        }
+        return 0;
+    }
+
+    size_t job_memory_budget = std::max(0, processor.getSettingAsCount("machine_job_memory_budget")) * size_t(1024 * 1024);
+    if (daemon_workers >= 0)
+    {
+        SliceDaemon daemon(processor, daemon_workers, job_memory_budget, std::cout);
+        daemon.run(std::cin);
+        daemon.finish();
+        finishTrace(trace_file);
+        return 0;
+    }
+    if (batch_workers >= 0)
+    {
+        SliceDaemon daemon(processor, batch_workers, job_memory_budget, std::cout);
+        if (daemon.queueDirectory(batch_model_dir, batch_output_dir) == 0)
+        {
+            logError("No models to slice in %s\n", batch_model_dir.c_str());
+        }
+        daemon.finish();
+        finishTrace(trace_file);
+        return (daemon.getFailedCount() > 0)? 1 : 0;
+    }
+
+    if (replay_file.size() > 0)
+    {
+        CommandSocket replaySocket(&processor);
+        if (!replaySocket.replay(replay_file))
+        {
+            logError("Failed to read the session recording %s\n", replay_file.c_str());
+            exit(1);
+        }
+        finishTrace(trace_file);
+        return 0;
+    }
+
     if(commandSocket)
     {
-        commandSocket->connect(ip, port);
+        commandSocket->connect(ip, port, record_file);
     }
     else
     {
@@ -209,6 +361,7 @@ int main(int argc, char **argv)
         //Finalize the processor, this adds the end.gcode. And reports statistics.
         processor.finalize();
     }
+    finishTrace(trace_file);
 
-    return 0;
+    return processor.isMemoryLimitExceeded()? 1 : 0;
 }
@@ -0,0 +1,205 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#include "memoryUsage.h"
+
+#include <algorithm>
+#include <cstdio>
+#if defined(__linux__) || (defined(__APPLE__) && defined(__MACH__))
+#include <sys/resource.h>
+#endif
+
+#include "comb.h"
+#include "utils/trace.h"
+
+namespace cura {
+
+MemoryUsage::MemoryUsage()
+{
+    clear();
+}
+
+const char* MemoryUsage::getCategoryName(MemoryCategory category)
+{
+    static const char* names[Memory_Count] = { "meshes", "slices", "outlines", "insets", "skins", "infill", "combs", "frozen", "support", "infill_cache", "toolpaths", "paths", "time_estimate" };
+    return names[category];
+}
+
+void MemoryUsage::clear()
+{
+    std::fill(used, used + Memory_Count, 0);
+    peak_total = 0;
+}
+
+void MemoryUsage::set(MemoryCategory category, size_t bytes)
+{
+    used[category] = bytes;
+    peak_total = std::max(peak_total, getTotal());
+}
+
+void MemoryUsage::add(MemoryCategory category, size_t bytes)
+{
+    set(category, used[category] + bytes);
+}
+
+size_t MemoryUsage::getTotal() const
+{
+    size_t total = 0;
+    for (size_t bytes : used)
+    {
+        total += bytes;
+    }
+    return total;
+}
+
+MemoryCategory MemoryUsage::getLargest() const
+{
+    return static_cast<MemoryCategory>(std::max_element(used, used + Memory_Count) - used);
+}
+
+std::string MemoryUsage::toString() const
+{
+    std::vector<MemoryCategory> categories;
+    for (int category = 0; category < Memory_Count; category++)
+    {
+        if (used[category] > 0)
+        {
+            categories.push_back(static_cast<MemoryCategory>(category));
+        }
+    }
+    std::stable_sort(categories.begin(), categories.end(), [this](MemoryCategory a, MemoryCategory b) { return used[a] > used[b]; });
+
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%.1fMB", getTotal() / (1024.0 * 1024.0));
+    std::string result = buffer;
+    for (unsigned int category_idx = 0; category_idx < categories.size(); category_idx++)
+    {
+        snprintf(buffer, sizeof(buffer), "%s %.1fMB", getCategoryName(categories[category_idx]), used[categories[category_idx]] / (1024.0 * 1024.0));
+        result += ((category_idx == 0)? " (" : ", ") + std::string(buffer);
+    }
+    if (categories.size() > 0)
+    {
+        result += ")";
+    }
+    return result;
+}
+
+void MemoryUsage::trace() const
+{
+    if (!isTraceEnabled())
+    {
+        return;
+    }
+    std::vector<std::pair<const char*, double>> values;
+    for (int category = 0; category < Memory_Count; category++)
+    {
+        values.emplace_back(getCategoryName(static_cast<MemoryCategory>(category)), used[category] / (1024.0 * 1024.0));
+    }
+    traceCounter("memory (MB)", values);
+}
+
+size_t getMemoryUsage(const std::vector<Polygons>& polygons)
+{
+    size_t memory = polygons.capacity() * sizeof(Polygons);
+    for (const Polygons& polys : polygons)
+    {
+        memory += polys.getMemoryUsage();
+    }
+    return memory;
+}
+
+size_t getMemoryUsage(const Mesh& mesh)
+{
+    return mesh.vertices.positions.capacity() * sizeof(Point3)
+        + (mesh.vertices.face_offsets.capacity() + mesh.vertices.face_indices.capacity()) * sizeof(uint32_t)
+        + mesh.faces.capacity() * sizeof(MeshFace);
+}
+
+size_t getMemoryUsage(const Slicer& slicer)
+{
+    size_t memory = slicer.layers.capacity() * sizeof(SlicerLayer);
+    for (const SlicerLayer& layer : slicer.layers)
+    {
+        memory += layer.segmentList.capacity() * sizeof(SlicerSegment) + layer.polygonList.getMemoryUsage() + layer.openPolygons.getMemoryUsage();
+    }
+    return memory;
+}
+
+void addMemoryUsage(const SliceLayer& layer, MemoryUsage& usage)
+{
+    size_t outlines = layer.parts.capacity() * sizeof(SliceLayerPart) + layer.openLines.getMemoryUsage();
+    size_t insets = 0;
+    size_t skins = 0;
+    size_t infill = 0;
+    size_t combs = 0;
+    size_t toolpaths = 0;
+    for (const SliceLayerPart& part : layer.parts)
+    {
+        outlines += part.outline.getMemoryUsage() + part.combBoundery.getMemoryUsage();
+        insets += getMemoryUsage(part.insets);
+        skins += part.skin_parts.capacity() * sizeof(SkinPart);
+        for (const SkinPart& skin_part : part.skin_parts)
+        {
+            skins += skin_part.outline.getMemoryUsage() + getMemoryUsage(skin_part.insets) + skin_part.perimeterGaps.getMemoryUsage();
+        }
+        infill += getMemoryUsage(part.sparse_outline) + part.perimeterGaps.getMemoryUsage();
+        if (part.comb)
+        {
+            combs += sizeof(Comb) + part.comb->getMemoryUsage();
+        }
+        if (part.toolpaths)
+        {
+            toolpaths += sizeof(PartToolpaths) + getMemoryUsage(part.toolpaths->infill_lines) + getMemoryUsage(part.toolpaths->infill_polygons)
+                + getMemoryUsage(part.toolpaths->skin_perimeters) + part.toolpaths->skin_polygons.getMemoryUsage() + part.toolpaths->skin_lines.getMemoryUsage();
+        }
+    }
+    usage.add(Memory_Outlines, outlines);
+    usage.add(Memory_Insets, insets);
+    usage.add(Memory_Skins, skins);
+    usage.add(Memory_Infill, infill);
+    usage.add(Memory_Combs, combs);
+    usage.add(Memory_Frozen, layer.compact.capacity());
+    usage.add(Memory_Toolpaths, toolpaths);
+}
+
+size_t getMemoryUsage(const SupportToolpaths& toolpaths)
+{
+    return sizeof(SupportToolpaths) + getMemoryUsage(toolpaths.islands) + getMemoryUsage(toolpaths.lines);
+}
+
+void setMemoryUsage(const SliceDataStorage& storage, MemoryUsage& usage)
+{
+    MemoryUsage layers_usage;
+    for (const SliceMeshStorage& mesh : storage.meshes)
+    {
+        layers_usage.add(Memory_Outlines, mesh.layers.capacity() * sizeof(SliceLayer));
+        for (const SliceLayer& layer : mesh.layers)
+        {
+            addMemoryUsage(layer, layers_usage);
+        }
+    }
+    for (MemoryCategory category : { Memory_Outlines, Memory_Insets, Memory_Skins, Memory_Infill, Memory_Combs, Memory_Frozen, Memory_Toolpaths })
+    {
+        usage.set(category, layers_usage.get(category));
+    }
+    usage.set(Memory_Support, getMemoryUsage(storage.support.supportAreasPerLayer) + getMemoryUsage(storage.oozeShield)
+        + storage.skirt.getMemoryUsage() + storage.raftOutline.getMemoryUsage() + storage.wipeTower.getMemoryUsage());
+}
+
+size_t getPeakResidentMemory()
+{
+#if defined(__linux__)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+        return size_t(usage.ru_maxrss) * 1024; // in kilobytes on linux
+    }
+#elif defined(__APPLE__) && defined(__MACH__)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+        return usage.ru_maxrss; // in bytes on mac
+    }
+#endif
+    return 0;
+}
+
+}//namespace cura
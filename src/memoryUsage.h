@@ -0,0 +1,99 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#ifndef MEMORY_USAGE_H
+#define MEMORY_USAGE_H
+
+#include <string>
+
+#include "mesh.h"
+#include "slicer.h"
+#include "sliceDataStorage.h"
+
+/*
+The memory used while processing a model is accounted by adding up the capacity of the containers of each kind of data,
+after each stage and within the stages which go through the layers block by block. That misses the temporaries within a
+stage and the overhead of the allocator, so the process itself takes somewhat more, but it tells which data is
+responsible when a model needs too much, and it costs next to nothing compared to computing the data.
+*/
+namespace cura {
+
+/*!
+ * The kinds of data of which the memory is accounted.
+ */
+enum MemoryCategory
+{
+    Memory_Meshes,          //!< The vertices and faces of the meshes
+    Memory_Slices,          //!< The segments and polygons of the slicer layers
+    Memory_Outlines,        //!< The outlines and comb boundaries of the layer parts
+    Memory_Insets,          //!< The insets of the layer parts
+    Memory_Skins,           //!< The outlines, insets and perimeter gaps of the skin parts
+    Memory_Infill,          //!< The sparse outlines and the perimeter gaps of the layer parts
+    Memory_Combs,           //!< The grids of the comb boundaries
+    Memory_Frozen,          //!< The compact encoding of the frozen layers
+    Memory_Support,         //!< The support areas, the ooze shield, the skirt and the raft
+    Memory_InfillCache,     //!< The infill cached for later layers and jobs
+    Memory_Toolpaths,       //!< The infill, skin and support paths generated ahead of planning
+    Memory_Paths,           //!< The paths planned for the layers being exported and their formatted G-code
+    Memory_TimeEstimate,    //!< The blocks of the print time estimate
+    Memory_Count
+};
+
+/*!
+ * The memory used by each kind of data, and the most it has been since it was cleared.
+ */
+class MemoryUsage
+{
+public:
+    MemoryUsage();
+
+    static const char* getCategoryName(MemoryCategory category);
+
+    void clear(); //!< Set the memory used and the peaks to zero
+
+    void set(MemoryCategory category, size_t bytes);
+    void add(MemoryCategory category, size_t bytes);
+    size_t get(MemoryCategory category) const { return used[category]; }
+    size_t getTotal() const;
+    size_t getPeakTotal() const { return peak_total; }
+
+    /*!
+     * The kind of data using the most memory now.
+     */
+    MemoryCategory getLargest() const;
+
+    /*!
+     * The total memory used and that of each kind of data using any, largest first, e.g. "12.3MB (insets 10.1MB, outlines 2.2MB)".
+     */
+    std::string toString() const;
+
+    /*!
+     * Record the memory of each kind of data as a counter in the trace, in MB.
+     */
+    void trace() const;
+private:
+    size_t used[Memory_Count];
+    size_t peak_total; //!< The highest total memory used whenever it was set
+};
+
+size_t getMemoryUsage(const std::vector<Polygons>& polygons);
+size_t getMemoryUsage(const Mesh& mesh);
+size_t getMemoryUsage(const Slicer& slicer);
+size_t getMemoryUsage(const SupportToolpaths& toolpaths);
+
+/*!
+ * Add the memory of the outlines, insets, skins, infill areas and combs of the parts of a layer to \p usage.
+ */
+void addMemoryUsage(const SliceLayer& layer, MemoryUsage& usage);
+
+/*!
+ * Set the memory of the outlines, insets, skins, infill areas, combs and support of a storage in \p usage.
+ */
+void setMemoryUsage(const SliceDataStorage& storage, MemoryUsage& usage);
+
+/*!
+ * The most memory the process has had resident so far, in bytes; zero where this isn't known.
+ */
+size_t getPeakResidentMemory();
+
+}//namespace cura
+
+#endif//MEMORY_USAGE_H
@@ -1,15 +1,37 @@
+#include <algorithm> // sort
+
 #include "mesh.h"
 #include "utils/logoutput.h"
+#include "utils/parallel.h"
 
 
 const int vertex_meld_distance = MM2INT(0.03);
-static inline uint32_t pointHash(Point3& p)
+const uint32_t no_vertex = static_cast<uint32_t>(-1); //!< marks an empty slot in the vertex_hash_table
+
+/*!
+ * The cell of the vertex meld grid a point is in.
+ */
+static inline Point3 meldCell(const Point3& p)
 {
-    return ((p.x + vertex_meld_distance/2) / vertex_meld_distance) ^ (((p.y + vertex_meld_distance/2) / vertex_meld_distance) << 10) ^ (((p.z + vertex_meld_distance/2) / vertex_meld_distance) << 20);
+    return Point3((p.x + vertex_meld_distance/2) / vertex_meld_distance, (p.y + vertex_meld_distance/2) / vertex_meld_distance, (p.z + vertex_meld_distance/2) / vertex_meld_distance);
+}
+
+/*!
+ * Hash of the meld grid cell a point is in, mixing all bits of the coordinates (the finalizer of SplitMix64).
+ */
+static inline uint64_t pointHash(const Point3& p)
+{
+    Point3 cell = meldCell(p);
+    uint64_t hash = (uint64_t(uint32_t(cell.x)) << 32 | uint32_t(cell.y)) ^ (uint64_t(uint32_t(cell.z)) * 0x9E3779B97F4A7C15ull);
+    hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ull;
+    hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBull;
+    return hash ^ (hash >> 31);
 }
 
 Mesh::Mesh(SettingsBase* parent)
 : SettingsBase(parent)
+, boundary_edge_count(0)
+, non_manifold_edge_count(0)
 {
 }
 
@@ -26,31 +48,352 @@ void Mesh::addFace(Point3& v0, Point3& v1, Point3& v2)
     face.vertex_index[0] = vi0;
     face.vertex_index[1] = vi1;
     face.vertex_index[2] = vi2;
-    vertices[face.vertex_index[0]].connected_faces.push_back(idx);
-    vertices[face.vertex_index[1]].connected_faces.push_back(idx);
-    vertices[face.vertex_index[2]].connected_faces.push_back(idx);
+}
+
+void Mesh::addFaces(const std::vector<Point3>& corners)
+{
+    if (vertices.size() > 0)
+    { // the new corners may have to be welded to existing vertices; just add them one by one
+        for(unsigned int i=0; i+2<corners.size(); i+=3)
+        {
+            Point3 v0 = corners[i], v1 = corners[i+1], v2 = corners[i+2];
+            addFace(v0, v1, v2);
+        }
+        return;
+    }
+    unsigned int corner_count = corners.size() / 3 * 3;
+    unsigned int thread_count = cura::getThreadCount(getSettingAsCount("machine_thread_count"));
+
+    std::vector<uint64_t> hashes(corner_count);
+    unsigned int chunk_count = std::max(1u, std::min(thread_count * 4, corner_count / 4096));
+    cura::parallelFor(chunk_count, thread_count, [&](unsigned int chunk_idx)
+    {
+        unsigned int end = uint64_t(corner_count) * (chunk_idx + 1) / chunk_count;
+        for(unsigned int i = uint64_t(corner_count) * chunk_idx / chunk_count; i < end; i++)
+            hashes[i] = pointHash(corners[i]);
+    });
+
+    // Distribute the corners over buckets on the highest bits of their hash, keeping them in order.
+    unsigned int bucket_bits = 1;
+    while ((1u << bucket_bits) < thread_count * 16 && bucket_bits < 16)
+        bucket_bits++;
+    std::vector<unsigned int> bucket_start((1u << bucket_bits) + 1, 0);
+    for(unsigned int i=0; i<corner_count; i++)
+        bucket_start[(hashes[i] >> (64 - bucket_bits)) + 1]++;
+    for(unsigned int b=1; b<bucket_start.size(); b++)
+        bucket_start[b] += bucket_start[b-1];
+    std::vector<unsigned int> bucketed(corner_count);
+    {
+        std::vector<unsigned int> bucket_fill(bucket_start.begin(), bucket_start.end() - 1);
+        for(unsigned int i=0; i<corner_count; i++)
+            bucketed[bucket_fill[hashes[i] >> (64 - bucket_bits)]++] = i;
+    }
+
+    // For each corner find the first earlier corner which becomes a vertex it should be welded to, exactly like findIndexOfVertex would.
+    std::vector<unsigned int> representative(corner_count);
+    cura::parallelFor(bucket_start.size() - 1, thread_count, [&](unsigned int bucket_idx)
+    {
+        std::vector<unsigned int>::iterator begin = bucketed.begin() + bucket_start[bucket_idx];
+        std::vector<unsigned int>::iterator end = bucketed.begin() + bucket_start[bucket_idx + 1];
+        std::sort(begin, end, [&hashes](unsigned int a, unsigned int b) { return (hashes[a] != hashes[b])? hashes[a] < hashes[b] : a < b; });
+        for(std::vector<unsigned int>::iterator run_begin = begin; run_begin != end; )
+        {
+            std::vector<unsigned int>::iterator run_end = run_begin;
+            while (run_end != end && hashes[*run_end] == hashes[*run_begin])
+                ++run_end;
+            for(std::vector<unsigned int>::iterator it = run_begin; it != run_end; ++it)
+            {
+                unsigned int corner = *it;
+                representative[corner] = corner;
+                Point3 cell = meldCell(corners[corner]);
+                for(std::vector<unsigned int>::iterator other = run_begin; other != it; ++other)
+                {
+                    if (representative[*other] == *other && meldCell(corners[*other]) == cell && (corners[*other] - corners[corner]).testLength(vertex_meld_distance))
+                    {
+                        representative[corner] = *other;
+                        break;
+                    }
+                }
+            }
+            run_begin = run_end;
+        }
+    });
+
+    reserve(corner_count / 3);
+    std::vector<unsigned int> vertex_idx(corner_count);
+    for(unsigned int i=0; i<corner_count; i++)
+    {
+        if (representative[i] == i)
+        {
+            vertex_idx[i] = vertices.size();
+            vertices.emplace_back(corners[i]);
+        }
+        else
+        {
+            vertex_idx[i] = vertex_idx[representative[i]];
+        }
+    }
+    for(uint32_t vertex = 0; vertex < vertices.size(); vertex++)
+        insertVertexHash(vertex);
+
+    for(unsigned int i=0; i<corner_count; i+=3)
+    {
+        int vi0 = vertex_idx[i];
+        int vi1 = vertex_idx[i+1];
+        int vi2 = vertex_idx[i+2];
+        if (vi0 == vi1 || vi1 == vi2 || vi0 == vi2) continue; // the face has two vertices which get assigned the same location. Don't add the face.
+
+        int idx = faces.size(); // index of face to be added
+        faces.emplace_back();
+        MeshFace& face = faces[idx];
+        face.vertex_index[0] = vi0;
+        face.vertex_index[1] = vi1;
+        face.vertex_index[2] = vi2;
+    }
+}
+
+void Mesh::addIndexedFaces(const std::vector<Point3>& positions, const uint32_t* indices, unsigned int face_count)
+{
+    uint32_t first_vertex = vertices.size();
+    vertices.reserve(first_vertex + positions.size());
+    for(const Point3& p : positions)
+        vertices.emplace_back(p);
+    if (vertex_hash_table.size() > 0)
+    { // faces may still be added with addFace, which should be able to weld to these vertices
+        for(uint32_t vertex = first_vertex; vertex < vertices.size(); vertex++)
+            insertVertexHash(vertex);
+    }
+
+    faces.reserve(faces.size() + face_count);
+    unsigned int invalid_count = 0;
+    for(unsigned int i=0; i<face_count; i++)
+    {
+        uint32_t vi0 = indices[i * 3];
+        uint32_t vi1 = indices[i * 3 + 1];
+        uint32_t vi2 = indices[i * 3 + 2];
+        if (vi0 >= positions.size() || vi1 >= positions.size() || vi2 >= positions.size())
+        {
+            invalid_count++;
+            continue;
+        }
+        if (positions[vi0] == positions[vi1] || positions[vi1] == positions[vi2] || positions[vi0] == positions[vi2]) continue; // the face has two vertices at the same location. Don't add the face.
+
+        faces.emplace_back();
+        MeshFace& face = faces.back();
+        face.vertex_index[0] = first_vertex + vi0;
+        face.vertex_index[1] = first_vertex + vi1;
+        face.vertex_index[2] = first_vertex + vi2;
+    }
+    if (invalid_count > 0)
+        cura::logError("Skipped %u faces with a vertex index out of range.\n", invalid_count);
+}
+
+void Mesh::reserve(unsigned int face_count)
+{
+    faces.reserve(face_count);
+    vertices.reserve(face_count / 2 + 3); // a closed mesh has about half as many vertices as faces
+    unsigned int table_size = 16;
+    while (table_size < face_count)
+        table_size *= 2;
+    if (table_size > vertex_hash_table.size())
+    {
+        vertex_hash_table.assign(table_size, no_vertex);
+        for(uint32_t vertex = 0; vertex < vertices.size(); vertex++)
+            insertVertexHash(vertex);
+    }
 }
 
 void Mesh::clear()
 {
     faces.clear();
     vertices.clear();
-    vertex_hash_map.clear();
+    std::vector<uint32_t>().swap(vertex_hash_table);
+    std::vector<std::pair<int32_t, int32_t>>().swap(open_z_ranges);
+    boundary_edge_count = 0;
+    non_manifold_edge_count = 0;
 }
 
 void Mesh::finish()
 {
-    // Finish up the mesh, clear the vertex_hash_map, as it's no longer needed from this point on and uses quite a bit of memory.
-    vertex_hash_map.clear();
+    // Finish up the mesh, clear the vertex_hash_table, as it's no longer needed from this point on and uses quite a bit of memory.
+    std::vector<uint32_t>().swap(vertex_hash_table);
 
-    // For each face, store which other face is connected with it.
-    for(unsigned int i=0; i<faces.size(); i++)
+    // Store the faces connected to each vertex, in order of the faces.
+    std::vector<uint32_t>& face_offsets = vertices.face_offsets;
+    std::vector<uint32_t>& face_indices = vertices.face_indices;
+    face_offsets.assign(vertices.size() + 1, 0);
+    for(MeshFace& face : faces)
+        for(unsigned int k=0; k<3; k++)
+            face_offsets[face.vertex_index[k] + 1]++;
+    for(unsigned int v=1; v<face_offsets.size(); v++)
+        face_offsets[v] += face_offsets[v-1];
+    face_indices.resize(faces.size() * 3);
+    {
+        std::vector<uint32_t> fill(face_offsets.begin(), face_offsets.end() - 1);
+        for(unsigned int i=0; i<faces.size(); i++)
+            for(unsigned int k=0; k<3; k++)
+                face_indices[fill[faces[i].vertex_index[k]]++] = i;
+    }
+
+    // Store the (at most two) faces of each edge in a hash table, to quickly look up the other face of manifold edges.
+    // For large meshes the table is split into shards by the hash of the edges, which are filled on multiple threads.
+    // Each shard is filled in the order of the faces, so the result is the same as filling a single table.
+    unsigned int thread_count = cura::getThreadCount(getSettingAsCount("machine_thread_count"));
+    EdgeTable edge_table;
+    edge_table.shard_bits = 0;
+    if (faces.size() >= 65536)
+    {
+        while ((2u << edge_table.shard_bits) <= std::min(thread_count, 64u))
+            edge_table.shard_bits++;
+    }
+    unsigned int shard_count = 1 << edge_table.shard_bits;
+    std::vector<size_t> shard_edge_counts(shard_count, 0); // the number of times an edge of the shard is found, which is at least the number of edges in it
+    std::vector<uint8_t> edge_shards; // for each edge of each face its shard
+    if (shard_count == 1)
+    {
+        shard_edge_counts[0] = faces.size() * 3;
+    }
+    else
+    {
+        edge_shards.resize(faces.size() * 3);
+        std::vector<std::vector<size_t>> chunk_edge_counts(shard_count, std::vector<size_t>(shard_count, 0));
+        cura::parallelFor(shard_count, thread_count, [&](unsigned int chunk_idx)
+        {
+            unsigned int end = uint64_t(faces.size()) * (chunk_idx + 1) / shard_count;
+            for(unsigned int i = uint64_t(faces.size()) * chunk_idx / shard_count; i < end; i++)
+            {
+                for(unsigned int k=0; k<3; k++)
+                {
+                    unsigned int shard = edge_table.getShard(EdgeTable::getHash(faces[i].vertex_index[k], faces[i].vertex_index[(k + 1) % 3]));
+                    edge_shards[i * 3 + k] = shard;
+                    chunk_edge_counts[chunk_idx][shard]++;
+                }
+            }
+        });
+        for(std::vector<size_t>& counts : chunk_edge_counts)
+            for(unsigned int shard = 0; shard < shard_count; shard++)
+                shard_edge_counts[shard] += counts[shard];
+    }
+    edge_table.shard_offsets.assign(1, 0);
+    for(unsigned int shard = 0; shard < shard_count; shard++)
+    {
+        unsigned int table_size = 16;
+        while (table_size < shard_edge_counts[shard])
+            table_size *= 2;
+        edge_table.shard_offsets.push_back(edge_table.shard_offsets.back() + table_size);
+    }
+    edge_table.entries.resize(edge_table.shard_offsets.back());
+    cura::parallelFor(shard_count, thread_count, [&](unsigned int shard)
+    {
+        for(unsigned int i=0; i<faces.size(); i++)
+        {
+            MeshFace& face = faces[i];
+            for(unsigned int k=0; k<3; k++)
+            {
+                if (shard_count > 1 && edge_shards[i * 3 + k] != shard)
+                    continue;
+                EdgeFaces& edge = edge_table.find(face.vertex_index[k], face.vertex_index[(k + 1) % 3]);
+                if (edge.face[0] == -1)
+                {
+                    edge.face[0] = i;
+                    edge.first_from = face.vertex_index[k];
+                }
+                else if (edge.face[1] == -1)
+                {
+                    edge.face[1] = i;
+                    edge.same_direction = (edge.first_from == static_cast<uint32_t>(face.vertex_index[k]));
+                }
+                else
+                    edge.non_manifold = true;
+            }
+        }
+    });
+
+    // Classify the edges: where the plane crosses an edge without exactly two faces continuing each other, the slicer
+    // can't follow the outline, so only the layers at those heights may get open polygons.
+    boundary_edge_count = 0;
+    non_manifold_edge_count = 0;
+    open_z_ranges.clear();
+    for(const EdgeFaces& edge : edge_table.entries)
     {
-        MeshFace& face = faces[i];
-        face.connected_face_index[0] = getFaceIdxWithPoints(face.vertex_index[0], face.vertex_index[1], i); // faces are connected via the outside
-        face.connected_face_index[1] = getFaceIdxWithPoints(face.vertex_index[1], face.vertex_index[2], i);
-        face.connected_face_index[2] = getFaceIdxWithPoints(face.vertex_index[2], face.vertex_index[0], i);
+        if (edge.face[0] == -1)
+            continue;
+        if (edge.face[1] == -1)
+            boundary_edge_count++;
+        else if (edge.non_manifold || edge.same_direction)
+            non_manifold_edge_count++;
+        else
+            continue;
+        int32_t z0 = vertices.positions[edge.key >> 32].z;
+        int32_t z1 = vertices.positions[edge.key & 0xFFFFFFFF].z;
+        if (z0 != z1)
+            open_z_ranges.emplace_back(std::min(z0, z1), std::max(z0, z1));
+    }
+    std::sort(open_z_ranges.begin(), open_z_ranges.end());
+    unsigned int merged_count = 0;
+    for(const std::pair<int32_t, int32_t>& range : open_z_ranges)
+    {
+        if (merged_count > 0 && range.first <= open_z_ranges[merged_count - 1].second)
+            open_z_ranges[merged_count - 1].second = std::max(open_z_ranges[merged_count - 1].second, range.second);
+        else
+            open_z_ranges[merged_count++] = range;
+    }
+    open_z_ranges.resize(merged_count);
+    if (boundary_edge_count > 0 || non_manifold_edge_count > 0)
+    {
+        int64_t open_height = 0;
+        for(const std::pair<int32_t, int32_t>& range : open_z_ranges)
+            open_height += range.second - range.first;
+        cura::log("The mesh isn't closed: %u boundary and %u non-manifold edges, spanning %.2fmm of its height\n", boundary_edge_count, non_manifold_edge_count, INT2MM(open_height));
     }
+
+    // For each face, store which other face is connected with it.
+    unsigned int chunk_count = std::max(1u, std::min(thread_count * 4, static_cast<unsigned int>(faces.size() / 1024)));
+    cura::parallelFor(chunk_count, thread_count, [&](unsigned int chunk_idx)
+    {
+        unsigned int end = uint64_t(faces.size()) * (chunk_idx + 1) / chunk_count;
+        for(unsigned int i = uint64_t(faces.size()) * chunk_idx / chunk_count; i < end; i++)
+        {
+            MeshFace& face = faces[i];
+            for(unsigned int k=0; k<3; k++)
+            {
+                int idx0 = face.vertex_index[k];
+                int idx1 = face.vertex_index[(k + 1) % 3];
+                EdgeFaces& edge = edge_table.find(idx0, idx1);
+                if (edge.non_manifold)
+                    face.connected_face_index[k] = getFaceIdxWithPoints(idx0, idx1, i); // faces are connected via the outside
+                else if (edge.face[1] == -1)
+                {
+                    cura::logError("Couldn't find face connected to face %i.\n", i);
+                    face.connected_face_index[k] = -1;
+                }
+                else
+                    face.connected_face_index[k] = (edge.face[0] == static_cast<int>(i))? edge.face[1] : edge.face[0];
+            }
+        }
+    });
+}
+
+Mesh::EdgeFaces& Mesh::EdgeTable::find(uint32_t idx0, uint32_t idx1)
+{
+    uint64_t key = uint64_t(std::min(idx0, idx1)) << 32 | std::max(idx0, idx1);
+    uint64_t hash = getHash(idx0, idx1);
+    unsigned int shard = getShard(hash);
+    EdgeFaces* table = entries.data() + shard_offsets[shard];
+    unsigned int mask = shard_offsets[shard + 1] - shard_offsets[shard] - 1;
+    unsigned int slot = (hash ^ (hash >> 32)) & mask;
+    while (table[slot].face[0] != -1 && table[slot].key != key)
+        slot = (slot + 1) & mask;
+    if (table[slot].face[0] == -1)
+        table[slot].key = key; // a new edge; only happens while filling the table
+    return table[slot];
+}
+
+bool Mesh::mayBeOpenAt(int32_t z) const
+{
+    // the last range starting below z
+    auto range = std::lower_bound(open_z_ranges.begin(), open_z_ranges.end(), z, [](const std::pair<int32_t, int32_t>& range, int32_t z) { return range.first < z; });
+    return range != open_z_ranges.begin() && z <= (range - 1)->second;
 }
 
 Point3 Mesh::min()
@@ -82,20 +425,39 @@ Point3 Mesh::max()
 
 int Mesh::findIndexOfVertex(Point3& v)
 {
-    uint32_t hash = pointHash(v);
-
-    for(unsigned int idx = 0; idx < vertex_hash_map[hash].size(); idx++)
+    if (vertex_hash_table.size() > 0)
     {
-        if ((vertices[vertex_hash_map[hash][idx]].p - v).testLength(vertex_meld_distance))
+        Point3 cell = meldCell(v);
+        unsigned int mask = vertex_hash_table.size() - 1;
+        for(unsigned int slot = pointHash(v) & mask; vertex_hash_table[slot] != no_vertex; slot = (slot + 1) & mask)
         {
-            return vertex_hash_map[hash][idx];
+            uint32_t vertex = vertex_hash_table[slot];
+            if (meldCell(vertices[vertex].p) == cell && (vertices[vertex].p - v).testLength(vertex_meld_distance))
+            {
+                return vertex;
+            }
         }
     }
-    vertex_hash_map[hash].push_back(vertices.size());
     vertices.emplace_back(v);
+    insertVertexHash(vertices.size() - 1);
     return vertices.size() - 1;
 }
 
+void Mesh::insertVertexHash(uint32_t vertex_idx)
+{
+    if ((vertex_idx + 1) * 2 > vertex_hash_table.size())
+    { // keep the table at most half full; rebuilding it in vertex order keeps the vertices of each location in order
+        vertex_hash_table.assign(std::max(size_t(16), vertex_hash_table.size() * 2), no_vertex);
+        for(uint32_t vertex = 0; vertex < vertex_idx; vertex++)
+            insertVertexHash(vertex);
+    }
+    unsigned int mask = vertex_hash_table.size() - 1;
+    unsigned int slot = pointHash(vertices[vertex_idx].p) & mask;
+    while (vertex_hash_table[slot] != no_vertex)
+        slot = (slot + 1) & mask;
+    vertex_hash_table[slot] = vertex_idx;
+}
+
 /*!
 Returns the index of the 'other' face connected to the edge between vertices with indices idx0 and idx1.
 In case more than two faces are connected via the same edge, the next face in a counter-clockwise ordering (looking from idx1 to idx0) is returned.
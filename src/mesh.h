@@ -3,18 +3,68 @@
 
 #include "settings.h"
 
+/*!
+The indices of the faces connected to a vertex; a view on the adjacency stored in MeshVertices.
+*/
+class ConnectedFaces
+{
+    const uint32_t* begin_;
+    const uint32_t* end_;
+public:
+    ConnectedFaces(const uint32_t* begin, const uint32_t* end) : begin_(begin), end_(end) {}
+
+    const uint32_t* begin() const { return begin_; }
+    const uint32_t* end() const { return end_; }
+    unsigned int size() const { return end_ - begin_; }
+    uint32_t operator[](unsigned int idx) const { return begin_[idx]; }
+};
+
 /*!
 Vertex type to be used in a Mesh.
 
+This is a view on the vertex data in MeshVertices, which refers to the location of the vertex itself.
 Keeps track of which faces connect to it.
 */
 class MeshVertex
 {
 public:
-    Point3 p; //!< location of the vertex
-    std::vector<uint32_t> connected_faces; //!< list of the indices of connected faces
+    Point3& p; //!< location of the vertex
+    ConnectedFaces connected_faces; //!< list of the indices of connected faces; only filled in by Mesh::finish
+
+    MeshVertex(Point3& p, ConnectedFaces connected_faces) : p(p), connected_faces(connected_faces) {}
+};
+
+/*!
+The vertices of a Mesh, stored as a structure of arrays.
 
-    MeshVertex(Point3 p) : p(p) {} //!< doesn't set connected_faces
+The locations are stored contiguously, and the faces connected to each vertex are stored in compressed sparse row format:
+the faces of vertex \p i are face_indices[face_offsets[i]] up to face_indices[face_offsets[i+1]].
+This avoids a heap allocation per vertex.
+Indexing gives a MeshVertex, so that the vertices can be used as if they were a vector of MeshVertex.
+*/
+class MeshVertices
+{
+public:
+    std::vector<Point3> positions; //!< location of each vertex
+    std::vector<uint32_t> face_offsets; //!< for each vertex the offset of its faces in face_indices, plus the total as last element
+    std::vector<uint32_t> face_indices; //!< the indices of the faces connected to each vertex, in order of the vertices
+
+    MeshVertex operator[](unsigned int idx)
+    {
+        if (idx + 1 < face_offsets.size())
+            return MeshVertex(positions[idx], ConnectedFaces(face_indices.data() + face_offsets[idx], face_indices.data() + face_offsets[idx + 1]));
+        return MeshVertex(positions[idx], ConnectedFaces(nullptr, nullptr));
+    }
+
+    unsigned int size() const { return positions.size(); }
+    void emplace_back(Point3 p) { positions.push_back(p); }
+    void reserve(unsigned int vertex_count) { positions.reserve(vertex_count); }
+    void clear()
+    {
+        std::vector<Point3>().swap(positions);
+        std::vector<uint32_t>().swap(face_offsets);
+        std::vector<uint32_t>().swap(face_indices);
+    }
 };
 
 /*! A MeshFace is a 3 dimensional model triangle with 3 points. These points are already converted to integers
@@ -53,23 +103,92 @@ See MeshFace for the specifics of how/when faces are connected.
 */
 class Mesh : public SettingsBase // inherits settings
 {
-    //! The vertex_hash_map stores a index reference of each vertex for the hash of that location. Allows for quick retrieval of points with the same location.
-    std::map<uint32_t, std::vector<uint32_t> > vertex_hash_map;
+    /*!
+     * The vertex_hash_table stores the index of each vertex at (or after) the slot given by the hash of its location; an open addressing hash table with linear probing.
+     * Allows for quick retrieval of points with the same location.
+     * Vertices in the same location are in the order in which they were added, since nothing is ever removed from the table.
+     */
+    std::vector<uint32_t> vertex_hash_table;
+    /*!
+     * The heights at which the plane crosses a boundary or non-manifold edge, as ranges of which the lowest height is
+     * excluded and the highest included; sorted and without overlap. Set by finish.
+     */
+    std::vector<std::pair<int32_t, int32_t>> open_z_ranges;
 public:
-    std::vector<MeshVertex> vertices;//!< list of all vertices in the mesh
+    MeshVertices vertices;//!< list of all vertices in the mesh
     std::vector<MeshFace> faces; //!< list of all faces in the mesh
+    unsigned int boundary_edge_count; //!< the number of edges of only one face; set by finish
+    unsigned int non_manifold_edge_count; //!< the number of edges of more than two faces, or of two faces running along it the same way; set by finish
 
     Mesh(SettingsBase* parent); //!< initializes the settings
 
     void addFace(Point3& v0, Point3& v1, Point3& v2); //!< add a face to the mesh without settings it's connected_faces.
+    /*!
+     * Add many faces at once, without setting their connected_faces.
+     * 
+     * Gives the same result as calling addFace for each face, but welds the vertices on multiple threads by grouping the corners on their location.
+     * 
+     * \param corners The corners of the faces; three consecutive points per face
+     */
+    void addFaces(const std::vector<Point3>& corners);
+    /*!
+     * Add the faces of an indexed mesh, without setting their connected_faces.
+     * 
+     * The vertices are taken as they are: vertices which have been shared between the faces by whoever built the index buffer are shared in the mesh,
+     * but vertices which merely lie close together are not welded.
+     * 
+     * \param positions The vertices of the faces
+     * \param indices For each face the indices of its three vertices in \p positions
+     * \param face_count The number of faces
+     */
+    void addIndexedFaces(const std::vector<Point3>& positions, const uint32_t* indices, unsigned int face_count);
+    void reserve(unsigned int face_count); //!< reserve memory for a total of \p face_count faces
     void clear(); //!< clears all data
     void finish(); //!< complete the model : set the connected_face_index fields of the faces.
 
+    /*!
+     * Whether the plane at height \p z crosses a boundary or non-manifold edge, so that slicing there may give open
+     * polygons. Elsewhere the faces around each crossed edge continue each other, so all polygons close.
+     */
+    bool mayBeOpenAt(int32_t z) const;
+
     Point3 min(); //!< min (in x,y and z) vertex of the bounding box
     Point3 max(); //!< max (in x,y and z) vertex of the bounding box
 
 private:
+    /*!
+     * Entry in the edge hash table used in Mesh::finish: the faces connected via an edge.
+     */
+    struct EdgeFaces
+    {
+        uint64_t key; //!< the indices of the two vertices of the edge, the lowest in the upper half
+        int face[2]; //!< the first two faces connected via the edge, or -1
+        uint32_t first_from; //!< the vertex at which the first face starts along the edge
+        bool non_manifold; //!< whether more than two faces are connected via the edge
+        bool same_direction; //!< whether the first two faces run along the edge the same way, so one of them is flipped
+        EdgeFaces() : key(0), first_from(0), non_manifold(false), same_direction(false) { face[0] = face[1] = -1; }
+    };
+    /*!
+     * The edge hash table used in Mesh::finish: open addressing tables, one per shard of the hashes of the edges, so that
+     * each shard can be filled by a thread of its own.
+     */
+    struct EdgeTable
+    {
+        std::vector<EdgeFaces> entries; //!< the tables of the shards one after the other; the size of each is a power of two and it is never full
+        std::vector<uint32_t> shard_offsets; //!< where the table of each shard starts in entries, followed by the size of entries
+        unsigned int shard_bits; //!< the number of highest bits of the hash of an edge which choose its shard
+
+        static uint64_t getHash(uint32_t idx0, uint32_t idx1) { return (uint64_t(std::min(idx0, idx1)) << 32 | std::max(idx0, idx1)) * 0x9E3779B97F4A7C15ull; }
+        unsigned int getShard(uint64_t hash) const { return (shard_bits == 0)? 0 : hash >> (64 - shard_bits); }
+        /*!
+         * Find (or create) the entry of the edge between two vertices.
+         * \param idx0 The index of one vertex of the edge
+         * \param idx1 The index of the other vertex of the edge
+         */
+        EdgeFaces& find(uint32_t idx0, uint32_t idx1);
+    };
     int findIndexOfVertex(Point3& v); //!< find index of vertex close to the given point, or create a new vertex and return its index.
+    void insertVertexHash(uint32_t vertex_idx); //!< add a vertex to the vertex_hash_table, growing the table if it gets too full.
     /*!
     Get the index of the face connected to the face with index \p notFaceIdx, via vertices \p idx0 and \p idx1.
     In case multiple faces connect with the same edge, return the next counter-clockwise face when viewing from \p idx1 to \p idx0.
@@ -0,0 +1,257 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#include "meshInstances.h"
+
+#include <algorithm>
+
+namespace cura {
+
+namespace
+{
+
+/*!
+ * Whether a mesh consists of the same faces as another, with all vertices moved by the same distance in X and Y.
+ *
+ * \param master The earlier mesh
+ * \param mesh The mesh which may be a copy of \p master
+ * \param offset Output: the distance from \p master to \p mesh, if it is a copy
+ */
+bool isMovedMesh(const Mesh& master, const Mesh& mesh, Point& offset)
+{
+    const std::vector<Point3>& master_positions = master.vertices.positions;
+    const std::vector<Point3>& positions = mesh.vertices.positions;
+    if (master_positions.size() != positions.size() || master.faces.size() != mesh.faces.size() || positions.empty())
+    {
+        return false;
+    }
+    Point3 move = positions[0] - master_positions[0];
+    if (move.z != 0)
+    {
+        return false;
+    }
+    for (unsigned int vertex_idx = 0; vertex_idx < positions.size(); vertex_idx++)
+    {
+        if (positions[vertex_idx] - master_positions[vertex_idx] != move)
+        {
+            return false;
+        }
+    }
+    for (unsigned int face_idx = 0; face_idx < mesh.faces.size(); face_idx++)
+    {
+        const MeshFace& master_face = master.faces[face_idx];
+        const MeshFace& face = mesh.faces[face_idx];
+        if (!std::equal(face.vertex_index, face.vertex_index + 3, master_face.vertex_index))
+        {
+            return false;
+        }
+    }
+    offset = Point(move.x, move.y);
+    return true;
+}
+
+/*!
+ * Whether the polygons \p moved are exactly the polygons \p master, moved by \p offset.
+ */
+bool isMovedPolygons(const Polygons& master, Point offset, const Polygons& moved)
+{
+    if (master.size() != moved.size())
+    {
+        return false;
+    }
+    auto moved_poly = moved.begin();
+    for (const ClipperLib::Path& master_poly : master)
+    {
+        if (master_poly.size() != moved_poly->size())
+        {
+            return false;
+        }
+        for (unsigned int point_idx = 0; point_idx < master_poly.size(); point_idx++)
+        {
+            const Point& master_point = master_poly[point_idx];
+            const Point& moved_point = (*moved_poly)[point_idx];
+            if (master_point.X + offset.X != moved_point.X || master_point.Y + offset.Y != moved_point.Y)
+            {
+                return false;
+            }
+        }
+        ++moved_poly;
+    }
+    return true;
+}
+
+void movePolygons(std::vector<Polygons>& polygons, Point offset)
+{
+    for (Polygons& polys : polygons)
+    {
+        polys.translate(offset);
+    }
+}
+
+}//anonymous namespace
+
+std::vector<MeshInstance> findMeshInstances(PrintObject* object)
+{
+    std::vector<MeshInstance> instances(object->meshes.size());
+    std::vector<std::map<std::string, std::string>> mesh_settings;
+    std::vector<unsigned int> masters; // the meshes which aren't a copy of an earlier mesh
+    for (unsigned int mesh_idx = 0; mesh_idx < object->meshes.size(); mesh_idx++)
+    {
+        const Mesh& mesh = object->meshes[mesh_idx];
+        mesh_settings.push_back(mesh.getAllSettings());
+        for (unsigned int master_idx : masters)
+        {
+            Point offset;
+            if (mesh_settings[master_idx] == mesh_settings[mesh_idx] && isMovedMesh(object->meshes[master_idx], mesh, offset))
+            {
+                instances[mesh_idx] = MeshInstance(master_idx, offset);
+                break;
+            }
+        }
+        if (instances[mesh_idx].master < 0)
+        {
+            masters.push_back(mesh_idx);
+        }
+    }
+    return instances;
+}
+
+void copyMovedSlices(const Slicer& master, Point offset, Slicer& instance)
+{
+    for (unsigned int layer_nr = 0; layer_nr < master.layers.size(); layer_nr++)
+    {
+        SlicerLayer& layer = instance.layers[layer_nr];
+        layer.polygonList = master.layers[layer_nr].polygonList;
+        layer.polygonList.translate(offset);
+        layer.openPolygons = master.layers[layer_nr].openPolygons;
+        layer.openPolygons.translate(offset);
+    }
+}
+
+std::vector<std::vector<bool>> findMovedLayers(const std::vector<SliceMeshStorage>& meshes, int isolation_distance)
+{
+    std::vector<std::vector<bool>> moved_layers;
+    std::vector<std::vector<AABB>> layer_boxes; // per mesh, for each layer the bounding box of all its parts, grown by half the isolation distance
+    for (const SliceMeshStorage& mesh : meshes)
+    {
+        moved_layers.emplace_back(mesh.layers.size(), false);
+        layer_boxes.emplace_back();
+        for (const SliceLayer& layer : mesh.layers)
+        {
+            AABB box; // empty: the minimum lies above the maximum
+            box.min = Point(POINT_MAX, POINT_MAX);
+            for (const SliceLayerPart& part : layer.parts)
+            {
+                box.min.X = std::min(box.min.X, part.boundaryBox.min.X - isolation_distance / 2);
+                box.min.Y = std::min(box.min.Y, part.boundaryBox.min.Y - isolation_distance / 2);
+                box.max.X = std::max(box.max.X, part.boundaryBox.max.X + isolation_distance / 2);
+                box.max.Y = std::max(box.max.Y, part.boundaryBox.max.Y + isolation_distance / 2);
+            }
+            layer_boxes.back().push_back(box);
+        }
+    }
+    auto isIsolated = [&](unsigned int mesh_idx, unsigned int layer_nr)
+    {
+        const AABB& box = layer_boxes[mesh_idx][layer_nr];
+        for (unsigned int other_idx = 0; other_idx < meshes.size(); other_idx++)
+        {
+            const AABB& other_box = layer_boxes[other_idx][layer_nr];
+            if (other_idx != mesh_idx && box.hit(other_box))
+            {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    for (unsigned int mesh_idx = 0; mesh_idx < meshes.size(); mesh_idx++)
+    {
+        const SliceMeshStorage& mesh = meshes[mesh_idx];
+        if (mesh.instance.master < 0)
+        {
+            continue;
+        }
+        const SliceMeshStorage& master = meshes[mesh.instance.master];
+        if (master.settings->getAllSettings() != mesh.settings->getAllSettings())
+        {
+            continue;
+        }
+        for (unsigned int layer_nr = 0; layer_nr < mesh.layers.size(); layer_nr++)
+        {
+            const std::vector<SliceLayerPart>& master_parts = master.layers[layer_nr].parts;
+            const std::vector<SliceLayerPart>& parts = mesh.layers[layer_nr].parts;
+            bool is_moved = master_parts.size() == parts.size();
+            for (unsigned int part_idx = 0; is_moved && part_idx < parts.size(); part_idx++)
+            {
+                is_moved = isMovedPolygons(master_parts[part_idx].outline, mesh.instance.offset, parts[part_idx].outline);
+            }
+            moved_layers[mesh_idx][layer_nr] = is_moved && isIsolated(mesh_idx, layer_nr) && isIsolated(mesh.instance.master, layer_nr);
+        }
+    }
+    return moved_layers;
+}
+
+std::vector<bool> findMovedSkinLayers(const std::vector<bool>& moved_layers, int downSkinCount, int upSkinCount)
+{
+    int layer_count = moved_layers.size();
+    std::vector<bool> moved_skin_layers(layer_count, false);
+    int n_not_moved = 0; // the number of layers in [layer_nr - downSkinCount, layer_nr + upSkinCount] which aren't moved copies
+    for (int layer_nr = 0; layer_nr < std::min(upSkinCount, layer_count); layer_nr++)
+    {
+        n_not_moved += !moved_layers[layer_nr];
+    }
+    for (int layer_nr = 0; layer_nr < layer_count; layer_nr++)
+    {
+        if (layer_nr + upSkinCount < layer_count)
+        {
+            n_not_moved += !moved_layers[layer_nr + upSkinCount];
+        }
+        if (layer_nr - downSkinCount - 1 >= 0)
+        {
+            n_not_moved -= !moved_layers[layer_nr - downSkinCount - 1];
+        }
+        moved_skin_layers[layer_nr] = n_not_moved == 0;
+    }
+    return moved_skin_layers;
+}
+
+void copyMovedLayer(const SliceLayer& master, Point offset, SliceLayer& instance)
+{
+    instance.parts = master.parts;
+    for (SliceLayerPart& part : instance.parts)
+    {
+        part.boundaryBox.min += offset;
+        part.boundaryBox.max += offset;
+        part.outline.translate(offset);
+        part.combBoundery.translate(offset);
+        movePolygons(part.insets, offset);
+        for (SkinPart& skin_part : part.skin_parts)
+        {
+            skin_part.outline.translate(offset);
+            movePolygons(skin_part.insets, offset);
+            skin_part.perimeterGaps.translate(offset);
+        }
+        movePolygons(part.sparse_outline, offset);
+        part.perimeterGaps.translate(offset);
+    }
+}
+
+void copyMovedSkins(const SliceLayer& master, Point offset, SliceLayer& instance)
+{
+    for (unsigned int part_idx = 0; part_idx < instance.parts.size(); part_idx++)
+    {
+        const SliceLayerPart& master_part = master.parts[part_idx];
+        SliceLayerPart& part = instance.parts[part_idx];
+        part.skin_parts = master_part.skin_parts;
+        for (SkinPart& skin_part : part.skin_parts)
+        {
+            skin_part.outline.translate(offset);
+            movePolygons(skin_part.insets, offset);
+            skin_part.perimeterGaps.translate(offset);
+        }
+        part.sparse_outline = master_part.sparse_outline;
+        movePolygons(part.sparse_outline, offset);
+        part.perimeterGaps = master_part.perimeterGaps;
+        part.perimeterGaps.translate(offset);
+    }
+}
+
+}//namespace cura
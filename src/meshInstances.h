@@ -0,0 +1,89 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#ifndef MESH_INSTANCES_H
+#define MESH_INSTANCES_H
+
+#include "sliceDataStorage.h"
+#include "slicer.h"
+#include "modelFile/modelFile.h"
+
+/*
+This file contains code to find meshes which are copies of an earlier mesh moved over the build plate, as when several
+copies of a part are placed side by side, so that the layers of the first copy can be copied (and moved) instead of
+generated again for each of the others.
+
+Only what a layer of a mesh gets from the layers of the same mesh is copied: the slices, insets, skins, sparse infill
+and perimeter gaps. Everything which depends on the other meshes, such as the support, the skirt and the order in
+which the parts are printed, is still computed for each copy.
+*/
+namespace cura {
+
+/*!
+ * Find the meshes which are a copy of an earlier mesh, moved in X and Y.
+ *
+ * A mesh is a copy of another when it has the same settings and the same faces on the same vertices, in the same order,
+ * and all of its vertices are moved by the same distance in X and Y. This is what loading the same file at another
+ * position gives.
+ *
+ * \param object The object of which the meshes are yet to be sliced
+ * \return For each mesh the first mesh of which it is a copy and its offset from that mesh
+ */
+std::vector<MeshInstance> findMeshInstances(PrintObject* object);
+
+/*!
+ * Fill the layers of a slicer with the outlines sliced from its master, moved by \p offset.
+ *
+ * \param master The slicer of the master mesh
+ * \param offset The distance from the master to the copy
+ * \param instance A slicer with the same layers as \p master, of which the outlines aren't filled in yet
+ */
+void copyMovedSlices(const Slicer& master, Point offset, Slicer& instance);
+
+/*!
+ * Find the layers of the meshes of which the parts are exactly those of their master, moved by the offset of the mesh.
+ *
+ * The outlines of a copy may differ from those of its master where another mesh overlaps one of them, or where the
+ * settings of one of them have been changed since they were sliced. Where the parts of another mesh come close to
+ * either of them, the outlines are changed by generateMultipleVolumesOverlap, so those layers aren't copied either.
+ *
+ * \param meshes All meshes, of which the layer parts are generated, but the insets aren't
+ * \param isolation_distance How close the parts of the other meshes may come to those of a copy and its master
+ * \return Per mesh, for each layer whether its parts are a moved copy of those of the same layer of the master; all false if the mesh isn't a copy
+ */
+std::vector<std::vector<bool>> findMovedLayers(const std::vector<SliceMeshStorage>& meshes, int isolation_distance);
+
+/*!
+ * Find the layers of a mesh of which the skin, sparse infill and perimeter gaps are those of its master, moved.
+ *
+ * These only depend on the parts of a layer and of the layers \p downSkinCount below and \p upSkinCount above it,
+ * so all of those have to be moved copies.
+ *
+ * \param moved_layers For each layer whether its parts are a moved copy; see findMovedLayers
+ * \param downSkinCount The number of layers below a layer which are considered for its down skin
+ * \param upSkinCount The number of layers above a layer which are considered for its up skin
+ * \return For each layer whether its results are a moved copy of those of the master
+ */
+std::vector<bool> findMovedSkinLayers(const std::vector<bool>& moved_layers, int downSkinCount, int upSkinCount);
+
+/*!
+ * Replace the parts of a layer with a copy of the parts of another layer, moved by \p offset.
+ *
+ * \param master The layer to copy the parts from
+ * \param offset The distance to move the copy by
+ * \param instance The layer which gets the copy
+ */
+void copyMovedLayer(const SliceLayer& master, Point offset, SliceLayer& instance);
+
+/*!
+ * Replace the skins, sparse infill areas and perimeter gaps of the parts of a layer with a copy of those of the parts of
+ * another layer, moved by \p offset. The other fields of the parts are left alone, so the layers around it can read
+ * them meanwhile.
+ *
+ * \param master The layer to copy from
+ * \param offset The distance to move the copy by
+ * \param instance The layer which gets the copy, of which the parts are a moved copy of those of \p master
+ */
+void copyMovedSkins(const SliceLayer& master, Point offset, SliceLayer& instance);
+
+}//namespace cura
+
+#endif//MESH_INSTANCES_H
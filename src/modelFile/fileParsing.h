@@ -0,0 +1,126 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#ifndef MODELFILE_FILE_PARSING_H
+#define MODELFILE_FILE_PARSING_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <vector>
+#ifndef __WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+The helpers shared by the model loaders, to read files without copying them and to parse the numbers in text formats.
+*/
+
+/*!
+ * Read-only access to the contents of a whole file.
+ * 
+ * The file is memory mapped, so that it is read by the OS as the data is used instead of being copied through stdio.
+ * On Windows the file is simply read into memory.
+ */
+class MappedFile
+{
+public:
+    MappedFile(const char* filename)
+    : data_(nullptr), size_(0)
+    {
+#ifdef __WIN32
+        FILE* f = fopen(filename, "rb");
+        if (!f)
+            return;
+        fseek(f, 0, SEEK_END);
+        long size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        if (size > 0)
+        {
+            buffer.resize(size);
+            if (fread(buffer.data(), size, 1, f) == 1)
+            {
+                data_ = buffer.data();
+                size_ = size;
+            }
+        }
+        fclose(f);
+#else
+        int fd = open(filename, O_RDONLY);
+        if (fd < 0)
+            return;
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0)
+        {
+            void* mapped = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED)
+            {
+                madvise(mapped, file_stat.st_size, MADV_SEQUENTIAL);
+                data_ = static_cast<const char*>(mapped);
+                size_ = file_stat.st_size;
+            }
+        }
+        ::close(fd); // the mapping stays valid after closing the file
+#endif
+    }
+
+    ~MappedFile()
+    {
+        close();
+    }
+
+    void close()
+    {
+#ifdef __WIN32
+        std::vector<char>().swap(buffer);
+#else
+        if (data_)
+            munmap(const_cast<char*>(data_), size_);
+#endif
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+    bool isValid() const { return data_ != nullptr; }
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    const char* data_;
+    size_t size_;
+#ifdef __WIN32
+    std::vector<char> buffer;
+#endif
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+};
+
+inline bool isLineEnd(char c)
+{
+    return c == '\n' || c == '\r';
+}
+
+inline bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\v' || c == '\f';
+}
+
+inline bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+/*!
+ * Parse a number from [\p p, \p end) exactly like strtof would in the "C" locale, using strtof only for unusual input.
+ * 
+ * Plain decimal numbers with at most 19 significant digits and a small exponent are computed exactly in double precision.
+ * Rounding that to float is then exact too, unless the double lies precisely halfway between two floats.
+ * 
+ * \param p Start of the number
+ * \param end End of the text; the text doesn't need to be zero terminated
+ * \param result Output parameter: the parsed number
+ * \return The position after the number, or nullptr if there is no number at \p p
+ */
+const char* parseFloat(const char* p, const char* end, float& result);
+
+#endif//MODELFILE_FILE_PARSING_H
@@ -0,0 +1,1021 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#include "indexedModelFile.h"
+
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <string>
+#include <vector>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "fileParsing.h"
+#include "../utils/logoutput.h"
+#include "../utils/parallel.h"
+
+namespace
+{
+const uint32_t invalid_index = std::numeric_limits<uint32_t>::max(); //!< Out of range for Mesh::addIndexedFaces, which skips the face
+const size_t text_chunk_size = 1 << 20; //!< The size of the parts of a text file parsed in parallel
+
+/*!
+ * The coordinates of vertices as they are in a file.
+ */
+struct VertexCoordinates
+{
+    std::vector<float> x, y, z;
+
+    void add(float vx, float vy, float vz)
+    {
+        x.push_back(vx);
+        y.push_back(vy);
+        z.push_back(vz);
+    }
+};
+
+/*!
+ * Parse an integer, with an optional sign, from [\p p, \p end).
+ *
+ * \return The position after the number, or nullptr if there is no number at \p p
+ */
+const char* parseInt(const char* p, const char* end, int64_t& result)
+{
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = *p == '-';
+        p++;
+    }
+    if (p >= end || !isDigit(*p))
+    {
+        return nullptr;
+    }
+    uint64_t value = 0;
+    for (; p < end && isDigit(*p); p++)
+    {
+        if (value < (uint64_t(1) << 40))
+        {
+            value = value * 10 + (*p - '0');
+        }
+    }
+    result = negative? -int64_t(value) : int64_t(value);
+    return p;
+}
+
+/*!
+ * Split [\p begin, \p end) into parts of about text_chunk_size, each starting right after a \p separator.
+ *
+ * \return The start of each part, followed by \p end
+ */
+std::vector<const char*> splitText(const char* begin, const char* end, char separator)
+{
+    std::vector<const char*> starts;
+    starts.push_back(begin);
+    while (end - starts.back() > ptrdiff_t(text_chunk_size))
+    {
+        const char* p = starts.back() + text_chunk_size;
+        while (p < end && *p != separator)
+            p++;
+        starts.push_back(std::min(p + 1, end));
+    }
+    starts.push_back(end);
+    return starts;
+}
+
+/*!
+ * Add the faces of an index buffer to \p mesh and finish it.
+ *
+ * \param coordinates The coordinates of the vertices, in the units of the file, freed by this
+ * \param indices Three indices per face into the vertices
+ */
+void finishIndexedMesh(Mesh* mesh, VertexCoordinates& coordinates, const std::vector<uint32_t>& indices, FMatrix3x3& matrix)
+{
+    std::vector<Point3> positions(coordinates.x.size());
+    const size_t batch_size = 1 << 16;
+    unsigned int batch_count = (positions.size() + batch_size - 1) / batch_size;
+    unsigned int thread_count = cura::getThreadCount(mesh->getSettingAsCount("machine_thread_count"));
+    cura::parallelFor(batch_count, thread_count, [&](unsigned int batch_idx)
+    {
+        size_t start = batch_idx * batch_size;
+        size_t count = std::min(batch_size, positions.size() - start);
+        matrix.apply(&coordinates.x[start], &coordinates.y[start], &coordinates.z[start], count, &positions[start]);
+    });
+    coordinates = VertexCoordinates(); // free the memory
+
+    mesh->addIndexedFaces(positions, indices.data(), indices.size() / 3);
+    mesh->finish();
+}
+
+/*!
+ * Add the triangles of a fan over the vertices of a face to \p indices.
+ */
+template<typename T>
+void addFan(const T* face, unsigned int vertex_count, std::vector<T>& indices)
+{
+    for (unsigned int corner = 1; corner + 1 < vertex_count; corner++)
+    {
+        indices.push_back(face[0]);
+        indices.push_back(face[corner]);
+        indices.push_back(face[corner + 1]);
+    }
+}
+
+/*
+OBJ files may refer to vertices relative to the last one, so the indices found in a part of the file can only be made
+absolute once the number of vertices in the parts before it is known. A relative index is kept as its position from the
+start of the part, minus relative_index_base; absolute ones are kept as they are, counting from zero.
+*/
+const int64_t relative_index_base = int64_t(1) << 62;
+const int64_t invalid_obj_index = std::numeric_limits<int64_t>::max();
+
+/*!
+ * The vertices and the triangles found in a part of an OBJ file.
+ */
+struct ObjChunk
+{
+    VertexCoordinates vertices;
+    std::vector<int64_t> indices;
+};
+
+/*!
+ * Collect the vertices and faces of the lines in [\p begin, \p end), which should begin at the start of a line.
+ */
+void parseObjLines(const char* begin, const char* end, ObjChunk& result)
+{
+    std::vector<int64_t> face;
+    const char* p = begin;
+    while (p < end)
+    {
+        while (p < end && isSpace(*p))
+            p++;
+        if (end - p >= 2 && p[0] == 'v' && isSpace(p[1]))
+        {
+            p += 2;
+            float v[3];
+            bool is_vertex = true;
+            for (unsigned int n = 0; n < 3 && is_vertex; n++)
+            {
+                while (p < end && isSpace(*p))
+                    p++;
+                const char* number_end = (p < end && !isLineEnd(*p))? parseFloat(p, end, v[n]) : nullptr;
+                is_vertex = number_end != nullptr;
+                if (is_vertex)
+                    p = number_end;
+            }
+            if (is_vertex)
+            {
+                result.vertices.add(v[0], v[1], v[2]);
+            }
+        }
+        else if (end - p >= 2 && p[0] == 'f' && isSpace(p[1]))
+        {
+            p += 2;
+            face.clear();
+            while (true)
+            {
+                while (p < end && isSpace(*p))
+                    p++;
+                if (p >= end || isLineEnd(*p))
+                    break;
+                int64_t index;
+                const char* number_end = parseInt(p, end, index);
+                if (!number_end)
+                    break;
+                if (index > 0)
+                    face.push_back(index - 1);
+                else if (index < 0)
+                    face.push_back(int64_t(result.vertices.x.size()) + index - relative_index_base);
+                else
+                    face.push_back(invalid_obj_index);
+                for (p = number_end; p < end && !isSpace(*p) && !isLineEnd(*p); p++) { } // the texture coordinate and normal
+            }
+            addFan(face.data(), face.size(), result.indices);
+        }
+        while (p < end && !isLineEnd(*p))
+            p++;
+        while (p < end && isLineEnd(*p))
+            p++;
+    }
+}
+
+enum PlyType
+{
+    Ply_Int8, Ply_UInt8, Ply_Int16, Ply_UInt16, Ply_Int32, Ply_UInt32, Ply_Float32, Ply_Float64, Ply_Invalid
+};
+
+PlyType getPlyType(const std::string& name)
+{
+    if (name == "char" || name == "int8") return Ply_Int8;
+    if (name == "uchar" || name == "uint8") return Ply_UInt8;
+    if (name == "short" || name == "int16") return Ply_Int16;
+    if (name == "ushort" || name == "uint16") return Ply_UInt16;
+    if (name == "int" || name == "int32") return Ply_Int32;
+    if (name == "uint" || name == "uint32") return Ply_UInt32;
+    if (name == "float" || name == "float32") return Ply_Float32;
+    if (name == "double" || name == "float64") return Ply_Float64;
+    return Ply_Invalid;
+}
+
+unsigned int getPlyTypeSize(PlyType type)
+{
+    static const unsigned int sizes[] = {1, 1, 2, 2, 4, 4, 4, 8, 0};
+    return sizes[type];
+}
+
+/*!
+ * Read a value of a PLY file, which must have getPlyTypeSize(\p type) bytes.
+ */
+double readPlyValue(const char* data, PlyType type, bool big_endian)
+{
+    unsigned char bytes[8];
+    unsigned int size = getPlyTypeSize(type);
+    for (unsigned int byte_idx = 0; byte_idx < size; byte_idx++)
+    {
+        bytes[byte_idx] = data[big_endian? size - 1 - byte_idx : byte_idx];
+    }
+    // the bytes are now little endian; assemble them so that the host's byte order doesn't matter
+    uint64_t bits = 0;
+    for (unsigned int byte_idx = 0; byte_idx < size; byte_idx++)
+    {
+        bits |= uint64_t(bytes[byte_idx]) << (8 * byte_idx);
+    }
+    switch (type)
+    {
+    case Ply_Int8: return int8_t(bits);
+    case Ply_UInt8: return uint8_t(bits);
+    case Ply_Int16: return int16_t(bits);
+    case Ply_UInt16: return uint16_t(bits);
+    case Ply_Int32: return int32_t(bits);
+    case Ply_UInt32: return uint32_t(bits);
+    case Ply_Float32: { uint32_t bits32 = bits; float value; memcpy(&value, &bits32, sizeof(value)); return value; }
+    case Ply_Float64: { double value; memcpy(&value, &bits, sizeof(value)); return value; }
+    default: return 0;
+    }
+}
+
+struct PlyProperty
+{
+    std::string name;
+    PlyType type; //!< The type of the value, or of the items of a list
+    PlyType count_type; //!< The type of the number of items of a list; Ply_Invalid if the property isn't a list
+};
+
+struct PlyElement
+{
+    std::string name;
+    size_t count;
+    std::vector<PlyProperty> properties;
+};
+
+/*!
+ * Read the header of a PLY file.
+ *
+ * \param data The contents of the file
+ * \param size The size of the file
+ * \param elements Where to store the elements of the file
+ * \param big_endian Where to store whether the file is big endian
+ * \return The size of the header; zero if the file isn't a binary PLY file
+ */
+size_t readPlyHeader(const char* data, size_t size, std::vector<PlyElement>& elements, bool& big_endian)
+{
+    const char* end = data + size;
+    const char* p = data;
+    bool binary = false;
+    bool first_line = true;
+    while (p < end)
+    {
+        const char* line_end = p;
+        while (line_end < end && *line_end != '\n')
+            line_end++;
+        std::vector<std::string> words;
+        for (const char* word = p; word < line_end; )
+        {
+            while (word < line_end && (isSpace(*word) || *word == '\r'))
+                word++;
+            const char* word_end = word;
+            while (word_end < line_end && !isSpace(*word_end) && *word_end != '\r')
+                word_end++;
+            if (word_end > word)
+                words.emplace_back(word, word_end);
+            word = word_end;
+        }
+        p = std::min(line_end + 1, end);
+        if (first_line)
+        {
+            if (words.size() != 1 || words[0] != "ply")
+                return 0;
+            first_line = false;
+        }
+        else if (words.empty() || words[0] == "comment" || words[0] == "obj_info")
+        {
+            continue;
+        }
+        else if (words[0] == "format" && words.size() >= 2)
+        {
+            binary = words[1] == "binary_little_endian" || words[1] == "binary_big_endian";
+            big_endian = words[1] == "binary_big_endian";
+            if (!binary)
+            {
+                cura::logError("Only binary PLY files can be loaded, not %s ones\n", words[1].c_str());
+                return 0;
+            }
+        }
+        else if (words[0] == "element" && words.size() == 3)
+        {
+            elements.emplace_back();
+            elements.back().name = words[1];
+            elements.back().count = strtoull(words[2].c_str(), nullptr, 10);
+        }
+        else if (words[0] == "property" && !elements.empty())
+        {
+            PlyProperty property;
+            if (words.size() == 5 && words[1] == "list")
+            {
+                property.count_type = getPlyType(words[2]);
+                property.type = getPlyType(words[3]);
+                property.name = words[4];
+                if (property.count_type == Ply_Invalid || property.count_type == Ply_Float32 || property.count_type == Ply_Float64)
+                    return 0;
+            }
+            else if (words.size() == 3)
+            {
+                property.count_type = Ply_Invalid;
+                property.type = getPlyType(words[1]);
+                property.name = words[2];
+            }
+            else
+            {
+                return 0;
+            }
+            if (property.type == Ply_Invalid)
+                return 0;
+            elements.back().properties.push_back(property);
+        }
+        else if (words[0] == "end_header")
+        {
+            return binary? p - data : 0;
+        }
+        else
+        {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+/*
+The parts of a 3MF file are stored in a ZIP archive. Only the model is read from it, which is found through the
+relationships of the package, in _rels/.rels.
+*/
+uint32_t readZipUInt(const char* data, unsigned int size)
+{
+    uint32_t value = 0;
+    for (unsigned int byte_idx = 0; byte_idx < size; byte_idx++)
+    {
+        value |= uint32_t(static_cast<unsigned char>(data[byte_idx])) << (8 * byte_idx);
+    }
+    return value;
+}
+
+/*!
+ * Read a file from a ZIP archive.
+ *
+ * \param data The archive
+ * \param size The size of the archive
+ * \param name The name of the file, of which the case doesn't matter
+ * \param contents Where to store the contents of the file
+ * \return Whether the file was found and could be read
+ */
+bool readZipEntry(const char* data, size_t size, const std::string& name, std::string& contents)
+{
+    // the end of central directory record: 22 bytes, followed by a comment of up to 64 kB
+    const size_t end_record_size = 22;
+    if (size < end_record_size)
+        return false;
+    const char* end_record = nullptr;
+    for (size_t pos = size - end_record_size; pos + 0x10000 + end_record_size >= size; pos--)
+    {
+        if (readZipUInt(data + pos, 4) == 0x06054b50)
+        {
+            end_record = data + pos;
+            break;
+        }
+        if (pos == 0)
+            break;
+    }
+    if (!end_record)
+        return false;
+    size_t entry_count = readZipUInt(end_record + 10, 2);
+    size_t directory_offset = readZipUInt(end_record + 16, 4);
+    const char* end = data + size;
+    const char* entry = data + std::min(directory_offset, size);
+    for (size_t entry_idx = 0; entry_idx < entry_count; entry_idx++)
+    {
+        if (end - entry < 46 || readZipUInt(entry, 4) != 0x02014b50)
+            return false;
+        unsigned int method = readZipUInt(entry + 10, 2);
+        size_t compressed_size = readZipUInt(entry + 20, 4);
+        size_t uncompressed_size = readZipUInt(entry + 24, 4);
+        size_t name_size = readZipUInt(entry + 28, 2);
+        size_t entry_size = 46 + name_size + readZipUInt(entry + 30, 2) + readZipUInt(entry + 32, 2);
+        size_t local_offset = readZipUInt(entry + 42, 4);
+        if (size_t(end - entry) < entry_size)
+            return false;
+        if (name_size != name.size() || strncasecmp(entry + 46, name.data(), name_size) != 0)
+        {
+            entry += entry_size;
+            continue;
+        }
+        if (local_offset > size || size - local_offset < 30 || readZipUInt(data + local_offset, 4) != 0x04034b50)
+            return false;
+        size_t data_offset = local_offset + 30 + readZipUInt(data + local_offset + 26, 2) + readZipUInt(data + local_offset + 28, 2);
+        if (compressed_size == 0xFFFFFFFF || uncompressed_size == 0xFFFFFFFF)
+        {
+            cura::logError("Can't read %s, which is stored as ZIP64\n", name.c_str());
+            return false;
+        }
+        if (data_offset > size || size - data_offset < compressed_size)
+            return false;
+        const char* compressed = data + data_offset;
+        if (method == 0) // stored
+        {
+            contents.assign(compressed, compressed_size);
+            return true;
+        }
+        if (method != 8) // deflated
+        {
+            cura::logError("Can't read %s, which is compressed by method %u\n", name.c_str(), method);
+            return false;
+        }
+#ifdef HAVE_ZLIB
+        contents.resize(uncompressed_size);
+        z_stream stream;
+        memset(&stream, 0, sizeof(stream));
+        if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) // raw deflate, without a zlib header
+            return false;
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(compressed));
+        stream.avail_in = compressed_size;
+        stream.next_out = reinterpret_cast<Bytef*>(&contents[0]);
+        stream.avail_out = uncompressed_size;
+        int result = inflate(&stream, Z_FINISH);
+        inflateEnd(&stream);
+        return result == Z_STREAM_END && stream.total_out == uncompressed_size;
+#else
+        cura::logError("Can't read %s, which is compressed, without zlib\n", name.c_str());
+        return false;
+#endif
+    }
+    return false;
+}
+
+/*!
+ * Find the value of an attribute in the XML tag [\p tag, \p tag_end). Namespace prefixes aren't looked at.
+ *
+ * \return Whether the tag has the attribute
+ */
+bool getXmlAttribute(const char* tag, const char* tag_end, const char* name, const char*& value, const char*& value_end)
+{
+    size_t name_size = strlen(name);
+    for (const char* p = tag; p + name_size + 2 < tag_end; p++)
+    {
+        if ((isSpace(p[-1]) || isLineEnd(p[-1])) && memcmp(p, name, name_size) == 0 && p[name_size] == '=' && (p[name_size + 1] == '"' || p[name_size + 1] == '\''))
+        {
+            char quote = p[name_size + 1];
+            value = p + name_size + 2;
+            value_end = static_cast<const char*>(memchr(value, quote, tag_end - value));
+            return value_end != nullptr;
+        }
+    }
+    return false;
+}
+
+/*!
+ * Find the next tag with a name in [\p p, \p end), skipping closing tags and tags of which the name only starts with it.
+ *
+ * \return The start of the tag, at its name after the '<', or nullptr if there is none
+ */
+const char* findXmlTag(const char* p, const char* end, const char* name, const char*& tag_end)
+{
+    size_t name_size = strlen(name);
+    while (p < end)
+    {
+        p = static_cast<const char*>(memchr(p, '<', end - p));
+        if (!p)
+            return nullptr;
+        p++;
+        const char* tag_name = p;
+        for (const char* q = p; q < end && *q != '>' && !isSpace(*q) && !isLineEnd(*q) && *q != '/'; q++)
+        {
+            if (*q == ':')
+                tag_name = q + 1; // a namespace prefix
+        }
+        if (end - tag_name > ptrdiff_t(name_size) && memcmp(tag_name, name, name_size) == 0
+            && (isSpace(tag_name[name_size]) || isLineEnd(tag_name[name_size]) || tag_name[name_size] == '>' || tag_name[name_size] == '/'))
+        {
+            tag_end = static_cast<const char*>(memchr(tag_name, '>', end - tag_name));
+            if (!tag_end)
+                return nullptr;
+            return tag_name;
+        }
+    }
+    return nullptr;
+}
+
+/*!
+ * Find the end of the element of which the start tag ends at \p tag_end: the start of its closing tag, or \p tag_end if it is empty.
+ */
+const char* findXmlElementEnd(const char* tag_end, const char* end, const char* name)
+{
+    if (tag_end[-1] == '/')
+        return tag_end;
+    std::string closing = std::string("/") + name + ">";
+    for (const char* p = tag_end; p < end; p++)
+    {
+        p = static_cast<const char*>(memchr(p, '<', end - p));
+        if (!p)
+            return end;
+        const char* tag_name = p + 1;
+        if (tag_name < end && *tag_name == '/')
+        {
+            const char* q = tag_name + 1;
+            const char* name_start = q;
+            for (; q < end && *q != '>'; q++)
+            {
+                if (*q == ':')
+                    name_start = q + 1;
+            }
+            if (size_t(q - name_start) == strlen(name) && memcmp(name_start, name, q - name_start) == 0)
+                return p;
+        }
+    }
+    return end;
+}
+
+/*!
+ * A 3MF transform: the first three rows of a 4x4 matrix of which the points are multiplied from the left, the last row
+ * being the translation.
+ */
+struct Transform3MF
+{
+    double m[12];
+
+    Transform3MF()
+    {
+        static const double identity[12] = {1, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0};
+        memcpy(m, identity, sizeof(m));
+    }
+
+    /*!
+     * Read the transform attribute of a tag; the identity if it hasn't got one.
+     */
+    Transform3MF(const char* tag, const char* tag_end)
+    : Transform3MF()
+    {
+        const char* value;
+        const char* value_end;
+        if (!getXmlAttribute(tag, tag_end, "transform", value, value_end))
+            return;
+        for (unsigned int idx = 0; idx < 12; idx++)
+        {
+            while (value < value_end && isSpace(*value))
+                value++;
+            float number;
+            const char* number_end = parseFloat(value, value_end, number);
+            if (!number_end)
+                return;
+            m[idx] = number;
+            value = number_end;
+        }
+    }
+
+    /*!
+     * This transform followed by \p then.
+     */
+    Transform3MF followedBy(const Transform3MF& then) const
+    {
+        Transform3MF result;
+        for (unsigned int row = 0; row < 4; row++)
+        {
+            for (unsigned int column = 0; column < 3; column++)
+            {
+                double value = (row == 3)? then.m[9 + column] : 0;
+                for (unsigned int k = 0; k < 3; k++)
+                    value += m[row * 3 + k] * then.m[k * 3 + column];
+                result.m[row * 3 + column] = value;
+            }
+        }
+        return result;
+    }
+};
+
+/*!
+ * An object of a 3MF model: a mesh, or components made of other objects.
+ */
+struct Object3MF
+{
+    VertexCoordinates vertices;
+    std::vector<uint32_t> indices;
+    std::vector<std::pair<std::string, Transform3MF>> components; //!< The id of the object of each component, and its transform
+};
+
+/*!
+ * Parse the vertices of the vertices element [\p begin, \p end) in parallel.
+ */
+void parse3MFVertices(const char* begin, const char* end, unsigned int thread_count, VertexCoordinates& result)
+{
+    std::vector<const char*> starts = splitText(begin, end, '>');
+    std::vector<VertexCoordinates> chunks(starts.size() - 1);
+    cura::parallelFor(chunks.size(), thread_count, [&](unsigned int chunk_idx)
+    {
+        const char* chunk_end = starts[chunk_idx + 1];
+        const char* tag_end;
+        for (const char* tag = findXmlTag(starts[chunk_idx], chunk_end, "vertex", tag_end); tag; tag = findXmlTag(tag_end, chunk_end, "vertex", tag_end))
+        {
+            float v[3];
+            const char* names[] = {"x", "y", "z"};
+            bool is_vertex = true;
+            for (unsigned int n = 0; n < 3 && is_vertex; n++)
+            {
+                const char* value;
+                const char* value_end;
+                is_vertex = getXmlAttribute(tag, tag_end, names[n], value, value_end) && parseFloat(value, value_end, v[n]);
+            }
+            if (!is_vertex)
+                v[0] = v[1] = v[2] = 0; // keep the numbering of the vertices
+            chunks[chunk_idx].add(v[0], v[1], v[2]);
+        }
+    });
+    for (VertexCoordinates& chunk : chunks)
+    {
+        result.x.insert(result.x.end(), chunk.x.begin(), chunk.x.end());
+        result.y.insert(result.y.end(), chunk.y.begin(), chunk.y.end());
+        result.z.insert(result.z.end(), chunk.z.begin(), chunk.z.end());
+        chunk = VertexCoordinates();
+    }
+}
+
+/*!
+ * Parse the triangles of the triangles element [\p begin, \p end) in parallel.
+ */
+void parse3MFTriangles(const char* begin, const char* end, unsigned int thread_count, std::vector<uint32_t>& result)
+{
+    std::vector<const char*> starts = splitText(begin, end, '>');
+    std::vector<std::vector<uint32_t>> chunks(starts.size() - 1);
+    cura::parallelFor(chunks.size(), thread_count, [&](unsigned int chunk_idx)
+    {
+        const char* chunk_end = starts[chunk_idx + 1];
+        const char* tag_end;
+        for (const char* tag = findXmlTag(starts[chunk_idx], chunk_end, "triangle", tag_end); tag; tag = findXmlTag(tag_end, chunk_end, "triangle", tag_end))
+        {
+            const char* names[] = {"v1", "v2", "v3"};
+            for (unsigned int n = 0; n < 3; n++)
+            {
+                const char* value;
+                const char* value_end;
+                int64_t index;
+                bool valid = getXmlAttribute(tag, tag_end, names[n], value, value_end) && parseInt(value, value_end, index) && index >= 0 && index < invalid_index;
+                chunks[chunk_idx].push_back(valid? uint32_t(index) : invalid_index);
+            }
+        }
+    });
+    for (std::vector<uint32_t>& chunk : chunks)
+    {
+        result.insert(result.end(), chunk.begin(), chunk.end());
+        std::vector<uint32_t>().swap(chunk);
+    }
+}
+
+/*!
+ * Add a mesh to \p object for each mesh of a 3MF object, placed by \p transform.
+ */
+void place3MFObject(PrintObject* object, std::map<std::string, Object3MF>& objects, const std::string& id, const Transform3MF& transform, double unit, FMatrix3x3& matrix, unsigned int depth)
+{
+    auto found = objects.find(id);
+    if (found == objects.end() || depth > 16)
+    {
+        cura::logError("3MF object %s doesn't exist\n", id.c_str());
+        return;
+    }
+    Object3MF& source = found->second;
+    for (std::pair<std::string, Transform3MF>& component : source.components)
+    {
+        place3MFObject(object, objects, component.first, component.second.followedBy(transform), unit, matrix, depth + 1);
+    }
+    if (source.indices.empty())
+    {
+        return;
+    }
+    VertexCoordinates coordinates;
+    size_t vertex_count = source.vertices.x.size();
+    coordinates.x.resize(vertex_count);
+    coordinates.y.resize(vertex_count);
+    coordinates.z.resize(vertex_count);
+    const double* m = transform.m;
+    for (size_t vertex_idx = 0; vertex_idx < vertex_count; vertex_idx++)
+    {
+        double x = source.vertices.x[vertex_idx];
+        double y = source.vertices.y[vertex_idx];
+        double z = source.vertices.z[vertex_idx];
+        coordinates.x[vertex_idx] = (x * m[0] + y * m[3] + z * m[6] + m[9]) * unit;
+        coordinates.y[vertex_idx] = (x * m[1] + y * m[4] + z * m[7] + m[10]) * unit;
+        coordinates.z[vertex_idx] = (x * m[2] + y * m[5] + z * m[8] + m[11]) * unit;
+    }
+    object->meshes.emplace_back(object);
+    finishIndexedMesh(&object->meshes.back(), coordinates, source.indices, matrix);
+}
+
+}//namespace
+
+bool loadModelOBJ(Mesh* mesh, const char* filename, FMatrix3x3& matrix)
+{
+    MappedFile file(filename);
+    if (!file.isValid())
+    {
+        return false;
+    }
+    std::vector<const char*> chunk_starts = splitText(file.data(), file.data() + file.size(), '\n');
+    unsigned int chunk_count = chunk_starts.size() - 1;
+    unsigned int thread_count = cura::getThreadCount(mesh->getSettingAsCount("machine_thread_count"));
+    std::vector<ObjChunk> chunks(chunk_count);
+    cura::parallelFor(chunk_count, thread_count, [&](unsigned int chunk_idx)
+    {
+        parseObjLines(chunk_starts[chunk_idx], chunk_starts[chunk_idx + 1], chunks[chunk_idx]);
+    });
+    file.close();
+
+    // Make the indices absolute, now that the number of vertices before each part is known.
+    std::vector<size_t> vertex_offsets(chunk_count + 1, 0);
+    std::vector<size_t> index_offsets(chunk_count + 1, 0);
+    for (unsigned int chunk_idx = 0; chunk_idx < chunk_count; chunk_idx++)
+    {
+        vertex_offsets[chunk_idx + 1] = vertex_offsets[chunk_idx] + chunks[chunk_idx].vertices.x.size();
+        index_offsets[chunk_idx + 1] = index_offsets[chunk_idx] + chunks[chunk_idx].indices.size();
+    }
+    int64_t vertex_count = vertex_offsets.back();
+    VertexCoordinates coordinates;
+    coordinates.x.resize(vertex_count);
+    coordinates.y.resize(vertex_count);
+    coordinates.z.resize(vertex_count);
+    std::vector<uint32_t> indices(index_offsets.back());
+    cura::parallelFor(chunk_count, thread_count, [&](unsigned int chunk_idx)
+    {
+        ObjChunk& chunk = chunks[chunk_idx];
+        std::copy(chunk.vertices.x.begin(), chunk.vertices.x.end(), coordinates.x.begin() + vertex_offsets[chunk_idx]);
+        std::copy(chunk.vertices.y.begin(), chunk.vertices.y.end(), coordinates.y.begin() + vertex_offsets[chunk_idx]);
+        std::copy(chunk.vertices.z.begin(), chunk.vertices.z.end(), coordinates.z.begin() + vertex_offsets[chunk_idx]);
+        for (size_t idx = 0; idx < chunk.indices.size(); idx++)
+        {
+            int64_t index = chunk.indices[idx];
+            if (index < 0)
+                index += relative_index_base + vertex_offsets[chunk_idx];
+            indices[index_offsets[chunk_idx] + idx] = (index >= 0 && index < vertex_count && index < invalid_index)? uint32_t(index) : invalid_index;
+        }
+        chunk = ObjChunk(); // free the memory
+    });
+
+    finishIndexedMesh(mesh, coordinates, indices, matrix);
+    return true;
+}
+
+bool loadModelPLY(Mesh* mesh, const char* filename, FMatrix3x3& matrix)
+{
+    MappedFile file(filename);
+    if (!file.isValid())
+    {
+        return false;
+    }
+    std::vector<PlyElement> elements;
+    bool big_endian = false;
+    size_t header_size = readPlyHeader(file.data(), file.size(), elements, big_endian);
+    if (header_size == 0)
+    {
+        return false;
+    }
+    const char* p = file.data() + header_size;
+    const char* end = file.data() + file.size();
+
+    VertexCoordinates coordinates;
+    std::vector<uint32_t> indices;
+    for (const PlyElement& element : elements)
+    {
+        bool is_list = false;
+        bool is_face = element.name == "face";
+        size_t record_size = 0;
+        size_t min_record_size = 0; // with all lists empty
+        size_t min_face_size = 0; // with the indices of a triangle
+        int coordinate_offsets[3] = {-1, -1, -1};
+        PlyType coordinate_types[3] = {Ply_Invalid, Ply_Invalid, Ply_Invalid};
+        for (const PlyProperty& property : element.properties)
+        {
+            is_list |= property.count_type != Ply_Invalid;
+            if (property.count_type == Ply_Invalid)
+            {
+                min_record_size += getPlyTypeSize(property.type);
+            }
+            else
+            {
+                min_record_size += getPlyTypeSize(property.count_type);
+                if (is_face && (property.name == "vertex_indices" || property.name == "vertex_index"))
+                    min_face_size += 3 * getPlyTypeSize(property.type);
+            }
+            for (unsigned int axis = 0; axis < 3; axis++)
+            {
+                if (property.count_type == Ply_Invalid && property.name == std::string(1, 'x' + axis))
+                {
+                    coordinate_offsets[axis] = record_size;
+                    coordinate_types[axis] = property.type;
+                }
+            }
+            record_size += getPlyTypeSize(property.type);
+        }
+
+        if (!is_list)
+        { // fixed size records, which can be read in parallel
+            if (record_size > 0 && size_t(end - p) / record_size < element.count)
+                return false;
+            if (element.name == "vertex")
+            {
+                if (coordinate_offsets[0] < 0 || coordinate_offsets[1] < 0 || coordinate_offsets[2] < 0)
+                    return false;
+                coordinates.x.resize(element.count);
+                coordinates.y.resize(element.count);
+                coordinates.z.resize(element.count);
+                const size_t batch_size = 1 << 16;
+                unsigned int batch_count = (element.count + batch_size - 1) / batch_size;
+                unsigned int thread_count = cura::getThreadCount(mesh->getSettingAsCount("machine_thread_count"));
+                const char* records = p;
+                cura::parallelFor(batch_count, thread_count, [&](unsigned int batch_idx)
+                {
+                    size_t batch_end = std::min(element.count, (batch_idx + 1) * batch_size);
+                    for (size_t vertex_idx = batch_idx * batch_size; vertex_idx < batch_end; vertex_idx++)
+                    {
+                        const char* record = records + vertex_idx * record_size;
+                        coordinates.x[vertex_idx] = readPlyValue(record + coordinate_offsets[0], coordinate_types[0], big_endian);
+                        coordinates.y[vertex_idx] = readPlyValue(record + coordinate_offsets[1], coordinate_types[1], big_endian);
+                        coordinates.z[vertex_idx] = readPlyValue(record + coordinate_offsets[2], coordinate_types[2], big_endian);
+                    }
+                });
+            }
+            p += record_size * element.count;
+            continue;
+        }
+
+        // records with lists, of which each has to be read to find the next
+        if (size_t(end - p) / min_record_size < element.count)
+            return false; // the header declares more records than the file can hold
+        std::vector<uint32_t> face;
+        if (is_face)
+        { // don't trust the count for more triangles than the rest of the file can hold
+            indices.reserve(3 * std::min(element.count, size_t(end - p) / (min_record_size + min_face_size)));
+        }
+        for (size_t record_idx = 0; record_idx < element.count; record_idx++)
+        {
+            for (const PlyProperty& property : element.properties)
+            {
+                unsigned int value_size = getPlyTypeSize(property.type);
+                if (property.count_type == Ply_Invalid)
+                {
+                    if (size_t(end - p) < value_size)
+                        return false;
+                    p += value_size;
+                    continue;
+                }
+                unsigned int count_size = getPlyTypeSize(property.count_type);
+                if (size_t(end - p) < count_size)
+                    return false;
+                double count_value = readPlyValue(p, property.count_type, big_endian);
+                p += count_size;
+                size_t item_count = (count_value > 0)? size_t(count_value) : 0;
+                if (size_t(end - p) / value_size < item_count)
+                    return false;
+                if (is_face && (property.name == "vertex_indices" || property.name == "vertex_index"))
+                {
+                    face.clear();
+                    for (size_t item_idx = 0; item_idx < item_count; item_idx++)
+                    {
+                        double index = readPlyValue(p + item_idx * value_size, property.type, big_endian);
+                        face.push_back((index >= 0 && index < invalid_index)? uint32_t(index) : invalid_index);
+                    }
+                    addFan(face.data(), face.size(), indices);
+                }
+                p += item_count * value_size;
+            }
+        }
+    }
+    file.close();
+
+    finishIndexedMesh(mesh, coordinates, indices, matrix);
+    return true;
+}
+
+bool loadModel3MF(PrintObject* object, const char* filename, FMatrix3x3& matrix)
+{
+    MappedFile file(filename);
+    if (!file.isValid())
+    {
+        return false;
+    }
+    // the model is the target of the relationship of the package of type 3dmodel
+    std::string model_name = "3D/3dmodel.model";
+    std::string relationships;
+    if (readZipEntry(file.data(), file.size(), "_rels/.rels", relationships))
+    {
+        const char* rels_end = relationships.data() + relationships.size();
+        const char* tag_end;
+        for (const char* tag = findXmlTag(relationships.data(), rels_end, "Relationship", tag_end); tag; tag = findXmlTag(tag_end, rels_end, "Relationship", tag_end))
+        {
+            const char* type;
+            const char* type_end;
+            const char* target;
+            const char* target_end;
+            const char* model_type = "/3dmodel";
+            if (getXmlAttribute(tag, tag_end, "Type", type, type_end) && type_end - type >= ptrdiff_t(strlen(model_type))
+                && memcmp(type_end - strlen(model_type), model_type, strlen(model_type)) == 0
+                && getXmlAttribute(tag, tag_end, "Target", target, target_end))
+            {
+                model_name.assign((*target == '/')? target + 1 : target, target_end);
+                break;
+            }
+        }
+    }
+    std::string model;
+    if (!readZipEntry(file.data(), file.size(), model_name, model))
+    {
+        cura::logError("Can't find the model %s in %s\n", model_name.c_str(), filename);
+        return false;
+    }
+    file.close();
+
+    const char* begin = model.data();
+    const char* end = begin + model.size();
+    const char* tag_end;
+    const char* model_tag = findXmlTag(begin, end, "model", tag_end);
+    if (!model_tag)
+    {
+        return false;
+    }
+    double unit = 1.0; // millimeter
+    const char* value;
+    const char* value_end;
+    if (getXmlAttribute(model_tag, tag_end, "unit", value, value_end))
+    {
+        std::string unit_name(value, value_end);
+        const std::pair<const char*, double> units[] = {{"micron", 0.001}, {"centimeter", 10.0}, {"inch", 25.4}, {"foot", 304.8}, {"meter", 1000.0}};
+        for (const std::pair<const char*, double>& named_unit : units)
+        {
+            if (unit_name == named_unit.first)
+                unit = named_unit.second;
+        }
+    }
+
+    unsigned int thread_count = cura::getThreadCount(object->getSettingAsCount("machine_thread_count"));
+    std::map<std::string, Object3MF> objects;
+    std::vector<std::string> object_ids; // in the order of the file
+    for (const char* tag = findXmlTag(tag_end, end, "object", tag_end); tag; tag = findXmlTag(tag_end, end, "object", tag_end))
+    {
+        const char* object_end = findXmlElementEnd(tag_end, end, "object");
+        if (!getXmlAttribute(tag, tag_end, "id", value, value_end))
+            continue;
+        std::string id(value, value_end);
+        Object3MF& object_3mf = objects[id];
+        object_ids.push_back(id);
+        const char* part_end;
+        const char* part = findXmlTag(tag_end, object_end, "vertices", part_end);
+        if (part)
+        {
+            parse3MFVertices(part_end, findXmlElementEnd(part_end, object_end, "vertices"), thread_count, object_3mf.vertices);
+        }
+        part = findXmlTag(tag_end, object_end, "triangles", part_end);
+        if (part)
+        {
+            parse3MFTriangles(part_end, findXmlElementEnd(part_end, object_end, "triangles"), thread_count, object_3mf.indices);
+        }
+        for (part = findXmlTag(tag_end, object_end, "component", part_end); part; part = findXmlTag(part_end, object_end, "component", part_end))
+        {
+            if (getXmlAttribute(part, part_end, "objectid", value, value_end))
+                object_3mf.components.emplace_back(std::string(value, value_end), Transform3MF(part, part_end));
+        }
+        tag_end = object_end;
+    }
+
+    unsigned int mesh_count = object->meshes.size();
+    const char* build = findXmlTag(begin, end, "build", tag_end);
+    const char* item_end = nullptr;
+    const char* item = build? findXmlTag(tag_end, end, "item", item_end) : nullptr;
+    if (!item)
+    { // without a build all objects are printed where they are
+        for (const std::string& id : object_ids)
+            place3MFObject(object, objects, id, Transform3MF(), unit, matrix, 0);
+    }
+    for (; item; item = findXmlTag(item_end, end, "item", item_end))
+    {
+        if (getXmlAttribute(item, item_end, "objectid", value, value_end))
+            place3MFObject(object, objects, std::string(value, value_end), Transform3MF(item, item_end), unit, matrix, 0);
+    }
+    return object->meshes.size() > mesh_count;
+}
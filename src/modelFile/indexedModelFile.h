@@ -0,0 +1,35 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#ifndef MODELFILE_INDEXED_MODEL_FILE_H
+#define MODELFILE_INDEXED_MODEL_FILE_H
+
+#include "modelFile.h"
+
+/*
+The loaders of the formats which store a mesh as a list of vertices and, for each face, the indices of its vertices: OBJ,
+PLY and 3MF. Where an STL file repeats the corners of every face, so that the vertices have to be welded again through
+the hash of Mesh::findIndexOfVertex, these hand their index buffers to Mesh::addIndexedFaces as they are, which loads a
+large model in less time and memory.
+
+Faces with more than three vertices are split into triangles as a fan from their first vertex.
+*/
+
+/*!
+ * Load the "v" and "f" lines of a Wavefront OBJ file into \p mesh. Texture coordinates, normals, groups and materials are
+ * ignored, so all faces go into the one mesh.
+ */
+bool loadModelOBJ(Mesh* mesh, const char* filename, FMatrix3x3& matrix);
+
+/*!
+ * Load the x, y and z of the vertices and the vertex_indices of the faces of a binary PLY file, little or big endian,
+ * into \p mesh. Other elements and properties are skipped.
+ */
+bool loadModelPLY(Mesh* mesh, const char* filename, FMatrix3x3& matrix);
+
+/*!
+ * Load a 3MF file into \p object: a mesh for each object with a mesh which the build puts on the build plate, moved by
+ * the transform of the build item and those of the components in between. The model may be stored or deflated; the
+ * latter needs zlib.
+ */
+bool loadModel3MF(PrintObject* object, const char* filename, FMatrix3x3& matrix);
+
+#endif//MODELFILE_INDEXED_MODEL_FILE_H
@@ -2,105 +2,254 @@
 #include <string.h>
 #include <strings.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <float.h>
+#include <algorithm> // min
 
 #include "modelFile.h"
+#include "fileParsing.h"
+#include "indexedModelFile.h"
 #include "../utils/logoutput.h"
 #include "../utils/string.h"
+#include "../utils/parallel.h"
 
 FILE* binaryMeshBlob = nullptr;
 
 /* Custom fgets function to support Mac line-ends in Ascii STL files. OpenSCAD produces this when used on Mac */
-void* fgets_(char* ptr, size_t len, FILE* f)
+namespace
 {
-    while(len && fread(ptr, 1, 1, f) > 0)
+const double powers_of_ten[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+}//namespace
+
+const char* parseFloat(const char* p, const char* end, float& result)
+{
+    const char* start = p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = *p == '-';
+        p++;
+    }
+    uint64_t mantissa = 0;
+    int digits = 0; // significant digits in the mantissa
+    int exponent = 0;
+    bool any_digits = false;
+    for (; p < end && isDigit(*p); p++)
+    {
+        any_digits = true;
+        if (mantissa == 0 && *p == '0')
+            continue;
+        mantissa = mantissa * 10 + (*p - '0');
+        digits++;
+    }
+    if (p < end && *p == '.')
     {
-        if (*ptr == '\n' || *ptr == '\r')
+        for (p++; p < end && isDigit(*p); p++)
         {
-            *ptr = '\0';
-            return ptr;
+            any_digits = true;
+            exponent--;
+            if (mantissa == 0 && *p == '0')
+                continue;
+            mantissa = mantissa * 10 + (*p - '0');
+            digits++;
         }
-        ptr++;
-        len--;
     }
-    return nullptr;
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        const char* e = p + 1;
+        bool negative_exponent = false;
+        if (e < end && (*e == '-' || *e == '+'))
+        {
+            negative_exponent = *e == '-';
+            e++;
+        }
+        if (e < end && isDigit(*e))
+        {
+            int exp_value = 0;
+            for (; e < end && isDigit(*e); e++)
+            {
+                if (exp_value < 10000)
+                    exp_value = exp_value * 10 + (*e - '0');
+            }
+            exponent += negative_exponent? -exp_value : exp_value;
+            p = e;
+        }
+    }
+    bool fast = any_digits && digits <= 19 && mantissa <= (uint64_t(1) << 53) && exponent >= -22 && exponent <= 22
+        && !(p < end && (*p == 'x' || *p == 'X')); // hexadecimal
+    if (fast)
+    {
+        double value = double(mantissa);
+        value = (exponent < 0)? value / powers_of_ten[-exponent] : value * powers_of_ten[exponent];
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        bool halfway = (bits & 0x1FFFFFFF) == 0x10000000;
+        if (value == 0.0 || (!halfway && value >= FLT_MIN && value <= FLT_MAX))
+        {
+            result = float(negative? -value : value);
+            return p;
+        }
+    }
+    // Long, huge, tiny or special numbers (inf, nan, hexadecimal).
+    char buffer[128];
+    size_t length = std::min(size_t(end - start), sizeof(buffer) - 1);
+    memcpy(buffer, start, length);
+    buffer[length] = '\0';
+    char* number_end;
+    result = strtof(buffer, &number_end);
+    if (number_end == buffer)
+        return nullptr;
+    return start + (number_end - buffer);
 }
 
-bool loadModelSTL_ascii(Mesh* mesh, const char* filename, FMatrix3x3& matrix)
+namespace
 {
-    FILE* f = fopen(filename, "rt"); //read text
-    char buffer[1024];
-    FPoint3 vertex;
-    int n = 0;
-    Point3 v0(0,0,0), v1(0,0,0), v2(0,0,0);
-    while(fgets_(buffer, sizeof(buffer), f))
-    {
-        if (sscanf(buffer, " vertex %f %f %f", &vertex.x, &vertex.y, &vertex.z) == 3)
+/*!
+ * The vertex coordinates found in a part of an ASCII STL file.
+ */
+struct StlVertexCoordinates
+{
+    std::vector<float> x, y, z;
+};
+
+/*!
+ * Collect the coordinates of all " vertex x y z" lines in [\p begin, \p end), which should begin at the start of a line.
+ */
+void parseVertexLines(const char* begin, const char* end, StlVertexCoordinates& result)
+{
+    const char* p = begin;
+    while (p < end)
+    {
+        while (p < end && isSpace(*p))
+            p++;
+        float v[3];
+        bool is_vertex = end - p >= 6 && memcmp(p, "vertex", 6) == 0;
+        if (is_vertex)
         {
-            n++;
-            switch(n)
+            p += 6;
+            for (unsigned int n = 0; n < 3 && is_vertex; n++)
             {
-            case 1:
-                v0 = matrix.apply(vertex);
-                break;
-            case 2:
-                v1 = matrix.apply(vertex);
-                break;
-            case 3:
-                v2 = matrix.apply(vertex);
-                mesh->addFace(v0, v1, v2);
-                n = 0;
-                break;
+                while (p < end && isSpace(*p))
+                    p++;
+                const char* number_end = (p < end && !isLineEnd(*p))? parseFloat(p, end, v[n]) : nullptr;
+                is_vertex = number_end != nullptr;
+                if (is_vertex)
+                    p = number_end;
             }
         }
+        if (is_vertex)
+        {
+            result.x.push_back(v[0]);
+            result.y.push_back(v[1]);
+            result.z.push_back(v[2]);
+        }
+        while (p < end && !isLineEnd(*p))
+            p++;
+        while (p < end && isLineEnd(*p))
+            p++;
     }
-    fclose(f);
+}
+}//namespace
+
+bool loadModelSTL_ascii(Mesh* mesh, const char* filename, FMatrix3x3& matrix)
+{
+    MappedFile file(filename);
+    if (!file.isValid())
+    {
+        return false;
+    }
+    const char* data = file.data();
+    const char* data_end = data + file.size();
+
+    // Split the file into chunks at line ends and parse those in parallel.
+    const size_t chunk_size = 1 << 20;
+    std::vector<const char*> chunk_starts;
+    chunk_starts.push_back(data);
+    while (data_end - chunk_starts.back() > ptrdiff_t(chunk_size))
+    {
+        const char* p = chunk_starts.back() + chunk_size;
+        while (p < data_end && !isLineEnd(*p))
+            p++;
+        chunk_starts.push_back(p);
+    }
+    chunk_starts.push_back(data_end);
+    unsigned int chunk_count = chunk_starts.size() - 1;
+
+    unsigned int thread_count = cura::getThreadCount(mesh->getSettingAsCount("machine_thread_count"));
+    std::vector<StlVertexCoordinates> chunks(chunk_count);
+    cura::parallelFor(chunk_count, thread_count, [&](unsigned int chunk_idx)
+    {
+        parseVertexLines(chunk_starts[chunk_idx], chunk_starts[chunk_idx + 1], chunks[chunk_idx]);
+    });
+    file.close();
+
+    std::vector<size_t> chunk_offsets(chunk_count + 1, 0);
+    for (unsigned int chunk_idx = 0; chunk_idx < chunk_count; chunk_idx++)
+    {
+        chunk_offsets[chunk_idx + 1] = chunk_offsets[chunk_idx] + chunks[chunk_idx].x.size();
+    }
+    std::vector<Point3> corners(chunk_offsets.back());
+    cura::parallelFor(chunk_count, thread_count, [&](unsigned int chunk_idx)
+    {
+        StlVertexCoordinates& chunk = chunks[chunk_idx];
+        matrix.apply(chunk.x.data(), chunk.y.data(), chunk.z.data(), chunk.x.size(), corners.data() + chunk_offsets[chunk_idx]);
+        chunk = StlVertexCoordinates(); // free the memory
+    });
+
+    mesh->reserve(corners.size() / 3);
+    mesh->addFaces(corners);
     mesh->finish();
     return true;
 }
 
 bool loadModelSTL_binary(Mesh* mesh, const char* filename, FMatrix3x3& matrix)
 {
-    FILE* f = fopen(filename, "rb"); // read binary
-    char buffer[80];
-    uint32_t faceCount;
-    //Skip the header
-    if (fread(buffer, 80, 1, f) != 1)
+    MappedFile file(filename);
+    if (!file.isValid() || file.size() < 84)
     {
-        fclose(f);
         return false;
     }
-    //Read the face count
-    if (fread(&faceCount, sizeof(uint32_t), 1, f) != 1)
+    //Skip the header and read the face count
+    uint32_t faceCount;
+    memcpy(&faceCount, file.data() + 80, sizeof(uint32_t));
+    //For each face read:
+    //float(x,y,z) = normal, float(X,Y,Z)*3 = vertexes, uint16_t = flags
+    const size_t bytes_per_face = sizeof(float) * 12 + sizeof(uint16_t);
+    if ((file.size() - 84) / bytes_per_face < faceCount)
     {
-        fclose(f);
         return false;
     }
-    //For each face read:
-    //float(x,y,z) = normal, float(X,Y,Z)*3 = vertexes, uint16_t = flags
-    for(unsigned int i=0;i<faceCount;i++)
+    const char* face_data = file.data() + 84;
+
+    std::vector<Point3> corners(size_t(faceCount) * 3);
+    const unsigned int batch_size = 1024; // faces
+    unsigned int batch_count = (faceCount + batch_size - 1) / batch_size;
+    unsigned int thread_count = cura::getThreadCount(mesh->getSettingAsCount("machine_thread_count"));
+    cura::parallelFor(batch_count, thread_count, [&](unsigned int batch_idx)
     {
-        if (fread(buffer, sizeof(float) * 3, 1, f) != 1)
+        // Gather the coordinates of the batch into separate arrays, then transform them all at once.
+        float x[batch_size * 3], y[batch_size * 3], z[batch_size * 3];
+        unsigned int face_start = batch_idx * batch_size;
+        unsigned int face_end = std::min(face_start + batch_size, faceCount);
+        unsigned int n = 0;
+        for(unsigned int i = face_start; i < face_end; i++)
         {
-            fclose(f);
-            return false;
-        }
-        float v[9];
-        if (fread(v, sizeof(float) * 9, 1, f) != 1)
-        {
-            fclose(f);
-            return false;
-        }
-        Point3 v0 = matrix.apply(FPoint3(v[0], v[1], v[2]));
-        Point3 v1 = matrix.apply(FPoint3(v[3], v[4], v[5]));
-        Point3 v2 = matrix.apply(FPoint3(v[6], v[7], v[8]));
-        mesh->addFace(v0, v1, v2);
-        if (fread(buffer, sizeof(uint16_t), 1, f) != 1)
-        {
-            fclose(f);
-            return false;
+            float v[9];
+            memcpy(v, face_data + i * bytes_per_face + sizeof(float) * 3, sizeof(float) * 9);
+            for(unsigned int k = 0; k < 9; k += 3, n++)
+            {
+                x[n] = v[k];
+                y[n] = v[k + 1];
+                z[n] = v[k + 2];
+            }
         }
-    }
-    fclose(f);
+        matrix.apply(x, y, z, n, &corners[size_t(face_start) * 3]);
+    });
+    file.close();
+
+    mesh->reserve(faceCount);
+    mesh->addFaces(corners);
     mesh->finish();
     return true;
 }
@@ -138,6 +287,12 @@ bool loadModelSTL(Mesh* mesh, const char* filename, FMatrix3x3& matrix)
     return loadModelSTL_binary(mesh, filename, matrix);
 }
 
+bool isModelFile(const char* filename)
+{
+    const char* ext = strrchr(filename, '.');
+    return ext && (stringcasecompare(ext, ".stl") == 0 || stringcasecompare(ext, ".obj") == 0 || stringcasecompare(ext, ".ply") == 0 || stringcasecompare(ext, ".3mf") == 0);
+}
+
 //PrintObject is in modelFile.h
 bool loadMeshFromFile(PrintObject* object, const char* filename, FMatrix3x3& matrix)
 {
@@ -147,5 +302,19 @@ bool loadMeshFromFile(PrintObject* object, const char* filename, FMatrix3x3& mat
         object->meshes.emplace_back(object); //Appends a new element to the end of the container.
         return loadModelSTL(&object->meshes[object->meshes.size()-1], filename, matrix);
     }
+    if (ext && stringcasecompare(ext, ".obj") == 0)
+    {
+        object->meshes.emplace_back(object);
+        return loadModelOBJ(&object->meshes.back(), filename, matrix);
+    }
+    if (ext && stringcasecompare(ext, ".ply") == 0)
+    {
+        object->meshes.emplace_back(object);
+        return loadModelPLY(&object->meshes.back(), filename, matrix);
+    }
+    if (ext && stringcasecompare(ext, ".3mf") == 0)
+    {
+        return loadModel3MF(object, filename, matrix);
+    }
     return false;
 }
@@ -3,6 +3,7 @@
 #define MODELFILE_H
 /**
 modelFile contains the model loaders for the slicer. The model loader turns any format that it can read into a list of triangles with 3 X/Y/Z points.
+STL files are loaded here; the indexed formats OBJ, PLY and 3MF in indexedModelFile.
 
 The format returned is a Model class with an array of faces, which have integer points with a resolution of 1 micron. Giving a maximum object size of 4 meters.
 **/
@@ -58,8 +59,8 @@ public:
     void offset(Point3 offset)
     {
         for(Mesh& m : meshes)
-            for(MeshVertex& v : m.vertices)
-                v.p += offset;
+            for(Point3& p : m.vertices.positions)
+                p += offset;
     }
 
     void finalize()
@@ -93,6 +94,11 @@ public:
     }
 };
 
+/*!
+ * Whether a file is a model which loadMeshFromFile can load, going by its extension: STL, OBJ, PLY or 3MF.
+ */
+bool isModelFile(const char* filename);
+
 bool loadMeshFromFile(PrintObject* object, const char* filename, FMatrix3x3& matrix);
 
 #endif//MODELFILE_H
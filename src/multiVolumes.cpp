@@ -1,58 +1,116 @@
 #include "multiVolumes.h"
 
+#include "utils/parallel.h"
+#include "utils/trace.h"
+
+/*
+The layers are independent of each other, so they are processed in parallel. Within a layer a part is only combined with
+the areas of which the bounding box hits its own: polygons entirely outside the bounding box of a part don't change the
+result of a boolean operation within it, so leaving them out doesn't change the outlines.
+*/
 namespace cura {
 
-void carveMultipleVolumes(std::vector<SliceMeshStorage> &volumes)
+namespace
+{
+
+/*!
+ * The polygons of \p polys of which the bounding box hits \p box.
+ */
+Polygons getPolygonsNear(Polygons& polys, const std::vector<AABB>& boxes, const AABB& box)
+{
+    Polygons near;
+    for(unsigned int poly_idx = 0; poly_idx < polys.size(); poly_idx++)
+    {
+        if (boxes[poly_idx].hit(box))
+        {
+            near.add(polys[poly_idx]);
+        }
+    }
+    return near;
+}
+
+std::vector<AABB> getBoundaryBoxes(Polygons& polys)
+{
+    std::vector<AABB> boxes;
+    boxes.reserve(polys.size());
+    for(unsigned int poly_idx = 0; poly_idx < polys.size(); poly_idx++)
+    {
+        Polygons poly;
+        poly.add(polys[poly_idx]);
+        boxes.emplace_back(poly);
+    }
+    return boxes;
+}
+
+}//anonymous namespace
+
+void carveMultipleVolumes(std::vector<SliceMeshStorage> &volumes, unsigned int thread_count)
 {
+    if (volumes.size() < 2) return;
+
     //Go trough all the volumes, and remove the previous volume outlines from our own outline, so we never have overlapped areas.
-    for(unsigned int idx=0; idx < volumes.size(); idx++)
+    //The outlines of the parts of all previous volumes which hit a part are removed from it at once.
+    parallelFor(volumes[0].layers.size(), thread_count, [&](unsigned int layerNr)
     {
-        for(unsigned int idx2=0; idx2<idx; idx2++)
+        TRACE_ZONE("layer carve", layerNr);
+        for(unsigned int idx=1; idx < volumes.size(); idx++)
         {
-            for(unsigned int layerNr=0; layerNr < volumes[idx].layers.size(); layerNr++)
+            SliceLayer* layer1 = &volumes[idx].layers[layerNr];
+            for(unsigned int p1 = 0; p1 < layer1->parts.size(); p1++)
             {
-                SliceLayer* layer1 = &volumes[idx].layers[layerNr];
-                SliceLayer* layer2 = &volumes[idx2].layers[layerNr];
-                for(unsigned int p1 = 0; p1 < layer1->parts.size(); p1++)
+                SliceLayerPart& part1 = layer1->parts[p1];
+                Polygons previous_outlines;
+                for(unsigned int idx2=0; idx2<idx; idx2++)
                 {
+                    SliceLayer* layer2 = &volumes[idx2].layers[layerNr];
                     for(unsigned int p2 = 0; p2 < layer2->parts.size(); p2++)
                     {
-                        layer1->parts[p1].outline = layer1->parts[p1].outline.difference(layer2->parts[p2].outline);
+                        if (part1.boundaryBox.hit(layer2->parts[p2].boundaryBox))
+                        {
+                            previous_outlines.add(layer2->parts[p2].outline);
+                        }
                     }
                 }
+                if (previous_outlines.size() > 0)
+                {
+                    part1.outline = part1.outline.differenceUnion(previous_outlines);
+                }
             }
         }
-    }
+    });
 }
 
 //Expand each layer a bit and then keep the extra overlapping parts that overlap with other volumes.
 //This generates some overlap in dual extrusion, for better bonding in touching parts.
-void generateMultipleVolumesOverlap(std::vector<SliceMeshStorage> &volumes, int overlap)
+void generateMultipleVolumesOverlap(std::vector<SliceMeshStorage> &volumes, int overlap, unsigned int thread_count)
 {
     if (volumes.size() < 2 || overlap <= 0) return;
     
-    for(unsigned int layerNr=0; layerNr < volumes[0].layers.size(); layerNr++)
+    parallelFor(volumes[0].layers.size(), thread_count, [&](unsigned int layerNr)
     {
+        TRACE_ZONE("layer overlap", layerNr);
         Polygons fullLayer;
         for(unsigned int volIdx = 0; volIdx < volumes.size(); volIdx++)
         {
             SliceLayer* layer1 = &volumes[volIdx].layers[layerNr];
             for(unsigned int p1 = 0; p1 < layer1->parts.size(); p1++)
             {
-                fullLayer = fullLayer.unionPolygons(layer1->parts[p1].outline.offset(20)); // TODO: put hard coded value in a variable with an explanatory name (and make var a parameter, and perhaps even a setting?)
+                fullLayer.add(layer1->parts[p1].outline.offset(20)); // TODO: put hard coded value in a variable with an explanatory name (and make var a parameter, and perhaps even a setting?)
             }
         }
-        fullLayer = fullLayer.offset(-20); // TODO: put hard coded value in a variable with an explanatory name (and make var a parameter, and perhaps even a setting?)
+        fullLayer = fullLayer.unionPolygons().offset(-20); // TODO: put hard coded value in a variable with an explanatory name (and make var a parameter, and perhaps even a setting?)
+        std::vector<AABB> fullLayer_boxes = getBoundaryBoxes(fullLayer);
         
         for(unsigned int volIdx = 0; volIdx < volumes.size(); volIdx++)
         {
             SliceLayer* layer1 = &volumes[volIdx].layers[layerNr];
             for(unsigned int p1 = 0; p1 < layer1->parts.size(); p1++)
             {
-                layer1->parts[p1].outline = fullLayer.intersection(layer1->parts[p1].outline.offset(overlap / 2));
+                Polygons expanded = layer1->parts[p1].outline.offset(overlap / 2);
+                layer1->parts[p1].outline = getPolygonsNear(fullLayer, fullLayer_boxes, AABB(expanded)).intersection(expanded);
             }
         }
-    }
+    });
 }
  
 }//namespace cura
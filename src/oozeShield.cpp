@@ -0,0 +1,103 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#include "oozeShield.h"
+
+#include <algorithm>
+
+#include "utils/parallel.h"
+#include "utils/trace.h"
+
+/*
+The shield of each layer is widened to what is left of the shield of the layer below after an inset by the angle
+distance, from the bottom up, and then likewise from the top down. Rather than one layer after the other, the layers are
+swept a block at a time: each block is swept on its own in parallel, after which the shield carried into each block from
+the blocks before it takes one inset and union per block, and is added to each layer of the block inset by the distance
+of that layer from the start of the block. This only differs from sweeping layer by layer where the insets of areas
+carried up from different layers would touch, which is too little to matter for a shield. The blocks have a fixed size,
+so the shield doesn't depend on the number of threads.
+*/
+namespace cura 
+{
+
+namespace
+{
+
+const unsigned int sweep_block_size = 32; //!< The number of layers swept at a time
+
+/*!
+ * Widen each shield layer to the inset of the shield of the layer before it, going up or down through the layers.
+ */
+void sweepOozeShield(std::vector<Polygons>& shield, bool upward, int angle_distance, unsigned int thread_count)
+{
+    unsigned int layer_count = shield.size();
+    unsigned int block_count = (layer_count + sweep_block_size - 1) / sweep_block_size;
+    auto getLayer = [&](unsigned int block_idx, unsigned int pos) -> Polygons&
+    {
+        unsigned int step = block_idx * sweep_block_size + pos;
+        return shield[upward? step : layer_count - 1 - step];
+    };
+    auto getBlockSize = [&](unsigned int block_idx)
+    {
+        return std::min(sweep_block_size, layer_count - block_idx * sweep_block_size);
+    };
+
+    parallelFor(block_count, thread_count, [&](unsigned int block_idx)
+    {
+        TRACE_ZONE("ooze shield sweep");
+        for(unsigned int pos = 1; pos < getBlockSize(block_idx); pos++)
+        {
+            getLayer(block_idx, pos) = getLayer(block_idx, pos).unionPolygons(getLayer(block_idx, pos - 1).offset(-angle_distance));
+        }
+    });
+
+    std::vector<Polygons> carried(block_count); // per block, the shield of the layer before it
+    for(unsigned int block_idx = 1; block_idx < block_count; block_idx++)
+    {
+        Polygons& last = getLayer(block_idx - 1, sweep_block_size - 1);
+        carried[block_idx] = last.unionPolygons(carried[block_idx - 1].offset(-angle_distance * int(sweep_block_size)));
+    }
+
+    parallelFor(layer_count, thread_count, [&](unsigned int step)
+    {
+        unsigned int block_idx = step / sweep_block_size;
+        unsigned int pos = step % sweep_block_size;
+        if (carried[block_idx].size() == 0)
+        {
+            return;
+        }
+        Polygons carried_inset = carried[block_idx].offset(-angle_distance * int(pos + 1));
+        if (carried_inset.size() > 0)
+        {
+            Polygons& layer = getLayer(block_idx, pos);
+            layer = layer.unionPolygons(carried_inset);
+        }
+    });
+}
+
+}//anonymous namespace
+
+void generateOozeShield(SliceDataStorage& storage, unsigned int layer_count, int distance, int angle_distance, unsigned int thread_count)
+{
+    storage.oozeShield.resize(layer_count);
+    parallelFor(layer_count, thread_count, [&](unsigned int layer_nr)
+    {
+        TRACE_ZONE("layer ooze shield", layer_nr);
+        StatsScope stats_scope(getStatsContext().stage, layer_nr);
+        Polygons outlines;
+        for(SliceMeshStorage& mesh : storage.meshes)
+        {
+            for(SliceLayerPart& part : mesh.layers[layer_nr].parts)
+            {
+                outlines.add(part.outline);
+            }
+        }
+        // a single offset of all outlines of the layer is the union of the offsets of the parts
+        Polygons& shield = storage.oozeShield[layer_nr];
+        shield = outlines.offset(distance);
+        shield = shield.offset(-MM2INT(1.0)).offset(MM2INT(1.0)); // TODO: put hard coded value in a variable with an explanatory name (and make var a parameter, and perhaps even a setting?)
+    });
+
+    sweepOozeShield(storage.oozeShield, true, angle_distance, thread_count);
+    sweepOozeShield(storage.oozeShield, false, angle_distance, thread_count);
+}
+
+}//namespace cura
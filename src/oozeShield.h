@@ -0,0 +1,24 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#ifndef OOZE_SHIELD_H
+#define OOZE_SHIELD_H
+
+#include "sliceDataStorage.h"
+
+namespace cura 
+{
+
+/*!
+ * Generate the ooze shield: a wall around all meshes at \p distance from them, of which each layer sticks out at most
+ * \p angle_distance beyond the layers below and above it.
+ * 
+ * \param storage Storage containing the parts of all layers, to which the shield of each layer is added
+ * \param layer_count The number of layers
+ * \param distance The distance of the shield from the parts
+ * \param angle_distance The distance a layer of the shield may stick out beyond the layer above or below it
+ * \param thread_count The number of threads with which to generate the shield
+ */
+void generateOozeShield(SliceDataStorage& storage, unsigned int layer_count, int distance, int angle_distance, unsigned int thread_count);
+
+}//namespace cura
+
+#endif//OOZE_SHIELD_H
@@ -1,23 +1,183 @@
 /** Copyright (C) 2013 David Braam - Released under terms of the AGPLv3 License */
+#include <algorithm>
+#include <cmath>
 #include <map>
 
 #include "pathOrderOptimizer.h"
+#include "utils/gettime.h"
 #include "utils/logoutput.h"
-#include "utils/BucketGrid2D.h"
+#include "utils/stats.h"
+#include "utils/trace.h"
+#include "utils/PointGrid2D.h"
 
 #define INLINE static inline
 
 namespace cura {
 
+namespace
+{
+
+/*!
+ * A path in a sequence of paths to be printed, as seen by the travel between them.
+ */
+struct OrderedPath
+{
+    int idx; //!< The index of the path in the optimizer
+    Point from; //!< Where printing the path starts
+    Point to; //!< Where printing the path ends
+};
+
+double travelDistance(const Point& a, const Point& b)
+{
+    return std::sqrt(double(vSize2(a - b)));
+}
+
+/*!
+ * The total travel of printing \p paths in order, starting at \p start_point.
+ */
+double totalTravel(const std::vector<OrderedPath>& paths, Point start_point)
+{
+    double travel = 0;
+    for (const OrderedPath& path : paths)
+    {
+        travel += travelDistance(start_point, path.from);
+        start_point = path.to;
+    }
+    return travel;
+}
+
+/*!
+ * Print the paths \p begin up to \p end in the opposite order and direction.
+ */
+void reversePaths(std::vector<OrderedPath>::iterator begin, std::vector<OrderedPath>::iterator end)
+{
+    std::reverse(begin, end);
+    for (std::vector<OrderedPath>::iterator it = begin; it != end; ++it)
+    {
+        std::swap(it->from, it->to);
+    }
+}
+
+/*!
+ * Shorten the travel between \p paths with 2-opt moves (printing a run of paths in the opposite order and direction) and
+ * Or-opt moves (printing a run of up to three paths somewhere else), until no move shortens the travel or the time is up.
+ *
+ * Only moves saving more than a micron are made, so the search always ends.
+ *
+ * In metal printing a travel longer than \p welder_off_distance turns the welder off and on again. Such a travel costs
+ * \p welder_cycle_cost on top of its length, so that paths are chained to keep the arc lit.
+ *
+ * \param paths The paths in the order in which they are printed; reordered and reversed in place
+ * \param start_point Where the nozzle is before the first path
+ * \param time_budget The time in seconds after which no more moves are tried
+ * \param welder_off_distance The travel distance above which the welder is turned off, or zero when it never is
+ * \param welder_cycle_cost The travel distance worth saving one welder off/on cycle
+ */
+void refinePathOrder(std::vector<OrderedPath>& paths, Point start_point, double time_budget, int64_t welder_off_distance, int64_t welder_cycle_cost)
+{
+    auto travelCost = [&](const Point& a, const Point& b)
+    {
+        double distance = travelDistance(a, b);
+        return (welder_off_distance > 0 && distance > welder_off_distance)? distance + welder_cycle_cost : distance;
+    };
+    const double min_gain = 1.0;
+    const double deadline = getTime() + time_budget;
+    const int n = paths.size();
+    auto exitBefore = [&](int pos) { return (pos == 0)? start_point : paths[pos - 1].to; };
+    bool improved = true;
+    while (improved)
+    {
+        improved = false;
+        for (int i = 0; i < n; i++) /// 2-opt: reverse the paths i up to j
+        {
+            if (getTime() > deadline)
+            {
+                return;
+            }
+            Point before = exitBefore(i);
+            double cost_in = travelCost(before, paths[i].from);
+            for (int j = i; j < n; j++)
+            {
+                double old_cost = cost_in + ((j + 1 < n)? travelCost(paths[j].to, paths[j + 1].from) : 0);
+                double new_cost = travelCost(before, paths[j].to) + ((j + 1 < n)? travelCost(paths[i].from, paths[j + 1].from) : 0);
+                if (new_cost < old_cost - min_gain)
+                {
+                    reversePaths(paths.begin() + i, paths.begin() + j + 1);
+                    cost_in = travelCost(before, paths[i].from);
+                    improved = true;
+                }
+            }
+        }
+        for (int len = 1; len <= 3; len++) /// Or-opt: move the paths i up to i + len to after path k
+        {
+            for (int i = 0; i + len <= n; i++)
+            {
+                if (getTime() > deadline)
+                {
+                    return;
+                }
+                const int last = i + len - 1;
+                const Point before = exitBefore(i);
+                const bool has_after = last + 1 < n;
+                const double removal_gain = travelCost(before, paths[i].from)
+                    + (has_after? travelCost(paths[last].to, paths[last + 1].from) - travelCost(before, paths[last + 1].from) : 0);
+                bool moved = false;
+                for (int k = -1; k < n && !moved; k++)
+                {
+                    if (k >= i - 1 && k <= last)
+                    {
+                        continue; /// k == i - 1 leaves the paths where they are
+                    }
+                    const Point exit = (k < 0)? start_point : paths[k].to;
+                    const bool has_next = k + 1 < n;
+                    const double gap = has_next? travelCost(exit, paths[k + 1].from) : 0;
+                    for (bool reverse : { false, true })
+                    {
+                        const Point& from = reverse? paths[last].to : paths[i].from;
+                        const Point& to = reverse? paths[i].from : paths[last].to;
+                        const double insertion_cost = travelCost(exit, from) + (has_next? travelCost(to, paths[k + 1].from) - gap : 0);
+                        if (insertion_cost < removal_gain - min_gain)
+                        {
+                            int new_i;
+                            if (k < i)
+                            {
+                                std::rotate(paths.begin() + k + 1, paths.begin() + i, paths.begin() + last + 1);
+                                new_i = k + 1;
+                            }
+                            else
+                            {
+                                std::rotate(paths.begin() + i, paths.begin() + last + 1, paths.begin() + k + 1);
+                                new_i = k + 1 - len;
+                            }
+                            if (reverse)
+                            {
+                                reversePaths(paths.begin() + new_i, paths.begin() + new_i + len);
+                            }
+                            moved = true;
+                            break;
+                        }
+                    }
+                }
+                improved |= moved;
+            }
+        }
+    }
+}
+
+}//anonymous namespace
+
 /**
 *
 */
 void PathOrderOptimizer::optimize()
 {
-    bool picked[polygons.size()];
-    memset(picked, false, sizeof(bool) * polygons.size());/// initialized as falses
-    
-    for(unsigned int i_polygon=0 ; i_polygon<polygons.size() ; i_polygon++) /// find closest point to initial starting point within each polygon +initialize picked
+    TRACE_ZONE("PathOrderOptimizer::optimize");
+    countStat(Stat_OrderProblems);
+    countStat(Stat_OrderPolygons, polygons.size());
+    Point min_start(POINT_MAX, POINT_MAX); /// bounding box of the starting points
+    Point max_start(POINT_MIN, POINT_MIN);
+
+    for(unsigned int i_polygon=0 ; i_polygon<polygons.size() ; i_polygon++) /// find closest point to initial starting point within each polygon
     {
         int best = -1;
         float bestDist = std::numeric_limits<float>::infinity();
@@ -32,11 +192,27 @@ void PathOrderOptimizer::optimize()
             }
         }
         polyStart.push_back(best);
-        //picked.push_back(false); /// initialize all picked values as false
+        if (best > -1)
+        {
+            min_start = Point(std::min(min_start.X, poly[best].X), std::min(min_start.Y, poly[best].Y));
+            max_start = Point(std::max(max_start.X, poly[best].X), std::max(max_start.Y, poly[best].Y));
+        }
 
         assert(poly.size() != 2);
     }
+    if (min_start.X > max_start.X) /// no polygon has any points
+    {
+        min_start = max_start = startPoint;
+    }
 
+    PointGrid2D<unsigned int> start_grid(min_start, max_start, polygons.size()); /// the starting points of the polygons which are not yet picked
+    for(unsigned int i_polygon=0 ; i_polygon<polygons.size() ; i_polygon++)
+    {
+        if (polygons[i_polygon].size() > 0) /// skip single-point-polygons
+        {
+            start_grid.insert(polygons[i_polygon][polyStart[i_polygon]], i_polygon);
+        }
+    }
 
     Point prev_point = startPoint;
     for(unsigned int i_polygon=0 ; i_polygon<polygons.size() ; i_polygon++) /// actual path order optimizer
@@ -44,23 +220,16 @@ void PathOrderOptimizer::optimize()
         int best = -1;
         float bestDist = std::numeric_limits<float>::infinity();
 
-
-        for(unsigned int i_polygon=0 ; i_polygon<polygons.size() ; i_polygon++)
+        start_grid.findNearestObjects(prev_point, [&](const Point& start, unsigned int i_candidate)
         {
-            if (picked[i_polygon] || polygons[i_polygon].size() < 1) /// skip single-point-polygons
-                continue;
-
-            assert (polygons[i_polygon].size() != 2);
-
-            float dist = vSize2f(polygons[i_polygon][polyStart[i_polygon]] - prev_point);
-            if (dist < bestDist)
+            float dist = vSize2f(start - prev_point);
+            if (dist < bestDist || (dist == bestDist && int(i_candidate) < best)) /// on a tie take the first polygon, like a search over all polygons in order would
             {
-                best = i_polygon;
+                best = i_candidate;
                 bestDist = dist;
             }
-
-        }
-
+            return double(bestDist);
+        });
 
         if (best > -1) /// should always be true; we should have been able to identify the best next polygon
         {
@@ -68,7 +237,7 @@ void PathOrderOptimizer::optimize()
 
             prev_point = polygons[best][polyStart[best]];
 
-            picked[best] = true;
+            start_grid.remove(prev_point, best);
             polyOrder.push_back(best);
         }
         else
@@ -86,6 +255,23 @@ void PathOrderOptimizer::optimize()
     }
 }
 
+int64_t PathOrderOptimizer::refine(double time_budget)
+{
+    std::vector<OrderedPath> paths;
+    for(int i_polygon : polyOrder)
+    {
+        Point start = polygons[i_polygon][polyStart[i_polygon]]; /// a polygon ends where it starts
+        paths.push_back(OrderedPath{i_polygon, start, start});
+    }
+    double old_travel = totalTravel(paths, startPoint);
+    refinePathOrder(paths, startPoint, time_budget, welderOffDistance, welderCycleCost);
+    for(unsigned int n=0; n<paths.size(); n++)
+    {
+        polyOrder[n] = paths[n].idx;
+    }
+    return old_travel - totalTravel(paths, startPoint);
+}
+
 inline int PathOrderOptimizer::getClosestPointInPolygon(Point prev_point, int i_polygon)
 {
     PolygonRef poly = polygons[i_polygon];
@@ -115,12 +301,13 @@ inline int PathOrderOptimizer::getClosestPointInPolygon(Point prev_point, int i_
 */
 void LineOrderOptimizer::optimize()
 {
-    int gridSize = 5000; // the size of the cells in the hash grid.
-    BucketGrid2D<unsigned int> line_bucket_grid(gridSize);
-    bool picked[polygons.size()];
-    memset(picked, false, sizeof(bool) * polygons.size());/// initialized as falses
-    
-    for(unsigned int i_polygon=0 ; i_polygon<polygons.size() ; i_polygon++) /// find closest point to initial starting point within each polygon +initialize picked
+    TRACE_ZONE("LineOrderOptimizer::optimize");
+    countStat(Stat_OrderProblems);
+    countStat(Stat_OrderPolygons, polygons.size());
+    Point min_point(POINT_MAX, POINT_MAX); /// bounding box of the lines
+    Point max_point(POINT_MIN, POINT_MIN);
+
+    for(unsigned int i_polygon=0 ; i_polygon<polygons.size() ; i_polygon++) /// find closest point to initial starting point within each polygon
     {
         int best = -1;
         float bestDist = std::numeric_limits<float>::infinity();
@@ -133,16 +320,27 @@ void LineOrderOptimizer::optimize()
                 best = i_point;
                 bestDist = dist;
             }
+            min_point = Point(std::min(min_point.X, poly[i_point].X), std::min(min_point.Y, poly[i_point].Y));
+            max_point = Point(std::max(max_point.X, poly[i_point].X), std::max(max_point.Y, poly[i_point].Y));
         }
         polyStart.push_back(best);
 
         assert(poly.size() == 2);
-
-        line_bucket_grid.insert(poly[0], i_polygon);
-        line_bucket_grid.insert(poly[1], i_polygon);
-
+    }
+    if (min_point.X > max_point.X) /// no line has any points
+    {
+        min_point = max_point = startPoint;
     }
 
+    PointGrid2D<unsigned int> line_end_grid(min_point, max_point, polygons.size() * 2); /// the end points of the lines which are not yet picked, as 2 * line index + end point index
+    for(unsigned int i_polygon=0 ; i_polygon<polygons.size() ; i_polygon++)
+    {
+        if (polygons[i_polygon].size() > 0) /// skip single-point-polygons
+        {
+            line_end_grid.insert(polygons[i_polygon][0], i_polygon * 2);
+            line_end_grid.insert(polygons[i_polygon][1], i_polygon * 2 + 1);
+        }
+    }
 
     Point incommingPerpundicularNormal(0, 0);
     Point prev_point = startPoint;
@@ -151,28 +349,11 @@ void LineOrderOptimizer::optimize()
         int best = -1;
         float bestDist = std::numeric_limits<float>::infinity();
 
-        for(unsigned int i_close_line_polygon :  line_bucket_grid.findNearbyObjects(prev_point)) /// check if single-line-polygon is close to last point
+        line_end_grid.findNearestObjects(prev_point, [&](const Point&, unsigned int line_end)
         {
-            if (picked[i_close_line_polygon] || polygons[i_close_line_polygon].size() < 1)
-                continue;
-
-
-            checkIfLineIsBest(i_close_line_polygon, best, bestDist, prev_point, incommingPerpundicularNormal);
-
-        }
-
-        if (best == -1) /// if single-line-polygon hasn't been found yet
-        {
-           for(unsigned int i_polygon=0 ; i_polygon<polygons.size() ; i_polygon++)
-            {
-                if (picked[i_polygon] || polygons[i_polygon].size() < 1) /// skip single-point-polygons
-                    continue;
-                assert(polygons[i_polygon].size() == 2);
-
-                checkIfLineIsBest(i_polygon, best, bestDist, prev_point, incommingPerpundicularNormal);
-
-            }
-        }
+            checkIfLineIsBest(line_end / 2, line_end % 2, best, bestDist, prev_point, incommingPerpundicularNormal);
+            return double(bestDist);
+        });
 
         if (best > -1) /// should always be true; we should have been able to identify the best next polygon
         {
@@ -182,7 +363,8 @@ void LineOrderOptimizer::optimize()
             prev_point = polygons[best][endIdx];
             incommingPerpundicularNormal = crossZ(normal(polygons[best][endIdx] - polygons[best][polyStart[best]], 1000));
 
-            picked[best] = true;
+            line_end_grid.remove(polygons[best][0], best * 2);
+            line_end_grid.remove(polygons[best][1], best * 2 + 1);
             polyOrder.push_back(best);
         }
         else
@@ -219,27 +401,35 @@ void LineOrderOptimizer::optimize()
     }
 }
 
-inline void LineOrderOptimizer::checkIfLineIsBest(unsigned int i_line_polygon, int& best, float& bestDist, Point& prev_point, Point& incommingPerpundicularNormal)
+int64_t LineOrderOptimizer::refine(double time_budget)
 {
-    { /// check distance to first point on line (0)
-        float dist = vSize2f(polygons[i_line_polygon][0] - prev_point);
-        dist += abs(dot(incommingPerpundicularNormal, normal(polygons[i_line_polygon][1] - polygons[i_line_polygon][0], 1000))) * 0.0001f; /// penalize sharp corners
-        if (dist < bestDist)
-        {
-            best = i_line_polygon;
-            bestDist = dist;
-            polyStart[i_line_polygon] = 0;
-        }
+    std::vector<OrderedPath> paths;
+    for(int i_polygon : polyOrder)
+    {
+        paths.push_back(OrderedPath{i_polygon, polygons[i_polygon][polyStart[i_polygon]], polygons[i_polygon][1 - polyStart[i_polygon]]});
     }
-    { /// check distance to second point on line (1)
-        float dist = vSize2f(polygons[i_line_polygon][1] - prev_point);
-        dist += abs(dot(incommingPerpundicularNormal, normal(polygons[i_line_polygon][0] - polygons[i_line_polygon][1], 1000) )) * 0.0001f; /// penalize sharp corners
-        if (dist < bestDist)
-        {
-            best = i_line_polygon;
-            bestDist = dist;
-            polyStart[i_line_polygon] = 1;
-        }
+    double old_travel = totalTravel(paths, startPoint);
+    refinePathOrder(paths, startPoint, time_budget, welderOffDistance, welderCycleCost);
+    for(unsigned int n=0; n<paths.size(); n++)
+    {
+        polyOrder[n] = paths[n].idx;
+        polyStart[paths[n].idx] = (paths[n].from == polygons[paths[n].idx][0])? 0 : 1;
+    }
+    return old_travel - totalTravel(paths, startPoint);
+}
+
+inline void LineOrderOptimizer::checkIfLineIsBest(unsigned int i_line_polygon, unsigned int i_point, int& best, float& bestDist, Point& prev_point, Point& incommingPerpundicularNormal)
+{
+    Point start = polygons[i_line_polygon][i_point];
+    Point end = polygons[i_line_polygon][1 - i_point];
+    float dist = vSize2f(start - prev_point);
+    dist += abs(dot(incommingPerpundicularNormal, normal(end - start, 1000))) * 0.0001f; /// penalize sharp corners
+    /// on a tie take the first line and its first point, like a search over all lines in order would
+    if (dist < bestDist || (dist == bestDist && (int(i_line_polygon) < best || (int(i_line_polygon) == best && int(i_point) < polyStart[best]))))
+    {
+        best = i_line_polygon;
+        bestDist = dist;
+        polyStart[i_line_polygon] = i_point;
     }
 }
 
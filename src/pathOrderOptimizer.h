@@ -19,8 +19,12 @@ public:
     std::vector<PolygonRef> polygons; //!< the parts of the layer (in arbitrary order)
     std::vector<int> polyStart; //!< polygons[i][polyStart[i]] = point of polygon i which is to be the starting point in printing the polygon
     std::vector<int> polyOrder; //!< the optimized order as indices in #polygons
+    int64_t welderOffDistance; //!< in metal printing: the travel distance above which the welder is turned off, or zero
+    int64_t welderCycleCost; //!< the travel distance which refine() may add to save one welder off/on cycle
 
     PathOrderOptimizer(Point startPoint)
+    : welderOffDistance(0)
+    , welderCycleCost(0)
     {
         this->startPoint = startPoint;
     }
@@ -38,6 +42,16 @@ public:
 
     void optimize(); //!< sets #polyStart and #polyOrder
 
+    /*!
+     * Shorten the travel between the paths ordered by optimize() with 2-opt and Or-opt moves, until no move helps or
+     * the time is up. Unlike optimize() the result depends on the speed of the machine slicing.
+     * With #welderOffDistance set, travels which turn the welder off and on again cost #welderCycleCost extra.
+     *
+     * \param time_budget The time in seconds after which no more moves are tried
+     * \return The distance of travel saved; negative when travel was added to save welder cycles
+     */
+    int64_t refine(double time_budget);
+
     private:
         int getClosestPointInPolygon(Point prev, int i_polygon); //!< returns the index of the closest point
 
@@ -54,8 +68,12 @@ public:
     std::vector<PolygonRef> polygons; //!< the parts of the layer (in arbitrary order)
     std::vector<int> polyStart; //!< polygons[i][polyStart[i]] = point of polygon i which is to be the starting point in printing the polygon
     std::vector<int> polyOrder; //!< the optimized order as indices in #polygons
+    int64_t welderOffDistance; //!< in metal printing: the travel distance above which the welder is turned off, or zero
+    int64_t welderCycleCost; //!< the travel distance which refine() may add to save one welder off/on cycle
 
     LineOrderOptimizer(Point startPoint)
+    : welderOffDistance(0)
+    , welderCycleCost(0)
     {
         this->startPoint = startPoint;
     }
@@ -73,8 +91,18 @@ public:
 
     void optimize(); //!< sets #polyStart and #polyOrder
 
+    /*!
+     * Shorten the travel between the paths ordered by optimize() with 2-opt and Or-opt moves, until no move helps or
+     * the time is up. Unlike optimize() the result depends on the speed of the machine slicing.
+     * With #welderOffDistance set, travels which turn the welder off and on again cost #welderCycleCost extra.
+     *
+     * \param time_budget The time in seconds after which no more moves are tried
+     * \return The distance of travel saved; negative when travel was added to save welder cycles
+     */
+    int64_t refine(double time_budget);
+
 private:
-    void checkIfLineIsBest(unsigned int i_line_polygon, int& best, float& bestDist, Point& prev_point, Point& incommingPerpundicularNormal);
+    void checkIfLineIsBest(unsigned int i_line_polygon, unsigned int i_point, int& best, float& bestDist, Point& prev_point, Point& incommingPerpundicularNormal); //!< check starting line \p i_line_polygon at its point \p i_point
 
 };
 
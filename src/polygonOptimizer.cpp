@@ -1,6 +1,9 @@
 /** Copyright (C) 2013 David Braam - Released under terms of the AGPLv3 License */
 #include "polygonOptimizer.h"
 
+#include <utility>
+#include <vector>
+
 namespace cura {
 
 void optimizePolygon(PolygonRef poly)
@@ -51,4 +54,111 @@ void optimizePolygons(Polygons& polys)
     }
 }
 
+namespace
+{
+/*!
+ * The square of the distance of \p p to the line segment from \p a to \p b.
+ */
+double segmentDistance2(Point p, Point a, Point b)
+{
+    Point ab = b - a;
+    Point ap = p - a;
+    double length2 = vSize2(ab);
+    double along = dot(ap, ab);
+    if (along <= 0 || length2 == 0)
+    {
+        return vSize2(ap);
+    }
+    if (along >= length2)
+    {
+        return vSize2(p - b);
+    }
+    double across = cross(ab, ap);
+    return across * across / length2;
+}
+}//namespace
+
+unsigned int simplifyPolygon(PolygonRef poly, int64_t max_deviation)
+{
+    unsigned int size = poly.size();
+    if (size < 4 || max_deviation <= 0)
+    {
+        return 0;
+    }
+    // A closed polygon is split into two chains at its first point and the point furthest from it, which both stay.
+    unsigned int far_idx = 0;
+    int64_t far_distance2 = -1;
+    for (unsigned int idx = 1; idx < size; idx++)
+    {
+        int64_t distance2 = vSize2(poly[idx] - poly[0]);
+        if (distance2 > far_distance2)
+        {
+            far_distance2 = distance2;
+            far_idx = idx;
+        }
+    }
+    std::vector<bool> keep(size, false);
+    keep[0] = true;
+    keep[far_idx] = true;
+    double max_deviation2 = double(max_deviation) * max_deviation;
+    std::vector<std::pair<unsigned int, unsigned int>> chains; // index size stands for the first point again
+    chains.emplace_back(0, far_idx);
+    chains.emplace_back(far_idx, size);
+    while (!chains.empty())
+    {
+        unsigned int start = chains.back().first;
+        unsigned int end = chains.back().second;
+        chains.pop_back();
+        Point a = poly[start];
+        Point b = poly[end % size];
+        double worst_distance2 = max_deviation2;
+        unsigned int worst_idx = 0;
+        for (unsigned int idx = start + 1; idx < end; idx++)
+        {
+            double distance2 = segmentDistance2(poly[idx], a, b);
+            if (distance2 > worst_distance2)
+            {
+                worst_distance2 = distance2;
+                worst_idx = idx;
+            }
+        }
+        if (worst_idx > 0)
+        {
+            keep[worst_idx] = true;
+            chains.emplace_back(start, worst_idx);
+            chains.emplace_back(worst_idx, end);
+        }
+    }
+
+    unsigned int kept = 0;
+    for (unsigned int idx = 0; idx < size; idx++)
+    {
+        if (keep[idx])
+        {
+            poly[kept++] = poly[idx];
+        }
+    }
+    while (poly.size() > kept)
+    {
+        poly.remove(poly.size() - 1);
+    }
+    return size - kept;
+}
+
+unsigned int simplifyPolygons(Polygons& polys, int64_t max_deviation)
+{
+    unsigned int removed = 0;
+    for(unsigned int n = 0; n < polys.size(); n++)
+    {
+        removed += simplifyPolygon(polys[n], max_deviation);
+        if (polys[n].size() < 3)
+        {
+            removed += polys[n].size();
+            polys.remove(n);
+            n--;
+        }
+    }
+    return removed;
+}
+
 }//namespace cura
@@ -10,6 +10,21 @@ void optimizePolygon(PolygonRef poly);
 
 void optimizePolygons(Polygons& polys);
 
+/*!
+ * Remove the points of a polygon which the polygon can do without while staying within \p max_deviation of its original
+ * shape, with the Douglas-Peucker algorithm.
+ *
+ * \return The number of points removed
+ */
+unsigned int simplifyPolygon(PolygonRef poly, int64_t max_deviation);
+
+/*!
+ * Simplify each polygon with simplifyPolygon, and remove the polygons which end up with fewer than 3 points.
+ *
+ * \return The number of points removed, including those of the polygons removed
+ */
+unsigned int simplifyPolygons(Polygons& polys, int64_t max_deviation);
+
 }//namespace cura
 
 #endif//POLYGON_OPTIMIZER_H
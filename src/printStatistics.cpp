@@ -0,0 +1,103 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#include "printStatistics.h"
+
+#include <fstream>
+#include <iomanip>
+#include <string.h>
+
+namespace cura {
+
+namespace
+{
+
+void writeJSONString(std::ostream& out, const std::string& str)
+{
+    out << '"';
+    for (char c : str)
+    {
+        if (c == '"' || c == '\\')
+            out << '\\';
+        out << c;
+    }
+    out << '"';
+}
+
+}//anonymous namespace
+
+unsigned int PrintStatistics::getEntryIdx(int layer, const std::string& feature)
+{
+    auto inserted = entry_idx.emplace(std::make_pair(layer, feature), entries.size());
+    if (inserted.second)
+    {
+        entries.push_back(Entry{layer, feature, 0.0, 0.0, 0.0, 0.0});
+    }
+    return inserted.first->second;
+}
+
+void PrintStatistics::clear()
+{
+    entries.clear();
+    entry_idx.clear();
+}
+
+void PrintStatistics::writeJSON(std::ostream& out) const
+{
+    Entry total{no_layer, "", 0.0, 0.0, 0.0, 0.0};
+    for (const Entry& entry : entries)
+    {
+        total.time += entry.time;
+        total.travel_distance += entry.travel_distance;
+        total.extrusion_volume += entry.extrusion_volume;
+        total.welding_time += entry.welding_time;
+    }
+    out << std::fixed << std::setprecision(3);
+    out << "{\n";
+    out << "  \"time\": " << total.time << ",\n";
+    out << "  \"travel_distance\": " << total.travel_distance << ",\n";
+    out << "  \"extrusion_volume\": " << total.extrusion_volume << ",\n";
+    out << "  \"welding_time\": " << total.welding_time << ",\n";
+    out << "  \"entries\": [";
+    for (unsigned int n = 0; n < entries.size(); n++)
+    {
+        const Entry& entry = entries[n];
+        out << ((n > 0)? ",\n" : "\n") << "    {\"layer\": ";
+        if (entry.layer == no_layer)
+            out << "null";
+        else
+            out << entry.layer;
+        out << ", \"feature\": ";
+        writeJSONString(out, entry.feature);
+        out << ", \"time\": " << entry.time;
+        out << ", \"travel_distance\": " << entry.travel_distance;
+        out << ", \"extrusion_volume\": " << entry.extrusion_volume;
+        out << ", \"welding_time\": " << entry.welding_time << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+void PrintStatistics::writeCSV(std::ostream& out) const
+{
+    out << std::fixed << std::setprecision(3);
+    out << "layer,feature,time,travel_distance,extrusion_volume,welding_time\n";
+    for (const Entry& entry : entries)
+    {
+        if (entry.layer != no_layer)
+            out << entry.layer;
+        out << "," << entry.feature << "," << entry.time << "," << entry.travel_distance << "," << entry.extrusion_volume << "," << entry.welding_time << "\n";
+    }
+}
+
+bool PrintStatistics::writeFile(const char* filename) const
+{
+    std::ofstream out(filename);
+    if (!out.is_open())
+        return false;
+    size_t length = strlen(filename);
+    if (length >= 5 && strcmp(filename + length - 5, ".json") == 0)
+        writeJSON(out);
+    else
+        writeCSV(out);
+    return out.good();
+}
+
+}//namespace cura
@@ -0,0 +1,76 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#ifndef PRINT_STATISTICS_H
+#define PRINT_STATISTICS_H
+
+#include <climits>
+#include <map>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace cura {
+
+/*!
+ * Where the machine time and the material of a print go: the print time, travel distance, extrusion volume and arc-on
+ * time of each feature (the path config names of the ;TYPE: comments, like WALL-OUTER and FILL) on each layer.
+ *
+ * GCodeExport fills these in while it writes the GCode, see GCodeExport::setStatistics. The times are those of the
+ * print time estimate, so the times of all entries add up to GCodeExport::getTotalPrintTime.
+ */
+class PrintStatistics
+{
+public:
+    static const int no_layer = INT_MIN; //!< The layer of what is printed before the first layer, like the start GCode
+
+    struct Entry
+    {
+        int layer; //!< The layer number of the ;LAYER: comments, or no_layer
+        std::string feature; //!< The name of the feature
+        double time; //!< The print time, in s
+        double travel_distance; //!< The distance moved without extruding, in mm
+        double extrusion_volume; //!< The volume extruded, in mm^3
+        double welding_time; //!< The part of the print time during which the welder is on, in s
+    };
+
+    /*!
+     * Get the entry of a feature on a layer, adding it when there is none yet.
+     *
+     * \return The index of the entry
+     */
+    unsigned int getEntryIdx(int layer, const std::string& feature);
+
+    Entry& operator[](unsigned int idx) { return entries[idx]; }
+
+    /*!
+     * The entries, in the order in which their features were first printed.
+     */
+    const std::vector<Entry>& getEntries() const { return entries; }
+
+    void clear();
+
+    /*!
+     * Write the entries as a JSON object with the totals of the print and an array of the entries.
+     */
+    void writeJSON(std::ostream& out) const;
+
+    /*!
+     * Write the entries as CSV with a header line, one line per entry.
+     */
+    void writeCSV(std::ostream& out) const;
+
+    /*!
+     * Write the entries to a file, as JSON when its name ends in .json and as CSV otherwise.
+     *
+     * \return Whether the file could be written
+     */
+    bool writeFile(const char* filename) const;
+
+private:
+    std::vector<Entry> entries;
+    std::map<std::pair<int, std::string>, unsigned int> entry_idx; //!< The index in entries of each layer and feature
+};
+
+}//namespace cura
+
+#endif//PRINT_STATISTICS_H
@@ -6,19 +6,23 @@ namespace cura {
 
 void generateRaft(SliceDataStorage& storage, int distance)
 {
+    // everything on the first layer, offset at once
+    Polygons first_layer;
     for(SliceMeshStorage& mesh : storage.meshes)
     {
         if (mesh.layers.size() < 1) continue;
         SliceLayer* layer = &mesh.layers[0];
         for(SliceLayerPart& part : layer->parts)
-            storage.raftOutline = storage.raftOutline.unionPolygons(part.outline.offset(distance));
+            first_layer.add(part.outline);
     }
 
-    Polygons support;
     if (storage.support.generated) 
-        support = storage.support.supportAreasPerLayer[0];
-    storage.raftOutline = storage.raftOutline.unionPolygons(support.offset(distance));
-    storage.raftOutline = storage.raftOutline.unionPolygons(storage.wipeTower.offset(distance));
+        first_layer.add(storage.support.supportAreasPerLayer[0]);
+    first_layer.add(storage.wipeTower);
+
+    Polygons raft_outlines = storage.raftOutline;
+    raft_outlines.add(first_layer.unionPolygons().offset(distance));
+    storage.raftOutline = raft_outlines.unionPolygons();
 }
 
 }//namespace cura
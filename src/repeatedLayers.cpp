@@ -0,0 +1,284 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#include "repeatedLayers.h"
+
+#include <functional>
+#include <unordered_map>
+
+#include "utils/polygonUtils.h"
+
+namespace cura {
+
+namespace
+{
+
+/*!
+ * Hash of the outlines of all parts of a layer, for grouping the layers which may be the same.
+ */
+uint64_t hashLayerOutlines(const SliceLayer& layer)
+{
+    uint64_t hash = 14695981039346656037ull; // FNV-1a
+    auto mix = [&hash](int64_t value)
+    {
+        hash ^= static_cast<uint64_t>(value);
+        hash *= 1099511628211ull;
+    };
+    mix(layer.parts.size());
+    for (const SliceLayerPart& part : layer.parts)
+    {
+        mix(part.outline.size());
+        for (const ClipperLib::Path& poly : part.outline)
+        {
+            mix(poly.size());
+            for (const Point& p : poly)
+            {
+                mix(p.X);
+                mix(p.Y);
+            }
+        }
+    }
+    return hash;
+}
+
+/*!
+ * Whether two layers consist of exactly the same parts, including everything already generated for them.
+ */
+bool haveSameParts(const SliceLayer& a, const SliceLayer& b)
+{
+    if (a.parts.size() != b.parts.size())
+    {
+        return false;
+    }
+    for (unsigned int part_idx = 0; part_idx < a.parts.size(); part_idx++)
+    {
+        const SliceLayerPart& part_a = a.parts[part_idx];
+        const SliceLayerPart& part_b = b.parts[part_idx];
+        if (!(part_a.outline == part_b.outline) || !(part_a.perimeterGaps == part_b.perimeterGaps) || part_a.insets.size() != part_b.insets.size())
+        {
+            return false;
+        }
+        for (unsigned int inset_idx = 0; inset_idx < part_a.insets.size(); inset_idx++)
+        {
+            if (!(part_a.insets[inset_idx] == part_b.insets[inset_idx]))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/*!
+ * For each layer find the first earlier layer with the same results.
+ *
+ * \param layer_count The number of layers
+ * \param getKey Hash of everything the results of a layer depend on; layers with different keys never have the same results
+ * \param haveSameResults Whether a layer (first argument) has the same results as a later layer (second argument) with the same key
+ * \return For each layer the index of the first layer with the same results, or the layer itself
+ */
+std::vector<unsigned int> findRepeatedLayers(unsigned int layer_count, std::function<uint64_t (unsigned int)> getKey, std::function<bool (unsigned int, unsigned int)> haveSameResults)
+{
+    std::vector<unsigned int> sources(layer_count);
+    std::unordered_map<uint64_t, std::vector<unsigned int>> first_layers; // for each key: the first layer of each different result with that key
+    for (unsigned int layer_nr = 0; layer_nr < layer_count; layer_nr++)
+    {
+        std::vector<unsigned int>& candidates = first_layers[getKey(layer_nr)];
+        sources[layer_nr] = layer_nr;
+        for (unsigned int candidate : candidates)
+        {
+            if (haveSameResults(candidate, layer_nr))
+            {
+                sources[layer_nr] = candidate;
+                break;
+            }
+        }
+        if (sources[layer_nr] == layer_nr)
+        {
+            candidates.push_back(layer_nr);
+        }
+    }
+    return sources;
+}
+
+}//anonymous namespace
+
+std::vector<unsigned int> findRepeatedInsetLayers(const SliceMeshStorage& mesh, const std::vector<int>& inset_counts)
+{
+    const std::vector<SliceLayer>& layers = mesh.layers;
+    std::vector<uint64_t> hashes;
+    hashes.reserve(layers.size());
+    for (const SliceLayer& layer : layers)
+    {
+        hashes.push_back(hashLayerOutlines(layer));
+    }
+    return findRepeatedLayers(layers.size(),
+        [&](unsigned int layer_nr)
+        {
+            return hashes[layer_nr] * 31 + inset_counts[layer_nr];
+        },
+        [&](unsigned int earlier, unsigned int later)
+        {
+            return inset_counts[earlier] == inset_counts[later] && haveSameParts(layers[earlier], layers[later]);
+        });
+}
+
+std::vector<unsigned int> findRepeatedSkinLayers(const SliceMeshStorage& mesh, const std::vector<int>& inset_counts, int downSkinCount, int upSkinCount)
+{
+    const std::vector<SliceLayer>& layers = mesh.layers;
+    const int layer_count = layers.size();
+    std::vector<uint64_t> hashes;
+    hashes.reserve(layers.size());
+    for (const SliceLayer& layer : layers)
+    {
+        hashes.push_back(hashLayerOutlines(layer));
+    }
+    // the layers which make up the skin of a layer, or -1 where generateSkinAreas doesn't look
+    auto getLayerBelow = [&](int layer_nr) { return (layer_nr - downSkinCount >= 0)? layer_nr - downSkinCount : -1; };
+    auto getLayerAbove = [&](int layer_nr) { return (layer_nr + upSkinCount < layer_count)? layer_nr + upSkinCount : -1; };
+    auto haveSameLayers = [&](int a, int b)
+    {
+        if (a < 0 || b < 0)
+        {
+            return a == b;
+        }
+        return hashes[a] == hashes[b] && inset_counts[a] == inset_counts[b] && haveSameParts(layers[a], layers[b]);
+    };
+    return findRepeatedLayers(layers.size(),
+        [&](unsigned int layer_nr)
+        {
+            int below = getLayerBelow(layer_nr);
+            int above = getLayerAbove(layer_nr);
+            return ((hashes[layer_nr] * 31 + ((below < 0)? 0 : hashes[below])) * 31 + ((above < 0)? 0 : hashes[above])) * 31 + inset_counts[layer_nr];
+        },
+        [&](unsigned int earlier, unsigned int later)
+        {
+            return haveSameLayers(earlier, later)
+                && haveSameLayers(getLayerBelow(earlier), getLayerBelow(later))
+                && haveSameLayers(getLayerAbove(earlier), getLayerAbove(later));
+        });
+}
+
+std::vector<unsigned int> findRepeatedSupportLayers(const std::vector<Polygons>& support_areas, const std::vector<int>& variants)
+{
+    std::vector<uint64_t> hashes;
+    hashes.reserve(support_areas.size());
+    for (const Polygons& areas : support_areas)
+    {
+        hashes.push_back(hashPolygons(areas));
+    }
+    return findRepeatedLayers(support_areas.size(),
+        [&](unsigned int layer_nr)
+        {
+            return hashes[layer_nr] * 31 + variants[layer_nr];
+        },
+        [&](unsigned int earlier, unsigned int later)
+        {
+            return variants[earlier] == variants[later] && support_areas[earlier] == support_areas[later];
+        });
+}
+
+void copySkins(const std::vector<SliceLayerPart>& from, std::vector<SliceLayerPart>& to)
+{
+    for (unsigned int part_idx = 0; part_idx < to.size(); part_idx++)
+    {
+        to[part_idx].skin_parts = from[part_idx].skin_parts;
+        to[part_idx].sparse_outline = from[part_idx].sparse_outline;
+        to[part_idx].perimeterGaps = from[part_idx].perimeterGaps;
+    }
+}
+
+uint64_t hashLayerToolpaths(const SliceDataStorage& storage, unsigned int layer_nr, int64_t variant)
+{
+    uint64_t hash = 14695981039346656037ull; // FNV-1a
+    auto mix = [&hash](int64_t value)
+    {
+        hash ^= static_cast<uint64_t>(value);
+        hash *= 1099511628211ull;
+    };
+    auto mixAll = [&mix](const std::vector<Polygons>& polygons)
+    {
+        mix(polygons.size());
+        for (const Polygons& polys : polygons)
+        {
+            mix(hashPolygons(polys));
+        }
+    };
+    mix(variant);
+    for (const SliceMeshStorage& mesh : storage.meshes)
+    {
+        const SliceLayer& layer = mesh.layers[layer_nr];
+        mix(layer.parts.size());
+        for (const SliceLayerPart& part : layer.parts)
+        {
+            mixAll(part.insets);
+            mix(hashPolygons(part.combBoundery));
+            if (!part.toolpaths)
+            {
+                mix(-1);
+                continue;
+            }
+            const PartToolpaths& toolpaths = *part.toolpaths;
+            mixAll(toolpaths.infill_lines);
+            mixAll(toolpaths.infill_polygons);
+            mixAll(toolpaths.skin_perimeters);
+            mix(hashPolygons(toolpaths.skin_polygons));
+            mix(hashPolygons(toolpaths.skin_lines));
+        }
+        mix(hashPolygons(layer.openLines));
+    }
+    if (storage.support.generated && layer_nr < storage.support.toolpathsPerLayer.size() && storage.support.toolpathsPerLayer[layer_nr])
+    {
+        mixAll(storage.support.toolpathsPerLayer[layer_nr]->islands);
+        mixAll(storage.support.toolpathsPerLayer[layer_nr]->lines);
+    }
+    if (layer_nr < storage.oozeShield.size())
+    {
+        mix(hashPolygons(storage.oozeShield[layer_nr]));
+    }
+    return hash;
+}
+
+RepeatedLayerResults::RepeatedLayerResults(const std::vector<std::vector<unsigned int>>& sources)
+: sources(sources)
+{
+    for (const std::vector<unsigned int>& mesh_sources : sources)
+    {
+        n_repeats.emplace_back(mesh_sources.size(), 0);
+        kept.emplace_back(mesh_sources.size());
+        for (unsigned int layer_nr = 0; layer_nr < mesh_sources.size(); layer_nr++)
+        {
+            if (mesh_sources[layer_nr] != layer_nr)
+            {
+                n_repeats.back()[mesh_sources[layer_nr]]++;
+            }
+        }
+    }
+}
+
+void RepeatedLayerResults::keep(unsigned int mesh_idx, unsigned int layer_nr, const std::vector<SliceLayerPart>& parts)
+{
+    if (n_repeats[mesh_idx][layer_nr] == 0)
+    {
+        return;
+    }
+    std::shared_ptr<const std::vector<SliceLayerPart>> copy = std::make_shared<const std::vector<SliceLayerPart>>(parts);
+    std::lock_guard<std::mutex> lock(mutex);
+    kept[mesh_idx][layer_nr] = copy;
+}
+
+std::shared_ptr<const std::vector<SliceLayerPart>> RepeatedLayerResults::take(unsigned int mesh_idx, unsigned int layer_nr)
+{
+    unsigned int source = sources[mesh_idx][layer_nr];
+    if (source == layer_nr)
+    {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    std::shared_ptr<const std::vector<SliceLayerPart>> parts = kept[mesh_idx][source];
+    if (--n_repeats[mesh_idx][source] == 0)
+    {
+        kept[mesh_idx][source].reset();
+    }
+    return parts;
+}
+
+}//namespace cura
@@ -0,0 +1,111 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#ifndef REPEATED_LAYERS_H
+#define REPEATED_LAYERS_H
+
+#include <memory>
+#include <mutex>
+
+#include "sliceDataStorage.h"
+
+/* This file contains code to find layers which would give the same results as an earlier layer, so these results can be copied instead of recomputed. */
+namespace cura {
+
+/*!
+ * Find the layers of which the insets are the same as those of an earlier layer.
+ *
+ * The insets of a layer only depend on the outlines of its parts and on the number of insets,
+ * so layers with exactly the same outlines and inset count get the same insets.
+ *
+ * \param mesh The mesh of which the insets are yet to be generated
+ * \param inset_counts For each layer the number of insets to generate
+ * \return For each layer the index of the first layer with the same insets; the layer itself if there is none before it
+ */
+std::vector<unsigned int> findRepeatedInsetLayers(const SliceMeshStorage& mesh, const std::vector<int>& inset_counts);
+
+/*!
+ * Find the layers of which the skin, sparse infill and perimeter gaps are the same as those of an earlier layer.
+ *
+ * These only depend on the insets of a layer and of the layers \p downSkinCount below and \p upSkinCount above it,
+ * so two layers get the same results when all of those have exactly the same outlines and inset counts. That way the
+ * layers can be found before the insets are generated.
+ *
+ * \param mesh The mesh of which the skins are yet to be generated
+ * \param inset_counts For each layer the number of insets to generate
+ * \param downSkinCount The number of layers below a layer which are considered for its down skin
+ * \param upSkinCount The number of layers above a layer which are considered for its up skin
+ * \return For each layer the index of the first layer with the same results; the layer itself if there is none before it
+ */
+std::vector<unsigned int> findRepeatedSkinLayers(const SliceMeshStorage& mesh, const std::vector<int>& inset_counts, int downSkinCount, int upSkinCount);
+
+/*!
+ * Find the layers of which the support is filled the same as that of an earlier layer.
+ *
+ * The support lines of a layer only depend on its support areas and on the layer number through a few cases, like the
+ * alternating direction of the lines, so layers with exactly the same areas in the same case get the same lines.
+ *
+ * \param support_areas For each layer the support areas
+ * \param variants For each layer everything besides the areas which the support lines depend on
+ * \return For each layer the index of the first layer with the same support lines; the layer itself if there is none before it
+ */
+std::vector<unsigned int> findRepeatedSupportLayers(const std::vector<Polygons>& support_areas, const std::vector<int>& variants);
+
+/*!
+ * Copy the skins, sparse infill areas and perimeter gaps of the parts of a layer to the same parts of another layer.
+ * The other fields of the parts are left alone, so the layers around it can read them meanwhile.
+ *
+ * \param from The parts to copy from
+ * \param to The parts to copy to, with the same outlines as \p from
+ */
+void copySkins(const std::vector<SliceLayerPart>& from, std::vector<SliceLayerPart>& to);
+
+/*!
+ * Hash of everything planning a layer reads once its toolpaths are generated: the insets, comb boundaries and toolpaths
+ * of the parts of all meshes, the open lines, the support paths and the ooze shield. Layers with the same hash and the
+ * same \p variant are planned into the same moves, when planned from the same position.
+ *
+ * \param storage The model, of which the toolpaths of the layer are generated
+ * \param layer_nr The layer
+ * \param variant Everything besides these which planning the layer depends on
+ * \return The hash
+ */
+uint64_t hashLayerToolpaths(const SliceDataStorage& storage, unsigned int layer_nr, int64_t variant);
+
+/*!
+ * Keeps the parts of the layers which later layers repeat, from when their results are generated until the last layer
+ * repeating them has its copy. The layers which are copied from may then be processed further, or even freed, while
+ * the layers repeating them are still to get their copy.
+ *
+ * Different layers may be kept and taken from different threads at once, as long as a layer is kept before the layers
+ * repeating it take it.
+ */
+class RepeatedLayerResults
+{
+public:
+    /*!
+     * \param sources Per mesh, for each layer the layer of which it repeats the results; the layer itself when it
+     * doesn't, see findRepeatedInsetLayers and findRepeatedSkinLayers
+     */
+    RepeatedLayerResults(const std::vector<std::vector<unsigned int>>& sources);
+
+    /*!
+     * Keep a copy of the parts of a layer, when any layer repeats it.
+     */
+    void keep(unsigned int mesh_idx, unsigned int layer_nr, const std::vector<SliceLayerPart>& parts);
+
+    /*!
+     * Take the kept parts of the layer which a layer repeats. They are released once all layers repeating it took them.
+     *
+     * \return The kept parts; null when the layer doesn't repeat another layer
+     */
+    std::shared_ptr<const std::vector<SliceLayerPart>> take(unsigned int mesh_idx, unsigned int layer_nr);
+
+private:
+    const std::vector<std::vector<unsigned int>>& sources;
+    std::vector<std::vector<unsigned int>> n_repeats; //!< Per mesh, for each layer the number of layers yet to take it
+    std::vector<std::vector<std::shared_ptr<const std::vector<SliceLayerPart>>>> kept; //!< Per mesh, for each layer its kept parts
+    std::mutex mutex;
+};
+
+}//namespace cura
+
+#endif//REPEATED_LAYERS_H
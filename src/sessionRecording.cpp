@@ -0,0 +1,129 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#include "sessionRecording.h"
+
+#include <chrono>
+#include <cstring>
+
+#include "utils/logoutput.h"
+
+namespace cura {
+
+namespace
+{
+/*
+Layout of a session recording:
+    the magic bytes "CURASES" followed by the version of the format, "1"
+    for each message: the 8 byte time it arrived, the 4 byte type id and the 4 byte size of its data, little endian,
+        followed by its data
+*/
+const char session_magic[] = "CURASES1";
+const unsigned int session_magic_size = 8;
+const unsigned int message_header_size = sizeof(uint64_t) + 2 * sizeof(uint32_t);
+
+void writeUInt(unsigned char* out, uint64_t value, unsigned int size)
+{
+    for (unsigned int byte_idx = 0; byte_idx < size; byte_idx++)
+    {
+        out[byte_idx] = value >> (8 * byte_idx);
+    }
+}
+
+uint64_t readUInt(const unsigned char* data, unsigned int size)
+{
+    uint64_t value = 0;
+    for (unsigned int byte_idx = 0; byte_idx < size; byte_idx++)
+    {
+        value |= uint64_t(data[byte_idx]) << (8 * byte_idx);
+    }
+    return value;
+}
+
+uint64_t getMicroseconds()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}//anonymous namespace
+
+SessionRecorder::SessionRecorder()
+: file(nullptr)
+, start_time(0)
+{
+}
+
+SessionRecorder::~SessionRecorder()
+{
+    if (file)
+    {
+        fclose(file);
+    }
+}
+
+bool SessionRecorder::open(const std::string& filename)
+{
+    file = fopen(filename.c_str(), "wb");
+    if (!file)
+    {
+        return false;
+    }
+    start_time = getMicroseconds();
+    if (fwrite(session_magic, 1, session_magic_size, file) != session_magic_size)
+    {
+        fclose(file);
+        file = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void SessionRecorder::record(uint32_t type_id, const std::string& data)
+{
+    if (!file)
+    {
+        return;
+    }
+    unsigned char header[message_header_size];
+    writeUInt(header, getMicroseconds() - start_time, sizeof(uint64_t));
+    writeUInt(header + sizeof(uint64_t), type_id, sizeof(uint32_t));
+    writeUInt(header + sizeof(uint64_t) + sizeof(uint32_t), data.size(), sizeof(uint32_t));
+    if (fwrite(header, 1, message_header_size, file) != message_header_size
+        || fwrite(data.data(), 1, data.size(), file) != data.size()
+        || fflush(file) != 0)
+    {
+        logError("Failed to record the session; stopped recording\n");
+        fclose(file);
+        file = nullptr;
+    }
+}
+
+bool readSessionRecording(const std::string& filename, std::vector<RecordedMessage>& messages)
+{
+    FILE* f = fopen(filename.c_str(), "rb");
+    if (!f)
+    {
+        return false;
+    }
+    char magic[session_magic_size];
+    if (fread(magic, 1, session_magic_size, f) != session_magic_size || memcmp(magic, session_magic, session_magic_size) != 0)
+    {
+        fclose(f);
+        return false;
+    }
+    unsigned char header[message_header_size];
+    while (fread(header, 1, message_header_size, f) == message_header_size)
+    {
+        RecordedMessage message;
+        message.time = readUInt(header, sizeof(uint64_t));
+        message.type_id = readUInt(header + sizeof(uint64_t), sizeof(uint32_t));
+        message.data.resize(readUInt(header + sizeof(uint64_t) + sizeof(uint32_t), sizeof(uint32_t)));
+        if (fread(&message.data[0], 1, message.data.size(), f) != message.data.size())
+        {
+            break; // cut short
+        }
+        messages.push_back(std::move(message));
+    }
+    fclose(f);
+    return true;
+}
+
+}//namespace cura
@@ -0,0 +1,67 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#ifndef SESSION_RECORDING_H
+#define SESSION_RECORDING_H
+
+#include <stdio.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+A session recording holds the messages the front-end sent over a --connect session, with when each of them arrived, so
+that the session can be replayed without the front-end by CommandSocket::replay: to reproduce how the engine behaved on
+exactly that sequence of settings and objects, and to measure how long the front-end waits for each job.
+*/
+
+namespace cura {
+
+/*!
+ * A message of a recorded session.
+ */
+struct RecordedMessage
+{
+    uint64_t time; //!< When the message arrived, in microseconds since the session started
+    uint32_t type_id; //!< The Arcus type id of the message
+    std::string data; //!< The serialized message
+};
+
+/*!
+ * Writes the messages of a session to a file as they arrive.
+ */
+class SessionRecorder
+{
+public:
+    SessionRecorder();
+    ~SessionRecorder();
+
+    /*!
+     * Create the recording file; the session starts now.
+     *
+     * \return Whether the file could be created
+     */
+    bool open(const std::string& filename);
+
+    /*!
+     * Add a message which arrived just now. The file is flushed after each message, so that the session up to a crash
+     * is kept.
+     */
+    void record(uint32_t type_id, const std::string& data);
+
+private:
+    FILE* file;
+    uint64_t start_time; //!< When the session started, in microseconds of the steady clock
+};
+
+/*!
+ * Read the messages of a session recording.
+ *
+ * \param filename The recording
+ * \param messages Where to store the messages, in the order they arrived
+ * \return Whether the file is a session recording and could be read; a recording cut short is read up to its last
+ * complete message
+ */
+bool readSessionRecording(const std::string& filename, std::vector<RecordedMessage>& messages);
+
+}//namespace cura
+
+#endif//SESSION_RECORDING_H
@@ -1,6 +1,10 @@
 #include "settingRegistry.h"
 
+#include <iterator>
 #include <sstream>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/stat.h>
 #include "utils/logoutput.h"
 
 #include "rapidjson/rapidjson.h"
@@ -10,6 +14,149 @@
 
 SettingRegistry SettingRegistry::instance; // define settingRegistry
 
+/*
+A compiled registry holds the categories and settings of a JSON file in a simple binary form, so that starting the engine
+doesn't require parsing the JSON file. It's stored next to the JSON file and is only used while the size and modification
+time of the JSON file match the ones recorded in it; otherwise the JSON file is parsed and the compiled registry written again.
+
+Format: the magic "CURAREG1", the size and modification time of the JSON file, then the categories, each with their settings
+trees in pre-order. Numbers are stored as varints, strings as their length followed by their bytes.
+*/
+
+namespace
+{
+
+const char compiled_registry_magic[] = "CURAREG1";
+const unsigned int compiled_registry_magic_size = 8;
+
+std::string compiledRegistryFileName(const std::string& json_filename)
+{
+    return json_filename + ".cache";
+}
+
+//! Get the size and modification time of a file, which identify the version of the JSON file a compiled registry was made from.
+bool getFileStamp(const std::string& filename, uint64_t& size, uint64_t& modification_time)
+{
+    struct stat file_stat;
+    if (stat(filename.c_str(), &file_stat) != 0)
+    {
+        return false;
+    }
+    size = file_stat.st_size;
+    modification_time = file_stat.st_mtime;
+    return true;
+}
+
+class CompiledRegistryWriter
+{
+public:
+    std::string data;
+
+    void writeVarInt(uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            data.push_back(static_cast<char>((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        data.push_back(static_cast<char>(value));
+    }
+
+    void writeString(const std::string& value)
+    {
+        writeVarInt(value.size());
+        data += value;
+    }
+
+    void writeSetting(SettingConfig& config)
+    {
+        writeString(config.getKey());
+        writeString(config.getLabel());
+        writeString(config.getType());
+        writeString(config.getDefaultValue());
+        writeString(config.getUnit());
+        writeVarInt(config.getStages());
+        writeVarInt(config.getChildren().size());
+        for (SettingConfig& child : config.getChildren())
+        {
+            writeSetting(child);
+        }
+    }
+};
+
+class CompiledRegistryReader
+{
+public:
+    const std::string& data;
+    size_t pos;
+    bool failed;
+
+    CompiledRegistryReader(const std::string& data, size_t pos)
+    : data(data), pos(pos), failed(false)
+    {
+    }
+
+    uint64_t readVarInt()
+    {
+        uint64_t value = 0;
+        for (unsigned int shift = 0; shift < 64; shift += 7)
+        {
+            if (pos >= data.size())
+            {
+                break;
+            }
+            unsigned char byte = data[pos++];
+            value |= uint64_t(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+            {
+                return value;
+            }
+        }
+        failed = true;
+        return 0;
+    }
+
+    //! Read a count of items which each take at least one byte, so that a corrupt count can be rejected right away.
+    uint64_t readCount()
+    {
+        uint64_t count = readVarInt();
+        if (count > data.size() - pos)
+        {
+            failed = true;
+            return 0;
+        }
+        return count;
+    }
+
+    std::string readString()
+    {
+        uint64_t size = readCount();
+        std::string value = data.substr(pos, size);
+        pos += size;
+        return value;
+    }
+
+    //! Read the children of a setting or category; \p Parent is SettingCategory or SettingConfig.
+    template<typename Parent>
+    void readChildren(Parent* parent)
+    {
+        uint64_t child_count = readCount();
+        for (uint64_t child_idx = 0; child_idx < child_count && !failed; child_idx++)
+        {
+            std::string key = readString();
+            std::string label = readString();
+            SettingConfig* config = parent->addChild(key, label);
+            config->setType(readString());
+            config->setDefault(readString());
+            config->setUnit(readString());
+            config->setStages(readVarInt());
+            readChildren(config);
+        }
+    }
+};
+
+}//anonymous namespace
+
 bool SettingRegistry::settingExists(std::string key) const
 {
     return settings.find(key) != settings.end();
@@ -22,6 +169,42 @@ const SettingConfig* SettingRegistry::getSettingConfig(std::string key)
     return settings[key];
 }
 
+unsigned int SettingRegistry::getSettingStages(std::string key) const
+{
+    auto it = settings.find(key);
+    if (it == settings.end())
+        return ALL_PIPELINE_STAGES;
+    return it->second->getStages();
+}
+
+unsigned int SettingRegistry::getSettingId(const std::string& key)
+{
+    auto it = setting_ids.find(key);
+    if (it != setting_ids.end())
+        return it->second;
+    unsigned int id = setting_keys.size();
+    setting_ids[key] = id;
+    setting_keys.push_back(key);
+    return id;
+}
+
+bool SettingRegistry::findSettingId(const std::string& key, unsigned int& id) const
+{
+    auto it = setting_ids.find(key);
+    if (it == setting_ids.end())
+        return false;
+    id = it->second;
+    return true;
+}
+
+void SettingRegistry::assignSettingIds()
+{
+    for (auto& setting : settings)
+    {
+        getSettingId(setting.first);
+    }
+}
+
 SettingRegistry::SettingRegistry()
 {
 }
@@ -31,8 +214,133 @@ bool SettingRegistry::settingsLoaded()
     return settings.size() > 0;
 }
 
+void SettingRegistry::_registerSetting(SettingConfig* config)
+{
+    if (settingExists(config->getKey()))
+    {
+        cura::logError("Duplicate definition of setting: %s\n", config->getKey().c_str());
+    }
+    settings[config->getKey()] = config;
+}
+
+void SettingRegistry::_registerSettingTree(SettingConfig& config)
+{
+    _registerSetting(&config);
+    for (SettingConfig& child : config.getChildren())
+    {
+        _registerSettingTree(child);
+    }
+}
+
+bool SettingRegistry::_loadCompiledRegistry(std::string json_filename)
+{
+    uint64_t json_size, json_modification_time;
+    if (!getFileStamp(json_filename, json_size, json_modification_time))
+    {
+        return false;
+    }
+    std::string data;
+    {
+        FILE* f = fopen(compiledRegistryFileName(json_filename).c_str(), "rb");
+        if (!f)
+        {
+            return false;
+        }
+        char read_buffer[4096];
+        size_t read_size;
+        while ((read_size = fread(read_buffer, 1, sizeof(read_buffer), f)) > 0)
+        {
+            data.append(read_buffer, read_size);
+        }
+        fclose(f);
+    }
+    if (data.compare(0, compiled_registry_magic_size, compiled_registry_magic) != 0)
+    {
+        return false;
+    }
+    CompiledRegistryReader reader(data, compiled_registry_magic_size);
+    if (reader.readVarInt() != json_size || reader.readVarInt() != json_modification_time || reader.failed)
+    {
+        return false; // The JSON file changed since the registry was compiled.
+    }
+
+    // Read everything before registering anything, so that a corrupt file leaves the registry untouched.
+    std::list<SettingCategory> loaded_categories;
+    uint64_t category_count = reader.readCount();
+    for (uint64_t category_idx = 0; category_idx < category_count && !reader.failed; category_idx++)
+    {
+        std::string key = reader.readString();
+        std::string label = reader.readString();
+        loaded_categories.emplace_back(key, label);
+        reader.readChildren(&loaded_categories.back());
+    }
+    if (reader.failed || reader.pos != data.size())
+    {
+        cura::logError("Ignoring corrupt compiled setting registry %s\n", compiledRegistryFileName(json_filename).c_str());
+        return false;
+    }
+
+    categories.splice(categories.end(), loaded_categories);
+    for (std::list<SettingCategory>::iterator category = std::prev(categories.end(), category_count); category != categories.end(); ++category)
+    {
+        for (SettingConfig& config : category->getChildren())
+        {
+            _registerSettingTree(config);
+        }
+    }
+    return true;
+}
+
+void SettingRegistry::_saveCompiledRegistry(std::string json_filename, std::list<SettingCategory>::iterator first_category)
+{
+    uint64_t json_size, json_modification_time;
+    if (!getFileStamp(json_filename, json_size, json_modification_time))
+    {
+        return;
+    }
+    CompiledRegistryWriter writer;
+    writer.data.assign(compiled_registry_magic, compiled_registry_magic_size);
+    writer.writeVarInt(json_size);
+    writer.writeVarInt(json_modification_time);
+    writer.writeVarInt(std::distance(first_category, categories.end()));
+    for (std::list<SettingCategory>::iterator category = first_category; category != categories.end(); ++category)
+    {
+        writer.writeString(category->getKey());
+        writer.writeString(category->getLabel());
+        writer.writeVarInt(category->getChildren().size());
+        for (SettingConfig& config : category->getChildren())
+        {
+            writer.writeSetting(config);
+        }
+    }
+
+    // Write to a temporary file first, so that a concurrently starting engine never reads a truncated file.
+    // The directory of the JSON file may well be read-only; then the JSON file is simply parsed every time.
+    std::string filename = compiledRegistryFileName(json_filename);
+    std::string temp_filename = filename + ".tmp";
+    FILE* f = fopen(temp_filename.c_str(), "wb");
+    if (!f)
+    {
+        cura::log("Cannot write compiled setting registry %s\n", filename.c_str());
+        return;
+    }
+    bool written = fwrite(writer.data.data(), 1, writer.data.size(), f) == writer.data.size();
+    written = (fclose(f) == 0) && written;
+    remove(filename.c_str());
+    if (!written || rename(temp_filename.c_str(), filename.c_str()) != 0)
+    {
+        cura::log("Cannot write compiled setting registry %s\n", filename.c_str());
+        remove(temp_filename.c_str());
+    }
+}
+
 bool SettingRegistry::loadJSON(std::string filename)
 {
+    if (_loadCompiledRegistry(filename))
+    {
+        return true;
+    }
+
     rapidjson::Document json_document;
     
     {
@@ -62,37 +370,26 @@ bool SettingRegistry::loadJSON(std::string filename)
     }
 
     categories.emplace_back("machine_settings", "Machine Settings");
+    std::list<SettingCategory>::iterator first_category = std::prev(categories.end());
     SettingCategory* category_machine_settings = &categories.back();
-    _addSettingsToCategory(category_machine_settings, json_document["machine_settings"], NULL);
+    _addSettingsToCategory(category_machine_settings, json_document["machine_settings"], NULL, ALL_PIPELINE_STAGES);
     
     categories.emplace_back("mesh_settings", "TEMPORARY");
     SettingCategory* category_mesh_settings = &categories.back();
     {
         SettingConfig* config = category_mesh_settings->addChild("mesh_position_x", "mesh_position_x");
         config->setDefault("0");
-        if (settingExists(config->getKey()))
-        {
-            cura::logError("Duplicate definition of setting: %s\n", config->getKey().c_str());
-        }
-        settings[config->getKey()] = config;
+        _registerSetting(config);
     }
     {
         SettingConfig* config = category_mesh_settings->addChild("mesh_position_y", "mesh_position_y");
         config->setDefault("0");
-        if (settingExists(config->getKey()))
-        {
-            cura::logError("Duplicate definition of setting: %s\n", config->getKey().c_str());
-        }
-        settings[config->getKey()] = config;
+        _registerSetting(config);
     }
     {
         SettingConfig* config = category_mesh_settings->addChild("mesh_position_z", "mesh_position_z");
         config->setDefault("0");
-        if (settingExists(config->getKey()))
-        {
-            cura::logError("Duplicate definition of setting: %s\n", config->getKey().c_str());
-        }
-        settings[config->getKey()] = config;
+        _registerSetting(config);
     }
     
     
@@ -113,15 +410,48 @@ bool SettingRegistry::loadJSON(std::string filename)
         
         categories.emplace_back(category_iterator->name.GetString(), category_iterator->value["label"].GetString());
         SettingCategory* category = &categories.back();
+        unsigned int category_stages = ALL_PIPELINE_STAGES;
+        _parseStages(category_iterator->value, category_stages);
         
-        _addSettingsToCategory(category, category_iterator->value["settings"], NULL);
+        _addSettingsToCategory(category, category_iterator->value["settings"], NULL, category_stages);
     }
     
+    _saveCompiledRegistry(filename, first_category);
     
     return true;
 }
 
-void SettingRegistry::_addSettingsToCategory(SettingCategory* category, const rapidjson::Value& json_object, SettingConfig* parent)
+void SettingRegistry::_parseStages(const rapidjson::Value& json_object, unsigned int& stages)
+{
+    if (!json_object.HasMember("stages") || !json_object["stages"].IsArray())
+    {
+        return;
+    }
+    static const char* stage_names[Stage_Count] = { "slice", "layer_parts", "insets", "skins_infill", "support", "planning", "export" };
+    const rapidjson::Value& stage_list = json_object["stages"];
+    unsigned int result = 0;
+    for (rapidjson::SizeType idx = 0; idx < stage_list.Size(); idx++)
+    {
+        int stage = -1;
+        if (stage_list[idx].IsString())
+        {
+            for (int n = 0; n < Stage_Count; n++)
+            {
+                if (std::string(stage_list[idx].GetString()) == stage_names[n])
+                    stage = n;
+            }
+        }
+        if (stage < 0)
+        {
+            cura::logError("Unknown pipeline stage in setting definition\n");
+            return;
+        }
+        result |= 1u << stage;
+    }
+    stages = result;
+}
+
+void SettingRegistry::_addSettingsToCategory(SettingCategory* category, const rapidjson::Value& json_object, SettingConfig* parent, unsigned int inherited_stages)
 {
     for (rapidjson::Value::ConstMemberIterator setting_iterator = json_object.MemberBegin(); setting_iterator != json_object.MemberEnd(); ++setting_iterator)
     {
@@ -175,18 +505,17 @@ void SettingRegistry::_addSettingsToCategory(SettingCategory* category, const ra
         {
             config->setUnit(data["unit"].GetString());
         }
+        unsigned int stages = inherited_stages;
+        _parseStages(data, stages);
+        config->setStages(stages);
         
         /// Register the setting in the settings map lookup.
-        if (settingExists(config->getKey()))
-        {
-            cura::logError("Duplicate definition of setting: %s\n", config->getKey().c_str());
-        }
-        settings[config->getKey()] = config;
+        _registerSetting(config);
 
         /// When this setting has children, add those children to this setting.
         if (data.HasMember("children") && data["children"].IsObject())
         {
-            _addSettingsToCategory(category, data["children"], config);
+            _addSettingsToCategory(category, data["children"], config, stages);
         }
     }
 }
@@ -203,7 +532,7 @@ SettingConfig* SettingCategory::addChild(std::string key, std::string label)
 }
 
 SettingConfig::SettingConfig(std::string key, std::string label, SettingConfig* parent)
-: label(label), key(key), parent(parent)
+: label(label), key(key), stages(ALL_PIPELINE_STAGES), parent(parent)
 {
 }
 
@@ -5,12 +5,32 @@
 #include <list>
 #include <map>
 #include <string>
+#include <unordered_map>
 
 #include "rapidjson/document.h"
 
 // Forward declaration
 class SettingConfig;
 
+/*!
+ * The stages of the processing pipeline, in the order in which they run.
+ * Every setting is tagged with the stages whose results depend on it, so that a job can reuse the results of the previous job up to the first stage affected by a changed setting.
+ */
+enum EPipelineStage
+{
+    Stage_Slice,        //!< Slicing the meshes into outlines
+    Stage_LayerParts,   //!< Splitting the outlines into parts
+    Stage_Insets,       //!< Generating the walls
+    Stage_SkinsInfill,  //!< Generating the top/bottom skins and the sparse infill areas
+    Stage_Support,      //!< Generating the support areas and the other helper structures: skirt, brim, raft, ooze shield and wipe tower
+    Stage_Planning,     //!< Planning the paths of each layer
+    Stage_Export,       //!< Writing the GCode
+    Stage_Count
+};
+
+//! Bit mask of all pipeline stages; settings which aren't tagged affect all of them.
+#define ALL_PIPELINE_STAGES ((1u << Stage_Count) - 1)
+
 /*!
  * Setting category.
  * Filled from the fdmprinter.json file. Contains one or more children settings.
@@ -25,6 +45,21 @@ public:
     SettingCategory(std::string key, std::string label);
     
     SettingConfig* addChild(std::string key, std::string label);
+
+    std::string getKey() const
+    {
+        return key;
+    }
+
+    std::string getLabel() const
+    {
+        return label;
+    }
+
+    std::list<SettingConfig>& getChildren()
+    {
+        return children;
+    }
 };
 
 /*!
@@ -40,6 +75,7 @@ private:
     std::string type;
     std::string default_value;
     std::string unit;
+    unsigned int stages; //!< Bit mask of the EPipelineStage values which depend on this setting
     SettingConfig* parent;
     std::list<SettingConfig> children;
 public:
@@ -51,6 +87,16 @@ public:
     {
         return key;
     }
+
+    std::string getLabel() const
+    {
+        return label;
+    }
+
+    std::list<SettingConfig>& getChildren()
+    {
+        return children;
+    }
     
     void setType(std::string type)
     {
@@ -81,6 +127,16 @@ public:
     {
         return unit;
     }
+
+    void setStages(unsigned int stages)
+    {
+        this->stages = stages;
+    }
+
+    unsigned int getStages() const
+    {
+        return stages;
+    }
 };
 
 /*!
@@ -96,18 +152,102 @@ private:
 
     std::map<std::string, SettingConfig*> settings;
     std::list<SettingCategory> categories;
+
+    std::unordered_map<std::string, unsigned int> setting_ids; //!< The id of each key which has been used so far
+    std::vector<std::string> setting_keys; //!< The key of each id
 public:
     static SettingRegistry* getInstance() { return &instance; }
     
     bool settingExists(std::string key) const;
     const SettingConfig* getSettingConfig(std::string key);
+
+    /*!
+     * Get the pipeline stages whose results depend on a setting.
+     * 
+     * \param key The key of the setting
+     * \return Bit mask of EPipelineStage values; all stages for unregistered settings
+     */
+    unsigned int getSettingStages(std::string key) const;
+
+    /*!
+     * Get the integer id of a setting key, so that settings can be stored and looked up by index instead of by string.
+     * Ids are handed out in the order in which keys are first seen, also for keys which are not (yet) registered.
+     * 
+     * \param key The key of the setting
+     * \return The id of the key
+     */
+    unsigned int getSettingId(const std::string& key);
+
+    /*!
+     * Look up the id of a setting key without handing out a new one, so that it is safe to call concurrently.
+     * 
+     * \param key The key of the setting
+     * \param id Output parameter: the id of the key
+     * \return Whether the key has an id
+     */
+    bool findSettingId(const std::string& key, unsigned int& id) const;
+
+    /*!
+     * Hand out an id to every registered setting which doesn't have one yet, so that the ids below getSettingIdCount() cover all registered settings.
+     */
+    void assignSettingIds();
+
+    /*!
+     * Get the number of ids handed out so far.
+     */
+    unsigned int getSettingIdCount() const
+    {
+        return setting_keys.size();
+    }
+
+    /*!
+     * Get the key belonging to an id obtained from getSettingId.
+     */
+    const std::string& getSettingKey(unsigned int id) const
+    {
+        return setting_keys[id];
+    }
     
     bool settingsLoaded();
     bool loadJSON(std::string filename);
 private:
     SettingRegistry();
     
-    void _addSettingsToCategory(SettingCategory* category, const rapidjson::Value& json_object, SettingConfig* parent);
+    void _addSettingsToCategory(SettingCategory* category, const rapidjson::Value& json_object, SettingConfig* parent, unsigned int inherited_stages);
+
+    /*!
+     * Add a setting to the settings map lookup.
+     */
+    void _registerSetting(SettingConfig* config);
+
+    /*!
+     * Add a setting and all its descendants to the settings map lookup, in the order in which they are added when reading the JSON file.
+     */
+    void _registerSettingTree(SettingConfig& config);
+
+    /*!
+     * Load the categories and settings from the compiled registry of a JSON file, if it is up to date with the JSON file.
+     * 
+     * \param json_filename The JSON file
+     * \return Whether the compiled registry was loaded; if not, nothing was added
+     */
+    bool _loadCompiledRegistry(std::string json_filename);
+
+    /*!
+     * Store the categories and settings just loaded from a JSON file in a compiled registry next to it, so the JSON doesn't need to be parsed next time.
+     * 
+     * \param json_filename The JSON file
+     * \param first_category The first of the categories loaded from it
+     */
+    void _saveCompiledRegistry(std::string json_filename, std::list<SettingCategory>::iterator first_category);
+
+    /*!
+     * Read the "stages" list of a setting or category, e.g. "stages": ["insets", "skins_infill"].
+     * 
+     * \param json_object The setting or category
+     * \param stages Output parameter: the bit mask of the listed stages; left untouched when the object has no (valid) list
+     */
+    static void _parseStages(const rapidjson::Value& json_object, unsigned int& stages);
 };
 
 #endif//SETTING_REGISTRY_H
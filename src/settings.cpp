@@ -13,127 +13,228 @@
 #endif
 
 SettingsBase::SettingsBase()
-: parent(NULL)
+: parent(NULL), frozen(false)
 {
 }
 
 SettingsBase::SettingsBase(SettingsBase* parent)
-: parent(parent)
+: parent(parent), frozen(false)
 {
 }
 
-void SettingsBase::setSetting(std::string key, std::string value)
+SettingsBase* SettingsBase::getRoot()
 {
-    if (SettingRegistry::getInstance()->settingExists(key))
+    SettingsBase* root = this;
+    while (root->parent)
     {
-        setting_values[key] = value;
+        root = root->parent;
+    }
+    return root;
+}
+
+void SettingsBase::freezeSettings()
+{
+    SettingsBase* root = getRoot();
+    SettingRegistry* registry = SettingRegistry::getInstance();
+    registry->assignSettingIds();
+    for (unsigned int id = 0; id < registry->getSettingIdCount(); id++)
+    {
+        if (id >= root->setting_values.size() || !root->setting_values[id].is_set)
+        {
+            root->setDefault(id, false);
+        }
+    }
+    root->frozen = true;
+}
+
+void SettingsBase::thawSettings()
+{
+    getRoot()->frozen = false;
+}
+
+void SettingsBase::SettingValue::set(const std::string& value)
+{
+    is_set = true;
+    this->value = value;
+    int_value = atoi(value.c_str());
+    double_value = atof(value.c_str());
+    bool_value = value == "on" || value == "yes" || value == "true" || value == "True" || int_value != 0; //Python uses "True"
+    is_default = false;
+}
+
+void SettingsBase::setDefault(unsigned int id, bool log_default)
+{
+    SettingRegistry* registry = SettingRegistry::getInstance();
+    const std::string& key = registry->getSettingKey(id);
+    if (id >= setting_values.size())
+    {
+        setting_values.resize(id + 1);
+    }
+    SettingValue& setting = setting_values[id];
+    if (registry->settingExists(key))
+    {
+        setting.set(registry->getSettingConfig(key)->getDefaultValue());
+        if (log_default)
+        {
+            cura::logWarningOnce(("default " + key).c_str(), "Using default for: %s = %s\n", key.c_str(), setting.value.c_str());
+        }
     }
     else
     {
-        cura::logError("Warning: setting an unregistered setting %s\n", key.c_str() );
-        setting_values[key] = value; // Handy when programmers are in the process of introducing a new setting
+        setting.set("");
+        if (log_default)
+        {
+            cura::logWarningOnce(("unregistered " + key).c_str(), "Unregistered setting %s\n", key.c_str());
+        }
     }
+    setting.is_default = true;
+}
+
+const SettingsBase::SettingValue& SettingsBase::getUnknownSettingValue(const std::string& key)
+{
+    static const SettingValue unknown_setting;
+    cura::logWarningOnce(("unregistered " + key).c_str(), "Unregistered setting %s\n", key.c_str());
+    return unknown_setting;
 }
 
-std::string SettingsBase::getSettingString(std::string key)
+void SettingsBase::setSetting(const std::string& key, const std::string& value)
 {
-    if (setting_values.find(key) != setting_values.end())
+    if (getRoot()->frozen)
     {
-        return setting_values[key];
+        cura::logError("Error: the settings are frozen, ignoring %s = %s\n", key.c_str(), value.c_str());
+        return;
     }
+    SettingRegistry* registry = SettingRegistry::getInstance();
+    if (!registry->settingExists(key))
+    {
+        cura::logError("Warning: setting an unregistered setting %s\n", key.c_str() );
+        // Set it anyway; handy when programmers are in the process of introducing a new setting
+    }
+    unsigned int id = registry->getSettingId(key);
+    if (id >= setting_values.size())
+    {
+        setting_values.resize(id + 1);
+    }
+    setting_values[id].set(value);
+}
+
+std::map<std::string, std::string> SettingsBase::getAllSettings() const
+{
+    std::map<std::string, std::string> result;
     if (parent)
     {
-        return parent->getSettingString(key);
+        result = parent->getAllSettings();
     }
-    
-    if (SettingRegistry::getInstance()->settingExists(key))
+    SettingRegistry* registry = SettingRegistry::getInstance();
+    for (unsigned int id = 0; id < setting_values.size(); id++)
     {
-        setting_values[key] = SettingRegistry::getInstance()->getSettingConfig(key)->getDefaultValue();
-        cura::logError("Using default for: %s = %s\n", key.c_str(), setting_values[key].c_str());
+        if (setting_values[id].is_set)
+        {
+            result[registry->getSettingKey(id)] = setting_values[id].value;
+        }
+    }
+    return result;
+}
+
+const SettingsBase::SettingValue& SettingsBase::getSettingValue(const std::string& key)
+{
+    SettingRegistry* registry = SettingRegistry::getInstance();
+    SettingsBase* root = getRoot();
+    unsigned int id;
+    if (root->frozen)
+    {
+        if (!registry->findSettingId(key, id))
+        {
+            return getUnknownSettingValue(key);
+        }
     }
     else
     {
-        setting_values[key] = "";
-        cura::logError("Unregistered setting %s\n", key.c_str());
+        id = registry->getSettingId(key);
+    }
+    for (SettingsBase* settings = this; settings; settings = settings->parent)
+    {
+        if (id < settings->setting_values.size() && settings->setting_values[id].is_set)
+        {
+            return settings->setting_values[id];
+        }
+    }
+    if (root->frozen)
+    {
+        return getUnknownSettingValue(key);
     }
-    return setting_values[key];
+    root->setDefault(id, true);
+    return root->setting_values[id];
 }
 
-bool SettingsBase::hasSetting(std::string key)
+std::string SettingsBase::getSettingString(const std::string& key)
 {
-    if (setting_values.find(key) != setting_values.end())
+    return getSettingValue(key).value;
+}
+
+bool SettingsBase::hasSetting(const std::string& key)
+{
+    unsigned int id;
+    if (!SettingRegistry::getInstance()->findSettingId(key, id))
     {
-        return true;
+        return false;
     }
-    if (parent)
+    for (SettingsBase* settings = this; settings; settings = settings->parent)
     {
-        return parent->hasSetting(key);
+        if (id < settings->setting_values.size() && settings->setting_values[id].is_set && !settings->setting_values[id].is_default)
+        {
+            return true;
+        }
     }
-    
     return false;
 }
 
-int SettingsBase::getSettingAsIndex(std::string key)
+int SettingsBase::getSettingAsIndex(const std::string& key)
 {
-    std::string value = getSettingString(key);
-    return atoi(value.c_str());
+    return getSettingValue(key).int_value;
 }
 
-int SettingsBase::getSettingAsCount(std::string key)
+int SettingsBase::getSettingAsCount(const std::string& key)
 {
-    std::string value = getSettingString(key);
-    return atoi(value.c_str());
+    return getSettingValue(key).int_value;
 }
 
-int SettingsBase::getSettingInMicrons(std::string key)
+int SettingsBase::getSettingInMicrons(const std::string& key)
 {
-    std::string value = getSettingString(key);
-    return atof(value.c_str()) * 1000.0;
+    return getSettingValue(key).double_value * 1000.0;
 }
 
-double SettingsBase::getSettingInAngleRadians(std::string key)
+double SettingsBase::getSettingInAngleRadians(const std::string& key)
 {
-    std::string value = getSettingString(key);
-    return atof(value.c_str()) / 180.0 * M_PI;
+    return getSettingValue(key).double_value / 180.0 * M_PI;
 }
 
-bool SettingsBase::getSettingBoolean(std::string key)
+bool SettingsBase::getSettingBoolean(const std::string& key)
 {
-    std::string value = getSettingString(key);
-    if (value == "on")
-        return true;
-    if (value == "yes")
-        return true;
-    if (value == "true" or value == "True") //Python uses "True"
-        return true;
-    return atoi(value.c_str()) != 0;
+    return getSettingValue(key).bool_value;
 }
 
-double SettingsBase::getSettingInDegreeCelsius(std::string key)
+double SettingsBase::getSettingInDegreeCelsius(const std::string& key)
 {
-    std::string value = getSettingString(key);
-    return atof(value.c_str());
+    return getSettingValue(key).double_value;
 }
 
-double SettingsBase::getSettingInMillimetersPerSecond(std::string key)
+double SettingsBase::getSettingInMillimetersPerSecond(const std::string& key)
 {
-    std::string value = getSettingString(key);
-    return std::max(1.0, atof(value.c_str()));
+    return std::max(1.0, getSettingValue(key).double_value);
 }
 
-double SettingsBase::getSettingInPercentage(std::string key)
+double SettingsBase::getSettingInPercentage(const std::string& key)
 {
-    std::string value = getSettingString(key);
-    return std::max(0.0, atof(value.c_str()));
+    return std::max(0.0, getSettingValue(key).double_value);
 }
 
-double SettingsBase::getSettingInSeconds(std::string key)
+double SettingsBase::getSettingInSeconds(const std::string& key)
 {
-    std::string value = getSettingString(key);
-    return std::max(0.0, atof(value.c_str()));
+    return std::max(0.0, getSettingValue(key).double_value);
 }
 
-EGCodeFlavor SettingsBase::getSettingAsGCodeFlavor(std::string key)
+EGCodeFlavor SettingsBase::getSettingAsGCodeFlavor(const std::string& key)
 {
     std::string value = getSettingString(key);
     if (value == "RepRap")
@@ -151,7 +252,7 @@ EGCodeFlavor SettingsBase::getSettingAsGCodeFlavor(std::string key)
     return GCODE_FLAVOR_REPRAP;
 }
 
-EFillMethod SettingsBase::getSettingAsFillMethod(std::string key)
+EFillMethod SettingsBase::getSettingAsFillMethod(const std::string& key)
 {
     std::string value = getSettingString(key);
     if (value == "Lines")
@@ -167,7 +268,7 @@ EFillMethod SettingsBase::getSettingAsFillMethod(std::string key)
     return Fill_None;
 }
 
-EPlatformAdhesion SettingsBase::getSettingAsPlatformAdhesion(std::string key)
+EPlatformAdhesion SettingsBase::getSettingAsPlatformAdhesion(const std::string& key)
 {
     std::string value = getSettingString(key);
     if (value == "Brim")
@@ -177,7 +278,7 @@ EPlatformAdhesion SettingsBase::getSettingAsPlatformAdhesion(std::string key)
     return Adhesion_None;
 }
 
-ESupportType SettingsBase::getSettingAsSupportType(std::string key)
+ESupportType SettingsBase::getSettingAsSupportType(const std::string& key)
 {
     std::string value = getSettingString(key);
     if (value == "Everywhere")
@@ -186,3 +287,13 @@ ESupportType SettingsBase::getSettingAsSupportType(std::string key)
         return Support_PlatformOnly;
     return Support_None;
 }
+
+EFillPerimeterGaps SettingsBase::getSettingAsFillPerimeterGaps(const std::string& key)
+{
+    std::string value = getSettingString(key);
+    if (value == "Everywhere")
+        return FillPerimeterGaps_Everywhere;
+    if (value == "Skin")
+        return FillPerimeterGaps_Skin;
+    return FillPerimeterGaps_Nowhere;
+}
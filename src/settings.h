@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <map>
+#include <string>
 
 #include "utils/floatpoint.h"
 
@@ -105,6 +106,16 @@ enum ESupportType
     Support_Everywhere
 };
 
+/*!
+ * Where to fill the gaps between the walls
+ */
+enum EFillPerimeterGaps
+{
+    FillPerimeterGaps_Nowhere,
+    FillPerimeterGaps_Everywhere,
+    FillPerimeterGaps_Skin
+};
+
 #define MAX_EXTRUDERS 16
 
 //Maximum number of sparse layers that can be combined into a single sparse extrusion.
@@ -120,32 +131,94 @@ enum ESupportType
 class SettingsBase
 {
 private:
-    std::map<std::string, std::string> setting_values;
+    /*!
+     * The value of a single setting.
+     * The numeric interpretations of the value are parsed once when the setting is set, so the getters don't need to parse strings.
+     */
+    struct SettingValue
+    {
+        bool is_set; //!< Whether the setting is set on this object
+        std::string value;
+        int int_value; //!< The value parsed with atoi
+        double double_value; //!< The value parsed with atof
+        bool bool_value; //!< The value interpreted as a boolean
+        bool is_default; //!< Whether the value was filled in from the registry default rather than set
+
+        SettingValue() : is_set(false), int_value(0), double_value(0.0), bool_value(false), is_default(false) {}
+
+        void set(const std::string& value);
+    };
+
+    std::vector<SettingValue> setting_values; //!< Indexed by the setting id from SettingRegistry::getSettingId
     SettingsBase* parent;
+    bool frozen; //!< Whether the settings tree is read-only; only used on the root of the tree
+
+    SettingsBase* getRoot();
+
+    /*!
+     * Put the default value of a setting in \ref setting_values.
+     * 
+     * \param id The id of the setting key
+     * \param log_default Whether to report that the default is used
+     */
+    void setDefault(unsigned int id, bool log_default);
+
+    /*!
+     * Get the (empty) value to use for a setting which isn't known while the settings are frozen.
+     * Reports the setting as unregistered the first time.
+     */
+    static const SettingValue& getUnknownSettingValue(const std::string& key);
+
+    /*!
+     * Get the value of a setting from this object or its parents, adding the default value to the root object when no object has it.
+     * When the settings are frozen nothing is added, so this is safe to call from multiple threads.
+     * 
+     * \param key The key of the setting
+     * \return The value; only valid until the next setting is added to any SettingsBase
+     */
+    const SettingValue& getSettingValue(const std::string& key);
 public:
     SettingsBase();
     SettingsBase(SettingsBase* parent);
 
-    bool hasSetting(std::string key);
-
-    void setSetting(std::string key, std::string value);
-
-    std::string getSettingString(std::string key);
-    int getSettingAsIndex(std::string key);
-    int getSettingAsCount(std::string key);
-
-    double getSettingInAngleRadians(std::string key);
-    int getSettingInMicrons(std::string key);
-    bool getSettingBoolean(std::string key);
-    double getSettingInDegreeCelsius(std::string key);
-    double getSettingInMillimetersPerSecond(std::string key);
-    double getSettingInPercentage(std::string key);
-    double getSettingInSeconds(std::string key);
-
-    EGCodeFlavor getSettingAsGCodeFlavor(std::string key);
-    EFillMethod getSettingAsFillMethod(std::string key);
-    EPlatformAdhesion getSettingAsPlatformAdhesion(std::string key);
-    ESupportType getSettingAsSupportType(std::string key);
+    /*!
+     * Make the settings tree this object belongs to read-only, so that it can be read from multiple threads at the same time.
+     * The defaults of all settings which aren't set are resolved up front, so that reading a setting doesn't modify the tree.
+     * Setting a value is refused until thawSettings is called.
+     */
+    void freezeSettings();
+
+    /*!
+     * Make the settings tree this object belongs to writable again after freezeSettings.
+     */
+    void thawSettings();
+
+    bool hasSetting(const std::string& key);
+
+    void setSetting(const std::string& key, const std::string& value);
+
+    /*!
+     * Get all settings which are set on this object or one of its parents, with the values as seen from this object.
+     */
+    std::map<std::string, std::string> getAllSettings() const;
+
+    std::string getSettingString(const std::string& key);
+    int getSettingAsIndex(const std::string& key);
+    int getSettingAsCount(const std::string& key);
+
+    double getSettingInAngleRadians(const std::string& key);
+    int getSettingInMicrons(const std::string& key);
+    bool getSettingBoolean(const std::string& key);
+    double getSettingInDegreeCelsius(const std::string& key);
+    double getSettingInMillimetersPerSecond(const std::string& key);
+    double getSettingInPercentage(const std::string& key);
+    double getSettingInSeconds(const std::string& key);
+
+    EGCodeFlavor getSettingAsGCodeFlavor(const std::string& key);
+    EFillMethod getSettingAsFillMethod(const std::string& key);
+    EPlatformAdhesion getSettingAsPlatformAdhesion(const std::string& key);
+    ESupportType getSettingAsSupportType(const std::string& key);
+    EFillPerimeterGaps getSettingAsFillPerimeterGaps(const std::string& key);
 };
 
 
@@ -0,0 +1,90 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#include "settingsSnapshot.h"
+
+#include <algorithm>
+
+namespace cura {
+
+namespace
+{
+/*!
+ * The number of skin layers given by setting \p key. With adaptive layer heights the layers can be thinner than the
+ * layer height, so the count is raised to make up the same thickness from the thinnest layers.
+ */
+int getSkinLayerCount(SettingsBase* settings, const std::string& key)
+{
+    int count = settings->getSettingAsCount(key);
+    if (count <= 0 || !settings->getSettingBoolean("adaptive_layer_height_enabled"))
+    {
+        return count;
+    }
+    int layer_height = settings->getSettingInMicrons("layer_height");
+    int variation_step = settings->getSettingInMicrons("adaptive_layer_height_variation_step");
+    int min_thickness = std::max(std::max(1, variation_step), layer_height - settings->getSettingInMicrons("adaptive_layer_height_variation"));
+    return (int64_t(count) * layer_height + min_thickness - 1) / min_thickness;
+}
+}//namespace
+
+SettingsSnapshot::SettingsSnapshot(SettingsBase* settings)
+: layer_height(settings->getSettingInMicrons("layer_height"))
+, layer_height_0(settings->getSettingInMicrons("layer_height_0"))
+, adhesion_type(settings->getSettingAsPlatformAdhesion("adhesion_type"))
+, extruder_nr(settings->getSettingAsIndex("extruder_nr"))
+, wall_line_count(settings->getSettingAsCount("wall_line_count"))
+, top_layers(getSkinLayerCount(settings, "top_layers"))
+, bottom_layers(getSkinLayerCount(settings, "bottom_layers"))
+, skin_outline_count(settings->getSettingAsCount("skin_outline_count"))
+, fill_sparse_combine(settings->getSettingAsCount("fill_sparse_combine"))
+, alternate_extra_perimeter(settings->getSettingBoolean("alternate_extra_perimeter"))
+, wall_overlap_avoid_enabled(settings->getSettingBoolean("wall_overlap_avoid_enabled"))
+, wall_field_point_count(settings->getSettingAsCount("wall_field_point_count"))
+, magic_spiralize(settings->getSettingBoolean("magic_spiralize"))
+, magic_polygon_mode(settings->getSettingBoolean("magic_polygon_mode"))
+, wall_line_width_0(settings->getSettingInMicrons("wall_line_width_0"))
+, wall_line_width_x(settings->getSettingInMicrons("wall_line_width_x"))
+, skin_line_width(settings->getSettingInMicrons("skin_line_width"))
+, infill_line_width(settings->getSettingInMicrons("infill_line_width"))
+, infill_line_distance(settings->getSettingInMicrons("infill_line_distance"))
+, skirt_line_width(settings->getSettingInMicrons("skirt_line_width"))
+, support_line_width(settings->getSettingInMicrons("support_line_width"))
+, support_line_distance(settings->getSettingInMicrons("support_line_distance"))
+, material_flow(settings->getSettingInPercentage("material_flow"))
+, fill_overlap(settings->getSettingInPercentage("fill_overlap"))
+, fill_pattern(settings->getSettingAsFillMethod("fill_pattern"))
+, fill_per_layer(settings->getSettingBoolean("fill_per_layer"))
+, top_bottom_pattern(settings->getSettingAsFillMethod("top_bottom_pattern"))
+, support_pattern(settings->getSettingAsFillMethod("support_pattern"))
+, fill_perimeter_gaps(settings->getSettingAsFillPerimeterGaps("fill_perimeter_gaps"))
+, support_connect_zigzags(settings->getSettingBoolean("support_connect_zigzags"))
+, support_extruder_nr(settings->getSettingAsIndex("support_extruder_nr"))
+, wipe_tower_size(settings->getSettingInMicrons("wipe_tower_size"))
+, speed_wall_0(settings->getSettingInMillimetersPerSecond("speed_wall_0"))
+, speed_wall_x(settings->getSettingInMillimetersPerSecond("speed_wall_x"))
+, speed_topbottom(settings->getSettingInMillimetersPerSecond("speed_topbottom"))
+, speed_infill(settings->getSettingInMillimetersPerSecond("speed_infill"))
+, speed_support(settings->getSettingInMillimetersPerSecond("speed_support"))
+, skirt_speed(settings->getSettingInMillimetersPerSecond("skirt_speed"))
+, speed_layer_0(settings->getSettingInMillimetersPerSecond("speed_layer_0"))
+, speed_slowdown_layers(settings->getSettingAsCount("speed_slowdown_layers"))
+, speed_travel(settings->getSettingInMillimetersPerSecond("speed_travel"))
+, retraction_min_travel(settings->getSettingInMicrons("retraction_min_travel"))
+, retraction_combing(settings->getSettingBoolean("retraction_combing"))
+, machine_travel_refinement_time(settings->getSettingAsCount("machine_travel_refinement_time"))
+, machine_planning_lookahead(settings->getSettingAsCount("machine_planning_lookahead"))
+, machine_arc_tolerance(settings->getSettingInMicrons("machine_arc_tolerance"))
+, machine_merge_tolerance(settings->getSettingInMicrons("machine_merge_tolerance"))
+, machine_layer_templates(settings->getSettingBoolean("machine_layer_templates"))
+, machine_metal_printing(settings->getSettingBoolean("machine_metal_printing"))
+, machine_min_dist_welder_off(settings->getSettingInMicrons("machine_min_dist_welder_off"))
+, machine_welder_cycle_cost(settings->getSettingInMicrons("machine_welder_cycle_cost"))
+, cool_min_layer_time(settings->getSettingInSeconds("cool_min_layer_time"))
+, cool_min_layer_time_fan_speed_max(settings->getSettingInSeconds("cool_min_layer_time_fan_speed_max"))
+, cool_min_speed(settings->getSettingInMillimetersPerSecond("cool_min_speed"))
+, cool_fan_speed_min(settings->getSettingInPercentage("cool_fan_speed_min"))
+, cool_fan_speed_max(settings->getSettingInPercentage("cool_fan_speed_max"))
+, cool_fan_full_layer(settings->getSettingAsCount("cool_fan_full_layer"))
+, cool_lift_head(settings->getSettingBoolean("cool_lift_head"))
+{
+}
+
+}//namespace cura
@@ -0,0 +1,92 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#ifndef SETTINGS_SNAPSHOT_H
+#define SETTINGS_SNAPSHOT_H
+
+#include "settings.h"
+
+namespace cura {
+
+/*!
+ * The settings which are used in the per layer loops of the fffProcessor, resolved once before processing.
+ * 
+ * Looking up a setting walks the settings hierarchy and converts the value, which adds up when it is done for every
+ * layer, part and mesh. The snapshot is taken from one SettingsBase (the processor or a single mesh) after all settings
+ * are known and is never changed afterwards.
+ */
+class SettingsSnapshot
+{
+public:
+    const int layer_height;
+    const int layer_height_0;
+    const EPlatformAdhesion adhesion_type;
+    const int extruder_nr;
+
+    const int wall_line_count;
+    const int top_layers;
+    const int bottom_layers;
+    const int skin_outline_count;
+    const int fill_sparse_combine;
+    const bool alternate_extra_perimeter;
+    const bool wall_overlap_avoid_enabled;
+    const int wall_field_point_count;
+    const bool magic_spiralize;
+    const bool magic_polygon_mode;
+
+    const int wall_line_width_0;
+    const int wall_line_width_x;
+    const int skin_line_width;
+    const int infill_line_width;
+    const int infill_line_distance;
+    const int skirt_line_width;
+    const int support_line_width;
+    const int support_line_distance;
+    const double material_flow;
+    const double fill_overlap;
+    const EFillMethod fill_pattern;
+    const bool fill_per_layer;
+    const EFillMethod top_bottom_pattern;
+    const EFillMethod support_pattern;
+    const EFillPerimeterGaps fill_perimeter_gaps;
+    const bool support_connect_zigzags;
+    const int support_extruder_nr;
+    const int wipe_tower_size;
+
+    const double speed_wall_0;
+    const double speed_wall_x;
+    const double speed_topbottom;
+    const double speed_infill;
+    const double speed_support;
+    const double skirt_speed;
+    const double speed_layer_0;
+    const int speed_slowdown_layers;
+    const double speed_travel;
+    const int retraction_min_travel;
+    const bool retraction_combing;
+    const int machine_travel_refinement_time;
+    const int machine_planning_lookahead;
+    const int machine_arc_tolerance;
+    const int machine_merge_tolerance;
+    const bool machine_layer_templates;
+    const bool machine_metal_printing;
+    const int machine_min_dist_welder_off;
+    const int machine_welder_cycle_cost;
+
+    const double cool_min_layer_time;
+    const double cool_min_layer_time_fan_speed_max;
+    const double cool_min_speed;
+    const double cool_fan_speed_min;
+    const double cool_fan_speed_max;
+    const int cool_fan_full_layer;
+    const bool cool_lift_head;
+
+    /*!
+     * Resolve the settings as seen from \p settings.
+     * 
+     * \param settings The processor or mesh to take the settings from
+     */
+    SettingsSnapshot(SettingsBase* settings);
+};
+
+}//namespace cura
+
+#endif//SETTINGS_SNAPSHOT_H
@@ -26,27 +26,31 @@ void generateSkinAreas(int layerNr, SliceMeshStorage& storage, int extrusionWidt
     {
         SliceLayerPart* part = &layer->parts[partNr];
         
-        Polygons upskin = part->insets.back().offset(-extrusionWidth/2);
+        Polygons upskin = part->inner_offsets.offset(part->insets.back(), -extrusionWidth/2);
         Polygons downskin = upskin;
 
         
         if (static_cast<int>(layerNr - downSkinCount) >= 0)
         {
             SliceLayer* layer2 = &storage.layers[layerNr - downSkinCount];
+            Polygons insets_below;
             for(SliceLayerPart& part2 : layer2->parts)
             {
                 if (part->boundaryBox.hit(part2.boundaryBox))
-                    downskin = downskin.difference(part2.insets.back());
+                    insets_below.add(part2.insets.back());
             }
+            downskin = downskin.difference(insets_below); // the parts of a layer don't overlap, so one difference with all of them at once removes the same area
         }
         if (static_cast<int>(layerNr + upSkinCount) < static_cast<int>(storage.layers.size()))
         {
             SliceLayer* layer2 = &storage.layers[layerNr + upSkinCount];
+            Polygons insets_above;
             for(SliceLayerPart& part2 : layer2->parts)
             {
                 if (part->boundaryBox.hit(part2.boundaryBox))
-                    upskin = upskin.difference(part2.insets.back());
+                    insets_above.add(part2.insets.back());
             }
+            upskin = upskin.difference(insets_above);
         }
         
         Polygons skin = upskin.unionPolygons(downskin);
@@ -101,7 +105,7 @@ void generateSparse(int layerNr, SliceMeshStorage& storage, int extrusionWidth,
 
     for(SliceLayerPart& part : layer.parts)
     {
-        Polygons sparse = part.insets.back().offset(-extrusionWidth / 2 - infill_skin_overlap);
+        Polygons sparse = part.inner_offsets.offset(part.insets.back(), -extrusionWidth / 2 - infill_skin_overlap);
 
         for(SliceLayerPart& part2 : layer.parts)
         {
@@ -1,4 +1,7 @@
 /** Copyright (C) 2013 David Braam - Released under terms of the AGPLv3 License */
+#include <algorithm>
+#include <functional>
+
 #include "skirt.h"
 #include "support.h"
 
@@ -15,13 +18,15 @@ void generateSkirt(SliceDataStorage& storage, int distance, int extrusionWidth,
     if (storage.support.generated) 
         support = storage.support.supportAreasPerLayer[0];
     { // get support polygons
+        Polygons model_outlines;
         for(SliceMeshStorage& mesh : storage.meshes)
         {
             if (mesh.layers.size() < 1) continue;
             SliceLayer* layer = &mesh.layers[0];
             for(unsigned int i=0; i<layer->parts.size(); i++)        
-                support = support.difference(layer->parts[i].outline);
+                model_outlines.add(layer->parts[i].outline);
         }
+        support = support.differenceUnion(model_outlines);
         
         // expand and contract to smooth the final polygon
         if (count == 1 && distance > 0)
@@ -38,31 +43,58 @@ void generateSkirt(SliceDataStorage& storage, int distance, int extrusionWidth,
     } 
     
     
-    for(int skirtNr=0; skirtNr<count;skirtNr++)
+    // Everything on the first layer which the skirt goes around, in one union.
+    Polygons first_layer = storage.wipeTower;
+    for(SliceMeshStorage& mesh : storage.meshes)
     {
-        int offsetDistance = distance + extrusionWidth * skirtNr + extrusionWidth / 2 + overshoot;
+        if (mesh.layers.size() < 1) continue;
+        SliceLayer* layer = &mesh.layers[0];
+        for(unsigned int i=0; i<layer->parts.size(); i++)
+        {
+            if (externalOnly)
+                first_layer.add(layer->parts[i].outline[0]);
+            else
+                first_layer.add(layer->parts[i].outline);
+        }
+    }
+    first_layer.add(support);
+    first_layer = first_layer.unionPolygons();
 
-        Polygons skirtPolygons(storage.wipeTower.offset(offsetDistance));
-        for(SliceMeshStorage& mesh : storage.meshes)
+    // A hole closes up once the offset is more than half its width. Offsetting it further would turn it inside out, and
+    // untangling that is most of the work of offsetting, so the holes are left out from the skirt line on which they close.
+    Polygons outlines;
+    std::vector<std::pair<int, unsigned int>> holes; // half the smaller size of the bounding box of each hole, and the hole
+    for(unsigned int n=0; n<first_layer.size(); n++)
+    {
+        if (first_layer[n].orientation())
         {
-            if (mesh.layers.size() < 1) continue;
-            SliceLayer* layer = &mesh.layers[0];
-            for(unsigned int i=0; i<layer->parts.size(); i++)
-            {
-                if (externalOnly)
-                {
-                    Polygons p;
-                    p.add(layer->parts[i].outline[0]);
-                    skirtPolygons = skirtPolygons.unionPolygons(p.offset(offsetDistance, ClipperLib::jtRound));
-                }
-                else
-                {
-                    skirtPolygons = skirtPolygons.unionPolygons(layer->parts[i].outline.offset(offsetDistance, ClipperLib::jtRound));
-                }
-            }
+            outlines.add(first_layer[n]);
+        }
+        else
+        {
+            Point hole_size = first_layer[n].max() - first_layer[n].min();
+            holes.emplace_back(std::min(hole_size.X, hole_size.Y) / 2, n);
         }
+    }
+    std::sort(holes.begin(), holes.end(), std::greater<std::pair<int, unsigned int>>());
 
-        skirtPolygons = skirtPolygons.unionPolygons(support.offset(offsetDistance, ClipperLib::jtRound));
+    auto getOffsetDistance = [&](int skirtNr) { return distance + extrusionWidth * skirtNr + extrusionWidth / 2 + overshoot; };
+    std::vector<Polygons> skirt_lines;
+    for(int skirtNr=0; skirtNr<count;skirtNr++)
+    {
+        if (skirtNr >= int(skirt_lines.size()))
+        { // the lines from here on which go around the same holes, in one offset
+            Polygons around = outlines;
+            unsigned int hole_count = 0;
+            while (hole_count < holes.size() && holes[hole_count].first > getOffsetDistance(skirtNr))
+                around.add(first_layer[holes[hole_count++].second]);
+            std::vector<int> offset_distances;
+            for(int line_nr = skirtNr; line_nr < count && (hole_count == 0 || holes[hole_count - 1].first > getOffsetDistance(line_nr)); line_nr++)
+                offset_distances.push_back(getOffsetDistance(line_nr));
+            std::vector<Polygons> lines = around.offsetMultiple(offset_distances, ClipperLib::jtRound);
+            skirt_lines.insert(skirt_lines.end(), lines.begin(), lines.end());
+        }
+        Polygons& skirtPolygons = skirt_lines[skirtNr];
         //Remove small inner skirt holes. Holes have a negative area, remove anything smaller then 100x extrusion "area"
         for(unsigned int n=0; n<skirtPolygons.size(); n++)
         {
@@ -0,0 +1,224 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#include "sliceCache.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "utils/logoutput.h"
+#include "utils/varint.h"
+
+namespace cura {
+
+namespace
+{
+/*
+Layout of a cache file, all integers are little endian varints:
+    the magic bytes "CURASLC2", followed by the 8 byte key
+    the number of layers
+    for each layer: its z, its closed polygons, its open polygons
+        for each of those: the number of polygons
+            for each polygon: the number of points, followed by the points as zigzag encoded differences to the previous point
+*/
+const char cache_magic[] = "CURASLC2";
+const unsigned int cache_magic_size = 8;
+
+//! 64 bit FNV-1a hash
+class Hash
+{
+public:
+    uint64_t value;
+
+    Hash()
+    : value(14695981039346656037ull)
+    {
+    }
+
+    void add(const void* data, size_t size)
+    {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; i++)
+        {
+            value = (value ^ bytes[i]) * 1099511628211ull;
+        }
+    }
+
+    void add(int64_t number)
+    {
+        add(&number, sizeof(number));
+    }
+};
+
+std::string cacheFileName(const std::string& directory, uint64_t key)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.slices", (unsigned long long)key);
+    if (directory.empty() || directory[directory.size() - 1] == '/' || directory[directory.size() - 1] == '\\')
+    {
+        return directory + name;
+    }
+    return directory + "/" + name;
+}
+
+void writePolygons(std::vector<unsigned char>& data, Polygons& polygons)
+{
+    writeVarInt(data, polygons.size());
+    for (unsigned int polygon_idx = 0; polygon_idx < polygons.size(); polygon_idx++)
+    {
+        PolygonRef polygon = polygons[polygon_idx];
+        writeVarInt(data, polygon.size());
+        Point previous(0, 0);
+        for (unsigned int point_idx = 0; point_idx < polygon.size(); point_idx++)
+        {
+            writeSignedVarInt(data, polygon[point_idx].X - previous.X);
+            writeSignedVarInt(data, polygon[point_idx].Y - previous.Y);
+            previous = polygon[point_idx];
+        }
+    }
+}
+
+void readPolygons(VarIntReader& reader, Polygons& polygons)
+{
+    uint64_t polygon_count = reader.readCount();
+    for (uint64_t polygon_idx = 0; polygon_idx < polygon_count && !reader.failed; polygon_idx++)
+    {
+        PolygonRef polygon = polygons.newPoly();
+        uint64_t point_count = reader.readCount();
+        Point p(0, 0);
+        for (uint64_t point_idx = 0; point_idx < point_count && !reader.failed; point_idx++)
+        {
+            p.X += reader.readSignedVarInt();
+            p.Y += reader.readSignedVarInt();
+            polygon.add(p);
+        }
+    }
+}
+
+}//namespace
+
+uint64_t meshHash(Mesh* mesh)
+{
+    Hash hash;
+    hash.add(int64_t(mesh->vertices.size()));
+    for (unsigned int vertex_idx = 0; vertex_idx < mesh->vertices.size(); vertex_idx++)
+    {
+        const Point3& p = mesh->vertices.positions[vertex_idx];
+        int32_t coords[3] = { p.x, p.y, p.z };
+        hash.add(coords, sizeof(coords));
+    }
+    hash.add(int64_t(mesh->faces.size()));
+    for (const MeshFace& face : mesh->faces)
+    {
+        hash.add(face.vertex_index, sizeof(face.vertex_index));
+    }
+    return hash.value;
+}
+
+uint64_t sliceCacheKey(Mesh* mesh, const std::vector<int>& layer_z, bool keep_none_closed, bool extensive_stitching, int xy_offset)
+{
+    Hash hash;
+    hash.add(cache_magic, cache_magic_size);
+    hash.add(int64_t(Slicer::output_version));
+    hash.add(int64_t(layer_z.size()));
+    for (int z : layer_z)
+    {
+        hash.add(z);
+    }
+    hash.add(keep_none_closed);
+    hash.add(extensive_stitching);
+    hash.add(xy_offset);
+    hash.add(int64_t(meshHash(mesh)));
+    return hash.value;
+}
+
+bool loadSliceCache(const std::string& directory, uint64_t key, Slicer& slicer)
+{
+    FILE* f = fopen(cacheFileName(directory, key).c_str(), "rb");
+    if (!f)
+    {
+        return false;
+    }
+    std::vector<unsigned char> data;
+    unsigned char buffer[1 << 16];
+    size_t read_size;
+    while ((read_size = fread(buffer, 1, sizeof(buffer), f)) > 0)
+    {
+        data.insert(data.end(), buffer, buffer + read_size);
+    }
+    fclose(f);
+
+    if (data.size() < cache_magic_size + sizeof(uint64_t) || memcmp(data.data(), cache_magic, cache_magic_size) != 0)
+    {
+        return false;
+    }
+    uint64_t stored_key = 0;
+    for (unsigned int byte_idx = 0; byte_idx < sizeof(uint64_t); byte_idx++)
+    {
+        stored_key |= uint64_t(data[cache_magic_size + byte_idx]) << (8 * byte_idx);
+    }
+    VarIntReader reader(data, cache_magic_size + sizeof(uint64_t));
+    if (stored_key != key || reader.readVarInt() != slicer.layers.size())
+    {
+        return false;
+    }
+    for (SlicerLayer& layer : slicer.layers)
+    {
+        if (reader.readSignedVarInt() != layer.z)
+        {
+            reader.failed = true;
+        }
+        readPolygons(reader, layer.polygonList);
+        readPolygons(reader, layer.openPolygons);
+        if (reader.failed)
+        {
+            break;
+        }
+    }
+    if (reader.failed || reader.pos != data.size())
+    {
+        logError("Ignoring corrupt slice cache file %s\n", cacheFileName(directory, key).c_str());
+        for (SlicerLayer& layer : slicer.layers)
+        {
+            layer.polygonList.clear();
+            layer.openPolygons.clear();
+        }
+        return false;
+    }
+    return true;
+}
+
+void saveSliceCache(const std::string& directory, uint64_t key, Slicer& slicer)
+{
+    std::vector<unsigned char> data(cache_magic, cache_magic + cache_magic_size);
+    for (unsigned int byte_idx = 0; byte_idx < sizeof(uint64_t); byte_idx++)
+    {
+        data.push_back(key >> (8 * byte_idx));
+    }
+    writeVarInt(data, slicer.layers.size());
+    for (SlicerLayer& layer : slicer.layers)
+    {
+        writeSignedVarInt(data, layer.z);
+        writePolygons(data, layer.polygonList);
+        writePolygons(data, layer.openPolygons);
+    }
+
+    // Write to a temporary file first, so that an interrupted run never leaves a truncated cache file behind.
+    std::string filename = cacheFileName(directory, key);
+    std::string temp_filename = filename + ".tmp";
+    FILE* f = fopen(temp_filename.c_str(), "wb");
+    if (!f)
+    {
+        logError("Cannot write slice cache file %s\n", temp_filename.c_str());
+        return;
+    }
+    bool written = fwrite(data.data(), 1, data.size(), f) == data.size();
+    written = (fclose(f) == 0) && written;
+    remove(filename.c_str());
+    if (!written || rename(temp_filename.c_str(), filename.c_str()) != 0)
+    {
+        logError("Cannot write slice cache file %s\n", filename.c_str());
+        remove(temp_filename.c_str());
+    }
+}
+
+}//namespace cura
@@ -0,0 +1,62 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#ifndef SLICE_CACHE_H
+#define SLICE_CACHE_H
+
+#include <string>
+
+#include "slicer.h"
+
+/*
+The slice cache stores the outlines and open lines produced by the Slicer on disk, so that printing the same mesh again
+with different printing settings (speeds, pause times, start/end code) doesn't have to slice it again.
+
+The cache is keyed on the contents of the mesh after it has been loaded, transformed and placed, together with the
+settings which influence the slicing itself. Everything from the layer parts onward is still computed on every run.
+*/
+
+namespace cura {
+
+/*!
+ * Compute a hash of the geometry of a mesh: the positions of its vertices and the vertices of its faces.
+ * 
+ * \param mesh The mesh
+ * \return The hash
+ */
+uint64_t meshHash(Mesh* mesh);
+
+/*!
+ * Compute the key under which the slicing of a mesh is stored.
+ * 
+ * \param mesh The mesh, after it has been transformed and placed on the build plate
+ * \param layer_z The height of each slice
+ * \param keep_none_closed Whether open polygons are kept (meshfix_keep_open_polygons)
+ * \param extensive_stitching Whether extensive stitching is used (meshfix_extensive_stitching)
+ * \param xy_offset The offset applied to the outlines (xy_offset)
+ * \return A hash of all data which determines the result of slicing
+ */
+uint64_t sliceCacheKey(Mesh* mesh, const std::vector<int>& layer_z, bool keep_none_closed, bool extensive_stitching, int xy_offset);
+
+/*!
+ * Fill the layers of a Slicer from the cache.
+ * 
+ * \param directory The cache directory
+ * \param key The key computed by sliceCacheKey
+ * \param slicer An unsliced Slicer with the layer heights set up; see Slicer::Slicer(const std::vector<int>&)
+ * \return Whether the cache held a valid entry; if not, the outlines of \p slicer are left empty
+ */
+bool loadSliceCache(const std::string& directory, uint64_t key, Slicer& slicer);
+
+/*!
+ * Store the outlines of all layers of a Slicer in the cache.
+ * 
+ * Failing to write the cache is not an error; the next run will simply slice again.
+ * 
+ * \param directory The cache directory
+ * \param key The key computed by sliceCacheKey
+ * \param slicer The Slicer holding the outlines
+ */
+void saveSliceCache(const std::string& directory, uint64_t key, Slicer& slicer);
+
+}//namespace cura
+
+#endif//SLICE_CACHE_H
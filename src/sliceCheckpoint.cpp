@@ -0,0 +1,366 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#include "sliceCheckpoint.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "layerCodec.h"
+#include "layerSpill.h"
+#include "settingRegistry.h"
+#include "utils/logoutput.h"
+#include "utils/varint.h"
+
+namespace cura {
+
+namespace
+{
+/*
+Layout of a checkpoint file:
+    the magic bytes "CURACKP" followed by the version of the format, "1"
+    the 8 byte key and the 8 byte offset of the index, little endian
+    the encoding of each layer of each mesh by encodeLayer, mesh by mesh
+    the index, of which all integers are varints:
+        the minimum and maximum corner of the model
+        the skirt, the raft outline and the wipe tower, as Polygons, and the wipe point
+        the number of layers of ooze shield, followed by the Polygons of each
+        whether the support is generated, the number of layers of support, followed by the Polygons of each
+        the number of meshes, and for each mesh: the index of its master plus one, the offset to it, the number of layers,
+            and for each layer its slice z, print z and the size of its encoding
+where Polygons are encoded by encodePolygons from the origin.
+*/
+const char checkpoint_magic[] = "CURACKP1";
+const unsigned int checkpoint_magic_size = 8;
+const unsigned int checkpoint_header_size = checkpoint_magic_size + 2 * sizeof(uint64_t);
+
+void writeUInt64(std::vector<unsigned char>& out, uint64_t value)
+{
+    for (unsigned int byte_idx = 0; byte_idx < sizeof(uint64_t); byte_idx++)
+    {
+        out.push_back(value >> (8 * byte_idx));
+    }
+}
+
+uint64_t readUInt64(const unsigned char* data)
+{
+    uint64_t value = 0;
+    for (unsigned int byte_idx = 0; byte_idx < sizeof(uint64_t); byte_idx++)
+    {
+        value |= uint64_t(data[byte_idx]) << (8 * byte_idx);
+    }
+    return value;
+}
+
+/*!
+ * The encoding of a layer, from wherever it is: in memory, frozen or spilled.
+ */
+void getLayerEncoding(SliceDataStorage& storage, unsigned int mesh_idx, unsigned int layer_nr, std::vector<unsigned char>& out)
+{
+    const SliceLayer& layer = storage.meshes[mesh_idx].layers[layer_nr];
+    if (layer.parts.empty() && layer.openLines.size() == 0)
+    {
+        if (!layer.compact.empty())
+        {
+            out = layer.compact;
+            return;
+        }
+        SliceLayer spilled;
+        if (storage.spill && storage.spill->load(mesh_idx, layer_nr, spilled))
+        {
+            encodeLayer(spilled, out);
+            return;
+        }
+    }
+    encodeLayer(layer, out);
+}
+}//namespace
+
+uint64_t checkpointKey(const std::vector<uint64_t>& mesh_hashes, const std::vector<std::map<std::string, std::string>>& settings)
+{
+    uint64_t hash = 14695981039346656037ull; // 64 bit FNV-1a
+    auto add = [&hash](const void* data, size_t size)
+    {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; i++)
+        {
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+    };
+    add(checkpoint_magic, checkpoint_magic_size);
+    for (uint64_t mesh_hash : mesh_hashes)
+    {
+        add(&mesh_hash, sizeof(mesh_hash));
+    }
+    const unsigned int processing_stages = (1u << Stage_Planning) - 1;
+    for (const std::map<std::string, std::string>& level : settings)
+    {
+        for (const std::pair<const std::string, std::string>& setting : level)
+        {
+            if (SettingRegistry::getInstance()->getSettingStages(setting.first) & processing_stages)
+            {
+                add(setting.first.c_str(), setting.first.size() + 1);
+                add(setting.second.c_str(), setting.second.size() + 1);
+            }
+        }
+        add("", 1); // the end of the level
+    }
+    return hash;
+}
+
+bool saveCheckpoint(const std::string& filename, uint64_t key, SliceDataStorage& storage, unsigned int layer_start, unsigned int layer_end)
+{
+    // Write to a temporary file first, so that an interrupted run never leaves a truncated checkpoint behind.
+    std::string temp_filename = filename + ".tmp";
+    FILE* f = fopen(temp_filename.c_str(), "wb");
+    if (!f)
+    {
+        logError("Cannot write the checkpoint %s\n", temp_filename.c_str());
+        return false;
+    }
+    std::vector<unsigned char> header(checkpoint_header_size, 0);
+    bool written = fwrite(header.data(), 1, header.size(), f) == header.size();
+
+    std::vector<unsigned char> index;
+    writeSignedVarInt(index, storage.model_min.x);
+    writeSignedVarInt(index, storage.model_min.y);
+    writeSignedVarInt(index, storage.model_min.z);
+    writeSignedVarInt(index, storage.model_max.x);
+    writeSignedVarInt(index, storage.model_max.y);
+    writeSignedVarInt(index, storage.model_max.z);
+    encodePolygons(storage.skirt, Point(0, 0), index);
+    encodePolygons(storage.raftOutline, Point(0, 0), index);
+    encodePolygons(storage.wipeTower, Point(0, 0), index);
+    writeSignedVarInt(index, storage.wipePoint.X);
+    writeSignedVarInt(index, storage.wipePoint.Y);
+    writeVarInt(index, storage.oozeShield.size());
+    for (const Polygons& shield : storage.oozeShield)
+    {
+        encodePolygons(shield, Point(0, 0), index);
+    }
+    writeVarInt(index, storage.support.generated);
+    writeVarInt(index, storage.support.supportAreasPerLayer.size());
+    for (const Polygons& support : storage.support.supportAreasPerLayer)
+    {
+        encodePolygons(support, Point(0, 0), index);
+    }
+    writeVarInt(index, storage.meshes.size());
+    uint64_t index_offset = checkpoint_header_size;
+    std::vector<unsigned char> layer_data;
+    for (unsigned int mesh_idx = 0; mesh_idx < storage.meshes.size() && written; mesh_idx++)
+    {
+        SliceMeshStorage& mesh = storage.meshes[mesh_idx];
+        writeVarInt(index, mesh.instance.master + 1);
+        writeSignedVarInt(index, mesh.instance.offset.X);
+        writeSignedVarInt(index, mesh.instance.offset.Y);
+        writeVarInt(index, mesh.layers.size());
+        for (unsigned int layer_nr = 0; layer_nr < mesh.layers.size() && written; layer_nr++)
+        {
+            layer_data.clear();
+            if (layer_nr >= layer_start && layer_nr < layer_end)
+            {
+                getLayerEncoding(storage, mesh_idx, layer_nr, layer_data);
+            }
+            else
+            {
+                encodeLayer(SliceLayer(), layer_data);
+            }
+            written = fwrite(layer_data.data(), 1, layer_data.size(), f) == layer_data.size();
+            index_offset += layer_data.size();
+            writeSignedVarInt(index, mesh.layers[layer_nr].sliceZ);
+            writeSignedVarInt(index, mesh.layers[layer_nr].printZ);
+            writeVarInt(index, layer_data.size());
+        }
+    }
+    written = written && fwrite(index.data(), 1, index.size(), f) == index.size();
+
+    header.assign(checkpoint_magic, checkpoint_magic + checkpoint_magic_size);
+    writeUInt64(header, key);
+    writeUInt64(header, index_offset);
+    written = written && fseek(f, 0, SEEK_SET) == 0 && fwrite(header.data(), 1, header.size(), f) == header.size();
+    written = (fclose(f) == 0) && written;
+    remove(filename.c_str());
+    if (!written || rename(temp_filename.c_str(), filename.c_str()) != 0)
+    {
+        logError("Cannot write the checkpoint %s\n", filename.c_str());
+        remove(temp_filename.c_str());
+        return false;
+    }
+    return true;
+}
+
+SliceCheckpoint::SliceCheckpoint(const std::string& filename)
+: filename(filename)
+, data(nullptr)
+, size(0)
+{
+#ifndef _WIN32
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0)
+    {
+        void* mapping = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED)
+        {
+            data = static_cast<const unsigned char*>(mapping);
+            size = file_stat.st_size;
+        }
+    }
+    close(fd); // the mapping stays
+#else
+    FILE* f = fopen(filename.c_str(), "rb");
+    if (!f)
+    {
+        return;
+    }
+    unsigned char buffer[1 << 16];
+    size_t read_size;
+    while ((read_size = fread(buffer, 1, sizeof(buffer), f)) > 0)
+    {
+        contents.insert(contents.end(), buffer, buffer + read_size);
+    }
+    fclose(f);
+    if (!contents.empty())
+    {
+        data = contents.data();
+        size = contents.size();
+    }
+#endif
+}
+
+SliceCheckpoint::~SliceCheckpoint()
+{
+#ifndef _WIN32
+    if (data)
+    {
+        munmap(const_cast<unsigned char*>(data), size);
+    }
+#endif
+}
+
+bool SliceCheckpoint::load(uint64_t key, std::vector<Mesh>& meshes, SliceDataStorage& storage)
+{
+    if (!data || size < checkpoint_header_size || memcmp(data, checkpoint_magic, checkpoint_magic_size) != 0)
+    {
+        return false;
+    }
+    uint64_t index_offset = readUInt64(data + checkpoint_magic_size + sizeof(uint64_t));
+    if (readUInt64(data + checkpoint_magic_size) != key || index_offset < checkpoint_header_size || index_offset > size)
+    {
+        return false;
+    }
+    VarIntReader reader(data, size, index_offset);
+    storage.model_min.x = reader.readSignedVarInt();
+    storage.model_min.y = reader.readSignedVarInt();
+    storage.model_min.z = reader.readSignedVarInt();
+    storage.model_max.x = reader.readSignedVarInt();
+    storage.model_max.y = reader.readSignedVarInt();
+    storage.model_max.z = reader.readSignedVarInt();
+    storage.model_size = storage.model_max - storage.model_min;
+    decodePolygons(reader, Point(0, 0), storage.skirt);
+    decodePolygons(reader, Point(0, 0), storage.raftOutline);
+    decodePolygons(reader, Point(0, 0), storage.wipeTower);
+    storage.wipePoint.X = reader.readSignedVarInt();
+    storage.wipePoint.Y = reader.readSignedVarInt();
+    storage.oozeShield.resize(reader.readCount());
+    for (Polygons& shield : storage.oozeShield)
+    {
+        decodePolygons(reader, Point(0, 0), shield);
+    }
+    storage.support.generated = reader.readVarInt();
+    storage.support.supportAreasPerLayer.resize(reader.readCount());
+    for (Polygons& support : storage.support.supportAreasPerLayer)
+    {
+        decodePolygons(reader, Point(0, 0), support);
+    }
+    if (reader.readVarInt() != meshes.size())
+    {
+        return false;
+    }
+    entries.assign(meshes.size(), std::vector<Entry>());
+    storage.meshes.reserve(meshes.size());
+    size_t layer_offset = checkpoint_header_size;
+    for (unsigned int mesh_idx = 0; mesh_idx < meshes.size() && !reader.failed; mesh_idx++)
+    {
+        storage.meshes.emplace_back(&meshes[mesh_idx]);
+        SliceMeshStorage& mesh = storage.meshes.back();
+        mesh.instance.master = int(reader.readVarInt()) - 1;
+        mesh.instance.offset.X = reader.readSignedVarInt();
+        mesh.instance.offset.Y = reader.readSignedVarInt();
+        mesh.layers.resize(reader.readCount());
+        entries[mesh_idx].resize(mesh.layers.size());
+        for (unsigned int layer_nr = 0; layer_nr < mesh.layers.size() && !reader.failed; layer_nr++)
+        {
+            mesh.layers[layer_nr].sliceZ = reader.readSignedVarInt();
+            mesh.layers[layer_nr].printZ = reader.readSignedVarInt();
+            size_t layer_size = reader.readVarInt();
+            if (layer_size > index_offset - layer_offset)
+            {
+                reader.failed = true;
+            }
+            entries[mesh_idx][layer_nr] = Entry{data + layer_offset, layer_size};
+            layer_offset += layer_size;
+        }
+        if (mesh.instance.master >= int(mesh_idx))
+        {
+            reader.failed = true;
+        }
+    }
+    if (reader.failed || reader.pos != size || layer_offset != index_offset)
+    {
+        logError("Ignoring corrupt checkpoint %s\n", filename.c_str());
+        entries.clear();
+        return false;
+    }
+    return true;
+}
+
+bool SliceCheckpoint::loadLayer(unsigned int mesh_idx, unsigned int layer_nr, SliceLayer& layer) const
+{
+    if (mesh_idx >= entries.size() || layer_nr >= entries[mesh_idx].size())
+    {
+        return false;
+    }
+    const Entry& entry = entries[mesh_idx][layer_nr];
+    if (!decodeLayer(entry.data, entry.size, layer))
+    {
+        logError("Layer %d in the checkpoint %s is corrupt\n", layer_nr, filename.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool SliceCheckpoint::takeLayers(std::shared_ptr<SliceCheckpoint> other, unsigned int layer_start, unsigned int layer_end)
+{
+    if (!other || other->entries.size() != entries.size())
+    {
+        return false;
+    }
+    for (unsigned int mesh_idx = 0; mesh_idx < entries.size(); mesh_idx++)
+    {
+        if (other->entries[mesh_idx].size() != entries[mesh_idx].size())
+        {
+            return false;
+        }
+    }
+    for (unsigned int mesh_idx = 0; mesh_idx < entries.size(); mesh_idx++)
+    {
+        for (unsigned int layer_nr = layer_start; layer_nr < std::min(layer_end, static_cast<unsigned int>(entries[mesh_idx].size())); layer_nr++)
+        {
+            entries[mesh_idx][layer_nr] = other->entries[mesh_idx][layer_nr];
+        }
+    }
+    sources.push_back(other);
+    return true;
+}
+
+}//namespace cura
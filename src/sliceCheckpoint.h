@@ -0,0 +1,113 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#ifndef SLICE_CHECKPOINT_H
+#define SLICE_CHECKPOINT_H
+
+#include <limits>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "sliceDataStorage.h"
+
+/*
+A checkpoint keeps a model as processSliceData leaves it, so that its GCode can be written again without loading, slicing
+and processing it: to rerun only the export with other export settings, to pick up a long job after a crash, or to
+profile the export on its own.
+
+The checkpoint file holds the encoding of layerCodec of each layer of each mesh, followed by an index with what concerns
+the model as a whole and where each layer is. It is memory mapped when it is read: only the index is read up front, and
+each layer is decoded straight from the mapping when the export gets to it, so a checkpoint opens at once however large
+it is, and its layers take no memory before they are written.
+*/
+
+namespace cura {
+
+/*!
+ * Compute the key of the checkpoint of a model: a hash of its meshes and of the settings on which processing it depends,
+ * which are all settings of the stages before Stage_Planning.
+ *
+ * \param mesh_hashes The meshHash of each mesh
+ * \param settings All settings of the processor, the object and each mesh
+ * \return The key
+ */
+uint64_t checkpointKey(const std::vector<uint64_t>& mesh_hashes, const std::vector<std::map<std::string, std::string>>& settings);
+
+/*!
+ * Write the checkpoint of a processed model. The layers packed away by spilling or freezing them are written as they
+ * are packed.
+ *
+ * Failing to write the checkpoint is not an error; the next run simply processes the model again.
+ *
+ * \param filename The checkpoint file
+ * \param key The key computed by checkpointKey
+ * \param storage The model after processSliceData
+ * \param layer_start The first layer of which the parts are written; the other layers are written empty
+ * \param layer_end The end of the layers of which the parts are written
+ * \return Whether the checkpoint was written
+ */
+bool saveCheckpoint(const std::string& filename, uint64_t key, SliceDataStorage& storage, unsigned int layer_start = 0, unsigned int layer_end = std::numeric_limits<unsigned int>::max());
+
+class SliceCheckpoint
+{
+public:
+    /*!
+     * Map a checkpoint file into memory.
+     */
+    SliceCheckpoint(const std::string& filename);
+
+    ~SliceCheckpoint();
+
+    /*!
+     * Whether the file could be mapped.
+     */
+    bool isOpen() const { return data != nullptr; }
+
+    /*!
+     * Fill a storage with the model as a whole and the heights of its layers. The parts of the layers stay in the
+     * checkpoint until they are read by loadLayer.
+     *
+     * \param key The key the checkpoint must have
+     * \param meshes The meshes of the model, for their settings
+     * \param storage An empty storage
+     * \return Whether the checkpoint has \p key and as many meshes, and could be read
+     */
+    bool load(uint64_t key, std::vector<Mesh>& meshes, SliceDataStorage& storage);
+
+    /*!
+     * Read the parts and open lines of a layer into \p layer. The comb of each part isn't kept, so it has to be
+     * prepared again. Safe to call for different layers at once.
+     *
+     * \return Whether the layer could be read
+     */
+    bool loadLayer(unsigned int mesh_idx, unsigned int layer_nr, SliceLayer& layer) const;
+
+    /*!
+     * Read some of the layers from another checkpoint of the same model from now on, as when the layers were processed
+     * in parts by distributed slicing. The other checkpoint is kept open for as long as this one.
+     *
+     * \param other The other checkpoint, already loaded with the same key
+     * \param layer_start The first layer to take from \p other
+     * \param layer_end The end of the layers to take from \p other
+     * \return Whether \p other has as many meshes and layers
+     */
+    bool takeLayers(std::shared_ptr<SliceCheckpoint> other, unsigned int layer_start, unsigned int layer_end);
+
+private:
+    struct Entry
+    {
+        const unsigned char* data;
+        size_t size;
+    };
+
+    std::string filename;
+    const unsigned char* data; //!< The contents of the file
+    size_t size; //!< The size of the file
+    std::vector<unsigned char> contents; //!< The contents of the file, where it can't be mapped
+    std::vector<std::vector<Entry>> entries; //!< Per mesh, for each layer where its encoding is
+    std::vector<std::shared_ptr<SliceCheckpoint>> sources; //!< The checkpoints layers were taken from by takeLayers
+};
+
+}//namespace cura
+
+#endif//SLICE_CHECKPOINT_H
@@ -0,0 +1,363 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#include "sliceDaemon.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <dirent.h>
+#include <fstream>
+#include <sstream>
+
+#include "fffProcessor.h"
+#include "settingRegistry.h"
+#include "utils/logoutput.h"
+#include "utils/string.h"
+
+namespace cura {
+
+SliceDaemon::SliceDaemon(const SettingsBase& default_settings, unsigned int worker_count, size_t memory_budget, std::ostream& status_output)
+: default_settings(default_settings.getAllSettings())
+, memory_budget(memory_budget)
+, status_output(status_output)
+, memory_in_use(0)
+, failed_count(0)
+, stopping(false)
+{
+    // Jobs only look up setting ids from here on, which is safe from several threads at once.
+    SettingRegistry::getInstance()->assignSettingIds();
+    for (unsigned int worker_idx = 0; worker_idx < std::max(1u, worker_count); worker_idx++)
+    {
+        workers.emplace_back([this]() { work(); });
+    }
+}
+
+SliceDaemon::~SliceDaemon()
+{
+    finish();
+}
+
+void SliceDaemon::finish()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    queue_changed.notify_all();
+    for (std::thread& worker : workers)
+    {
+        if (worker.joinable())
+        {
+            worker.join();
+        }
+    }
+}
+
+void SliceDaemon::run(std::istream& input)
+{
+    std::string line;
+    while (std::getline(input, line))
+    {
+        if (!handleCommand(line))
+        {
+            return;
+        }
+    }
+}
+
+bool SliceDaemon::handleCommand(const std::string& line)
+{
+    std::istringstream arguments(line);
+    std::string command;
+    if (!(arguments >> command))
+    {
+        return true; // an empty line
+    }
+    if (command == "slice")
+    {
+        handleSlice(arguments);
+    }
+    else if (command == "cancel")
+    {
+        handleCancel(arguments);
+    }
+    else if (command == "quit")
+    {
+        return false;
+    }
+    else
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        writeStatus("error", "unknown command " + command);
+    }
+    return true;
+}
+
+unsigned int SliceDaemon::queueDirectory(const std::string& model_dir, const std::string& output_dir)
+{
+    std::vector<std::string> names;
+    DIR* dir = opendir(model_dir.c_str());
+    if (!dir)
+    {
+        logError("Failed to open the directory %s\n", model_dir.c_str());
+        return 0;
+    }
+    for (dirent* entry = readdir(dir); entry; entry = readdir(dir))
+    {
+        std::string name = entry->d_name;
+        if (isModelFile(name.c_str()))
+        {
+            names.push_back(name);
+        }
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+
+    unsigned int queued_count = 0;
+    for (const std::string& name : names)
+    {
+        std::shared_ptr<Job> job(new Job);
+        job->name = name.substr(0, name.rfind('.'));
+        job->output_file = output_dir + "/" + job->name + ".gcode";
+        job->model_files.push_back(model_dir + "/" + name);
+        if (queueJob(job))
+        {
+            queued_count++;
+        }
+    }
+    return queued_count;
+}
+
+unsigned int SliceDaemon::getFailedCount()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return failed_count;
+}
+
+size_t SliceDaemon::estimateJobMemory(const std::vector<std::string>& model_files)
+{
+    size_t file_size = 0;
+    for (const std::string& model_file : model_files)
+    {
+        std::ifstream file(model_file, std::ios::binary | std::ios::ate);
+        if (file.is_open())
+        {
+            size_t compression = (model_file.size() > 4 && stringcasecompare(model_file.c_str() + model_file.size() - 4, ".3mf") == 0)? 6 : 1;
+            file_size += compression * size_t(file.tellg());
+        }
+    }
+    return 3 * file_size + 8 * 1024 * 1024;
+}
+
+void SliceDaemon::handleSlice(std::istream& arguments)
+{
+    std::shared_ptr<Job> job(new Job);
+    std::string error;
+    std::string argument;
+    if (!(arguments >> job->name))
+    {
+        error = "slice without a job name";
+    }
+    while (error.empty() && arguments >> argument)
+    {
+        if (argument == "-s")
+        {
+            std::string setting;
+            size_t value_pos;
+            if (!(arguments >> setting) || (value_pos = setting.find('=')) == std::string::npos)
+            {
+                error = "-s without <settingkey>=<value>";
+                break;
+            }
+            std::string key = setting.substr(0, value_pos);
+            if (!SettingRegistry::getInstance()->settingExists(key))
+            {
+                error = "unknown setting " + key; // unlike a setting given to the daemon, as a new key would have to be added to the registry while jobs run
+                break;
+            }
+            job->settings.emplace_back(key, setting.substr(value_pos + 1));
+        }
+        else if (argument == "-o")
+        {
+            if (!(arguments >> job->output_file))
+            {
+                error = "-o without an output file";
+            }
+        }
+        else
+        {
+            job->model_files.push_back(argument);
+        }
+    }
+    if (error.empty() && job->output_file.empty())
+    {
+        error = "no output file for job " + job->name;
+    }
+    if (error.empty() && job->model_files.empty())
+    {
+        error = "no model files for job " + job->name;
+    }
+    if (!error.empty())
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        writeStatus("error", error);
+        return;
+    }
+    queueJob(job);
+}
+
+bool SliceDaemon::queueJob(std::shared_ptr<Job> job)
+{
+    job->memory_estimate = estimateJobMemory(job->model_files);
+    job->processor = nullptr;
+    job->cancelled = false;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (jobs.find(job->name) != jobs.end())
+    {
+        writeStatus("error", "job " + job->name + " is already queued");
+        return false;
+    }
+    jobs[job->name] = job;
+    queue.push_back(job);
+    writeStatus(job->name, "queued");
+    queue_changed.notify_all();
+    return true;
+}
+
+void SliceDaemon::handleCancel(std::istream& arguments)
+{
+    std::string name;
+    arguments >> name;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto job_it = jobs.find(name);
+    if (job_it == jobs.end())
+    {
+        writeStatus("error", "no job " + name);
+        return;
+    }
+    std::shared_ptr<Job> job = job_it->second;
+    job->cancelled = true;
+    if (job->processor)
+    {
+        job->processor->cancel(); // the worker reports it once the processor has stopped
+        return;
+    }
+    auto queue_it = std::find(queue.begin(), queue.end(), job);
+    if (queue_it != queue.end())
+    {
+        queue.erase(queue_it);
+        jobs.erase(job_it);
+        writeStatus(name, "cancelled");
+        queue_changed.notify_all(); // the next job may fit in the memory budget now
+    }
+    // otherwise a worker has just taken the job, and won't start it
+}
+
+void SliceDaemon::work()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        queue_changed.wait(lock, [this]() { return (stopping && queue.empty()) || canStartNextJob(); });
+        if (queue.empty())
+        {
+            return;
+        }
+        std::shared_ptr<Job> job = queue.front();
+        queue.pop_front();
+        memory_in_use += job->memory_estimate;
+        lock.unlock();
+        runJob(*job);
+        lock.lock();
+        memory_in_use -= job->memory_estimate;
+        queue_changed.notify_all();
+    }
+}
+
+bool SliceDaemon::canStartNextJob()
+{
+    if (queue.empty())
+    {
+        return false;
+    }
+    return memory_budget == 0 || memory_in_use == 0 || memory_in_use + queue.front()->memory_estimate <= memory_budget;
+}
+
+void SliceDaemon::runJob(Job& job)
+{
+    std::unique_ptr<fffProcessor> processor(new fffProcessor());
+    for (const std::pair<const std::string, std::string>& setting : default_settings)
+    {
+        processor->setSetting(setting.first, setting.second);
+    }
+    for (const std::pair<std::string, std::string>& setting : job.settings)
+    {
+        processor->setSetting(setting.first, setting.second);
+    }
+    int reported_percent = 0;
+    processor->setProgressHandler([this, &job, &reported_percent](float progress)
+    {
+        int percent = progress * 100;
+        if (percent > reported_percent)
+        {
+            reported_percent = percent;
+            std::lock_guard<std::mutex> lock(mutex);
+            writeStatus(job.name, "progress " + std::to_string(percent));
+        }
+    });
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (job.cancelled)
+        {
+            jobs.erase(job.name);
+            writeStatus(job.name, "cancelled");
+            return;
+        }
+        job.processor = processor.get();
+        writeStatus(job.name, "started");
+    }
+
+    bool success = false;
+    if (!processor->setTargetFile(job.output_file.c_str()))
+    {
+        logError("Failed to open %s for output.\n", job.output_file.c_str());
+    }
+    else
+    {
+        try {
+            //Catch all exceptions, so that a job in which ClipperLib makes an internal error doesn't stop the other jobs.
+            success = processor->processFiles(job.model_files);
+            if (success)
+            {
+                processor->finalize();
+            }
+        }catch(...){
+            logError("Unknown exception in job %s\n", job.name.c_str());
+        }
+    }
+    bool cancelled = processor->isCancelled() && !processor->isMemoryLimitExceeded(); // a job over the memory limit failed
+    std::ostringstream result;
+    result << "done " << int(processor->getTotalPrintTime()) << " " << processor->getTotalFilamentUsed(0);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job.processor = nullptr;
+    }
+    processor.reset(); // closes the output file, so it's complete when the job is reported done
+    if (!success)
+    {
+        std::remove(job.output_file.c_str());
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    jobs.erase(job.name);
+    if (!success && !cancelled)
+    {
+        failed_count++;
+    }
+    writeStatus(job.name, success? result.str() : (cancelled? "cancelled" : "failed"));
+}
+
+void SliceDaemon::writeStatus(const std::string& job_name, const std::string& status)
+{
+    status_output << job_name << " " << status << std::endl;
+}
+
+}//namespace cura
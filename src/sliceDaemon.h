@@ -0,0 +1,158 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#ifndef SLICE_DAEMON_H
+#define SLICE_DAEMON_H
+
+#include <condition_variable>
+#include <deque>
+#include <istream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "settings.h"
+
+namespace cura {
+
+class fffProcessor;
+
+/*!
+ * Slices the jobs read from an input stream on a fixed number of worker threads, so that the setting definitions are
+ * loaded once for any number of jobs and a long job doesn't hold up the short ones queued after it.
+ * Every job is sliced by a processor of its own, with the settings given to the daemon and those given with the job.
+ *
+ * Each line of the input is a command:
+ *     slice <job> [-s <settingkey>=<value>]... -o <output.gcode> <model.stl>...
+ *     cancel <job>
+ *     quit
+ * The daemon finishes the queued and running jobs after a quit or at the end of the input. Names and paths can't hold spaces.
+ *
+ * For each job a line is written to the status output when it is queued, started and done:
+ *     <job> queued
+ *     <job> started
+ *     <job> progress <percent>
+ *     <job> done <print time in s> <filament of the first extruder in mm>
+ *     <job> failed
+ *     <job> cancelled
+ * An invalid command is answered with "error <message>". The output file of a failed or cancelled job is removed.
+ *
+ * The jobs can also be queued directly, e.g. all models in a directory for a batch run.
+ * With a memory budget a job only starts when the estimated memory of the running jobs leaves room for it, or when no
+ * other job runs. The jobs start in the order in which they were queued.
+ */
+class SliceDaemon
+{
+public:
+    /*!
+     * Start the workers.
+     *
+     * \param default_settings The settings for all jobs, to which the settings of each job are added
+     * \param worker_count The number of jobs to slice at once
+     * \param memory_budget The memory all running jobs may use together, in bytes, as estimated by estimateJobMemory; zero for no limit
+     * \param status_output Where the status of the jobs is written
+     */
+    SliceDaemon(const SettingsBase& default_settings, unsigned int worker_count, size_t memory_budget, std::ostream& status_output);
+
+    /*!
+     * Wait for the queued and running jobs to be done.
+     */
+    ~SliceDaemon();
+
+    /*!
+     * Wait for the queued and running jobs to be done, after which no more jobs are taken.
+     */
+    void finish();
+
+    /*!
+     * Handle the commands read from \p input until a quit command or the end of the input.
+     */
+    void run(std::istream& input);
+
+    /*!
+     * Handle a single command.
+     *
+     * \param line The command, without the line ending
+     * \return Whether more commands are accepted; false after a quit command
+     */
+    bool handleCommand(const std::string& line);
+
+    /*!
+     * Queue a job for each model file in a directory (see isModelFile), named after the file, with its G-code written to \p output_dir.
+     *
+     * \return The number of jobs queued
+     */
+    unsigned int queueDirectory(const std::string& model_dir, const std::string& output_dir);
+
+    /*!
+     * The number of jobs which failed so far.
+     */
+    unsigned int getFailedCount();
+
+    /*!
+     * A rough estimate of the memory used while slicing a model, from the size of its file: the peak memory measured for
+     * binary STL files is about three times their size, besides what every job needs; ASCII files take even less. 3MF
+     * files are counted as six times their size, as that is how much their model is typically deflated.
+     */
+    static size_t estimateJobMemory(const std::vector<std::string>& model_files);
+
+private:
+    struct Job
+    {
+        std::string name;
+        std::vector<std::pair<std::string, std::string>> settings; //!< The settings of this job only, in the order in which they were given
+        std::string output_file;
+        std::vector<std::string> model_files;
+        size_t memory_estimate; //!< See estimateJobMemory
+        fffProcessor* processor; //!< The processor slicing the job while it runs, or nullptr
+        bool cancelled;
+    };
+
+    std::map<std::string, std::string> default_settings;
+    size_t memory_budget; //!< The maximum of memory_in_use when more than one job runs; zero for no limit
+    std::ostream& status_output;
+    std::mutex mutex; //!< Guards all of the below and writing to status_output
+    std::condition_variable queue_changed; //!< Notified when a job is queued, when a job is done or when stopping
+    std::deque<std::shared_ptr<Job>> queue; //!< The jobs waiting for a worker
+    std::map<std::string, std::shared_ptr<Job>> jobs; //!< The queued and running jobs, by name
+    size_t memory_in_use; //!< The sum of the memory estimates of the running jobs
+    unsigned int failed_count;
+    bool stopping; //!< Whether the workers should stop once the queue is empty
+    std::vector<std::thread> workers;
+
+    void handleSlice(std::istream& arguments);
+    void handleCancel(std::istream& arguments);
+
+    /*!
+     * Queue a job, unless one with the same name is queued or running.
+     *
+     * \return Whether the job was queued
+     */
+    bool queueJob(std::shared_ptr<Job> job);
+
+    /*!
+     * Whether the first job of the queue fits in the memory budget. The mutex must be locked.
+     */
+    bool canStartNextJob();
+
+    /*!
+     * Run the jobs from the queue until stopping with an empty queue.
+     */
+    void work();
+
+    /*!
+     * Slice a job taken from the queue and report how it went.
+     */
+    void runJob(Job& job);
+
+    /*!
+     * Write a line to the status output. The mutex must be locked.
+     */
+    void writeStatus(const std::string& job_name, const std::string& status);
+};
+
+}//namespace cura
+
+#endif//SLICE_DAEMON_H
@@ -4,11 +4,18 @@
 
 #include "utils/intpoint.h"
 #include "utils/polygon.h"
+#include "utils/offsetCache.h"
+#include <memory>
+
 #include "mesh.h"
 #include "gcodePlanner.h"
+#include "settingsSnapshot.h"
 
 namespace cura 
 {
+class LayerSpill;
+class SliceCheckpoint;
+
 /*!
  * A SkinPart is a connected area designated as top and/or bottom skin. 
  * Surrounding each non-bridged skin area with an outline may result in better top skins.
@@ -21,6 +28,20 @@ public:
     std::vector<Polygons> insets;   //!< The skin can have perimeters so that the skin lines always start at a perimeter instead of in the middle of an infill cell.
     Polygons perimeterGaps;         //!< The gaps introduced by avoidOverlappingPerimeters which would otherwise be overlapping perimeters.
 };
+/*!
+ * The infill, skin, bridge and perimeter gap paths of a layer part, generated in parallel ahead of the export by
+ * fffProcessor.generateLayerToolpaths(.), so that planning the layer only has to order them.
+ */
+class PartToolpaths
+{
+public:
+    std::vector<Polygons> infill_lines;     //!< For each infill thickness (see SliceLayerPart::sparse_outline) the infill printed as lines
+    std::vector<Polygons> infill_polygons;  //!< For each infill thickness the infill printed as polygons
+    std::vector<Polygons> skin_perimeters;  //!< The insets of the skin parts, in the order they are printed
+    Polygons skin_polygons;                 //!< The concentric skin
+    Polygons skin_lines;                    //!< The skin, bridges and perimeter gaps printed as lines
+};
+
 /*!
     The SliceLayerPart is a single enclosed printable area for a single layer. (Also known as islands)
     It's filled during the fffProcessor.processSliceData(.), where each step uses data from the previous steps.
@@ -32,10 +53,13 @@ public:
     AABB boundaryBox;       //!< The boundaryBox is an axis-aligned bounardy box which is used to quickly check for possible collision between different parts on different layers. It's an optimalization used during skin calculations.
     Polygons outline;       //!< The outline is the first member that is filled, and it's filled with polygons that match a cross section of the 3D model. The first polygon is the outer boundary polygon and the rest are holes.
     Polygons combBoundery;  //!< The combBoundery is generated from the online. It's the area in which the nozzle tries to stay during traveling.
+    std::shared_ptr<Comb> comb; //!< The comb of the combBoundery, prepared at the end of fffProcessor.processSliceData(.) when combing is enabled; null otherwise.
     std::vector<Polygons> insets;         //!< The insets are generated with: an offset of (index * line_width + line_width/2) compared to the outline. The insets are also known as perimeters, and printed inside out.
     std::vector<SkinPart> skin_parts;     //!< The skin parts which are filled for 100% with lines and/or insets.
     std::vector<Polygons> sparse_outline; //!< The sparse_outline are the areas which need to be filled with sparse (0-99%) infill. The sparse_outline is an array to support thicker layers of sparse infill. sparse_outline[n] is sparse outline of (n+1) layers thick. 
     Polygons perimeterGaps; //!< The gaps introduced by avoidOverlappingPerimeters which would otherwise be overlapping perimeters.
+    std::shared_ptr<PartToolpaths> toolpaths; //!< The paths filling the part, generated ahead of the export; null until then.
+    OffsetCache inner_offsets; //!< The offsets of the last inset which the skin and sparse infill of the part share; cleared once they are generated.
 };
 
 /*!
@@ -49,6 +73,17 @@ public:
     int printZ;     //!< The height at which this layer needs to be printed. Can differ from sliceZ due to the raft.
     std::vector<SliceLayerPart> parts;  //!< An array of LayerParts which contain the actual data. The parts are printed one at a time to minimize travel outside of the 3D model.
     Polygons openLines; //!< A list of lines which were never hooked up into a 2D polygon. (Currently unused in normal operation)
+    std::vector<unsigned char> compact; //!< The parts and open lines encoded by freezeLayer while the layer is frozen; empty otherwise
+};
+
+/*!
+ * The paths of the support of a layer, generated ahead of the export like PartToolpaths.
+ */
+class SupportToolpaths
+{
+public:
+    std::vector<Polygons> islands;  //!< The support area split into islands
+    std::vector<Polygons> lines;    //!< For each island the lines filling it
 };
 
 /******************/
@@ -58,30 +93,41 @@ public:
     bool generated; //!< whether generateSupportGrid(.) has completed (successfully)
         
     std::vector<Polygons> supportAreasPerLayer;
+    std::vector<std::shared_ptr<SupportToolpaths>> toolpathsPerLayer; //!< For each layer the paths of the support once they are generated
 
-    SupportStorage(){}
+    SupportStorage() : generated(false) {}
     ~SupportStorage(){supportAreasPerLayer.clear(); }
 };
 /******************/
 
+/*!
+ * Whether a mesh is a copy of an earlier mesh moved over the build plate, as found by findMeshInstances.
+ */
+struct MeshInstance
+{
+    int master; //!< The index of the first mesh of which this mesh is a moved copy, or -1 if it isn't one
+    Point offset; //!< The distance from the master to this mesh
+
+    MeshInstance() : master(-1), offset(0, 0) {}
+    MeshInstance(int master, Point offset) : master(master), offset(offset) {}
+};
+
 class SliceMeshStorage
 {
 public:
     SettingsBase* settings;
+    MeshInstance instance; //!< The mesh of which the layers may be copied instead of generated, moved by its offset
+    std::shared_ptr<const SettingsSnapshot> settings_snapshot; //!< The \ref settings used in the per layer loops, resolved before processing
     std::vector<SliceLayer> layers;
 
     RetractionConfig retraction_config;
-    GCodePathConfig inset0_config;
-    GCodePathConfig insetX_config;
-    GCodePathConfig skin_config;
-    GCodePathConfig infill_config[MAX_SPARSE_COMBINE];
     
     SliceMeshStorage(SettingsBase* settings)
-    : settings(settings), inset0_config(&retraction_config, "WALL-OUTER"), insetX_config(&retraction_config, "WALL-INNER"), skin_config(&retraction_config, "SKIN")
+    : settings(settings)
     {
-        for(int n=0; n<MAX_SPARSE_COMBINE; n++)
-            infill_config[n] = GCodePathConfig(&retraction_config, "FILL");
     }
+
+    SliceMeshStorage& operator=(const SliceMeshStorage&) = delete;
 };
 
 class SliceDataStorage
@@ -94,16 +140,61 @@ public:
     std::vector<SliceMeshStorage> meshes;
 
     RetractionConfig retraction_config;
-    GCodePathConfig skirt_config;
-    GCodePathConfig support_config;
     
     SupportStorage support;
     Polygons wipeTower;
     Point wipePoint;
+    std::shared_ptr<LayerSpill> spill; //!< Where the layer parts are kept while they aren't in memory; null when they are all in memory. Shared by the copies of the storage.
+    bool compact_layers; //!< Whether the layers which aren't worked on are frozen into their compact encoding
+    std::shared_ptr<SliceCheckpoint> checkpoint; //!< Where the layer parts are read from when the storage was loaded from a checkpoint; null otherwise. Shared by the copies of the storage.
     
     SliceDataStorage()
-    : skirt_config(&retraction_config, "SKIRT"), support_config(&retraction_config, "SUPPORT")
+    : compact_layers(false)
+    {
+    }
+
+    SliceDataStorage& operator=(const SliceDataStorage&) = delete;
+};
+
+/*!
+ * The path configs of the paths of a mesh on a layer.
+ */
+class MeshPathConfigs
+{
+public:
+    GCodePathConfig inset0_config;
+    GCodePathConfig inset0_spiralize_config; //!< The outer wall once it is spiralized; the same as inset0_config but for that
+    GCodePathConfig insetX_config;
+    GCodePathConfig skin_config;
+    GCodePathConfig infill_config[MAX_SPARSE_COMBINE];
+
+    MeshPathConfigs(RetractionConfig* retraction_config)
+    : inset0_config(retraction_config, "WALL-OUTER"), inset0_spiralize_config(retraction_config, "WALL-OUTER"), insetX_config(retraction_config, "WALL-INNER"), skin_config(retraction_config, "SKIN")
+    {
+        for(int n=0; n<MAX_SPARSE_COMBINE; n++)
+            infill_config[n] = GCodePathConfig(retraction_config, "FILL");
+    }
+};
+
+/*!
+ * The path configs of a layer: the line width, speed, flow and layer thickness of each kind of path.
+ *
+ * These only differ between the first layers, which are slowed down, and between layers of a different thickness, so
+ * they are set once per job for each kind of layer and then only read. The layers planned in parallel can share them.
+ * They refer to the retraction configs of the storage they were set for.
+ */
+class LayerPathConfigs
+{
+public:
+    GCodePathConfig skirt_config;
+    GCodePathConfig support_config;
+    std::vector<MeshPathConfigs> meshes; //!< Per mesh of the storage
+
+    LayerPathConfigs(SliceDataStorage& storage)
+    : skirt_config(&storage.retraction_config, "SKIRT"), support_config(&storage.retraction_config, "SUPPORT")
     {
+        for(SliceMeshStorage& mesh : storage.meshes)
+            meshes.emplace_back(&mesh.retraction_config);
     }
 };
 
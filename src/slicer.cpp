@@ -1,15 +1,175 @@
 /** Copyright (C) 2013 David Braam - Released under terms of the AGPLv3 License */
 #include <stdio.h>
+#include <algorithm> // min, max, sort
+#include <cstdlib> // abs
+#include <queue> // priority_queue
 
 #include "utils/gettime.h"
 #include "utils/logoutput.h"
+#include "utils/parallel.h"
 
 #include "slicer.h"
+#include "gpuSlicer.h"
 #include "polygonOptimizer.h"
 
 namespace cura {
 
-void SlicerLayer::makePolygons(Mesh* mesh, bool keep_none_closed, bool extensive_stitching)
+namespace
+{
+
+/*!
+ * Steps trunc(rise * z_offset / run) from one layer to the next, where z_offset changes by the layer thickness, without
+ * dividing: the quotient and remainder are advanced by those of one layer step. Gives exactly the integer division of
+ * Slicer::project2D, as long as neither the sign of z_offset nor that of run changes, which holds while the plane
+ * crosses the same two edges of a face.
+ */
+class EdgeStepper
+{
+public:
+    void init(int64_t rise, int64_t z_offset, int64_t run, int64_t layer_step)
+    {
+        // trunc(n / d) = sign(n) * sign(d) * floor(|n| / |d|)
+        negative = (rise < 0) ^ (z_offset < 0) ^ (run < 0);
+        divisor = std::abs(run);
+        int64_t numerator = std::abs(rise) * std::abs(z_offset);
+        quotient = numerator / divisor;
+        remainder = numerator % divisor;
+        // |z_offset| grows with z when the plane is above the start of the edge and shrinks when it's below it
+        int64_t step = std::abs(rise) * layer_step * ((z_offset < 0)? -1 : 1);
+        step_quotient = step / divisor;
+        step_remainder = step % divisor;
+    }
+
+    void next()
+    {
+        quotient += step_quotient;
+        remainder += step_remainder;
+        if (remainder >= divisor)
+        {
+            remainder -= divisor;
+            quotient++;
+        }
+        else if (remainder < 0)
+        {
+            remainder += divisor;
+            quotient--;
+        }
+    }
+
+    int64_t value() const
+    {
+        return negative? -quotient : quotient;
+    }
+
+private:
+    int64_t quotient;
+    int64_t remainder; //!< Always in [0, divisor)
+    int64_t step_quotient;
+    int64_t step_remainder;
+    int64_t divisor;
+    bool negative;
+};
+
+/*!
+ * A face which the sweeping plane is passing through, with everything needed to cut it at the next layer.
+ *
+ * The plane cuts the two edges from the lowest vertex while it's above that vertex and at most at the middle one, and the
+ * two edges to the highest vertex while it's above the middle vertex and below the highest one. When the plane is at a
+ * vertex which isn't the only lowest one, it gives no segment, so that it isn't cut twice by the faces meeting there.
+ * Within each the cut moves along the same edges from layer to layer, so the steppers are only set up with a division
+ * when the plane enters it.
+ */
+struct ActiveFace
+{
+    enum Crossing { None, FromLowest, ToHighest };
+
+    unsigned int face_idx;
+    Point3 p[3];
+    int32_t z_mid; //!< The height of the middle vertex
+    unsigned char lowest; //!< The index of the lowest vertex; only used when it's the only one that low
+    unsigned char highest; //!< The index of the highest vertex; only used when it's the only one that high
+    Crossing crossing; //!< The edges the steppers follow
+    int32_t last_z; //!< The height for which the steppers hold the cut
+    int32_t step; //!< The distance by which the steppers step on to the next layer
+    EdgeStepper steppers[4]; //!< The start X and Y, and the end X and Y
+
+    ActiveFace(unsigned int face_idx, Mesh& mesh)
+    : face_idx(face_idx)
+    , crossing(None)
+    , last_z(0)
+    , step(0)
+    {
+        const MeshFace& face = mesh.faces[face_idx];
+        for (unsigned int i = 0; i < 3; i++)
+        {
+            p[i] = mesh.vertices[face.vertex_index[i]].p;
+        }
+        lowest = (p[0].z <= p[1].z)? ((p[0].z <= p[2].z)? 0 : 2) : ((p[1].z <= p[2].z)? 1 : 2);
+        highest = (p[0].z >= p[1].z)? ((p[0].z >= p[2].z)? 0 : 2) : ((p[1].z >= p[2].z)? 1 : 2);
+        z_mid = std::max(std::min(p[0].z, p[1].z), std::min(std::max(p[0].z, p[1].z), p[2].z));
+    }
+
+    /*!
+     * Cut the face at \p z, stepping on from the previous layer when it crossed the same edges as far below as the
+     * steppers step. Otherwise the steppers are set up anew, to step by \p next_step, the distance to the next layer.
+     *
+     * \return Whether the face produces a segment at this height
+     */
+    bool slice(int32_t z, int32_t next_step, SlicerSegment& result)
+    {
+        Crossing now = None;
+        if (p[lowest].z < z && z <= z_mid)
+        {
+            now = FromLowest;
+        }
+        else if (z_mid < z && z < p[highest].z)
+        {
+            now = ToHighest;
+        }
+        if (now == None)
+        {
+            crossing = None;
+            return false;
+        }
+
+        // The vertex the cut edges share, and the far ends of the edges of the start and the end of the segment, such that the
+        // segments run the same way around the outline.
+        unsigned int apex = (now == FromLowest)? lowest : highest;
+        const Point3& p0 = p[apex];
+        const Point3& p_start = p[(now == FromLowest)? (apex + 2) % 3 : (apex + 1) % 3];
+        const Point3& p_end = p[(now == FromLowest)? (apex + 1) % 3 : (apex + 2) % 3];
+        if (now != crossing || int64_t(z) - last_z != step)
+        {
+            step = next_step;
+            int64_t z_offset = int64_t(z) - p0.z;
+            steppers[0].init(int64_t(p_start.x) - p0.x, z_offset, int64_t(p_start.z) - p0.z, step);
+            steppers[1].init(int64_t(p_start.y) - p0.y, z_offset, int64_t(p_start.z) - p0.z, step);
+            steppers[2].init(int64_t(p_end.x) - p0.x, z_offset, int64_t(p_end.z) - p0.z, step);
+            steppers[3].init(int64_t(p_end.y) - p0.y, z_offset, int64_t(p_end.z) - p0.z, step);
+            crossing = now;
+        }
+        else
+        {
+            for (EdgeStepper& stepper : steppers)
+            {
+                stepper.next();
+            }
+        }
+        last_z = z;
+
+        result.start.X = p0.x + steppers[0].value();
+        result.start.Y = p0.y + steppers[1].value();
+        result.end.X = p0.x + steppers[2].value();
+        result.end.Y = p0.y + steppers[3].value();
+        result.faceIndex = face_idx;
+        result.addedToPolygon = false;
+        return true;
+    }
+};
+
+}//anonymous namespace
+
+void SlicerLayer::makePolygons(Mesh* mesh, bool keep_none_closed, bool extensive_stitching, int xy_offset)
 {
     Polygons openPolygonList;
 
@@ -33,17 +193,18 @@ void SlicerLayer::makePolygons(Mesh* mesh, bool keep_none_closed, bool extensive
             MeshFace* face = &mesh->faces[segmentList[segmentIndex].faceIndex];
             for(unsigned int i=0;i<3;i++)
             {
-                if (face->connected_face_index[i] > -1 && face_idx_to_segment_index.find(face->connected_face_index[i]) != face_idx_to_segment_index.end())
+                int connected_segment_idx = (face->connected_face_index[i] > -1)? face_idx_to_segment_index.find(face->connected_face_index[i]) : -1;
+                if (connected_segment_idx > -1)
                 {
-                    Point p1 = segmentList[face_idx_to_segment_index[face->connected_face_index[i]]].start;
+                    Point p1 = segmentList[connected_segment_idx].start;
                     Point diff = p0 - p1;
                     if (shorterThen(diff, MM2INT(0.01)))
                     {
-                        if (face_idx_to_segment_index[face->connected_face_index[i]] == static_cast<int>(startSegment))
+                        if (connected_segment_idx == static_cast<int>(startSegment))
                             canClose = true;
-                        if (segmentList[face_idx_to_segment_index[face->connected_face_index[i]]].addedToPolygon)
+                        if (segmentList[connected_segment_idx].addedToPolygon)
                             continue;
-                        nextIndex = face_idx_to_segment_index[face->connected_face_index[i]];
+                        nextIndex = connected_segment_idx;
                     }
                 }
             }
@@ -57,209 +218,129 @@ void SlicerLayer::makePolygons(Mesh* mesh, bool keep_none_closed, bool extensive
             openPolygonList.add(poly);
     }
     //Clear the segmentList to save memory, it is no longer needed after this point.
-    segmentList.clear();
+    std::vector<SlicerSegment>().swap(segmentList);
+    face_idx_to_segment_index.clear();
 
-    //Connecting polygons that are not closed yet, as models are not always perfect manifold we need to join some stuff up to get proper polygons
-    //First link up polygon ends that are within 2 microns.
-    for(unsigned int i=0;i<openPolygonList.size();i++)
+    // Open polygons only come from where the plane crosses a boundary or non-manifold edge (see Mesh::mayBeOpenAt), or from
+    // cuts of two faces rounded apart. A closed mesh hardly ever has any, so the stitching is skipped on the layers without.
+    if (openPolygonList.size() > 0)
     {
-        if (openPolygonList[i].size() < 1) continue;
-        for(unsigned int j=0;j<openPolygonList.size();j++)
-        {
-            if (openPolygonList[j].size() < 1) continue;
-
-            Point diff = openPolygonList[i][openPolygonList[i].size()-1] - openPolygonList[j][0];
-            int64_t distSquared = vSize2(diff);
-
-            if (distSquared < MM2INT(0.02) * MM2INT(0.02))
-            {
-                if (i == j)
-                {
-                    polygonList.add(openPolygonList[i]);
-                    openPolygonList[i].clear();
-                    break;
-                }else{
-                    for(unsigned int n=0; n<openPolygonList[j].size(); n++)
-                        openPolygonList[i].add(openPolygonList[j][n]);
+        //Connecting polygons that are not closed yet, as models are not always perfect manifold we need to join some stuff up to get proper polygons
+        //First link up polygon ends that are within 2 microns.
+        joinTouchingOpenPolygons(openPolygonList);
 
-                    openPolygonList[j].clear();
-                }
-            }
-        }
-    }
+        //Next link up all the missing ends, closing up the smallest gaps first.
+        closeSmallestGaps(openPolygonList);
 
-    //Next link up all the missing ends, closing up the smallest gaps first. This is an inefficient implementation which can run in O(n*n*n) time.
-    while(1)
-    {
-        int64_t bestScore = MM2INT(10.0) * MM2INT(10.0);
-        unsigned int bestA = -1;
-        unsigned int bestB = -1;
-        bool reversed = false;
-        for(unsigned int i=0;i<openPolygonList.size();i++)
+        if (extensive_stitching)
         {
-            if (openPolygonList[i].size() < 1) continue;
-            for(unsigned int j=0;j<openPolygonList.size();j++)
-            {
-                if (openPolygonList[j].size() < 1) continue;
-
-                Point diff = openPolygonList[i][openPolygonList[i].size()-1] - openPolygonList[j][0];
-                int64_t distSquared = vSize2(diff);
-                if (distSquared < bestScore)
-                {
-                    bestScore = distSquared;
-                    bestA = i;
-                    bestB = j;
-                    reversed = false;
-                }
-
-                if (i != j)
-                {
-                    Point diff = openPolygonList[i][openPolygonList[i].size()-1] - openPolygonList[j][openPolygonList[j].size()-1];
-                    int64_t distSquared = vSize2(diff);
-                    if (distSquared < bestScore)
-                    {
-                        bestScore = distSquared;
-                        bestA = i;
-                        bestB = j;
-                        reversed = true;
-                    }
-                }
-            }
-        }
+            //For extensive stitching find 2 open polygons that are touching 2 closed polygons.
+            // Then find the sortest path over this polygon that can be used to connect the open polygons,
+            // And generate a path over this shortest bit to link up the 2 open polygons.
+            // (If these 2 open polygons are the same polygon, then the final result is a closed polyon)
 
-        if (bestScore >= MM2INT(10.0) * MM2INT(10.0))
-            break;
-
-        if (bestA == bestB)
-        {
-            polygonList.add(openPolygonList[bestA]);
-            openPolygonList[bestA].clear();
-        }else{
-            if (reversed)
+            initEdgeGrid();
+            while(1)
             {
-                if (openPolygonList[bestA].polygonLength() > openPolygonList[bestB].polygonLength())
+                updateEdgeGrid();
+                unsigned int bestA = -1;
+                unsigned int bestB = -1;
+                gapCloserResult bestResult;
+                bestResult.len = POINT_MAX;
+                bestResult.polygonIdx = -1;
+                bestResult.pointIdxA = -1;
+                bestResult.pointIdxB = -1;
+
+                for(unsigned int i=0; i<openPolygonList.size(); i++)
                 {
-                    for(unsigned int n=openPolygonList[bestB].size()-1; int(n)>=0; n--)
-                        openPolygonList[bestA].add(openPolygonList[bestB][n]);
-                    openPolygonList[bestB].clear();
-                }else{
-                    for(unsigned int n=openPolygonList[bestA].size()-1; int(n)>=0; n--)
-                        openPolygonList[bestB].add(openPolygonList[bestA][n]);
-                    openPolygonList[bestA].clear();
-                }
-            }else{
-                for(unsigned int n=0; n<openPolygonList[bestB].size(); n++)
-                    openPolygonList[bestA].add(openPolygonList[bestB][n]);
-                openPolygonList[bestB].clear();
-            }
-        }
-    }
-
-    if (extensive_stitching)
-    {
-        //For extensive stitching find 2 open polygons that are touching 2 closed polygons.
-        // Then find the sortest path over this polygon that can be used to connect the open polygons,
-        // And generate a path over this shortest bit to link up the 2 open polygons.
-        // (If these 2 open polygons are the same polygon, then the final result is a closed polyon)
-
-        while(1)
-        {
-            unsigned int bestA = -1;
-            unsigned int bestB = -1;
-            gapCloserResult bestResult;
-            bestResult.len = POINT_MAX;
-            bestResult.polygonIdx = -1;
-            bestResult.pointIdxA = -1;
-            bestResult.pointIdxB = -1;
-
-            for(unsigned int i=0; i<openPolygonList.size(); i++)
-            {
-                if (openPolygonList[i].size() < 1) continue;
+                    if (openPolygonList[i].size() < 1) continue;
 
-                {
-                    gapCloserResult res = findPolygonGapCloser(openPolygonList[i][0], openPolygonList[i][openPolygonList[i].size()-1]);
-                    if (res.len > 0 && res.len < bestResult.len)
                     {
-                        bestA = i;
-                        bestB = i;
-                        bestResult = res;
+                        gapCloserResult res = findPolygonGapCloser(openPolygonList[i][0], openPolygonList[i][openPolygonList[i].size()-1]);
+                        if (res.len > 0 && res.len < bestResult.len)
+                        {
+                            bestA = i;
+                            bestB = i;
+                            bestResult = res;
+                        }
                     }
-                }
 
-                for(unsigned int j=0; j<openPolygonList.size(); j++)
-                {
-                    if (openPolygonList[j].size() < 1 || i == j) continue;
-
-                    gapCloserResult res = findPolygonGapCloser(openPolygonList[i][0], openPolygonList[j][openPolygonList[j].size()-1]);
-                    if (res.len > 0 && res.len < bestResult.len)
+                    for(unsigned int j=0; j<openPolygonList.size(); j++)
                     {
-                        bestA = i;
-                        bestB = j;
-                        bestResult = res;
+                        if (openPolygonList[j].size() < 1 || i == j) continue;
+
+                        gapCloserResult res = findPolygonGapCloser(openPolygonList[i][0], openPolygonList[j][openPolygonList[j].size()-1]);
+                        if (res.len > 0 && res.len < bestResult.len)
+                        {
+                            bestA = i;
+                            bestB = j;
+                            bestResult = res;
+                        }
                     }
                 }
-            }
 
-            if (bestResult.len < POINT_MAX)
-            {
-                if (bestA == bestB)
+                if (bestResult.len < POINT_MAX)
                 {
-                    if (bestResult.pointIdxA == bestResult.pointIdxB)
+                    if (bestA == bestB)
                     {
-                        polygonList.add(openPolygonList[bestA]);
-                        openPolygonList[bestA].clear();
-                    }
-                    else if (bestResult.AtoB)
-                    {
-                        PolygonRef poly = polygonList.newPoly();
-                        for(unsigned int j = bestResult.pointIdxA; j != bestResult.pointIdxB; j = (j + 1) % polygonList[bestResult.polygonIdx].size())
-                            poly.add(polygonList[bestResult.polygonIdx][j]);
-                        for(unsigned int j = openPolygonList[bestA].size() - 1; int(j) >= 0; j--)
-                            poly.add(openPolygonList[bestA][j]);
-                        openPolygonList[bestA].clear();
+                        if (bestResult.pointIdxA == bestResult.pointIdxB)
+                        {
+                            polygonList.add(openPolygonList[bestA]);
+                            openPolygonList[bestA].clear();
+                        }
+                        else if (bestResult.AtoB)
+                        {
+                            PolygonRef poly = polygonList.newPoly();
+                            for(unsigned int j = bestResult.pointIdxA; j != bestResult.pointIdxB; j = (j + 1) % polygonList[bestResult.polygonIdx].size())
+                                poly.add(polygonList[bestResult.polygonIdx][j]);
+                            for(unsigned int j = openPolygonList[bestA].size() - 1; int(j) >= 0; j--)
+                                poly.add(openPolygonList[bestA][j]);
+                            openPolygonList[bestA].clear();
+                        }
+                        else
+                        {
+                            unsigned int n = polygonList.size();
+                            polygonList.add(openPolygonList[bestA]);
+                            for(unsigned int j = bestResult.pointIdxB; j != bestResult.pointIdxA; j = (j + 1) % polygonList[bestResult.polygonIdx].size())
+                                polygonList[n].add(polygonList[bestResult.polygonIdx][j]);
+                            openPolygonList[bestA].clear();
+                        }
                     }
                     else
                     {
-                        unsigned int n = polygonList.size();
-                        polygonList.add(openPolygonList[bestA]);
-                        for(unsigned int j = bestResult.pointIdxB; j != bestResult.pointIdxA; j = (j + 1) % polygonList[bestResult.polygonIdx].size())
-                            polygonList[n].add(polygonList[bestResult.polygonIdx][j]);
-                        openPolygonList[bestA].clear();
+                        if (bestResult.pointIdxA == bestResult.pointIdxB)
+                        {
+                            for(unsigned int n=0; n<openPolygonList[bestA].size(); n++)
+                                openPolygonList[bestB].add(openPolygonList[bestA][n]);
+                            openPolygonList[bestA].clear();
+                        }
+                        else if (bestResult.AtoB)
+                        {
+                            Polygon poly;
+                            for(unsigned int n = bestResult.pointIdxA; n != bestResult.pointIdxB; n = (n + 1) % polygonList[bestResult.polygonIdx].size())
+                                poly.add(polygonList[bestResult.polygonIdx][n]);
+                            for(unsigned int n=poly.size()-1;int(n) >= 0; n--)
+                                openPolygonList[bestB].add(poly[n]);
+                            for(unsigned int n=0; n<openPolygonList[bestA].size(); n++)
+                                openPolygonList[bestB].add(openPolygonList[bestA][n]);
+                            openPolygonList[bestA].clear();
+                        }
+                        else
+                        {
+                            for(unsigned int n = bestResult.pointIdxB; n != bestResult.pointIdxA; n = (n + 1) % polygonList[bestResult.polygonIdx].size())
+                                openPolygonList[bestB].add(polygonList[bestResult.polygonIdx][n]);
+                            for(unsigned int n = openPolygonList[bestA].size() - 1; int(n) >= 0; n--)
+                                openPolygonList[bestB].add(openPolygonList[bestA][n]);
+                            openPolygonList[bestA].clear();
+                        }
                     }
                 }
                 else
                 {
-                    if (bestResult.pointIdxA == bestResult.pointIdxB)
-                    {
-                        for(unsigned int n=0; n<openPolygonList[bestA].size(); n++)
-                            openPolygonList[bestB].add(openPolygonList[bestA][n]);
-                        openPolygonList[bestA].clear();
-                    }
-                    else if (bestResult.AtoB)
-                    {
-                        Polygon poly;
-                        for(unsigned int n = bestResult.pointIdxA; n != bestResult.pointIdxB; n = (n + 1) % polygonList[bestResult.polygonIdx].size())
-                            poly.add(polygonList[bestResult.polygonIdx][n]);
-                        for(unsigned int n=poly.size()-1;int(n) >= 0; n--)
-                            openPolygonList[bestB].add(poly[n]);
-                        for(unsigned int n=0; n<openPolygonList[bestA].size(); n++)
-                            openPolygonList[bestB].add(openPolygonList[bestA][n]);
-                        openPolygonList[bestA].clear();
-                    }
-                    else
-                    {
-                        for(unsigned int n = bestResult.pointIdxB; n != bestResult.pointIdxA; n = (n + 1) % polygonList[bestResult.polygonIdx].size())
-                            openPolygonList[bestB].add(polygonList[bestResult.polygonIdx][n]);
-                        for(unsigned int n = openPolygonList[bestA].size() - 1; int(n) >= 0; n--)
-                            openPolygonList[bestB].add(openPolygonList[bestA][n]);
-                        openPolygonList[bestA].clear();
-                    }
+                    break;
                 }
             }
-            else
-            {
-                break;
-            }
+            clearEdgeGrid();
         }
     }
 
@@ -275,7 +356,7 @@ void SlicerLayer::makePolygons(Mesh* mesh, bool keep_none_closed, bool extensive
     for(unsigned int i=0;i<openPolygonList.size();i++)
     {
         if (openPolygonList[i].size() > 0)
-            openPolygons.newPoly() = openPolygonList[i];
+            openPolygons.add(openPolygonList[i]);
     }
 
     //Remove all the tiny polygons, or polygons that are not closed. As they do not contribute to the actual print.
@@ -302,7 +383,6 @@ void SlicerLayer::makePolygons(Mesh* mesh, bool keep_none_closed, bool extensive
 
     polygonList = polygonList.removeDegenerateVerts(); // remove verts connected to overlapping line segments
 
-    int xy_offset = mesh->getSettingInMicrons("xy_offset");
     if (xy_offset != 0)
     {
         polygonList = polygonList.offset(xy_offset);
@@ -310,66 +390,406 @@ void SlicerLayer::makePolygons(Mesh* mesh, bool keep_none_closed, bool extensive
 }
 
 
-Slicer::Slicer(Mesh* mesh, int initial, int thickness, int layer_count, bool keep_none_closed, bool extensive_stitching)
+void SlicerLayer::initEdgeGrid()
+{
+    clearEdgeGrid();
+    //Make the cells about as large as the average edge, so that an edge is in only a few cells
+    int64_t total_length = 0;
+    unsigned int edge_count = 0;
+    for(unsigned int n=0; n<polygonList.size(); n++)
+    {
+        total_length += polygonList[n].polygonLength();
+        edge_count += polygonList[n].size();
+    }
+    edge_grid = SpatialHashGrid<std::pair<unsigned int, unsigned int>>(std::max(int64_t(MM2INT(0.5)), (edge_count > 0)? total_length / edge_count : 0), edge_count);
+}
+
+void SlicerLayer::updateEdgeGrid()
+{
+    for(unsigned int n = polygon_arc_lengths.size(); n < polygonList.size(); n++)
+    {
+        PolygonRef poly = polygonList[n];
+        polygon_arc_lengths.emplace_back();
+        std::vector<int64_t>& arc_lengths = polygon_arc_lengths.back();
+        arc_lengths.reserve(poly.size() + 1);
+        arc_lengths.push_back(0);
+        for(unsigned int i=1; i<poly.size(); i++)
+            arc_lengths.push_back(arc_lengths.back() + vSize(poly[i-1] - poly[i]));
+        if (poly.size() > 0)
+            arc_lengths.push_back(arc_lengths.back() + vSize(poly[poly.size()-1] - poly[0]));
+
+        for(unsigned int i=0; i<poly.size(); i++)
+        {
+            edge_grid.insertSegment(poly[(i > 0)? i - 1 : poly.size() - 1], poly[i], std::make_pair(n, i));
+        }
+    }
+}
+
+void SlicerLayer::clearEdgeGrid()
+{
+    edge_grid.clear();
+    std::vector<std::vector<int64_t>>().swap(polygon_arc_lengths);
+}
+
+void SlicerLayer::joinTouchingOpenPolygons(Polygons& openPolygonList)
+{
+    const int64_t max_dist = MM2INT(0.02);
+    //The starts of the open polygons never move; a polygon only gets longer at its end, or it is cleared.
+    std::vector<std::pair<Point, unsigned int>> starts;
+    for(unsigned int j=0;j<openPolygonList.size();j++)
+    {
+        if (openPolygonList[j].size() < 1) continue;
+        starts.emplace_back(openPolygonList[j][0], j);
+    }
+    SpatialHashGrid<unsigned int> start_grid(max_dist);
+    start_grid.build(starts);
+
+    for(unsigned int i=0;i<openPolygonList.size();i++)
+    {
+        if (openPolygonList[i].size() < 1) continue;
+        //Link up with the polygons in order of their index, just like checking all polygons one by one would.
+        for(unsigned int j_min = 0; ; )
+        {
+            Point end = openPolygonList[i][openPolygonList[i].size()-1];
+            unsigned int best_j = -1;
+            countStat(Stat_StitchSearches);
+            start_grid.forEachNear(end, max_dist, [&](const Point& start, const Point&, unsigned int j)
+            {
+                if (j >= j_min && j < best_j && vSize2(end - start) < max_dist * max_dist)
+                {
+                    best_j = j;
+                }
+            });
+            if (best_j == static_cast<unsigned int>(-1))
+                break;
+
+            start_grid.remove(openPolygonList[best_j][0], best_j);
+            if (best_j == i)
+            {
+                polygonList.add(openPolygonList[i]);
+                openPolygonList[i].clear();
+                break;
+            }
+            for(unsigned int n=0; n<openPolygonList[best_j].size(); n++)
+                openPolygonList[i].add(openPolygonList[best_j][n]);
+            openPolygonList[best_j].clear();
+            j_min = best_j + 1;
+        }
+    }
+}
+
+namespace
 {
-    assert(layer_count > 0); //about if layer_count <= 0
+/*!
+ * A possible connection between the end of one open polygon and the start (or the end) of another.
+ * 
+ * Candidates are ordered the same way as a scan over all pairs of polygons would find them:
+ * smallest gap first, then on the polygon indices, then a normal connection before a reversed one.
+ */
+struct GapCandidate
+{
+    int64_t dist2; //!< The squared length of the gap
+    unsigned int a; //!< The polygon of which the end is connected
+    unsigned int b; //!< The polygon of which the start (or end when \p reversed) is connected
+    bool reversed; //!< Whether the end of \p a is connected to the end of \p b
+    unsigned int version_a; //!< The version of \p a when this candidate was found
+    unsigned int version_b; //!< The version of \p b when this candidate was found
+
+    bool operator>(const GapCandidate& other) const
+    {
+        if (dist2 != other.dist2) return dist2 > other.dist2;
+        if (a != other.a) return a > other.a;
+        if (b != other.b) return b > other.b;
+        return reversed > other.reversed;
+    }
+};
+}//namespace
 
-    layers.resize(layer_count); //resize vector to fit layer_count
+void SlicerLayer::closeSmallestGaps(Polygons& openPolygonList)
+{
+    const int64_t max_gap = MM2INT(10.0);
+    //Both ends of every open polygon are in the grid; a polygon is taken out when it changes and put back at its new ends.
+    SpatialHashGrid<unsigned int> end_grid(max_gap, openPolygonList.size() * 2);
+    //Every change to a polygon increases its version, which invalidates all candidates found for it before.
+    std::vector<unsigned int> versions(openPolygonList.size(), 0);
+    std::priority_queue<GapCandidate, std::vector<GapCandidate>, std::greater<GapCandidate>> candidates;
+
+    std::vector<unsigned int> nearby;
+    auto findNearby = [&](Point p)
+    {
+        nearby.clear();
+        countStat(Stat_StitchSearches);
+        end_grid.forEachNear(p, max_gap, [&](const Point&, const Point&, unsigned int k) { nearby.push_back(k); });
+        std::sort(nearby.begin(), nearby.end());
+        nearby.erase(std::unique(nearby.begin(), nearby.end()), nearby.end());
+    };
+    auto addCandidate = [&](int64_t dist2, unsigned int a, unsigned int b, bool reversed)
+    {
+        if (dist2 < max_gap * max_gap)
+        {
+            GapCandidate candidate = {dist2, a, b, reversed, versions[a], versions[b]};
+            candidates.push(candidate);
+        }
+    };
+    //Add the candidates connecting from the end of polygon \p p, and - if \p as_target - the candidates connecting to \p p from other polygons.
+    auto addCandidates = [&](unsigned int p, bool as_target)
+    {
+        Point start = openPolygonList[p][0];
+        Point end = openPolygonList[p][openPolygonList[p].size()-1];
+        findNearby(end);
+        for(unsigned int k : nearby)
+        {
+            if (openPolygonList[k].size() < 1) continue;
+            addCandidate(vSize2(end - openPolygonList[k][0]), p, k, false);
+            if (k != p)
+            {
+                int64_t dist2 = vSize2(end - openPolygonList[k][openPolygonList[k].size()-1]);
+                addCandidate(dist2, p, k, true);
+                if (as_target)
+                    addCandidate(dist2, k, p, true);
+            }
+        }
+        if (as_target)
+        {
+            findNearby(start);
+            for(unsigned int k : nearby)
+            {
+                if (k == p || openPolygonList[k].size() < 1) continue;
+                addCandidate(vSize2(openPolygonList[k][openPolygonList[k].size()-1] - start), k, p, false);
+            }
+        }
+    };
+
+    auto insertEnds = [&](unsigned int p)
+    {
+        end_grid.insert(openPolygonList[p][0], p);
+        end_grid.insert(openPolygonList[p][openPolygonList[p].size()-1], p);
+    };
+    auto removeEnds = [&](unsigned int p)
+    {
+        end_grid.remove(openPolygonList[p][0], p);
+        end_grid.remove(openPolygonList[p][openPolygonList[p].size()-1], p);
+    };
+
+    for(unsigned int i=0;i<openPolygonList.size();i++)
+    {
+        if (openPolygonList[i].size() < 1) continue;
+        insertEnds(i);
+    }
+    for(unsigned int i=0;i<openPolygonList.size();i++)
+    {
+        if (openPolygonList[i].size() < 1) continue;
+        addCandidates(i, false);
+    }
+
+    while(!candidates.empty())
+    {
+        GapCandidate best = candidates.top();
+        candidates.pop();
+        unsigned int bestA = best.a;
+        unsigned int bestB = best.b;
+        if (openPolygonList[bestA].size() < 1 || openPolygonList[bestB].size() < 1 || versions[bestA] != best.version_a || versions[bestB] != best.version_b)
+            continue; // outdated candidate
+
+        removeEnds(bestA);
+        if (bestB != bestA)
+            removeEnds(bestB);
+        unsigned int changed;
+        if (bestA == bestB)
+        {
+            polygonList.add(openPolygonList[bestA]);
+            openPolygonList[bestA].clear();
+            continue;
+        }else{
+            if (best.reversed)
+            {
+                if (openPolygonList[bestA].polygonLength() > openPolygonList[bestB].polygonLength())
+                {
+                    for(unsigned int n=openPolygonList[bestB].size()-1; int(n)>=0; n--)
+                        openPolygonList[bestA].add(openPolygonList[bestB][n]);
+                    openPolygonList[bestB].clear();
+                    changed = bestA;
+                }else{
+                    for(unsigned int n=openPolygonList[bestA].size()-1; int(n)>=0; n--)
+                        openPolygonList[bestB].add(openPolygonList[bestA][n]);
+                    openPolygonList[bestA].clear();
+                    changed = bestB;
+                }
+            }else{
+                for(unsigned int n=0; n<openPolygonList[bestB].size(); n++)
+                    openPolygonList[bestA].add(openPolygonList[bestB][n]);
+                openPolygonList[bestB].clear();
+                changed = bestA;
+            }
+        }
+        versions[changed]++;
+        insertEnds(changed);
+        addCandidates(changed, true);
+    }
+}
 
+std::vector<int> Slicer::getUniformLayerZ(int initial, int thickness, int layer_count)
+{
+    std::vector<int> layer_z(layer_count);
     for(int32_t layer_nr = 0; layer_nr < layer_count; layer_nr++)
     {
-        layers[layer_nr].z = initial + thickness * layer_nr;//set z value of each layer
+        layer_z[layer_nr] = initial + thickness * layer_nr;
     }
-    //find all segments in each layer
-    for(unsigned int i=0; i<mesh->faces.size(); i++)
+    return layer_z;
+}
+
+Slicer::Slicer(int initial, int thickness, int layer_count)
+: Slicer(getUniformLayerZ(initial, thickness, layer_count))
+{
+}
+
+Slicer::Slicer(const std::vector<int>& layer_z)
+{
+    assert(layer_z.size() > 0); //about if layer_count <= 0
+
+    layers.resize(layer_z.size()); //resize vector to fit layer_count
+
+    for(unsigned int layer_nr = 0; layer_nr < layer_z.size(); layer_nr++)
+    {
+        layers[layer_nr].z = layer_z[layer_nr];//set z value of each layer
+    }
+}
+
+void Slicer::findSegments(Mesh* mesh, unsigned int thread_count)
+{
+    int layer_count = layers.size();
+
+    //find all segments in each layer, sweeping a plane upward through the faces sorted on their lowest point
+    unsigned int face_count = mesh->faces.size();
+    std::vector<int32_t> face_min_z(face_count);
+    std::vector<int32_t> face_max_z(face_count);
+    std::vector<unsigned int> faces_by_min_z(face_count);
+    for(unsigned int i=0; i<face_count; i++)
     {
         MeshFace& face = mesh->faces[i];
-        Point3 p0 = mesh->vertices[face.vertex_index[0]].p;
-        Point3 p1 = mesh->vertices[face.vertex_index[1]].p;
-        Point3 p2 = mesh->vertices[face.vertex_index[2]].p;
-        int32_t minZ = p0.z;
-        int32_t maxZ = p0.z;
-        if (p1.z < minZ) minZ = p1.z;
-        if (p2.z < minZ) minZ = p2.z;
-        if (p1.z > maxZ) maxZ = p1.z;
-        if (p2.z > maxZ) maxZ = p2.z;
-
-        for(int32_t layer_nr = (minZ - initial) / thickness; layer_nr <= (maxZ - initial) / thickness; layer_nr++)
+        int32_t z0 = mesh->vertices[face.vertex_index[0]].p.z;
+        int32_t z1 = mesh->vertices[face.vertex_index[1]].p.z;
+        int32_t z2 = mesh->vertices[face.vertex_index[2]].p.z;
+        face_min_z[i] = std::min(z0, std::min(z1, z2));
+        face_max_z[i] = std::max(z0, std::max(z1, z2));
+        faces_by_min_z[i] = i;
+    }
+    std::stable_sort(faces_by_min_z.begin(), faces_by_min_z.end(), [&face_min_z](unsigned int a, unsigned int b) { return face_min_z[a] < face_min_z[b]; });
+
+    //Each thread sweeps a consecutive range of layers with its own list of active faces.
+    unsigned int chunk_count = std::min(thread_count, static_cast<unsigned int>(layer_count));
+    parallelFor(chunk_count, thread_count, [&](unsigned int chunk_idx)
+    {
+        TRACE_ZONE("slice faces");
+        unsigned int layer_start = uint64_t(layer_count) * chunk_idx / chunk_count;
+        unsigned int layer_end = uint64_t(layer_count) * (chunk_idx + 1) / chunk_count;
+        std::vector<ActiveFace> active_faces;
+        unsigned int next_face = 0;
+        for(unsigned int layer_nr = layer_start; layer_nr < layer_end; layer_nr++)
         {
-            int32_t z = layer_nr * thickness + initial;
-            if (z < minZ) continue;
-            if (layer_nr < 0) continue;
-
-            SlicerSegment s;
-            if (p0.z < z && p1.z >= z && p2.z >= z)
-                s = project2D(p0, p2, p1, z);
-            else if (p0.z > z && p1.z < z && p2.z < z)
-                s = project2D(p0, p1, p2, z);
-
-            else if (p1.z < z && p0.z >= z && p2.z >= z)
-                s = project2D(p1, p0, p2, z);
-            else if (p1.z > z && p0.z < z && p2.z < z)
-                s = project2D(p1, p2, p0, z);
-
-            else if (p2.z < z && p1.z >= z && p0.z >= z)
-                s = project2D(p2, p1, p0, z);
-            else if (p2.z > z && p1.z < z && p0.z < z)
-                s = project2D(p2, p0, p1, z);
-            else
+            SlicerLayer& layer = layers[layer_nr];
+            int32_t z = layer.z;
+            // the distance to the next layer, which the faces step their cuts on by; the last layer has none, so any will do
+            int32_t next_step = (layer_nr + 1 < layers.size())? layers[layer_nr + 1].z - z : 1;
+            for(; next_face < face_count && face_min_z[faces_by_min_z[next_face]] <= z; next_face++)
             {
-                //Not all cases create a segment, because a point of a face could create just a dot, and two touching faces
-                //  on the slice would create two segments
-                continue;
+                active_faces.emplace_back(faces_by_min_z[next_face], *mesh);
             }
-            layers[layer_nr].face_idx_to_segment_index[i] = layers[layer_nr].segmentList.size();
-            s.faceIndex = i;
-            s.addedToPolygon = false;
-            layers[layer_nr].segmentList.push_back(s);
+            active_faces.erase(std::remove_if(active_faces.begin(), active_faces.end(), [&face_max_z, z](const ActiveFace& face) { return face_max_z[face.face_idx] < z; }), active_faces.end());
+
+            layer.segmentList.reserve(active_faces.size());
+            for(ActiveFace& face : active_faces)
+            {
+                SlicerSegment s;
+                if (face.slice(z, next_step, s))
+                {
+                    layer.segmentList.push_back(s);
+                }
+            }
+            //Keep the segments in the order of the faces, so that the polygons come out exactly the same as when looping over the faces.
+            std::sort(layer.segmentList.begin(), layer.segmentList.end(), [](const SlicerSegment& a, const SlicerSegment& b) { return a.faceIndex < b.faceIndex; });
+        }
+    });
+}
+
+Slicer::Slicer(Mesh* mesh, int initial, int thickness, int layer_count, bool keep_none_closed, bool extensive_stitching)
+: Slicer(mesh, getUniformLayerZ(initial, thickness, layer_count), keep_none_closed, extensive_stitching)
+{
+}
+
+Slicer::Slicer(Mesh* mesh, const std::vector<int>& layer_z, bool keep_none_closed, bool extensive_stitching)
+: Slicer(layer_z)
+{
+    int layer_count = layer_z.size();
+    unsigned int thread_count = getThreadCount(mesh->getSettingAsCount("machine_thread_count"));
+    int xy_offset = mesh->getSettingInMicrons("xy_offset"); // read before going parallel; reading a default value of a setting inserts it into the settings map
+
+    std::string backend = mesh->getSettingString("machine_slice_backend");
+    bool on_gpu = false;
+    if (backend == "opencl")
+    {
+        if (haveGPUSlicing())
+        {
+            on_gpu = sliceSegmentsOnGPU(*mesh, layers, thread_count);
+        }
+        else
+        {
+            logWarningOnce("machine_slice_backend", "Built without the OpenCL backend (ENABLE_OPENCL); slicing on the CPU\n");
+        }
+    }
+    else if (backend != "cpu")
+    {
+        logWarningOnce("machine_slice_backend", "Unknown machine_slice_backend %s; slicing on the CPU\n", backend.c_str());
+    }
+    if (!on_gpu)
+    {
+        findSegments(mesh, thread_count);
+    }
+    else if (mesh->getSettingBoolean("machine_slice_backend_check"))
+    {
+        // The sweep on the CPU is the reference; any layer on which the GPU differs from it gets the segments of the CPU.
+        Slicer reference(layer_z);
+        reference.findSegments(mesh, thread_count);
+        unsigned int differing_layer_count = 0;
+        for(int layer_nr = 0; layer_nr < layer_count; layer_nr++)
+        {
+            std::vector<SlicerSegment>& segments = layers[layer_nr].segmentList;
+            std::vector<SlicerSegment>& reference_segments = reference.layers[layer_nr].segmentList;
+            if (segments.size() != reference_segments.size() || !std::equal(segments.begin(), segments.end(), reference_segments.begin(), [](const SlicerSegment& a, const SlicerSegment& b)
+                {
+                    return a.start == b.start && a.end == b.end && a.faceIndex == b.faceIndex;
+                }))
+            {
+                segments.swap(reference_segments);
+                differing_layer_count++;
+            }
+        }
+        if (differing_layer_count > 0)
+        {
+            logError("The segments of the OpenCL backend differ from those of the CPU on %u of %d layers; using those of the CPU\n", differing_layer_count, layer_count);
+        }
+        else
+        {
+            log("The segments of the OpenCL backend are the same as those of the CPU on all %d layers\n", layer_count);
         }
     }
-    for(unsigned int layer_nr=0; layer_nr<layers.size(); layer_nr++)
+
+    parallelFor(layer_count, thread_count, [&](unsigned int layer_nr)
     {
-        layers[layer_nr].makePolygons(mesh, keep_none_closed, extensive_stitching);
+        TRACE_ZONE("makePolygons", layer_nr);
+        StatsScope stats_scope(getStatsContext().stage, layer_nr);
+        layers[layer_nr].face_idx_to_segment_index.build(layers[layer_nr].segmentList);
+        layers[layer_nr].makePolygons(mesh, keep_none_closed, extensive_stitching, xy_offset);
+    });
+
+    if (mesh->boundary_edge_count > 0 || mesh->non_manifold_edge_count > 0)
+    {
+        unsigned int open_layer_count = 0;
+        for(SlicerLayer& layer : layers)
+        {
+            open_layer_count += mesh->mayBeOpenAt(layer.z);
+        }
+        log("%u of %u layers cross an edge where the mesh isn't closed and may need stitching\n", open_layer_count, static_cast<unsigned int>(layers.size()));
     }
 }
 
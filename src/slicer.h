@@ -4,6 +4,7 @@
 
 #include "mesh.h"
 #include "utils/polygon.h"
+#include "utils/SpatialHashGrid.h"
 /*
     The Slicer creates layers of polygons from an optimized 3D model.
     The result of the Slicer is a list of polygons without any order or structure.
@@ -36,21 +37,162 @@ public:
     bool AtoB;
 };
 
+/*!
+ * Flat lookup table from the index of a face to the index of the segment it produced in a layer.
+ * 
+ * Uses open addressing with linear probing in a single array, which is a lot faster to build and query than a tree.
+ * A face produces at most one segment per layer, so the keys are unique.
+ */
+class FaceSegmentIndex
+{
+public:
+    FaceSegmentIndex()
+    : bits(0)
+    {
+    }
+
+    /*!
+     * Fill the table with all segments of a layer.
+     * 
+     * \param segments The segments of the layer
+     */
+    void build(const std::vector<SlicerSegment>& segments)
+    {
+        bits = 1;
+        while ((1u << bits) < segments.size() * 2)
+        {
+            bits++;
+        }
+        table.assign(1u << bits, std::make_pair(-1, -1));
+        unsigned int mask = table.size() - 1;
+        for (unsigned int segment_idx = 0; segment_idx < segments.size(); segment_idx++)
+        {
+            unsigned int slot = hash(segments[segment_idx].faceIndex);
+            while (table[slot].first != -1)
+            {
+                slot = (slot + 1) & mask;
+            }
+            table[slot] = std::make_pair(segments[segment_idx].faceIndex, int(segment_idx));
+        }
+    }
+
+    /*!
+     * Get the index of the segment produced by a face.
+     * 
+     * \param face_idx The index of the face
+     * \return The index of the segment, or -1 if the face produced no segment in this layer
+     */
+    int find(int face_idx) const
+    {
+        if (table.empty())
+        {
+            return -1;
+        }
+        unsigned int mask = table.size() - 1;
+        for (unsigned int slot = hash(face_idx); table[slot].first != -1; slot = (slot + 1) & mask)
+        {
+            if (table[slot].first == face_idx)
+            {
+                return table[slot].second;
+            }
+        }
+        return -1;
+    }
+
+    void clear()
+    {
+        std::vector<std::pair<int, int>>().swap(table);
+    }
+
+private:
+    std::vector<std::pair<int, int>> table; //!< (face index, segment index) pairs; -1 as face index for an empty slot
+    unsigned int bits; //!< The table size is 2 to the power \p bits
+
+    unsigned int hash(int face_idx) const
+    {
+        return (uint32_t(face_idx) * 2654435769u) >> (32 - bits); // Fibonacci hashing
+    }
+};
+
 class SlicerLayer
 {
 public:
     std::vector<SlicerSegment> segmentList;
-    std::map<int, int> face_idx_to_segment_index;
+    FaceSegmentIndex face_idx_to_segment_index;
 
     int z;
     Polygons polygonList;
     Polygons openPolygons;
 
-    void makePolygons(Mesh* mesh, bool keepNoneClosed, bool extensiveStitching);
+    /*!
+     * Connect the segments of this layer into polygons and clean them up.
+     * 
+     * Only touches the data of this layer, so different layers can be processed concurrently.
+     * 
+     * \param mesh The mesh from which the segments were sliced
+     * \param keepNoneClosed Whether to keep polygons which could not be closed
+     * \param extensiveStitching Whether to stitch open polygons together using parts of closed polygons
+     * \param xy_offset The offset to apply to the resulting polygons
+     */
+    void makePolygons(Mesh* mesh, bool keepNoneClosed, bool extensiveStitching, int xy_offset);
 
 private:
+    /*!
+     * Link up open polygons of which the end is within 20 micron of the start of another (or the same) open polygon.
+     * 
+     * Uses a grid on the starts of the polygons, so that it doesn't need to check every pair of polygons.
+     * 
+     * \param openPolygonList The open polygons; linked polygons are cleared and closed ones are moved to SlicerLayer::polygonList
+     */
+    void joinTouchingOpenPolygons(Polygons& openPolygonList);
+
+    /*!
+     * Link up the ends of open polygons, closing up the smallest gaps (up to 10mm) first.
+     * 
+     * The candidate gaps are found using a grid on the polygon ends and processed from a priority queue,
+     * which gives the same result as repeatedly checking all pairs of polygons for the smallest gap.
+     * 
+     * \param openPolygonList The open polygons; linked polygons are cleared and closed ones are moved to SlicerLayer::polygonList
+     */
+    void closeSmallestGaps(Polygons& openPolygonList);
+
+    /*!
+     * The edges of SlicerLayer::polygonList, used by extensive stitching.
+     * 
+     * Each edge is stored as a (polygon index, point index) pair, where the edge runs from point index - 1 to point index.
+     */
+    SpatialHashGrid<std::pair<unsigned int, unsigned int>> edge_grid;
+    std::vector<std::vector<int64_t>> polygon_arc_lengths; //!< For each polygon in SlicerLayer::polygonList the length from its first point up to each point, with the total length as last element
+
+    /*!
+     * Prepare the edge grid and arc lengths for the closed polygons, which speed up findPolygonGapCloser.
+     */
+    void initEdgeGrid();
+
+    /*!
+     * Add polygons which have been added to SlicerLayer::polygonList to the edge grid and arc lengths.
+     */
+    void updateEdgeGrid();
+
+    /*!
+     * Free the memory of the edge grid and arc lengths.
+     */
+    void clearEdgeGrid();
+
+    /*!
+     * The length of the polygon from point \p from up to point \p to, following the point order (and wrapping around).
+     */
+    int64_t arcLength(unsigned int poly_idx, unsigned int from, unsigned int to) const
+    {
+        const std::vector<int64_t>& lengths = polygon_arc_lengths[poly_idx];
+        if (to >= from)
+            return lengths[to] - lengths[from];
+        return lengths.back() - lengths[from] + lengths[to];
+    }
+
     gapCloserResult findPolygonGapCloser(Point ip0, Point ip1)
     {
+        countStat(Stat_StitchSearches);
         gapCloserResult ret;
         closePolygonResult c1 = findPolygonPointClosestTo(ip0);
         closePolygonResult c2 = findPolygonPointClosestTo(ip1);
@@ -70,25 +212,11 @@ private:
             ret.len = vSize(ip0 - ip1);
         }else{
             //Find out if we have should go from A to B or the other way around.
-            Point p0 = polygonList[ret.polygonIdx][ret.pointIdxA];
-            int64_t lenA = vSize(p0 - ip0);
-            for(unsigned int i = ret.pointIdxA; i != ret.pointIdxB; i = (i + 1) % polygonList[ret.polygonIdx].size())
-            {
-                Point p1 = polygonList[ret.polygonIdx][i];
-                lenA += vSize(p0 - p1);
-                p0 = p1;
-            }
-            lenA += vSize(p0 - ip1);
-
-            p0 = polygonList[ret.polygonIdx][ret.pointIdxB];
-            int64_t lenB = vSize(p0 - ip1);
-            for(unsigned int i = ret.pointIdxB; i != ret.pointIdxA; i = (i + 1) % polygonList[ret.polygonIdx].size())
-            {
-                Point p1 = polygonList[ret.polygonIdx][i];
-                lenB += vSize(p0 - p1);
-                p0 = p1;
-            }
-            lenB += vSize(p0 - ip0);
+            PolygonRef poly = polygonList[ret.polygonIdx];
+            unsigned int before_B = (ret.pointIdxB + poly.size() - 1) % poly.size();
+            unsigned int before_A = (ret.pointIdxA + poly.size() - 1) % poly.size();
+            int64_t lenA = vSize(poly[ret.pointIdxA] - ip0) + arcLength(ret.polygonIdx, ret.pointIdxA, before_B) + vSize(poly[before_B] - ip1);
+            int64_t lenB = vSize(poly[ret.pointIdxB] - ip1) + arcLength(ret.polygonIdx, ret.pointIdxB, before_A) + vSize(poly[before_A] - ip0);
 
             if (lenA < lenB)
             {
@@ -102,38 +230,42 @@ private:
         return ret;
     }
 
+    /*!
+     * Find the first edge (in the order of SlicerLayer::polygonList) which passes within 100 micron of \p input.
+     * 
+     * Only the edges in the edge grid cells around \p input are checked.
+     */
     closePolygonResult findPolygonPointClosestTo(Point input)
     {
         closePolygonResult ret;
-        for(unsigned int n=0; n<polygonList.size(); n++)
+        ret.polygonIdx = -1;
+        edge_grid.forEachNear(input, 100, [&](const Point&, const Point&, const std::pair<unsigned int, unsigned int>& edge)
         {
-            Point p0 = polygonList[n][polygonList[n].size()-1];
-            for(unsigned int i=0; i<polygonList[n].size(); i++)
-            {
-                Point p1 = polygonList[n][i];
+            unsigned int n = edge.first;
+            unsigned int i = edge.second;
+            if (ret.polygonIdx >= 0 && (n > static_cast<unsigned int>(ret.polygonIdx) || (n == static_cast<unsigned int>(ret.polygonIdx) && i >= ret.pointIdx)))
+                return; // an earlier edge has already been found
+            Point p0 = polygonList[n][(i > 0)? i - 1 : polygonList[n].size() - 1];
+            Point p1 = polygonList[n][i];
 
-                //Q = A + Normal( B - A ) * ((( B - A ) dot ( P - A )) / VSize( A - B ));
-                Point pDiff = p1 - p0;
-                int64_t lineLength = vSize(pDiff);
-                if (lineLength > 1)
+            //Q = A + Normal( B - A ) * ((( B - A ) dot ( P - A )) / VSize( A - B ));
+            Point pDiff = p1 - p0;
+            int64_t lineLength = vSize(pDiff);
+            if (lineLength > 1)
+            {
+                int64_t distOnLine = dot(pDiff, input - p0) / lineLength;
+                if (distOnLine >= 0 && distOnLine <= lineLength)
                 {
-                    int64_t distOnLine = dot(pDiff, input - p0) / lineLength;
-                    if (distOnLine >= 0 && distOnLine <= lineLength)
+                    Point q = p0 + pDiff * distOnLine / lineLength;
+                    if (shorterThen(q - input, 100))
                     {
-                        Point q = p0 + pDiff * distOnLine / lineLength;
-                        if (shorterThen(q - input, 100))
-                        {
-                            ret.intersectionPoint = q;
-                            ret.polygonIdx = n;
-                            ret.pointIdx = i;
-                            return ret;
-                        }
+                        ret.intersectionPoint = q;
+                        ret.polygonIdx = n;
+                        ret.pointIdx = i;
                     }
                 }
-                p0 = p1;
             }
-        }
-        ret.polygonIdx = -1;
+        });
         return ret;
     }
 };
@@ -141,10 +273,57 @@ private:
 class Slicer
 {
 public:
+    /*!
+     * The version of the outlines the Slicer produces, which keys the slice cache: increase it with every change which
+     * changes them, so that the cache doesn't return those of an older version.
+     */
+    static const int output_version = 1;
+
     std::vector<SlicerLayer> layers;
 
     Slicer(Mesh* mesh, int initial, int thickness, int layer_count, bool keepNoneClosed, bool extensiveStitching);
 
+    /*!
+     * Slice a mesh at the given heights, which may be any distance apart, such as those of adaptive layer heights.
+     * 
+     * \param layer_z The height at which to slice each layer, from the bottom up
+     */
+    Slicer(Mesh* mesh, const std::vector<int>& layer_z, bool keepNoneClosed, bool extensiveStitching);
+
+    /*!
+     * Create the layers at their heights without slicing anything, so that their outlines can be filled in from elsewhere (the slice cache).
+     * 
+     * \param initial The height of the first layer
+     * \param thickness The distance between layers
+     * \param layer_count The number of layers
+     */
+    Slicer(int initial, int thickness, int layer_count);
+
+    /*!
+     * Create the layers at the given heights without slicing anything, like Slicer(int, int, int).
+     * 
+     * \param layer_z The height of each layer, from the bottom up
+     */
+    Slicer(const std::vector<int>& layer_z);
+
+    /*!
+     * The heights of layers a fixed distance apart.
+     * 
+     * \param initial The height of the first layer
+     * \param thickness The distance between layers
+     * \param layer_count The number of layers
+     */
+    static std::vector<int> getUniformLayerZ(int initial, int thickness, int layer_count);
+
+    /*!
+     * Fill the segment list of each layer by sweeping a plane upward through the faces, keeping the segments of each
+     * layer in the order of their faces. This is the reference for the GPU backend, see sliceSegmentsOnGPU.
+     * 
+     * \param mesh The mesh to slice
+     * \param thread_count The threads which each sweep a consecutive range of layers
+     */
+    void findSegments(Mesh* mesh, unsigned int thread_count);
+
     SlicerSegment project2D(Point3& p0, Point3& p1, Point3& p2, int32_t z) const
     {//find 2D segment
         SlicerSegment seg;
@@ -158,6 +337,71 @@ public:
     void dumpSegmentsToHTML(const char* filename);
 };
 
+/*!
+ * A single layer of several slicers, e.g. of all meshes of an object, seen as one list of polygons.
+ * 
+ * Refers to the polygons stored in the slicers rather than copying them, so the slicers must outlive the view.
+ */
+class SlicerLayerView
+{
+public:
+    /*!
+     * \param slicers The slicers, which all have the same layer heights
+     * \param layer_nr The index of the layer in each of the \p slicers
+     */
+    SlicerLayerView(const std::vector<Slicer*>& slicers, unsigned int layer_nr)
+    : slicers(slicers)
+    , layer_nr(layer_nr)
+    {
+    }
+
+    /*!
+     * The total number of polygons in the layer over all slicers.
+     */
+    unsigned int size() const
+    {
+        unsigned int size = 0;
+        for (const Slicer* slicer : slicers)
+        {
+            size += slicer->layers[layer_nr].polygonList.size();
+        }
+        return size;
+    }
+
+    /*!
+     * Call \p process for each polygon, slicer by slicer.
+     * 
+     * \param process Called with a PolygonRef to each polygon
+     */
+    template<typename Process>
+    void forEachPolygon(Process process) const
+    {
+        for (Slicer* slicer : slicers)
+        {
+            Polygons& polygons = slicer->layers[layer_nr].polygonList;
+            for (unsigned int poly_idx = 0; poly_idx < polygons.size(); poly_idx++)
+            {
+                process(polygons[poly_idx]);
+            }
+        }
+    }
+
+    /*!
+     * Copy the polygons of the layer into \p result, for when they have to be kept apart from the slicers.
+     */
+    void addTo(Polygons& result) const
+    {
+        for (const Slicer* slicer : slicers)
+        {
+            result.add(slicer->layers[layer_nr].polygonList);
+        }
+    }
+
+private:
+    const std::vector<Slicer*>& slicers;
+    unsigned int layer_nr;
+};
+
 }//namespace cura
 
 #endif//SLICER_H
@@ -1,9 +1,13 @@
 /** Copyright (C) 2013 David Braam - Released under terms of the AGPLv3 License */
 #include "support.h"
 
+#include <algorithm> // max
 #include <cmath> // sqrt
 #include <utility> // pair
 
+#include "utils/parallel.h"
+#include "utils/trace.h"
+
 namespace cura 
 {
 
@@ -17,6 +21,10 @@ namespace cura
  * - perform inset using X/Y-distance and bottom Z distance
  * 
  * for support buildplate only: purge all support not connected to buildplate
+ * 
+ * Only joining with the support of the layer above is sequential. The overhang of each layer (including the wall struts)
+ * is computed in parallel beforehand, and the X/Y and bottom Z distance are applied in parallel afterwards, as the
+ * support passed on to the next lower layer is taken before them.
  */
 void generateSupportAreas(SliceDataStorage& storage, SliceMeshStorage* object, int layer_count)
 {
@@ -50,6 +58,7 @@ void generateSupportAreas(SliceDataStorage& storage, SliceMeshStorage* object, i
     int layerThickness = object->settings->getSettingInMicrons("layer_height");
     int extrusionWidth = object->settings->getSettingInMicrons("wall_line_width_x"); // TODO check for layer0extrusionWidth!
     int supportXYDistance = object->settings->getSettingInMicrons("support_xy_distance") + extrusionWidth / 2;
+    unsigned int thread_count = getThreadCount(object->settings->getSettingAsCount("machine_thread_count"));
     
 
     
@@ -61,21 +70,35 @@ void generateSupportAreas(SliceDataStorage& storage, SliceMeshStorage* object, i
     
     int supportLayerThickness = layerThickness;
     
-    int layerZdistanceTop       = supportZDistanceTop / supportLayerThickness + 1; // support must always be 1 layer below overhang
-    int layerZdistanceBottom    = supportZDistanceBottom / supportLayerThickness; 
-
     double tanAngle = tan(supportAngle) - 0.01;  // the XY-component of the supportAngle
-    int maxDistFromLowerLayer = tanAngle * supportLayerThickness; // max dist which can be bridged
     
     int support_layer_count = layer_count;
     
+    // The layers can differ in thickness (adaptive layer heights), so the Z distances are measured between the heights
+    // of the layers. The support of each layer holds up the overhang of the first layer more than the top distance above
+    // it, which must always be at least 1 layer up.
+    std::vector<int> overhang_layers; // per layer which can have support, the layer of which it holds up the overhang
+    for (int layer_idx = 0, overhang_layer = 1; layer_idx < support_layer_count; layer_idx++)
+    {
+        overhang_layer = std::max(overhang_layer, layer_idx + 1);
+        while (overhang_layer < support_layer_count && object->layers[overhang_layer].printZ - object->layers[layer_idx].printZ <= supportZDistanceTop)
+        {
+            overhang_layer++;
+        }
+        if (overhang_layer >= support_layer_count)
+        {
+            break;
+        }
+        overhang_layers.push_back(overhang_layer);
+    }
+    
     double tanTowerRoofAngle = tan(supportTowerRoofAngle);
     int towerRoofExpansionDistance = layerThickness / tanTowerRoofAngle;
     
     
     // early out
     
-    if ( layerZdistanceTop + 1 > (int) support_layer_count )
+    if ( overhang_layers.empty() )
     {
         storage.support.generated = false; // no (first layer) support can be generated 
         return;
@@ -87,7 +110,7 @@ void generateSupportAreas(SliceDataStorage& storage, SliceMeshStorage* object, i
     
     std::vector<Polygons> joinedLayers; // join model layers of all meshes into polygons and store small areas which need tower support
     std::vector<std::pair<int, std::vector<Polygons>>> overhang_points; // stores overhang_points along with the layer index at which the overhang point occurs
-    AreaSupport::joinMeshesAndDetectOverhangPoints(storage, joinedLayers, overhang_points, layer_count, supportMinAreaSqrt, extrusionWidth);
+    AreaSupport::joinMeshesAndDetectOverhangPoints(storage, joinedLayers, overhang_points, layer_count, supportMinAreaSqrt, extrusionWidth, thread_count);
         
     
     // initialization of supportAreasPerLayer
@@ -95,42 +118,33 @@ void generateSupportAreas(SliceDataStorage& storage, SliceMeshStorage* object, i
         storage.support.supportAreasPerLayer.emplace_back();
 
     
+    int top_support_layer = overhang_layers.size() - 1;
+
+    // compute the overhang of each layer, which only depends on the model
+    std::vector<Polygons> overhangs(top_support_layer + 1);
+    parallelFor(top_support_layer + 1, thread_count, [&](unsigned int layer_idx)
+    {
+        TRACE_ZONE("layer overhang", layer_idx);
+        StatsScope stats_scope(getStatsContext().stage, layer_idx);
+        int overhang_layer = overhang_layers[layer_idx];
+        int maxDistFromLowerLayer = tanAngle * (object->layers[overhang_layer].printZ - object->layers[overhang_layer - 1].printZ); // max dist which can be bridged
+        overhangs[layer_idx] = AreaSupport::computeOverhang(joinedLayers[overhang_layer], joinedLayers[overhang_layer - 1], maxDistFromLowerLayer);
+        if (supportMinAreaSqrt > 0)
+        {
+            // handle straight walls
+            AreaSupport::handleWallStruts(overhangs[layer_idx], supportMinAreaSqrt, supportTowerDiameter);
+        }
+    });
+
     int overhang_points_pos = overhang_points.size() - 1;
     Polygons supportLayer_last;
     std::vector<Polygons> towerRoofs;
-    for (int layer_idx = support_layer_count - 1 - layerZdistanceTop; layer_idx >= 0 ; layer_idx--)
+    for (int layer_idx = top_support_layer; layer_idx >= 0 ; layer_idx--)
     {
-        
-        
-        // compute basic overhang and put in right layer ([layerZdistanceTOp] layers below)
-        Polygons supportLayer_supportee =  joinedLayers[layer_idx+layerZdistanceTop];
-        Polygons supportLayer_supported =  joinedLayers[layer_idx-1+layerZdistanceTop].offset(maxDistFromLowerLayer);
-        Polygons basic_overhang = supportLayer_supportee.difference(supportLayer_supported);
-        
-        Polygons support_extension = basic_overhang.offset(maxDistFromLowerLayer);
-        support_extension = support_extension.intersection(supportLayer_supported);
-        support_extension = support_extension.intersection(supportLayer_supportee);
-        
-        Polygons overhang =  basic_overhang.unionPolygons(support_extension);
-        
-        /* supported
-         * .................
-         *         ______________|
-         * _______|         ^^^^^ basic overhang
-         * 
-         *         ^^^^^^^^^      overhang extensions
-         *         ^^^^^^^^^^^^^^ overhang
-         */
-
-        
-        Polygons& supportLayer_this = overhang; 
-        
-        supportLayer_this = supportLayer_this.simplify(50); // TODO: hardcoded value!
+        Polygons& supportLayer_this = overhangs[layer_idx];
         
         if (supportMinAreaSqrt > 0)
         {
-            // handle straight walls
-            AreaSupport::handleWallStruts(supportLayer_this, supportMinAreaSqrt, supportTowerDiameter);
             // handle towers
             AreaSupport::handleTowers(supportLayer_this, towerRoofs, overhang_points, overhang_points_pos, layer_idx, towerRoofExpansionDistance, supportTowerDiameter, supportMinAreaSqrt, layer_count, z_layer_distance_tower);
         }
@@ -159,22 +173,38 @@ void generateSupportAreas(SliceDataStorage& storage, SliceMeshStorage* object, i
         
         supportLayer_last = supportLayer_this;
         
+        logProgress("support", support_layer_count - layer_idx, support_layer_count);
+    }
+
+    // keep the distances to the model, which aren't passed on to the layers below
+    parallelFor(top_support_layer + 1, thread_count, [&](unsigned int layer_idx)
+    {
+        TRACE_ZONE("layer support", layer_idx);
+        StatsScope stats_scope(getStatsContext().stage, layer_idx);
+        Polygons& supportLayer_this = overhangs[layer_idx];
+        
         // inset using X/Y distance
         if (supportLayer_this.size() > 0)
             supportLayer_this = supportLayer_this.difference(joinedLayers[layer_idx].offset(supportXYDistance));
         
-        // move up from model
-        if (layerZdistanceBottom > 0 && layer_idx >= layerZdistanceBottom)
+        // move up from model: by the layers within the bottom distance below, of which there must be fewer than the layers
+        // below; below the first layer there would be another layer of the layer height
+        int layerZdistanceBottom = 0;
+        int z = object->layers[layer_idx].printZ;
+        auto layerZ = [object, layerThickness](int idx) { return (idx < 0)? object->layers[0].printZ - layerThickness : object->layers[idx].printZ; };
+        while (layerZdistanceBottom <= (int)layer_idx && z - layerZ(layer_idx - layerZdistanceBottom - 1) <= supportZDistanceBottom)
+        {
+            layerZdistanceBottom++;
+        }
+        if (layerZdistanceBottom > 0 && (int)layer_idx >= layerZdistanceBottom)
         {
             int stepHeight = support_bottom_stair_step_height / supportLayerThickness + 1;
             int bottomLayer = ((layer_idx - layerZdistanceBottom) / stepHeight) * stepHeight;
             supportLayer_this = supportLayer_this.difference(joinedLayers[bottomLayer]);
         }
         
-        storage.support.supportAreasPerLayer[layer_idx] = supportLayer_this;
-        
-        logProgress("support", support_layer_count - layer_idx, support_layer_count);
-    }
+        storage.support.supportAreasPerLayer[layer_idx] = std::move(supportLayer_this);
+    });
     
     // do stuff for when support on buildplate only
     if (supportOnBuildplateOnly)
@@ -193,18 +223,45 @@ void generateSupportAreas(SliceDataStorage& storage, SliceMeshStorage* object, i
     storage.support.generated = true;
 }
 
+Polygons AreaSupport::computeOverhang(const Polygons& supportLayer_supportee, const Polygons& layer_below, int maxDistFromLowerLayer)
+{
+    // compute basic overhang and put in right layer ([layerZdistanceTOp] layers below)
+    Polygons supportLayer_supported = layer_below.offset(maxDistFromLowerLayer);
+    Polygons basic_overhang = supportLayer_supportee.difference(supportLayer_supported);
+    
+    Polygons support_extension = basic_overhang.offset(maxDistFromLowerLayer);
+    support_extension = support_extension.intersection(supportLayer_supported);
+    support_extension = support_extension.intersection(supportLayer_supportee);
+    
+    Polygons overhang =  basic_overhang.unionPolygons(support_extension);
+    
+    /* supported
+     * .................
+     *         ______________|
+     * _______|         ^^^^^ basic overhang
+     * 
+     *         ^^^^^^^^^      overhang extensions
+     *         ^^^^^^^^^^^^^^ overhang
+     */
+    
+    return overhang.simplify(50); // TODO: hardcoded value!
+}
+
 void AreaSupport::joinMeshesAndDetectOverhangPoints(
     SliceDataStorage& storage,
     std::vector<Polygons>& joinedLayers,
     std::vector<std::pair<int, std::vector<Polygons>>>& overhang_points, // stores overhang_points along with the layer index at which the overhang point occurs)
     int layer_count,
     int supportMinAreaSqrt,
-    int extrusionWidth
+    int extrusionWidth,
+    unsigned int thread_count
                   )
 {
-    for (int layer_idx = 0 ; layer_idx < layer_count ; layer_idx++)
+    joinedLayers.resize(layer_count);
+    std::vector<std::vector<Polygons>> small_part_polys_per_layer(layer_count);
+    parallelFor(layer_count, thread_count, [&](unsigned int layer_idx)
     {
-        joinedLayers.emplace_back();
+        Polygons& joined = joinedLayers[layer_idx];
         for (SliceMeshStorage& mesh : storage.meshes)
         {
             SliceLayer& layer = mesh.layers[layer_idx];
@@ -216,21 +273,22 @@ void AreaSupport::joinMeshesAndDetectOverhangPoints(
                     Polygons part_poly = part.outline.offset(-extrusionWidth/2);
                     if (part_poly.size() > 0)
                     {
-                        if (overhang_points.size() > 0 && overhang_points.back().first == layer_idx)
-                            overhang_points.back().second.push_back(part_poly);
-                        else 
-                        {
-                            std::vector<Polygons> small_part_polys;
-                            small_part_polys.push_back(part_poly);
-                            overhang_points.emplace_back<std::pair<int, std::vector<Polygons>>>(std::make_pair(layer_idx, small_part_polys));
-                        }
+                        small_part_polys_per_layer[layer_idx].push_back(part_poly);
                     }
                     
                 }
-                joinedLayers.back() = joinedLayers.back().unionPolygons(part.outline);
+                joined.add(part.outline);
                 
             }
         }
+        joined = joined.unionPolygons();
+    });
+    for (int layer_idx = 0 ; layer_idx < layer_count ; layer_idx++)
+    {
+        if (small_part_polys_per_layer[layer_idx].size() > 0)
+        {
+            overhang_points.emplace_back(layer_idx, std::move(small_part_polys_per_layer[layer_idx]));
+        }
     }
 }
 
@@ -259,12 +317,14 @@ void AreaSupport::handleTowers(
             if (overhang_points_pos > 0 && overhang_points[overhang_points_pos - 1].first == layer_overhang_point - 1)
             {
                 std::vector<Polygons>& overhang_points_below = overhang_points[overhang_points_pos - 1].second;
+                Polygons near_points_below;
+                for (Polygons& poly_below : overhang_points_below)
+                {
+                    near_points_below.add(poly_below.offset(supportMinAreaSqrt*2));
+                }
                 for (Polygons& poly_here : overhang_points_here)
                 {
-                    for (Polygons& poly_below : overhang_points_below)
-                    {
-                        poly_here = poly_here.difference(poly_below.offset(supportMinAreaSqrt*2));
-                    }
+                    poly_here = poly_here.differenceUnion(near_points_below);
                 }
             }
         }
@@ -278,7 +338,7 @@ void AreaSupport::handleTowers(
     //for (Polygons& tower_roof : towerRoofs)
     for (unsigned int r = 0; r < towerRoofs.size(); r++)
     {
-        supportLayer_this = supportLayer_this.unionPolygons(towerRoofs[r]);
+        supportLayer_this.add(towerRoofs[r]);
         
         Polygons& tower_roof = towerRoofs[r];
         if (tower_roof.size() > 0 && tower_roof[0].area() < supportTowerDiameter * supportTowerDiameter)
@@ -286,6 +346,10 @@ void AreaSupport::handleTowers(
             towerRoofs[r] = tower_roof.offset(towerRoofExpansionDistance);
         }
     }
+    if (towerRoofs.size() > 0)
+    {
+        supportLayer_this = supportLayer_this.unionPolygons();
+    }
 }
 
 void AreaSupport::handleWallStruts(
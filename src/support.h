@@ -17,6 +17,7 @@ public:
      * \param layer_count total number of layers
      * \param supportMinAreaSqrt diameter of the minimal area which can be supported without a specialized strut
      * \param extrusionWidth extrusionWidth
+     * \param thread_count The number of threads with which to join the layers
      */
     static void joinMeshesAndDetectOverhangPoints(
         SliceDataStorage& storage,
@@ -24,9 +25,19 @@ public:
         std::vector<std::pair<int, std::vector<Polygons>>>& overhang_points, 
         int layer_count,
         int supportMinAreaSqrt,
-        int extrusionWidth
+        int extrusionWidth,
+        unsigned int thread_count
     );
     
+    /*!
+     * Computes the areas of a layer which aren't supported by the layer below, extended to where they can be attached to it.
+     * \param supportLayer_supportee The joined outlines of the layer which needs support
+     * \param layer_below The joined outlines of the layer below it
+     * \param maxDistFromLowerLayer The distance a layer can stick out beyond the layer below without support
+     * \return The simplified overhang areas
+     */
+    static Polygons computeOverhang(const Polygons& supportLayer_supportee, const Polygons& layer_below, int maxDistFromLowerLayer);
+    
     /*!
      * Adds tower pieces to the current support layer.
      * From below the roof, the towers are added to the normal support layer and handled as normal support area.
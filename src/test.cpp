@@ -267,6 +267,178 @@ void test_findClosestConnection()
 }
 */
 
+#include "utils/gettime.h"
+// Time findClosest on large, roughly circular polygons, as used by the wireframe printing and the support towers.
+void test_findClosest_timing()
+{
+    srand(1234);
+    Polygons polys;
+    for (int i = 0; i < 100; i++)
+    {
+        PolygonRef poly = polys.newPoly();
+        double radius = 10000 + rand() % 10000;
+        for (int n = 0; n < 2000; n++)
+        {
+            double a = n * 2 * M_PI / 2000;
+            double dist = radius + rand() % 100;
+            poly.add(Point(dist * std::cos(a), dist * std::sin(a)));
+        }
+    }
+    
+    TimeKeeper timer;
+    int64_t total_dist = 0;
+    for (int i = 0; i < 100000; i++)
+    {
+        Point from(rand() % 60000 - 30000, rand() % 60000 - 30000);
+        ClosestPolygonPoint closest = findClosest(from, polys[i % polys.size()]);
+        total_dist += vSize(closest.location - from);
+    }
+    std::cerr << "findClosest time : " << timer.restart() << std::endl;
+    std::cerr << "total distance : " << total_dist << std::endl;
+}
+
+// Time finding the closest points of a dense wireframe layer on the layer below, by scanning and through a SegmentGrid.
+void test_segmentGrid_timing()
+{
+    srand(1234);
+    Polygons supporting;
+    Polygons supported;
+    for (int x = 0; x < 20; x++)
+    {
+        for (int y = 0; y < 20; y++)
+        {
+            // a lattice of small rings, like the struts of a lattice part
+            Point center(x * 5000, y * 5000);
+            PolygonRef lower = supporting.newPoly();
+            PolygonRef upper = supported.newPoly();
+            for (int n = 0; n < 60; n++)
+            {
+                double a = n * 2 * M_PI / 60;
+                lower.add(center + Point(2000 * std::cos(a) + rand() % 50, 2000 * std::sin(a) + rand() % 50));
+                upper.add(center + Point(1900 * std::cos(a + 0.05) + rand() % 50, 1900 * std::sin(a + 0.05) + rand() % 50));
+            }
+        }
+    }
+    
+    TimeKeeper timer;
+    int64_t total_dist = 0;
+    for (unsigned int poly_idx = 0; poly_idx < supported.size(); poly_idx++)
+        for (Point& p : supported[poly_idx])
+            total_dist += vSize(findClosest(p, supporting).location - p);
+    std::cerr << "findClosest time : " << timer.restart() << std::endl;
+    std::cerr << "total distance : " << total_dist << std::endl;
+    
+    total_dist = 0;
+    SegmentGrid grid(supporting);
+    for (unsigned int poly_idx = 0; poly_idx < supported.size(); poly_idx++)
+        for (Point& p : supported[poly_idx])
+            total_dist += vSize(grid.findClosest(p).location - p);
+    std::cerr << "SegmentGrid time : " << timer.restart() << std::endl;
+    std::cerr << "total distance : " << total_dist << std::endl;
+    
+    int mismatches = 0;
+    for (unsigned int poly_idx = 0; poly_idx < supported.size(); poly_idx++)
+        for (Point& p : supported[poly_idx])
+        {
+            ClosestPolygonPoint scanned = findClosest(p, supporting);
+            ClosestPolygonPoint closest = grid.findClosest(p);
+            if (closest.location != scanned.location || closest.pos != scanned.pos || closest.poly.data() != scanned.poly.data())
+                mismatches++;
+        }
+    std::cerr << "mismatches : " << mismatches << std::endl;
+}
+
+#include "infill.h"
+// Time the zigzag infill with end pieces, as used for support, on outlines with more and more vertices.
+// The previous implementation first copied the outline through Clipper, which took most of the time on complex outlines.
+void test_zigzag_timing()
+{
+    for (int vertex_count = 1000; vertex_count <= 64000; vertex_count *= 4)
+    {
+        Polygons outline;
+        PolygonRef poly = outline.newPoly();
+        for (int n = 0; n < vertex_count; n++)
+        {
+            double a = n * 2 * M_PI / vertex_count;
+            double radius = (n % 2)? 50000 : 30000; // a star with many spikes
+            poly.add(Point(radius * std::cos(a), radius * std::sin(a)));
+        }
+
+        TimeKeeper timer;
+        Polygons result;
+        generateZigZagInfill_endPieces(outline, result, 400, 400, 0, 0, true);
+        double zigzag_time = timer.restart();
+        Polygons empty;
+        Polygons clipper_copy = outline.difference(empty);
+        double clipper_copy_time = timer.restart();
+        std::cerr << vertex_count << " vertices: zigzag time : " << zigzag_time << ", previous implementation : " << zigzag_time + clipper_copy_time << " (" << result.size() << " lines)" << std::endl;
+    }
+}
+
+#include "pathOrderOptimizer.h"
+// Compare the line order of the LineOrderOptimizer with a greedy search over all lines, on the infill of a plate.
+// The total travel of the optimizer may be at most a fraction tolerance longer than that of the full search.
+void test_lineOrder(double tolerance)
+{
+    for (int plate_size = 50000; plate_size <= 300000; plate_size *= 2)
+    {
+        Polygons outline;
+        PolygonRef poly = outline.newPoly();
+        poly.add(Point(0, 0));
+        poly.add(Point(plate_size, 0));
+        poly.add(Point(plate_size, plate_size));
+        poly.add(Point(0, plate_size));
+        Polygons lines;
+        generateLineInfill(outline, 0, lines, 400, 400, 0, 45);
+
+        TimeKeeper timer;
+        LineOrderOptimizer optimizer(Point(0, 0));
+        optimizer.addPolygons(lines);
+        optimizer.optimize();
+        double optimize_time = timer.restart();
+        int64_t travel = 0;
+        Point prev_point(0, 0);
+        for (unsigned int n = 0; n < optimizer.polyOrder.size(); n++)
+        {
+            PolygonRef line = lines[optimizer.polyOrder[n]];
+            int start = optimizer.polyStart[optimizer.polyOrder[n]];
+            travel += vSize(line[start] - prev_point);
+            prev_point = line[1 - start];
+        }
+
+        std::vector<bool> picked(lines.size(), false);
+        int64_t full_search_travel = 0;
+        prev_point = Point(0, 0);
+        for (unsigned int n = 0; n < lines.size(); n++)
+        {
+            int best = -1;
+            int best_start = 0;
+            int64_t best_dist2 = std::numeric_limits<int64_t>::max();
+            for (unsigned int line_idx = 0; line_idx < lines.size(); line_idx++)
+            {
+                for (int start = 0; start < 2 && !picked[line_idx]; start++)
+                {
+                    int64_t dist2 = vSize2(lines[line_idx][start] - prev_point);
+                    if (dist2 < best_dist2)
+                    {
+                        best = line_idx;
+                        best_start = start;
+                        best_dist2 = dist2;
+                    }
+                }
+            }
+            picked[best] = true;
+            full_search_travel += vSize(lines[best][best_start] - prev_point);
+            prev_point = lines[best][1 - best_start];
+        }
+        double full_search_time = timer.restart();
+
+        bool ok = travel <= full_search_travel * (1.0 + tolerance);
+        std::cerr << lines.size() << " lines: order time : " << optimize_time << ", full search : " << full_search_time
+            << ", travel : " << INT2MM(travel) << "mm, full search : " << INT2MM(full_search_travel) << "mm" << (ok? "" : " TOO LONG") << std::endl;
+    }
+}
+
 void test_clipper()
 {
     Polygon p;
@@ -308,5 +480,9 @@ void test_clipper()
 int main(int argc, char **argv)
 {
 //     test_findClosestConnection();
+//     test_findClosest_timing();
+//     test_segmentGrid_timing();
+//     test_zigzag_timing();
+//     test_lineOrder(0.01);
     test_clipper();
 }
\ No newline at end of file
@@ -1,21 +1,111 @@
 #include <math.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
 #include <algorithm>
+#include <sstream>
 #include "timeEstimate.h"
 
-#define MINIMUM_PLANNER_SPEED 0.05// (mm/sec)
+//c++11 no longer defines M_PI, so add our own constant.
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
 
-const double max_feedrate[TimeEstimateCalculator::NUM_AXIS] = {600, 600, 40, 25};
-const double minimumfeedrate = 0.01;
-const double acceleration = 3000;
-const double max_acceleration[TimeEstimateCalculator::NUM_AXIS] = {9000,9000,100,10000};
-const double max_xy_jerk = 20.0;
-const double max_z_jerk = 0.4;
-const double max_e_jerk = 5.0;
+#define MINIMUM_PLANNER_SPEED 0.05// (mm/sec)
 
 template<typename T> const T square(const T& a) { return a * a; }
 
+namespace
+{
+
+/*!
+ * The words of a line of G-code: a letter with a number each, like G1, X10.5 or F3000. Comments are skipped.
+ */
+class GCodeWords
+{
+public:
+    GCodeWords(const std::string& line)
+    {
+        for(unsigned int n=0; n<26; n++)
+        {
+            found[n] = false;
+            values[n] = 0;
+        }
+        const char* c = line.c_str();
+        while (*c && *c != ';')
+        {
+            if (*c == '(') // comment up to the closing parenthesis
+            {
+                while (*c && *c != ')')
+                    c++;
+                continue;
+            }
+            int letter = toupper(*c) - 'A';
+            c++;
+            if (letter < 0 || letter >= 26 || found[letter])
+                continue;
+            // parse the number by hand rather than with strtod, which would take "X1E2" to mean 100
+            while (*c == ' ')
+                c++;
+            double sign = 1;
+            if (*c == '-' || *c == '+')
+                sign = (*c++ == '-')? -1 : 1;
+            if (!isdigit(*c) && *c != '.')
+                continue;
+            double number = 0;
+            for(; isdigit(*c); c++)
+                number = number * 10 + (*c - '0');
+            if (*c == '.')
+            {
+                double scale = 0.1;
+                for(c++; isdigit(*c); c++, scale *= 0.1)
+                    number += (*c - '0') * scale;
+            }
+            found[letter] = true;
+            values[letter] = sign * number;
+        }
+    }
+
+    bool has(char letter) const { return found[letter - 'A']; }
+    double get(char letter) const { return values[letter - 'A']; } //!< The number of a letter, or zero when the line doesn't have it
+
+    //! Whether this line is the command \p letter \p number, like G 1 or M 400
+    bool is(char letter, int number) const { return has(letter) && get(letter) == number; }
+
+    //! The time a G4 waits: S gives seconds and P milliseconds, like in Marlin
+    double getDwellTime() const { return has('S')? get('S') : (has('P')? get('P') / 1000.0 : 0); }
+private:
+    bool found[26];
+    double values[26];
+};
+
+const char axis_letters[TimeEstimateCalculator::NUM_AXIS] = {'X', 'Y', 'Z', 'E'};
+
+}//anonymous namespace
+
+TimeEstimateCalculator::MachineLimits::MachineLimits()
+: max_feedrate{600, 600, 40, 25}
+, max_acceleration{9000, 9000, 100, 10000}
+, acceleration(3000)
+, minimum_feedrate(0.01)
+, max_xy_jerk(20.0)
+, max_z_jerk(0.4)
+, max_e_jerk(5.0)
+, firmware_retraction_amount(4.5)
+, firmware_retraction_speed(25)
+{
+}
+
+TimeEstimateCalculator::TimeEstimateCalculator()
+: previous_nominal_feedrate(0)
+, block_buffer_tail(0)
+, block_count(0)
+, planned_since_reset(false)
+, retired_time(0)
+, current_tag(0)
+{
+}
+
 void TimeEstimateCalculator::setPosition(Position newPos)
 {
     currentPosition = newPos;
@@ -23,7 +113,23 @@ void TimeEstimateCalculator::setPosition(Position newPos)
 
 void TimeEstimateCalculator::reset()
 {
-    blocks.clear();
+    block_buffer_tail = 0;
+    block_count = 0;
+    planned_since_reset = false;
+    retired_time = 0;
+}
+
+void TimeEstimateCalculator::setTag(unsigned int tag)
+{
+    current_tag = tag;
+}
+
+void TimeEstimateCalculator::dwell(double seconds)
+{
+    retire_all_blocks();
+    planned_since_reset = false; // the next move starts from a standstill
+    retired_time += seconds;
+    addTagTime(current_tag, seconds);
 }
 
 // Calculates the maximum allowable speed at this point when you must be able to reach target_velocity using the 
@@ -89,6 +195,28 @@ void TimeEstimateCalculator::calculate_trapezoid_for_block(Block *block, double
     block->final_feedrate = final_feedrate;
 }                    
 
+void TimeEstimateCalculator::planArc(Position newPos, double centerX, double centerY, bool clockwise, double feedrate)
+{
+    Position start = currentPosition;
+    double radius = sqrt(square(start[X_AXIS] - centerX) + square(start[Y_AXIS] - centerY));
+    double startAngle = atan2(start[Y_AXIS] - centerY, start[X_AXIS] - centerX);
+    double sweep = atan2(newPos[Y_AXIS] - centerY, newPos[X_AXIS] - centerX) - startAngle;
+    if (clockwise)
+        sweep = -sweep;
+    if (sweep <= 0)
+        sweep += 2 * M_PI;
+    if (clockwise)
+        sweep = -sweep;
+    int segments = std::max(1, int(ceil(fabs(sweep) / (M_PI / 36)))); // at most 5 degrees each, so the junctions hardly slow down
+    for(int n=1; n<segments; n++)
+    {
+        double f = double(n) / segments;
+        double angle = startAngle + sweep * f;
+        plan(Position(centerX + radius * cos(angle), centerY + radius * sin(angle), start[Z_AXIS] + (newPos[Z_AXIS] - start[Z_AXIS]) * f, start[E_AXIS] + (newPos[E_AXIS] - start[E_AXIS]) * f), feedrate);
+    }
+    plan(newPos, feedrate);
+}
+
 void TimeEstimateCalculator::plan(Position newPos, double feedrate)
 {
     Block block;
@@ -103,12 +231,13 @@ void TimeEstimateCalculator::plan(Position newPos, double feedrate)
     }
     if (block.maxTravel <= 0)
         return;
-    if (feedrate < minimumfeedrate)
-        feedrate = minimumfeedrate;
+    if (feedrate < limits.minimum_feedrate)
+        feedrate = limits.minimum_feedrate;
     block.distance = sqrtf(square(block.absDelta[0]) + square(block.absDelta[1]) + square(block.absDelta[2]));
     if (block.distance == 0.0)
         block.distance = block.absDelta[3];
     block.nominal_feedrate = feedrate;
+    block.tag = current_tag;
     
     Position current_feedrate;
     Position current_abs_feedrate;
@@ -117,8 +246,8 @@ void TimeEstimateCalculator::plan(Position newPos, double feedrate)
     {
         current_feedrate[n] = block.delta[n] * feedrate / block.distance;
         current_abs_feedrate[n] = fabs(current_feedrate[n]);
-        if (current_abs_feedrate[n] > max_feedrate[n])
-            feedrate_factor = std::min(feedrate_factor, max_feedrate[n] / current_abs_feedrate[n]);
+        if (current_abs_feedrate[n] > limits.max_feedrate[n])
+            feedrate_factor = std::min(feedrate_factor, limits.max_feedrate[n] / current_abs_feedrate[n]);
     }
     //TODO: XY_FREQUENCY_LIMIT
     
@@ -132,34 +261,33 @@ void TimeEstimateCalculator::plan(Position newPos, double feedrate)
         block.nominal_feedrate *= feedrate_factor;
     }
     
-    block.acceleration = acceleration;
+    block.acceleration = limits.acceleration;
     for(unsigned int n=0; n<NUM_AXIS; n++)
     {
-        if (block.acceleration * (block.absDelta[n] / block.distance) > max_acceleration[n])
-            block.acceleration = max_acceleration[n];
+        if (block.acceleration * (block.absDelta[n] / block.distance) > limits.max_acceleration[n])
+            block.acceleration = limits.max_acceleration[n];
     }
     
-    double vmax_junction = max_xy_jerk/2; 
+    double vmax_junction = limits.max_xy_jerk/2; 
     double vmax_junction_factor = 1.0; 
-    if(current_abs_feedrate[Z_AXIS] > max_z_jerk/2)
-        vmax_junction = std::min(vmax_junction, max_z_jerk/2);
-    if(current_abs_feedrate[E_AXIS] > max_e_jerk/2)
-        vmax_junction = std::min(vmax_junction, max_e_jerk/2);
+    if(current_abs_feedrate[Z_AXIS] > limits.max_z_jerk/2)
+        vmax_junction = std::min(vmax_junction, limits.max_z_jerk/2);
+    if(current_abs_feedrate[E_AXIS] > limits.max_e_jerk/2)
+        vmax_junction = std::min(vmax_junction, limits.max_e_jerk/2);
     vmax_junction = std::min(vmax_junction, block.nominal_feedrate);
-    double safe_speed = vmax_junction;
     
-    if ((blocks.size() > 0) && (previous_nominal_feedrate > 0.0001))
+    if (planned_since_reset && (previous_nominal_feedrate > 0.0001))
     {
         double xy_jerk = sqrt(square(current_feedrate[X_AXIS]-previous_feedrate[X_AXIS])+square(current_feedrate[Y_AXIS]-previous_feedrate[Y_AXIS]));
         vmax_junction = block.nominal_feedrate;
-        if (xy_jerk > max_xy_jerk) {
-            vmax_junction_factor = (max_xy_jerk/xy_jerk);
+        if (xy_jerk > limits.max_xy_jerk) {
+            vmax_junction_factor = (limits.max_xy_jerk/xy_jerk);
         } 
-        if(fabs(current_feedrate[Z_AXIS] - previous_feedrate[Z_AXIS]) > max_z_jerk) {
-            vmax_junction_factor = std::min(vmax_junction_factor, (max_z_jerk/fabs(current_feedrate[Z_AXIS] - previous_feedrate[Z_AXIS])));
+        if(fabs(current_feedrate[Z_AXIS] - previous_feedrate[Z_AXIS]) > limits.max_z_jerk) {
+            vmax_junction_factor = std::min(vmax_junction_factor, (limits.max_z_jerk/fabs(current_feedrate[Z_AXIS] - previous_feedrate[Z_AXIS])));
         } 
-        if(fabs(current_feedrate[E_AXIS] - previous_feedrate[E_AXIS]) > max_e_jerk) {
-            vmax_junction_factor = std::min(vmax_junction_factor, (max_e_jerk/fabs(current_feedrate[E_AXIS] - previous_feedrate[E_AXIS])));
+        if(fabs(current_feedrate[E_AXIS] - previous_feedrate[E_AXIS]) > limits.max_e_jerk) {
+            vmax_junction_factor = std::min(vmax_junction_factor, (limits.max_e_jerk/fabs(current_feedrate[E_AXIS] - previous_feedrate[E_AXIS])));
         } 
         vmax_junction = std::min(previous_nominal_feedrate, vmax_junction * vmax_junction_factor); // Limit speed to max previous speed
     }
@@ -169,34 +297,54 @@ void TimeEstimateCalculator::plan(Position newPos, double feedrate)
     double v_allowable = max_allowable_speed(-block.acceleration, MINIMUM_PLANNER_SPEED, block.distance);
     block.entry_speed = std::min(vmax_junction, v_allowable);
     block.nominal_length_flag = block.nominal_feedrate <= v_allowable;
-    block.recalculate_flag = true; // Always calculate trapezoid for new block
 
     previous_feedrate = current_feedrate;
     previous_nominal_feedrate = block.nominal_feedrate;
+    planned_since_reset = true;
 
     currentPosition = newPos;
 
-    calculate_trapezoid_for_block(&block, block.entry_speed/block.nominal_feedrate, safe_speed/block.nominal_feedrate);
-    
-    blocks.push_back(block);
+    if (block_count == BLOCK_BUFFER_SIZE)
+    {
+        // the buffer is full, so the oldest block gets executed with the speeds planned for it with the lookahead so far
+        reverse_pass();
+        forward_pass();
+        retire_block(this->block(1).entry_speed);
+    }
+    this->block(block_count) = block;
+    block_count++;
 }
 
 double TimeEstimateCalculator::calculate()
+{
+    retire_all_blocks();
+    return retired_time;
+}
+
+void TimeEstimateCalculator::retire_all_blocks()
 {
     reverse_pass();
     forward_pass();
-    recalculate_trapezoids();
-    
-    double totalTime = 0;
-    for(unsigned int n=0; n<blocks.size(); n++)
+    while (block_count > 0)
     {
-        double plateau_distance = blocks[n].decelerate_after - blocks[n].accelerate_until;
-        
-        totalTime += acceleration_time_from_distance(blocks[n].initial_feedrate, blocks[n].accelerate_until, blocks[n].acceleration);
-        totalTime += plateau_distance / blocks[n].nominal_feedrate;
-        totalTime += acceleration_time_from_distance(blocks[n].final_feedrate, (blocks[n].distance - blocks[n].decelerate_after), blocks[n].acceleration);
+        retire_block((block_count > 1)? block(1).entry_speed : MINIMUM_PLANNER_SPEED);
     }
-    return totalTime;
+}
+
+void TimeEstimateCalculator::retire_block(double exit_speed)
+{
+    Block& oldest = block(0);
+    calculate_trapezoid_for_block(&oldest, oldest.entry_speed/oldest.nominal_feedrate, exit_speed/oldest.nominal_feedrate);
+
+    double plateau_distance = oldest.decelerate_after - oldest.accelerate_until;
+    double block_time = acceleration_time_from_distance(oldest.initial_feedrate, oldest.accelerate_until, oldest.acceleration);
+    block_time += plateau_distance / oldest.nominal_feedrate;
+    block_time += acceleration_time_from_distance(oldest.final_feedrate, (oldest.distance - oldest.decelerate_after), oldest.acceleration);
+    retired_time += block_time;
+    addTagTime(oldest.tag, block_time);
+
+    block_buffer_tail = (block_buffer_tail + 1) % BLOCK_BUFFER_SIZE;
+    block_count--;
 }
 
 // The kernel called by accelerationPlanner::calculate() when scanning the plan from last to first entry.
@@ -219,18 +367,17 @@ void TimeEstimateCalculator::planner_reverse_pass_kernel(Block *previous, Block
         } else {
             current->entry_speed = current->max_entry_speed;
         }
-        current->recalculate_flag = true;
     }
 }
 
 void TimeEstimateCalculator::reverse_pass()
 {
     Block* block[3] = {nullptr, nullptr, nullptr};
-    for(unsigned int n=blocks.size()-1; int(n)>=0; n--)
+    for(unsigned int n=block_count; n>0; n--)
     {
         block[2]= block[1];
         block[1]= block[0];
-        block[0] = &blocks[n];
+        block[0] = &this->block(n - 1);
         planner_reverse_pass_kernel(block[0], block[1], block[2]);
     }
 }
@@ -256,7 +403,6 @@ void TimeEstimateCalculator::planner_forward_pass_kernel(Block *previous, Block
             if (current->entry_speed != entry_speed)
             {
                 current->entry_speed = entry_speed;
-                current->recalculate_flag = true;
             }
         }
     }
@@ -265,43 +411,124 @@ void TimeEstimateCalculator::planner_forward_pass_kernel(Block *previous, Block
 void TimeEstimateCalculator::forward_pass()
 {
     Block* block[3] = {nullptr, nullptr, nullptr};
-    for(unsigned int n=0; n<blocks.size(); n++)
+    for(unsigned int n=0; n<block_count; n++)
     {
         block[0]= block[1];
         block[1]= block[2];
-        block[2] = &blocks[n];
+        block[2] = &this->block(n);
         planner_forward_pass_kernel(block[0], block[1], block[2]);
     }
     planner_forward_pass_kernel(block[1], block[2], nullptr);
 }
 
-// Recalculates the trapezoid speed profiles for all blocks in the plan according to the 
-// entry_factor for each junction. Must be called by planner_recalculate() after 
-// updating the blocks.
-void TimeEstimateCalculator::recalculate_trapezoids()
+bool TimeEstimateCalculator::findDwell(const std::string& gcode, double& seconds)
 {
-    Block *current;
-    Block *next = nullptr;
+    bool found = false;
+    seconds = 0;
+    std::istringstream lines(gcode);
+    std::string line;
+    while (std::getline(lines, line))
+    {
+        GCodeWords words(line);
+        if (words.is('G', 4))
+        {
+            found = true;
+            seconds += words.getDwellTime();
+        }
+    }
+    return found;
+}
 
-    for(unsigned int n=0; n<blocks.size(); n--)
+double TimeEstimateCalculator::estimate(std::istream& gcode)
+{
+    reset();
+    setPosition(Position());
+    bool absolute = true;
+    bool absolute_e = true;
+    bool retracted = false;
+    double feedrate = 25; // the default of Marlin until the G-code gives one
+    std::string line;
+    while (std::getline(gcode, line))
     {
-        current = next;
-        next = &blocks[n];
-        if (current)
+        GCodeWords words(line);
+        Position newPos = currentPosition;
+        if (words.has('G'))
         {
-            // Recalculate if current block entry or exit junction speed has changed.
-            if (current->recalculate_flag || next->recalculate_flag)
+            int code = int(words.get('G'));
+            switch(code)
             {
-                // NOTE: Entry and exit factors always > 0 by all previous logic operations.
-                calculate_trapezoid_for_block(current, current->entry_speed/current->nominal_feedrate, next->entry_speed/current->nominal_feedrate);
-                current->recalculate_flag = false; // Reset current only to ensure next trapezoid is computed
+            case 0: case 1: case 2: case 3:
+                if (words.has('F'))
+                    feedrate = words.get('F') / 60;
+                for(unsigned int n=0; n<NUM_AXIS; n++)
+                {
+                    if (words.has(axis_letters[n]))
+                        newPos[n] = (((n == E_AXIS)? absolute_e : absolute)? 0 : currentPosition[n]) + words.get(axis_letters[n]);
+                }
+                if (code <= 1)
+                    plan(newPos, feedrate);
+                else
+                    planArc(newPos, currentPosition[X_AXIS] + words.get('I'), currentPosition[Y_AXIS] + words.get('J'), code == 2, feedrate);
+                break;
+            case 4:
+                dwell(words.getDwellTime());
+                break;
+            case 10: case 11:
+                if (retracted != (code == 10))
+                {
+                    newPos[E_AXIS] += (code == 10)? -limits.firmware_retraction_amount : limits.firmware_retraction_amount;
+                    plan(newPos, limits.firmware_retraction_speed);
+                    retracted = code == 10;
+                }
+                break;
+            case 28: case 92:
+                {
+                    // homing sets the axes to zero, G92 to the given values; without axes all are set
+                    bool any_axis = false;
+                    for(unsigned int n=0; n<NUM_AXIS; n++)
+                        any_axis |= words.has(axis_letters[n]);
+                    for(unsigned int n=0; n<NUM_AXIS; n++)
+                    {
+                        if (words.has(axis_letters[n]) || (!any_axis && (code == 92 || n != E_AXIS)))
+                            newPos[n] = (code == 92)? words.get(axis_letters[n]) : 0;
+                    }
+                    setPosition(newPos);
+                }
+                break;
+            case 90: case 91:
+                absolute = absolute_e = code == 90;
+                break;
+            }
+        }
+        else if (words.has('M'))
+        {
+            switch(int(words.get('M')))
+            {
+            case 82: case 83:
+                absolute_e = words.is('M', 82);
+                break;
+            case 201: case 203:
+                for(unsigned int n=0; n<NUM_AXIS; n++)
+                {
+                    if (words.has(axis_letters[n]))
+                        (words.is('M', 201)? limits.max_acceleration : limits.max_feedrate)[n] = words.get(axis_letters[n]);
+                }
+                break;
+            case 204:
+                if (words.has('S') || words.has('P'))
+                    limits.acceleration = words.has('S')? words.get('S') : words.get('P');
+                break;
+            case 205:
+                if (words.has('X')) limits.max_xy_jerk = words.get('X');
+                if (words.has('Z')) limits.max_z_jerk = words.get('Z');
+                if (words.has('E')) limits.max_e_jerk = words.get('E');
+                if (words.has('S')) limits.minimum_feedrate = words.get('S');
+                break;
+            case 400:
+                dwell(0);
+                break;
             }
         }
     }
-    // Last/newest block in buffer. Exit speed is set with MINIMUM_PLANNER_SPEED. Always recalculated.
-    if(next != nullptr)
-    {
-        calculate_trapezoid_for_block(next, next->entry_speed/next->nominal_feedrate, MINIMUM_PLANNER_SPEED/next->nominal_feedrate);
-        next->recalculate_flag = false;
-    }
+    return calculate();
 }
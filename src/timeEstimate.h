@@ -2,11 +2,17 @@
 #define TIME_ESTIMATE_H
 
 #include <stdint.h>
+#include <istream>
+#include <string>
 #include <vector>
 
 /**
     The TimeEstimateCalculator class generates a estimate of printing time calculated with acceleration in mind.
     Some of this code has been addapted from the Marlin sources.
+
+    Like the planner of the firmware, it only looks ahead a fixed number of moves: the blocks are kept in a ring buffer,
+    and once it is full the oldest block is retired with the speeds planned for it so far and its time is added up.
+    So the cost per move and the memory used don't grow with the number of moves between two calls to calculate().
 */
 
 class TimeEstimateCalculator
@@ -17,6 +23,7 @@ public:
     const static unsigned int Y_AXIS = 1;
     const static unsigned int Z_AXIS = 2;
     const static unsigned int E_AXIS = 3;
+    const static unsigned int BLOCK_BUFFER_SIZE = 16; //!< The number of moves the planner looks ahead, like the BLOCK_BUFFER_SIZE of Marlin
 
     class Position
     {
@@ -28,11 +35,28 @@ public:
         double& operator[](const int n) { return axis[n]; }
     };
 
+    /*!
+     * The limits with which the firmware plans the moves. The defaults are those of Marlin on an Ultimaker.
+     */
+    class MachineLimits
+    {
+    public:
+        MachineLimits();
+
+        double max_feedrate[NUM_AXIS]; //!< The maximum speed of each axis, in mm/s
+        double max_acceleration[NUM_AXIS]; //!< The maximum acceleration of each axis, in mm/s^2
+        double acceleration; //!< The acceleration of a move in mm/s^2, unless the axes it moves limit it further
+        double minimum_feedrate; //!< The lowest speed of a move, in mm/s
+        double max_xy_jerk; //!< The change of speed in the XY plane which is made instantly, in mm/s
+        double max_z_jerk; //!< The change of speed of the Z axis which is made instantly, in mm/s
+        double max_e_jerk; //!< The change of speed of the E axis which is made instantly, in mm/s
+        double firmware_retraction_amount; //!< The length retracted by G10, in the units of the E axis
+        double firmware_retraction_speed; //!< The speed of the retraction of G10 and of the prime of G11, in mm/s
+    };
+
     class Block
     {
     public:
-        bool recalculate_flag;
-        
         double accelerate_until;
         double decelerate_after;
         double initial_feedrate;
@@ -48,25 +72,108 @@ public:
         double acceleration;
         Position delta;
         Position absDelta;
+        unsigned int tag; //!< The tag set when the block was planned
     };
 
 private:
+    MachineLimits limits;
+
     Position previous_feedrate;
     double previous_nominal_feedrate;
 
     Position currentPosition;
 
-    std::vector<Block> blocks;
+    Block blocks[BLOCK_BUFFER_SIZE]; //!< Ring buffer of the blocks whose speeds can still change
+    unsigned int block_buffer_tail; //!< The index in blocks of the oldest block
+    unsigned int block_count; //!< The number of blocks in the buffer
+    bool planned_since_reset; //!< Whether a block was planned since the last reset or dwell, so the junction with the previous move counts
+    double retired_time; //!< The time of the blocks retired since the last reset
+    unsigned int current_tag; //!< The tag of the blocks and dwells planned from now on
+    std::vector<double> tag_times; //!< The time of the retired blocks and the dwells with each tag, kept over resets
 public:
+    TimeEstimateCalculator();
+
+    void setMachineLimits(const MachineLimits& limits) { this->limits = limits; }
+    size_t getMemoryUsage() const { return sizeof(*this) + tag_times.capacity() * sizeof(double); } //!< The memory held by the calculator, including its block buffer, in bytes
+    const MachineLimits& getMachineLimits() const { return limits; }
+
     void setPosition(Position newPos);
+    Position getPosition() const { return currentPosition; }
     void plan(Position newPos, double feedRate);
+    /*!
+     * Plan an arc in the XY plane from the current position to \p newPos around the center (\p centerX, \p centerY),
+     * as a series of short lines along it. Z and E change evenly along the arc.
+     */
+    void planArc(Position newPos, double centerX, double centerY, bool clockwise, double feedRate);
     void reset();
+
+    /*!
+     * Tag the moves and dwells planned from now on, so that their time is added up separately from that of the moves
+     * with other tags, see getTagTimes. The moves start with tag 0.
+     */
+    void setTag(unsigned int tag);
+
+    /*!
+     * The time of the retired blocks and the dwells with each tag, since the tag times were last cleared. The blocks
+     * which are still in the buffer aren't included until calculate() retires them.
+     */
+    const std::vector<double>& getTagTimes() const { return tag_times; }
+    void clearTagTimes() { tag_times.clear(); }
+
+    /*!
+     * Wait for the planned moves to finish and then wait some time, like G4 does.
+     *
+     * \param seconds The time to wait after the moves
+     */
+    void dwell(double seconds);
+
+    /*!
+     * Find the G4 commands in some G-code.
+     *
+     * \param gcode One or more lines of G-code
+     * \param seconds Set to the total time the G4 commands wait
+     * \return Whether there is a G4 command, which waits for the planned moves to finish even when it doesn't wait any longer
+     */
+    static bool findDwell(const std::string& gcode, double& seconds);
+
+    /*!
+     * Estimate the print time of a G-code file by planning all of its moves, dwells and changes of the machine limits.
+     * This resets the calculator.
+     *
+     * \param gcode The G-code
+     * \return The print time in seconds
+     */
+    double estimate(std::istream& gcode);
     
+    /*!
+     * Retire all blocks planned since the last reset.
+     *
+     * \return The time of all blocks planned since the last reset
+     */
     double calculate();
 private:
+    Block& block(unsigned int idx) { return blocks[(block_buffer_tail + idx) % BLOCK_BUFFER_SIZE]; } //!< The idx-th oldest block in the buffer
     void reverse_pass();
     void forward_pass();
-    void recalculate_trapezoids();
+
+    /*!
+     * Remove the oldest block from the buffer, adding its time to retired_time.
+     *
+     * \param exit_speed The speed at the end of the block: the entry speed of the next block
+     */
+    void retire_block(double exit_speed);
+
+    /*!
+     * Retire all blocks, the last of which ends at a standstill.
+     */
+    void retire_all_blocks();
+
+    void addTagTime(unsigned int tag, double time)
+    {
+        if (tag_times.size() <= tag)
+            tag_times.resize(tag + 1, 0.0);
+        tag_times[tag] += time;
+    }
     
     void calculate_trapezoid_for_block(Block *block, double entry_factor, double exit_factor);
     void planner_reverse_pass_kernel(Block *previous, Block *current, Block *next);
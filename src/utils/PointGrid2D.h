@@ -0,0 +1,184 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#ifndef POINT_GRID_2D_H
+#define POINT_GRID_2D_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "intpoint.h"
+
+namespace cura
+{
+
+/*!
+ * Container for items with a location, in which the nearest items to a location can be found and from which items can be removed.
+ *
+ * Unlike BucketGrid2D the cells are not hashed: the grid covers a fixed area with a fixed number of cells, so a search can
+ * go outward ring by ring and stop as soon as no cell further away can hold a closer item.
+ */
+template<typename T>
+class PointGrid2D
+{
+public:
+    /*!
+     * The constructor for a point grid.
+     *
+     * \param min The lower left corner of the area in which the items lie
+     * \param max The upper right corner of the area in which the items lie
+     * \param expected_count The number of items which will be inserted; the cells are sized to hold about one item each
+     */
+    PointGrid2D(Point min, Point max, unsigned int expected_count)
+    : min(min)
+    , item_count(0)
+    {
+        double width = std::max(int64_t(1), int64_t(max.X - min.X));
+        double height = std::max(int64_t(1), int64_t(max.Y - min.Y));
+        double cell = std::sqrt(width * height / std::max(1u, expected_count));
+        cell = std::max(cell, std::max(width, height) / 4096); // bound the number of cells of long thin areas
+        cell_size = std::max(int64_t(1), int64_t(std::ceil(cell)));
+        cells_x = (max.X - min.X) / cell_size + 1;
+        cells_y = (max.Y - min.Y) / cell_size + 1;
+        cells.resize(cells_x * cells_y);
+    }
+
+    /*!
+     * Insert an item into the grid.
+     *
+     * \param p The location of \p t, which lies in the area given to the constructor
+     * \param t The item to insert
+     */
+    void insert(const Point& p, const T& t)
+    {
+        cells[getCellIdx(getCellX(p), getCellY(p))].emplace_back(p, t);
+        item_count++;
+    }
+
+    /*!
+     * Remove an item which was inserted at location \p p.
+     *
+     * \param p The location at which \p t was inserted
+     * \param t The item to remove
+     * \return Whether the item was found
+     */
+    bool remove(const Point& p, const T& t)
+    {
+        std::vector<std::pair<Point, T>>& cell = cells[getCellIdx(getCellX(p), getCellY(p))];
+        for (unsigned int idx = 0; idx < cell.size(); idx++)
+        {
+            if (cell[idx].second == t && cell[idx].first == p)
+            {
+                cell[idx] = cell.back();
+                cell.pop_back();
+                item_count--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /*!
+     * Visit the items around \p p ring of cells by ring of cells, until the items which are left are further away than
+     * the squared distance returned by \p process. Every item closer than that is visited, some further ones may be too.
+     *
+     * \param p The location around which to search; may lie outside the area of the grid
+     * \param process Called with the location and the item of each visited item; returns the squared distance within
+     * which items are still of interest, e.g. the distance to the best item found so far
+     */
+    template<typename Process>
+    void findNearestObjects(const Point& p, Process process) const
+    {
+        if (item_count == 0)
+        {
+            return;
+        }
+        const int64_t center_x = std::min(std::max(int64_t(0), int64_t(p.X - min.X) / cell_size), cells_x - 1);
+        const int64_t center_y = std::min(std::max(int64_t(0), int64_t(p.Y - min.Y) / cell_size), cells_y - 1);
+        double max_dist2 = std::numeric_limits<double>::infinity();
+        for (int64_t ring = 0; ; ring++)
+        {
+            if (ring > 0)
+            {
+                // everything within ring - 1 has been visited; stop when all of the grid has been, or when the rest is too far away
+                const int64_t min_x = center_x - ring + 1;
+                const int64_t max_x = center_x + ring - 1;
+                const int64_t min_y = center_y - ring + 1;
+                const int64_t max_y = center_y + ring - 1;
+                if (min_x <= 0 && min_y <= 0 && max_x >= cells_x - 1 && max_y >= cells_y - 1)
+                {
+                    return;
+                }
+                // the distance from p to the nearest side of the visited cells beyond which there are cells left
+                double dist_out = std::numeric_limits<double>::infinity();
+                if (min_x > 0)
+                {
+                    dist_out = std::min(dist_out, double(p.X - min.X) - min_x * cell_size);
+                }
+                if (max_x < cells_x - 1)
+                {
+                    dist_out = std::min(dist_out, double(min.X - p.X) + (max_x + 1) * cell_size);
+                }
+                if (min_y > 0)
+                {
+                    dist_out = std::min(dist_out, double(p.Y - min.Y) - min_y * cell_size);
+                }
+                if (max_y < cells_y - 1)
+                {
+                    dist_out = std::min(dist_out, double(min.Y - p.Y) + (max_y + 1) * cell_size);
+                }
+                if (dist_out > 0 && dist_out * dist_out * (1.0 - 1e-5) > max_dist2) // margin for callers comparing float distances
+                {
+                    return;
+                }
+            }
+            for (int64_t y = center_y - ring; y <= center_y + ring; y++)
+            {
+                if (y < 0 || y >= cells_y)
+                {
+                    continue;
+                }
+                const bool full_row = y == center_y - ring || y == center_y + ring;
+                const int64_t step = full_row? 1 : std::max(int64_t(1), 2 * ring);
+                for (int64_t x = center_x - ring; x <= center_x + ring; x += step)
+                {
+                    if (x < 0 || x >= cells_x)
+                    {
+                        continue;
+                    }
+                    for (const std::pair<Point, T>& item : cells[getCellIdx(x, y)])
+                    {
+                        max_dist2 = process(item.first, item.second);
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    Point min; //!< The lower left corner of the grid
+    int64_t cell_size; //!< The width and height of a cell
+    int64_t cells_x; //!< The number of cells in the x direction
+    int64_t cells_y; //!< The number of cells in the y direction
+    std::vector<std::vector<std::pair<Point, T>>> cells; //!< The items in each cell, row by row
+    unsigned int item_count; //!< The number of items in the grid
+
+    int64_t getCellX(const Point& p) const
+    {
+        return std::min(std::max(int64_t(0), int64_t(p.X - min.X) / cell_size), cells_x - 1);
+    }
+
+    int64_t getCellY(const Point& p) const
+    {
+        return std::min(std::max(int64_t(0), int64_t(p.Y - min.Y) / cell_size), cells_y - 1);
+    }
+
+    unsigned int getCellIdx(int64_t x, int64_t y) const
+    {
+        return y * cells_x + x;
+    }
+};
+
+} // namespace cura
+#endif//POINT_GRID_2D_H
@@ -0,0 +1,521 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#ifndef SPATIAL_HASH_GRID_H
+#define SPATIAL_HASH_GRID_H
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "intpoint.h"
+
+namespace cura
+{
+
+/*!
+ * Container for items with a location, either a point or a segment, in which the items near a location can be found
+ * and from which items can be removed.
+ *
+ * The grid has square cells of a fixed size over the whole plane. Only the cells holding items take up memory: they are
+ * kept in an open addressing hash table on their mixed coordinates. The items are stored in a single vector, through
+ * which each cell links its items; build() stores the items cell by cell, so a cell's items are next to each other.
+ * A segment is stored in every cell its bounding box overlaps.
+ *
+ * Unlike PointGrid2D the area of the items doesn't have to be known in advance, so items can be added anywhere at any
+ * time; a search outward for the nearest items is bounded by a maximum distance instead of by the grid.
+ */
+template<typename T>
+class SpatialHashGrid
+{
+public:
+    /*!
+     * \param cell_size The width and height of a cell; about the distance searched around a location works well
+     * \param expected_count The number of items which will be inserted, to reserve memory for
+     */
+    explicit SpatialHashGrid(int64_t cell_size = MM2INT(1.0), unsigned int expected_count = 0)
+    : cell_size(std::max(int64_t(1), cell_size))
+    , item_count(0)
+    , free_entry(none)
+    , min_cell_x(0)
+    , max_cell_x(-1)
+    , min_cell_y(0)
+    , max_cell_y(-1)
+    {
+        entries.reserve(expected_count);
+        reserveCells(expected_count);
+    }
+
+    /*!
+     * Replace the items by the given points, storing them cell by cell.
+     *
+     * \param points The location and the item of each point
+     */
+    void build(const std::vector<std::pair<Point, T>>& points)
+    {
+        clear();
+        std::vector<std::pair<std::pair<int64_t, int64_t>, unsigned int>> order; // the cell and the index of each point
+        order.reserve(points.size());
+        for (unsigned int idx = 0; idx < points.size(); idx++)
+        {
+            order.emplace_back(std::make_pair(getCell(points[idx].first.X), getCell(points[idx].first.Y)), idx);
+        }
+        std::sort(order.begin(), order.end());
+        entries.reserve(points.size());
+        reserveCells(points.size());
+        // insert the points of each cell from the last to the first, so that its chain runs forward through the vector
+        for (unsigned int run_end = order.size(); run_end > 0; )
+        {
+            unsigned int run_start = run_end - 1;
+            while (run_start > 0 && order[run_start - 1].first == order[run_end - 1].first)
+            {
+                run_start--;
+            }
+            for (unsigned int idx = run_start; idx < run_end; idx++)
+            {
+                const std::pair<Point, T>& point = points[order[idx].second];
+                entries.push_back(Entry{point.first, point.first, point.second, none});
+            }
+            uint32_t& head = getHead(order[run_start].first.first, order[run_start].first.second);
+            for (unsigned int entry_idx = entries.size() - (run_end - run_start); entry_idx + 1 < entries.size(); entry_idx++)
+            {
+                entries[entry_idx].next = entry_idx + 1;
+            }
+            entries.back().next = head;
+            head = entries.size() - (run_end - run_start);
+            run_end = run_start;
+        }
+        item_count = points.size();
+    }
+
+    /*!
+     * Insert a point.
+     *
+     * \param p The location of \p t
+     * \param t The item to insert
+     */
+    void insert(const Point& p, const T& t)
+    {
+        link(getCell(p.X), getCell(p.Y), p, p, t);
+        item_count++;
+    }
+
+    /*!
+     * Insert a segment, in all cells which its bounding box overlaps.
+     *
+     * \param a The start of the segment
+     * \param b The end of the segment
+     * \param t The item to insert
+     */
+    void insertSegment(const Point& a, const Point& b, const T& t)
+    {
+        for (int64_t cell_y = getCell(std::min(a.Y, b.Y)); cell_y <= getCell(std::max(a.Y, b.Y)); cell_y++)
+        {
+            for (int64_t cell_x = getCell(std::min(a.X, b.X)); cell_x <= getCell(std::max(a.X, b.X)); cell_x++)
+            {
+                link(cell_x, cell_y, a, b, t);
+            }
+        }
+        item_count++;
+    }
+
+    /*!
+     * Remove a point which was inserted at location \p p.
+     *
+     * \param p The location at which \p t was inserted
+     * \param t The item to remove
+     * \return Whether the item was found
+     */
+    bool remove(const Point& p, const T& t)
+    {
+        if (!unlink(getCell(p.X), getCell(p.Y), p, p, t))
+        {
+            return false;
+        }
+        item_count--;
+        return true;
+    }
+
+    /*!
+     * Remove a segment which was inserted from \p a to \p b.
+     *
+     * \return Whether the item was found
+     */
+    bool removeSegment(const Point& a, const Point& b, const T& t)
+    {
+        bool found = false;
+        for (int64_t cell_y = getCell(std::min(a.Y, b.Y)); cell_y <= getCell(std::max(a.Y, b.Y)); cell_y++)
+        {
+            for (int64_t cell_x = getCell(std::min(a.X, b.X)); cell_x <= getCell(std::max(a.X, b.X)); cell_x++)
+            {
+                found |= unlink(cell_x, cell_y, a, b, t);
+            }
+        }
+        if (found)
+        {
+            item_count--;
+        }
+        return found;
+    }
+
+    /*!
+     * Remove all items, keeping the cell size.
+     */
+    void clear()
+    {
+        std::vector<Entry>().swap(entries);
+        std::vector<Cell>().swap(cells);
+        cell_count = 0;
+        item_count = 0;
+        free_entry = none;
+        min_cell_x = min_cell_y = 0;
+        max_cell_x = max_cell_y = -1;
+    }
+
+    /*!
+     * The number of items in the grid.
+     */
+    unsigned int size() const
+    {
+        return item_count;
+    }
+
+    /*!
+     * Visit the items in the cells which overlap the square of \p radius around \p p: all items within \p radius of
+     * \p p and some further ones. A segment which is in several of these cells is visited once for each.
+     *
+     * \param process Called with the start, the end (the same as the start for a point) and the item of each visited item
+     */
+    template<typename Process>
+    void forEachNear(const Point& p, int64_t radius, Process process) const
+    {
+        if (item_count == 0)
+        {
+            return;
+        }
+        const int64_t cell_x_end = std::min(getCell(p.X + radius), max_cell_x);
+        const int64_t cell_y_end = std::min(getCell(p.Y + radius), max_cell_y);
+        for (int64_t cell_y = std::max(getCell(p.Y - radius), min_cell_y); cell_y <= cell_y_end; cell_y++)
+        {
+            for (int64_t cell_x = std::max(getCell(p.X - radius), min_cell_x); cell_x <= cell_x_end; cell_x++)
+            {
+                for (uint32_t entry_idx = findHead(cell_x, cell_y); entry_idx != none; entry_idx = entries[entry_idx].next)
+                {
+                    const Entry& entry = entries[entry_idx];
+                    process(entry.a, entry.b, entry.value);
+                }
+            }
+        }
+    }
+
+    /*!
+     * Find the items within \p radius of \p p. A segment is within the radius when any of its points is.
+     *
+     * \param result The items found are added to this; each segment once, when \p T has a less-than and equality operator
+     */
+    void findWithinRadius(const Point& p, int64_t radius, std::vector<T>& result) const
+    {
+        const size_t first_found = result.size();
+        bool segments = false;
+        forEachNear(p, radius, [&](const Point& a, const Point& b, const T& t)
+        {
+            if (getDist2(p, a, b) <= radius * radius)
+            {
+                result.push_back(t);
+                segments |= !(a == b);
+            }
+        });
+        if (segments)
+        {
+            std::sort(result.begin() + first_found, result.end());
+            result.erase(std::unique(result.begin() + first_found, result.end()), result.end());
+        }
+    }
+
+    /*!
+     * Find the \p k items nearest to \p p, within \p max_radius of it.
+     *
+     * Searches outward ring of cells by ring of cells, until the rings left are further away than the k-th item found.
+     *
+     * \param result The items found, nearest first, are added to this
+     */
+    void findNearest(const Point& p, unsigned int k, int64_t max_radius, std::vector<T>& result) const
+    {
+        std::vector<std::pair<int64_t, T>> best; // the squared distance and item of the nearest items found so far, nearest first
+        if (k > 0 && item_count > 0)
+        {
+            const int64_t max_dist2 = max_radius * max_radius;
+            const int64_t center_x = getCell(p.X);
+            const int64_t center_y = getCell(p.Y);
+            for (int64_t ring = 0; ; ring++)
+            {
+                // all items closer than this to p are in the rings visited so far
+                const int64_t covered = std::min(std::min(p.X - center_x * cell_size, (center_x + 1) * cell_size - p.X), std::min(p.Y - center_y * cell_size, (center_y + 1) * cell_size - p.Y)) + (ring - 1) * cell_size;
+                if (ring > 0 && (covered > max_radius || (best.size() == k && covered * covered >= best.back().first)))
+                {
+                    break;
+                }
+                if (center_x - ring < min_cell_x && center_x + ring > max_cell_x && center_y - ring < min_cell_y && center_y + ring > max_cell_y)
+                {
+                    break; // beyond all cells with items
+                }
+                for (int64_t cell_y = center_y - ring; cell_y <= center_y + ring; cell_y++)
+                {
+                    if (cell_y < min_cell_y || cell_y > max_cell_y)
+                    {
+                        continue;
+                    }
+                    const bool full_row = cell_y == center_y - ring || cell_y == center_y + ring;
+                    const int64_t step = full_row? 1 : std::max(int64_t(1), 2 * ring);
+                    for (int64_t cell_x = center_x - ring; cell_x <= center_x + ring; cell_x += step)
+                    {
+                        if (cell_x < min_cell_x || cell_x > max_cell_x)
+                        {
+                            continue;
+                        }
+                        for (uint32_t entry_idx = findHead(cell_x, cell_y); entry_idx != none; entry_idx = entries[entry_idx].next)
+                        {
+                            const Entry& entry = entries[entry_idx];
+                            const int64_t dist2 = getDist2(p, entry.a, entry.b);
+                            if (dist2 > max_dist2 || (best.size() == k && dist2 >= best.back().first))
+                            {
+                                continue;
+                            }
+                            if (!(entry.a == entry.b) && std::find_if(best.begin(), best.end(), [&entry](const std::pair<int64_t, T>& found) { return found.second == entry.value; }) != best.end())
+                            {
+                                continue; // a segment already found in another cell
+                            }
+                            std::pair<int64_t, T> found(dist2, entry.value);
+                            best.insert(std::upper_bound(best.begin(), best.end(), found, [](const std::pair<int64_t, T>& a, const std::pair<int64_t, T>& b) { return a.first < b.first; }), found);
+                            if (best.size() > k)
+                            {
+                                best.pop_back();
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        for (const std::pair<int64_t, T>& found : best)
+        {
+            result.push_back(found.second);
+        }
+    }
+
+    /*!
+     * Find the item nearest to \p p, within \p max_radius of it.
+     *
+     * \param nearest Output parameter: the nearest item, if any
+     * \return Whether an item has been found
+     */
+    bool findNearest(const Point& p, int64_t max_radius, T& nearest) const
+    {
+        std::vector<T> result;
+        findNearest(p, 1, max_radius, result);
+        if (result.empty())
+        {
+            return false;
+        }
+        nearest = result[0];
+        return true;
+    }
+
+private:
+    static const uint32_t none = static_cast<uint32_t>(-1); //!< The end of a chain, or an empty cell
+
+    struct Entry
+    {
+        Point a; //!< The location of a point, or the start of a segment
+        Point b; //!< The location of a point, or the end of a segment
+        T value;
+        uint32_t next; //!< The next entry in the same cell, or in the free list
+    };
+
+    struct Cell
+    {
+        int64_t x;
+        int64_t y;
+        uint32_t head; //!< The first entry in the cell, or none when all its items are removed
+        bool used; //!< Whether the slot holds a cell; slots stay used once they do, to keep the probe sequences intact
+    };
+
+    int64_t cell_size; //!< The width and height of a cell
+    std::vector<Entry> entries; //!< The items, linked per cell
+    std::vector<Cell> cells; //!< Hash table of the cells with items; its size is a power of two and at most half full
+    unsigned int cell_count; //!< The number of used slots in SpatialHashGrid::cells
+    unsigned int item_count; //!< The number of items, counting each segment once
+    uint32_t free_entry; //!< The first of the entries freed by removing items, linked through Entry::next
+    int64_t min_cell_x, max_cell_x, min_cell_y, max_cell_y; //!< The range of the cells which ever held items
+
+    int64_t getCell(int64_t coord) const
+    {
+        return (coord >= 0)? coord / cell_size : (coord + 1) / cell_size - 1;
+    }
+
+    static uint64_t hashCell(int64_t x, int64_t y)
+    {
+        uint64_t hash = uint64_t(x) * 0x9E3779B97F4A7C15ull ^ uint64_t(y);
+        hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ull; // the finalizer of SplitMix64
+        hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBull;
+        return hash ^ (hash >> 31);
+    }
+
+    /*!
+     * The squared distance from \p p to the segment from \p a to \p b.
+     */
+    static int64_t getDist2(const Point& p, const Point& a, const Point& b)
+    {
+        const Point ab = b - a;
+        const int64_t length2 = vSize2(ab);
+        const int64_t projected = dot(p - a, ab);
+        if (length2 == 0 || projected <= 0)
+        {
+            return vSize2(p - a);
+        }
+        if (projected >= length2)
+        {
+            return vSize2(p - b);
+        }
+        const double t = double(projected) / length2;
+        const double dx = a.X + ab.X * t - p.X;
+        const double dy = a.Y + ab.Y * t - p.Y;
+        return static_cast<int64_t>(dx * dx + dy * dy);
+    }
+
+    void reserveCells(size_t item_count)
+    {
+        if (cells.size() >= 2 * item_count && cells.size() > 0)
+        {
+            return;
+        }
+        size_t table_size = 16;
+        while (table_size < 2 * item_count)
+        {
+            table_size *= 2;
+        }
+        rehash(table_size);
+    }
+
+    void rehash(size_t table_size)
+    {
+        std::vector<Cell> old_cells;
+        old_cells.swap(cells);
+        cells.assign(table_size, Cell{0, 0, none, false});
+        cell_count = 0;
+        for (const Cell& cell : old_cells)
+        {
+            if (cell.used && cell.head != none)
+            {
+                getHead(cell.x, cell.y) = cell.head;
+            }
+        }
+    }
+
+    /*!
+     * The head of the chain of a cell, adding the cell when it isn't in the table.
+     */
+    uint32_t& getHead(int64_t x, int64_t y)
+    {
+        if (2 * (cell_count + 1) > cells.size())
+        {
+            rehash(std::max(size_t(16), cells.size() * 2));
+        }
+        const size_t mask = cells.size() - 1;
+        for (size_t slot = hashCell(x, y) & mask; ; slot = (slot + 1) & mask)
+        {
+            Cell& cell = cells[slot];
+            if (!cell.used)
+            {
+                cell.x = x;
+                cell.y = y;
+                cell.used = true;
+                cell_count++;
+                min_cell_x = (max_cell_x < min_cell_x)? x : std::min(min_cell_x, x);
+                max_cell_x = std::max(max_cell_x, x);
+                min_cell_y = (max_cell_y < min_cell_y)? y : std::min(min_cell_y, y);
+                max_cell_y = std::max(max_cell_y, y);
+                return cell.head;
+            }
+            if (cell.x == x && cell.y == y)
+            {
+                return cell.head;
+            }
+        }
+    }
+
+    /*!
+     * The slot of a cell, or null when the cell never held items.
+     */
+    const Cell* findCell(int64_t x, int64_t y) const
+    {
+        if (cells.empty())
+        {
+            return nullptr;
+        }
+        const size_t mask = cells.size() - 1;
+        for (size_t slot = hashCell(x, y) & mask; ; slot = (slot + 1) & mask)
+        {
+            const Cell& cell = cells[slot];
+            if (!cell.used)
+            {
+                return nullptr;
+            }
+            if (cell.x == x && cell.y == y)
+            {
+                return &cell;
+            }
+        }
+    }
+
+    /*!
+     * The first entry of a cell, or none when the cell holds no items.
+     */
+    uint32_t findHead(int64_t x, int64_t y) const
+    {
+        const Cell* cell = findCell(x, y);
+        return cell? cell->head : none;
+    }
+
+    void link(int64_t cell_x, int64_t cell_y, const Point& a, const Point& b, const T& t)
+    {
+        uint32_t entry_idx;
+        if (free_entry != none)
+        {
+            entry_idx = free_entry;
+            free_entry = entries[entry_idx].next;
+            entries[entry_idx] = Entry{a, b, t, none};
+        }
+        else
+        {
+            entry_idx = entries.size();
+            entries.push_back(Entry{a, b, t, none});
+        }
+        uint32_t& head = getHead(cell_x, cell_y);
+        entries[entry_idx].next = head;
+        head = entry_idx;
+    }
+
+    bool unlink(int64_t cell_x, int64_t cell_y, const Point& a, const Point& b, const T& t)
+    {
+        Cell* cell = const_cast<Cell*>(findCell(cell_x, cell_y));
+        if (!cell)
+        {
+            return false;
+        }
+        for (uint32_t* link = &cell->head; *link != none; link = &entries[*link].next)
+        {
+            Entry& entry = entries[*link];
+            if (entry.value == t && entry.a == a && entry.b == b)
+            {
+                const uint32_t entry_idx = *link;
+                *link = entry.next;
+                entry.next = free_entry;
+                free_entry = entry_idx;
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+} // namespace cura
+#endif//SPATIAL_HASH_GRID_H
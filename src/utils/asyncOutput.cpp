@@ -0,0 +1,98 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#include "asyncOutput.h"
+
+namespace cura
+{
+
+AsyncOutputBuffer::AsyncOutputBuffer(Sink sink, size_t buffer_size)
+: sink(sink)
+, filling(0)
+, pending_size(0)
+, stopping(false)
+{
+    buffers[0].resize(buffer_size);
+    buffers[1].resize(buffer_size);
+    setp(&buffers[0][0], &buffers[0][0] + buffer_size);
+    writer = std::thread(&AsyncOutputBuffer::run, this);
+}
+
+AsyncOutputBuffer::~AsyncOutputBuffer()
+{
+    handOver();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work.notify_one();
+    writer.join();
+}
+
+void AsyncOutputBuffer::handOver()
+{
+    size_t size = pptr() - pbase();
+    if (size == 0)
+    {
+        return;
+    }
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this]() { return pending_size == 0; });
+        pending_size = size;
+        filling = 1 - filling;
+    }
+    work.notify_one();
+    setp(&buffers[filling][0], &buffers[filling][0] + buffers[filling].size());
+}
+
+void AsyncOutputBuffer::discard()
+{
+    setp(&buffers[filling][0], &buffers[filling][0] + buffers[filling].size());
+}
+
+AsyncOutputBuffer::int_type AsyncOutputBuffer::overflow(int_type c)
+{
+    handOver();
+    if (!traits_type::eq_int_type(c, traits_type::eof()))
+    {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+int AsyncOutputBuffer::sync()
+{
+    handOver();
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this]() { return pending_size == 0; });
+    return 0;
+}
+
+void AsyncOutputBuffer::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        work.wait(lock, [this]() { return pending_size > 0 || stopping; });
+        if (pending_size == 0)
+        {
+            return;
+        }
+        // the buffer not being filled can't change until pending_size is reset, so it is written without the lock
+        std::string& pending = buffers[1 - filling];
+        const size_t size = pending_size;
+        const size_t buffer_size = pending.size();
+        lock.unlock();
+        sink(pending, size);
+        if (pending.size() != buffer_size)
+        { // the sink took the buffer
+            pending.clear();
+            pending.resize(buffer_size);
+        }
+        lock.lock();
+        pending_size = 0;
+        idle.notify_all();
+    }
+}
+
+}//namespace cura
@@ -0,0 +1,115 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#ifndef UTILS_ASYNC_OUTPUT_H
+#define UTILS_ASYNC_OUTPUT_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+
+namespace cura
+{
+
+/*!
+ * A stream buffer with two large buffers of a fixed size: while one is being filled, the other is passed on to the sink
+ * by a background thread. The thread writing into the stream only waits when it fills a buffer faster than the sink
+ * takes the previous one.
+ */
+class AsyncOutputBuffer : public std::streambuf
+{
+public:
+    /*!
+     * Where the data ends up, e.g. a file or a socket. Called from the background thread, with the data in order.
+     *
+     * The data is the first \p size bytes of \p buffer. The sink may take the buffer instead of copying the data out of
+     * it, by swapping it with an empty string; a new buffer is then allocated in its place.
+     */
+    typedef std::function<void (std::string& buffer, size_t size)> Sink;
+
+    /*!
+     * \param sink Where to pass the written data on to
+     * \param buffer_size The size of each of the two buffers
+     */
+    AsyncOutputBuffer(Sink sink, size_t buffer_size);
+
+    /*!
+     * Passes the remaining data on to the sink and waits for it.
+     */
+    ~AsyncOutputBuffer();
+
+    /*!
+     * Hand the data written so far to the background thread, without waiting for it to reach the sink.
+     */
+    void handOver();
+
+    /*!
+     * Drop the data written since it was last handed over, e.g. the rest of a job which was abandoned.
+     */
+    void discard();
+
+protected:
+    int_type overflow(int_type c) override;
+
+    /*!
+     * Hand the data written so far to the background thread and wait until it has reached the sink.
+     */
+    int sync() override;
+
+private:
+    Sink sink;
+    std::string buffers[2];
+    unsigned int filling; //!< The index of the buffer being filled
+    size_t pending_size; //!< The amount of data in the other buffer still to pass on to the sink; zero when the background thread is idle
+    bool stopping; //!< Whether the background thread should stop once it is idle
+    std::mutex mutex; //!< Guards pending_size and stopping
+    std::condition_variable work; //!< Notified when there is data to pass on, or when stopping
+    std::condition_variable idle; //!< Notified when the background thread has passed on its data
+    std::thread writer;
+
+    /*!
+     * The loop of the background thread.
+     */
+    void run();
+};
+
+/*!
+ * An output stream which passes its data on to a sink from a background thread, see AsyncOutputBuffer.
+ *
+ * flush() waits until everything written before has reached the sink.
+ */
+class AsyncOutputStream : public std::ostream
+{
+public:
+    AsyncOutputStream(AsyncOutputBuffer::Sink sink, size_t buffer_size = 1 << 20)
+    : std::ostream(nullptr)
+    , buffer(sink, buffer_size)
+    {
+        rdbuf(&buffer);
+    }
+
+    /*!
+     * Hand the data written so far to the background thread, without waiting for it to reach the sink.
+     */
+    void handOver()
+    {
+        buffer.handOver();
+    }
+
+    /*!
+     * Drop the data written since it was last handed over.
+     */
+    void discard()
+    {
+        buffer.discard();
+    }
+
+private:
+    AsyncOutputBuffer buffer;
+};
+
+}//namespace cura
+
+#endif//UTILS_ASYNC_OUTPUT_H
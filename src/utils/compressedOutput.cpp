@@ -0,0 +1,169 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#include "compressedOutput.h"
+
+#include <vector>
+
+#ifdef HAVE_ZLIB
+#include <string.h>
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace cura
+{
+
+namespace
+{
+
+bool endsWith(const std::string& text, const std::string& end)
+{
+    return text.size() >= end.size() && text.compare(text.size() - end.size(), end.size(), end) == 0;
+}
+
+#ifdef HAVE_ZLIB
+class GzipCompressor : public OutputCompressor
+{
+public:
+    GzipCompressor(std::ostream& output)
+    : output(output)
+    , buffer(1 << 18)
+    {
+        memset(&stream, 0, sizeof(stream));
+        deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY); // 15 + 16: a 32kB window with a gzip header
+    }
+
+    ~GzipCompressor()
+    {
+        compress(nullptr, 0, Z_FINISH);
+        deflateEnd(&stream);
+        output.flush();
+    }
+
+    void write(const char* data, size_t size) override
+    {
+        compress(data, size, Z_NO_FLUSH);
+    }
+
+private:
+    std::ostream& output;
+    std::vector<char> buffer;
+    z_stream stream;
+
+    void compress(const char* data, size_t size, int flush)
+    {
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        stream.avail_in = size;
+        do
+        {
+            stream.next_out = reinterpret_cast<Bytef*>(buffer.data());
+            stream.avail_out = buffer.size();
+            deflate(&stream, flush);
+            output.write(buffer.data(), buffer.size() - stream.avail_out);
+        } while (stream.avail_out == 0);
+    }
+};
+#endif
+
+#ifdef HAVE_ZSTD
+class ZstdCompressor : public OutputCompressor
+{
+public:
+    ZstdCompressor(std::ostream& output)
+    : output(output)
+    , buffer(ZSTD_CStreamOutSize())
+    , stream(ZSTD_createCStream())
+    {
+        ZSTD_initCStream(stream, 3);
+    }
+
+    ~ZstdCompressor()
+    {
+        size_t remaining;
+        do
+        {
+            ZSTD_outBuffer out = { buffer.data(), buffer.size(), 0 };
+            remaining = ZSTD_endStream(stream, &out);
+            output.write(buffer.data(), out.pos);
+        } while (remaining > 0 && !ZSTD_isError(remaining));
+        ZSTD_freeCStream(stream);
+        output.flush();
+    }
+
+    void write(const char* data, size_t size) override
+    {
+        ZSTD_inBuffer in = { data, size, 0 };
+        while (in.pos < in.size)
+        {
+            ZSTD_outBuffer out = { buffer.data(), buffer.size(), 0 };
+            if (ZSTD_isError(ZSTD_compressStream(stream, &out, &in)))
+            {
+                return;
+            }
+            output.write(buffer.data(), out.pos);
+        }
+    }
+
+private:
+    std::ostream& output;
+    std::vector<char> buffer;
+    ZSTD_CStream* stream;
+};
+#endif
+
+}//anonymous namespace
+
+OutputCompression getOutputCompression(const std::string& filename)
+{
+    if (endsWith(filename, ".gz"))
+    {
+        return Compression_Gzip;
+    }
+    if (endsWith(filename, ".zst"))
+    {
+        return Compression_Zstd;
+    }
+    return Compression_None;
+}
+
+bool isOutputCompressionAvailable(OutputCompression compression)
+{
+    switch (compression)
+    {
+    case Compression_None:
+        return true;
+    case Compression_Gzip:
+#ifdef HAVE_ZLIB
+        return true;
+#else
+        return false;
+#endif
+    case Compression_Zstd:
+#ifdef HAVE_ZSTD
+        return true;
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+std::unique_ptr<OutputCompressor> OutputCompressor::create(OutputCompression compression, std::ostream& output)
+{
+    switch (compression)
+    {
+#ifdef HAVE_ZLIB
+    case Compression_Gzip:
+        return std::unique_ptr<OutputCompressor>(new GzipCompressor(output));
+#endif
+#ifdef HAVE_ZSTD
+    case Compression_Zstd:
+        return std::unique_ptr<OutputCompressor>(new ZstdCompressor(output));
+#endif
+    default:
+        return nullptr;
+    }
+}
+
+}//namespace cura
@@ -0,0 +1,53 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#ifndef UTILS_COMPRESSED_OUTPUT_H
+#define UTILS_COMPRESSED_OUTPUT_H
+
+#include <memory>
+#include <ostream>
+#include <string>
+
+namespace cura
+{
+
+enum OutputCompression
+{
+    Compression_None,
+    Compression_Gzip, //!< .gz, needs zlib (HAVE_ZLIB)
+    Compression_Zstd, //!< .zst, needs libzstd (HAVE_ZSTD)
+};
+
+/*!
+ * The compression to write an output file with, from the extension of its name.
+ */
+OutputCompression getOutputCompression(const std::string& filename);
+
+/*!
+ * Whether this build of the engine can write output with \p compression.
+ */
+bool isOutputCompressionAvailable(OutputCompression compression);
+
+/*!
+ * Compresses data incrementally into an output stream.
+ *
+ * The compressed stream is completed when the compressor is destroyed, so the output stream has to outlive it.
+ */
+class OutputCompressor
+{
+public:
+    /*!
+     * \param compression The compression to use, which has to be available and not Compression_None
+     * \param output The stream to write the compressed data to
+     */
+    static std::unique_ptr<OutputCompressor> create(OutputCompression compression, std::ostream& output);
+
+    virtual ~OutputCompressor() {}
+
+    /*!
+     * Compress the next part of the data and write whatever compressed data is ready to the output stream.
+     */
+    virtual void write(const char* data, size_t size) = 0;
+};
+
+}//namespace cura
+
+#endif//UTILS_COMPRESSED_OUTPUT_H
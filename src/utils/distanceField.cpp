@@ -0,0 +1,319 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#include "distanceField.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace cura {
+
+namespace
+{
+const int grid_margin = 2; //!< The number of grid points around the bounding box, so that the border is outside the area
+const double far_away = 1e20; //!< The squared distance of the points which have no feature point yet
+
+/*!
+ * The number of grid points along one side of a bounding box.
+ */
+int64_t getGridSize(int64_t extent, int64_t cell_size)
+{
+    return extent / cell_size + 1 + 2 * grid_margin;
+}
+
+/*!
+ * The one dimensional squared distance transform of Felzenszwalb and Huttenlocher: for each index q the least
+ * (q - p)^2 + f[p], in linear time by keeping the lower envelope of the parabolas rooted at each p.
+ *
+ * \param f The squared distances so far, \p n of them
+ * \param d The result, \p n values
+ * \param v Scratch space for the roots of the parabolas of the envelope, \p n values
+ * \param z Scratch space for the boundaries between those parabolas, \p n + 1 values
+ */
+void transform1D(const double* f, unsigned int n, double* d, unsigned int* v, double* z)
+{
+    unsigned int k = 0;
+    v[0] = 0;
+    z[0] = -far_away;
+    z[1] = far_away;
+    auto intersection = [f](unsigned int q, unsigned int p)
+    {
+        return ((f[q] + double(q) * q) - (f[p] + double(p) * p)) / (2.0 * q - 2.0 * p);
+    };
+    for (unsigned int q = 1; q < n; q++)
+    {
+        double s = intersection(q, v[k]);
+        while (s <= z[k])
+        {
+            k--;
+            s = intersection(q, v[k]);
+        }
+        k++;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = far_away;
+    }
+    k = 0;
+    for (unsigned int q = 0; q < n; q++)
+    {
+        while (z[k + 1] < q)
+        {
+            k++;
+        }
+        double offset = double(q) - v[k];
+        d[q] = offset * offset + f[v[k]];
+    }
+}
+
+/*!
+ * For each grid point the squared distance, in cells, to the nearest grid point for which \p feature is set.
+ */
+std::vector<float> squaredDistances(const std::vector<unsigned char>& feature, int width, int height)
+{
+    std::vector<float> grid(feature.size());
+    for (unsigned int idx = 0; idx < feature.size(); idx++)
+    {
+        grid[idx] = feature[idx] ? 0.0f : float(far_away);
+    }
+    unsigned int n = std::max(width, height);
+    std::vector<double> f(n);
+    std::vector<double> d(n);
+    std::vector<unsigned int> v(n);
+    std::vector<double> z(n + 1);
+    for (int x = 0; x < width; x++)
+    {
+        for (int y = 0; y < height; y++)
+        {
+            f[y] = grid[y * width + x];
+        }
+        transform1D(f.data(), height, d.data(), v.data(), z.data());
+        for (int y = 0; y < height; y++)
+        {
+            grid[y * width + x] = d[y];
+        }
+    }
+    for (int y = 0; y < height; y++)
+    {
+        float* row = &grid[y * width];
+        for (int x = 0; x < width; x++)
+        {
+            f[x] = row[x];
+        }
+        transform1D(f.data(), width, d.data(), v.data(), z.data());
+        for (int x = 0; x < width; x++)
+        {
+            row[x] = d[x];
+        }
+    }
+    return grid;
+}
+}//namespace
+
+DistanceField::DistanceField()
+: cell_size(1)
+, origin(0, 0)
+, width(0)
+, height(0)
+{
+}
+
+DistanceField::DistanceField(const Polygons& polygons, int64_t cell_size)
+: cell_size(cell_size)
+{
+    AABB box(polygons);
+    origin = box.min - Point(grid_margin * cell_size, grid_margin * cell_size);
+    width = getGridSize(box.max.X - box.min.X, cell_size);
+    height = getGridSize(box.max.Y - box.min.Y, cell_size);
+
+    // Which grid points are inside, by the even-odd rule along each row of points.
+    std::vector<std::pair<int, double>> crossings; // the row and the x of each crossing of a row with an edge, in cells
+    for (const ClipperLib::Path& poly : polygons)
+    {
+        for (unsigned int idx = 0; idx < poly.size(); idx++)
+        {
+            Point a = poly[idx] - origin;
+            Point b = poly[(idx + 1) % poly.size()] - origin;
+            if (a.Y == b.Y)
+            {
+                continue;
+            }
+            if (a.Y > b.Y)
+            {
+                std::swap(a, b);
+            }
+            // the rows at a.Y <= y < b.Y
+            for (int64_t row = (a.Y + cell_size - 1) / cell_size; row * cell_size < b.Y; row++)
+            {
+                double y = double(row * cell_size);
+                double x = a.X + (y - a.Y) * (b.X - a.X) / (b.Y - a.Y);
+                crossings.emplace_back(row, x / cell_size);
+            }
+        }
+    }
+    std::sort(crossings.begin(), crossings.end());
+    std::vector<unsigned char> inside(width * height, 0);
+    for (unsigned int idx = 0; idx + 1 < crossings.size(); idx += 2)
+    {
+        int row = crossings[idx].first;
+        unsigned char* row_inside = &inside[row * width];
+        int end = std::min(width, int(std::ceil(crossings[idx + 1].second)));
+        for (int x = std::max(0, int(std::ceil(crossings[idx].second))); x < end; x++)
+        {
+            row_inside[x] = 1;
+        }
+    }
+    computeDistances(inside);
+}
+
+int64_t DistanceField::getCellSize(const Polygons& polygons, int64_t cell_size, int64_t max_cell_size, uint64_t max_cell_count)
+{
+    AABB box(polygons);
+    cell_size = std::max(int64_t(1), cell_size);
+    while (cell_size <= max_cell_size)
+    {
+        uint64_t cell_count = getGridSize(box.max.X - box.min.X, cell_size) * getGridSize(box.max.Y - box.min.Y, cell_size);
+        if (cell_count <= max_cell_count)
+        {
+            return cell_size;
+        }
+        cell_size = cell_size * 5 / 4 + 1;
+    }
+    return 0;
+}
+
+void DistanceField::computeDistances(const std::vector<unsigned char>& inside)
+{
+    std::vector<unsigned char> outside(inside.size());
+    for (unsigned int idx = 0; idx < inside.size(); idx++)
+    {
+        outside[idx] = !inside[idx];
+    }
+    std::vector<float> to_outside = squaredDistances(outside, width, height);
+    std::vector<float> to_inside = squaredDistances(inside, width, height);
+    // The boundary lies somewhere between a point inside and the nearest point outside, so half a cell is taken off.
+    values.resize(inside.size());
+    for (unsigned int idx = 0; idx < inside.size(); idx++)
+    {
+        if (inside[idx])
+        {
+            values[idx] = (std::sqrt(to_outside[idx]) - 0.5f) * cell_size;
+        }
+        else
+        {
+            values[idx] = -(std::sqrt(to_inside[idx]) - 0.5f) * cell_size;
+        }
+    }
+}
+
+Polygons DistanceField::getArea(int distance) const
+{
+    std::vector<float> levels(values.size());
+    for (unsigned int idx = 0; idx < values.size(); idx++)
+    {
+        levels[idx] = values[idx] - distance;
+    }
+    return getContour(levels);
+}
+
+DistanceField DistanceField::getFieldOfArea(int distance) const
+{
+    DistanceField ret;
+    ret.cell_size = cell_size;
+    ret.origin = origin;
+    ret.width = width;
+    ret.height = height;
+    std::vector<unsigned char> inside(values.size());
+    for (unsigned int idx = 0; idx < values.size(); idx++)
+    {
+        inside[idx] = values[idx] >= distance;
+    }
+    ret.computeDistances(inside);
+    return ret;
+}
+
+Polygons DistanceField::getAreaDifference(const DistanceField& a, int distance_a, const DistanceField& b, int distance_b)
+{
+    std::vector<float> levels(a.values.size());
+    for (unsigned int idx = 0; idx < a.values.size(); idx++)
+    {
+        levels[idx] = std::min(a.values[idx] - distance_a, distance_b - b.values[idx]);
+    }
+    return a.getContour(levels);
+}
+
+Polygons DistanceField::getContour(const std::vector<float>& levels) const
+{
+    // Marching squares. The crossings of the contour with the edges between the grid points are linked into loops:
+    // next[edge] is the edge where the contour leaves the cell it enters through edge, with the area on its left.
+    // Edge y * width + x is the one from point (x, y) to (x + 1, y), and width * height + y * width + x the one from
+    // (x, y) to (x, y + 1).
+    int vertical = width * height;
+    std::vector<int> next(2 * width * height, -1);
+    for (int y = 0; y + 1 < height; y++)
+    {
+        for (int x = 0; x + 1 < width; x++)
+        {
+            // the corners and edges of the cell counter-clockwise, starting at its lower left corner
+            float corner_levels[4] = { levels[y * width + x], levels[y * width + x + 1], levels[(y + 1) * width + x + 1], levels[(y + 1) * width + x] };
+            int edges[4] = { y * width + x, vertical + y * width + x + 1, (y + 1) * width + x, vertical + y * width + x };
+            int crossed[4]; // the indices of the edges where the contour crosses, counter-clockwise
+            int crossed_count = 0;
+            for (int side = 0; side < 4; side++)
+            {
+                if ((corner_levels[side] >= 0) != (corner_levels[(side + 1) % 4] >= 0))
+                {
+                    crossed[crossed_count++] = side;
+                }
+            }
+            if (crossed_count == 0)
+            {
+                continue;
+            }
+            // Going around the cell, the contour leaves at the edges where the area ends, to the edge where it starts
+            // again before it; unless the two diagonal corners in the area are connected through the center.
+            bool center_inside = corner_levels[0] + corner_levels[1] + corner_levels[2] + corner_levels[3] >= 0;
+            for (int crossing = 0; crossing < crossed_count; crossing++)
+            {
+                int side = crossed[crossing];
+                if (corner_levels[side] < 0)
+                {
+                    continue; // the area starts here
+                }
+                int partner = (crossed_count == 4 && center_inside) ? crossed[(crossing + 1) % 4] : crossed[(crossing + crossed_count - 1) % crossed_count];
+                next[edges[side]] = edges[partner];
+            }
+        }
+    }
+
+    Polygons ret;
+    for (unsigned int start = 0; start < next.size(); start++)
+    {
+        if (next[start] < 0)
+        {
+            continue;
+        }
+        PolygonRef poly = ret.newPoly();
+        int edge = start;
+        while (next[edge] >= 0)
+        {
+            int from = (edge < vertical) ? edge : edge - vertical;
+            int to = (edge < vertical) ? from + 1 : from + width;
+            float t = levels[from] / (levels[from] - levels[to]);
+            double x = from % width;
+            double y = from / width;
+            if (edge < vertical)
+            {
+                x += t;
+            }
+            else
+            {
+                y += t;
+            }
+            poly.add(origin + Point(std::llround(x * cell_size), std::llround(y * cell_size)));
+            int following = next[edge];
+            next[edge] = -1;
+            edge = following;
+        }
+    }
+    return ret;
+}
+
+}//namespace cura
@@ -0,0 +1,94 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#ifndef UTILS_DISTANCE_FIELD_H
+#define UTILS_DISTANCE_FIELD_H
+
+#include <vector>
+
+#include "polygon.h"
+
+namespace cura {
+
+/*!
+ * The signed distance to the boundary of an area, sampled on a square grid: positive inside the area, negative outside.
+ *
+ * An inward offset of the area by any distance is then the contour of the field at that distance, so the walls of a
+ * part all come from the same field, and the time taken depends on the size of the grid rather than on the number of
+ * points of the outline. Where ClipperOffset struggles with outlines of hundreds of thousands of points, like those of
+ * scanned models or lattices, this is far faster, at the cost of the contours only being accurate to about half a cell.
+ *
+ * The distances of the grid points are computed with the exact Euclidean distance transform of Felzenszwalb and
+ * Huttenlocher, from which point is in the area; the contours are found by marching squares and have the orientation
+ * of the polygons of Clipper: outlines counter-clockwise and holes clockwise. Offsets have round corners, like
+ * offsetting with ClipperLib::jtRound.
+ */
+class DistanceField
+{
+public:
+    /*!
+     * The field of the area of \p polygons, by the even-odd rule, on a grid covering their bounding box.
+     *
+     * \param polygons The area
+     * \param cell_size The distance between the grid points, as chosen by getCellSize
+     */
+    DistanceField(const Polygons& polygons, int64_t cell_size);
+
+    /*!
+     * The distance between grid points to use for the field of some polygons: \p cell_size, or a larger one up to \p
+     * max_cell_size when the bounding box of the polygons would otherwise need more than \p max_cell_count points.
+     *
+     * \return The distance between the grid points; zero when the polygons are too large even for \p max_cell_size
+     */
+    static int64_t getCellSize(const Polygons& polygons, int64_t cell_size, int64_t max_cell_size, uint64_t max_cell_count);
+
+    /*!
+     * The area where the field is at least \p distance, the same as offsetting the area by -\p distance with round
+     * corners. A negative \p distance grows the area; that is only right for a field made by getFieldOfArea, and only
+     * as long as the area stays within the polygons of the first field, since the grid ends just outside of those.
+     */
+    Polygons getArea(int distance) const;
+
+    /*!
+     * The field of the area getArea(\p distance), to offset that area further from.
+     *
+     * Growing an area and shrinking it again isn't the same as doing nothing, so after an offset in one direction the
+     * distances have to be measured anew from the offset area before offsetting it in the other direction.
+     */
+    DistanceField getFieldOfArea(int distance) const;
+
+    /*!
+     * The area where \p a is at least \p distance_a and \p b is less than \p distance_b, that is
+     * a.getArea(distance_a).difference(b.getArea(distance_b)).
+     *
+     * \param a A field
+     * \param distance_a The distance in \p a
+     * \param b A field on the same grid as \p a, made from it by getFieldOfArea
+     * \param distance_b The distance in \p b
+     */
+    static Polygons getAreaDifference(const DistanceField& a, int distance_a, const DistanceField& b, int distance_b);
+
+private:
+    int64_t cell_size; //!< The distance between the grid points
+    Point origin; //!< The position of grid point (0, 0)
+    int width; //!< The number of grid points along x
+    int height; //!< The number of grid points along y
+    std::vector<float> values; //!< The signed distance at each grid point, row by row
+
+    /*!
+     * An empty field, for getFieldOfArea to fill in.
+     */
+    DistanceField();
+
+    /*!
+     * Fill the values from which grid points are inside the area.
+     */
+    void computeDistances(const std::vector<unsigned char>& inside);
+
+    /*!
+     * The contour where \p levels goes from negative to zero or more, with a value for each grid point.
+     */
+    Polygons getContour(const std::vector<float>& levels) const;
+};
+
+}//namespace cura
+
+#endif//UTILS_DISTANCE_FIELD_H
@@ -120,6 +120,30 @@ public:
             MM2INT(p.x * m[0][1] + p.y * m[1][1] + p.z * m[2][1]),
             MM2INT(p.x * m[0][2] + p.y * m[1][2] + p.z * m[2][2]));
     }
+
+    /*!
+     * Apply the matrix to a batch of points, given as separate arrays of coordinates.
+     * 
+     * Gives exactly the same results as apply(const FPoint3&), but the simple loop over contiguous arrays can be vectorized by the compiler.
+     * 
+     * \param x The x coordinates of the points
+     * \param y The y coordinates of the points
+     * \param z The z coordinates of the points
+     * \param count The number of points
+     * \param result Output parameter: the transformed points
+     */
+    void apply(const float* x, const float* y, const float* z, unsigned int count, Point3* result) const
+    {
+        const double m00 = m[0][0], m10 = m[1][0], m20 = m[2][0];
+        const double m01 = m[0][1], m11 = m[1][1], m21 = m[2][1];
+        const double m02 = m[0][2], m12 = m[1][2], m22 = m[2][2];
+        for (unsigned int i = 0; i < count; i++)
+        {
+            result[i].x = MM2INT(x[i] * m00 + y[i] * m10 + z[i] * m20);
+            result[i].y = MM2INT(x[i] * m01 + y[i] * m11 + z[i] * m21);
+            result[i].z = MM2INT(x[i] * m02 + y[i] * m12 + z[i] * m22);
+        }
+    }
 };
 
 #endif//INT_POINT_H
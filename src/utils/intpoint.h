@@ -125,7 +125,10 @@ inline Point3 operator*(const double d, const Point3& rhs) {
     return rhs * d;
 }
 
-/* 64bit Points are used mostly troughout the code, these are the 2D points from ClipperLib */
+/* 64bit Points are used mostly troughout the code, these are the 2D points from ClipperLib.
+   When built with COORD_INT32 (use_int32 for ClipperLib) the coordinates are 32 bit, which halves the memory of all
+   geometry; coordinates then have to stay within +/- 2^30 micron, and products of coordinates have to be taken in 64 bit,
+   as vSize2, dot and cross do. */
 typedef ClipperLib::IntPoint Point;
 
 class IntPoint {
@@ -152,7 +155,7 @@ INLINE Point& operator -= (Point& p0, const Point& p1) { p0.X -= p1.X; p0.Y -= p
 
 INLINE int64_t vSize2(const Point& p0)
 {
-    return p0.X*p0.X+p0.Y*p0.Y;
+    return int64_t(p0.X)*p0.X+int64_t(p0.Y)*p0.Y;
 }
 INLINE float vSize2f(const Point& p0)
 {
@@ -165,7 +168,7 @@ INLINE bool shorterThen(const Point& p0, int32_t len)
         return false;
     if (p0.Y > len || p0.Y < -len)
         return false;
-    return vSize2(p0) <= len*len;
+    return vSize2(p0) <= int64_t(len)*len;
 }
 
 INLINE int64_t vSize(const Point& p0)
@@ -185,7 +188,7 @@ INLINE Point normal(const Point& p0, int64_t len)
     int64_t _len = vSize(p0);
     if (_len < 1)
         return Point(len, 0);
-    return p0 * len / _len;
+    return Point(int64_t(p0.X) * len / _len, int64_t(p0.Y) * len / _len);
 }
 
 INLINE Point crossZ(const Point& p0)
@@ -194,7 +197,11 @@ INLINE Point crossZ(const Point& p0)
 }
 INLINE int64_t dot(const Point& p0, const Point& p1)
 {
-    return p0.X * p1.X + p0.Y * p1.Y;
+    return int64_t(p0.X) * p1.X + int64_t(p0.Y) * p1.Y;
+}
+INLINE int64_t cross(const Point& p0, const Point& p1)
+{
+    return int64_t(p0.X) * p1.Y - int64_t(p0.Y) * p1.X;
 }
 
 INLINE int angle(const Point& p)
@@ -0,0 +1,277 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#include "layerPipeline.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <queue>
+#include <thread>
+
+#include "numa.h"
+#include "stats.h"
+#include "trace.h"
+
+namespace cura
+{
+
+LayerPipeline::LayerPipeline()
+: window(0)
+{
+}
+
+unsigned int LayerPipeline::addStage(const char* name, std::function<void (unsigned int layer_nr)> process, bool on_calling_thread)
+{
+    stages.push_back(Stage{name, process, on_calling_thread, {}});
+    return stages.size() - 1;
+}
+
+void LayerPipeline::addDependency(unsigned int stage, unsigned int required_stage, unsigned int below, unsigned int above)
+{
+    stages[stage].dependencies.push_back(Dependency{required_stage, below, above, GetRequiredLayers()});
+}
+
+void LayerPipeline::addDependency(unsigned int stage, unsigned int required_stage, GetRequiredLayers getRequiredLayers)
+{
+    stages[stage].dependencies.push_back(Dependency{required_stage, 0, 0, getRequiredLayers});
+}
+
+void LayerPipeline::setWindow(unsigned int layer_count)
+{
+    window = layer_count;
+}
+
+int LayerPipeline::getReach() const
+{
+    std::vector<int> stage_reach(stages.size(), 0);
+    int reach = 0;
+    for (unsigned int stage_idx = 0; stage_idx < stages.size(); stage_idx++)
+    {
+        for (const Dependency& dependency : stages[stage_idx].dependencies)
+        {
+            if (dependency.required_stage == stage_idx)
+            {
+                if (!dependency.getRequiredLayers && dependency.above > 0)
+                {
+                    return -1; // the stage goes from the top down
+                }
+                continue;
+            }
+            int required_reach = stage_reach[dependency.required_stage];
+            if (!dependency.getRequiredLayers)
+            {
+                required_reach += dependency.above;
+            }
+            stage_reach[stage_idx] = std::max(stage_reach[stage_idx], required_reach);
+        }
+        reach = std::max(reach, stage_reach[stage_idx]);
+    }
+    return reach;
+}
+
+bool LayerPipeline::run(unsigned int layer_count, unsigned int thread_count, std::function<bool ()> isCancelled)
+{
+    const unsigned int stage_count = stages.size();
+    const unsigned int task_count = stage_count * layer_count;
+    // A task is a stage of a layer; the tasks of a layer are consecutive.
+    auto getTask = [stage_count](unsigned int stage_idx, unsigned int layer_nr) { return layer_nr * stage_count + stage_idx; };
+
+    std::vector<unsigned int> n_waiting(task_count, 0); // for each task the number of tasks it still waits for
+    std::vector<std::vector<unsigned int>> dependents(task_count); // for each task the tasks waiting for it
+    std::vector<unsigned int> required_layers;
+    for (unsigned int stage_idx = 0; stage_idx < stage_count; stage_idx++)
+    {
+        const Stage& stage = stages[stage_idx];
+        for (unsigned int layer_nr = 0; layer_nr < layer_count; layer_nr++)
+        {
+            unsigned int task = getTask(stage_idx, layer_nr);
+            auto require = [&](unsigned int required_stage, unsigned int required_layer)
+            {
+                if (required_layer >= layer_count || (required_stage == stage_idx && required_layer == layer_nr))
+                {
+                    return;
+                }
+                dependents[getTask(required_stage, required_layer)].push_back(task);
+                n_waiting[task]++;
+            };
+            if (stage.on_calling_thread && layer_nr > 0)
+            {
+                require(stage_idx, layer_nr - 1);
+            }
+            for (const Dependency& dependency : stage.dependencies)
+            {
+                if (dependency.getRequiredLayers)
+                {
+                    required_layers.clear();
+                    dependency.getRequiredLayers(layer_nr, required_layers);
+                    for (unsigned int required_layer : required_layers)
+                    {
+                        require(dependency.required_stage, required_layer);
+                    }
+                    continue;
+                }
+                unsigned int first = layer_nr - std::min(layer_nr, dependency.below);
+                unsigned int last = std::min(layer_nr + dependency.above, layer_count - 1);
+                for (unsigned int required_layer = first; required_layer <= last; required_layer++)
+                {
+                    require(dependency.required_stage, required_layer);
+                }
+            }
+        }
+    }
+
+    // The lowest layer first, and within a layer the last stage first
+    auto hasLowerPriority = [stage_count](unsigned int a, unsigned int b)
+    {
+        return (a / stage_count != b / stage_count)? a / stage_count > b / stage_count : a % stage_count < b % stage_count;
+    };
+    typedef std::priority_queue<unsigned int, std::vector<unsigned int>, decltype(hasLowerPriority)> TaskQueue;
+    // The tasks which are ready and may run on any thread, per NUMA node on which their layer was started, so that the
+    // data of a layer stays on one node; the last queue holds those of the layers which haven't been started.
+    const unsigned int node_count = getNumaNodeCount();
+    std::vector<TaskQueue> parallel_tasks(node_count + 1, TaskQueue(hasLowerPriority));
+    std::vector<int> layer_nodes(layer_count, -1);
+    TaskQueue calling_thread_tasks(hasLowerPriority); // the tasks which are ready and have to run on the calling thread
+
+    int reach = getReach();
+    const unsigned int window_size = (window == 0 || reach < 0)? layer_count : std::max(window, static_cast<unsigned int>(reach) + 1);
+    std::vector<unsigned int> n_stages_done(layer_count, 0);
+    unsigned int lowest_unfinished_layer = 0;
+    unsigned int n_tasks_done = 0;
+    bool stopped = false;
+    std::mutex mutex;
+    std::condition_variable condition;
+
+    auto push = [&](unsigned int task)
+    {
+        if (stages[task % stage_count].on_calling_thread)
+        {
+            calling_thread_tasks.push(task);
+        }
+        else
+        {
+            int node = layer_nodes[task / stage_count];
+            parallel_tasks[(node >= 0)? node : node_count].push(task);
+        }
+    };
+    for (unsigned int task = 0; task < task_count; task++)
+    {
+        if (n_waiting[task] == 0)
+        {
+            push(task);
+        }
+    }
+    auto isInWindow = [&](const TaskQueue& tasks)
+    {
+        return !tasks.empty() && tasks.top() / stage_count < lowest_unfinished_layer + window_size;
+    };
+
+    // The queue with the ready task of the highest priority within the window, among the queues of the node of a thread
+    // and of the layers which haven't been started; or else of the other nodes
+    auto getParallelTasks = [&](unsigned int node) -> TaskQueue*
+    {
+        TaskQueue* best = nullptr;
+        auto consider = [&](TaskQueue& tasks)
+        {
+            if (isInWindow(tasks) && (!best || hasLowerPriority(best->top(), tasks.top())))
+            {
+                best = &tasks;
+            }
+        };
+        consider(parallel_tasks[node]);
+        consider(parallel_tasks[node_count]);
+        for (unsigned int other_node = 0; other_node < node_count && !best; other_node++)
+        {
+            consider(parallel_tasks[other_node]);
+        }
+        return best;
+    };
+
+    auto work = [&](bool on_calling_thread, unsigned int thread_idx)
+    {
+        unsigned int node = on_calling_thread? getCurrentNumaNode() : bindThreadToNumaNode(thread_idx);
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            if (on_calling_thread && !stopped)
+            {
+                lock.unlock();
+                bool cancelled = isCancelled();
+                lock.lock();
+                if (cancelled)
+                {
+                    stopped = true;
+                    condition.notify_all();
+                }
+            }
+            if (stopped || n_tasks_done == task_count)
+            {
+                return;
+            }
+            TaskQueue* tasks = nullptr;
+            if (on_calling_thread && isInWindow(calling_thread_tasks))
+            {
+                tasks = &calling_thread_tasks;
+            }
+            else
+            {
+                tasks = getParallelTasks(node);
+            }
+            if (!tasks)
+            {
+                if (on_calling_thread)
+                {
+                    condition.wait_for(lock, std::chrono::milliseconds(50)); // wake up now and then to check whether to stop
+                }
+                else
+                {
+                    condition.wait(lock);
+                }
+                continue;
+            }
+            unsigned int task = tasks->top();
+            tasks->pop();
+            if (layer_nodes[task / stage_count] < 0)
+            {
+                layer_nodes[task / stage_count] = node;
+            }
+            lock.unlock();
+            {
+                const Stage& stage = stages[task % stage_count];
+                TraceZone zone(stage.name, task / stage_count);
+                StatsScope stats_scope(stage.name, task / stage_count);
+                stage.process(task / stage_count);
+            }
+            lock.lock();
+
+            n_tasks_done++;
+            for (unsigned int dependent : dependents[task])
+            {
+                if (--n_waiting[dependent] == 0)
+                {
+                    push(dependent);
+                }
+            }
+            n_stages_done[task / stage_count]++;
+            while (lowest_unfinished_layer < layer_count && n_stages_done[lowest_unfinished_layer] == stage_count)
+            {
+                lowest_unfinished_layer++;
+            }
+            condition.notify_all();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int thread_idx = 1; thread_idx < std::min(thread_count, task_count); thread_idx++)
+    {
+        threads.emplace_back(work, false, thread_idx);
+    }
+    work(true, 0);
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    return !stopped;
+}
+
+}//namespace cura
@@ -0,0 +1,113 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#ifndef UTILS_LAYER_PIPELINE_H
+#define UTILS_LAYER_PIPELINE_H
+
+#include <functional>
+#include <vector>
+
+namespace cura
+{
+
+/*!
+ * Runs the stages which process a model layer by layer as a dataflow: a stage of a layer runs as soon as the stages of
+ * the layers it depends on are done, instead of each stage going through all layers before the next one starts. So the
+ * layers at the bottom can be written while those above them are still being processed, and the data of a layer can be
+ * freed once it's written.
+ *
+ * The ready stages of the lowest layers go first, and of the stages of a layer the later ones go first, so each layer
+ * is finished as early as possible. The layers being processed can be limited to a window above the lowest layer which
+ * isn't finished, which bounds the data of the layers in between.
+ *
+ * On a host with several NUMA nodes the threads are bound to the nodes in turn, and a thread runs the stages of the
+ * layers started on its node before those of other nodes, so the data of a layer mostly stays in the memory of the node
+ * which made it.
+ */
+class LayerPipeline
+{
+public:
+    /*!
+     * Get the layers of a stage which a layer of another stage depends on.
+     *
+     * \param layer_nr The layer which depends on them
+     * \param required_layers The layers it depends on are added to this; only layers below it when the stage is the
+     * stage itself
+     */
+    typedef std::function<void (unsigned int layer_nr, std::vector<unsigned int>& required_layers)> GetRequiredLayers;
+
+    LayerPipeline();
+
+    /*!
+     * Add a stage. A stage can only depend on itself and the stages added before it.
+     *
+     * \param name The name of the trace zone of each layer of the stage; a string literal
+     * \param process Process a layer. Unless \p on_calling_thread, this is called from several threads at once for
+     * different layers.
+     * \param on_calling_thread Whether to process the layers on the thread calling run, one after the other from the
+     * bottom up, e.g. to write them out; rather than in parallel
+     * \return The index of the stage
+     */
+    unsigned int addStage(const char* name, std::function<void (unsigned int layer_nr)> process, bool on_calling_thread = false);
+
+    /*!
+     * Make each layer of \p stage wait for the layers of \p required_stage from \p below under it up to \p above over
+     * it, as far as those exist.
+     *
+     * When \p required_stage is \p stage itself, the layer itself isn't waited for. Depending on the layers above it
+     * in the same stage makes the stage go from the top down, so the window of the pipeline is then lifted.
+     */
+    void addDependency(unsigned int stage, unsigned int required_stage, unsigned int below, unsigned int above);
+
+    /*!
+     * Make each layer of \p stage wait for the layers of \p required_stage given by \p getRequiredLayers, e.g. the
+     * layers from which it copies the results. These have to be at or below the layer.
+     */
+    void addDependency(unsigned int stage, unsigned int required_stage, GetRequiredLayers getRequiredLayers);
+
+    /*!
+     * Only start processing a layer when it is less than \p layer_count layers above the lowest layer of which not all
+     * stages are done. The window is widened as far as needed for the layers which depend on layers above them.
+     *
+     * \param layer_count The number of layers in the window; zero for no limit, which is the default
+     */
+    void setWindow(unsigned int layer_count);
+
+    /*!
+     * Process all layers through all stages.
+     *
+     * \param layer_count The number of layers
+     * \param thread_count The number of threads to use, including the calling thread
+     * \param isCancelled Polled from the calling thread; once it returns true, no more layers are started
+     * \return Whether all layers were processed; false when cancelled
+     */
+    bool run(unsigned int layer_count, unsigned int thread_count, std::function<bool ()> isCancelled);
+
+private:
+    struct Dependency
+    {
+        unsigned int required_stage;
+        unsigned int below;
+        unsigned int above;
+        GetRequiredLayers getRequiredLayers; //!< Empty for a window of \p below to \p above layers
+    };
+
+    struct Stage
+    {
+        const char* name;
+        std::function<void (unsigned int)> process;
+        bool on_calling_thread;
+        std::vector<Dependency> dependencies;
+    };
+
+    std::vector<Stage> stages;
+    unsigned int window;
+
+    /*!
+     * How far above a layer the layers are which it depends on through any chain of dependencies, or -1 when they may
+     * be anywhere above it.
+     */
+    int getReach() const;
+};
+
+}//namespace cura
+
+#endif//UTILS_LAYER_PIPELINE_H
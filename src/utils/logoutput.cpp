@@ -1,6 +1,18 @@
 /** Copyright (C) 2013 David Braam - Released under terms of the AGPLv3 License */
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
 
 #include "logoutput.h"
 
@@ -9,6 +21,242 @@ namespace cura {
 static int verbose_level;
 static bool progressLogging;
 
+namespace
+{
+
+/*!
+ * The queue of messages and the thread writing them to stderr.
+ *
+ * The queue is a bounded ring of slots with a sequence number each, after Dmitry Vyukov's bounded MPMC queue: a slot is
+ * free for the message at position p when its sequence number is p, and holds it when its sequence number is p + 1. A
+ * message longer than a slot takes consecutive slots, which are claimed together, so messages never get mixed up.
+ */
+class AsyncLog
+{
+public:
+    AsyncLog()
+    : write_pos(0)
+    , read_pos(0)
+    , written_pos(0)
+    , sleeping(false)
+    , stopping(false)
+    , stopped(false)
+    {
+        for (unsigned int slot_idx = 0; slot_idx < slot_count; slot_idx++)
+        {
+            slots[slot_idx].sequence.store(slot_idx, std::memory_order_relaxed);
+        }
+        thread = std::thread(&AsyncLog::run, this);
+    }
+
+    /*!
+     * The log of the process. It is never destroyed, as messages may be logged from the destructors of other static
+     * objects; it stops at exit, and messages logged after that are written straight away.
+     */
+    static AsyncLog& getInstance()
+    {
+        static AsyncLog* instance = []()
+        {
+            AsyncLog* log = new AsyncLog();
+            std::atexit([]() { getInstance().stop(); });
+            return log;
+        }();
+        return *instance;
+    }
+
+    void write(const char* text, size_t size)
+    {
+        if (stopped.load())
+        {
+            fwrite(text, 1, size, stderr);
+            fflush(stderr);
+            return;
+        }
+        size = std::min(size, size_t(max_message_slots * slot_text_size));
+        uint64_t n_slots = std::max(size_t(1), (size + slot_text_size - 1) / slot_text_size);
+        uint64_t pos = write_pos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            // the slots are freed in order, so when the last of them is free, all of them are
+            uint64_t last = pos + n_slots - 1;
+            int64_t difference = int64_t(slots[last % slot_count].sequence.load(std::memory_order_acquire) - last);
+            if (difference == 0)
+            {
+                if (write_pos.compare_exchange_weak(pos, pos + n_slots, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (difference < 0)
+            {
+                wakeWriter(); // full
+                std::this_thread::yield();
+                pos = write_pos.load(std::memory_order_relaxed);
+            }
+            else
+            {
+                pos = write_pos.load(std::memory_order_relaxed); // taken by another thread
+            }
+        }
+        for (uint64_t slot_nr = 0; slot_nr < n_slots; slot_nr++)
+        {
+            Slot& slot = slots[(pos + slot_nr) % slot_count];
+            slot.size = std::min(size - slot_nr * slot_text_size, size_t(slot_text_size));
+            memcpy(slot.text, text + slot_nr * slot_text_size, slot.size);
+            slot.sequence.store(pos + slot_nr + 1, std::memory_order_release);
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst); // against the writer going to sleep after it checked the slot
+        if (sleeping.load(std::memory_order_relaxed))
+        {
+            wakeWriter();
+        }
+    }
+
+    void flush()
+    {
+        uint64_t target = write_pos.load();
+        std::unique_lock<std::mutex> lock(mutex);
+        while (written_pos < target && !stopped.load())
+        {
+            wake.notify_one();
+            drained.wait_for(lock, std::chrono::milliseconds(10));
+        }
+    }
+
+    /*!
+     * Write the remaining messages and stop the thread.
+     */
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        thread.join();
+        stopped = true;
+    }
+
+private:
+    static constexpr unsigned int slot_count = 1024;
+    static constexpr unsigned int slot_text_size = 248;
+    static constexpr unsigned int max_message_slots = 64; //!< Longer messages are cut off
+
+    struct Slot
+    {
+        std::atomic<uint64_t> sequence;
+        size_t size;
+        char text[slot_text_size];
+    };
+
+    Slot slots[slot_count];
+    std::atomic<uint64_t> write_pos; //!< The position of the next slot to claim
+    uint64_t read_pos; //!< The position of the next slot to write out; only used by the writer thread
+    uint64_t written_pos; //!< The position up to which the messages have been written, guarded by mutex
+    std::atomic<bool> sleeping; //!< Whether the writer thread waits for wake
+    bool stopping; //!< Guarded by mutex
+    std::atomic<bool> stopped;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable drained;
+    std::thread thread;
+
+    void wakeWriter()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        wake.notify_one();
+    }
+
+    bool isReady()
+    {
+        return slots[read_pos % slot_count].sequence.load(std::memory_order_acquire) == read_pos + 1;
+    }
+
+    void run()
+    {
+        std::string batch;
+        while (true)
+        {
+            batch.clear();
+            while (isReady())
+            {
+                Slot& slot = slots[read_pos % slot_count];
+                batch.append(slot.text, slot.size);
+                slot.sequence.store(read_pos + slot_count, std::memory_order_release);
+                read_pos++;
+            }
+            if (batch.size() > 0)
+            {
+                fwrite(batch.data(), 1, batch.size(), stderr);
+                fflush(stderr);
+                std::lock_guard<std::mutex> lock(mutex);
+                written_pos = read_pos;
+                drained.notify_all();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            sleeping = true;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!isReady())
+            {
+                if (stopping)
+                {
+                    sleeping = false;
+                    return;
+                }
+                wake.wait_for(lock, std::chrono::milliseconds(100));
+            }
+            sleeping = false;
+        }
+    }
+};
+
+constexpr unsigned int AsyncLog::slot_count;
+constexpr unsigned int AsyncLog::slot_text_size;
+constexpr unsigned int AsyncLog::max_message_slots;
+
+void vlogf(const char* fmt, va_list args)
+{
+    char buffer[1024];
+    va_list args_copy;
+    va_copy(args_copy, args);
+    int size = vsnprintf(buffer, sizeof(buffer), fmt, args);
+    if (size < 0)
+    {
+        va_end(args_copy);
+        return;
+    }
+    if (size_t(size) < sizeof(buffer))
+    {
+        AsyncLog::getInstance().write(buffer, size);
+    }
+    else
+    {
+        std::vector<char> long_buffer(size + 1);
+        vsnprintf(long_buffer.data(), long_buffer.size(), fmt, args_copy);
+        AsyncLog::getInstance().write(long_buffer.data(), size);
+    }
+    va_end(args_copy);
+}
+
+void logf(const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vlogf(fmt, args);
+    va_end(args);
+}
+
+std::mutex warnings_mutex; // guards the below
+std::unordered_set<std::string> warned_keys;
+unsigned int n_repeated_warnings = 0;
+
+const int64_t progress_interval = 100; //!< The least time between two reports of the same type of progress, in ms
+std::atomic<int64_t> last_progress_time(0);
+std::atomic<const char*> last_progress_type(nullptr);
+
+}//anonymous namespace
+
 void increaseVerboseLevel()
 {
     verbose_level++;
@@ -23,18 +271,39 @@ void logError(const char* fmt, ...)
 {
     va_list args;
     va_start(args, fmt);
-    vfprintf(stderr, fmt, args);
+    vlogf(fmt, args);
     va_end(args);
-    fflush(stderr);
-}
-
+}
+
+void logWarningOnce(const char* key, const char* fmt, ...)
+{
+    {
+        std::lock_guard<std::mutex> lock(warnings_mutex);
+        if (!warned_keys.insert(key).second)
+        {
+            if (n_repeated_warnings++ == 0)
+            {
+                std::atexit([]()
+                {
+                    std::lock_guard<std::mutex> lock(warnings_mutex);
+                    logf("Left out %u repeats of warnings given before\n", n_repeated_warnings);
+                }); // runs before the log stops, which registered its handler earlier
+            }
+            return;
+        }
+    }
+    va_list args;
+    va_start(args, fmt);
+    vlogf(fmt, args);
+    va_end(args);
+}
+
 void logCopyright(const char* fmt, ...)
 {
     va_list args;
     va_start(args, fmt);
-    vfprintf(stderr, fmt, args);
+    vlogf(fmt, args);
     va_end(args);
-    fflush(stderr);
 }
 
 void log(const char* fmt, ...)
@@ -44,17 +313,34 @@ void log(const char* fmt, ...)
 
     va_list args;
     va_start(args, fmt);
-    vfprintf(stderr, fmt, args);
+    vlogf(fmt, args);
     va_end(args);
-    fflush(stderr);
 }
 void logProgress(const char* type, int value, int maxValue)
 {
     if (!progressLogging)
         return;
 
-    fprintf(stderr, "Progress:%s:%i:%i\n", type, value, maxValue);
-    fflush(stderr);
+    if (value < maxValue && type == last_progress_type.load())
+    {
+        int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        int64_t last = last_progress_time.load();
+        if (now - last < progress_interval || !last_progress_time.compare_exchange_strong(last, now))
+        {
+            return; // reported recently, by this thread or another one
+        }
+    }
+    else
+    {
+        last_progress_type = type;
+        last_progress_time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    logf("Progress:%s:%i:%i\n", type, value, maxValue);
+}
+
+void flushLog()
+{
+    AsyncLog::getInstance().flush();
 }
 
 }//namespace cura
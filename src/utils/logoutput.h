@@ -4,19 +4,32 @@
 
 namespace cura {
 
+/*
+The messages are queued and written to stderr by a background thread, so that the threads slicing the layers don't wait
+for the terminal, and don't take turns for it either: the queue is a ring buffer which the threads add to without
+locking. What is queued is written before the program exits; flushLog waits for it at other times, e.g. before starting
+a process which writes to the same terminal.
+*/
+
 void increaseVerboseLevel();
 void enableProgressLogging();
 
 //Report an error message (always reported, independed of verbose level)
 void logError(const char* fmt, ...);
+//Report a warning the first time it's given for a key, like a setting; the repeats are counted, and their number is reported at exit (always reported, independent of verbose level)
+void logWarningOnce(const char* key, const char* fmt, ...);
 //Report a message if the verbose level is 1 or higher. (defined as _log to prevent clash with log() function from <math.h>)
 void log(const char* fmt, ...);
 //Report an copyright message (always reported, independed of verbose level)
 void logCopyright(const char* fmt, ...);
 
 //Report engine progress to interface if any. Only if "enableProgressLogging()" has been called.
+//At most one report per 0.1s is written for the same type of progress, besides the last one, where value is maxValue.
 void logProgress(const char* type, int value, int maxValue);
 
+//Wait until the messages reported so far have been written.
+void flushLog();
+
 }//namespace cura
 
 #endif//LOGOUTPUT_H
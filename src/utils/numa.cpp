@@ -0,0 +1,172 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#include "numa.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace cura
+{
+
+namespace
+{
+
+std::atomic<bool> placement_enabled(true);
+
+/*!
+ * The CPUs of each NUMA node of the host, read once from sysfs.
+ */
+class NumaTopology
+{
+public:
+    std::vector<std::vector<int>> node_cpus;
+    std::vector<int> cpu_nodes; //!< The node of each CPU
+#ifdef __linux__
+    cpu_set_t allowed_cpus; //!< The CPUs the process was given, e.g. by taskset, numactl or its cgroup
+#endif
+
+    static const NumaTopology& getInstance()
+    {
+        static NumaTopology instance;
+        return instance;
+    }
+
+private:
+    NumaTopology()
+    {
+#ifdef __linux__
+        // No thread is bound before the topology is read, so this is still the mask the process inherited.
+        if (sched_getaffinity(0, sizeof(allowed_cpus), &allowed_cpus) != 0)
+        {
+            CPU_ZERO(&allowed_cpus);
+        }
+        for (unsigned int node = 0; ; node++)
+        {
+            std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            std::string list;
+            if (!in.is_open() || !std::getline(in, list))
+            {
+                break;
+            }
+            node_cpus.push_back(parseCpuList(list));
+            for (int cpu : node_cpus.back())
+            {
+                if (cpu >= int(cpu_nodes.size()))
+                {
+                    cpu_nodes.resize(cpu + 1, 0);
+                }
+                cpu_nodes[cpu] = node;
+            }
+        }
+#endif
+    }
+
+    /*!
+     * Parse a list of CPUs like "0-15,32-47".
+     */
+    static std::vector<int> parseCpuList(const std::string& list)
+    {
+        std::vector<int> cpus;
+        size_t pos = 0;
+        while (pos < list.size())
+        {
+            size_t end = list.find(',', pos);
+            if (end == std::string::npos)
+            {
+                end = list.size();
+            }
+            std::string range = list.substr(pos, end - pos);
+            size_t dash = range.find('-');
+            try {
+                int first = std::stoi(range.substr(0, dash));
+                int last = (dash == std::string::npos)? first : std::stoi(range.substr(dash + 1));
+                for (int cpu = first; cpu <= last; cpu++)
+                {
+                    cpus.push_back(cpu);
+                }
+            }catch(...){
+                // not a number, like the empty list of a node without CPUs
+            }
+            pos = end + 1;
+        }
+        return cpus;
+    }
+};
+
+}//anonymous namespace
+
+void setNumaPlacement(bool enabled)
+{
+    placement_enabled = enabled;
+}
+
+unsigned int getNumaNodeCount()
+{
+    if (!placement_enabled)
+    {
+        return 1;
+    }
+    const NumaTopology& topology = NumaTopology::getInstance();
+    for (const std::vector<int>& cpus : topology.node_cpus)
+    {
+        if (cpus.empty())
+        {
+            return 1; // nodes of memory only; spreading the threads by node number would leave CPUs unused
+        }
+    }
+    return std::max(size_t(1), topology.node_cpus.size());
+}
+
+unsigned int bindThreadToNumaNode(unsigned int node)
+{
+    unsigned int node_count = getNumaNodeCount();
+    if (node_count <= 1)
+    {
+        return 0;
+    }
+    node %= node_count;
+#ifdef __linux__
+    const NumaTopology& topology = NumaTopology::getInstance();
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for (int cpu : topology.node_cpus[node])
+    {
+        if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &topology.allowed_cpus))
+        {
+            CPU_SET(cpu, &cpu_set);
+        }
+    }
+    if (CPU_COUNT(&cpu_set) == 0)
+    {
+        return getCurrentNumaNode(); // none of the CPUs of the node were given to the process, so the thread stays unbound
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set); // when it fails, the thread simply isn't bound
+#endif
+    return node;
+}
+
+unsigned int getCurrentNumaNode()
+{
+    if (getNumaNodeCount() <= 1)
+    {
+        return 0;
+    }
+#ifdef __linux__
+    int cpu = sched_getcpu();
+    const std::vector<int>& cpu_nodes = NumaTopology::getInstance().cpu_nodes;
+    if (cpu >= 0 && cpu < int(cpu_nodes.size()))
+    {
+        return cpu_nodes[cpu];
+    }
+#endif
+    return 0;
+}
+
+}//namespace cura
@@ -0,0 +1,44 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#ifndef UTILS_NUMA_H
+#define UTILS_NUMA_H
+
+namespace cura
+{
+
+/*
+On a host with several sockets, memory is attached to one of the sockets (a NUMA node), and reading memory of another
+node is slower and goes over the link between the sockets. Linux places a page on the node of the thread which first
+writes to it, and malloc hands out the memory a thread freed to the same thread again, so the data of a layer ends up on
+the node of the thread which made it, as long as threads stay on one node. The threads of the engine are therefore
+bound to the nodes in turn, and the LayerPipeline runs the stages of a layer on the node on which the layer was started.
+
+Elsewhere than on Linux, and on hosts with a single node, there is one node and nothing is bound.
+*/
+
+/*!
+ * Set whether threads started from now on are bound to a NUMA node. On by default.
+ */
+void setNumaPlacement(bool enabled);
+
+/*!
+ * The number of NUMA nodes over which threads are spread: one when placement is off or the host has a single node.
+ */
+unsigned int getNumaNodeCount();
+
+/*!
+ * Bind the calling thread to the CPUs of a NUMA node, when placement is on. Only the CPUs the process was given are
+ * used; when it was given none of the node, the thread is left unbound.
+ *
+ * \param node The node; taken modulo getNumaNodeCount, so threads can simply be numbered
+ * \return The node the thread is bound to, zero when there is only one, or the node it runs on when left unbound
+ */
+unsigned int bindThreadToNumaNode(unsigned int node);
+
+/*!
+ * The NUMA node of the CPU the calling thread runs on, for a thread which isn't bound, like the main thread.
+ */
+unsigned int getCurrentNumaNode();
+
+}//namespace cura
+
+#endif//UTILS_NUMA_H
@@ -0,0 +1,38 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#include "offsetCache.h"
+
+#include "polygonUtils.h"
+
+namespace cura {
+
+OffsetCache::OffsetCache()
+: source_hash(0)
+{
+}
+
+const Polygons& OffsetCache::offset(const Polygons& source, int distance, ClipperLib::JoinType join_type)
+{
+    uint64_t hash = hashPolygons(source);
+    if (hash != source_hash)
+    {
+        entries.clear();
+        source_hash = hash;
+    }
+    for (Entry& entry : entries)
+    {
+        if (entry.distance == distance && entry.join_type == join_type)
+        {
+            return entry.result;
+        }
+    }
+    entries.push_back(Entry{distance, join_type, source.offset(distance, join_type)});
+    return entries.back().result;
+}
+
+void OffsetCache::clear()
+{
+    std::vector<Entry>().swap(entries);
+    source_hash = 0;
+}
+
+}//namespace cura
@@ -0,0 +1,53 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#ifndef UTILS_OFFSET_CACHE_H
+#define UTILS_OFFSET_CACHE_H
+
+#include <vector>
+
+#include "polygon.h"
+
+namespace cura {
+
+/*!
+ * The offsets of one set of polygons which have been computed so far, so that asking for the same offset again is a
+ * lookup instead of another run of ClipperOffset.
+ *
+ * The cache doesn't keep the polygons it offsets, only a hash of them: when it is asked for an offset of polygons with
+ * another hash, they have changed and the cached offsets are dropped. Computing the hash goes over the points once,
+ * which is far cheaper than an offset.
+ *
+ * A cache isn't safe to use from several threads at once.
+ */
+class OffsetCache
+{
+public:
+    OffsetCache();
+
+    /*!
+     * The offset of \p source, the same as source.offset(distance, join_type).
+     *
+     * \param source The polygons to offset; the polygons of earlier calls, unless they have changed since
+     * \return The offset, which stays valid until the next call or clear()
+     */
+    const Polygons& offset(const Polygons& source, int distance, ClipperLib::JoinType join_type = ClipperLib::jtMiter);
+
+    /*!
+     * Free the cached offsets.
+     */
+    void clear();
+
+private:
+    struct Entry
+    {
+        int distance;
+        ClipperLib::JoinType join_type;
+        Polygons result;
+    };
+
+    uint64_t source_hash; //!< The hash of the polygons the entries are offsets of
+    std::vector<Entry> entries; //!< Few per source, so they are searched in order
+};
+
+}//namespace cura
+
+#endif//UTILS_OFFSET_CACHE_H
@@ -0,0 +1,111 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#ifndef UTILS_PARALLEL_H
+#define UTILS_PARALLEL_H
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "stats.h"
+#include "threadPool.h"
+
+namespace cura
+{
+
+/*!
+ * Resolve the number of worker threads to use from a (user) setting.
+ *
+ * \param requested The requested number of threads; zero or less means: use all hardware threads
+ * \return The number of threads to use; at least one
+ */
+inline unsigned int getThreadCount(int requested)
+{
+    if (requested > 0)
+    {
+        return requested;
+    }
+    unsigned int hardware_threads = std::thread::hardware_concurrency();
+    return (hardware_threads > 0)? hardware_threads : 1;
+}
+
+/*!
+ * Call \p function for each index in [0, \p count) using up to \p thread_count threads of the ThreadPool.
+ *
+ * Indices are handed out one at a time, so the work per index may differ greatly.
+ * The calling thread takes part in the work, so a \p thread_count of 1 simply runs the loop serially.
+ * The function has to be safe to call concurrently for different indices. It may itself call parallelFor; the inner
+ * loop then runs on the threads which aren't busy with the outer one.
+ *
+ * \param count The number of indices to process
+ * \param thread_count The maximum number of threads to use
+ * \param function The function to call with each index
+ */
+template<typename Function>
+void parallelFor(unsigned int count, unsigned int thread_count, Function function)
+{
+    if (thread_count > count)
+    {
+        thread_count = count;
+    }
+    if (thread_count <= 1)
+    {
+        for (unsigned int idx = 0; idx < count; idx++)
+        {
+            function(idx);
+        }
+        return;
+    }
+    ThreadPool::getInstance().reserve(thread_count);
+    StatsContext stats_context = getStatsContext(); // the helpers count their work for the stage and layer of the caller
+    std::atomic<unsigned int> next_idx(0);
+    auto worker = [&]()
+    {
+        for (unsigned int idx = next_idx++; idx < count; idx = next_idx++)
+        {
+            function(idx);
+        }
+    };
+    TaskGroup helpers;
+    for (unsigned int thread_idx = 1; thread_idx < thread_count; thread_idx++)
+    {
+        helpers.run([&]()
+        {
+            StatsScope stats_scope(stats_context);
+            worker(); // finds nothing left to do when it starts after the loop is done
+        });
+    }
+    worker();
+    helpers.wait();
+}
+
+/*!
+ * Compute \p function for each index in [0, \p count) in parallel, and combine the results in index order, so the
+ * result doesn't depend on the number of threads or the order in which they finish; e.g. for sums of floating point
+ * values.
+ *
+ * \param count The number of indices
+ * \param thread_count The maximum number of threads to use
+ * \param initial The result of combining no values
+ * \param function Gives the value of an index
+ * \param combine Combines the result so far with the value of the next index
+ * \return The values of all indices combined
+ */
+template<typename T, typename Function, typename Combine>
+T parallelReduce(unsigned int count, unsigned int thread_count, T initial, Function function, Combine combine)
+{
+    std::vector<T> values(count);
+    parallelFor(count, thread_count, [&](unsigned int idx)
+    {
+        values[idx] = function(idx);
+    });
+    T result = initial;
+    for (T& value : values)
+    {
+        result = combine(result, value);
+    }
+    return result;
+}
+
+}//namespace cura
+
+#endif//UTILS_PARALLEL_H
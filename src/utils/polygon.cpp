@@ -0,0 +1,85 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#include "polygon.h"
+
+namespace cura
+{
+
+namespace
+{
+
+thread_local bool thread_clipper_in_use = false;
+thread_local bool thread_clipper_offset_in_use = false;
+
+ClipperLib::Clipper& getThreadClipper()
+{
+    static thread_local ClipperLib::Clipper thread_clipper(clipper_init);
+    return thread_clipper;
+}
+
+ClipperLib::ClipperOffset& getThreadClipperOffset()
+{
+    static thread_local ClipperLib::ClipperOffset thread_clipper_offset;
+    return thread_clipper_offset;
+}
+
+}//anonymous namespace
+
+ClipperLease::ClipperLease()
+: private_clipper(nullptr)
+{
+    if (thread_clipper_in_use)
+    {
+        private_clipper = new ClipperLib::Clipper(clipper_init);
+        clipper = private_clipper;
+    }
+    else
+    {
+        thread_clipper_in_use = true;
+        clipper = &getThreadClipper();
+    }
+}
+
+ClipperLease::~ClipperLease()
+{
+    if (private_clipper)
+    {
+        delete private_clipper;
+    }
+    else
+    {
+        clipper->Clear();
+        thread_clipper_in_use = false;
+    }
+}
+
+ClipperOffsetLease::ClipperOffsetLease(double miter_limit, double arc_tolerance)
+: private_clipper(nullptr)
+{
+    if (thread_clipper_offset_in_use)
+    {
+        private_clipper = new ClipperLib::ClipperOffset(miter_limit, arc_tolerance);
+        clipper = private_clipper;
+    }
+    else
+    {
+        thread_clipper_offset_in_use = true;
+        clipper = &getThreadClipperOffset();
+        clipper->MiterLimit = miter_limit;
+        clipper->ArcTolerance = arc_tolerance;
+    }
+}
+
+ClipperOffsetLease::~ClipperOffsetLease()
+{
+    if (private_clipper)
+    {
+        delete private_clipper;
+    }
+    else
+    {
+        clipper->Clear();
+        thread_clipper_offset_in_use = false;
+    }
+}
+
+}//namespace cura
@@ -8,8 +8,11 @@
 
 #include <algorithm>    // std::reverse
 #include <cmath> // fabs
+#include <utility> // std::move
 
 #include "intpoint.h"
+#include "stats.h"
+#include "trace.h"
 
 //#define CHECK_POLY_ACCESS
 #ifdef CHECK_POLY_ACCESS
@@ -35,6 +38,71 @@ enum PolygonType
 const static int clipper_init = (0);
 #define NO_INDEX (std::numeric_limits<unsigned int>::max())
 
+/*!
+ * Lends a polygon operation the Clipper engine of the current thread.
+ *
+ * Constructing a ClipperLib::Clipper for every operation allocates its internal buffers anew each time.
+ * The engine of a thread is cleared rather than destroyed when the lease ends, so following operations reuse the capacity of those buffers.
+ * While the engine of the thread is lent out, further leases get a private engine, so leases may nest.
+ */
+class ClipperLease
+{
+public:
+    ClipperLease();
+    ~ClipperLease();
+    ClipperLib::Clipper* operator->() { return clipper; }
+private:
+    ClipperLib::Clipper* clipper; //!< The engine lent out: the one of the thread, or private_clipper
+    ClipperLib::Clipper* private_clipper; //!< The engine made for this lease when the one of the thread was in use, or nullptr
+    ClipperLease(const ClipperLease&) = delete;
+    ClipperLease& operator=(const ClipperLease&) = delete;
+};
+
+/*!
+ * Lends a polygon operation the ClipperOffset engine of the current thread, like ClipperLease does for ClipperLib::Clipper.
+ */
+class ClipperOffsetLease
+{
+public:
+    /*!
+     * \param miter_limit The miter limit to offset with
+     * \param arc_tolerance The maximum distance of rounded joins to the true arc
+     */
+    ClipperOffsetLease(double miter_limit, double arc_tolerance);
+    ~ClipperOffsetLease();
+    ClipperLib::ClipperOffset* operator->() { return clipper; }
+private:
+    ClipperLib::ClipperOffset* clipper; //!< The engine lent out: the one of the thread, or private_clipper
+    ClipperLib::ClipperOffset* private_clipper; //!< The engine made for this lease when the one of the thread was in use, or nullptr
+    ClipperOffsetLease(const ClipperOffsetLease&) = delete;
+    ClipperOffsetLease& operator=(const ClipperOffsetLease&) = delete;
+};
+
+/*!
+ * Count a Clipper operation for the stats, with the points of its operands and of its result.
+ *
+ * \param operation Stat_ClipperOperations or Stat_Offsets
+ */
+inline void countClipperStats(StatCounter operation, const ClipperLib::Paths& subject, const ClipperLib::Paths& clip, const ClipperLib::Paths& result)
+{
+    if (!isStatsEnabled())
+    {
+        return;
+    }
+    auto countPoints = [](const ClipperLib::Paths& paths)
+    {
+        uint64_t point_count = 0;
+        for (const ClipperLib::Path& path : paths)
+        {
+            point_count += path.size();
+        }
+        return point_count;
+    };
+    countStat(operation);
+    countStat(Stat_ClipperInputPoints, countPoints(subject) + countPoints(clip));
+    countStat(Stat_ClipperOutputPoints, countPoints(result));
+}
+
 class PolygonRef
 {
     ClipperLib::Path* polygon;
@@ -155,7 +223,7 @@ public:
         for(unsigned int n=0; n<polygon->size(); n++)
         {
             Point p1 = (*polygon)[n];
-            double second_factor = (p0.X * p1.Y) - (p1.X * p0.Y);
+            double second_factor = cross(p0, p1);
 
             x += double(p0.X + p1.X) * second_factor;
             y += double(p0.Y + p1.Y) * second_factor;
@@ -215,59 +283,75 @@ public:
         for(unsigned int n=0; n<size(); n++)
         {
             Point p1 = thiss[n];
-            // no tests unless the segment p0-p1 is at least partly at, or to right of, p.X
-            if ( std::max(p0.X, p1.X) >= p.X )
+            int crossing = rayCrossing(p0, p1, p);
+            if (crossing < 0)
+            {
+                return border_result;
+            }
+            crossings += crossing;
+            p0 = p1;
+        }
+        return (crossings % 2) == 1;
+    }
+
+    /*!
+     * The test of inside() for a single edge: whether the edge from \p p0 to \p p1 crosses the ray from \p p to the right.
+     * 
+     * \return 1 when the edge crosses the ray, 0 when it doesn't, -1 when \p p lies on the edge
+     */
+    static int rayCrossing(const Point& p0, const Point& p1, const Point& p)
+    {
+        // no tests unless the segment p0-p1 is at least partly at, or to right of, p.X
+        if ( std::max(p0.X, p1.X) >= p.X )
+        {
+            int64_t pdY = p1.Y-p0.Y;
+            if (pdY < 0) // p0->p1 is 'falling'
             {
-                int64_t pdY = p1.Y-p0.Y;
-                if (pdY < 0) // p0->p1 is 'falling'
+                if ( p1.Y <= p.Y && p0.Y > p.Y ) // candidate
                 {
-                    if ( p1.Y <= p.Y && p0.Y > p.Y ) // candidate
+                    // dx > 0 if intersection is to right of p.X
+                    int64_t dx = int64_t(p1.X - p0.X) * (p1.Y - p.Y) - (p1.X-p.X)*pdY;
+                    if (dx == 0) // includes p == p1
+                    {
+                        return -1;
+                    }
+                    if (dx > 0)
                     {
-                        // dx > 0 if intersection is to right of p.X
-                        int64_t dx = (p1.X - p0.X) * (p1.Y - p.Y) - (p1.X-p.X)*pdY;
-                        if (dx == 0) // includes p == p1
-                        {
-                            return border_result;
-                        }
-                        if (dx > 0)
-                        {
-                            crossings ++;
-                        }
+                        return 1;
                     }
                 }
-                else if (p.Y >= p0.Y)
+            }
+            else if (p.Y >= p0.Y)
+            {
+                if (p.Y < p1.Y) // candidate for p0->p1 'rising' and includes p.Y
                 {
-                    if (p.Y < p1.Y) // candidate for p0->p1 'rising' and includes p.Y
+                    // dx > 0 if intersection is to right of p.X
+                    int64_t dx = int64_t(p1.X - p0.X) * (p.Y - p0.Y) - (p.X-p0.X)*pdY;
+                    if (dx == 0) // includes p == p0
+                    {
+                        return -1;
+                    }
+                    if (dx > 0)
                     {
-                        // dx > 0 if intersection is to right of p.X
-                        int64_t dx = (p1.X - p0.X) * (p.Y - p0.Y) - (p.X-p0.X)*pdY;
-                        if (dx == 0) // includes p == p0
-                        {
-                            return border_result;
-                        }
-                        if (dx > 0)
-                        {
-                            crossings ++;
-                        }
+                        return 1;
                     }
-                    else if (p.Y == p1.Y)
+                }
+                else if (p.Y == p1.Y)
+                {
+                    // some special cases here, points on border:
+                    // - p1 exactly matches p (might otherwise be missed)
+                    // - p0->p1 exactly horizontal, and includes p.
+                    // (we already tested std::max(p0.X,p1.X) >= p.X )
+                    if (p.X == p1.X ||
+                        (pdY==0 && std::min(p0.X,p1.X) <= p.X) )
                     {
-                        // some special cases here, points on border:
-                        // - p1 exactly matches p (might otherwise be missed)
-                        // - p0->p1 exactly horizontal, and includes p.
-                        // (we already tested std::max(p0.X,p1.X) >= p.X )
-                        if (p.X == p1.X ||
-                            (pdY==0 && std::min(p0.X,p1.X) <= p.X) )
-                        {
-                            return border_result;
-                            // otherwise, count no crossings
-                        }
+                        return -1;
+                        // otherwise, count no crossings
                     }
                 }
             }
-            p0 = p1;
         }
-        return (crossings % 2) == 1;
+        return 0;
     }
     
     void smooth(int remove_length, PolygonRef result)
@@ -423,6 +507,46 @@ public:
     {
         return polygons.end();
     }
+    ClipperLib::Paths::const_iterator begin() const
+    {
+        return polygons.begin();
+    }
+    ClipperLib::Paths::const_iterator end() const
+    {
+        return polygons.end();
+    }
+    /*!
+     * Whether \p other consists of exactly the same polygons, with the same points in the same order.
+     */
+    bool operator==(const Polygons& other) const
+    {
+        return polygons == other.polygons;
+    }
+    /*!
+     * Move all polygons by \p translation.
+     */
+    void translate(Point translation)
+    {
+        for(ClipperLib::Path& poly : polygons)
+        {
+            for(Point& p : poly)
+            {
+                p += translation;
+            }
+        }
+    }
+    /*!
+     * The heap memory held by the polygons, in bytes.
+     */
+    size_t getMemoryUsage() const
+    {
+        size_t memory = polygons.capacity() * sizeof(ClipperLib::Path);
+        for(const ClipperLib::Path& poly : polygons)
+        {
+            memory += poly.capacity() * sizeof(Point);
+        }
+        return memory;
+    }
     void remove(unsigned int index)
     {
         POLY_ASSERT(index < size());
@@ -441,6 +565,17 @@ public:
         for(unsigned int n=0; n<other.polygons.size(); n++)
             polygons.push_back(other.polygons[n]);
     }
+    void add(Polygons&& other)
+    {
+        if (polygons.empty())
+        {
+            polygons = std::move(other.polygons);
+            return;
+        }
+        polygons.reserve(polygons.size() + other.polygons.size());
+        for(unsigned int n=0; n<other.polygons.size(); n++)
+            polygons.push_back(std::move(other.polygons[n]));
+    }
     PolygonRef newPoly()
     {
         polygons.push_back(ClipperLib::Path());
@@ -454,50 +589,113 @@ public:
     Polygons() {}
     Polygons(const Polygons& other) { polygons = other.polygons; }
     Polygons& operator=(const Polygons& other) { polygons = other.polygons; return *this; }
+    Polygons(Polygons&& other) { polygons = std::move(other.polygons); }
+    Polygons& operator=(Polygons&& other) { polygons = std::move(other.polygons); return *this; }
     Polygons difference(const Polygons& other) const
     {
+        TRACE_ZONE("Polygons::difference");
         Polygons ret;
-        ClipperLib::Clipper clipper(clipper_init);
-        clipper.AddPaths(polygons, ClipperLib::ptSubject, true);
-        clipper.AddPaths(other.polygons, ClipperLib::ptClip, true);
-        clipper.Execute(ClipperLib::ctDifference, ret.polygons);
+        ClipperLease clipper;
+        clipper->AddPaths(polygons, ClipperLib::ptSubject, true);
+        clipper->AddPaths(other.polygons, ClipperLib::ptClip, true);
+        clipper->Execute(ClipperLib::ctDifference, ret.polygons);
+        countClipperStats(Stat_ClipperOperations, polygons, other.polygons, ret.polygons);
         return ret;
     }
     Polygons unionPolygons(const Polygons& other) const
     {
+        TRACE_ZONE("Polygons::unionPolygons");
         Polygons ret;
-        ClipperLib::Clipper clipper(clipper_init);
-        clipper.AddPaths(polygons, ClipperLib::ptSubject, true);
-        clipper.AddPaths(other.polygons, ClipperLib::ptSubject, true);
-        clipper.Execute(ClipperLib::ctUnion, ret.polygons, ClipperLib::pftNonZero, ClipperLib::pftNonZero);
+        ClipperLease clipper;
+        clipper->AddPaths(polygons, ClipperLib::ptSubject, true);
+        clipper->AddPaths(other.polygons, ClipperLib::ptSubject, true);
+        clipper->Execute(ClipperLib::ctUnion, ret.polygons, ClipperLib::pftNonZero, ClipperLib::pftNonZero);
+        countClipperStats(Stat_ClipperOperations, polygons, other.polygons, ret.polygons);
+        return ret;
+    }
+    /*!
+     * Union all polygons in this collection with each other, using the same non-zero fill rule as unionPolygons(other).
+     *
+     * Collecting many operands with add() and calling this once does a single Clipper execution,
+     * rather than re-processing a growing result for each operand.
+     */
+    Polygons unionPolygons() const
+    {
+        TRACE_ZONE("Polygons::unionPolygons");
+        Polygons ret;
+        ClipperLease clipper;
+        clipper->AddPaths(polygons, ClipperLib::ptSubject, true);
+        clipper->Execute(ClipperLib::ctUnion, ret.polygons, ClipperLib::pftNonZero, ClipperLib::pftNonZero);
+        countClipperStats(Stat_ClipperOperations, polygons, ClipperLib::Paths(), ret.polygons);
+        return ret;
+    }
+    /*!
+     * Subtract the union of all polygons in \p others in a single Clipper execution.
+     *
+     * Unlike difference(other), the polygons in \p others may overlap each other, so the operands can simply be collected with add().
+     */
+    Polygons differenceUnion(const Polygons& others) const
+    {
+        TRACE_ZONE("Polygons::differenceUnion");
+        Polygons ret;
+        ClipperLease clipper;
+        clipper->AddPaths(polygons, ClipperLib::ptSubject, true);
+        clipper->AddPaths(others.polygons, ClipperLib::ptClip, true);
+        clipper->Execute(ClipperLib::ctDifference, ret.polygons, ClipperLib::pftEvenOdd, ClipperLib::pftNonZero);
+        countClipperStats(Stat_ClipperOperations, polygons, others.polygons, ret.polygons);
         return ret;
     }
     Polygons intersection(const Polygons& other) const
     {
+        TRACE_ZONE("Polygons::intersection");
         Polygons ret;
-        ClipperLib::Clipper clipper(clipper_init);
-        clipper.AddPaths(polygons, ClipperLib::ptSubject, true);
-        clipper.AddPaths(other.polygons, ClipperLib::ptClip, true);
-        clipper.Execute(ClipperLib::ctIntersection, ret.polygons);
+        ClipperLease clipper;
+        clipper->AddPaths(polygons, ClipperLib::ptSubject, true);
+        clipper->AddPaths(other.polygons, ClipperLib::ptClip, true);
+        clipper->Execute(ClipperLib::ctIntersection, ret.polygons);
+        countClipperStats(Stat_ClipperOperations, polygons, other.polygons, ret.polygons);
         return ret;
     }
     Polygons xorPolygons(const Polygons& other) const
     {
+        TRACE_ZONE("Polygons::xorPolygons");
         Polygons ret;
-        ClipperLib::Clipper clipper(clipper_init);
-        clipper.AddPaths(polygons, ClipperLib::ptSubject, true);
-        clipper.AddPaths(other.polygons, ClipperLib::ptClip, true);
-        clipper.Execute(ClipperLib::ctXor, ret.polygons);
+        ClipperLease clipper;
+        clipper->AddPaths(polygons, ClipperLib::ptSubject, true);
+        clipper->AddPaths(other.polygons, ClipperLib::ptClip, true);
+        clipper->Execute(ClipperLib::ctXor, ret.polygons);
+        countClipperStats(Stat_ClipperOperations, polygons, other.polygons, ret.polygons);
         return ret;
     }
     Polygons offset(int distance, ClipperLib::JoinType joinType = ClipperLib::jtMiter) const
     {
+        TRACE_ZONE("Polygons::offset");
         Polygons ret;
         double miterLimit = 1.2;
-        ClipperLib::ClipperOffset clipper(miterLimit, 10.0);
-        clipper.AddPaths(polygons, joinType, ClipperLib::etClosedPolygon);
-        clipper.MiterLimit = miterLimit;
-        clipper.Execute(ret.polygons, distance);
+        ClipperOffsetLease clipper(miterLimit, 10.0);
+        clipper->AddPaths(polygons, joinType, ClipperLib::etClosedPolygon);
+        clipper->Execute(ret.polygons, distance);
+        countClipperStats(Stat_Offsets, polygons, ClipperLib::Paths(), ret.polygons);
+        return ret;
+    }
+    /*!
+     * Offset by each of \p distances, adding the polygons to Clipper only once for all of them.
+     *
+     * Gives the same as offset(distance, joinType) for each distance, for rings around the same polygons such as the
+     * lines of a brim.
+     */
+    std::vector<Polygons> offsetMultiple(const std::vector<int>& distances, ClipperLib::JoinType joinType = ClipperLib::jtMiter) const
+    {
+        TRACE_ZONE("Polygons::offsetMultiple");
+        std::vector<Polygons> ret(distances.size());
+        double miterLimit = 1.2;
+        ClipperOffsetLease clipper(miterLimit, 10.0);
+        clipper->AddPaths(polygons, joinType, ClipperLib::etClosedPolygon);
+        for (unsigned int distance_idx = 0; distance_idx < distances.size(); distance_idx++)
+        {
+            clipper->Execute(ret[distance_idx].polygons, distances[distance_idx]);
+            countClipperStats(Stat_Offsets, polygons, ClipperLib::Paths(), ret[distance_idx].polygons);
+        }
         return ret;
     }
     
@@ -542,16 +740,26 @@ public:
      */
     std::vector<Polygons> splitIntoParts(bool unionAll = false) const
     {
+        TRACE_ZONE("Polygons::splitIntoParts");
         std::vector<Polygons> ret;
-        ClipperLib::Clipper clipper(clipper_init);
+        ClipperLease clipper;
         ClipperLib::PolyTree resultPolyTree;
-        clipper.AddPaths(polygons, ClipperLib::ptSubject, true);
+        clipper->AddPaths(polygons, ClipperLib::ptSubject, true);
         if (unionAll)
-            clipper.Execute(ClipperLib::ctUnion, resultPolyTree, ClipperLib::pftNonZero, ClipperLib::pftNonZero);
+            clipper->Execute(ClipperLib::ctUnion, resultPolyTree, ClipperLib::pftNonZero, ClipperLib::pftNonZero);
         else
-            clipper.Execute(ClipperLib::ctUnion, resultPolyTree);
+            clipper->Execute(ClipperLib::ctUnion, resultPolyTree);
 
         _processPolyTreeNode(&resultPolyTree, ret);
+        if (isStatsEnabled())
+        {
+            ClipperLib::Paths result;
+            for (const Polygons& part : ret)
+            {
+                result.insert(result.end(), part.polygons.begin(), part.polygons.end());
+            }
+            countClipperStats(Stat_ClipperOperations, polygons, ClipperLib::Paths(), result);
+        }
         return ret;
     }
     /*!
@@ -687,9 +895,10 @@ public:
     Polygons processEvenOdd() const
     {
         Polygons ret;
-        ClipperLib::Clipper clipper(clipper_init);
-        clipper.AddPaths(polygons, ClipperLib::ptSubject, true);
-        clipper.Execute(ClipperLib::ctUnion, ret.polygons);
+        ClipperLease clipper;
+        clipper->AddPaths(polygons, ClipperLib::ptSubject, true);
+        clipper->Execute(ClipperLib::ctUnion, ret.polygons);
+        countClipperStats(Stat_ClipperOperations, polygons, ClipperLib::Paths(), ret.polygons);
         return ret;
     }
 
@@ -808,24 +1017,24 @@ public:
     : min(POINT_MIN, POINT_MIN), max(POINT_MIN, POINT_MIN)
     {
     }
-    AABB(Polygons polys)
+    AABB(const Polygons& polys)
     : min(POINT_MIN, POINT_MIN), max(POINT_MIN, POINT_MIN)
     {
         calculate(polys);
     }
 
-    void calculate(Polygons polys)
+    void calculate(const Polygons& polys)
     {
         min = Point(POINT_MAX, POINT_MAX);
         max = Point(POINT_MIN, POINT_MIN);
-        for(unsigned int i=0; i<polys.size(); i++)
+        for(const ClipperLib::Path& poly : polys)
         {
-            for(unsigned int j=0; j<polys[i].size(); j++)
+            for(const Point& p : poly)
             {
-                if (min.X > polys[i][j].X) min.X = polys[i][j].X;
-                if (min.Y > polys[i][j].Y) min.Y = polys[i][j].Y;
-                if (max.X < polys[i][j].X) max.X = polys[i][j].X;
-                if (max.Y < polys[i][j].Y) max.Y = polys[i][j].Y;
+                if (min.X > p.X) min.X = p.X;
+                if (min.Y > p.Y) min.Y = p.Y;
+                if (max.X < p.X) max.X = p.X;
+                if (max.Y < p.Y) max.Y = p.Y;
             }
         }
     }
@@ -1,13 +1,14 @@
 /** Copyright (C) 2015 Tim Kuipers - Released under terms of the AGPLv3 License */
 #include "polygonUtils.h"
 
+#include <cmath>
 #include <list>
 
 #include "../debug.h"
 namespace cura 
 {
 
-void offsetExtrusionWidth(Polygons& poly, bool inward, int extrusionWidth, Polygons& result, Polygons* in_between, bool avoidOverlappingPerimeters)
+void offsetExtrusionWidth(const Polygons& poly, bool inward, int extrusionWidth, Polygons& result, Polygons* in_between, bool avoidOverlappingPerimeters)
 {
     int distance = (inward)? -extrusionWidth : extrusionWidth;
     if (!avoidOverlappingPerimeters)
@@ -24,7 +25,7 @@ void offsetExtrusionWidth(Polygons& poly, bool inward, int extrusionWidth, Polyg
 }
 
 
-void offsetSafe(Polygons& poly, int distance, int extrusionWidth, Polygons& result, bool avoidOverlappingPerimeters)
+void offsetSafe(const Polygons& poly, int distance, int extrusionWidth, Polygons& result, bool avoidOverlappingPerimeters)
 {
     int direction = (distance > 0)? 1 : -1;
     if (!avoidOverlappingPerimeters)
@@ -43,6 +44,27 @@ void removeOverlapping(Polygons& poly, int extrusionWidth, Polygons& result)
     result = poly.offset(extrusionWidth/2).offset(-extrusionWidth).offset(extrusionWidth/2);
 }
 
+uint64_t hashPolygons(const Polygons& polygons)
+{
+    uint64_t hash = 14695981039346656037ull; // FNV-1a
+    auto mix = [&hash](int64_t value)
+    {
+        hash ^= static_cast<uint64_t>(value);
+        hash *= 1099511628211ull;
+    };
+    mix(polygons.size());
+    for (const ClipperLib::Path& poly : polygons)
+    {
+        mix(poly.size());
+        for (const Point& p : poly)
+        {
+            mix(p.X);
+            mix(p.Y);
+        }
+    }
+    return hash;
+}
+
 
 
 
@@ -226,7 +248,11 @@ ClosestPolygonPoint findClosest(Point from, PolygonRef polygon)
 
     int64_t closestDist = vSize2(from - best);
     int bestPos = 0;
-//
+
+    // getClosestOnLine rounds its result to within a few microns of the bounding box of the line segment,
+    // so a segment whose slightly enlarged bounding box is no closer than the best point so far can't give a better point.
+    // Skipping those saves the square roots and division of getClosestOnLine for most segments of a large polygon.
+    const int64_t rounding_margin = 10;
     for (unsigned int p = 0; p<polygon.size(); p++)
     {
         Point& p1 = polygon[p];
@@ -235,6 +261,15 @@ ClosestPolygonPoint findClosest(Point from, PolygonRef polygon)
         if (p2_idx >= polygon.size()) p2_idx = 0;
         Point& p2 = polygon[p2_idx];
 
+        int64_t box_dist_x = std::max(std::min(p1.X, p2.X) - from.X, from.X - std::max(p1.X, p2.X)) - rounding_margin;
+        int64_t box_dist_y = std::max(std::min(p1.Y, p2.Y) - from.Y, from.Y - std::max(p1.Y, p2.Y)) - rounding_margin;
+        if (box_dist_x < 0) box_dist_x = 0;
+        if (box_dist_y < 0) box_dist_y = 0;
+        if (box_dist_x * box_dist_x + box_dist_y * box_dist_y >= closestDist)
+        {
+            continue;
+        }
+
         Point closestHere = getClosestOnLine(from, p1 ,p2);
         int64_t dist = vSize2(from - closestHere);
         if (dist < closestDist)
@@ -248,6 +283,89 @@ ClosestPolygonPoint findClosest(Point from, PolygonRef polygon)
     return ClosestPolygonPoint(best, bestPos, polygon);
 }
 
+namespace
+{
+
+unsigned int countSegments(Polygons& polygons)
+{
+    unsigned int count = 0;
+    for (unsigned int poly_idx = 0; poly_idx < polygons.size(); poly_idx++)
+    {
+        count += polygons[poly_idx].size();
+    }
+    return count;
+}
+
+int64_t getAverageSegmentLength(Polygons& polygons)
+{
+    return std::max(int64_t(1), polygons.polygonLength() / std::max(1u, countSegments(polygons)));
+}
+
+}//anonymous namespace
+
+SegmentGrid::SegmentGrid(Polygons& polygons)
+: polygons(polygons)
+, sample_spacing(getAverageSegmentLength(polygons))
+, grid(polygons.min(), polygons.max(), countSegments(polygons) * 2) // a segment gets one point more than its length in sample spacings
+{
+    for (unsigned int poly_idx = 0; poly_idx < polygons.size(); poly_idx++)
+    {
+        PolygonRef poly = polygons[poly_idx];
+        for (unsigned int point_idx = 0; point_idx < poly.size(); point_idx++)
+        {
+            Point p0 = poly[point_idx];
+            Point p1 = poly[(point_idx + 1 < poly.size())? point_idx + 1 : 0];
+            int64_t sample_count = (vSize(p1 - p0) + sample_spacing - 1) / sample_spacing;
+            for (int64_t sample_idx = 0; sample_idx <= sample_count; sample_idx++)
+            {
+                Point sample = (sample_count == 0)? p0 : Point(p0.X + (p1.X - p0.X) * sample_idx / sample_count, p0.Y + (p1.Y - p0.Y) * sample_idx / sample_count);
+                grid.insert(sample, std::make_pair(poly_idx, point_idx));
+            }
+        }
+    }
+}
+
+ClosestPolygonPoint SegmentGrid::findClosest(Point from)
+{
+    if (polygons.size() == 0 || polygons[0].size() == 0)
+    {
+        return cura::findClosest(from, polygons);
+    }
+    // findClosest(from, Polygons&) keeps the first polygon with the smallest distance, and within a polygon first its
+    // first point and then the first segment with the smallest distance, so the candidates are ordered that way
+    Point best = polygons[0][0];
+    int64_t best_dist = vSize2(from - best);
+    unsigned int best_poly_idx = 0;
+    unsigned int best_candidate = 0; // 0 for the first point of the polygon, n + 1 for the segment from point n
+    auto consider = [&](Point location, unsigned int poly_idx, unsigned int candidate)
+    {
+        int64_t dist = vSize2(from - location);
+        if (dist < best_dist || (dist == best_dist && (poly_idx < best_poly_idx || (poly_idx == best_poly_idx && candidate < best_candidate))))
+        {
+            best = location;
+            best_dist = dist;
+            best_poly_idx = poly_idx;
+            best_candidate = candidate;
+        }
+    };
+    // a closer point on a segment lies within half a sample spacing of a point of that segment in the grid,
+    // with some margin for the rounding of getClosestOnLine and of the points in the grid
+    const double search_margin = sample_spacing / 2.0 + 20;
+    grid.findNearestObjects(from, [&](const Point&, const std::pair<unsigned int, unsigned int>& segment)
+    {
+        PolygonRef poly = polygons[segment.first];
+        if (segment.second == 0)
+        {
+            consider(poly[0], segment.first, 0);
+        }
+        Point p1 = poly[segment.second];
+        Point p2 = poly[(segment.second + 1 < poly.size())? segment.second + 1 : 0];
+        consider(getClosestOnLine(from, p1, p2), segment.first, segment.second + 1);
+        double search_dist = std::sqrt(double(best_dist)) + search_margin;
+        return search_dist * search_dist;
+    });
+    return ClosestPolygonPoint(best, (best_candidate == 0)? 0 : best_candidate - 1, polygons[best_poly_idx]);
+}
 
 Point getClosestOnLine(Point from, Point p0, Point p1)
 {
@@ -2,20 +2,28 @@
 #ifndef POLYGON_UTILS_H
 #define POLYGON_UTILS_H
 
+#include <utility>
+
 #include "polygon.h"
+#include "PointGrid2D.h"
 
 namespace cura 
 {
     
 //! performs an offset compared to an adjacent inset/outset and also computes the area created by gaps between the two consecutive insets/outsets
-void offsetExtrusionWidth(Polygons& poly, bool inward, int extrusionWidth, Polygons& result, Polygons* in_between, bool avoidOverlappingPerimeters);
+void offsetExtrusionWidth(const Polygons& poly, bool inward, int extrusionWidth, Polygons& result, Polygons* in_between, bool avoidOverlappingPerimeters);
 
 //! performs an offset and makes sure the lines don't overlap (ignores any area between the original poly and the resulting poly)
-void offsetSafe(Polygons& poly, int distance, int extrusionWidth, Polygons& result, bool avoidOverlappingPerimeters);
+void offsetSafe(const Polygons& poly, int distance, int extrusionWidth, Polygons& result, bool avoidOverlappingPerimeters);
 
 //! performs offsets to make sure the lines don't overlap (ignores any area between the original poly and the resulting poly)
 void removeOverlapping(Polygons& poly, int extrusionWidth, Polygons& result);
 
+/*!
+ * Hash of all points of some polygons; equal polygons have the same hash.
+ */
+uint64_t hashPolygons(const Polygons& polygons);
+
 /*!
  * Result of finding the closest point to a given within a set of polygons, with extra information on where the point is.
  */
@@ -81,6 +89,32 @@ ClosestPolygonPoint findNearestClosest(Point from, PolygonRef polygon, int start
  */
 ClosestPolygonPoint findClosest(Point from, Polygons& polygons);
     
+/*!
+ * The line segments of a set of polygons in a grid, to find the closest point on them to many points without going over
+ * all segments for each point.
+ * 
+ * Each segment is put into the grid as points along it, at most (around) the average segment length apart, so any point
+ * on a segment is close to one of them. The result is exactly that of findClosest on the same polygons.
+ */
+class SegmentGrid
+{
+public:
+    /*!
+     * \param polygons The polygons in which to find the closest points; they should not change while the grid is used
+     */
+    SegmentGrid(Polygons& polygons);
+
+    /*!
+     * Find the point closest to \p from in all polygons of the grid.
+     */
+    ClosestPolygonPoint findClosest(Point from);
+
+private:
+    Polygons& polygons;
+    int64_t sample_spacing; //!< The maximum distance between consecutive points of a segment in the grid
+    PointGrid2D<std::pair<unsigned int, unsigned int>> grid; //!< The polygon index and the segment index of points along the segments
+};
+
 /*!
  * Find the point closest to \p from in the polygon \p polygon.
  */
@@ -0,0 +1,281 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#include "stats.h"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <sstream>
+
+#include "logoutput.h"
+
+namespace cura {
+
+namespace stats_detail
+{
+std::atomic<bool> enabled(false);
+}
+
+namespace
+{
+
+const char* stat_names[Stat_Count] = {
+    "clipper_operations",
+    "clipper_input_points",
+    "clipper_output_points",
+    "offsets",
+    "order_problems",
+    "order_polygons",
+    "comb_queries",
+    "comb_collision_tests",
+    "stitch_searches",
+    "planned_moves",
+    "gcode_lines",
+    "gcode_bytes",
+    "welder_cycles",
+};
+
+const char* const no_stage = "other";
+
+/*!
+ * The counts of one thread. They are kept after the thread ends, until they are reported.
+ */
+struct ThreadStats
+{
+    std::vector<std::pair<const char*, StatCounts>> stages;
+    std::vector<StatCounts> layers;
+    unsigned int last_stage_idx = 0; //!< Where the stage counted for last is, which is most likely the next one too
+};
+
+std::mutex stats_mutex; // guards the below
+std::vector<std::unique_ptr<ThreadStats>> all_thread_stats;
+std::vector<std::string> stage_order; //!< The stages in the order in which they were first counted for
+
+thread_local ThreadStats* thread_stats = nullptr;
+thread_local StatsContext current_context = {nullptr, -1};
+
+StatCounts& getStageCounts(ThreadStats& stats, const char* stage)
+{
+    if (stats.last_stage_idx < stats.stages.size() && stats.stages[stats.last_stage_idx].first == stage)
+    {
+        return stats.stages[stats.last_stage_idx].second;
+    }
+    for (unsigned int stage_idx = 0; stage_idx < stats.stages.size(); stage_idx++)
+    {
+        if (stats.stages[stage_idx].first == stage)
+        {
+            stats.last_stage_idx = stage_idx;
+            return stats.stages[stage_idx].second;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        if (std::find(stage_order.begin(), stage_order.end(), stage) == stage_order.end())
+        {
+            stage_order.push_back(stage);
+        }
+    }
+    stats.stages.emplace_back(stage, StatCounts());
+    stats.stages.back().second.fill(0);
+    stats.last_stage_idx = stats.stages.size() - 1;
+    return stats.stages.back().second;
+}
+
+std::string formatCounts(const StatCounts& counts)
+{
+    std::ostringstream out;
+    for (unsigned int counter = 0; counter < Stat_Count; counter++)
+    {
+        if (counts[counter] > 0)
+        {
+            out << " " << stat_names[counter] << "=" << counts[counter];
+        }
+    }
+    return out.str();
+}
+
+}//anonymous namespace
+
+namespace stats_detail
+{
+
+void add(StatCounter counter, uint64_t amount)
+{
+    if (!thread_stats)
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        all_thread_stats.emplace_back(new ThreadStats());
+        thread_stats = all_thread_stats.back().get();
+    }
+    ThreadStats& stats = *thread_stats;
+    getStageCounts(stats, current_context.stage? current_context.stage : no_stage)[counter] += amount;
+    int layer_nr = current_context.layer_nr;
+    if (layer_nr >= 0)
+    {
+        if (stats.layers.size() <= static_cast<unsigned int>(layer_nr))
+        {
+            StatCounts zero;
+            zero.fill(0);
+            stats.layers.resize(layer_nr + 1, zero);
+        }
+        stats.layers[layer_nr][counter] += amount;
+    }
+}
+
+}//namespace stats_detail
+
+void startStats()
+{
+    stats_detail::enabled = true;
+}
+
+const char* getStatName(StatCounter counter)
+{
+    return stat_names[counter];
+}
+
+StatsContext getStatsContext()
+{
+    return current_context;
+}
+
+StatsScope::StatsScope(const char* stage, int layer_nr)
+: previous(current_context)
+{
+    current_context = StatsContext{stage, layer_nr};
+}
+
+StatsScope::StatsScope(const StatsContext& context)
+: previous(current_context)
+{
+    current_context = context;
+}
+
+StatsScope::~StatsScope()
+{
+    current_context = previous;
+}
+
+StatsReport getStats()
+{
+    StatsReport report;
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    for (const std::string& stage : stage_order)
+    {
+        report.stages.emplace_back(stage, StatCounts());
+        report.stages.back().second.fill(0);
+    }
+    for (const std::unique_ptr<ThreadStats>& stats : all_thread_stats)
+    {
+        for (const std::pair<const char*, StatCounts>& stage : stats->stages)
+        {
+            // the same name may be a different literal in another file
+            for (std::pair<std::string, StatCounts>& report_stage : report.stages)
+            {
+                if (report_stage.first == stage.first)
+                {
+                    for (unsigned int counter = 0; counter < Stat_Count; counter++)
+                    {
+                        report_stage.second[counter] += stage.second[counter];
+                    }
+                    break;
+                }
+            }
+        }
+        if (report.layers.size() < stats->layers.size())
+        {
+            StatCounts zero;
+            zero.fill(0);
+            report.layers.resize(stats->layers.size(), zero);
+        }
+        for (unsigned int layer_nr = 0; layer_nr < stats->layers.size(); layer_nr++)
+        {
+            for (unsigned int counter = 0; counter < Stat_Count; counter++)
+            {
+                report.layers[layer_nr][counter] += stats->layers[layer_nr][counter];
+            }
+        }
+    }
+    return report;
+}
+
+void logStats(unsigned int max_layers)
+{
+    StatsReport report = getStats();
+    logError("Work per stage:\n");
+    for (const std::pair<std::string, StatCounts>& stage : report.stages)
+    {
+        logError("  %s:%s\n", stage.first.c_str(), formatCounts(stage.second).c_str());
+    }
+    std::vector<unsigned int> layer_order;
+    for (unsigned int layer_nr = 0; layer_nr < report.layers.size(); layer_nr++)
+    {
+        layer_order.push_back(layer_nr);
+    }
+    std::stable_sort(layer_order.begin(), layer_order.end(), [&report](unsigned int a, unsigned int b)
+    {
+        return report.layers[a][Stat_ClipperInputPoints] > report.layers[b][Stat_ClipperInputPoints];
+    });
+    layer_order.resize(std::min(layer_order.size(), size_t(max_layers)));
+    if (layer_order.size() > 0)
+    {
+        logError("The %u layers with the most points through Clipper:\n", static_cast<unsigned int>(layer_order.size()));
+    }
+    for (unsigned int layer_nr : layer_order)
+    {
+        logError("  layer %u:%s\n", layer_nr, formatCounts(report.layers[layer_nr]).c_str());
+    }
+}
+
+void clearStats()
+{
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    for (const std::unique_ptr<ThreadStats>& stats : all_thread_stats)
+    {
+        stats->stages.clear();
+        stats->layers.clear();
+        stats->last_stage_idx = 0;
+    }
+    stage_order.clear();
+}
+
+StatsOutputBuffer::StatsOutputBuffer(std::streambuf* target)
+: target(target)
+{
+}
+
+std::streamsize StatsOutputBuffer::xsputn(const char* data, std::streamsize size)
+{
+    std::streamsize written = target->sputn(data, size);
+    if (isStatsEnabled() && written > 0)
+    {
+        countStat(Stat_GCodeBytes, written);
+        countStat(Stat_GCodeLines, std::count(data, data + written, '\n'));
+    }
+    return written;
+}
+
+StatsOutputBuffer::int_type StatsOutputBuffer::overflow(int_type c)
+{
+    if (traits_type::eq_int_type(c, traits_type::eof()))
+    {
+        return traits_type::not_eof(c);
+    }
+    int_type result = target->sputc(traits_type::to_char_type(c));
+    if (!traits_type::eq_int_type(result, traits_type::eof()))
+    {
+        countStat(Stat_GCodeBytes);
+        if (traits_type::to_char_type(c) == '\n')
+        {
+            countStat(Stat_GCodeLines);
+        }
+    }
+    return result;
+}
+
+int StatsOutputBuffer::sync()
+{
+    return target->pubsync();
+}
+
+}//namespace cura
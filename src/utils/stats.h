@@ -0,0 +1,181 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#ifndef UTILS_STATS_H
+#define UTILS_STATS_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+The stats count the work the hot paths of the engine do, like the Clipper operations and the points going through them,
+the path ordering problems and their sizes, the comb queries and the G-code written, per stage and per layer; so that
+where the trace shows which stage of a model is slow, the stats show which of its features make it so: many small holes
+show up as Clipper operations, thin walls as ordering problems of many short lines, a lot of travel as comb queries.
+
+Like the trace, a counter only checks a flag while the stats aren't started, and each thread counts on its own, so the
+counters can be placed in code which is run millions of times. A count goes to the stage and layer of the StatsScope the
+thread is in; the stages of the LayerPipeline and parallelFor take the scope along to the threads they run on.
+*/
+namespace cura {
+
+enum StatCounter
+{
+    Stat_ClipperOperations, //!< Boolean operations: unions, differences, intersections and xors
+    Stat_ClipperInputPoints, //!< The points given to the boolean operations and offsets
+    Stat_ClipperOutputPoints, //!< The points of their results
+    Stat_Offsets,
+    Stat_OrderProblems, //!< The calls of PathOrderOptimizer and LineOrderOptimizer
+    Stat_OrderPolygons, //!< The polygons or lines they ordered
+    Stat_CombQueries, //!< Travel moves planned by Comb
+    Stat_CombCollisionTests, //!< Tests of a line against the boundary of the comb
+    Stat_StitchSearches, //!< Searches for open polygon ends to stitch together
+    Stat_PlannedMoves, //!< The points of the planned paths, as given to the export
+    Stat_GCodeLines,
+    Stat_GCodeBytes,
+    Stat_WelderCycles, //!< Times the welder was switched on
+    Stat_Count
+};
+
+typedef std::array<uint64_t, Stat_Count> StatCounts;
+
+namespace stats_detail
+{
+extern std::atomic<bool> enabled;
+
+void add(StatCounter counter, uint64_t amount);
+}
+
+/*!
+ * Start counting on all threads.
+ */
+void startStats();
+
+/*!
+ * Whether the stats are being counted.
+ */
+inline bool isStatsEnabled()
+{
+    return stats_detail::enabled.load(std::memory_order_relaxed);
+}
+
+/*!
+ * Count work for the stage and layer the thread is in. Does nothing while the stats aren't started.
+ */
+inline void countStat(StatCounter counter, uint64_t amount = 1)
+{
+    if (isStatsEnabled())
+    {
+        stats_detail::add(counter, amount);
+    }
+}
+
+/*!
+ * The name of a counter, as used in the report and the messages to the front-end.
+ */
+const char* getStatName(StatCounter counter);
+
+/*!
+ * The stage and layer the counts of a thread go to.
+ */
+struct StatsContext
+{
+    const char* stage; //!< A string literal; nullptr outside of any stage
+    int layer_nr; //!< -1 when the work isn't for a single layer
+};
+
+/*!
+ * The context of the calling thread, to take along to the threads which do part of its work.
+ */
+StatsContext getStatsContext();
+
+/*!
+ * Makes the counts of the thread go to a stage and layer from its construction to its destruction.
+ */
+class StatsScope
+{
+public:
+    /*!
+     * \param stage The name of the stage; a string literal
+     * \param layer_nr The layer, or -1 when the work isn't for a single layer
+     */
+    StatsScope(const char* stage, int layer_nr = -1);
+
+    /*!
+     * Count for the context of another thread.
+     */
+    explicit StatsScope(const StatsContext& context);
+
+    ~StatsScope();
+
+    StatsScope(const StatsScope&) = delete;
+    StatsScope& operator=(const StatsScope&) = delete;
+private:
+    StatsContext previous;
+};
+
+/*!
+ * The counts of all threads so far. No thread may be counting at the time.
+ */
+struct StatsReport
+{
+    std::vector<std::pair<std::string, StatCounts>> stages; //!< In the order in which the stages were first counted for
+    std::vector<StatCounts> layers; //!< By layer number
+};
+
+StatsReport getStats();
+
+/*!
+ * Log the counts per stage, and the \p max_layers layers with the most points going through Clipper.
+ */
+void logStats(unsigned int max_layers = 10);
+
+/*!
+ * Forget the counts so far. No thread may be counting at the time.
+ */
+void clearStats();
+
+/*!
+ * Passes what is written on to another stream buffer, counting the bytes and lines as Stat_GCodeBytes and
+ * Stat_GCodeLines. It has no buffer of its own, so what is written reaches the other stream buffer at once and is
+ * counted for the layer being written.
+ */
+class StatsOutputBuffer : public std::streambuf
+{
+public:
+    StatsOutputBuffer(std::streambuf* target);
+
+protected:
+    std::streamsize xsputn(const char* data, std::streamsize size) override;
+    int_type overflow(int_type c) override;
+    int sync() override;
+
+private:
+    std::streambuf* target;
+};
+
+/*!
+ * An output stream which counts what is written to another stream, see StatsOutputBuffer.
+ */
+class StatsOutputStream : public std::ostream
+{
+public:
+    StatsOutputStream(std::ostream& target)
+    : std::ostream(nullptr)
+    , buffer(target.rdbuf())
+    {
+        rdbuf(&buffer);
+        copyfmt(target); // so the numbers come out the same as when written to the target
+    }
+
+private:
+    StatsOutputBuffer buffer;
+};
+
+}//namespace cura
+
+#endif//UTILS_STATS_H
@@ -0,0 +1,190 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#include "threadPool.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "numa.h"
+
+namespace cura
+{
+
+namespace
+{
+thread_local int current_worker = -1; //!< The index of the worker running on this thread; -1 for threads outside the pool
+}
+
+constexpr unsigned int ThreadPool::max_workers;
+
+ThreadPool& ThreadPool::getInstance()
+{
+    static ThreadPool instance;
+    return instance;
+}
+
+ThreadPool::ThreadPool()
+: worker_count(0)
+, n_queued(0)
+, next_queue(0)
+, stopping(false)
+{
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        stopping = true;
+    }
+    wake_up.notify_all();
+    for (unsigned int worker_idx = 0; worker_idx < worker_count; worker_idx++)
+    {
+        workers[worker_idx]->thread.join();
+    }
+}
+
+void ThreadPool::reserve(unsigned int thread_count)
+{
+    unsigned int wanted = std::min(max_workers, (thread_count > 0)? thread_count - 1 : 0);
+    if (worker_count.load() >= wanted)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(sleep_mutex);
+    while (worker_count.load() < wanted)
+    {
+        unsigned int worker_idx = worker_count.load();
+        workers[worker_idx].reset(new Worker());
+        workers[worker_idx]->thread = std::thread(&ThreadPool::work, this, worker_idx);
+        worker_count++; // only now may other threads steal from it
+    }
+}
+
+void ThreadPool::push(Task task)
+{
+    unsigned int n_workers = worker_count.load();
+    if (n_workers == 0)
+    {
+        run(task); // nothing to run it on
+        return;
+    }
+    unsigned int queue_idx = (current_worker >= 0)? current_worker : next_queue++ % n_workers;
+    {
+        std::lock_guard<std::mutex> lock(workers[queue_idx]->mutex);
+        workers[queue_idx]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex); // so a worker can't miss it between checking and sleeping
+        n_queued++;
+    }
+    wake_up.notify_one();
+}
+
+bool ThreadPool::pop(Task& task)
+{
+    if (n_queued.load() == 0)
+    {
+        return false;
+    }
+    unsigned int n_workers = worker_count.load();
+    if (current_worker >= 0)
+    {
+        Worker& own = *workers[current_worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty())
+        {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            n_queued--;
+            return true;
+        }
+    }
+    unsigned int first = (current_worker >= 0)? current_worker + 1 : 0;
+    for (unsigned int offset = 0; offset < n_workers; offset++)
+    {
+        Worker& victim = *workers[(first + offset) % n_workers];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty())
+        {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            n_queued--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::run(Task& task)
+{
+    task.function();
+    TaskGroup& group = *task.group;
+    std::lock_guard<std::mutex> lock(group.mutex); // the group may be gone as soon as it sees the count drop to zero
+    if (--group.n_unfinished == 0)
+    {
+        group.finished.notify_all();
+    }
+}
+
+void ThreadPool::work(unsigned int worker_idx)
+{
+    current_worker = worker_idx;
+    bindThreadToNumaNode(worker_idx + 1); // the thread which waits for the workers counts as the first
+    Task task;
+    while (true)
+    {
+        if (pop(task))
+        {
+            run(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        if (stopping)
+        {
+            return;
+        }
+        if (n_queued.load() == 0)
+        {
+            wake_up.wait(lock);
+        }
+    }
+}
+
+TaskGroup::TaskGroup()
+: n_unfinished(0)
+{
+}
+
+TaskGroup::~TaskGroup()
+{
+    wait();
+}
+
+void TaskGroup::run(std::function<void ()> function)
+{
+    n_unfinished++;
+    ThreadPool::getInstance().push(ThreadPool::Task{std::move(function), this});
+}
+
+void TaskGroup::wait()
+{
+    ThreadPool& pool = ThreadPool::getInstance();
+    ThreadPool::Task task;
+    while (n_unfinished.load() > 0)
+    {
+        if (pool.pop(task))
+        {
+            pool.run(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        if (n_unfinished.load() > 0)
+        {
+            // the remaining tasks are running elsewhere; look for new tasks now and then, which they may be waiting for
+            finished.wait_for(lock, std::chrono::milliseconds(1));
+        }
+    }
+    std::lock_guard<std::mutex> lock(mutex); // until the last task has let go of the group
+}
+
+}//namespace cura
@@ -0,0 +1,127 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#ifndef UTILS_THREAD_POOL_H
+#define UTILS_THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace cura
+{
+
+class TaskGroup;
+
+/*!
+ * The threads which run the parallel work of the whole engine, so the parallel loops don't each start threads of their
+ * own, and loops within parallel loops share the same threads instead of multiplying them.
+ *
+ * Each worker has its own queue of tasks. A task queued from a worker goes onto the queue of that worker, which takes
+ * its newest task first, so nested work stays on the thread which made it while it's hot in the cache; a worker without
+ * tasks steals the oldest task of another worker. Threads which wait for a TaskGroup run tasks meanwhile, so a task may
+ * wait for the tasks it queues without deadlocking the pool.
+ */
+class ThreadPool
+{
+public:
+    static ThreadPool& getInstance();
+
+    ~ThreadPool();
+
+    /*!
+     * Make sure there are workers for \p thread_count threads working at once, counting the thread which waits for them.
+     * The pool only grows, up to max_workers.
+     */
+    void reserve(unsigned int thread_count);
+
+    /*!
+     * The number of worker threads.
+     */
+    unsigned int getWorkerCount() const { return worker_count.load(); }
+
+    static constexpr unsigned int max_workers = 255;
+
+private:
+    friend class TaskGroup;
+
+    struct Task
+    {
+        std::function<void ()> function;
+        TaskGroup* group;
+    };
+
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks; //!< The newest task at the back
+        std::thread thread;
+    };
+
+    std::unique_ptr<Worker> workers[max_workers]; //!< Only the first worker_count exist
+    std::atomic<unsigned int> worker_count;
+    std::atomic<unsigned int> n_queued; //!< The number of tasks in all queues
+    std::atomic<unsigned int> next_queue; //!< Where the next task from a thread outside the pool goes
+    std::mutex sleep_mutex; //!< Guards growing the pool and sleeping
+    std::condition_variable wake_up;
+    bool stopping;
+
+    ThreadPool();
+
+    /*!
+     * Queue a task, onto the queue of the current worker, or spread over the queues when queued from another thread.
+     */
+    void push(Task task);
+
+    /*!
+     * Take a task from the queue of the current worker, or else steal one from the other queues.
+     *
+     * \param task Set to the task taken
+     * \return Whether a task was taken
+     */
+    bool pop(Task& task);
+
+    /*!
+     * Run a task and mark it done in its group.
+     */
+    void run(Task& task);
+
+    void work(unsigned int worker_idx);
+};
+
+/*!
+ * A set of tasks run on the ThreadPool, to wait for together.
+ */
+class TaskGroup
+{
+public:
+    TaskGroup();
+
+    /*!
+     * Waits for the tasks which are still running.
+     */
+    ~TaskGroup();
+
+    /*!
+     * Run \p function on the pool.
+     */
+    void run(std::function<void ()> function);
+
+    /*!
+     * Wait until all tasks of the group are done, running queued tasks meanwhile.
+     */
+    void wait();
+
+private:
+    friend class ThreadPool;
+
+    std::atomic<unsigned int> n_unfinished;
+    std::mutex mutex;
+    std::condition_variable finished;
+};
+
+}//namespace cura
+
+#endif//UTILS_THREAD_POOL_H
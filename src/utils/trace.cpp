@@ -0,0 +1,191 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#include "trace.h"
+
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace cura {
+
+namespace trace_detail
+{
+std::atomic<bool> enabled(false);
+}
+
+namespace
+{
+
+struct Zone
+{
+    const char* name;
+    int64_t start;
+    int64_t duration;
+    int layer_nr;
+};
+
+struct Counter
+{
+    const char* name;
+    int64_t time;
+    std::vector<std::pair<const char*, double>> values;
+};
+
+/*!
+ * The zones of one thread. They are kept after the thread ends, until the trace is written.
+ */
+struct ThreadZones
+{
+    unsigned int lane; //!< The track on which the zones are shown; reused by a later thread once this thread has ended
+    std::vector<Zone> zones;
+};
+
+std::mutex trace_mutex; // guards the below
+std::chrono::steady_clock::time_point trace_start;
+std::vector<std::unique_ptr<ThreadZones>> all_thread_zones;
+std::vector<bool> lanes_in_use;
+std::vector<Counter> counters;
+
+/*!
+ * The zones of the current thread, which gives its lane free when the thread ends.
+ * The workers of parallelFor only live for one call, so without reusing the lanes every call would show up as new threads.
+ */
+struct ThreadLane
+{
+    ThreadZones* thread_zones = nullptr;
+
+    ThreadZones& get()
+    {
+        if (!thread_zones)
+        {
+            std::lock_guard<std::mutex> lock(trace_mutex);
+            unsigned int lane = 0;
+            while (lane < lanes_in_use.size() && lanes_in_use[lane])
+            {
+                lane++;
+            }
+            if (lane == lanes_in_use.size())
+            {
+                lanes_in_use.push_back(false);
+            }
+            lanes_in_use[lane] = true;
+            all_thread_zones.emplace_back(new ThreadZones());
+            thread_zones = all_thread_zones.back().get();
+            thread_zones->lane = lane;
+        }
+        return *thread_zones;
+    }
+
+    ~ThreadLane()
+    {
+        if (thread_zones)
+        {
+            std::lock_guard<std::mutex> lock(trace_mutex);
+            lanes_in_use[thread_zones->lane] = false;
+        }
+    }
+};
+
+thread_local ThreadLane thread_lane;
+
+}//anonymous namespace
+
+namespace trace_detail
+{
+
+int64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - trace_start).count();
+}
+
+void addZone(const char* name, int64_t start, int64_t end, int layer_nr)
+{
+    thread_lane.get().zones.push_back(Zone{name, start, end - start, layer_nr});
+}
+
+}//namespace trace_detail
+
+void startTrace()
+{
+    {
+        std::lock_guard<std::mutex> lock(trace_mutex);
+        trace_start = std::chrono::steady_clock::now();
+    }
+    trace_detail::enabled = true;
+}
+
+void traceCounter(const char* name, const std::vector<std::pair<const char*, double>>& values)
+{
+    if (isTraceEnabled())
+    {
+        int64_t time = trace_detail::now();
+        std::lock_guard<std::mutex> lock(trace_mutex);
+        counters.push_back(Counter{name, time, values});
+    }
+}
+
+bool writeTrace(const std::string& filename)
+{
+    std::ofstream out(filename);
+    if (!out.is_open())
+    {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    out << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"CuraEngine\"}}";
+    for (unsigned int lane = 0; lane < lanes_in_use.size(); lane++)
+    {
+        out << ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << lane << ", \"args\": {\"name\": \"thread " << lane << "\"}}";
+    }
+    for (const std::unique_ptr<ThreadZones>& thread_zones : all_thread_zones)
+    {
+        for (const Zone& zone : thread_zones->zones)
+        {
+            out << ",\n{\"name\": \"" << zone.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << thread_zones->lane << ", \"ts\": " << zone.start << ", \"dur\": " << zone.duration;
+            if (zone.layer_nr >= 0)
+            {
+                out << ", \"args\": {\"layer\": " << zone.layer_nr << "}";
+            }
+            out << "}";
+        }
+    }
+    for (const Counter& counter : counters)
+    {
+        out << ",\n{\"name\": \"" << counter.name << "\", \"ph\": \"C\", \"pid\": 1, \"ts\": " << counter.time << ", \"args\": {";
+        for (unsigned int value_idx = 0; value_idx < counter.values.size(); value_idx++)
+        {
+            out << ((value_idx > 0)? ", \"" : "\"") << counter.values[value_idx].first << "\": " << counter.values[value_idx].second;
+        }
+        out << "}}";
+    }
+    out << "\n]}\n";
+    return out.good();
+}
+
+std::map<std::string, double> getTraceTotals()
+{
+    std::map<std::string, double> totals;
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    for (const std::unique_ptr<ThreadZones>& thread_zones : all_thread_zones)
+    {
+        for (const Zone& zone : thread_zones->zones)
+        {
+            totals[zone.name] += zone.duration / 1000000.0;
+        }
+    }
+    return totals;
+}
+
+void clearTrace()
+{
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    for (const std::unique_ptr<ThreadZones>& thread_zones : all_thread_zones)
+    {
+        thread_zones->zones.clear();
+    }
+    counters.clear();
+}
+
+}//namespace cura
@@ -0,0 +1,119 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#ifndef UTILS_TRACE_H
+#define UTILS_TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+The trace records how long each stage, layer and geometry kernel takes on which thread, so that the time spent on a
+model and the way the parallel stages use the threads can be looked at in chrome://tracing or https://ui.perfetto.dev.
+
+A TraceZone records the time from its construction to its destruction. While the trace isn't started a zone only checks
+a flag, so zones can be placed in code which is run millions of times. Each thread keeps its own zones, so recording
+takes no locks either, except for the first zone of a thread.
+*/
+namespace cura {
+
+namespace trace_detail
+{
+extern std::atomic<bool> enabled;
+
+int64_t now(); //!< The time since the trace was started, in microseconds
+void addZone(const char* name, int64_t start, int64_t end, int layer_nr);
+}
+
+/*!
+ * Start recording the zones of all threads.
+ */
+void startTrace();
+
+/*!
+ * Whether the trace is being recorded.
+ */
+inline bool isTraceEnabled()
+{
+    return trace_detail::enabled.load(std::memory_order_relaxed);
+}
+
+/*!
+ * Record the values of a counter at this time, shown as a graph under the threads; e.g. the memory used by each kind of
+ * data. Does nothing while the trace isn't started.
+ *
+ * \param name The name of the counter, a string literal
+ * \param values The name, a string literal, and the value of each series of the counter
+ */
+void traceCounter(const char* name, const std::vector<std::pair<const char*, double>>& values);
+
+/*!
+ * Write all zones and counters recorded so far in the Chrome trace event format. No zone may be open on another thread at the time.
+ *
+ * \param filename The file to write, normally named trace.json
+ * \return Whether the file could be written
+ */
+bool writeTrace(const std::string& filename);
+
+/*!
+ * The total duration of the zones recorded so far, by name, in seconds; nested zones count toward each of the zones they
+ * are in. No zone may be open on another thread at the time.
+ */
+std::map<std::string, double> getTraceTotals();
+
+/*!
+ * Forget the zones and counters recorded so far. No zone may be open on another thread at the time.
+ */
+void clearTrace();
+
+/*!
+ * Records the time from its construction to its destruction under a name, when the trace is enabled.
+ */
+class TraceZone
+{
+    const char* name;
+    int layer_nr;
+    int64_t start; //!< -1 when the trace was disabled at construction
+public:
+    /*!
+     * \param name The name of the zone; a string literal, as it is only copied when the trace is written
+     * \param layer_nr The layer which the zone processes, shown with the zone; -1 for none
+     */
+    TraceZone(const char* name, int layer_nr = -1)
+    : name(name)
+    , layer_nr(layer_nr)
+    , start(isTraceEnabled()? trace_detail::now() : -1)
+    {
+    }
+
+    ~TraceZone()
+    {
+        end();
+    }
+
+    /*!
+     * End the zone before the end of its scope.
+     */
+    void end()
+    {
+        if (start >= 0)
+        {
+            trace_detail::addZone(name, start, trace_detail::now(), layer_nr);
+            start = -1;
+        }
+    }
+
+    TraceZone(const TraceZone&) = delete;
+    TraceZone& operator=(const TraceZone&) = delete;
+};
+
+#define TRACE_ZONE_NAME_(line) trace_zone_##line
+#define TRACE_ZONE_NAME(line) TRACE_ZONE_NAME_(line)
+//! Record the rest of the current scope as a zone; optionally with the layer number as second argument.
+#define TRACE_ZONE(...) cura::TraceZone TRACE_ZONE_NAME(__LINE__)(__VA_ARGS__)
+
+}//namespace cura
+
+#endif//UTILS_TRACE_H
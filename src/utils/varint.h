@@ -0,0 +1,93 @@
+/** Copyright (C) 2017 Yuenyong Nilsiam */
+#ifndef UTILS_VARINT_H
+#define UTILS_VARINT_H
+
+#include <cstdint>
+#include <vector>
+
+namespace cura
+{
+
+/*!
+ * Append \p value as a little endian varint: 7 bits per byte, with the high bit set on all bytes but the last.
+ */
+inline void writeVarInt(std::vector<unsigned char>& out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(value);
+}
+
+/*!
+ * Append \p value as a zigzag encoded varint, so small negative values take few bytes as well.
+ */
+inline void writeSignedVarInt(std::vector<unsigned char>& out, int64_t value)
+{
+    writeVarInt(out, (uint64_t(value) << 1) ^ uint64_t(value >> 63)); // zigzag encoding
+}
+
+//! Reads varints from a buffer, remembering whether it ran out of data.
+class VarIntReader
+{
+public:
+    VarIntReader(const std::vector<unsigned char>& data, size_t pos)
+    : data(data.data()), size(data.size()), pos(pos), failed(false)
+    {
+    }
+
+    //! Read from \p size bytes at \p data, such as a memory mapped file.
+    VarIntReader(const unsigned char* data, size_t size, size_t pos)
+    : data(data), size(size), pos(pos), failed(false)
+    {
+    }
+
+    uint64_t readVarInt()
+    {
+        uint64_t value = 0;
+        for (unsigned int shift = 0; shift < 64; shift += 7)
+        {
+            if (pos >= size)
+            {
+                break;
+            }
+            unsigned char byte = data[pos++];
+            value |= uint64_t(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+            {
+                return value;
+            }
+        }
+        failed = true;
+        return 0;
+    }
+
+    int64_t readSignedVarInt()
+    {
+        uint64_t value = readVarInt();
+        return int64_t(value >> 1) ^ -int64_t(value & 1);
+    }
+
+    //! Read a count of items which each take up at least one byte, failing when the count can't be right.
+    uint64_t readCount()
+    {
+        uint64_t count = readVarInt();
+        if (count > size - pos)
+        {
+            failed = true;
+            return 0;
+        }
+        return count;
+    }
+
+    const unsigned char* data;
+    size_t size;
+    size_t pos;
+    bool failed;
+};
+
+}//namespace cura
+
+#endif//UTILS_VARINT_H
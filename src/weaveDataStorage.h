@@ -2,6 +2,8 @@
 #ifndef WEAVE_DATA_STORAGE_H
 #define WEAVE_DATA_STORAGE_H
 
+#include <deque>
+
 #include "utils/intpoint.h"
 #include "utils/polygon.h"
 #include "mesh.h"
@@ -73,7 +75,8 @@ struct WireFrame
     WeaveRoof bottom_infill;
     Polygons bottom_outline;
     int z_bottom;
-    std::vector<WeaveLayer> layers;
+    std::deque<WeaveLayer> layers; //!< The layers which are being generated, see Weaver::weave
+    unsigned int max_layer_count; //!< The number of layers there are at most, for reporting the progress
 };
     
 
@@ -8,13 +8,20 @@ import stat
 
 def main(engine, model_path):
 	filenames = sorted(os.listdir(model_path), key=lambda filename: os.stat(os.path.join(model_path, filename)).st_size)
-	filenames = list(filter(lambda filename: filename.lower().endswith('.stl'), filenames))
+	filenames = list(filter(lambda filename: os.path.splitext(filename.lower())[1] in ('.stl', '.obj', '.ply', '.3mf'), filenames))
 	for filename in filenames:
 		print("Slicing: %s (%d/%d)" % (filename, filenames.index(filename), len(filenames)))
 		t = time.time()
 		p = subprocess.Popen([engine, '-vv', os.path.join(model_path, filename)], stdin=subprocess.PIPE, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
 		stdout, stderr = p.communicate()
-		if p.wait() != 0:
+		if filename.startswith('malformed'):
+			# A broken model has to be refused with a load error, not crash the engine.
+			if p.wait() < 0 or b'Failed to load model' not in stderr:
+				print ("Engine didn't refuse malformed test object: %s" % (filename))
+				print(stderr.decode('utf-8', 'replace').split('\n')[-5:])
+				sys.exit(1)
+			print("Refused in: %f" % (time.time() - t))
+		elif p.wait() != 0:
 			print ("Engine failed to report success on test object: %s" % (filename))
 			print(stderr.decode('utf-8', 'replace').split('\n')[-5:])
 			sys.exit(1)